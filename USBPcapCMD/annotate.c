@@ -0,0 +1,201 @@
+/*
+ * Copyright (c) 2026 Tomasz Moń <desowin@gmail.com>
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "annotate.h"
+#include "ioengine.h"
+
+#define ANNOTATE_PIPE_PREFIX "\\\\.\\pipe\\"
+
+static void annotate_pipe_connect(annotate_pipe *pipe);
+
+static void annotate_pipe_read(annotate_pipe *pipe)
+{
+    DWORD err;
+
+    ResetEvent(pipe->overlapped.hEvent);
+    if (ReadFile(pipe->pipe, pipe->buf, sizeof(pipe->buf), NULL, &pipe->overlapped))
+    {
+        /* Completed immediately, event is signalled */
+        return;
+    }
+
+    err = GetLastError();
+    if ((err == ERROR_IO_PENDING) || (err == ERROR_MORE_DATA))
+    {
+        return;
+    }
+
+    /* Client has disconnected. Wait for next one. */
+    DisconnectNamedPipe(pipe->pipe);
+    annotate_pipe_connect(pipe);
+}
+
+static void annotate_pipe_connect(annotate_pipe *pipe)
+{
+    DWORD err;
+
+    pipe->connected = FALSE;
+    ResetEvent(pipe->overlapped.hEvent);
+    if (ConnectNamedPipe(pipe->pipe, &pipe->overlapped))
+    {
+        return;
+    }
+
+    err = GetLastError();
+    if (err == ERROR_PIPE_CONNECTED)
+    {
+        /* Client connected between pipe creation and this call */
+        pipe->connected = TRUE;
+        annotate_pipe_read(pipe);
+    }
+    else if (err != ERROR_IO_PENDING)
+    {
+        fprintf(stderr, "ConnectNamedPipe() on annotation pipe failed - %d\n", err);
+    }
+}
+
+static void annotate_write(annotate_pipe *pipe, HANDLE device, DWORD bytes)
+{
+    OVERLAPPED overlapped;
+    DWORD written;
+
+    if (bytes == 0)
+    {
+        return;
+    }
+
+    /* Capture handle is attached to read_thread() completion port, this
+     * write is waited for here instead.
+     */
+    ResetEvent(pipe->write_overlapped.hEvent);
+    overlapped = pipe->write_overlapped;
+    overlapped.hEvent = IO_UNQUEUED_EVENT(pipe->write_overlapped.hEvent);
+    if (!WriteFile(device, pipe->buf, bytes, NULL, &overlapped) &&
+        (GetLastError() != ERROR_IO_PENDING))
+    {
+        fprintf(stderr, "Failed to write annotation - %d\n", GetLastError());
+        return;
+    }
+
+    if (!GetOverlappedResult(device, &overlapped, &written, TRUE))
+    {
+        fprintf(stderr, "Failed to write annotation - %d\n", GetLastError());
+    }
+}
+
+BOOL annotate_pipe_open(annotate_pipe *pipe, const char *name)
+{
+    char *path;
+
+    memset(pipe, 0, sizeof(annotate_pipe));
+
+    path = malloc(sizeof(ANNOTATE_PIPE_PREFIX) + strlen(name));
+    if (path == NULL)
+    {
+        fprintf(stderr, "Failed to allocate annotation pipe name\n");
+        return FALSE;
+    }
+    sprintf(path, "%s%s", ANNOTATE_PIPE_PREFIX, name);
+
+    pipe->pipe = CreateNamedPipeA(path,
+                                  PIPE_ACCESS_INBOUND | FILE_FLAG_FIRST_PIPE_INSTANCE | FILE_FLAG_OVERLAPPED,
+                                  PIPE_TYPE_MESSAGE | PIPE_READMODE_MESSAGE | PIPE_WAIT,
+                                  1 /* Max instances of pipe */,
+                                  0, USBPCAP_MAX_ANNOTATION_LENGTH,
+                                  0, NULL);
+    if (pipe->pipe == INVALID_HANDLE_VALUE)
+    {
+        fprintf(stderr, "Failed to create annotation pipe %s - %d\n", path, GetLastError());
+        free(path);
+        pipe->pipe = NULL;
+        return FALSE;
+    }
+    free(path);
+
+    pipe->overlapped.hEvent = CreateEvent(NULL,
+                                          TRUE /* Manual Reset */,
+                                          FALSE /* Default non signaled */,
+                                          NULL /* No name */);
+    pipe->write_overlapped.hEvent = CreateEvent(NULL,
+                                                TRUE /* Manual Reset */,
+                                                FALSE /* Default non signaled */,
+                                                NULL /* No name */);
+    if ((pipe->overlapped.hEvent == NULL) || (pipe->write_overlapped.hEvent == NULL))
+    {
+        fprintf(stderr, "Failed to create annotation pipe events\n");
+        annotate_pipe_close(pipe);
+        return FALSE;
+    }
+
+    annotate_pipe_connect(pipe);
+    return TRUE;
+}
+
+HANDLE annotate_pipe_event(annotate_pipe *pipe)
+{
+    return pipe->overlapped.hEvent;
+}
+
+void annotate_pipe_process(annotate_pipe *pipe, HANDLE device)
+{
+    DWORD bytes;
+    DWORD err;
+
+    if (!pipe->connected)
+    {
+        /* Client connected */
+        pipe->connected = TRUE;
+        annotate_pipe_read(pipe);
+        return;
+    }
+
+    if (GetOverlappedResult(pipe->pipe, &pipe->overlapped, &bytes, FALSE))
+    {
+        annotate_write(pipe, device, bytes);
+        annotate_pipe_read(pipe);
+        return;
+    }
+
+    err = GetLastError();
+    if (err == ERROR_MORE_DATA)
+    {
+        /* Remaining part of the message is returned by next read */
+        annotate_write(pipe, device, bytes);
+        annotate_pipe_read(pipe);
+    }
+    else if (err == ERROR_IO_INCOMPLETE)
+    {
+        /* Spurious wake up */
+    }
+    else
+    {
+        DisconnectNamedPipe(pipe->pipe);
+        annotate_pipe_connect(pipe);
+    }
+}
+
+void annotate_pipe_close(annotate_pipe *pipe)
+{
+    if (pipe->pipe != NULL)
+    {
+        CancelIo(pipe->pipe);
+        CloseHandle(pipe->pipe);
+        pipe->pipe = NULL;
+    }
+    if (pipe->overlapped.hEvent != NULL)
+    {
+        CloseHandle(pipe->overlapped.hEvent);
+        pipe->overlapped.hEvent = NULL;
+    }
+    if (pipe->write_overlapped.hEvent != NULL)
+    {
+        CloseHandle(pipe->write_overlapped.hEvent);
+        pipe->write_overlapped.hEvent = NULL;
+    }
+}
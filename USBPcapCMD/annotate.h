@@ -0,0 +1,42 @@
+/*
+ * Copyright (c) 2026 Tomasz Moń <desowin@gmail.com>
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#ifndef USBPCAP_CMD_ANNOTATE_H
+#define USBPCAP_CMD_ANNOTATE_H
+
+#include <windows.h>
+#include "USBPcap.h"
+
+/* Named pipe server that forwards every message written to the pipe to
+ * the capture handle. Driver stores each one as USBPCAP_INFO_ANNOTATION
+ * packet, so external tools (e.g. test harness) can mark events in the
+ * capture with the same clock as captured URBs.
+ *
+ * Only one client can be connected at a time. After the client closes
+ * the pipe, another one can connect. Messages longer than
+ * USBPCAP_MAX_ANNOTATION_LENGTH are split into several annotations.
+ */
+typedef struct
+{
+    HANDLE pipe;
+    OVERLAPPED overlapped;       /* Used for connect and read */
+    OVERLAPPED write_overlapped; /* Used for writes to capture handle */
+    BOOL connected;
+    unsigned char buf[USBPCAP_MAX_ANNOTATION_LENGTH];
+} annotate_pipe;
+
+/* Creates \\.\pipe\<name> and starts waiting for client */
+BOOL annotate_pipe_open(annotate_pipe *pipe, const char *name);
+
+/* Returns event that is signalled when annotate_pipe_process() should be called */
+HANDLE annotate_pipe_event(annotate_pipe *pipe);
+
+/* Handles client connection or received message. Messages are written to device. */
+void annotate_pipe_process(annotate_pipe *pipe, HANDLE device);
+
+void annotate_pipe_close(annotate_pipe *pipe);
+
+#endif /* USBPCAP_CMD_ANNOTATE_H */
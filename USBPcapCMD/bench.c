@@ -0,0 +1,598 @@
+/*
+ * Copyright (c) 2026 Tomasz Moń <desowin@gmail.com>
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "bench.h"
+#include "USBPcap.h"
+
+#define BENCH_DEFAULT_SIZE      64
+#define BENCH_DEFAULT_DURATION  10
+#define BENCH_SWEEP_START_RATE  1000
+#define BENCH_SWEEP_MAX_RATE    100000000
+
+/* Latency histogram bucket i counts packets read within 2^(i+1)
+ * microseconds. The last bucket counts everything above.
+ */
+#define BENCH_HIST_BUCKETS      32
+
+/* Small pipe buffer keeps the backlog in producer buffer, where it is
+ * counted and dropped the same way as in the driver.
+ */
+#define BENCH_PIPE_BUFFER       4096
+
+/* URB_FUNCTION_BULK_OR_INTERRUPT_TRANSFER */
+#define BENCH_URB_FUNCTION_BULK 0x0009
+
+typedef struct
+{
+    UINT32 size;
+    UINT32 rate;
+    UINT32 burst;
+    UINT32 duration;
+    BOOL sweep;
+} bench_options;
+
+typedef struct
+{
+    const bench_options *options;
+    UINT32 rate;
+    LARGE_INTEGER frequency;
+    LARGE_INTEGER start;
+    HANDLE pipe;                 /* Server end, read_thread() has the client */
+    pcap_hdr_t header;
+
+    /* Template of generated record */
+    unsigned char *record;
+    UINT32 record_size;
+
+    /* Producer buffer holds whole records. stored is the time each was
+     * generated at.
+     */
+    CRITICAL_SECTION lock;
+    HANDLE data_event;
+    unsigned char *buffer;
+    LONGLONG *stored;
+    UINT32 capacity;
+    UINT32 head;
+    UINT32 count;
+    volatile LONG producing;
+    volatile LONG stopping;      /* Set when read_thread() has quit */
+    BOOL failed;
+
+    UINT64 generated;
+    UINT64 lost;
+    UINT64 delivered;
+    UINT64 buckets[BENCH_HIST_BUCKETS];
+    UINT64 max_latency;
+} bench_state;
+
+static BOOL bench_parse(const char *spec, bench_options *options)
+{
+    char *copy;
+    char *token;
+    char *context = NULL;
+    BOOL ok = TRUE;
+
+    options->size = BENCH_DEFAULT_SIZE;
+    options->rate = 0;
+    options->burst = 1;
+    options->duration = BENCH_DEFAULT_DURATION;
+    options->sweep = FALSE;
+
+    copy = _strdup(spec);
+    if (copy == NULL)
+    {
+        return FALSE;
+    }
+
+    for (token = strtok_s(copy, ",", &context); (token != NULL) && ok;
+         token = strtok_s(NULL, ",", &context))
+    {
+        char *value = strchr(token, '=');
+
+        if (value != NULL)
+        {
+            *value++ = '\0';
+        }
+
+        if (strcmp(token, "sweep") == 0)
+        {
+            options->sweep = TRUE;
+        }
+        else if (value == NULL)
+        {
+            ok = FALSE;
+        }
+        else if (strcmp(token, "size") == 0)
+        {
+            options->size = atol(value);
+        }
+        else if (strcmp(token, "rate") == 0)
+        {
+            options->rate = atol(value);
+        }
+        else if (strcmp(token, "burst") == 0)
+        {
+            options->burst = atol(value);
+        }
+        else if (strcmp(token, "duration") == 0)
+        {
+            options->duration = atol(value);
+        }
+        else
+        {
+            ok = FALSE;
+        }
+    }
+
+    if (!ok)
+    {
+        fprintf(stderr, "Invalid benchmark setting '%s'.\n", token);
+    }
+    else if ((options->burst == 0) || (options->duration == 0))
+    {
+        fprintf(stderr, "Benchmark burst and duration must be at least 1.\n");
+        ok = FALSE;
+    }
+
+    free(copy);
+    return ok;
+}
+
+static DWORD WINAPI bench_producer(LPVOID param)
+{
+    bench_state *state = (bench_state *)param;
+    pcaprec_hdr_t *hdr = (pcaprec_hdr_t *)state->record;
+    PUSBPCAP_BUFFER_PACKET_HEADER packet =
+        (PUSBPCAP_BUFFER_PACKET_HEADER)&state->record[sizeof(pcaprec_hdr_t)];
+    LONGLONG frequency = state->frequency.QuadPart;
+    LONGLONG end = state->options->duration * frequency;
+    UINT32 burst = state->options->burst;
+
+    for (;;)
+    {
+        LARGE_INTEGER now;
+        LONGLONG elapsed;
+        UINT64 due;
+        UINT64 usec;
+
+        QueryPerformanceCounter(&now);
+        elapsed = now.QuadPart - state->start.QuadPart;
+        if ((elapsed >= end) || state->stopping)
+        {
+            break;
+        }
+
+        if (state->rate == 0)
+        {
+            due = state->generated + burst;
+        }
+        else
+        {
+            due = (elapsed / frequency) * state->rate +
+                  (elapsed % frequency) * state->rate / frequency;
+            due -= due % burst;
+        }
+
+        if (state->generated >= due)
+        {
+            /* Sleep(1) can take whole scheduler tick, only use it when
+             * next burst is not due soon. Late bursts are caught up.
+             */
+            LONGLONG next = (LONGLONG)((state->generated + burst) * frequency / state->rate);
+            Sleep(((next - elapsed) * 1000 / frequency > 2) ? 1 : 0);
+            continue;
+        }
+
+        usec = elapsed * 1000000 / frequency;
+        hdr->ts_sec = (UINT32)(usec / 1000000);
+        hdr->ts_usec = (UINT32)(usec % 1000000);
+
+        EnterCriticalSection(&state->lock);
+        while (state->generated < due)
+        {
+            if (state->count == state->capacity)
+            {
+                /* Buffer full, driver drops the packet too */
+                state->lost++;
+            }
+            else
+            {
+                UINT32 slot = (state->head + state->count) % state->capacity;
+
+                packet->irpId = state->generated;
+                memcpy(&state->buffer[(SIZE_T)slot * state->record_size],
+                       state->record, state->record_size);
+                state->stored[slot] = now.QuadPart;
+                state->count++;
+            }
+            state->generated++;
+        }
+        LeaveCriticalSection(&state->lock);
+        SetEvent(state->data_event);
+    }
+
+    InterlockedExchange(&state->producing, FALSE);
+    SetEvent(state->data_event);
+    return 0;
+}
+
+static void bench_account(bench_state *state, const LONGLONG *times, UINT32 count)
+{
+    LARGE_INTEGER now;
+    UINT32 i;
+
+    QueryPerformanceCounter(&now);
+    for (i = 0; i < count; i++)
+    {
+        UINT64 latency = (now.QuadPart - times[i]) * 1000000 / state->frequency.QuadPart;
+        int bucket = 0;
+
+        while ((bucket < BENCH_HIST_BUCKETS - 1) && (latency >= ((UINT64)2 << bucket)))
+        {
+            bucket++;
+        }
+        state->buckets[bucket]++;
+        if (latency > state->max_latency)
+        {
+            state->max_latency = latency;
+        }
+    }
+    state->delivered += count;
+}
+
+/* Hands out buffered records like driver completes reads. Closes pipe
+ * after producer has finished and everything was read, or when reader is
+ * gone.
+ */
+static DWORD WINAPI bench_pump(LPVOID param)
+{
+    bench_state *state = (bench_state *)param;
+    UINT32 chunk_records = state->capacity;
+    unsigned char *chunk;
+    LONGLONG *times;
+    DWORD written;
+
+    chunk = (unsigned char *)malloc((SIZE_T)chunk_records * state->record_size);
+    times = (LONGLONG *)malloc(chunk_records * sizeof(LONGLONG));
+    if ((chunk == NULL) || (times == NULL) ||
+        !WriteFile(state->pipe, &state->header, sizeof(pcap_hdr_t), &written, NULL))
+    {
+        state->failed = TRUE;
+        goto finish;
+    }
+
+    for (;;)
+    {
+        /* Read before the buffer, producer stores everything first */
+        LONG producing = state->producing;
+        UINT32 count;
+        UINT32 first;
+        UINT32 rest;
+
+        EnterCriticalSection(&state->lock);
+        count = min(state->count, chunk_records);
+        first = min(count, state->capacity - state->head);
+        rest = count - first;
+        memcpy(chunk, &state->buffer[(SIZE_T)state->head * state->record_size],
+               (SIZE_T)first * state->record_size);
+        memcpy(&chunk[(SIZE_T)first * state->record_size], state->buffer,
+               (SIZE_T)rest * state->record_size);
+        memcpy(times, &state->stored[state->head], first * sizeof(LONGLONG));
+        memcpy(&times[first], state->stored, rest * sizeof(LONGLONG));
+        state->head = (state->head + count) % state->capacity;
+        state->count -= count;
+        LeaveCriticalSection(&state->lock);
+
+        if (count == 0)
+        {
+            if (!producing)
+            {
+                break;
+            }
+            WaitForSingleObject(state->data_event, INFINITE);
+            continue;
+        }
+
+        /* Returns once read_thread() has taken most of it */
+        if (!WriteFile(state->pipe, chunk, count * state->record_size, &written, NULL))
+        {
+            /* read_thread() has stopped, reason is already printed */
+            state->failed = TRUE;
+            goto finish;
+        }
+        bench_account(state, times, count);
+    }
+
+    /* Let read_thread() get the rest before it sees broken pipe */
+    FlushFileBuffers(state->pipe);
+
+finish:
+    CloseHandle(state->pipe);
+    free(chunk);
+    free(times);
+    return 0;
+}
+
+static UINT64 bench_percentile(const bench_state *state, UINT32 per_mille)
+{
+    UINT64 threshold = (state->delivered * per_mille + 999) / 1000;
+    UINT64 total = 0;
+    int i;
+
+    if (state->delivered == 0)
+    {
+        return 0;
+    }
+
+    for (i = 0; i < BENCH_HIST_BUCKETS - 1; i++)
+    {
+        total += state->buckets[i];
+        if (total >= threshold)
+        {
+            return (UINT64)2 << i;
+        }
+    }
+    return state->max_latency;
+}
+
+/* Runs one benchmark capture. Returns FALSE if it could not complete. */
+static BOOL bench_capture(struct thread_data *data, bench_state *state)
+{
+    char name[64];
+    HANDLE producer;
+    HANDLE pump;
+    HANDLE reader;
+    LARGE_INTEGER end;
+    double seconds;
+
+    sprintf_s(name, sizeof(name), "\\\\.\\pipe\\USBPcapBench-%u", GetCurrentProcessId());
+    state->pipe = CreateNamedPipeA(name,
+                                   PIPE_ACCESS_OUTBOUND | FILE_FLAG_FIRST_PIPE_INSTANCE,
+                                   PIPE_TYPE_BYTE | PIPE_WAIT,
+                                   1 /* Max instances of pipe */,
+                                   BENCH_PIPE_BUFFER, BENCH_PIPE_BUFFER,
+                                   0, NULL);
+    if (state->pipe == INVALID_HANDLE_VALUE)
+    {
+        fprintf(stderr, "Failed to create benchmark pipe - %d\n", GetLastError());
+        return FALSE;
+    }
+
+    /* read_thread() reads the client end, just like capture service pipe */
+    data->read_handle = CreateFileA(name, GENERIC_READ, 0, NULL, OPEN_EXISTING,
+                                    FILE_FLAG_OVERLAPPED, NULL);
+    if (data->read_handle == INVALID_HANDLE_VALUE)
+    {
+        fprintf(stderr, "Failed to open benchmark pipe - %d\n", GetLastError());
+        CloseHandle(state->pipe);
+        return FALSE;
+    }
+    data->read_connected = TRUE;
+    data->process = TRUE;
+    memset(&data->descriptors, 0, sizeof(data->descriptors));
+
+    state->head = 0;
+    state->count = 0;
+    state->generated = 0;
+    state->lost = 0;
+    state->delivered = 0;
+    state->max_latency = 0;
+    memset(state->buckets, 0, sizeof(state->buckets));
+    state->producing = TRUE;
+    state->stopping = FALSE;
+    state->failed = FALSE;
+    ResetEvent(state->data_event);
+
+    reader = CreateThread(NULL, 0, read_thread, data, 0, NULL);
+    if (reader == NULL)
+    {
+        fprintf(stderr, "Failed to create benchmark reader thread\n");
+        CloseHandle(data->read_handle);
+        data->read_handle = INVALID_HANDLE_VALUE;
+        CloseHandle(state->pipe);
+        return FALSE;
+    }
+
+    QueryPerformanceCounter(&state->start);
+    producer = CreateThread(NULL, 0, bench_producer, state, 0, NULL);
+    pump = CreateThread(NULL, 0, bench_pump, state, 0, NULL);
+    if ((producer == NULL) || (pump == NULL))
+    {
+        fprintf(stderr, "Failed to create benchmark threads\n");
+        state->failed = TRUE;
+        InterlockedExchange(&state->producing, FALSE);
+        SetEvent(state->data_event);
+        if (pump == NULL)
+        {
+            CloseHandle(state->pipe);
+        }
+    }
+
+    /* Ends when pump closes the pipe, or on capture failure */
+    WaitForSingleObject(reader, INFINITE);
+    CloseHandle(reader);
+    QueryPerformanceCounter(&end);
+
+    /* Closing client end makes pump give up if read_thread() quit early */
+    InterlockedExchange(&state->stopping, TRUE);
+    CloseHandle(data->read_handle);
+    data->read_handle = INVALID_HANDLE_VALUE;
+    if (pump != NULL)
+    {
+        WaitForSingleObject(pump, INFINITE);
+        CloseHandle(pump);
+    }
+    if (producer != NULL)
+    {
+        WaitForSingleObject(producer, INFINITE);
+        CloseHandle(producer);
+    }
+
+    seconds = (double)(end.QuadPart - state->start.QuadPart) / state->frequency.QuadPart;
+    if (state->rate == 0)
+    {
+        fprintf(stderr, "rate unlimited:");
+    }
+    else
+    {
+        fprintf(stderr, "rate %u/s:", state->rate);
+    }
+    fprintf(stderr, " %I64u generated, %I64u lost (%.2f%%), %.2f MB/s, %.0f packets/s,"
+            " latency us p50 <= %I64u, p90 <= %I64u, p99 <= %I64u, p99.9 <= %I64u, max %I64u\n",
+            state->generated, state->lost,
+            state->generated ? 100.0 * state->lost / state->generated : 0.0,
+            (double)state->delivered * state->record_size / seconds / 1000000.0,
+            (double)state->delivered / seconds,
+            bench_percentile(state, 500), bench_percentile(state, 900),
+            bench_percentile(state, 990), bench_percentile(state, 999),
+            state->max_latency);
+    return !state->failed;
+}
+
+int bench_run(struct thread_data *data, const char *spec)
+{
+    bench_options options;
+    bench_state state;
+    pcaprec_hdr_t *hdr;
+    PUSBPCAP_BUFFER_PACKET_HEADER packet;
+    UINT64 last_lossless = 0;
+    int ret = -1;
+
+    if (!bench_parse(spec, &options))
+    {
+        return -1;
+    }
+
+    memset(&state, 0, sizeof(state));
+    state.options = &options;
+    state.record_size = sizeof(pcaprec_hdr_t) + sizeof(USBPCAP_BUFFER_PACKET_HEADER) + options.size;
+    if (state.record_size > data->bufferlen)
+    {
+        fprintf(stderr, "Benchmark packet does not fit into buffer (-b).\n");
+        return -1;
+    }
+    state.capacity = data->bufferlen / state.record_size;
+    QueryPerformanceFrequency(&state.frequency);
+    InitializeCriticalSection(&state.lock);
+    state.data_event = CreateEvent(NULL, FALSE /* Auto Reset */, FALSE, NULL);
+    state.record = (unsigned char *)calloc(1, state.record_size);
+    state.buffer = (unsigned char *)malloc((SIZE_T)state.capacity * state.record_size);
+    state.stored = (LONGLONG *)malloc(state.capacity * sizeof(LONGLONG));
+    if ((state.data_event == NULL) || (state.record == NULL) ||
+        (state.buffer == NULL) || (state.stored == NULL))
+    {
+        fprintf(stderr, "Failed to allocate benchmark buffers\n");
+        goto cleanup;
+    }
+
+    state.header.magic_number = 0xA1B2C3D4;
+    state.header.version_major = 2;
+    state.header.version_minor = 4;
+    state.header.thiszone = 0;
+    state.header.sigfigs = 0;
+    state.header.snaplen = data->snaplen;
+    state.header.network = DLT_USBPCAP;
+
+    hdr = (pcaprec_hdr_t *)state.record;
+    hdr->incl_len = state.record_size - sizeof(pcaprec_hdr_t);
+    hdr->orig_len = hdr->incl_len;
+    packet = (PUSBPCAP_BUFFER_PACKET_HEADER)&state.record[sizeof(pcaprec_hdr_t)];
+    packet->headerLen = sizeof(USBPCAP_BUFFER_PACKET_HEADER);
+    packet->function = BENCH_URB_FUNCTION_BULK;
+    packet->info = USBPCAP_INFO_PDO_TO_FDO;
+    packet->bus = 1;
+    packet->device = 1;
+    packet->endpoint = 0x81;
+    packet->transfer = USBPCAP_TRANSFER_BULK;
+    packet->dataLength = options.size;
+
+    if (strncmp("-", data->filename, 2) == 0)
+    {
+        data->write_handle = GetStdHandle(STD_OUTPUT_HANDLE);
+    }
+    else
+    {
+        /* Pipes have to exist already, anything else is overwritten */
+        data->write_handle = CreateFileA(data->filename,
+                                         GENERIC_WRITE,
+                                         FILE_SHARE_READ,
+                                         NULL,
+                                         (strncmp(data->filename, "\\\\.\\pipe\\", 9) == 0) ?
+                                         OPEN_EXISTING : CREATE_ALWAYS,
+                                         FILE_ATTRIBUTE_NORMAL|FILE_FLAG_OVERLAPPED,
+                                         NULL);
+    }
+    if (data->write_handle == INVALID_HANDLE_VALUE)
+    {
+        fprintf(stderr, "Failed to open %s - %d\n", data->filename, GetLastError());
+        goto cleanup;
+    }
+
+    fprintf(stderr, "Benchmark: %u byte payload, %u packet bursts, %u s runs, buffer holds %u packets\n",
+            options.size, options.burst, options.duration, state.capacity);
+
+    state.rate = options.rate;
+    if (options.sweep && (state.rate == 0))
+    {
+        state.rate = BENCH_SWEEP_START_RATE;
+    }
+
+    for (;;)
+    {
+        if (!bench_capture(data, &state))
+        {
+            goto cleanup;
+        }
+
+        if (!options.sweep)
+        {
+            break;
+        }
+
+        if (state.lost > 0)
+        {
+            if (last_lossless > 0)
+            {
+                fprintf(stderr, "Packets are lost at %u packets/s, %I64u packets/s was captured without loss\n",
+                        state.rate, last_lossless);
+            }
+            else
+            {
+                fprintf(stderr, "Packets are lost already at %u packets/s\n", state.rate);
+            }
+            break;
+        }
+
+        last_lossless = state.rate;
+        if (state.rate > BENCH_SWEEP_MAX_RATE / 2)
+        {
+            fprintf(stderr, "No loss up to %u packets/s\n", state.rate);
+            break;
+        }
+        state.rate *= 2;
+    }
+    ret = 0;
+
+cleanup:
+    if ((data->write_handle != INVALID_HANDLE_VALUE) &&
+        (strncmp("-", data->filename, 2) != 0))
+    {
+        CloseHandle(data->write_handle);
+    }
+    data->write_handle = INVALID_HANDLE_VALUE;
+    if (state.data_event != NULL)
+    {
+        CloseHandle(state.data_event);
+    }
+    DeleteCriticalSection(&state.lock);
+    free(state.record);
+    free(state.buffer);
+    free(state.stored);
+    return ret;
+}
@@ -0,0 +1,33 @@
+/*
+ * Copyright (c) 2026 Tomasz Moń <desowin@gmail.com>
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#ifndef USBPCAP_CMD_BENCH_H
+#define USBPCAP_CMD_BENCH_H
+
+#include <windows.h>
+#include "thread.h"
+
+/* Capture pipeline benchmark.
+ *
+ * Filter device is replaced by producer thread that generates bulk
+ * packets. Like the driver, it keeps them in buffer of data->bufferlen
+ * bytes and drops new packets when the buffer is full. Packets are read
+ * by read_thread() and go through the same stages and output (file, pipe
+ * or standard output) as a live capture.
+ *
+ * spec is comma separated list of settings:
+ *   size=<bytes>    payload length, default 64
+ *   rate=<n>        packets per second, 0 (default) as fast as possible
+ *   burst=<n>       packets generated back to back, default 1
+ *   duration=<s>    seconds to generate packets for, default 10
+ *   sweep           doubles rate after every run until packets are lost
+ *
+ * Results are printed to standard error. Latency is the time from packet
+ * generation until read_thread() read it.
+ */
+int bench_run(struct thread_data *data, const char *spec);
+
+#endif /* USBPCAP_CMD_BENCH_H */
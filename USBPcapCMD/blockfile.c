@@ -0,0 +1,1010 @@
+/*
+ * Copyright (c) 2026 Tomasz Moń <desowin@gmail.com>
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <io.h>
+#include "blockfile.h"
+#include "lzblock.h"
+#include "pcapfile.h"
+
+/* Blocks of single writer that can be filled, compressed or waiting for
+ * write at the same time. Producer only waits when all of them are
+ * waiting for the disk.
+ */
+#define BLOCKFILE_SLOTS        16
+
+#define BLOCKFILE_MAX_WORKERS  16
+
+/* Blocks waiting for compression per worker. Blocks submitted when the
+ * queue is longer are stored uncompressed so compression never limits
+ * the capture rate.
+ */
+#define BLOCKFILE_QUEUE_DEPTH  2
+
+typedef struct _blockfile_slot
+{
+    blockfile_writer *writer;
+    unsigned char *data;    /* BLOCKFILE_BLOCK followed by block_size bytes */
+    unsigned char *packed;  /* BLOCKFILE_BLOCK followed by compressed data */
+    UINT32 length;
+    UINT32 packed_length;   /* 0 if block is stored uncompressed */
+    UINT64 seq;
+    volatile LONG done;
+    struct _blockfile_slot *next;
+} blockfile_slot;
+
+struct _blockfile_writer
+{
+    HANDLE handle;
+    HANDLE io_event;
+    UINT32 block_size;
+    blockfile_slot slots[BLOCKFILE_SLOTS];
+    blockfile_slot *current;
+    UINT64 next_seq;
+    HANDLE free_sem;        /* Counts slots that can be filled */
+    volatile LONG failed;
+    volatile LONG queued;   /* Blocks in pool queue or being compressed */
+    HANDLE idle_event;      /* Set when queued drops to zero */
+
+    /* Lock serializes writes and guards the fields below */
+    CRITICAL_SECTION lock;
+    UINT64 write_seq;
+    UINT64 file_offset;
+    UINT64 offset;
+    BLOCKFILE_INDEX_ENTRY *index;
+    UINT32 index_count;
+    UINT32 index_size;
+};
+
+static struct
+{
+    LONG users;
+    int count;
+    HANDLE threads[BLOCKFILE_MAX_WORKERS];
+    CRITICAL_SECTION lock;
+    HANDLE queue_sem;
+    blockfile_slot *head;
+    blockfile_slot *tail;
+    volatile LONG queued;
+} blockfile_pool;
+
+static BOOL blockfile_write_at(HANDLE handle, HANDLE event, UINT64 offset,
+                               const void *data, DWORD length)
+{
+    OVERLAPPED overlapped;
+    DWORD written;
+
+    memset(&overlapped, 0, sizeof(overlapped));
+    overlapped.Offset = (DWORD)offset;
+    overlapped.OffsetHigh = (DWORD)(offset >> 32);
+    overlapped.hEvent = event;
+
+    if (!WriteFile(handle, data, length, NULL, &overlapped) &&
+        (GetLastError() != ERROR_IO_PENDING))
+    {
+        return FALSE;
+    }
+
+    if (!GetOverlappedResult(handle, &overlapped, &written, TRUE))
+    {
+        return FALSE;
+    }
+
+    return (written == length);
+}
+
+static void blockfile_add_index(blockfile_writer *writer, UINT32 stored_length,
+                                UINT32 length)
+{
+    PBLOCKFILE_INDEX_ENTRY entry;
+
+    if (writer->index_count == writer->index_size)
+    {
+        UINT32 size = writer->index_size ? writer->index_size * 2 : 1024;
+        PBLOCKFILE_INDEX_ENTRY tmp;
+
+        tmp = realloc(writer->index, size * sizeof(BLOCKFILE_INDEX_ENTRY));
+        if (tmp == NULL)
+        {
+            InterlockedExchange(&writer->failed, TRUE);
+            return;
+        }
+        writer->index = tmp;
+        writer->index_size = size;
+    }
+
+    entry = &writer->index[writer->index_count++];
+    entry->fileOffset = writer->file_offset;
+    entry->offset = writer->offset;
+    entry->storedLength = stored_length;
+    entry->length = length;
+}
+
+/* Writes all finished blocks that are next in order. Called by every
+ * thread that finishes a block, so no block waits for a dedicated writer.
+ */
+static void blockfile_flush(blockfile_writer *writer)
+{
+    EnterCriticalSection(&writer->lock);
+    for (;;)
+    {
+        blockfile_slot *slot = &writer->slots[writer->write_seq % BLOCKFILE_SLOTS];
+        PBLOCKFILE_BLOCK block;
+        UINT32 stored_length;
+
+        if ((slot->done == 0) || (slot->seq != writer->write_seq))
+        {
+            break;
+        }
+        slot->done = 0;
+
+        if (slot->packed_length > 0)
+        {
+            block = (PBLOCKFILE_BLOCK)slot->packed;
+            stored_length = slot->packed_length;
+            block->flags = 0;
+        }
+        else
+        {
+            block = (PBLOCKFILE_BLOCK)slot->data;
+            stored_length = slot->length;
+            block->flags = BLOCKFILE_BLOCK_STORED;
+        }
+        block->storedLength = stored_length;
+        block->length = slot->length;
+
+        if (writer->failed == 0)
+        {
+            if (!blockfile_write_at(writer->handle, writer->io_event, writer->file_offset,
+                                    block, sizeof(BLOCKFILE_BLOCK) + stored_length))
+            {
+                fprintf(stderr, "Failed to write compressed block - %d\n", GetLastError());
+                InterlockedExchange(&writer->failed, TRUE);
+            }
+            else
+            {
+                blockfile_add_index(writer, stored_length, slot->length);
+            }
+        }
+
+        writer->file_offset += sizeof(BLOCKFILE_BLOCK) + stored_length;
+        writer->offset += slot->length;
+        writer->write_seq++;
+        ReleaseSemaphore(writer->free_sem, 1, NULL);
+    }
+    LeaveCriticalSection(&writer->lock);
+}
+
+static DWORD WINAPI blockfile_worker(LPVOID param)
+{
+    void *workmem = malloc(LZ_WORKMEM_SIZE);
+
+    UNREFERENCED_PARAMETER(param);
+
+    for (;;)
+    {
+        blockfile_slot *slot;
+        blockfile_writer *writer;
+
+        WaitForSingleObject(blockfile_pool.queue_sem, INFINITE);
+        EnterCriticalSection(&blockfile_pool.lock);
+        slot = blockfile_pool.head;
+        if (slot != NULL)
+        {
+            blockfile_pool.head = slot->next;
+            if (blockfile_pool.head == NULL)
+            {
+                blockfile_pool.tail = NULL;
+            }
+        }
+        LeaveCriticalSection(&blockfile_pool.lock);
+
+        if (slot == NULL)
+        {
+            /* Stop signal is only sent when every writer is closed */
+            break;
+        }
+
+        slot->packed_length = 0;
+        if (workmem != NULL)
+        {
+            /* Keep compressed data only if it saves at least 1/32 */
+            slot->packed_length = lz_compress(slot->data + sizeof(BLOCKFILE_BLOCK), slot->length,
+                                              slot->packed + sizeof(BLOCKFILE_BLOCK),
+                                              slot->length - (slot->length >> 5), workmem);
+        }
+
+        InterlockedDecrement(&blockfile_pool.queued);
+        InterlockedExchange(&slot->done, TRUE);
+        writer = slot->writer;
+        blockfile_flush(writer);
+
+        /* Writer can be freed as soon as this reaches zero */
+        if (InterlockedDecrement(&writer->queued) == 0)
+        {
+            SetEvent(writer->idle_event);
+        }
+    }
+
+    free(workmem);
+    return 0;
+}
+
+static void blockfile_pool_acquire(void)
+{
+    SYSTEM_INFO info;
+    int count;
+    int i;
+
+    if (blockfile_pool.users++ > 0)
+    {
+        return;
+    }
+
+    InitializeCriticalSection(&blockfile_pool.lock);
+    blockfile_pool.queue_sem = CreateSemaphore(NULL, 0, MAXLONG, NULL);
+    blockfile_pool.head = NULL;
+    blockfile_pool.tail = NULL;
+    blockfile_pool.queued = 0;
+    blockfile_pool.count = 0;
+
+    GetSystemInfo(&info);
+    count = min(max((int)info.dwNumberOfProcessors, 1), BLOCKFILE_MAX_WORKERS);
+
+    for (i = 0; (i < count) && (blockfile_pool.queue_sem != NULL); i++)
+    {
+        HANDLE thread = CreateThread(NULL, 0, blockfile_worker, NULL, 0, NULL);
+        if (thread == NULL)
+        {
+            break;
+        }
+        blockfile_pool.threads[blockfile_pool.count++] = thread;
+    }
+
+    if (blockfile_pool.count == 0)
+    {
+        /* Still usable, every block is then stored uncompressed */
+        fprintf(stderr, "Failed to start compression workers\n");
+    }
+}
+
+static void blockfile_pool_release(void)
+{
+    int i;
+
+    if (--blockfile_pool.users > 0)
+    {
+        return;
+    }
+
+    if (blockfile_pool.count > 0)
+    {
+        ReleaseSemaphore(blockfile_pool.queue_sem, blockfile_pool.count, NULL);
+        WaitForMultipleObjects(blockfile_pool.count, blockfile_pool.threads, TRUE, INFINITE);
+        for (i = 0; i < blockfile_pool.count; i++)
+        {
+            CloseHandle(blockfile_pool.threads[i]);
+        }
+        blockfile_pool.count = 0;
+    }
+
+    if (blockfile_pool.queue_sem != NULL)
+    {
+        CloseHandle(blockfile_pool.queue_sem);
+        blockfile_pool.queue_sem = NULL;
+    }
+    DeleteCriticalSection(&blockfile_pool.lock);
+}
+
+static void blockfile_free_writer(blockfile_writer *writer)
+{
+    int i;
+
+    for (i = 0; i < BLOCKFILE_SLOTS; i++)
+    {
+        free(writer->slots[i].data);
+        free(writer->slots[i].packed);
+    }
+    free(writer->index);
+
+    if (writer->free_sem != NULL)
+    {
+        CloseHandle(writer->free_sem);
+    }
+    if (writer->io_event != NULL)
+    {
+        CloseHandle(writer->io_event);
+    }
+    if (writer->idle_event != NULL)
+    {
+        CloseHandle(writer->idle_event);
+    }
+    DeleteCriticalSection(&writer->lock);
+    free(writer);
+}
+
+blockfile_writer *blockfile_writer_create(HANDLE handle, UINT32 block_size)
+{
+    blockfile_writer *writer;
+    BLOCKFILE_HEADER header;
+
+    if ((block_size == 0) || (block_size > BLOCKFILE_MAX_BLOCK_SIZE))
+    {
+        fprintf(stderr, "Invalid compression block size %u\n", block_size);
+        return NULL;
+    }
+
+    writer = (blockfile_writer *)calloc(1, sizeof(blockfile_writer));
+    if (writer == NULL)
+    {
+        return NULL;
+    }
+
+    InitializeCriticalSection(&writer->lock);
+    writer->handle = handle;
+    writer->block_size = block_size;
+    writer->io_event = CreateEvent(NULL, TRUE, FALSE, NULL);
+    writer->idle_event = CreateEvent(NULL, FALSE, FALSE, NULL);
+    writer->free_sem = CreateSemaphore(NULL, BLOCKFILE_SLOTS, BLOCKFILE_SLOTS, NULL);
+    if ((writer->io_event == NULL) || (writer->idle_event == NULL) ||
+        (writer->free_sem == NULL))
+    {
+        blockfile_free_writer(writer);
+        return NULL;
+    }
+
+    header.magic = BLOCKFILE_MAGIC;
+    header.version = BLOCKFILE_VERSION;
+    header.reserved = 0;
+    header.blockSize = block_size;
+    if (!blockfile_write_at(handle, writer->io_event, 0, &header, sizeof(header)))
+    {
+        fprintf(stderr, "Failed to write compressed file header - %d\n", GetLastError());
+        blockfile_free_writer(writer);
+        return NULL;
+    }
+    writer->file_offset = sizeof(header);
+
+    blockfile_pool_acquire();
+    return writer;
+}
+
+static BOOL blockfile_next_slot(blockfile_writer *writer)
+{
+    blockfile_slot *slot = &writer->slots[writer->next_seq % BLOCKFILE_SLOTS];
+
+    /* Slots are released in sequence order, so this one is free now */
+    WaitForSingleObject(writer->free_sem, INFINITE);
+
+    if (slot->data == NULL)
+    {
+        slot->data = malloc(sizeof(BLOCKFILE_BLOCK) + writer->block_size);
+        slot->packed = malloc(sizeof(BLOCKFILE_BLOCK) + writer->block_size);
+        if ((slot->data == NULL) || (slot->packed == NULL))
+        {
+            free(slot->data);
+            free(slot->packed);
+            slot->data = NULL;
+            slot->packed = NULL;
+            ReleaseSemaphore(writer->free_sem, 1, NULL);
+            fprintf(stderr, "Failed to allocate compression buffers\n");
+            InterlockedExchange(&writer->failed, TRUE);
+            return FALSE;
+        }
+    }
+
+    slot->writer = writer;
+    slot->length = 0;
+    slot->packed_length = 0;
+    slot->seq = writer->next_seq++;
+    writer->current = slot;
+    return TRUE;
+}
+
+static void blockfile_submit(blockfile_writer *writer)
+{
+    blockfile_slot *slot = writer->current;
+
+    writer->current = NULL;
+
+    if (blockfile_pool.queued >= blockfile_pool.count * BLOCKFILE_QUEUE_DEPTH)
+    {
+        /* Workers are behind, store this block as is */
+        InterlockedExchange(&slot->done, TRUE);
+        blockfile_flush(writer);
+        return;
+    }
+
+    InterlockedIncrement(&writer->queued);
+    InterlockedIncrement(&blockfile_pool.queued);
+    EnterCriticalSection(&blockfile_pool.lock);
+    slot->next = NULL;
+    if (blockfile_pool.tail != NULL)
+    {
+        blockfile_pool.tail->next = slot;
+    }
+    else
+    {
+        blockfile_pool.head = slot;
+    }
+    blockfile_pool.tail = slot;
+    LeaveCriticalSection(&blockfile_pool.lock);
+    ReleaseSemaphore(blockfile_pool.queue_sem, 1, NULL);
+}
+
+BOOL blockfile_write(blockfile_writer *writer, const void *data, UINT32 length)
+{
+    const unsigned char *ptr = (const unsigned char *)data;
+
+    while (length > 0)
+    {
+        blockfile_slot *slot;
+        UINT32 chunk;
+
+        if ((writer->current == NULL) && !blockfile_next_slot(writer))
+        {
+            return FALSE;
+        }
+        slot = writer->current;
+
+        chunk = min(length, writer->block_size - slot->length);
+        memcpy(slot->data + sizeof(BLOCKFILE_BLOCK) + slot->length, ptr, chunk);
+        slot->length += chunk;
+        ptr += chunk;
+        length -= chunk;
+
+        if (slot->length == writer->block_size)
+        {
+            blockfile_submit(writer);
+        }
+    }
+
+    return (writer->failed == 0);
+}
+
+BOOL blockfile_writer_close(blockfile_writer *writer)
+{
+    unsigned char *buffer;
+    UINT32 index_length;
+    BOOL ok;
+
+    if (writer->current != NULL)
+    {
+        blockfile_submit(writer);
+    }
+
+    /* Every worker flushes after compressing, so all blocks are written
+     * once no block is queued.
+     */
+    while (writer->queued > 0)
+    {
+        WaitForSingleObject(writer->idle_event, INFINITE);
+    }
+
+    index_length = writer->index_count * sizeof(BLOCKFILE_INDEX_ENTRY);
+    buffer = malloc(sizeof(BLOCKFILE_BLOCK) + index_length + sizeof(BLOCKFILE_TRAILER));
+    if (buffer == NULL)
+    {
+        writer->failed = TRUE;
+    }
+    else if (writer->failed == 0)
+    {
+        PBLOCKFILE_BLOCK block = (PBLOCKFILE_BLOCK)buffer;
+        PBLOCKFILE_TRAILER trailer;
+
+        block->storedLength = index_length;
+        block->length = index_length;
+        block->flags = BLOCKFILE_BLOCK_INDEX;
+        memcpy(buffer + sizeof(BLOCKFILE_BLOCK), writer->index, index_length);
+
+        trailer = (PBLOCKFILE_TRAILER)(buffer + sizeof(BLOCKFILE_BLOCK) + index_length);
+        trailer->indexOffset = writer->file_offset;
+        trailer->blockCount = writer->index_count;
+        trailer->magic = BLOCKFILE_MAGIC;
+
+        if (!blockfile_write_at(writer->handle, writer->io_event, writer->file_offset, buffer,
+                                sizeof(BLOCKFILE_BLOCK) + index_length + sizeof(BLOCKFILE_TRAILER)))
+        {
+            fprintf(stderr, "Failed to write compressed file index - %d\n", GetLastError());
+            writer->failed = TRUE;
+        }
+    }
+    free(buffer);
+
+    ok = (writer->failed == 0);
+    blockfile_free_writer(writer);
+    blockfile_pool_release();
+    return ok;
+}
+
+BOOL blockfile_check_magic(const void *data, size_t length)
+{
+    BLOCKFILE_HEADER header;
+
+    if (length < sizeof(header))
+    {
+        return FALSE;
+    }
+
+    memcpy(&header, data, sizeof(header));
+    return (header.magic == BLOCKFILE_MAGIC) ? TRUE : FALSE;
+}
+
+typedef struct
+{
+    HANDLE file;
+    HANDLE mapping;
+    const unsigned char *base;
+    UINT64 size;
+    UINT32 block_size;
+    PBLOCKFILE_INDEX_ENTRY index;
+    UINT32 count;
+    UINT64 length;          /* Total uncompressed length */
+
+    unsigned char *memory;  /* Destination memory, or NULL to write output */
+    HANDLE output;
+    volatile LONG next;
+    volatile LONG failed;
+} blockfile_reader;
+
+static void blockfile_reader_close(blockfile_reader *reader)
+{
+    free(reader->index);
+    if (reader->base != NULL)
+    {
+        UnmapViewOfFile(reader->base);
+    }
+    if (reader->mapping != NULL)
+    {
+        CloseHandle(reader->mapping);
+    }
+    if (reader->file != INVALID_HANDLE_VALUE)
+    {
+        CloseHandle(reader->file);
+    }
+}
+
+/* Uses index from trailer if present, scans blocks otherwise */
+static BOOL blockfile_read_index(blockfile_reader *reader, const char *filename)
+{
+    const UINT64 min_size = sizeof(BLOCKFILE_HEADER) + sizeof(BLOCKFILE_BLOCK) +
+                            sizeof(BLOCKFILE_TRAILER);
+    BLOCKFILE_TRAILER trailer;
+    BLOCKFILE_BLOCK block;
+    UINT64 file_offset;
+    UINT32 size = 0;
+    UINT32 i;
+
+    if (reader->size >= min_size)
+    {
+        memcpy(&trailer, reader->base + reader->size - sizeof(trailer), sizeof(trailer));
+        if ((trailer.magic == BLOCKFILE_MAGIC) &&
+            (trailer.indexOffset >= sizeof(BLOCKFILE_HEADER)) &&
+            (trailer.indexOffset <= reader->size - sizeof(trailer) - sizeof(block)))
+        {
+            memcpy(&block, reader->base + trailer.indexOffset, sizeof(block));
+            /* blockCount comes from the file, index size is computed in 64 bits */
+            if ((block.flags & BLOCKFILE_BLOCK_INDEX) &&
+                ((UINT64)trailer.blockCount * sizeof(BLOCKFILE_INDEX_ENTRY) == block.storedLength) &&
+                (trailer.indexOffset + sizeof(block) + block.storedLength ==
+                 reader->size - sizeof(trailer)))
+            {
+                reader->count = trailer.blockCount;
+                reader->index = malloc(max(block.storedLength, 1));
+                if (reader->index == NULL)
+                {
+                    return FALSE;
+                }
+                memcpy(reader->index, reader->base + trailer.indexOffset + sizeof(block),
+                       block.storedLength);
+
+                for (i = 0; i < reader->count; i++)
+                {
+                    if ((reader->index[i].offset != reader->length) ||
+                        (reader->index[i].length > reader->block_size))
+                    {
+                        fprintf(stderr, "%s: corrupted block index\n", filename);
+                        return FALSE;
+                    }
+                    reader->length += reader->index[i].length;
+                }
+                return TRUE;
+            }
+        }
+    }
+
+    /* No valid trailer, writer did not finish. Recover complete blocks. */
+    file_offset = sizeof(BLOCKFILE_HEADER);
+    while (reader->size - file_offset >= sizeof(block))
+    {
+        memcpy(&block, reader->base + file_offset, sizeof(block));
+        if ((block.flags & BLOCKFILE_BLOCK_INDEX) ||
+            (block.storedLength > reader->size - file_offset - sizeof(block)) ||
+            (block.length > reader->block_size))
+        {
+            break;
+        }
+
+        if (reader->count == size)
+        {
+            PBLOCKFILE_INDEX_ENTRY tmp;
+
+            if (size > ((SIZE_T)-1) / sizeof(BLOCKFILE_INDEX_ENTRY) / 2)
+            {
+                fprintf(stderr, "%s: too many blocks\n", filename);
+                return FALSE;
+            }
+            size = size ? size * 2 : 1024;
+            tmp = realloc(reader->index, size * sizeof(BLOCKFILE_INDEX_ENTRY));
+            if (tmp == NULL)
+            {
+                return FALSE;
+            }
+            reader->index = tmp;
+        }
+
+        reader->index[reader->count].fileOffset = file_offset;
+        reader->index[reader->count].offset = reader->length;
+        reader->index[reader->count].storedLength = block.storedLength;
+        reader->index[reader->count].length = block.length;
+        reader->count++;
+        reader->length += block.length;
+        file_offset += sizeof(block) + block.storedLength;
+    }
+
+    fprintf(stderr, "%s: index missing, recovered %u blocks\n", filename, reader->count);
+    return TRUE;
+}
+
+static BOOL blockfile_reader_open(blockfile_reader *reader, const char *filename)
+{
+    LARGE_INTEGER size;
+    BLOCKFILE_HEADER header;
+
+    memset(reader, 0, sizeof(blockfile_reader));
+
+    reader->file = CreateFileA(filename,
+                               GENERIC_READ,
+                               FILE_SHARE_READ | FILE_SHARE_WRITE,
+                               NULL,
+                               OPEN_EXISTING,
+                               FILE_ATTRIBUTE_NORMAL,
+                               NULL);
+    if (reader->file == INVALID_HANDLE_VALUE)
+    {
+        fprintf(stderr, "Failed to open %s - %d\n", filename, GetLastError());
+        return FALSE;
+    }
+
+    if (!GetFileSizeEx(reader->file, &size) || (size.QuadPart < sizeof(header)))
+    {
+        fprintf(stderr, "%s: file too short to contain compressed file header\n", filename);
+        goto error;
+    }
+
+    if ((UINT64)size.QuadPart > (SIZE_T)-1)
+    {
+        fprintf(stderr, "%s: file too large to map in 32-bit process\n", filename);
+        goto error;
+    }
+    reader->size = (UINT64)size.QuadPart;
+
+    reader->mapping = CreateFileMappingA(reader->file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (reader->mapping == NULL)
+    {
+        fprintf(stderr, "CreateFileMapping failed - %d\n", GetLastError());
+        goto error;
+    }
+
+    reader->base = MapViewOfFile(reader->mapping, FILE_MAP_READ, 0, 0, 0);
+    if (reader->base == NULL)
+    {
+        fprintf(stderr, "MapViewOfFile failed - %d\n", GetLastError());
+        goto error;
+    }
+
+    memcpy(&header, reader->base, sizeof(header));
+    if ((header.magic != BLOCKFILE_MAGIC) || (header.version != BLOCKFILE_VERSION) ||
+        (header.blockSize == 0) || (header.blockSize > BLOCKFILE_MAX_BLOCK_SIZE))
+    {
+        fprintf(stderr, "%s: unsupported compressed file\n", filename);
+        goto error;
+    }
+    reader->block_size = header.blockSize;
+
+    if (!blockfile_read_index(reader, filename))
+    {
+        goto error;
+    }
+
+    return TRUE;
+
+error:
+    blockfile_reader_close(reader);
+    return FALSE;
+}
+
+static DWORD WINAPI blockfile_extract_worker(LPVOID param)
+{
+    blockfile_reader *reader = (blockfile_reader *)param;
+    unsigned char *buffer = NULL;
+    HANDLE event = NULL;
+
+    if (reader->memory == NULL)
+    {
+        buffer = malloc(reader->block_size);
+        event = CreateEvent(NULL, TRUE, FALSE, NULL);
+        if ((buffer == NULL) || (event == NULL))
+        {
+            InterlockedExchange(&reader->failed, TRUE);
+        }
+    }
+
+    while (reader->failed == 0)
+    {
+        LONG i = InterlockedIncrement(&reader->next) - 1;
+        PBLOCKFILE_INDEX_ENTRY entry;
+        BLOCKFILE_BLOCK block;
+        const unsigned char *src;
+        unsigned char *dst;
+
+        if ((UINT32)i >= reader->count)
+        {
+            break;
+        }
+        entry = &reader->index[i];
+
+        if ((entry->fileOffset > reader->size - sizeof(block)) ||
+            (entry->storedLength > reader->size - entry->fileOffset - sizeof(block)))
+        {
+            InterlockedExchange(&reader->failed, TRUE);
+            break;
+        }
+        memcpy(&block, reader->base + entry->fileOffset, sizeof(block));
+        if ((block.storedLength != entry->storedLength) || (block.length != entry->length))
+        {
+            InterlockedExchange(&reader->failed, TRUE);
+            break;
+        }
+
+        src = reader->base + entry->fileOffset + sizeof(block);
+        dst = (reader->memory != NULL) ? reader->memory + entry->offset : buffer;
+
+        if (block.flags & BLOCKFILE_BLOCK_STORED)
+        {
+            if (block.storedLength != block.length)
+            {
+                InterlockedExchange(&reader->failed, TRUE);
+                break;
+            }
+            if (reader->memory != NULL)
+            {
+                memcpy(dst, src, block.length);
+            }
+            else
+            {
+                /* Write straight from mapping */
+                dst = (unsigned char *)src;
+            }
+        }
+        else if (lz_decompress(src, block.storedLength, dst, block.length) != (INT32)block.length)
+        {
+            InterlockedExchange(&reader->failed, TRUE);
+            break;
+        }
+
+        if ((reader->memory == NULL) &&
+            !blockfile_write_at(reader->output, event, entry->offset, dst, block.length))
+        {
+            InterlockedExchange(&reader->failed, TRUE);
+            break;
+        }
+    }
+
+    free(buffer);
+    if (event != NULL)
+    {
+        CloseHandle(event);
+    }
+    return 0;
+}
+
+/* Decompresses every block using one thread per processor */
+static BOOL blockfile_extract(blockfile_reader *reader, const char *filename)
+{
+    HANDLE threads[BLOCKFILE_MAX_WORKERS];
+    SYSTEM_INFO info;
+    int count;
+    int i;
+
+    GetSystemInfo(&info);
+    count = min(max((int)info.dwNumberOfProcessors, 1), BLOCKFILE_MAX_WORKERS);
+    count = (int)min((UINT32)count, max(reader->count, 1));
+
+    for (i = 0; i < count; i++)
+    {
+        threads[i] = CreateThread(NULL, 0, blockfile_extract_worker, reader, 0, NULL);
+        if (threads[i] == NULL)
+        {
+            break;
+        }
+    }
+    count = i;
+
+    if (count == 0)
+    {
+        /* Do the work in calling thread */
+        blockfile_extract_worker(reader);
+    }
+    else
+    {
+        WaitForMultipleObjects(count, threads, TRUE, INFINITE);
+        for (i = 0; i < count; i++)
+        {
+            CloseHandle(threads[i]);
+        }
+    }
+
+    if (reader->failed)
+    {
+        fprintf(stderr, "%s: failed to decompress\n", filename);
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+unsigned char *blockfile_load(const char *filename, UINT64 *length)
+{
+    blockfile_reader reader;
+
+    if (!blockfile_reader_open(&reader, filename))
+    {
+        return NULL;
+    }
+
+    if (reader.length > (SIZE_T)-1)
+    {
+        fprintf(stderr, "%s: decompressed data too large for 32-bit process\n", filename);
+        blockfile_reader_close(&reader);
+        return NULL;
+    }
+
+    reader.memory = VirtualAlloc(NULL, (SIZE_T)max(reader.length, 1),
+                                 MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+    if (reader.memory == NULL)
+    {
+        fprintf(stderr, "Failed to allocate %I64u bytes for decompressed data\n", reader.length);
+        blockfile_reader_close(&reader);
+        return NULL;
+    }
+
+    if (!blockfile_extract(&reader, filename))
+    {
+        VirtualFree(reader.memory, 0, MEM_RELEASE);
+        blockfile_reader_close(&reader);
+        return NULL;
+    }
+
+    *length = reader.length;
+    blockfile_reader_close(&reader);
+    return reader.memory;
+}
+
+void blockfile_unload(unsigned char *data)
+{
+    if (data != NULL)
+    {
+        VirtualFree(data, 0, MEM_RELEASE);
+    }
+}
+
+FILE *blockfile_open_stream(const char *filename)
+{
+    blockfile_reader reader;
+    char dir[MAX_PATH];
+    char name[MAX_PATH];
+    BOOL ok;
+    FILE *file;
+    int fd;
+
+    if ((GetTempPathA(MAX_PATH, dir) == 0) || (GetTempFileNameA(dir, "upc", 0, name) == 0))
+    {
+        fprintf(stderr, "Failed to get temporary file name - %d\n", GetLastError());
+        return NULL;
+    }
+
+    if (!blockfile_reader_open(&reader, filename))
+    {
+        DeleteFileA(name);
+        return NULL;
+    }
+
+    reader.output = CreateFileA(name,
+                                GENERIC_WRITE,
+                                FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                                NULL,
+                                CREATE_ALWAYS,
+                                FILE_ATTRIBUTE_TEMPORARY | FILE_FLAG_OVERLAPPED,
+                                NULL);
+    if (reader.output == INVALID_HANDLE_VALUE)
+    {
+        fprintf(stderr, "Failed to create %s - %d\n", name, GetLastError());
+        blockfile_reader_close(&reader);
+        DeleteFileA(name);
+        return NULL;
+    }
+
+    ok = blockfile_extract(&reader, filename);
+    blockfile_reader_close(&reader);
+
+    /* Reopen as CRT stream that deletes the file once closed */
+    fd = ok ? _open(name, _O_RDONLY | _O_BINARY | _O_TEMPORARY) : -1;
+    CloseHandle(reader.output);
+    if (fd == -1)
+    {
+        DeleteFileA(name);
+        return NULL;
+    }
+
+    file = _fdopen(fd, "rb");
+    if (file == NULL)
+    {
+        _close(fd);
+    }
+    return file;
+}
+
+int blockfile_decompress_file(const char *filename)
+{
+    blockfile_reader reader;
+    size_t base_length = pcap_base_length(filename);
+    size_t length = base_length + sizeof("_decompressed.pcap");
+    char *name;
+    BOOL ok;
+
+    name = malloc(length);
+    if (name == NULL)
+    {
+        return -1;
+    }
+    sprintf_s(name, length, "%.*s_decompressed.pcap", (int)base_length, filename);
+
+    if (!blockfile_reader_open(&reader, filename))
+    {
+        free(name);
+        return -1;
+    }
+
+    reader.output = CreateFileA(name,
+                                GENERIC_WRITE,
+                                FILE_SHARE_READ,
+                                NULL,
+                                CREATE_ALWAYS,
+                                FILE_ATTRIBUTE_NORMAL | FILE_FLAG_OVERLAPPED,
+                                NULL);
+    if (reader.output == INVALID_HANDLE_VALUE)
+    {
+        fprintf(stderr, "Failed to create %s - %d\n", name, GetLastError());
+        blockfile_reader_close(&reader);
+        free(name);
+        return -1;
+    }
+
+    ok = blockfile_extract(&reader, filename);
+    if (ok)
+    {
+        fprintf(stderr, "%s: %u blocks, %I64u bytes\n", name, reader.count, reader.length);
+    }
+
+    CloseHandle(reader.output);
+    blockfile_reader_close(&reader);
+    free(name);
+    return ok ? 0 : -1;
+}
@@ -0,0 +1,101 @@
+/*
+ * Copyright (c) 2026 Tomasz Moń <desowin@gmail.com>
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#ifndef USBPCAP_CMD_BLOCKFILE_H
+#define USBPCAP_CMD_BLOCKFILE_H
+
+#include <stdio.h>
+#include <windows.h>
+
+/* Block compressed file.
+ *
+ * Data is cut into independent blocks of blockSize bytes (last block may
+ * be shorter). Every block is compressed with lzblock or stored as is
+ * when compression does not help or compressor falls behind. Blocks are
+ * followed by index block and trailer, so readers can locate every block
+ * without scanning and decompress them in parallel. Files without trailer
+ * (capture was interrupted) are recovered by scanning the blocks.
+ */
+#define BLOCKFILE_MAGIC               0x5A435055 /* "UPCZ" */
+#define BLOCKFILE_VERSION             1
+#define BLOCKFILE_DEFAULT_BLOCK_SIZE  (1024 * 1024)
+#define BLOCKFILE_MAX_BLOCK_SIZE      (16 * 1024 * 1024)
+
+/* BLOCKFILE_BLOCK flags */
+#define BLOCKFILE_BLOCK_STORED        0x00000001 /* Data is not compressed */
+#define BLOCKFILE_BLOCK_INDEX         0x00000002 /* Data is BLOCKFILE_INDEX_ENTRY array */
+
+#pragma pack(push, 1)
+typedef struct
+{
+    UINT32  magic;
+    UINT16  version;
+    UINT16  reserved;
+    UINT32  blockSize;
+} BLOCKFILE_HEADER, *PBLOCKFILE_HEADER;
+
+typedef struct
+{
+    UINT32  storedLength;       /* Bytes following this header */
+    UINT32  length;             /* Uncompressed length */
+    UINT32  flags;
+} BLOCKFILE_BLOCK, *PBLOCKFILE_BLOCK;
+
+typedef struct
+{
+    UINT64  fileOffset;         /* Offset of BLOCKFILE_BLOCK */
+    UINT64  offset;             /* Offset of block data in uncompressed stream */
+    UINT32  storedLength;
+    UINT32  length;
+} BLOCKFILE_INDEX_ENTRY, *PBLOCKFILE_INDEX_ENTRY;
+
+typedef struct
+{
+    UINT64  indexOffset;        /* Offset of BLOCKFILE_BLOCK with index */
+    UINT32  blockCount;
+    UINT32  magic;
+} BLOCKFILE_TRAILER, *PBLOCKFILE_TRAILER;
+#pragma pack(pop)
+
+typedef struct _blockfile_writer blockfile_writer;
+
+/* Creates writer that appends compressed stream to handle. Handle can be
+ * opened with FILE_FLAG_OVERLAPPED. Blocks are compressed by process-wide
+ * worker pool and written in order by whichever thread completes the
+ * next block, so blockfile_write() only copies data and never waits for
+ * compression. If compression falls behind, blocks are stored
+ * uncompressed instead of being queued.
+ *
+ * Writers must be created and closed by the same thread.
+ */
+blockfile_writer *blockfile_writer_create(HANDLE handle, UINT32 block_size);
+
+/* Returns FALSE if any previous write to file failed. */
+BOOL blockfile_write(blockfile_writer *writer, const void *data, UINT32 length);
+
+/* Flushes last block, writes index and frees writer. Handle is not
+ * closed. Returns FALSE if any write failed.
+ */
+BOOL blockfile_writer_close(blockfile_writer *writer);
+
+/* Returns TRUE if data starts with BLOCKFILE_HEADER */
+BOOL blockfile_check_magic(const void *data, size_t length);
+
+/* Decompresses filename into memory allocated with VirtualAlloc().
+ * Returns NULL on failure.
+ */
+unsigned char *blockfile_load(const char *filename, UINT64 *length);
+void blockfile_unload(unsigned char *data);
+
+/* Decompresses filename into temporary file that is deleted when closed.
+ * Returns NULL on failure.
+ */
+FILE *blockfile_open_stream(const char *filename);
+
+/* Writes <filename>_decompressed.pcap. Returns 0 on success, -1 on failure. */
+int blockfile_decompress_file(const char *filename);
+
+#endif /* USBPCAP_CMD_BLOCKFILE_H */
@@ -20,6 +20,16 @@
 #include "roothubs.h"
 #include "version.h"
 #include "descriptors.h"
+#include "pyramid.h"
+#include "split.h"
+#include "isoch.h"
+#include "storage.h"
+#include "reassembly.h"
+#include "trim.h"
+#include "reorder.h"
+#include "service.h"
+#include "bench.h"
+#include "blockfile.h"
 #include "USBPcap.h"
 
 #define INPUT_BUFFER_SIZE 1024
@@ -349,6 +359,16 @@ static BOOL generate_worker_command_line(struct thread_data *data,
 #define WORKER_CMD_LINE_FORMATTER_CAPTURE_ALL L" --capture-from-all-devices"
 #define WORKER_CMD_LINE_FORMATTER_CAPTURE_NEW L" --capture-from-new-devices"
 #define WORKER_CMD_LINE_FORMATTER_INJECT_DESCRIPTORS L" --inject-descriptors"
+#define WORKER_CMD_LINE_FORMATTER_COMPRESS    L" --compress"
+#define WORKER_CMD_LINE_FORMATTER_ANNOTATE    L" --annotate-pipe %S"
+#define WORKER_CMD_LINE_FORMATTER_SEQUENCE    L" --sequence-numbers"
+#define WORKER_CMD_LINE_FORMATTER_COMPACT     L" --compact-ring"
+#define WORKER_CMD_LINE_FORMATTER_ALIGNED     L" --aligned-ring"
+#define WORKER_CMD_LINE_FORMATTER_PAYLOAD     L" --compress-payload"
+#define WORKER_CMD_LINE_FORMATTER_REORDER     L" --reorder-window %u"
+#define WORKER_CMD_LINE_FORMATTER_LIVE_STATS  L" --live-stats"
+#define WORKER_CMD_LINE_FORMATTER_LIVE_JSON   L" --live-stats-json \"%S\""
+#define WORKER_CMD_LINE_FORMATTER_NO_SERVICE  L" --no-service"
 
     cmdLineLen = MultiByteToWideChar(CP_ACP, 0, data->device, -1, NULL, 0);
     cmdLineLen += (pipeName == NULL) ? strlen(data->filename) : wcslen(pipeName);
@@ -361,7 +381,20 @@ static BOOL generate_worker_command_line(struct thread_data *data,
     cmdLineLen += wcslen(WORKER_CMD_LINE_FORMATTER_CAPTURE_ALL);
     cmdLineLen += wcslen(WORKER_CMD_LINE_FORMATTER_CAPTURE_NEW);
     cmdLineLen += wcslen(WORKER_CMD_LINE_FORMATTER_INJECT_DESCRIPTORS);
+    cmdLineLen += wcslen(WORKER_CMD_LINE_FORMATTER_COMPRESS);
     cmdLineLen += (data->address_list == NULL) ? 0 : strlen(data->address_list);
+    cmdLineLen += wcslen(WORKER_CMD_LINE_FORMATTER_ANNOTATE);
+    cmdLineLen += (data->annotate_pipe == NULL) ? 0 : strlen(data->annotate_pipe);
+    cmdLineLen += wcslen(WORKER_CMD_LINE_FORMATTER_SEQUENCE);
+    cmdLineLen += wcslen(WORKER_CMD_LINE_FORMATTER_COMPACT);
+    cmdLineLen += wcslen(WORKER_CMD_LINE_FORMATTER_ALIGNED);
+    cmdLineLen += wcslen(WORKER_CMD_LINE_FORMATTER_PAYLOAD);
+    cmdLineLen += wcslen(WORKER_CMD_LINE_FORMATTER_REORDER);
+    cmdLineLen += 10 /* maximum reorder window in characters */;
+    cmdLineLen += wcslen(WORKER_CMD_LINE_FORMATTER_LIVE_STATS);
+    cmdLineLen += wcslen(WORKER_CMD_LINE_FORMATTER_LIVE_JSON);
+    cmdLineLen += (data->live_stats_json == NULL) ? 0 : strlen(data->live_stats_json);
+    cmdLineLen += wcslen(WORKER_CMD_LINE_FORMATTER_NO_SERVICE);
 
     cmdLine = (PWSTR)malloc(cmdLineLen * sizeof(WCHAR));
 
@@ -428,9 +461,90 @@ static BOOL generate_worker_command_line(struct thread_data *data,
                              cmdLineLen - nChars,
                              WORKER_CMD_LINE_FORMATTER_INJECT_DESCRIPTORS);
     }
+
+    if (data->compress)
+    {
+        nChars += swprintf_s(&cmdLine[nChars],
+                             cmdLineLen - nChars,
+                             WORKER_CMD_LINE_FORMATTER_COMPRESS);
+    }
+
+    if (data->annotate_pipe != NULL)
+    {
+        nChars += swprintf_s(&cmdLine[nChars],
+                             cmdLineLen - nChars,
+                             WORKER_CMD_LINE_FORMATTER_ANNOTATE,
+                             data->annotate_pipe);
+    }
+
+    if (data->sequence_numbers)
+    {
+        nChars += swprintf_s(&cmdLine[nChars],
+                             cmdLineLen - nChars,
+                             WORKER_CMD_LINE_FORMATTER_SEQUENCE);
+    }
+
+    if (data->compact_ring)
+    {
+        nChars += swprintf_s(&cmdLine[nChars],
+                             cmdLineLen - nChars,
+                             WORKER_CMD_LINE_FORMATTER_COMPACT);
+    }
+
+    if (data->aligned_ring)
+    {
+        nChars += swprintf_s(&cmdLine[nChars],
+                             cmdLineLen - nChars,
+                             WORKER_CMD_LINE_FORMATTER_ALIGNED);
+    }
+
+    if (data->compress_payload)
+    {
+        nChars += swprintf_s(&cmdLine[nChars],
+                             cmdLineLen - nChars,
+                             WORKER_CMD_LINE_FORMATTER_PAYLOAD);
+    }
+
+    if (data->reorder_window > 0)
+    {
+        nChars += swprintf_s(&cmdLine[nChars],
+                             cmdLineLen - nChars,
+                             WORKER_CMD_LINE_FORMATTER_REORDER,
+                             data->reorder_window);
+    }
+
+    if (data->live_stats)
+    {
+        nChars += swprintf_s(&cmdLine[nChars],
+                             cmdLineLen - nChars,
+                             WORKER_CMD_LINE_FORMATTER_LIVE_STATS);
+    }
+
+    if (data->live_stats_json != NULL)
+    {
+        nChars += swprintf_s(&cmdLine[nChars],
+                             cmdLineLen - nChars,
+                             WORKER_CMD_LINE_FORMATTER_LIVE_JSON,
+                             data->live_stats_json);
+    }
+
+    /* Caller has already tried the service */
+    nChars += swprintf_s(&cmdLine[nChars],
+                         cmdLineLen - nChars,
+                         WORKER_CMD_LINE_FORMATTER_NO_SERVICE);
 #undef WORKER_CMD_LINE_FORMATTER_PIPE
 #undef WORKER_CMD_LINE_FORMATTER
 
+#undef WORKER_CMD_LINE_FORMATTER_NO_SERVICE
+#undef WORKER_CMD_LINE_FORMATTER_LIVE_JSON
+#undef WORKER_CMD_LINE_FORMATTER_LIVE_STATS
+#undef WORKER_CMD_LINE_FORMATTER_REORDER
+#undef WORKER_CMD_LINE_FORMATTER_PAYLOAD
+#undef WORKER_CMD_LINE_FORMATTER_ALIGNED
+#undef WORKER_CMD_LINE_FORMATTER_COMPACT
+#undef WORKER_CMD_LINE_FORMATTER_SEQUENCE
+#undef WORKER_CMD_LINE_FORMATTER_ANNOTATE
+#undef WORKER_CMD_LINE_FORMATTER_COMPRESS
 #undef WORKER_CMD_LINE_FORMATTER_INJECT_DESCRIPTORS
 #undef WORKER_CMD_LINE_FORMATTER_CAPTURE_NEW
 #undef WORKER_CMD_LINE_FORMATTER_CAPTURE_ALL
@@ -829,6 +943,7 @@ static void start_capture(struct thread_data *data)
     HANDLE pipe_handle = INVALID_HANDLE_VALUE;
     HANDLE process = INVALID_HANDLE_VALUE;
     HANDLE thread = NULL;
+    HANDLE service_pipe = INVALID_HANDLE_VALUE;
     DWORD thread_id;
 
     /* Sanity check capture configuration. */
@@ -841,6 +956,24 @@ static void start_capture(struct thread_data *data)
         return;
     }
 
+    if (data->compress && (strncmp("-", data->filename, 2) == 0))
+    {
+        fprintf(stderr, "Compressed output can only be written to file.\n");
+        return;
+    }
+
+    if (data->compact_ring && data->compress_payload)
+    {
+        fprintf(stderr, "--compact-ring cannot be used together with --compress-payload.\n");
+        return;
+    }
+
+    if (data->compact_ring && data->aligned_ring)
+    {
+        fprintf(stderr, "--compact-ring cannot be used together with --aligned-ring.\n");
+        return;
+    }
+
     if (FALSE == USBPcapInitAddressFilter(&data->filter, data->address_list, data->capture_all))
     {
         fprintf(stderr, "USBPcapInitAddressFilter failed!\n");
@@ -854,7 +987,15 @@ static void start_capture(struct thread_data *data)
 
     memset(&data->descriptors, 0, sizeof(data->descriptors));
 
-    if (IsElevated() == TRUE)
+    /* Options that need direct access to filter device bypass the service */
+    if (data->use_service && !data->sequence_numbers && !data->compact_ring &&
+        !data->compress_payload && !data->aligned_ring &&
+        (data->annotate_pipe == NULL))
+    {
+        service_pipe = service_attach(data);
+    }
+
+    if ((service_pipe != INVALID_HANDLE_VALUE) || (IsElevated() == TRUE))
     {
         data->read_handle = INVALID_HANDLE_VALUE;
         if (strncmp("-", data->filename, 2) == 0)
@@ -863,9 +1004,10 @@ static void start_capture(struct thread_data *data)
         }
         else
         {
+            /* Allow readers so the capture can be processed while it grows */
             data->write_handle = CreateFileA(data->filename,
                                              GENERIC_WRITE,
-                                             0,
+                                             FILE_SHARE_READ,
                                              NULL,
                                              CREATE_NEW,
                                              FILE_ATTRIBUTE_NORMAL|FILE_FLAG_OVERLAPPED,
@@ -874,12 +1016,20 @@ static void start_capture(struct thread_data *data)
 
         if (data->inject_descriptors)
         {
-            data->descriptors.descriptors = descriptors_generate_pcap(data->device, &data->descriptors.descriptors_len,
-                                                                      &data->filter);
+            descriptors_generate_pcap(&data->descriptors.packets, data->device, &data->filter);
             data->descriptors.buf_written = 0;
         }
 
-        data->read_handle = create_filter_read_handle(data);
+        if (service_pipe != INVALID_HANDLE_VALUE)
+        {
+            /* Service already holds the filter device, no elevation needed */
+            data->read_handle = service_pipe;
+            data->read_connected = TRUE;
+        }
+        else
+        {
+            data->read_handle = create_filter_read_handle(data);
+        }
 
         thread = CreateThread(NULL, /* default security attributes */
                               0,    /* use default stack size */
@@ -1109,10 +1259,7 @@ static void start_capture(struct thread_data *data)
         CloseHandle(process);
     }
 
-    if (data->descriptors.descriptors)
-    {
-        descriptors_free_pcap(data->descriptors.descriptors);
-    }
+    descriptors_free_pcap(&data->descriptors.packets);
 }
 
 static void print_extcap_version(void)
@@ -1344,15 +1491,142 @@ static void print_help(void)
            "    List is comma separated list of values. Example --devices 1,2,3.\n"
            "  --inject-descriptors\n"
            "    Inject already connected devices descriptors into capture data.\n"
+           "  --annotate-pipe <name>\n"
+           "    Creates \\\\.\\pipe\\<name>. Every message written to the pipe is\n"
+           "    stored in capture as annotation packet timestamped by the driver.\n"
+           "  --sequence-numbers\n"
+           "    Appends 64-bit sequence number to every packet header. Gaps in the\n"
+           "    sequence show where packets were dropped due to full buffer.\n"
+           "  --compact-ring\n"
+           "    Keeps packets in compact form in driver buffer (-b), so it holds\n"
+           "    several times more small packets. Captured data is not affected.\n"
+           "  --compress-payload\n"
+           "    Compresses payloads of 256 bytes or more in driver buffer (-b), so\n"
+           "    it holds more bulk data. Payloads are decompressed before output.\n"
+           "    Cannot be used together with --compact-ring.\n"
+           "  --aligned-ring\n"
+           "    Starts every packet on cache line boundary in driver buffer (-b),\n"
+           "    so it is stored and read with single copy. Buffer size is rounded\n"
+           "    down to power of two. Cannot be used together with --compact-ring.\n"
+           "  --reorder-window <n>\n"
+           "    Holds up to <n> packets to write them in timestamp order. Packets\n"
+           "    completed on different CPUs at the same time can be out of order.\n"
+           "  --live-stats\n"
+           "    Shows per-endpoint packet and byte rates, refreshed every second.\n"
+           "  --live-stats-json <file>\n"
+           "    Appends per-endpoint rates to <file> as one JSON object per second.\n"
+           "  --service\n"
+           "    Runs capture service. Must be started as administrator. The service\n"
+           "    keeps filter devices and buffers (-b) open. Captures started while it\n"
+           "    runs attach to it instantly. Only administrators can attach unless\n"
+           "    --service-group is given. Clients from other sessions are rejected.\n"
+           "  --service-group <SID>\n"
+           "    Lets members of group <SID> attach to the service without elevation.\n"
+           "    WARNING: they can then capture all USB traffic of every root hub,\n"
+           "    including keystrokes, while the service runs.\n"
+           "  --no-service\n"
+           "    Captures directly from filter device even if capture service runs.\n"
+           "  --shm <name>\n"
+           "    Publishes capture to shared memory ring <name> (e.g. Local\\USBPcap1)\n"
+           "    instead of output file. Readers that fall behind lose oldest packets\n"
+           "    and never slow down the capture.\n"
+           "  --shm-size <MiB>\n"
+           "    Sets shared memory ring size, rounded up to power of two. Default 64.\n"
+           "  --shm-allow-users\n"
+           "    Lets every authenticated user, including other sessions, read the\n"
+           "    shared memory ring. By default only the user running the capture\n"
+           "    and administrators can. WARNING: ring contains all captured data,\n"
+           "    including keystrokes.\n"
            "  -I,  --init-non-standard-hwids\n"
            "    Initializes NonStandardHWIDs registry key used by USBPcapDriver.\n"
-           "    This registry key is needed for USB 3.0 capture.\n");
+           "    This registry key is needed for USB 3.0 capture.\n"
+           "  --build-pyramid <file>\n"
+           "    Builds throughput pyramid sidecar <file>.pyr for capture file.\n"
+           "    When the sidecar exists, only newly appended packets are processed.\n"
+           "    Captures spanning more than 49 days are rejected.\n"
+           "  --query-pyramid <file>\n"
+           "    Prints per endpoint bytes, transfers and errors from <file>.pyr\n"
+           "    as comma separated values, sampled over the whole capture.\n"
+           "  --pyramid-samples <count>\n"
+           "    Sets number of samples printed by --query-pyramid. Default 100.\n"
+           "  --split <file>\n"
+           "    Splits capture file into one file per device.\n"
+           "  --split-by-endpoint\n"
+           "    Makes --split create one file per device endpoint.\n"
+           "  --analyze-isoch <file>\n"
+           "    Prints isochronous endpoint continuity, error and bitrate statistics.\n"
+           "    Use - to analyze live capture piped from USBPcapCMD -o -.\n"
+           "  --analyze-storage <file>\n"
+           "    Prints mass storage (BOT and UAS) SCSI commands, per-second IOPS and\n"
+           "    throughput and per-opcode latency histograms as comma separated values.\n"
+           "  --reassemble <file>\n"
+           "    Writes bulk endpoint payloads as continuous byte streams (.bin) with\n"
+           "    index (.idx) mapping stream offsets back to capture records.\n"
+           "  --trim <file>\n"
+           "    Writes <file>_trimmed.pcap with bulk and isochronous payloads removed,\n"
+           "    or <file>_trimmed.pcapz with --compress.\n"
+           "    Headers, control and interrupt transfers are kept unchanged.\n"
+           "  --trim-bulk <len>, --trim-isoch <len>\n"
+           "    Keeps first <len> payload bytes of bulk or isochronous transfers.\n"
+           "  --payload-store <dir>\n"
+           "    Moves payloads removed by --trim into content-addressed store <dir>.\n"
+           "  --rehydrate <file>\n"
+           "    Restores payloads of trimmed capture from --payload-store <dir>.\n"
+           "  --reorder <file>\n"
+           "    Writes <file>_reordered.pcap with packets sorted by timestamp.\n"
+           "    Uses --reorder-window <n> packets of memory, default 4096. Packets\n"
+           "    further out of order are sorted in temporary files.\n"
+           "  --compress\n"
+           "    Writes capture, --split and --trim outputs as block compressed files\n"
+           "    and compresses payloads moved to --payload-store.\n"
+           "    All analysis options read compressed captures directly.\n"
+           "  --decompress <file>\n"
+           "    Writes <file>_decompressed.pcap from block compressed capture.\n"
+           "  --benchmark <settings>\n"
+           "    Runs capture pipeline with all selected options on generated bulk\n"
+           "    packets instead of filter device, writes them to -o and prints\n"
+           "    throughput, latency and loss. Settings are comma separated:\n"
+           "    size=<bytes> (default 64), rate=<packets/s> (default 0, unlimited),\n"
+           "    burst=<packets> (default 1), duration=<s> (default 10) and sweep,\n"
+           "    which doubles rate after every run until packets are lost.\n"
+           "    Use -o NUL to leave out disk writes.\n");
 }
 
 /* Commandline arguments without short option */
 #define ARG_DEVICES                    900
 #define ARG_CAPTURE_FROM_NEW_DEVICES   901
 #define ARG_INJECT_DESCRIPTORS         902
+#define ARG_BUILD_PYRAMID              903
+#define ARG_SPLIT                      904
+#define ARG_SPLIT_BY_ENDPOINT          905
+#define ARG_ANALYZE_ISOCH              906
+#define ARG_ANALYZE_STORAGE            907
+#define ARG_REASSEMBLE                 908
+#define ARG_TRIM                       909
+#define ARG_TRIM_BULK                  910
+#define ARG_TRIM_ISOCH                 911
+#define ARG_PAYLOAD_STORE              912
+#define ARG_REHYDRATE                  913
+#define ARG_COMPRESS                   914
+#define ARG_DECOMPRESS                 915
+#define ARG_ANNOTATE_PIPE              916
+#define ARG_SEQUENCE_NUMBERS           917
+#define ARG_REORDER                    918
+#define ARG_REORDER_WINDOW             919
+#define ARG_LIVE_STATS                 920
+#define ARG_LIVE_STATS_JSON            921
+#define ARG_SERVICE                    922
+#define ARG_NO_SERVICE                 923
+#define ARG_SHM                        924
+#define ARG_SHM_SIZE                   925
+#define ARG_COMPACT_RING               926
+#define ARG_COMPRESS_PAYLOAD           927
+#define ARG_BENCHMARK                  928
+#define ARG_SERVICE_GROUP              929
+#define ARG_SHM_ALLOW_USERS            930
+#define ARG_ALIGNED_RING               931
+#define ARG_QUERY_PYRAMID              932
+#define ARG_PYRAMID_SAMPLES            933
 #define ARG_EXTCAP_VERSION            1000
 #define ARG_EXTCAP_INTERFACES         1001
 #define ARG_EXTCAP_INTERFACE          1002
@@ -1382,6 +1656,38 @@ int __cdecl main(int argc, CHAR **argv)
         {"capture-from-all-devices", no_argument, 0, 'A'},
         {"capture-from-new-devices", no_argument, 0, ARG_CAPTURE_FROM_NEW_DEVICES},
         {"inject-descriptors", no_argument, 0, ARG_INJECT_DESCRIPTORS},
+        {"annotate-pipe", required_argument, 0, ARG_ANNOTATE_PIPE},
+        {"sequence-numbers", no_argument, 0, ARG_SEQUENCE_NUMBERS},
+        {"compact-ring", no_argument, 0, ARG_COMPACT_RING},
+        {"aligned-ring", no_argument, 0, ARG_ALIGNED_RING},
+        {"compress-payload", no_argument, 0, ARG_COMPRESS_PAYLOAD},
+        {"reorder-window", required_argument, 0, ARG_REORDER_WINDOW},
+        {"live-stats", no_argument, 0, ARG_LIVE_STATS},
+        {"live-stats-json", required_argument, 0, ARG_LIVE_STATS_JSON},
+        {"service", no_argument, 0, ARG_SERVICE},
+        {"service-group", required_argument, 0, ARG_SERVICE_GROUP},
+        {"no-service", no_argument, 0, ARG_NO_SERVICE},
+        {"shm", required_argument, 0, ARG_SHM},
+        {"shm-size", required_argument, 0, ARG_SHM_SIZE},
+        {"shm-allow-users", no_argument, 0, ARG_SHM_ALLOW_USERS},
+        /* Offline capture file processing. */
+        {"build-pyramid", required_argument, 0, ARG_BUILD_PYRAMID},
+        {"query-pyramid", required_argument, 0, ARG_QUERY_PYRAMID},
+        {"pyramid-samples", required_argument, 0, ARG_PYRAMID_SAMPLES},
+        {"split", required_argument, 0, ARG_SPLIT},
+        {"split-by-endpoint", no_argument, 0, ARG_SPLIT_BY_ENDPOINT},
+        {"analyze-isoch", required_argument, 0, ARG_ANALYZE_ISOCH},
+        {"analyze-storage", required_argument, 0, ARG_ANALYZE_STORAGE},
+        {"reassemble", required_argument, 0, ARG_REASSEMBLE},
+        {"trim", required_argument, 0, ARG_TRIM},
+        {"trim-bulk", required_argument, 0, ARG_TRIM_BULK},
+        {"trim-isoch", required_argument, 0, ARG_TRIM_ISOCH},
+        {"payload-store", required_argument, 0, ARG_PAYLOAD_STORE},
+        {"rehydrate", required_argument, 0, ARG_REHYDRATE},
+        {"compress", no_argument, 0, ARG_COMPRESS},
+        {"decompress", required_argument, 0, ARG_DECOMPRESS},
+        {"reorder", required_argument, 0, ARG_REORDER},
+        {"benchmark", required_argument, 0, ARG_BENCHMARK},
         /* Extcap interface. Please note that there are no short
          * options for these and the numbers are just gopt keys.
          */
@@ -1396,6 +1702,17 @@ int __cdecl main(int argc, CHAR **argv)
     };
     int option_index = 0;
     int c;
+    const char *pyramid_input = NULL;
+    UINT32 pyramid_samples = 100;
+    const char *split_input = NULL;
+    BOOL split_by_endpoint = FALSE;
+    const char *trim_input = NULL;
+    const char *rehydrate_input = NULL;
+    const char *reorder_input = NULL;
+    const char *bench_spec = NULL;
+    BOOL run_service = FALSE;
+    const char *service_group = NULL;
+    trim_rules trim = {0, 0, NULL, FALSE};
 
     attach_parent_console();
 
@@ -1405,6 +1722,25 @@ int __cdecl main(int argc, CHAR **argv)
     data.capture_all = FALSE;
     data.capture_new = FALSE;
     data.inject_descriptors = FALSE;
+    data.compress = FALSE;
+    data.compressor = NULL;
+    data.annotate_pipe = NULL;
+    data.sequence_numbers = FALSE;
+    data.compact_ring = FALSE;
+    data.aligned_ring = FALSE;
+    data.compress_payload = FALSE;
+    data.inflate = NULL;
+    data.reorder_window = 0;
+    data.reorder = NULL;
+    data.live_stats = FALSE;
+    data.live_stats_json = NULL;
+    data.stats = NULL;
+    data.use_service = TRUE;
+    data.read_connected = FALSE;
+    data.shm_name = NULL;
+    data.shm_size = SHM_RING_DEFAULT_SIZE;
+    data.shm_allow_users = FALSE;
+    data.shm = NULL;
     data.snaplen = DEFAULT_SNAPSHOT_LENGTH;
     data.bufferlen = DEFAULT_INTERNAL_KERNEL_BUFFER_SIZE;
     data.job_handle = INVALID_HANDLE_VALUE;
@@ -1468,6 +1804,94 @@ int __cdecl main(int argc, CHAR **argv)
             case ARG_INJECT_DESCRIPTORS:
                 data.inject_descriptors = TRUE;
                 break;
+            case ARG_ANNOTATE_PIPE:
+                data.annotate_pipe = optarg;
+                break;
+            case ARG_SEQUENCE_NUMBERS:
+                data.sequence_numbers = TRUE;
+                break;
+            case ARG_COMPACT_RING:
+                data.compact_ring = TRUE;
+                break;
+            case ARG_ALIGNED_RING:
+                data.aligned_ring = TRUE;
+                break;
+            case ARG_COMPRESS_PAYLOAD:
+                data.compress_payload = TRUE;
+                break;
+            case ARG_REORDER_WINDOW:
+                data.reorder_window = atol(optarg);
+                break;
+            case ARG_LIVE_STATS:
+                data.live_stats = TRUE;
+                break;
+            case ARG_LIVE_STATS_JSON:
+                data.live_stats_json = optarg;
+                break;
+            case ARG_SERVICE:
+                run_service = TRUE;
+                break;
+            case ARG_SERVICE_GROUP:
+                service_group = optarg;
+                break;
+            case ARG_NO_SERVICE:
+                data.use_service = FALSE;
+                break;
+            case ARG_SHM:
+                data.shm_name = optarg;
+                break;
+            case ARG_SHM_ALLOW_USERS:
+                data.shm_allow_users = TRUE;
+                break;
+            case ARG_SHM_SIZE:
+                data.shm_size = (UINT64)atol(optarg) * 1024 * 1024;
+                break;
+            case ARG_BUILD_PYRAMID:
+                return pyramid_build(optarg);
+            case ARG_QUERY_PYRAMID:
+                pyramid_input = optarg;
+                break;
+            case ARG_PYRAMID_SAMPLES:
+                pyramid_samples = (UINT32)atol(optarg);
+                break;
+            case ARG_SPLIT:
+                split_input = optarg;
+                break;
+            case ARG_SPLIT_BY_ENDPOINT:
+                split_by_endpoint = TRUE;
+                break;
+            case ARG_ANALYZE_ISOCH:
+                return isoch_analyze(optarg);
+            case ARG_ANALYZE_STORAGE:
+                return storage_analyze(optarg);
+            case ARG_REASSEMBLE:
+                return reassemble_to_files(optarg);
+            case ARG_TRIM:
+                trim_input = optarg;
+                break;
+            case ARG_TRIM_BULK:
+                trim.bulk_keep = atol(optarg);
+                break;
+            case ARG_TRIM_ISOCH:
+                trim.isoch_keep = atol(optarg);
+                break;
+            case ARG_PAYLOAD_STORE:
+                trim.store = optarg;
+                break;
+            case ARG_REHYDRATE:
+                rehydrate_input = optarg;
+                break;
+            case ARG_COMPRESS:
+                data.compress = TRUE;
+                break;
+            case ARG_DECOMPRESS:
+                return blockfile_decompress_file(optarg);
+            case ARG_REORDER:
+                reorder_input = optarg;
+                break;
+            case ARG_BENCHMARK:
+                bench_spec = optarg;
+                break;
             case ARG_EXTCAP_VERSION:
                 do_extcap_version = 1;
                 wireshark_version = optarg;
@@ -1491,12 +1915,78 @@ int __cdecl main(int argc, CHAR **argv)
         }
     }
 
+    if (pyramid_input != NULL)
+    {
+        return pyramid_print(pyramid_input, pyramid_samples);
+    }
+
+    if (split_input != NULL)
+    {
+        return split_capture(split_input, split_by_endpoint, data.compress);
+    }
+
+    if (trim_input != NULL)
+    {
+        trim.compress = data.compress;
+        return trim_capture(trim_input, &trim);
+    }
+
+    if (rehydrate_input != NULL)
+    {
+        if (trim.store == NULL)
+        {
+            fprintf(stderr, "--rehydrate requires --payload-store.\n");
+            return -1;
+        }
+        return trim_rehydrate(rehydrate_input, trim.store);
+    }
+
+    if (run_service)
+    {
+        if (IsElevated() != TRUE)
+        {
+            fprintf(stderr, "Capture service must be run as administrator.\n");
+            return -1;
+        }
+        return service_run(data.bufferlen, service_group);
+    }
+
+    if (reorder_input != NULL)
+    {
+        return reorder_capture(reorder_input,
+                               (data.reorder_window > 0) ? data.reorder_window : REORDER_DEFAULT_WINDOW);
+    }
+
     if (data.snaplen > (data.bufferlen - sizeof(pcaprec_hdr_t)))
     {
         fprintf(stderr, "Packets larger than %u bytes won't be captured due to too small buffer.\n",
                 data.bufferlen - sizeof(pcaprec_hdr_t));
     }
 
+    if (data.shm_name != NULL)
+    {
+        if ((data.filename != NULL) && (strncmp(data.filename, "-", 2) != 0))
+        {
+            fprintf(stderr, "--shm replaces output file, -o cannot be used with it.\n");
+            return -1;
+        }
+        if (data.filename == NULL)
+        {
+            /* Capture flows through this process, see start_capture() */
+            data.filename = _strdup("-");
+        }
+    }
+
+    if (bench_spec != NULL)
+    {
+        if (data.filename == NULL)
+        {
+            fprintf(stderr, "--benchmark requires output file (-o).\n");
+            return -1;
+        }
+        return bench_run(&data, bench_spec);
+    }
+
     /* Handle extcap options separately from standard USBPcapCMD options. */
     if (run_as_extcap || do_extcap_version || do_extcap_interfaces || do_extcap_dlts || do_extcap_config || do_extcap_capture)
     {
@@ -13,120 +13,308 @@
 #include "enum.h"
 #include "iocontrol.h"
 #include "USBPcap.h"
+#include "descriptors.h"
 
 #define URB_SELECT_CONFIGURATION       0x0000
 #define URB_CONTROL_TRANSFER           0x0008
 #define URB_GET_DESCRIPTOR_FROM_DEVICE 0x000b
 
-typedef struct _list_entry
+/* Arena is grown by doubling, starting with this size */
+#define DESCRIPTORS_ARENA_INITIAL_SIZE (16 * 1024)
+
+#define DESCRIPTOR_CACHE_MAGIC   0x43445055 /* "UPDC" */
+#define DESCRIPTOR_CACHE_VERSION 1
+
+/* Sanity limits for cache file contents */
+#define DESCRIPTOR_CACHE_MAX_ENTRIES  65536
+#define DESCRIPTOR_CACHE_MAX_HUB_NAME 4096
+
+#pragma pack(push, 1)
+typedef struct
 {
-    void *data; /* Packet data without pcaprec_hdr_t */
-    int length; /* data length in bytes */
-    struct _list_entry *next;
-} list_entry;
+    UINT32 magic;
+    UINT32 version;
+    UINT32 count;       /* Number of DESCRIPTOR_CACHE_RECORD entries */
+} DESCRIPTOR_CACHE_HEADER;
+
+/* Followed by hub name and configuration descriptor */
+typedef struct
+{
+    UINT32 hubLength;
+    UINT32 port;
+    USHORT deviceAddress;
+    USHORT wTotalLength;
+    USB_DEVICE_DESCRIPTOR device;
+} DESCRIPTOR_CACHE_RECORD;
+#pragma pack(pop)
+
+/* Configuration descriptor of device connected to hub port. The device
+ * is identified by its address and device descriptor as reported in
+ * USB_NODE_CONNECTION_INFORMATION. Hub name and configuration descriptor
+ * are stored in the same allocation, right after the structure.
+ */
+typedef struct _descriptor_cache_entry
+{
+    DESCRIPTOR_CACHE_RECORD record;
+    char *hub;
+    UINT8 *config;
+    struct _descriptor_cache_entry *next;
+} descriptor_cache_entry;
 
 typedef struct _descriptor_callback_context
 {
     USHORT roothub;
     PUSBPCAP_ADDRESS_FILTER addresses;
-    list_entry *head;
-    list_entry *tail;
+    descriptors_arena *arena;
+    UINT32 ts_sec;  /* Timestamp of all generated records */
+    UINT32 ts_usec;
+    descriptor_cache_entry *cached; /* Loaded from cache file, not seen yet */
+    descriptor_cache_entry *seen;   /* Currently connected devices */
+    BOOL changed;                   /* TRUE if cache file needs update */
 } descriptor_callback_context;
 
-/* Get ddescriptor for given device
+/* Appends pcap record with data_len bytes of packet data to arena.
  *
- * hub - HANDLE to USB hub
- * port - hub port number to which the device whose descriptor is queried is connected
- * index - 0-based configuration descriptor index
- *
- * Returns dynamically allocated USB_DESCRIPTOR_REQUEST structure that must be freed
- * using free(). On failure, returns NULL.
+ * Returns pointer to record packet data that is valid until next call.
+ * On failure, returns NULL.
  */
-static PUSB_DESCRIPTOR_REQUEST get_config_descriptor(HANDLE hub, ULONG port, UCHAR index)
+static UINT8 *arena_add_record(descriptor_callback_context *ctx, int data_len)
 {
-    ULONG nBytes = 0;
-    ULONG nBytesReturned = 0;
-    UCHAR buffer[sizeof(USB_DESCRIPTOR_REQUEST) + sizeof(USB_CONFIGURATION_DESCRIPTOR)];
-    PUSB_DESCRIPTOR_REQUEST request = NULL;
-    PUSB_CONFIGURATION_DESCRIPTOR descriptor = NULL;
+    descriptors_arena *arena = ctx->arena;
+    int needed = sizeof(pcaprec_hdr_t) + data_len;
+    pcaprec_hdr_t *hdr;
 
-    /* This function does two queries for the descriptor:
-     *   * 1st time to obtain the configuration descriptor itself
-     *   * 2nd time to obtain the configuration descriptor and all interface and
-     *     endpoint descriptors
-     */
-    nBytes = sizeof(buffer);
-    request = (PUSB_DESCRIPTOR_REQUEST)buffer;
-    descriptor = (PUSB_CONFIGURATION_DESCRIPTOR)(request->Data);
+    if (arena->size - arena->length < needed)
+    {
+        int size = (arena->size > 0) ? arena->size : DESCRIPTORS_ARENA_INITIAL_SIZE;
+        UINT8 *tmp;
 
-    memset(request, 0, nBytes);
-    request->ConnectionIndex = port;
-    request->SetupPacket.bmRequest = 0x80; /* Device to Host */
-    request->SetupPacket.bRequest = 0x06; /* GET DESCRIPTOR */
-    request->SetupPacket.wValue = (USB_CONFIGURATION_DESCRIPTOR_TYPE << 8) | index;
-    request->SetupPacket.wIndex = 0; /* Language ID for String Descriptors */
-    request->SetupPacket.wLength = (USHORT)(nBytes - sizeof(USB_DESCRIPTOR_REQUEST));
+        while (size - arena->length < needed)
+        {
+            size *= 2;
+        }
 
-    if (!DeviceIoControl(hub, IOCTL_USB_GET_DESCRIPTOR_FROM_NODE_CONNECTION,
-                         request, nBytes, request, nBytes, &nBytesReturned, NULL))
+        tmp = (UINT8*)realloc(arena->data, size);
+        if (!tmp)
+        {
+            fprintf(stderr, "Failed to allocate %d bytes for descriptors\n", size);
+            return NULL;
+        }
+        arena->data = tmp;
+        arena->size = size;
+    }
+
+    hdr = (pcaprec_hdr_t *)&arena->data[arena->length];
+    hdr->ts_sec = ctx->ts_sec;
+    hdr->ts_usec = ctx->ts_usec;
+    hdr->incl_len = data_len;
+    hdr->orig_len = data_len;
+    arena->length += needed;
+
+    return (UINT8*)&hdr[1];
+}
+
+static descriptor_cache_entry *
+descriptor_cache_new_entry(const char *hub, ULONG port, USHORT deviceAddress,
+                           PUSB_DEVICE_DESCRIPTOR device, USHORT wTotalLength)
+{
+    size_t hubLength = strlen(hub);
+    descriptor_cache_entry *entry;
+
+    entry = (descriptor_cache_entry *)malloc(sizeof(descriptor_cache_entry) +
+                                             hubLength + 1 + wTotalLength);
+    if (!entry)
     {
-        fprintf(stderr, "Failed to get descriptor - %d\n", GetLastError());
         return NULL;
     }
 
-    if (nBytes != nBytesReturned)
+    entry->record.hubLength = (UINT32)hubLength;
+    entry->record.port = port;
+    entry->record.deviceAddress = deviceAddress;
+    entry->record.wTotalLength = wTotalLength;
+    entry->record.device = *device;
+    entry->hub = (char *)&entry[1];
+    entry->config = (UINT8 *)&entry->hub[hubLength + 1];
+    entry->next = NULL;
+    memcpy(entry->hub, hub, hubLength + 1);
+    return entry;
+}
+
+static void descriptor_cache_free(descriptor_cache_entry *entry)
+{
+    while (entry)
     {
-        fprintf(stderr, "Get Descriptor IOCTL returned %d bytes (requested %d)\n",
-                nBytesReturned, nBytes);
-        return NULL;
+        descriptor_cache_entry *next = entry->next;
+        free(entry);
+        entry = next;
     }
+}
 
-    if (descriptor->wTotalLength < sizeof(USB_CONFIGURATION_DESCRIPTOR))
+/* Returns cache file name for given root hub. Returned string must be
+ * freed using free(). On failure, returns NULL.
+ */
+static char *descriptor_cache_path(USHORT roothub)
+{
+    char dir[MAX_PATH + 1];
+    char *path;
+    DWORD length;
+
+    length = GetTempPathA(sizeof(dir), dir);
+    if ((length == 0) || (length > sizeof(dir)))
     {
-        fprintf(stderr, "Configuration descriptor is too small (%d) to hold the common data\n",
-                descriptor->wTotalLength);
         return NULL;
     }
 
-    /* Allocate the buffer and request complete descriptor */
-    nBytes = sizeof(USB_DESCRIPTOR_REQUEST) + descriptor->wTotalLength;
-    request = (PUSB_DESCRIPTOR_REQUEST)malloc(nBytes);
-    if (!request)
+    length += 64;
+    path = (char *)malloc(length);
+    if (path)
     {
-        return NULL;
+        sprintf_s(path, length, "%sUSBPcap-descriptors-%u.cache", dir, roothub);
     }
+    return path;
+}
 
-    descriptor = (PUSB_CONFIGURATION_DESCRIPTOR)(request->Data);
-    request->ConnectionIndex = port;
-    request->SetupPacket.bmRequest = 0x80; /* Device to Host */
-    request->SetupPacket.bRequest = 0x06; /* GET DESCRIPTOR */
-    request->SetupPacket.wValue = (USB_CONFIGURATION_DESCRIPTOR_TYPE << 8) | index;
-    request->SetupPacket.wIndex = 0; /* Language ID for String Descriptors */
-    request->SetupPacket.wLength = (USHORT)(nBytes - sizeof(USB_DESCRIPTOR_REQUEST));
-    if (!DeviceIoControl(hub, IOCTL_USB_GET_DESCRIPTOR_FROM_NODE_CONNECTION,
-                         request, nBytes, request, nBytes, &nBytesReturned, NULL))
+static descriptor_cache_entry *descriptor_cache_load(const char *path)
+{
+    DESCRIPTOR_CACHE_HEADER header;
+    descriptor_cache_entry *head = NULL;
+    FILE *file;
+    UINT32 i;
+
+    if (fopen_s(&file, path, "rb") != 0)
     {
-        fprintf(stderr, "Failed to get descriptor - %d\n", GetLastError());
-        free(request);
         return NULL;
     }
 
-    if (nBytes != nBytesReturned)
+    if ((fread(&header, sizeof(header), 1, file) != 1) ||
+        (header.magic != DESCRIPTOR_CACHE_MAGIC) ||
+        (header.version != DESCRIPTOR_CACHE_VERSION) ||
+        (header.count > DESCRIPTOR_CACHE_MAX_ENTRIES))
     {
-        fprintf(stderr, "Get Descriptor IOCTL returned %d bytes (requested %d)\n",
-                nBytesReturned, nBytes);
-        free(request);
+        fclose(file);
         return NULL;
     }
 
-    if (descriptor->wTotalLength != (nBytes - sizeof(USB_DESCRIPTOR_REQUEST)))
+    for (i = 0; i < header.count; i++)
     {
-        fprintf(stderr, "wTotalLength changed between calls\n");
-        free(request);
-        return NULL;
+        DESCRIPTOR_CACHE_RECORD record;
+        descriptor_cache_entry *entry;
+
+        if ((fread(&record, sizeof(record), 1, file) != 1) ||
+            (record.hubLength > DESCRIPTOR_CACHE_MAX_HUB_NAME) ||
+            (record.wTotalLength < sizeof(USB_CONFIGURATION_DESCRIPTOR)))
+        {
+            break;
+        }
+
+        entry = (descriptor_cache_entry *)malloc(sizeof(descriptor_cache_entry) +
+                                                 record.hubLength + 1 + record.wTotalLength);
+        if (!entry)
+        {
+            break;
+        }
+        entry->record = record;
+        entry->hub = (char *)&entry[1];
+        entry->config = (UINT8 *)&entry->hub[record.hubLength + 1];
+
+        if ((fread(entry->hub, record.hubLength, 1, file) != 1) ||
+            (fread(entry->config, record.wTotalLength, 1, file) != 1))
+        {
+            free(entry);
+            break;
+        }
+        entry->hub[record.hubLength] = '\0';
+
+        entry->next = head;
+        head = entry;
+    }
+
+    if (i != header.count)
+    {
+        /* Corrupted file, descriptors will be requested from devices */
+        descriptor_cache_free(head);
+        head = NULL;
     }
 
-    return request;
+    fclose(file);
+    return head;
+}
+
+static void descriptor_cache_save(const char *path, descriptor_cache_entry *entries)
+{
+    DESCRIPTOR_CACHE_HEADER header;
+    descriptor_cache_entry *entry;
+    char *tmpname;
+    size_t length;
+    FILE *file;
+    BOOL ok;
+
+    /* Write to temporary file first so concurrent readers never see
+     * partially written cache.
+     */
+    length = strlen(path) + 16;
+    tmpname = (char *)malloc(length);
+    if (!tmpname)
+    {
+        return;
+    }
+    sprintf_s(tmpname, length, "%s.%u.tmp", path, GetCurrentProcessId());
+
+    if (fopen_s(&file, tmpname, "wb") != 0)
+    {
+        free(tmpname);
+        return;
+    }
+
+    header.magic = DESCRIPTOR_CACHE_MAGIC;
+    header.version = DESCRIPTOR_CACHE_VERSION;
+    header.count = 0;
+    for (entry = entries; entry; entry = entry->next)
+    {
+        header.count++;
+    }
+
+    ok = (fwrite(&header, sizeof(header), 1, file) == 1);
+    for (entry = entries; ok && entry; entry = entry->next)
+    {
+        ok = (fwrite(&entry->record, sizeof(entry->record), 1, file) == 1) &&
+             (fwrite(entry->hub, entry->record.hubLength, 1, file) == 1) &&
+             (fwrite(entry->config, entry->record.wTotalLength, 1, file) == 1);
+    }
+
+    if ((fclose(file) != 0) || !ok ||
+        !MoveFileExA(tmpname, path, MOVEFILE_REPLACE_EXISTING))
+    {
+        DeleteFileA(tmpname);
+    }
+    free(tmpname);
+}
+
+/* Removes entry matching connected device from cached list.
+ * Returns NULL if the device is not in cache.
+ */
+static descriptor_cache_entry *
+descriptor_cache_take(descriptor_callback_context *ctx, const char *hub, ULONG port,
+                      USHORT deviceAddress, PUSB_DEVICE_DESCRIPTOR device)
+{
+    descriptor_cache_entry **link;
+
+    for (link = &ctx->cached; *link; link = &(*link)->next)
+    {
+        descriptor_cache_entry *entry = *link;
+
+        if ((entry->record.port == port) &&
+            (entry->record.deviceAddress == deviceAddress) &&
+            (memcmp(&entry->record.device, device, sizeof(USB_DEVICE_DESCRIPTOR)) == 0) &&
+            (strcmp(entry->hub, hub) == 0))
+        {
+            *link = entry->next;
+            entry->next = NULL;
+            return entry;
+        }
+    }
+
+    return NULL;
 }
 
 static void initialize_control_header(PUSBPCAP_BUFFER_CONTROL_HEADER hdr,
@@ -150,42 +338,6 @@ static void initialize_control_header(PUSBPCAP_BUFFER_CONTROL_HEADER hdr,
     hdr->stage = stage;
 }
 
-static void add_to_list(descriptor_callback_context *ctx, void *data, int length)
-{
-    list_entry *new_tail = (list_entry*)malloc(sizeof(list_entry));
-    new_tail->data = data;
-    new_tail->length = length;
-    new_tail->next = NULL;
-    if (ctx->tail)
-    {
-        ctx->tail->next = new_tail;
-        ctx->tail = new_tail;
-    }
-    else
-    {
-        ctx->head = ctx->tail = new_tail;
-    }
-}
-
-static void free_list(list_entry *head)
-{
-    list_entry *e;
-
-    if (!head)
-    {
-        return;
-    }
-
-    e = head;
-    while (e)
-    {
-        list_entry *tmp = e;
-        e = e->next;
-        free(tmp->data);
-        free(tmp);
-    }
-}
-
 static void write_setup_packet(descriptor_callback_context *ctx,
                                USHORT function,
                                USHORT deviceAddress,
@@ -196,10 +348,15 @@ static void write_setup_packet(descriptor_callback_context *ctx,
                                UINT16 wLength,
                                BOOL out)
 {
-    int data_len = sizeof(USBPCAP_BUFFER_CONTROL_HEADER) + 8;
-    UINT8 *data = (UINT8*)malloc(data_len);
+    UINT8 *data = arena_add_record(ctx, sizeof(USBPCAP_BUFFER_CONTROL_HEADER) + 8);
     PUSBPCAP_BUFFER_CONTROL_HEADER hdr = (PUSBPCAP_BUFFER_CONTROL_HEADER)data;
-    UINT8 *setup = &data[sizeof(USBPCAP_BUFFER_CONTROL_HEADER)];
+    UINT8 *setup;
+
+    if (!data)
+    {
+        return;
+    }
+    setup = &data[sizeof(USBPCAP_BUFFER_CONTROL_HEADER)];
 
     initialize_control_header(hdr, ctx->roothub, deviceAddress, 8,
                               USBPCAP_CONTROL_STAGE_SETUP, function, FALSE, out);
@@ -212,8 +369,6 @@ static void write_setup_packet(descriptor_callback_context *ctx,
     setup[5] = (wIndex & 0xFF00) >> 8;
     setup[6] = (wLength & 0x00FF);
     setup[7] = (wLength & 0xFF00) >> 8;
-
-    add_to_list(ctx, data, data_len);
 }
 
 static void write_complete_packet(descriptor_callback_context *ctx,
@@ -223,18 +378,20 @@ static void write_complete_packet(descriptor_callback_context *ctx,
                                   int payload_length,
                                   BOOL out)
 {
-    int data_len = sizeof(USBPCAP_BUFFER_CONTROL_HEADER) + payload_length;
-    UINT8 *data = (UINT8*)malloc(data_len);
+    UINT8 *data = arena_add_record(ctx, sizeof(USBPCAP_BUFFER_CONTROL_HEADER) + payload_length);
     PUSBPCAP_BUFFER_CONTROL_HEADER hdr = (PUSBPCAP_BUFFER_CONTROL_HEADER)data;
 
+    if (!data)
+    {
+        return;
+    }
+
     initialize_control_header(hdr, ctx->roothub, deviceAddress, payload_length,
                               USBPCAP_CONTROL_STAGE_COMPLETE, function, TRUE, out);
     if (payload_length > 0)
     {
         memcpy(&data[sizeof(USBPCAP_BUFFER_CONTROL_HEADER)], payload, payload_length);
     }
-
-    add_to_list(ctx, data, data_len);
 }
 
 static void
@@ -242,10 +399,15 @@ write_device_descriptor_complete(descriptor_callback_context *ctx,
                                  USHORT deviceAddress,
                                  PUSB_DEVICE_DESCRIPTOR descriptor)
 {
-    int data_len = sizeof(USBPCAP_BUFFER_CONTROL_HEADER) + 18;
-    UINT8 *data = (UINT8*)malloc(data_len);
+    UINT8 *data = arena_add_record(ctx, sizeof(USBPCAP_BUFFER_CONTROL_HEADER) + 18);
     PUSBPCAP_BUFFER_CONTROL_HEADER hdr = (PUSBPCAP_BUFFER_CONTROL_HEADER)data;
-    UINT8 *payload = &data[sizeof(USBPCAP_BUFFER_CONTROL_HEADER)];
+    UINT8 *payload;
+
+    if (!data)
+    {
+        return;
+    }
+    payload = &data[sizeof(USBPCAP_BUFFER_CONTROL_HEADER)];
 
     initialize_control_header(hdr, ctx->roothub, deviceAddress, 18,
                               USBPCAP_CONTROL_STAGE_COMPLETE,
@@ -269,16 +431,157 @@ write_device_descriptor_complete(descriptor_callback_context *ctx,
     payload[15] = descriptor->iProduct;
     payload[16] = descriptor->iSerialNumber;
     payload[17] = descriptor->bNumConfigurations;
+}
+
+static void write_set_configuration(descriptor_callback_context *ctx,
+                                    USHORT deviceAddress,
+                                    UCHAR bConfigurationValue)
+{
+    write_setup_packet(ctx, URB_SELECT_CONFIGURATION, deviceAddress,
+                       0x00, 9, bConfigurationValue, 0, 0, TRUE);
+    write_complete_packet(ctx, URB_SELECT_CONFIGURATION, deviceAddress,
+                          NULL, 0, TRUE);
+}
+
+/* Get configuration descriptor for given device and write the GET DESCRIPTOR
+ * and SET CONFIGURATION transfers to arena.
+ *
+ * hub - HANDLE to USB hub
+ * hubName - hub symbolic link name
+ * port - hub port number to which the device whose descriptor is queried is connected
+ * device - device descriptor reported by hub
+ * index - 0-based configuration descriptor index
+ *
+ * The complete descriptor is requested directly into the packet payload.
+ * On failure, no packets are written.
+ *
+ * Returns cache entry holding copy of the descriptor. On failure, returns NULL.
+ */
+static descriptor_cache_entry *
+write_config_descriptor(descriptor_callback_context *ctx,
+                        HANDLE hub, const char *hubName, ULONG port,
+                        USHORT deviceAddress, PUSB_DEVICE_DESCRIPTOR device,
+                        UCHAR index)
+{
+    ULONG nBytes = 0;
+    ULONG nBytesReturned = 0;
+    UCHAR buffer[sizeof(USB_DESCRIPTOR_REQUEST) + sizeof(USB_CONFIGURATION_DESCRIPTOR)];
+    PUSB_DESCRIPTOR_REQUEST request = NULL;
+    PUSB_CONFIGURATION_DESCRIPTOR descriptor = NULL;
+    USHORT wValue = (USB_CONFIGURATION_DESCRIPTOR_TYPE << 8) | index;
+    USHORT wTotalLength;
+    UCHAR bConfigurationValue;
+    int rollback = ctx->arena->length;
+    UINT8 *data;
+    descriptor_cache_entry *entry;
+
+    /* This function does two queries for the descriptor:
+     *   * 1st time to obtain the configuration descriptor itself
+     *   * 2nd time to obtain the configuration descriptor and all interface and
+     *     endpoint descriptors
+     */
+    nBytes = sizeof(buffer);
+    request = (PUSB_DESCRIPTOR_REQUEST)buffer;
+    descriptor = (PUSB_CONFIGURATION_DESCRIPTOR)(request->Data);
+
+    memset(request, 0, nBytes);
+    request->ConnectionIndex = port;
+    request->SetupPacket.bmRequest = 0x80; /* Device to Host */
+    request->SetupPacket.bRequest = 0x06; /* GET DESCRIPTOR */
+    request->SetupPacket.wValue = wValue;
+    request->SetupPacket.wIndex = 0; /* Language ID for String Descriptors */
+    request->SetupPacket.wLength = (USHORT)(nBytes - sizeof(USB_DESCRIPTOR_REQUEST));
+
+    if (!DeviceIoControl(hub, IOCTL_USB_GET_DESCRIPTOR_FROM_NODE_CONNECTION,
+                         request, nBytes, request, nBytes, &nBytesReturned, NULL))
+    {
+        fprintf(stderr, "Failed to get descriptor - %d\n", GetLastError());
+        return NULL;
+    }
+
+    if (nBytes != nBytesReturned)
+    {
+        fprintf(stderr, "Get Descriptor IOCTL returned %d bytes (requested %d)\n",
+                nBytesReturned, nBytes);
+        return NULL;
+    }
+
+    if (descriptor->wTotalLength < sizeof(USB_CONFIGURATION_DESCRIPTOR))
+    {
+        fprintf(stderr, "Configuration descriptor is too small (%d) to hold the common data\n",
+                descriptor->wTotalLength);
+        return NULL;
+    }
+    wTotalLength = descriptor->wTotalLength;
+
+    write_setup_packet(ctx, URB_GET_DESCRIPTOR_FROM_DEVICE, deviceAddress,
+                       0x80, 0x06, wValue, 0, wTotalLength, FALSE);
+
+    data = arena_add_record(ctx, sizeof(USBPCAP_BUFFER_CONTROL_HEADER) + wTotalLength);
+    if ((ctx->arena->length == rollback) || !data)
+    {
+        ctx->arena->length = rollback;
+        return NULL;
+    }
+
+    /* The request header is placed just before the payload. It fits within
+     * the control header, which is filled in after the descriptor is read.
+     */
+    nBytes = sizeof(USB_DESCRIPTOR_REQUEST) + wTotalLength;
+    request = (PUSB_DESCRIPTOR_REQUEST)&data[sizeof(USBPCAP_BUFFER_CONTROL_HEADER) -
+                                             sizeof(USB_DESCRIPTOR_REQUEST)];
+    descriptor = (PUSB_CONFIGURATION_DESCRIPTOR)(request->Data);
+    request->ConnectionIndex = port;
+    request->SetupPacket.bmRequest = 0x80; /* Device to Host */
+    request->SetupPacket.bRequest = 0x06; /* GET DESCRIPTOR */
+    request->SetupPacket.wValue = wValue;
+    request->SetupPacket.wIndex = 0; /* Language ID for String Descriptors */
+    request->SetupPacket.wLength = wTotalLength;
+    if (!DeviceIoControl(hub, IOCTL_USB_GET_DESCRIPTOR_FROM_NODE_CONNECTION,
+                         request, nBytes, request, nBytes, &nBytesReturned, NULL))
+    {
+        fprintf(stderr, "Failed to get descriptor - %d\n", GetLastError());
+        ctx->arena->length = rollback;
+        return NULL;
+    }
 
-    add_to_list(ctx, data, data_len);
+    if (nBytes != nBytesReturned)
+    {
+        fprintf(stderr, "Get Descriptor IOCTL returned %d bytes (requested %d)\n",
+                nBytesReturned, nBytes);
+        ctx->arena->length = rollback;
+        return NULL;
+    }
+
+    if (descriptor->wTotalLength != wTotalLength)
+    {
+        fprintf(stderr, "wTotalLength changed between calls\n");
+        ctx->arena->length = rollback;
+        return NULL;
+    }
+    bConfigurationValue = descriptor->bConfigurationValue;
+
+    entry = descriptor_cache_new_entry(hubName, port, deviceAddress, device, wTotalLength);
+    if (entry)
+    {
+        memcpy(entry->config, descriptor, wTotalLength);
+    }
+
+    initialize_control_header((PUSBPCAP_BUFFER_CONTROL_HEADER)data, ctx->roothub,
+                              deviceAddress, wTotalLength,
+                              USBPCAP_CONTROL_STAGE_COMPLETE, URB_CONTROL_TRANSFER,
+                              TRUE, FALSE);
+
+    write_set_configuration(ctx, deviceAddress, bConfigurationValue);
+    return entry;
 }
 
 static void
-descriptor_callback(HANDLE hub, ULONG port, USHORT deviceAddress,
+descriptor_callback(HANDLE hub, const char *hubName, ULONG port, USHORT deviceAddress,
                     PUSB_DEVICE_DESCRIPTOR desc, void *context)
 {
     descriptor_callback_context *ctx = (descriptor_callback_context *)context;
-    PUSB_DESCRIPTOR_REQUEST request;
+    descriptor_cache_entry *entry;
 
     if (!USBPcapIsDeviceFiltered(ctx->addresses, deviceAddress))
     {
@@ -290,79 +593,42 @@ descriptor_callback(HANDLE hub, ULONG port, USHORT deviceAddress,
                        USB_DEVICE_DESCRIPTOR_TYPE << 8, 0, 18, FALSE);
     write_device_descriptor_complete(ctx, deviceAddress, desc);
 
-    request = get_config_descriptor(hub, port, 0);
-    if (request)
+    entry = descriptor_cache_take(ctx, hubName, port, deviceAddress, desc);
+    if (entry)
     {
         PUSB_CONFIGURATION_DESCRIPTOR config;
-        config = (PUSB_CONFIGURATION_DESCRIPTOR)(request->Data);
-        write_setup_packet(ctx, URB_GET_DESCRIPTOR_FROM_DEVICE,
-                           deviceAddress,
-                           request->SetupPacket.bmRequest,
-                           request->SetupPacket.bRequest,
-                           request->SetupPacket.wValue,
-                           request->SetupPacket.wIndex,
-                           request->SetupPacket.wLength,
-                           FALSE);
-
-        write_complete_packet(ctx, URB_CONTROL_TRANSFER,
-                              deviceAddress, request->Data,
-                              request->SetupPacket.wLength, FALSE);
-
-        /* SET CONFIGURATION */
-        write_setup_packet(ctx, URB_SELECT_CONFIGURATION, deviceAddress,
-                           0x00, 9, config->bConfigurationValue, 0, 0, TRUE);
-        write_complete_packet(ctx, URB_SELECT_CONFIGURATION, deviceAddress,
-                              NULL, 0, TRUE);
-    }
-    free(request);
-}
-
-void *generate_pcap_packets(list_entry *head, int *out_len)
-{
-    int total_length = 0;
-    list_entry *e;
-    UINT8 *pcap;
-    int offset;
-
-    for (e = head; e; e = e->next)
+        config = (PUSB_CONFIGURATION_DESCRIPTOR)entry->config;
+
+        write_setup_packet(ctx, URB_GET_DESCRIPTOR_FROM_DEVICE, deviceAddress,
+                           0x80, 0x06, USB_CONFIGURATION_DESCRIPTOR_TYPE << 8, 0,
+                           entry->record.wTotalLength, FALSE);
+        write_complete_packet(ctx, URB_CONTROL_TRANSFER, deviceAddress,
+                              entry->config, entry->record.wTotalLength, FALSE);
+        write_set_configuration(ctx, deviceAddress, config->bConfigurationValue);
+    }
+    else
     {
-        total_length += sizeof(pcaprec_hdr_t);
-        total_length += e->length;
+        entry = write_config_descriptor(ctx, hub, hubName, port, deviceAddress, desc, 0);
+        if (entry)
+        {
+            ctx->changed = TRUE;
+        }
     }
 
-    *out_len = total_length;
-    pcap = (UINT8*)malloc(total_length);
-    offset = 0;
-    for (e = head; e; e = e->next)
+    if (entry)
     {
-        FILETIME ts;
-        ULARGE_INTEGER timestamp;
-        pcaprec_hdr_t hdr;
-
-        GetSystemTimeAsFileTime(&ts);
-        timestamp.LowPart = ts.dwLowDateTime;
-        timestamp.HighPart = ts.dwHighDateTime;
-
-        hdr.ts_sec = (UINT32)(timestamp.QuadPart/10000000-11644473600);
-        hdr.ts_usec = (UINT32)((timestamp.QuadPart%10000000)/10);
-        hdr.incl_len = e->length;
-        hdr.orig_len = e->length;
-
-        memcpy(&pcap[offset], &hdr, sizeof(pcaprec_hdr_t));
-        offset += sizeof(pcaprec_hdr_t);
-
-        memcpy(&pcap[offset], e->data, e->length);
-        offset += e->length;
+        entry->next = ctx->seen;
+        ctx->seen = entry;
     }
-
-    return pcap;
 }
 
-void *descriptors_generate_pcap(const char *filter, int *pcap_length, PUSBPCAP_ADDRESS_FILTER addresses)
+void descriptors_generate_pcap(descriptors_arena *arena, const char *filter,
+                               PUSBPCAP_ADDRESS_FILTER addresses)
 {
-    void *pcap_packets;
-    int pcap_packets_length;
     descriptor_callback_context ctx;
+    char *cache_path;
+    FILETIME ts;
+    ULARGE_INTEGER timestamp;
     const char *tmp;
     for (tmp = filter; *tmp; ++tmp) { /* Nothing to do here */ }
     --tmp;
@@ -380,17 +646,43 @@ void *descriptors_generate_pcap(const char *filter, int *pcap_length, PUSBPCAP_A
     }
     ctx.roothub = (USHORT)atoi(tmp);
     ctx.addresses = addresses;
-    ctx.head = NULL;
-    ctx.tail = NULL;
+    ctx.arena = arena;
+
+    GetSystemTimeAsFileTime(&ts);
+    timestamp.LowPart = ts.dwLowDateTime;
+    timestamp.HighPart = ts.dwHighDateTime;
+    ctx.ts_sec = (UINT32)(timestamp.QuadPart/10000000-11644473600);
+    ctx.ts_usec = (UINT32)((timestamp.QuadPart%10000000)/10);
+
+    /* Configuration descriptors of devices that are still connected with
+     * the same address and device descriptor are not requested again.
+     */
+    cache_path = descriptor_cache_path(ctx.roothub);
+    ctx.cached = cache_path ? descriptor_cache_load(cache_path) : NULL;
+    ctx.seen = NULL;
+    ctx.changed = FALSE;
+
+    /* Previously generated packets are discarded but the memory is reused */
+    arena->length = 0;
     enumerate_all_connected_devices(filter, descriptor_callback, &ctx);
 
-    pcap_packets = generate_pcap_packets(ctx.head, &pcap_packets_length);
-    free_list(ctx.head);
-    *pcap_length = pcap_packets_length;
-    return pcap_packets;
+    if (ctx.cached)
+    {
+        /* Disconnected devices are removed from cache */
+        ctx.changed = TRUE;
+    }
+    if (cache_path && ctx.changed)
+    {
+        descriptor_cache_save(cache_path, ctx.seen);
+    }
+
+    descriptor_cache_free(ctx.cached);
+    descriptor_cache_free(ctx.seen);
+    free(cache_path);
 }
 
-void descriptors_free_pcap(void *pcap)
+void descriptors_free_pcap(descriptors_arena *arena)
 {
-    free(pcap);
+    free(arena->data);
+    memset(arena, 0, sizeof(descriptors_arena));
 }
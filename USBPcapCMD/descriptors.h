@@ -9,7 +9,20 @@
 
 #include "iocontrol.h"
 
-void *descriptors_generate_pcap(const char *filter, int *pcap_length, PUSBPCAP_ADDRESS_FILTER addresses);
-void descriptors_free_pcap(void *pcap);
+/* Pcap records (pcaprec_hdr_t followed by packet data) describing already
+ * connected devices. The buffer is kept when the records are generated
+ * again, e.g. for a new output file, so it is only reallocated if the
+ * records do not fit.
+ */
+typedef struct
+{
+    UINT8 *data;
+    int length; /* Length of records in bytes */
+    int size;   /* Allocated size of data in bytes */
+} descriptors_arena;
+
+void descriptors_generate_pcap(descriptors_arena *arena, const char *filter,
+                               PUSBPCAP_ADDRESS_FILTER addresses);
+void descriptors_free_pcap(descriptors_arena *arena);
 
 #endif /* USBPCAP_DESCRIPTORS_H */
@@ -20,21 +20,7 @@
 #include <tchar.h>
 #include "USBPcap.h"
 #include "enum.h"
-
-/*
- * level - Tree depth level
- * port - Port the device is attached to on hub. 0 if does not apply (root hub or device node).
- * display - Buffer holding human-readable text describing device
- * deviceAddress - USB address assigned to device
- * parentAddress - USB address of parent hub, 0 if directly attached to Root Hub
- * node - Running index of child device instance. When this is non-zero, device instance children
- *        are being enumerated. They are enumerated to make it easy for user to determine what
- *        the parent "USB Composite Device" is.
- * parentNode - 0 if the node is directly under deviceAddress, otherwise a index of parent node
- */
-typedef void (*EnumDeviceInfoCallback)(ULONG level, ULONG port, TCHAR display[MAX_DEVICE_ID_LEN],
-                                       USHORT deviceAddress, USHORT parentAddress,
-                                       ULONG node, ULONG parentNode);
+#include "topology.h"
 
 #define IOCTL_OUTPUT_BUFFER_SIZE 1024
 
@@ -129,9 +115,6 @@ fallback:
 }
 
 static void EnumerateHub(PTSTR hub,
-                         PUSB_NODE_CONNECTION_INFORMATION connection_info,
-                         ULONG level,
-                         EnumDeviceInfoCallback callback,
                          EnumConnectedPortCallback port_callback, void *port_ctx);
 
 static void print_indent(ULONG level)
@@ -237,49 +220,43 @@ static PTSTR WideStrToMultiStr(__in LPCWSTR WideStr)
 #endif
 }
 
-void print_usbpcapcmd(ULONG level, ULONG port, TCHAR display[MAX_DEVICE_ID_LEN],
-                      USHORT deviceAddress, USHORT parentAddress,
-                      ULONG node, ULONG parentNode)
+void print_usbpcapcmd(const topology_entry *entry, void *ctx)
 {
-    (void)deviceAddress;
-    (void)parentAddress;
-    (void)node;
-    (void)parentNode;
-    print_indent(level + 2);
-    if (port)
+    (void)ctx;
+    print_indent(entry->level + 2);
+    if (entry->port)
     {
-        printf("[Port %d] ", port);
+        printf("[Port %d] ", entry->port);
     }
-    wide_print((PWSTR)display);
+    wide_print(entry->display);
     printf("\n");
 }
 
-void print_extcap_config(ULONG level, ULONG port, TCHAR display[MAX_DEVICE_ID_LEN],
-                         USHORT deviceAddress, USHORT parentAddress,
-                         ULONG node, ULONG parentNode)
+void print_extcap_config(const topology_entry *entry, void *ctx)
 {
-    PTSTR str = WideStrToUTF8((LPCWSTR)display);
+    PTSTR str = WideStrToUTF8(entry->display);
 
-    if (node)
+    (void)ctx;
+    if (entry->node)
     {
         printf("value {arg=%d}{value=%d_%d}{display=%s}{enabled=false}",
-               EXTCAP_ARGNUM_MULTICHECK, deviceAddress, node, str);
-        if (parentNode)
+               EXTCAP_ARGNUM_MULTICHECK, entry->deviceAddress, entry->node, str);
+        if (entry->parentNode)
         {
-            printf("{parent=%d_%d}", deviceAddress, parentNode);
+            printf("{parent=%d_%d}", entry->deviceAddress, entry->parentNode);
         }
         else
         {
-            printf("{parent=%d}", deviceAddress);
+            printf("{parent=%d}", entry->deviceAddress);
         }
     }
     else
     {
         printf("value {arg=%d}{value=%d}{display=[%d] %s}{enabled=true}",
-               EXTCAP_ARGNUM_MULTICHECK, deviceAddress, deviceAddress, str);
-        if (parentAddress)
+               EXTCAP_ARGNUM_MULTICHECK, entry->deviceAddress, entry->deviceAddress, str);
+        if (entry->parentAddress)
         {
-            printf("{parent=%d}", parentAddress);
+            printf("{parent=%d}", entry->parentAddress);
         }
     }
     printf("\n");
@@ -525,14 +502,14 @@ static BOOL stack_push(Stack **stack, USHORT value)
 
 
 static VOID PrintDevinstChildren(DEVINST parent, ULONG indent,
-                                 USHORT deviceAddress, EnumDeviceInfoCallback callback)
+                                 topology_entry_callback callback, void *ctx)
 {
     DEVINST    current;
     DEVINST    next;
     CONFIGRET  cr;
     ULONG      level;
     ULONG      len;
-    TCHAR      buf[MAX_DEVICE_ID_LEN];
+    topology_entry entry;
     USHORT     parentNode = 0;
     USHORT     nextNode = 1;
     Stack      *nodeStack = NULL;
@@ -560,33 +537,37 @@ static VOID PrintDevinstChildren(DEVINST parent, ULONG indent,
             fprintf(stderr, "Sanity check failed in PrintDevinstChildren()\n");
             return;
         }
-        len = sizeof(buf) / sizeof(buf[0]);
+        memset(&entry, 0, sizeof(entry));
+        len = sizeof(entry.display);
         cr = CM_Get_DevNode_Registry_PropertyW(current,
                                                CM_DRP_FRIENDLYNAME,
                                                NULL,
-                                               buf,
+                                               entry.display,
                                                &len,
                                                0);
         if (cr != CR_SUCCESS)
         {
-            len = sizeof(buf) / sizeof(buf[0]);
+            len = sizeof(entry.display);
             /* Failed to get friendly name,
              * display device description instead */
             cr = CM_Get_DevNode_Registry_PropertyW(current,
                                                    CM_DRP_DEVICEDESC,
                                                    NULL,
-                                                   buf,
+                                                   entry.display,
                                                    &len,
                                                    0);
         }
 
-        if (cr == CR_SUCCESS && (((PWSTR)buf)[0] != L'\0'))
+        if (cr == CR_SUCCESS && (entry.display[0] != L'\0'))
         {
             if (!stack_peek(&nodeStack, &parentNode))
             {
                 parentNode = 0;
             }
-            callback(level, 0, buf, deviceAddress, deviceAddress, nextNode, parentNode);
+            entry.level = level;
+            entry.node = nextNode;
+            entry.parentNode = parentNode;
+            callback(&entry, ctx);
         }
 
         // Go down a level to the first next.
@@ -646,16 +627,41 @@ static VOID PrintDevinstChildren(DEVINST parent, ULONG indent,
     }
 }
 
-VOID PrintDeviceDesc(__in PCTSTR DriverName, ULONG Index,
-                     ULONG Level, BOOLEAN PrintAllChildren,
-                     USHORT deviceAddress, USHORT parentAddress,
-                     EnumDeviceInfoCallback callback)
+
+typedef struct
+{
+    DEVINST devInst;
+    TCHAR   driver[MAX_DEVICE_ID_LEN];
+} DriverKeyIndexEntry;
+
+/* Context of Windows topology_ops implementation */
+typedef struct
+{
+    const char          *filter;  /* USBPcap control device, e.g. \\.\USBPcap1 */
+    CRITICAL_SECTION     lock;
+    BOOL                 built;
+    DriverKeyIndexEntry *drivers; /* Sorted by driver key name */
+    ULONG                count;
+} EnumTopologyContext;
+
+static int compare_driver_key(const void *a, const void *b)
+{
+    return _tcsicmp(((const DriverKeyIndexEntry *)a)->driver,
+                    ((const DriverKeyIndexEntry *)b)->driver);
+}
+
+/* Walks the whole device tree once and records every devnode that has
+ * driver key name. Looking up devices in the index replaces separate
+ * depth first search for every connected device.
+ */
+static VOID BuildDriverKeyIndex(EnumTopologyContext *ctx)
 {
     DEVINST    devInst;
     DEVINST    devInstNext;
     CONFIGRET  cr;
     ULONG      walkDone = 0;
     ULONG      len;
+    ULONG      size = 0;
     TCHAR      buf[MAX_DEVICE_ID_LEN];
 
     // Sanity counters to prevent endless loops
@@ -670,14 +676,12 @@ VOID PrintDeviceDesc(__in PCTSTR DriverName, ULONG Index,
         return;
     }
 
-    // Do a depth first search for the DevNode with a matching
-    // DriverName value
     while (!walkDone)
     {
         if ((++sanityOuter) > LOOP_SANITY_LIMIT)
         {
-            fprintf(stderr, "Sanity check failed in PrintDeviceDesc() outer loop!\n");
-            return;
+            fprintf(stderr, "Sanity check failed in BuildDriverKeyIndex() outer loop!\n");
+            break;
         }
         // Get the DriverName value
         len = sizeof(buf) / sizeof(buf[0]);
@@ -688,33 +692,25 @@ VOID PrintDeviceDesc(__in PCTSTR DriverName, ULONG Index,
                                               &len,
                                               0);
 
-        // If the DriverName value matches, return the DeviceDescription
         if (cr == CR_SUCCESS)
         {
-            if (_tcsicmp(DriverName, buf) == 0)
+            if (ctx->count == size)
             {
-                len = sizeof(buf) / sizeof(buf[0]);
-
-                cr = CM_Get_DevNode_Registry_PropertyW(devInst,
-                                                       CM_DRP_DEVICEDESC,
-                                                       NULL,
-                                                       buf,
-                                                       &len,
-                                                       0);
+                DriverKeyIndexEntry *tmp;
 
-
-                if (cr == CR_SUCCESS)
+                size = size ? size * 2 : 64;
+                tmp = realloc(ctx->drivers, size * sizeof(DriverKeyIndexEntry));
+                if (tmp == NULL)
                 {
-                    callback(Level, Index, buf, deviceAddress, parentAddress, 0, 0);
-                    if (PrintAllChildren)
-                    {
-                        PrintDevinstChildren(devInst, Level, deviceAddress, callback);
-                    }
+                    OOPS();
+                    break;
                 }
-
-                // Nothing left to do
-                return;
+                ctx->drivers = tmp;
             }
+
+            ctx->drivers[ctx->count].devInst = devInst;
+            _tcscpy_s(ctx->drivers[ctx->count].driver, MAX_DEVICE_ID_LEN, buf);
+            ctx->count++;
         }
         else if (cr == CR_NO_SUCH_VALUE)
         {
@@ -723,10 +719,10 @@ VOID PrintDeviceDesc(__in PCTSTR DriverName, ULONG Index,
         else
         {
             fprintf(stderr, "Failed to get CM_DRP_DRIVER: 0x%08X\n", cr);
-            return;
+            break;
         }
 
-        // This DevNode didn't match, go down a level to the first child.
+        // Go down a level to the first child.
         cr = CM_Get_Child(&devInstNext, devInst, 0);
 
         if (cr == CR_SUCCESS)
@@ -744,8 +740,9 @@ VOID PrintDeviceDesc(__in PCTSTR DriverName, ULONG Index,
         {
             if ((++sanityInner) > LOOP_SANITY_LIMIT)
             {
-                fprintf(stderr, "Sanity check failed in PrintDeviceDesc() inner loop!\n");
-                return;
+                fprintf(stderr, "Sanity check failed in BuildDriverKeyIndex() inner loop!\n");
+                walkDone = 1;
+                break;
             }
 
             cr = CM_Get_Sibling(&devInstNext, devInst, 0);
@@ -773,124 +770,88 @@ VOID PrintDeviceDesc(__in PCTSTR DriverName, ULONG Index,
             else
             {
                 fprintf(stderr, "CM_Get_Sibling() returned 0x%08X\n", cr);
-                return;
+                walkDone = 1;
+                break;
             }
         }
     }
+
+    if (ctx->count > 0)
+    {
+        qsort(ctx->drivers, ctx->count, sizeof(DriverKeyIndexEntry), compare_driver_key);
+    }
 }
 
-static VOID
-EnumerateHubPorts(HANDLE hHubDevice, UCHAR NumPorts, ULONG level,
-                  USHORT hubAddress, EnumDeviceInfoCallback print_callback,
-                  EnumConnectedPortCallback port_callback, void *port_ctx)
+static BOOL FindDriverKey(EnumTopologyContext *ctx, __in PCTSTR DriverName,
+                          DEVINST *devInst)
 {
-    ULONG       index;
-    BOOL        success;
-
-    PTSTR driverKeyName;
+    DriverKeyIndexEntry key;
+    DriverKeyIndexEntry *found;
 
-    // Loop over all ports of the hub.
-    //
-    // Port indices are 1 based, not 0 based.
-    for (index=1; index <= NumPorts; index++)
+    /* Index is built by whichever hub walker thread needs it first */
+    EnterCriticalSection(&ctx->lock);
+    if (!ctx->built)
     {
-        USB_NODE_CONNECTION_INFORMATION    connectionInfo;
-        ULONG                               nBytes;
-
-        connectionInfo.ConnectionIndex = index;
-
-        success = DeviceIoControl(hHubDevice,
-                                  IOCTL_USB_GET_NODE_CONNECTION_INFORMATION,
-                                  &connectionInfo,
-                                  sizeof(USB_NODE_CONNECTION_INFORMATION),
-                                  &connectionInfo,
-                                  sizeof(USB_NODE_CONNECTION_INFORMATION),
-                                  &nBytes,
-                                  NULL);
-
-        if (!success)
-        {
-            OOPS();
-            continue;
-        }
+        BuildDriverKeyIndex(ctx);
+        ctx->built = TRUE;
+    }
+    LeaveCriticalSection(&ctx->lock);
 
-        // If there is a device connected, get the Device Description
-        if (connectionInfo.ConnectionStatus != NoDeviceConnected)
-        {
-            if (print_callback)
-            {
-                driverKeyName = GetDriverKeyName(hHubDevice,
-                                                 index);
+    if (ctx->count == 0)
+    {
+        return FALSE;
+    }
 
-                if (driverKeyName)
-                {
-                    PrintDeviceDesc(driverKeyName, index, level,
-                                    !connectionInfo.DeviceIsHub,
-                                    connectionInfo.DeviceAddress,
-                                    hubAddress,
-                                    print_callback);
+    _tcscpy_s(key.driver, MAX_DEVICE_ID_LEN, DriverName);
+    found = bsearch(&key, ctx->drivers, ctx->count, sizeof(DriverKeyIndexEntry),
+                    compare_driver_key);
+    if (found == NULL)
+    {
+        return FALSE;
+    }
 
-                    GlobalFree(driverKeyName);
-                }
-            }
+    *devInst = found->devInst;
+    return TRUE;
+}
 
-            if ((connectionInfo.ConnectionStatus == DeviceConnected) && port_callback)
-            {
-                port_callback(hHubDevice, index, connectionInfo.DeviceAddress,
-                              &connectionInfo.DeviceDescriptor, port_ctx);
-            }
+static VOID PrintDeviceDesc(EnumTopologyContext *ctx, __in PCTSTR DriverName,
+                            BOOLEAN PrintAllChildren,
+                            topology_entry_callback callback, void *callback_ctx)
+{
+    DEVINST        devInst;
+    CONFIGRET      cr;
+    ULONG          len;
+    topology_entry entry;
 
-            // If the device connected to the port is an external hub, get the
-            // name of the external hub and recursively enumerate it.
-            if (connectionInfo.DeviceIsHub)
-            {
-                PTSTR extHubName;
+    if (!FindDriverKey(ctx, DriverName, &devInst))
+    {
+        return;
+    }
 
-                extHubName = GetExternalHubName(hHubDevice,
-                                                index);
+    memset(&entry, 0, sizeof(entry));
+    len = sizeof(entry.display);
+    cr = CM_Get_DevNode_Registry_PropertyW(devInst,
+                                           CM_DRP_DEVICEDESC,
+                                           NULL,
+                                           entry.display,
+                                           &len,
+                                           0);
 
-                if (extHubName != NULL)
-                {
-                    EnumerateHub(extHubName,
-                                 &connectionInfo,
-                                 level+1,
-                                 print_callback,
-                                 port_callback,
-                                 port_ctx);
-                    GlobalFree(extHubName);
-                }
-            }
+    if (cr == CR_SUCCESS)
+    {
+        callback(&entry, callback_ctx);
+        if (PrintAllChildren)
+        {
+            PrintDevinstChildren(devInst, 0, callback, callback_ctx);
         }
     }
 }
 
-
-static void EnumerateHub(PTSTR hub,
-                         PUSB_NODE_CONNECTION_INFORMATION connection_info,
-                         ULONG level,
-                         EnumDeviceInfoCallback print_callback,
-                         EnumConnectedPortCallback port_callback, void *port_ctx)
+static HANDLE OpenHub(PTSTR hub)
 {
-    PUSB_NODE_INFORMATION   hubInfo;
     HANDLE                  hHubDevice;
     PTSTR                   deviceName;
     size_t                  deviceNameSize;
-    BOOL                    success;
-    ULONG                   nBytes;
-
-    // Initialize locals to not allocated state so the error cleanup routine
-    // only tries to cleanup things that were successfully allocated.
-    hubInfo     = NULL;
-    hHubDevice  = INVALID_HANDLE_VALUE;
-
-    // Allocate some space for a USB_NODE_INFORMATION structure for this Hub
-    hubInfo = (PUSB_NODE_INFORMATION)GlobalAlloc(GPTR, sizeof(USB_NODE_INFORMATION));
-
-    if (hubInfo == NULL)
-    {
-        OOPS();
-        goto EnumerateHubError;
-    }
 
     // Allocate a temp buffer for the full hub device name.
     deviceNameSize = _tcslen(hub) + _tcslen(_T("\\\\.\\")) + 1;
@@ -899,7 +860,7 @@ static void EnumerateHub(PTSTR hub,
     if (deviceName == NULL)
     {
         OOPS();
-        goto EnumerateHubError;
+        return INVALID_HANDLE_VALUE;
     }
 
     if (_tcsncmp(_T("\\\?\?\\"), hub, 4) == 0)
@@ -933,17 +894,25 @@ static void EnumerateHub(PTSTR hub,
     {
         fprintf(stderr, "unable to open %s\n", hub);
         OOPS();
-        goto EnumerateHubError;
     }
 
+    return hHubDevice;
+}
+
+static UCHAR GetHubPortCount(HANDLE hHubDevice)
+{
+    USB_NODE_INFORMATION    hubInfo;
+    BOOL                    success;
+    ULONG                   nBytes;
+
     // Now query USBHUB for the USB_NODE_INFORMATION structure for this hub.
     // This will tell us the number of downstream ports to enumerate, among
     // other things.
     success = DeviceIoControl(hHubDevice,
                               IOCTL_USB_GET_NODE_INFORMATION,
-                              hubInfo,
+                              &hubInfo,
                               sizeof(USB_NODE_INFORMATION),
-                              hubInfo,
+                              &hubInfo,
                               sizeof(USB_NODE_INFORMATION),
                               &nBytes,
                               NULL);
@@ -951,29 +920,232 @@ static void EnumerateHub(PTSTR hub,
     if (!success)
     {
         OOPS();
-        goto EnumerateHubError;
+        return 0;
+    }
+
+    return hubInfo.u.HubInformation.HubDescriptor.bNumberOfPorts;
+}
+
+static BOOL GetConnectionInformation(HANDLE hHubDevice, ULONG index,
+                                     PUSB_NODE_CONNECTION_INFORMATION connectionInfo)
+{
+    ULONG nBytes;
+
+    connectionInfo->ConnectionIndex = index;
+
+    return DeviceIoControl(hHubDevice,
+                           IOCTL_USB_GET_NODE_CONNECTION_INFORMATION,
+                           connectionInfo,
+                           sizeof(USB_NODE_CONNECTION_INFORMATION),
+                           connectionInfo,
+                           sizeof(USB_NODE_CONNECTION_INFORMATION),
+                           &nBytes,
+                           NULL);
+}
+
+static VOID
+EnumerateHubPorts(HANDLE hHubDevice, PTSTR hub, UCHAR NumPorts,
+                  EnumConnectedPortCallback port_callback, void *port_ctx)
+{
+    ULONG       index;
+
+    // Loop over all ports of the hub.
+    //
+    // Port indices are 1 based, not 0 based.
+    for (index=1; index <= NumPorts; index++)
+    {
+        USB_NODE_CONNECTION_INFORMATION    connectionInfo;
+
+        if (!GetConnectionInformation(hHubDevice, index, &connectionInfo))
+        {
+            OOPS();
+            continue;
+        }
+
+        if (connectionInfo.ConnectionStatus == DeviceConnected)
+        {
+            port_callback(hHubDevice, hub, index, connectionInfo.DeviceAddress,
+                          &connectionInfo.DeviceDescriptor, port_ctx);
+        }
+
+        // If the device connected to the port is an external hub, get the
+        // name of the external hub and recursively enumerate it.
+        if ((connectionInfo.ConnectionStatus != NoDeviceConnected) &&
+            connectionInfo.DeviceIsHub)
+        {
+            PTSTR extHubName;
+
+            extHubName = GetExternalHubName(hHubDevice,
+                                            index);
+
+            if (extHubName != NULL)
+            {
+                EnumerateHub(extHubName,
+                             port_callback,
+                             port_ctx);
+                GlobalFree(extHubName);
+            }
+        }
+    }
+}
+
+
+static void EnumerateHub(PTSTR hub,
+                         EnumConnectedPortCallback port_callback, void *port_ctx)
+{
+    HANDLE                  hHubDevice;
+
+    hHubDevice = OpenHub(hub);
+    if (hHubDevice == INVALID_HANDLE_VALUE)
+    {
+        return;
     }
 
     // Now recursively enumrate the ports of this hub.
     EnumerateHubPorts(hHubDevice,
-                      hubInfo->u.HubInformation.HubDescriptor.bNumberOfPorts,
-                      level,
-                      (connection_info == NULL) ? 0 : connection_info->DeviceAddress,
-                      print_callback, port_callback, port_ctx);
+                      hub,
+                      GetHubPortCount(hHubDevice),
+                      port_callback, port_ctx);
+
+    CloseHandle(hHubDevice);
+}
+
+static void *topology_open_hub(void *ctx, const char *hub)
+{
+    HANDLE hHubDevice = OpenHub((PTSTR)hub);
+
+    (void)ctx;
+    return (hHubDevice == INVALID_HANDLE_VALUE) ? NULL : hHubDevice;
+}
+
+static void topology_close_hub(void *ctx, void *hub)
+{
+    (void)ctx;
+    CloseHandle((HANDLE)hub);
+}
+
+static UCHAR topology_get_port_count(void *ctx, void *hub)
+{
+    (void)ctx;
+    return GetHubPortCount((HANDLE)hub);
+}
+
+static BOOL topology_get_connection(void *ctx, void *hub, ULONG port,
+                                    PUSB_NODE_CONNECTION_INFORMATION info)
+{
+    (void)ctx;
+    if (!GetConnectionInformation((HANDLE)hub, port, info))
+    {
+        OOPS();
+        return FALSE;
+    }
+    return TRUE;
+}
+
+static char *topology_get_external_hub_name(void *ctx, void *hub, ULONG port)
+{
+    PTSTR extHubName;
+    char *name = NULL;
+
+    (void)ctx;
+    extHubName = GetExternalHubName((HANDLE)hub, port);
+    if (extHubName != NULL)
+    {
+        name = _strdup(extHubName);
+        GlobalFree(extHubName);
+    }
+    return name;
+}
+
+static void topology_describe_device(void *ctx, void *hub, ULONG port, BOOL children,
+                                     topology_entry_callback callback, void *callback_ctx)
+{
+    PTSTR driverKeyName;
+
+    driverKeyName = GetDriverKeyName((HANDLE)hub, port);
+    if (driverKeyName)
+    {
+        PrintDeviceDesc((EnumTopologyContext *)ctx, driverKeyName, (BOOLEAN)children,
+                        callback, callback_ctx);
+        GlobalFree(driverKeyName);
+    }
+}
+
+/* USBPcap driver counts PnP events under the Root Hub. While the count
+ * does not change the cached tree is valid and no hub is opened. Older
+ * drivers fail the IOCTL, then every port is checked with
+ * IOCTL_USB_GET_NODE_CONNECTION_INFORMATION.
+ */
+static UINT64 topology_generation(void *ctx)
+{
+    HANDLE filter_handle;
+    UINT64 generation = 0;
+    DWORD  bytes_ret = 0;
 
-EnumerateHubError:
-    // Clean up any stuff that got allocated
+    filter_handle = CreateFileA(((EnumTopologyContext *)ctx)->filter,
+                                0,
+                                0,
+                                0,
+                                OPEN_EXISTING,
+                                0,
+                                0);
 
-    if (hHubDevice != INVALID_HANDLE_VALUE)
+    if (filter_handle == INVALID_HANDLE_VALUE)
     {
-        CloseHandle(hHubDevice);
-        hHubDevice = INVALID_HANDLE_VALUE;
+        return 0;
     }
 
-    if (hubInfo)
+    if (!DeviceIoControl(filter_handle,
+                         IOCTL_USBPCAP_GET_TOPOLOGY_GENERATION,
+                         NULL,
+                         0,
+                         &generation,
+                         sizeof(generation),
+                         &bytes_ret,
+                         0) ||
+        (bytes_ret != sizeof(generation)))
     {
-        GlobalFree(hubInfo);
+        generation = 0;
     }
+
+    CloseHandle(filter_handle);
+    return generation;
+}
+
+static const topology_ops windows_topology_ops =
+{
+    topology_open_hub,
+    topology_close_hub,
+    topology_get_port_count,
+    topology_get_connection,
+    topology_get_external_hub_name,
+    topology_describe_device,
+    topology_generation,
+};
+
+static void enumerate_topology(const char *filter, PTSTR hub,
+                               topology_entry_callback callback)
+{
+    EnumTopologyContext ctx;
+    char cache_dir[MAX_PATH + 1];
+    DWORD length;
+
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.filter = filter;
+    InitializeCriticalSection(&ctx.lock);
+
+    length = GetTempPathA(sizeof(cache_dir), cache_dir);
+    if ((length == 0) || (length > sizeof(cache_dir)))
+    {
+        cache_dir[0] = '\0';
+    }
+
+    topology_enumerate(&windows_topology_ops, &ctx, hub,
+                       (cache_dir[0] != '\0') ? cache_dir : NULL,
+                       callback, NULL);
+
+    DeleteCriticalSection(&ctx.lock);
+    free(ctx.drivers);
 }
 
 /**
@@ -1038,7 +1210,7 @@ void enumerate_print_usbpcap_interactive(const char *filter)
         printf("\n");
 
         str = WideStrToMultiStr(outBuf);
-        EnumerateHub(str, NULL, 0, print_usbpcapcmd, NULL, NULL);
+        enumerate_topology(filter, str, print_usbpcapcmd);
         GlobalFree(str);
     }
 }
@@ -1054,7 +1226,7 @@ void enumerate_print_extcap_config(const char *filter)
         PTSTR str;
 
         str = WideStrToMultiStr(outBuf);
-        EnumerateHub(str, NULL, 0, print_extcap_config, NULL, NULL);
+        enumerate_topology(filter, str, print_extcap_config);
         GlobalFree(str);
     }
 }
@@ -1070,7 +1242,7 @@ void enumerate_all_connected_devices(const char *filter, EnumConnectedPortCallba
         PTSTR str;
 
         str = WideStrToMultiStr(outBuf);
-        EnumerateHub(str, NULL, 0, NULL, cb, ctx);
+        EnumerateHub(str, cb, ctx);
         GlobalFree(str);
     }
 }
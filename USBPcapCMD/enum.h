@@ -12,7 +12,10 @@
 
 #define EXTCAP_ARGNUM_MULTICHECK 99
 
-typedef void (*EnumConnectedPortCallback)(HANDLE hub, ULONG port, USHORT deviceAddress, PUSB_DEVICE_DESCRIPTOR desc, void *ctx);
+/* hubName - Hub symbolic link name, unique while the hub is connected */
+typedef void (*EnumConnectedPortCallback)(HANDLE hub, const char *hubName, ULONG port,
+                                          USHORT deviceAddress, PUSB_DEVICE_DESCRIPTOR desc,
+                                          void *ctx);
 
 void enumerate_print_usbpcap_interactive(const char *filter);
 void enumerate_print_extcap_config(const char *filter);
@@ -0,0 +1,555 @@
+/*
+ * Copyright (c) 2026 Tomasz Moń <desowin@gmail.com>
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+/* Tests of io_engine and write_queue on epoll backend.
+ * Run with make -C USBPcapCMD/host check.
+ */
+
+#include <signal.h>
+#include <windows.h>
+#include "ioengine.h"
+#include "writequeue.h"
+
+#define TEST_PIPE_SIZE      4096
+#define TEST_LARGE_WRITE    (256 * 1024)
+#define TEST_POOL_THREADS   4
+#define TEST_POOL_PIPES     8
+#define TEST_POOL_MESSAGES  2000
+#define TEST_MESSAGE_SIZE   64
+
+static int failures;
+
+#define CHECK(condition) \
+    do \
+    { \
+        if (!(condition)) \
+        { \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); \
+            failures++; \
+        } \
+    } while (0)
+
+typedef struct
+{
+    volatile LONG calls;
+    volatile LONG inside;   /* Callback is running */
+    volatile LONG overlaps; /* Callback of the request ran on two threads */
+    DWORD error;
+    DWORD bytes;
+} test_result;
+
+static void test_record(io_request *request, DWORD error, DWORD bytes)
+{
+    test_result *result = (test_result *)request->ctx;
+
+    result->error = error;
+    result->bytes = bytes;
+    InterlockedIncrement(&result->calls);
+}
+
+static void test_pipe(HANDLE *server, HANDLE *client)
+{
+    static int counter;
+    char name[64];
+
+    sprintf_s(name, sizeof(name), "\\\\.\\pipe\\USBPcapEngineTest-%d", counter++);
+    *server = CreateNamedPipeA(name, PIPE_ACCESS_OUTBOUND, PIPE_TYPE_BYTE | PIPE_WAIT, 1,
+                               TEST_PIPE_SIZE, TEST_PIPE_SIZE, 0, NULL);
+    *client = CreateFileA(name, GENERIC_READ, 0, NULL, OPEN_EXISTING,
+                          FILE_FLAG_OVERLAPPED, NULL);
+    CHECK(*server != INVALID_HANDLE_VALUE);
+    CHECK(*client != INVALID_HANDLE_VALUE);
+}
+
+static void test_poll_timeout(void)
+{
+    io_engine *engine = io_engine_create();
+    DWORD start = GetTickCount();
+
+    CHECK(!io_engine_poll(engine, 20));
+    CHECK(GetLastError() == WAIT_TIMEOUT);
+    CHECK(GetTickCount() - start >= 15);
+
+    io_engine_wake(engine);
+    CHECK(io_engine_poll(engine, 0));
+    CHECK(!io_engine_poll(engine, 0));
+    io_engine_destroy(engine);
+}
+
+static void test_read(void)
+{
+    io_engine *engine = io_engine_create();
+    HANDLE server, client;
+    io_request request;
+    test_result result;
+    char buffer[16];
+    DWORD written;
+
+    memset(&result, 0, sizeof(result));
+    test_pipe(&server, &client);
+    CHECK(io_engine_attach(engine, client));
+    CHECK(!io_engine_attach(engine, client));
+    io_request_init(&request, engine, test_record, &result);
+
+    /* Nothing to read yet */
+    CHECK(io_read(&request, client, buffer, sizeof(buffer)));
+    CHECK(!io_engine_poll(engine, 10));
+    CHECK(result.calls == 0);
+
+    CHECK(WriteFile(server, "hello", 5, &written, NULL));
+    CHECK(io_engine_poll(engine, 1000));
+    CHECK(result.calls == 1);
+    CHECK(result.error == ERROR_SUCCESS);
+    CHECK(result.bytes == 5);
+    CHECK(memcmp(buffer, "hello", 5) == 0);
+
+    /* Data is there already, callback still waits for poll */
+    CHECK(WriteFile(server, "again", 5, &written, NULL));
+    CHECK(io_read(&request, client, buffer, sizeof(buffer)));
+    CHECK(result.calls == 1);
+    CHECK(io_engine_poll(engine, 0));
+    CHECK(result.calls == 2);
+    CHECK(result.bytes == 5);
+
+    /* Closed server end breaks the pipe */
+    CHECK(io_read(&request, client, buffer, sizeof(buffer)));
+    CloseHandle(server);
+    CHECK(io_engine_poll(engine, 1000));
+    CHECK(result.calls == 3);
+    CHECK(result.error == ERROR_BROKEN_PIPE);
+
+    io_engine_drain(engine);
+    io_engine_destroy(engine);
+    CloseHandle(client);
+}
+
+static void test_immediate_failure(void)
+{
+    io_engine *engine = io_engine_create();
+    HANDLE server, client;
+    io_request request;
+    test_result result;
+    char buffer[16];
+
+    memset(&result, 0, sizeof(result));
+    test_pipe(&server, &client);
+    io_request_init(&request, engine, test_record, &result);
+
+    /* Handle was never attached */
+    CHECK(io_read(&request, client, buffer, sizeof(buffer)));
+    CHECK(result.calls == 0);
+    CHECK(io_engine_poll(engine, 0));
+    CHECK(result.calls == 1);
+    CHECK(result.error == ERROR_INVALID_HANDLE);
+
+    io_engine_destroy(engine);
+    CloseHandle(server);
+    CloseHandle(client);
+}
+
+static void test_cancel(void)
+{
+    io_engine *engine = io_engine_create();
+    HANDLE server, client;
+    io_request request;
+    test_result result;
+    char buffer[16];
+
+    memset(&result, 0, sizeof(result));
+    test_pipe(&server, &client);
+    CHECK(io_engine_attach(engine, client));
+    io_request_init(&request, engine, test_record, &result);
+
+    CHECK(io_read(&request, client, buffer, sizeof(buffer)));
+    io_cancel(&request, client);
+    io_engine_drain(engine);
+    CHECK(result.calls == 1);
+    CHECK(result.error == ERROR_OPERATION_ABORTED);
+
+    /* Finished operation is not cancelled again */
+    io_cancel(&request, client);
+    CHECK(!io_engine_poll(engine, 0));
+
+    io_engine_destroy(engine);
+    CloseHandle(server);
+    CloseHandle(client);
+}
+
+static void test_write(void)
+{
+    io_engine *engine = io_engine_create();
+    HANDLE server, client;
+    io_request request;
+    test_result result;
+    unsigned char *data;
+    unsigned char *received;
+    DWORD total = 0;
+    DWORD i;
+
+    memset(&result, 0, sizeof(result));
+    data = (unsigned char *)malloc(TEST_LARGE_WRITE);
+    received = (unsigned char *)malloc(TEST_LARGE_WRITE);
+    for (i = 0; i < TEST_LARGE_WRITE; i++)
+    {
+        data[i] = (unsigned char)(i * 7);
+    }
+    test_pipe(&server, &client);
+    CHECK(io_engine_attach(engine, server));
+    io_request_init(&request, engine, test_record, &result);
+
+    /* Write much larger than pipe buffer finishes as reader drains it */
+    CHECK(io_write(&request, server, data, TEST_LARGE_WRITE));
+    CHECK(!io_engine_poll(engine, 10));
+    CHECK(result.calls == 0);
+    while (total < TEST_LARGE_WRITE)
+    {
+        DWORD read;
+
+        if (!ReadFile(client, &received[total], TEST_LARGE_WRITE - total, &read, NULL))
+        {
+            break;
+        }
+        total += read;
+        io_engine_poll(engine, 0);
+    }
+    while (result.calls == 0)
+    {
+        if (!io_engine_poll(engine, 1000))
+        {
+            break;
+        }
+    }
+    CHECK(result.calls == 1);
+    CHECK(result.error == ERROR_SUCCESS);
+    CHECK(result.bytes == TEST_LARGE_WRITE);
+    CHECK(total == TEST_LARGE_WRITE);
+    CHECK(memcmp(data, received, TEST_LARGE_WRITE) == 0);
+
+    /* Write to pipe without reader fails */
+    CloseHandle(client);
+    CHECK(io_write(&request, server, data, 16));
+    CHECK(io_engine_poll(engine, 1000));
+    CHECK(result.calls == 2);
+    CHECK(result.error == ERROR_NO_DATA);
+
+    io_engine_drain(engine);
+    io_engine_destroy(engine);
+    CloseHandle(server);
+    free(data);
+    free(received);
+}
+
+static void test_file_write(void)
+{
+    io_engine *engine = io_engine_create();
+    io_request request;
+    test_result result;
+    char name[64];
+    char contents[16];
+    HANDLE file;
+    FILE *check;
+    size_t length;
+
+    memset(&result, 0, sizeof(result));
+    sprintf_s(name, sizeof(name), "/tmp/usbpcap-enginetest-%u", GetCurrentProcessId());
+    file = CreateFileA(name, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS,
+                       FILE_ATTRIBUTE_NORMAL | FILE_FLAG_OVERLAPPED, NULL);
+    CHECK(file != INVALID_HANDLE_VALUE);
+    CHECK(io_engine_attach(engine, file));
+    io_request_init(&request, engine, test_record, &result);
+
+    /* Regular files are always ready, writes append */
+    CHECK(io_write(&request, file, "abc", 3));
+    CHECK(result.calls == 0);
+    CHECK(io_engine_poll(engine, 0));
+    CHECK(io_write(&request, file, "def", 3));
+    CHECK(io_engine_poll(engine, 0));
+    CHECK(result.calls == 2);
+    CHECK(result.bytes == 3);
+
+    io_engine_destroy(engine);
+    CloseHandle(file);
+
+    CHECK(fopen_s(&check, name, "rb") == 0);
+    length = fread(contents, 1, sizeof(contents), check);
+    fclose(check);
+    remove(name);
+    CHECK((length == 6) && (memcmp(contents, "abcdef", 6) == 0));
+}
+
+static void test_watch(void)
+{
+    io_engine *engine = io_engine_create();
+    HANDLE event = CreateEvent(NULL, TRUE, FALSE, NULL);
+    io_request request;
+    test_result result;
+
+    memset(&result, 0, sizeof(result));
+    io_request_init(&request, engine, test_record, &result);
+
+    CHECK(io_watch(&request, event));
+    CHECK(!io_engine_poll(engine, 10));
+    SetEvent(event);
+    CHECK(io_engine_poll(engine, 1000));
+    CHECK(result.calls == 1);
+
+    /* Watched events are ignored while draining */
+    CHECK(io_watch(&request, event));
+    Sleep(20);
+    io_unwatch(&request);
+    io_engine_drain(engine);
+    CHECK(io_engine_poll(engine, 0));
+    CHECK(result.calls == 1);
+
+    io_engine_destroy(engine);
+    CloseHandle(event);
+}
+
+/* Pipe read by pool, callbacks restart reads until all messages arrive */
+typedef struct
+{
+    HANDLE server;
+    HANDLE client;
+    io_request request;
+    test_result result;
+    unsigned char buffer[TEST_MESSAGE_SIZE * 4];
+    DWORD received;
+    BOOL corrupted;
+    HANDLE done;
+} test_reader;
+
+static void test_pool_read_done(io_request *request, DWORD error, DWORD bytes)
+{
+    test_reader *reader = (test_reader *)request->ctx;
+    DWORD i;
+
+    if (InterlockedExchange(&reader->result.inside, TRUE))
+    {
+        InterlockedIncrement(&reader->result.overlaps);
+    }
+    InterlockedIncrement(&reader->result.calls);
+
+    if (error != ERROR_SUCCESS)
+    {
+        reader->result.error = error;
+        InterlockedExchange(&reader->result.inside, FALSE);
+        SetEvent(reader->done);
+        return;
+    }
+
+    for (i = 0; i < bytes; i++)
+    {
+        if (reader->buffer[i] != (unsigned char)((reader->received + i) % 251))
+        {
+            reader->corrupted = TRUE;
+        }
+    }
+    reader->received += bytes;
+
+    /* Gives other threads a chance to run the same callback */
+    Sleep(0);
+    InterlockedExchange(&reader->result.inside, FALSE);
+
+    if (reader->received == TEST_POOL_MESSAGES * TEST_MESSAGE_SIZE)
+    {
+        SetEvent(reader->done);
+        return;
+    }
+    io_read(request, reader->client, reader->buffer, sizeof(reader->buffer));
+}
+
+static DWORD WINAPI test_pool_writer(LPVOID param)
+{
+    test_reader *readers = (test_reader *)param;
+    unsigned char message[TEST_MESSAGE_SIZE];
+    DWORD sent[TEST_POOL_PIPES];
+    int i, j, k;
+
+    memset(sent, 0, sizeof(sent));
+    for (i = 0; i < TEST_POOL_MESSAGES; i++)
+    {
+        for (j = 0; j < TEST_POOL_PIPES; j++)
+        {
+            DWORD written;
+
+            for (k = 0; k < TEST_MESSAGE_SIZE; k++)
+            {
+                message[k] = (unsigned char)((sent[j] + k) % 251);
+            }
+            WriteFile(readers[j].server, message, TEST_MESSAGE_SIZE, &written, NULL);
+            sent[j] += TEST_MESSAGE_SIZE;
+        }
+    }
+    return 0;
+}
+
+static void test_pool(void)
+{
+    io_engine *engine = io_engine_create();
+    test_reader readers[TEST_POOL_PIPES];
+    HANDLE writer;
+    int i;
+
+    memset(readers, 0, sizeof(readers));
+    for (i = 0; i < TEST_POOL_PIPES; i++)
+    {
+        test_pipe(&readers[i].server, &readers[i].client);
+        readers[i].done = CreateEvent(NULL, TRUE, FALSE, NULL);
+        CHECK(io_engine_attach(engine, readers[i].client));
+        io_request_init(&readers[i].request, engine, test_pool_read_done, &readers[i]);
+        io_read(&readers[i].request, readers[i].client, readers[i].buffer,
+                sizeof(readers[i].buffer));
+    }
+
+    CHECK(io_engine_start(engine, TEST_POOL_THREADS) == TEST_POOL_THREADS);
+    writer = CreateThread(NULL, 0, test_pool_writer, readers, 0, NULL);
+    for (i = 0; i < TEST_POOL_PIPES; i++)
+    {
+        CHECK(WaitForSingleObject(readers[i].done, 10000) == WAIT_OBJECT_0);
+    }
+    WaitForSingleObject(writer, INFINITE);
+    CloseHandle(writer);
+    io_engine_stop(engine);
+    io_engine_drain(engine);
+
+    for (i = 0; i < TEST_POOL_PIPES; i++)
+    {
+        CHECK(readers[i].result.error == ERROR_SUCCESS);
+        CHECK(readers[i].received == TEST_POOL_MESSAGES * TEST_MESSAGE_SIZE);
+        CHECK(!readers[i].corrupted);
+        CHECK(readers[i].result.overlaps == 0);
+        CloseHandle(readers[i].done);
+        CloseHandle(readers[i].server);
+        CloseHandle(readers[i].client);
+    }
+    io_engine_destroy(engine);
+}
+
+typedef struct
+{
+    HANDLE client;
+    DWORD received;
+    BOOL corrupted;
+} test_sink;
+
+static DWORD WINAPI test_sink_reader(LPVOID param)
+{
+    test_sink *sink = (test_sink *)param;
+    unsigned char buffer[4096];
+    DWORD read;
+    DWORD i;
+
+    while (ReadFile(sink->client, buffer, sizeof(buffer), &read, NULL))
+    {
+        for (i = 0; i < read; i++)
+        {
+            if (buffer[i] != (unsigned char)((sink->received + i) % 251))
+            {
+                sink->corrupted = TRUE;
+            }
+        }
+        sink->received += read;
+        /* Slow reader keeps the queue full */
+        Sleep(1);
+    }
+    return 0;
+}
+
+static void test_ready(void *ctx)
+{
+    SetEvent((HANDLE)ctx);
+}
+
+static void test_write_queue(void)
+{
+    io_engine *engine = io_engine_create();
+    HANDLE ready = CreateEvent(NULL, FALSE, FALSE, NULL);
+    unsigned char message[1000];
+    write_queue *queue;
+    test_sink sink;
+    HANDLE server;
+    HANDLE reader;
+    DWORD sent = 0;
+    DWORD stalls = 0;
+    int i, k;
+
+    memset(&sink, 0, sizeof(sink));
+    test_pipe(&server, &sink.client);
+    CHECK(io_engine_attach(engine, server));
+    queue = write_queue_create(engine, server, 16 * 1024, test_ready, ready);
+    CHECK(io_engine_start(engine, 2) == 2);
+    reader = CreateThread(NULL, 0, test_sink_reader, &sink, 0, NULL);
+
+    for (i = 0; i < 500; i++)
+    {
+        for (k = 0; k < (int)sizeof(message); k++)
+        {
+            message[k] = (unsigned char)((sent + k) % 251);
+        }
+        CHECK(write_queue_write(queue, message, sizeof(message)));
+        sent += sizeof(message);
+        if (write_queue_full(queue))
+        {
+            /* Producer waits for ready callback instead of the sink */
+            stalls++;
+            CHECK(WaitForSingleObject(ready, 10000) == WAIT_OBJECT_0);
+        }
+    }
+    CHECK(stalls > 0);
+
+    io_engine_stop(engine);
+    io_engine_drain(engine);
+    CHECK(write_queue_error(queue) == ERROR_SUCCESS);
+    CloseHandle(server);
+    WaitForSingleObject(reader, INFINITE);
+    CloseHandle(reader);
+    CHECK(sink.received == sent);
+    CHECK(!sink.corrupted);
+
+    /* Failed write is reported through ready callback */
+    write_queue_destroy(queue);
+    io_engine_destroy(engine);
+    engine = io_engine_create();
+    test_pipe(&server, &sink.client);
+    CHECK(io_engine_attach(engine, server));
+    queue = write_queue_create(engine, server, 16 * 1024, test_ready, ready);
+    CloseHandle(sink.client);
+    ResetEvent(ready);
+    CHECK(write_queue_write(queue, message, sizeof(message)));
+    io_engine_drain(engine);
+    CHECK(WaitForSingleObject(ready, 0) == WAIT_OBJECT_0);
+    CHECK(write_queue_error(queue) == ERROR_NO_DATA);
+    CHECK(!write_queue_write(queue, message, sizeof(message)));
+
+    write_queue_destroy(queue);
+    io_engine_destroy(engine);
+    CloseHandle(server);
+    CloseHandle(ready);
+}
+
+int main(int argc, char **argv)
+{
+    /* Writes to pipes without reader fail with EPIPE instead */
+    signal(SIGPIPE, SIG_IGN);
+
+    test_poll_timeout();
+    test_read();
+    test_immediate_failure();
+    test_cancel();
+    test_write();
+    test_file_write();
+    test_watch();
+    test_pool();
+    test_write_queue();
+
+    if (failures > 0)
+    {
+        fprintf(stderr, "%d checks failed\n", failures);
+        return 1;
+    }
+    printf("All engine tests passed\n");
+    return 0;
+}
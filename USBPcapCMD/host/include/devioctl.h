@@ -0,0 +1,23 @@
+/*
+ * Copyright (c) 2026 Tomasz Moń <desowin@gmail.com>
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#ifndef USBPCAP_HOST_DEVIOCTL_H
+#define USBPCAP_HOST_DEVIOCTL_H
+
+#include <windows.h>
+
+#define FILE_DEVICE_UNKNOWN 0x00000022
+
+#define METHOD_BUFFERED     0
+
+#define FILE_ANY_ACCESS     0
+#define FILE_READ_ACCESS    0x0001
+#define FILE_WRITE_ACCESS   0x0002
+
+#define CTL_CODE(device, function, method, access) \
+    (((device) << 16) | ((access) << 14) | ((function) << 2) | (method))
+
+#endif /* USBPCAP_HOST_DEVIOCTL_H */
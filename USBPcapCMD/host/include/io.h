@@ -0,0 +1,26 @@
+/*
+ * Copyright (c) 2026 Tomasz Moń <desowin@gmail.com>
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#ifndef USBPCAP_HOST_IO_H
+#define USBPCAP_HOST_IO_H
+
+#include <fcntl.h>
+#include <unistd.h>
+
+/* Files are always binary. There is no delete on close, temporary
+ * files are not used by the benchmark.
+ */
+#define _O_RDONLY    O_RDONLY
+#define _O_RDWR      O_RDWR
+#define _O_TRUNC     O_TRUNC
+#define _O_BINARY    0
+#define _O_TEMPORARY 0
+
+#define _open  open
+#define _close close
+#define _fdopen fdopen
+
+#endif /* USBPCAP_HOST_IO_H */
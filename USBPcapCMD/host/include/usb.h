@@ -0,0 +1,14 @@
+/*
+ * Copyright (c) 2026 Tomasz Moń <desowin@gmail.com>
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#ifndef USBPCAP_HOST_USB_H
+#define USBPCAP_HOST_USB_H
+
+#include <devioctl.h>
+
+typedef LONG USBD_STATUS;
+
+#endif /* USBPCAP_HOST_USB_H */
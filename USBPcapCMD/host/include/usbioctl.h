@@ -0,0 +1,64 @@
+/*
+ * Copyright (c) 2026 Tomasz Moń <desowin@gmail.com>
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#ifndef USBPCAP_HOST_USBIOCTL_H
+#define USBPCAP_HOST_USBIOCTL_H
+
+/* Hub connection information used by topology walk */
+
+#include <usb.h>
+
+#pragma pack(push, 1)
+typedef struct _USB_DEVICE_DESCRIPTOR
+{
+    UCHAR  bLength;
+    UCHAR  bDescriptorType;
+    USHORT bcdUSB;
+    UCHAR  bDeviceClass;
+    UCHAR  bDeviceSubClass;
+    UCHAR  bDeviceProtocol;
+    UCHAR  bMaxPacketSize0;
+    USHORT idVendor;
+    USHORT idProduct;
+    USHORT bcdDevice;
+    UCHAR  iManufacturer;
+    UCHAR  iProduct;
+    UCHAR  iSerialNumber;
+    UCHAR  bNumConfigurations;
+} USB_DEVICE_DESCRIPTOR, *PUSB_DEVICE_DESCRIPTOR;
+#pragma pack(pop)
+
+typedef enum _USB_CONNECTION_STATUS
+{
+    NoDeviceConnected,
+    DeviceConnected,
+    DeviceFailedEnumeration,
+    DeviceGeneralFailure,
+    DeviceCausedOvercurrent,
+    DeviceNotEnoughPower,
+    DeviceNotEnoughBandwidth,
+    DeviceHubNestedTooDeeply,
+    DeviceInLegacyHub,
+    DeviceEnumerating,
+    DeviceReset
+} USB_CONNECTION_STATUS;
+
+/* Pipe list that follows the structure is left out */
+#pragma pack(push, 1)
+typedef struct _USB_NODE_CONNECTION_INFORMATION
+{
+    ULONG                 ConnectionIndex;
+    USB_DEVICE_DESCRIPTOR DeviceDescriptor;
+    UCHAR                 CurrentConfigurationValue;
+    BOOLEAN               LowSpeed;
+    BOOLEAN               DeviceIsHub;
+    USHORT                DeviceAddress;
+    ULONG                 NumberOfOpenPipes;
+    USB_CONNECTION_STATUS ConnectionStatus;
+} USB_NODE_CONNECTION_INFORMATION, *PUSB_NODE_CONNECTION_INFORMATION;
+#pragma pack(pop)
+
+#endif /* USBPCAP_HOST_USBIOCTL_H */
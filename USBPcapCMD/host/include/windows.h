@@ -0,0 +1,304 @@
+/*
+ * Copyright (c) 2026 Tomasz Moń <desowin@gmail.com>
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#ifndef USBPCAP_HOST_WINDOWS_H
+#define USBPCAP_HOST_WINDOWS_H
+
+/* Subset of Win32 used by capture pipeline sources that are built on
+ * POSIX hosts for benchmarking. Calls are implemented in win32.c, the
+ * ones that benchmark never reaches in stubs.c.
+ */
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+
+#define WINAPI
+#define CALLBACK
+#define __cdecl
+#define __int64 long long
+
+#define VOID void
+typedef int                BOOL;
+typedef unsigned char      BOOLEAN;
+typedef unsigned char      BYTE, UCHAR, UINT8;
+typedef unsigned short     WORD, USHORT, UINT16;
+typedef short              SHORT;
+typedef int                INT, INT32, LONG;
+typedef unsigned int       UINT, UINT32, ULONG, DWORD;
+typedef long long          INT64, LONGLONG, LONG64;
+typedef unsigned long long UINT64, ULONGLONG, ULONG64, DWORD64;
+typedef intptr_t           LONG_PTR;
+typedef uintptr_t          ULONG_PTR, SIZE_T;
+typedef char               CHAR;
+typedef wchar_t            WCHAR;
+
+typedef void          *PVOID, *LPVOID, *HANDLE;
+typedef const void    *LPCVOID;
+typedef char          *PCHAR, *LPSTR;
+typedef const char    *LPCSTR, *PCSTR;
+typedef UCHAR         *PUCHAR;
+typedef USHORT        *PUSHORT;
+typedef ULONG         *PULONG;
+typedef DWORD         *PDWORD, *LPDWORD;
+
+typedef union
+{
+    struct
+    {
+        DWORD LowPart;
+        LONG  HighPart;
+    } u;
+    LONGLONG QuadPart;
+} LARGE_INTEGER, *PLARGE_INTEGER;
+
+/* Internal holds Win32 error code of finished operation, or
+ * STATUS_PENDING while it is in progress.
+ */
+typedef struct _OVERLAPPED
+{
+    ULONG_PTR Internal;
+    ULONG_PTR InternalHigh;
+    DWORD     Offset;
+    DWORD     OffsetHigh;
+    HANDLE    hEvent;
+} OVERLAPPED, *LPOVERLAPPED;
+
+typedef struct
+{
+    pthread_mutex_t mutex;
+} CRITICAL_SECTION;
+
+typedef struct
+{
+    SHORT X;
+    SHORT Y;
+} COORD;
+
+typedef struct
+{
+    SHORT Left;
+    SHORT Top;
+    SHORT Right;
+    SHORT Bottom;
+} SMALL_RECT;
+
+typedef struct
+{
+    COORD      dwSize;
+    COORD      dwCursorPosition;
+    WORD       wAttributes;
+    SMALL_RECT srWindow;
+    COORD      dwMaximumWindowSize;
+} CONSOLE_SCREEN_BUFFER_INFO;
+
+typedef struct
+{
+    DWORD dwNumberOfProcessors;
+} SYSTEM_INFO;
+
+typedef DWORD (WINAPI *LPTHREAD_START_ROUTINE)(LPVOID param);
+typedef VOID (CALLBACK *WAITORTIMERCALLBACK)(PVOID param, BOOLEAN timed_out);
+
+#define TRUE  1
+#define FALSE 0
+
+#define INVALID_HANDLE_VALUE ((HANDLE)(LONG_PTR)-1)
+#define INFINITE             0xFFFFFFFF
+#define MAX_PATH             260
+#define MAXLONG              0x7FFFFFFF
+
+#define CONTAINING_RECORD(address, type, field) \
+    ((type *)((char *)(address) - offsetof(type, field)))
+#define FIELD_OFFSET(type, field) ((LONG)offsetof(type, field))
+#define UNREFERENCED_PARAMETER(p) ((void)(p))
+
+#ifndef min
+#define min(a, b) (((a) < (b)) ? (a) : (b))
+#endif
+#ifndef max
+#define max(a, b) (((a) > (b)) ? (a) : (b))
+#endif
+
+/* Error codes */
+#define ERROR_SUCCESS           0
+#define ERROR_FILE_NOT_FOUND    2
+#define ERROR_ACCESS_DENIED     5
+#define ERROR_INVALID_HANDLE    6
+#define ERROR_NOT_ENOUGH_MEMORY 8
+#define ERROR_WRITE_FAULT       29
+#define ERROR_GEN_FAILURE       31
+#define ERROR_HANDLE_EOF        38
+#define ERROR_NOT_SUPPORTED     50
+#define ERROR_INVALID_PARAMETER 87
+#define ERROR_BROKEN_PIPE       109
+#define ERROR_PIPE_BUSY         231
+#define ERROR_NO_DATA           232
+#define ERROR_PIPE_CONNECTED    535
+#define ERROR_OPERATION_ABORTED 995
+#define ERROR_IO_INCOMPLETE     996
+#define ERROR_IO_PENDING        997
+
+#define STATUS_PENDING          0x00000103
+
+#define WAIT_OBJECT_0           0
+#define WAIT_TIMEOUT            258
+#define WAIT_FAILED             0xFFFFFFFF
+
+/* CreateFileA */
+#define GENERIC_READ                  0x80000000
+#define GENERIC_WRITE                 0x40000000
+#define FILE_SHARE_READ               0x00000001
+#define FILE_SHARE_WRITE              0x00000002
+#define CREATE_NEW                    1
+#define CREATE_ALWAYS                 2
+#define OPEN_EXISTING                 3
+#define OPEN_ALWAYS                   4
+#define FILE_ATTRIBUTE_NORMAL         0x00000080
+#define FILE_FLAG_OVERLAPPED          0x40000000
+#define MOVEFILE_REPLACE_EXISTING     0x00000001
+
+/* CreateNamedPipeA */
+#define PIPE_ACCESS_INBOUND           0x00000001
+#define PIPE_ACCESS_OUTBOUND          0x00000002
+#define FILE_FLAG_FIRST_PIPE_INSTANCE 0x00080000
+#define PIPE_TYPE_BYTE                0x00000000
+#define PIPE_READMODE_BYTE            0x00000000
+#define PIPE_WAIT                     0x00000000
+
+/* GetFileType */
+#define FILE_TYPE_UNKNOWN             0x0000
+#define FILE_TYPE_DISK                0x0001
+#define FILE_TYPE_CHAR                0x0002
+#define FILE_TYPE_PIPE                0x0003
+
+#define STD_INPUT_HANDLE              ((DWORD)-10)
+#define STD_OUTPUT_HANDLE             ((DWORD)-11)
+#define STD_ERROR_HANDLE              ((DWORD)-12)
+
+/* RegisterWaitForSingleObject */
+#define WT_EXECUTEINWAITTHREAD        0x00000004
+#define WT_EXECUTEONLYONCE            0x00000008
+
+DWORD GetLastError(void);
+void SetLastError(DWORD error);
+
+BOOL CloseHandle(HANDLE handle);
+
+HANDLE CreateEventA(LPVOID attributes, BOOL manual_reset, BOOL initial_state,
+                    LPCSTR name);
+#define CreateEvent CreateEventA
+BOOL SetEvent(HANDLE event);
+BOOL ResetEvent(HANDLE event);
+DWORD WaitForSingleObject(HANDLE handle, DWORD timeout);
+DWORD WaitForMultipleObjects(DWORD count, const HANDLE *handles, BOOL wait_all,
+                             DWORD timeout);
+
+HANDLE CreateThread(LPVOID attributes, SIZE_T stack_size,
+                    LPTHREAD_START_ROUTINE start, LPVOID param,
+                    DWORD flags, LPDWORD thread_id);
+void Sleep(DWORD milliseconds);
+DWORD GetCurrentProcessId(void);
+void GetSystemInfo(SYSTEM_INFO *info);
+
+void InitializeCriticalSection(CRITICAL_SECTION *section);
+void EnterCriticalSection(CRITICAL_SECTION *section);
+void LeaveCriticalSection(CRITICAL_SECTION *section);
+void DeleteCriticalSection(CRITICAL_SECTION *section);
+
+/* Full barriers, like their Win32 counterparts */
+static __inline__ LONG InterlockedIncrement(volatile LONG *value)
+{
+    return __atomic_add_fetch(value, 1, __ATOMIC_SEQ_CST);
+}
+
+static __inline__ LONG InterlockedDecrement(volatile LONG *value)
+{
+    return __atomic_sub_fetch(value, 1, __ATOMIC_SEQ_CST);
+}
+
+static __inline__ LONG InterlockedExchange(volatile LONG *target, LONG value)
+{
+    return __atomic_exchange_n(target, value, __ATOMIC_SEQ_CST);
+}
+
+static __inline__ LONG InterlockedCompareExchange(volatile LONG *target,
+                                                  LONG exchange, LONG comparand)
+{
+    __atomic_compare_exchange_n(target, &comparand, exchange, 0,
+                                __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+    return comparand;
+}
+
+BOOL QueryPerformanceCounter(LARGE_INTEGER *counter);
+BOOL QueryPerformanceFrequency(LARGE_INTEGER *frequency);
+DWORD GetTickCount(void);
+
+BOOL RegisterWaitForSingleObject(HANDLE *wait, HANDLE object,
+                                 WAITORTIMERCALLBACK callback, PVOID param,
+                                 DWORD timeout, DWORD flags);
+BOOL UnregisterWaitEx(HANDLE wait, HANDLE completion_event);
+
+HANDLE CreateNamedPipeA(LPCSTR name, DWORD open_mode, DWORD pipe_mode,
+                        DWORD max_instances, DWORD out_buffer_size,
+                        DWORD in_buffer_size, DWORD default_timeout,
+                        LPVOID attributes);
+BOOL ConnectNamedPipe(HANDLE pipe, LPOVERLAPPED overlapped);
+BOOL DisconnectNamedPipe(HANDLE pipe);
+
+HANDLE CreateFileA(LPCSTR name, DWORD access, DWORD share, LPVOID attributes,
+                   DWORD disposition, DWORD flags, HANDLE template_file);
+HANDLE GetStdHandle(DWORD std_handle);
+DWORD GetFileType(HANDLE file);
+BOOL ReadFile(HANDLE file, LPVOID buffer, DWORD length, LPDWORD read,
+              LPOVERLAPPED overlapped);
+BOOL WriteFile(HANDLE file, LPCVOID buffer, DWORD length, LPDWORD written,
+               LPOVERLAPPED overlapped);
+BOOL GetOverlappedResult(HANDLE file, LPOVERLAPPED overlapped,
+                         LPDWORD bytes, BOOL wait);
+BOOL CancelIo(HANDLE file);
+BOOL FlushFileBuffers(HANDLE file);
+
+DWORD GetTempPathA(DWORD length, LPSTR buffer);
+UINT GetTempFileNameA(LPCSTR path, LPCSTR prefix, UINT unique, LPSTR name);
+BOOL DeleteFileA(LPCSTR name);
+BOOL MoveFileExA(LPCSTR existing, LPCSTR name, DWORD flags);
+
+BOOL DeviceIoControl(HANDLE device, DWORD code, LPVOID in, DWORD in_length,
+                     LPVOID out, DWORD out_length, LPDWORD returned,
+                     LPOVERLAPPED overlapped);
+
+BOOL GetConsoleScreenBufferInfo(HANDLE console, CONSOLE_SCREEN_BUFFER_INFO *info);
+BOOL SetConsoleCursorPosition(HANDLE console, COORD position);
+
+/* Host only: file descriptor of file or pipe handle, -1 for other handles */
+int host_file_descriptor(HANDLE handle);
+
+/* C runtime. Formats can use %I64 length modifier. */
+int host_printf(const char *format, ...);
+int host_fprintf(FILE *stream, const char *format, ...);
+int host_sprintf_s(char *buffer, size_t size, const char *format, ...);
+#define printf host_printf
+#define fprintf host_fprintf
+#define sprintf_s host_sprintf_s
+
+int strcpy_s(char *destination, size_t size, const char *source);
+int fopen_s(FILE **file, const char *name, const char *mode);
+#define _fsopen(name, mode, share) fopen(name, mode)
+#define _fseeki64 fseeko
+#define _ftelli64 ftello
+#define _fileno fileno
+#define _strdup strdup
+#define _stricmp strcasecmp
+#define _strnicmp strncasecmp
+#define strtok_s strtok_r
+
+#endif /* USBPCAP_HOST_WINDOWS_H */
@@ -0,0 +1,12 @@
+/*
+ * Copyright (c) 2026 Tomasz Moń <desowin@gmail.com>
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#ifndef USBPCAP_HOST_WTYPES_H
+#define USBPCAP_HOST_WTYPES_H
+
+#include <windows.h>
+
+#endif /* USBPCAP_HOST_WTYPES_H */
@@ -0,0 +1,681 @@
+/*
+ * Copyright (c) 2026 Tomasz Moń <desowin@gmail.com>
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+/* io_engine on epoll, used instead of ioengine.c on POSIX hosts.
+ *
+ * Completion port is modelled on top of readiness notifications. Read or
+ * write that cannot finish right away waits on its descriptor until epoll
+ * reports it ready, and the poller that gets the notification does the
+ * I/O. Finished operations are queued and dispatched one per
+ * io_engine_poll() call, eventfd wakes pollers up when there is something
+ * queued. Regular files are always ready, their operations finish before
+ * io_read() or io_write() returns and only the callback is deferred.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <windows.h>
+#include "ioengine.h"
+
+/* Completion keys */
+#define IO_KEY_OPERATION  0  /* Read, write or connect */
+#define IO_KEY_WATCH      1  /* Watched event got signalled */
+
+#define IO_ENGINE_MAX_THREADS  8
+
+/* Descriptor of handle attached to engine */
+typedef struct _io_attachment
+{
+    HANDLE handle;
+    int fd;
+    int flags;                /* File status flags before attach */
+    BOOL pollable;            /* epoll does not take regular files */
+    pthread_mutex_t mutex;    /* Guards operations below */
+    io_request *reader;
+    unsigned char *read_buffer;
+    DWORD read_length;
+    io_request *writer;
+    const unsigned char *write_buffer;
+    DWORD write_length;
+    DWORD written;
+    struct _io_attachment *next;
+} io_attachment;
+
+struct _io_engine
+{
+    int epoll_fd;
+    int event_fd;             /* Readable while there is something queued */
+    pthread_mutex_t mutex;    /* Guards queue and attachments */
+    io_request *head;         /* Finished operations */
+    io_request *tail;
+    DWORD wakeups;
+    io_attachment *attachments;
+    volatile LONG pending;    /* Reads, writes and connects in flight */
+    volatile LONG draining;
+    HANDLE threads[IO_ENGINE_MAX_THREADS];
+    DWORD thread_count;
+    volatile LONG stopping;
+};
+
+static DWORD io_error_from_errno(int error)
+{
+    switch (error)
+    {
+        case EPIPE:
+            return ERROR_NO_DATA;
+        case EBADF:
+            return ERROR_INVALID_HANDLE;
+        case ENOMEM:
+            return ERROR_NOT_ENOUGH_MEMORY;
+        default:
+            return ERROR_GEN_FAILURE;
+    }
+}
+
+static void io_engine_signal(io_engine *engine)
+{
+    UINT64 one = 1;
+
+    while ((write(engine->event_fd, &one, sizeof(one)) < 0) && (errno == EINTR))
+    {
+    }
+}
+
+/* Queues finished operation, error and bytes are kept in overlapped like
+ * Win32 does
+ */
+static void io_engine_queue(io_engine *engine, io_request *request, ULONG_PTR key,
+                            DWORD error, DWORD bytes)
+{
+    request->overlapped.Internal = error;
+    request->overlapped.InternalHigh = bytes;
+    request->key = key;
+    request->next = NULL;
+
+    pthread_mutex_lock(&engine->mutex);
+    if (engine->tail != NULL)
+    {
+        engine->tail->next = request;
+    }
+    else
+    {
+        engine->head = request;
+    }
+    engine->tail = request;
+    pthread_mutex_unlock(&engine->mutex);
+    io_engine_signal(engine);
+}
+
+io_engine *io_engine_create(void)
+{
+    io_engine *engine;
+    struct epoll_event event;
+
+    engine = (io_engine *)calloc(1, sizeof(io_engine));
+    if (engine == NULL)
+    {
+        return NULL;
+    }
+
+    engine->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    engine->event_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    event.events = EPOLLIN;
+    event.data.ptr = NULL;
+    if ((engine->epoll_fd == -1) || (engine->event_fd == -1) ||
+        (epoll_ctl(engine->epoll_fd, EPOLL_CTL_ADD, engine->event_fd, &event) != 0))
+    {
+        fprintf(stderr, "Failed to create epoll engine - %d\n", errno);
+        if (engine->epoll_fd != -1)
+        {
+            close(engine->epoll_fd);
+        }
+        if (engine->event_fd != -1)
+        {
+            close(engine->event_fd);
+        }
+        free(engine);
+        return NULL;
+    }
+    pthread_mutex_init(&engine->mutex, NULL);
+    return engine;
+}
+
+void io_engine_destroy(io_engine *engine)
+{
+    io_engine_stop(engine);
+
+    /* Requests still queued belong to caller */
+    while (engine->attachments != NULL)
+    {
+        io_attachment *attachment = engine->attachments;
+
+        engine->attachments = attachment->next;
+        if (attachment->pollable)
+        {
+            epoll_ctl(engine->epoll_fd, EPOLL_CTL_DEL, attachment->fd, NULL);
+            fcntl(attachment->fd, F_SETFL, attachment->flags);
+        }
+        pthread_mutex_destroy(&attachment->mutex);
+        free(attachment);
+    }
+    close(engine->event_fd);
+    close(engine->epoll_fd);
+    pthread_mutex_destroy(&engine->mutex);
+    free(engine);
+}
+
+BOOL io_engine_attach(io_engine *engine, HANDLE handle)
+{
+    io_attachment *attachment;
+    struct epoll_event event;
+    int fd;
+
+    fd = host_file_descriptor(handle);
+    if (fd == -1)
+    {
+        fprintf(stderr, "Failed to attach handle to engine - %d\n", GetLastError());
+        return FALSE;
+    }
+
+    pthread_mutex_lock(&engine->mutex);
+    for (attachment = engine->attachments; attachment != NULL; attachment = attachment->next)
+    {
+        if (attachment->handle == handle)
+        {
+            /* Handle can be attached only once */
+            pthread_mutex_unlock(&engine->mutex);
+            fprintf(stderr, "Handle is already attached to engine\n");
+            return FALSE;
+        }
+    }
+    pthread_mutex_unlock(&engine->mutex);
+
+    attachment = (io_attachment *)calloc(1, sizeof(io_attachment));
+    if (attachment == NULL)
+    {
+        return FALSE;
+    }
+    attachment->handle = handle;
+    attachment->fd = fd;
+    attachment->flags = fcntl(fd, F_GETFL);
+
+    /* Disarmed until there is an operation waiting */
+    event.events = EPOLLONESHOT;
+    event.data.ptr = attachment;
+    if (epoll_ctl(engine->epoll_fd, EPOLL_CTL_ADD, fd, &event) == 0)
+    {
+        /* Operations wait for readiness instead of blocking */
+        attachment->pollable = TRUE;
+        fcntl(fd, F_SETFL, attachment->flags | O_NONBLOCK);
+    }
+    else if (errno != EPERM)
+    {
+        fprintf(stderr, "Failed to attach handle to engine - %d\n", errno);
+        free(attachment);
+        return FALSE;
+    }
+    pthread_mutex_init(&attachment->mutex, NULL);
+
+    pthread_mutex_lock(&engine->mutex);
+    attachment->next = engine->attachments;
+    engine->attachments = attachment;
+    pthread_mutex_unlock(&engine->mutex);
+    return TRUE;
+}
+
+static io_attachment *io_attachment_find(io_engine *engine, HANDLE handle)
+{
+    io_attachment *attachment;
+
+    pthread_mutex_lock(&engine->mutex);
+    for (attachment = engine->attachments; attachment != NULL; attachment = attachment->next)
+    {
+        if (attachment->handle == handle)
+        {
+            break;
+        }
+    }
+    pthread_mutex_unlock(&engine->mutex);
+    return attachment;
+}
+
+/* Tries to finish read, called with attachment mutex held */
+static void io_attachment_read(io_engine *engine, io_attachment *attachment)
+{
+    io_request *request = attachment->reader;
+    ssize_t result;
+
+    do
+    {
+        result = read(attachment->fd, attachment->read_buffer, attachment->read_length);
+    } while ((result < 0) && (errno == EINTR));
+
+    if ((result < 0) && ((errno == EAGAIN) || (errno == EWOULDBLOCK)))
+    {
+        return;
+    }
+
+    attachment->reader = NULL;
+    if (result > 0)
+    {
+        io_engine_queue(engine, request, IO_KEY_OPERATION, ERROR_SUCCESS, (DWORD)result);
+    }
+    else if (result == 0)
+    {
+        /* Other end of pipe was closed, or end of file */
+        io_engine_queue(engine, request, IO_KEY_OPERATION,
+                        attachment->pollable ? ERROR_BROKEN_PIPE : ERROR_HANDLE_EOF, 0);
+    }
+    else
+    {
+        io_engine_queue(engine, request, IO_KEY_OPERATION, io_error_from_errno(errno), 0);
+    }
+}
+
+/* Tries to finish write, called with attachment mutex held */
+static void io_attachment_write(io_engine *engine, io_attachment *attachment)
+{
+    io_request *request = attachment->writer;
+
+    while (attachment->written < attachment->write_length)
+    {
+        ssize_t result = write(attachment->fd,
+                               &attachment->write_buffer[attachment->written],
+                               attachment->write_length - attachment->written);
+
+        if (result < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
+            {
+                return;
+            }
+            attachment->writer = NULL;
+            io_engine_queue(engine, request, IO_KEY_OPERATION, io_error_from_errno(errno),
+                            attachment->written);
+            return;
+        }
+        attachment->written += (DWORD)result;
+    }
+
+    attachment->writer = NULL;
+    io_engine_queue(engine, request, IO_KEY_OPERATION, ERROR_SUCCESS, attachment->written);
+}
+
+/* Waits for readiness needed by operations that did not finish yet.
+ * Called with attachment mutex held.
+ */
+static void io_attachment_arm(io_engine *engine, io_attachment *attachment)
+{
+    struct epoll_event event;
+
+    if (!attachment->pollable || ((attachment->reader == NULL) && (attachment->writer == NULL)))
+    {
+        return;
+    }
+
+    event.events = EPOLLONESHOT;
+    event.events |= (attachment->reader != NULL) ? EPOLLIN : 0;
+    event.events |= (attachment->writer != NULL) ? EPOLLOUT : 0;
+    event.data.ptr = attachment;
+    if (epoll_ctl(engine->epoll_fd, EPOLL_CTL_MOD, attachment->fd, &event) != 0)
+    {
+        DWORD err = io_error_from_errno(errno);
+
+        /* Operations would never finish otherwise */
+        if (attachment->reader != NULL)
+        {
+            io_engine_queue(engine, attachment->reader, IO_KEY_OPERATION, err, 0);
+            attachment->reader = NULL;
+        }
+        if (attachment->writer != NULL)
+        {
+            io_engine_queue(engine, attachment->writer, IO_KEY_OPERATION, err,
+                            attachment->written);
+            attachment->writer = NULL;
+        }
+    }
+}
+
+/* Descriptor was reported ready. One shot notification keeps other
+ * pollers away from it until it is armed again.
+ */
+static void io_attachment_ready(io_engine *engine, io_attachment *attachment)
+{
+    pthread_mutex_lock(&attachment->mutex);
+    if (attachment->reader != NULL)
+    {
+        io_attachment_read(engine, attachment);
+    }
+    if (attachment->writer != NULL)
+    {
+        io_attachment_write(engine, attachment);
+    }
+    io_attachment_arm(engine, attachment);
+    pthread_mutex_unlock(&attachment->mutex);
+}
+
+static void io_engine_dispatch(io_engine *engine, io_request *request)
+{
+    if (request->key == IO_KEY_WATCH)
+    {
+        if (engine->draining)
+        {
+            return;
+        }
+    }
+    else
+    {
+        InterlockedDecrement(&engine->pending);
+    }
+
+    request->callback(request, (DWORD)request->overlapped.Internal,
+                      (DWORD)request->overlapped.InternalHigh);
+}
+
+BOOL io_engine_poll(io_engine *engine, DWORD timeout)
+{
+    DWORD start = GetTickCount();
+
+    for (;;)
+    {
+        io_request *request = NULL;
+        BOOL woken = FALSE;
+        struct epoll_event event;
+        int wait_ms = -1;
+        int count;
+
+        pthread_mutex_lock(&engine->mutex);
+        if (engine->head != NULL)
+        {
+            request = engine->head;
+            engine->head = request->next;
+            if (engine->head == NULL)
+            {
+                engine->tail = NULL;
+            }
+        }
+        else if (engine->wakeups > 0)
+        {
+            engine->wakeups--;
+            woken = TRUE;
+        }
+        if ((engine->head != NULL) || (engine->wakeups > 0))
+        {
+            /* Poller that reset eventfd might have left some for others */
+            io_engine_signal(engine);
+        }
+        pthread_mutex_unlock(&engine->mutex);
+
+        if (request != NULL)
+        {
+            io_engine_dispatch(engine, request);
+            return TRUE;
+        }
+        if (woken)
+        {
+            return TRUE;
+        }
+
+        if (timeout != INFINITE)
+        {
+            DWORD elapsed = GetTickCount() - start;
+
+            wait_ms = (elapsed < timeout) ? (int)(timeout - elapsed) : 0;
+        }
+        count = epoll_wait(engine->epoll_fd, &event, 1, wait_ms);
+        if (count < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            SetLastError(io_error_from_errno(errno));
+            return FALSE;
+        }
+        if (count == 0)
+        {
+            SetLastError(WAIT_TIMEOUT);
+            return FALSE;
+        }
+
+        if (event.data.ptr == NULL)
+        {
+            UINT64 value;
+
+            /* Fails if another poller has reset it already */
+            if (read(engine->event_fd, &value, sizeof(value)) < 0)
+            {
+                continue;
+            }
+        }
+        else
+        {
+            io_attachment_ready(engine, (io_attachment *)event.data.ptr);
+        }
+    }
+}
+
+void io_engine_wake(io_engine *engine)
+{
+    pthread_mutex_lock(&engine->mutex);
+    engine->wakeups++;
+    pthread_mutex_unlock(&engine->mutex);
+    io_engine_signal(engine);
+}
+
+static DWORD WINAPI io_engine_thread(LPVOID param)
+{
+    io_engine *engine = (io_engine *)param;
+
+    while (!engine->stopping)
+    {
+        if (!io_engine_poll(engine, INFINITE))
+        {
+            fprintf(stderr, "Engine thread failed to poll - %d\n", GetLastError());
+            break;
+        }
+    }
+    return 0;
+}
+
+DWORD io_engine_start(io_engine *engine, DWORD threads)
+{
+    InterlockedExchange(&engine->stopping, FALSE);
+    threads = min(threads, IO_ENGINE_MAX_THREADS);
+    while (engine->thread_count < threads)
+    {
+        HANDLE thread = CreateThread(NULL, 0, io_engine_thread, engine, 0, NULL);
+
+        if (thread == NULL)
+        {
+            fprintf(stderr, "Failed to create engine thread - %d\n", GetLastError());
+            break;
+        }
+        engine->threads[engine->thread_count++] = thread;
+    }
+    return engine->thread_count;
+}
+
+void io_engine_stop(io_engine *engine)
+{
+    DWORD i;
+
+    InterlockedExchange(&engine->stopping, TRUE);
+    for (i = 0; i < engine->thread_count; i++)
+    {
+        /* Wake ups left unused by threads are ignored by pollers */
+        io_engine_wake(engine);
+    }
+    for (i = 0; i < engine->thread_count; i++)
+    {
+        WaitForSingleObject(engine->threads[i], INFINITE);
+        CloseHandle(engine->threads[i]);
+    }
+    engine->thread_count = 0;
+}
+
+void io_engine_drain(io_engine *engine)
+{
+    InterlockedExchange(&engine->draining, TRUE);
+    while (engine->pending > 0)
+    {
+        if (!io_engine_poll(engine, INFINITE))
+        {
+            fprintf(stderr, "Failed to drain engine - %d\n", GetLastError());
+            break;
+        }
+    }
+}
+
+void io_request_init(io_request *request, io_engine *engine,
+                     io_callback callback, void *ctx)
+{
+    memset(request, 0, sizeof(io_request));
+    request->engine = engine;
+    request->callback = callback;
+    request->ctx = ctx;
+}
+
+BOOL io_read(io_request *request, HANDLE handle, void *buffer, DWORD length)
+{
+    io_engine *engine = request->engine;
+    io_attachment *attachment = io_attachment_find(engine, handle);
+
+    InterlockedIncrement(&engine->pending);
+    if (attachment == NULL)
+    {
+        io_engine_queue(engine, request, IO_KEY_OPERATION, ERROR_INVALID_HANDLE, 0);
+        return TRUE;
+    }
+
+    pthread_mutex_lock(&attachment->mutex);
+    if (attachment->reader != NULL)
+    {
+        pthread_mutex_unlock(&attachment->mutex);
+        io_engine_queue(engine, request, IO_KEY_OPERATION, ERROR_PIPE_BUSY, 0);
+        return TRUE;
+    }
+    attachment->reader = request;
+    attachment->read_buffer = (unsigned char *)buffer;
+    attachment->read_length = length;
+    io_attachment_read(engine, attachment);
+    io_attachment_arm(engine, attachment);
+    pthread_mutex_unlock(&attachment->mutex);
+    return TRUE;
+}
+
+BOOL io_write(io_request *request, HANDLE handle, const void *buffer, DWORD length)
+{
+    io_engine *engine = request->engine;
+    io_attachment *attachment = io_attachment_find(engine, handle);
+
+    InterlockedIncrement(&engine->pending);
+    if (attachment == NULL)
+    {
+        io_engine_queue(engine, request, IO_KEY_OPERATION, ERROR_INVALID_HANDLE, 0);
+        return TRUE;
+    }
+
+    pthread_mutex_lock(&attachment->mutex);
+    if (attachment->writer != NULL)
+    {
+        pthread_mutex_unlock(&attachment->mutex);
+        io_engine_queue(engine, request, IO_KEY_OPERATION, ERROR_PIPE_BUSY, 0);
+        return TRUE;
+    }
+    attachment->writer = request;
+    attachment->write_buffer = (const unsigned char *)buffer;
+    attachment->write_length = length;
+    attachment->written = 0;
+    io_attachment_write(engine, attachment);
+    io_attachment_arm(engine, attachment);
+    pthread_mutex_unlock(&attachment->mutex);
+    return TRUE;
+}
+
+void io_cancel(io_request *request, HANDLE handle)
+{
+    io_engine *engine = request->engine;
+    io_attachment *attachment = io_attachment_find(engine, handle);
+
+    if (attachment == NULL)
+    {
+        return;
+    }
+
+    /* Operation that has finished already is not in attachment anymore */
+    pthread_mutex_lock(&attachment->mutex);
+    if (attachment->reader == request)
+    {
+        attachment->reader = NULL;
+        io_engine_queue(engine, request, IO_KEY_OPERATION, ERROR_OPERATION_ABORTED, 0);
+    }
+    if (attachment->writer == request)
+    {
+        attachment->writer = NULL;
+        io_engine_queue(engine, request, IO_KEY_OPERATION, ERROR_OPERATION_ABORTED,
+                        attachment->written);
+    }
+    pthread_mutex_unlock(&attachment->mutex);
+}
+
+BOOL io_connect(io_request *request, HANDLE pipe)
+{
+    DWORD err = ERROR_SUCCESS;
+
+    InterlockedIncrement(&request->engine->pending);
+    if (!ConnectNamedPipe(pipe, NULL))
+    {
+        err = GetLastError();
+        if (err == ERROR_PIPE_CONNECTED)
+        {
+            /* Client connected before the call */
+            err = ERROR_SUCCESS;
+        }
+    }
+    io_engine_queue(request->engine, request, IO_KEY_OPERATION, err, 0);
+    return TRUE;
+}
+
+static VOID CALLBACK io_watch_signalled(PVOID param, BOOLEAN timed_out)
+{
+    io_request *request = (io_request *)param;
+
+    io_engine_queue(request->engine, request, IO_KEY_WATCH, ERROR_SUCCESS, 0);
+}
+
+BOOL io_watch(io_request *request, HANDLE event)
+{
+    /* One shot wait is still registered until unregistered */
+    io_unwatch(request);
+
+    if (!RegisterWaitForSingleObject(&request->wait, event, io_watch_signalled,
+                                     request, INFINITE,
+                                     WT_EXECUTEONLYONCE | WT_EXECUTEINWAITTHREAD))
+    {
+        fprintf(stderr, "RegisterWaitForSingleObject() failed - %d\n", GetLastError());
+        request->wait = NULL;
+        return FALSE;
+    }
+    return TRUE;
+}
+
+void io_unwatch(io_request *request)
+{
+    if (request->wait != NULL)
+    {
+        /* Returns after callback that might be running has finished */
+        UnregisterWaitEx(request->wait, INVALID_HANDLE_VALUE);
+        request->wait = NULL;
+    }
+}
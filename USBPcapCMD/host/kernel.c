@@ -0,0 +1,144 @@
+/*
+ * Copyright (c) 2026 Tomasz Moń <desowin@gmail.com>
+ *
+ * SPDX-License-Identifier: GPL-2.0
+ */
+
+/* Kernel routines used by driver buffer code built on POSIX hosts, and
+ * driver routines from sources that are not built there.
+ */
+
+#include <time.h>
+#include "USBPcapMain.h"
+#include "USBPcapHelperFunctions.h"
+
+/* 100 ns intervals between 1601-01-01 and 1970-01-01 */
+#define HOST_EPOCH_OFFSET  116444736000000000LL
+
+#define HOST_PAGE_SIZE     4096
+
+PVOID ExAllocatePoolWithTag(POOL_TYPE type, SIZE_T size, ULONG tag)
+{
+    PVOID p;
+
+    UNREFERENCED_PARAMETER(type);
+    UNREFERENCED_PARAMETER(tag);
+
+    /* Like pool, allocations of page size or more are page aligned */
+    if (posix_memalign(&p, (size >= HOST_PAGE_SIZE) ? HOST_PAGE_SIZE : 16,
+                       size) != 0)
+    {
+        return NULL;
+    }
+    return p;
+}
+
+VOID ExFreePool(PVOID p)
+{
+    free(p);
+}
+
+VOID KeInitializeSpinLock(PKSPIN_LOCK lock)
+{
+    *lock = 0;
+}
+
+VOID KeAcquireSpinLockAtDpcLevel(PKSPIN_LOCK lock)
+{
+    while (__atomic_exchange_n(lock, 1, __ATOMIC_ACQUIRE) != 0)
+    {
+        while (__atomic_load_n(lock, __ATOMIC_RELAXED) != 0)
+        {
+            /* Spin */
+        }
+    }
+}
+
+VOID KeReleaseSpinLockFromDpcLevel(PKSPIN_LOCK lock)
+{
+    __atomic_store_n(lock, 0, __ATOMIC_RELEASE);
+}
+
+VOID KeAcquireSpinLock(PKSPIN_LOCK lock, PKIRQL irql)
+{
+    *irql = PASSIVE_LEVEL;
+    KeAcquireSpinLockAtDpcLevel(lock);
+}
+
+VOID KeReleaseSpinLock(PKSPIN_LOCK lock, KIRQL irql)
+{
+    UNREFERENCED_PARAMETER(irql);
+
+    KeReleaseSpinLockFromDpcLevel(lock);
+}
+
+VOID KeRaiseIrql(KIRQL level, PKIRQL irql)
+{
+    UNREFERENCED_PARAMETER(level);
+
+    *irql = PASSIVE_LEVEL;
+}
+
+VOID KeLowerIrql(KIRQL irql)
+{
+    UNREFERENCED_PARAMETER(irql);
+}
+
+KIRQL KeGetCurrentIrql(VOID)
+{
+    return DISPATCH_LEVEL;
+}
+
+ULONG KeQueryMaximumProcessorCountEx(USHORT group)
+{
+    UNREFERENCED_PARAMETER(group);
+
+    return 1;
+}
+
+ULONG KeGetCurrentProcessorNumberEx(PVOID number)
+{
+    UNREFERENCED_PARAMETER(number);
+
+    return 0;
+}
+
+VOID IoCompleteRequest(PIRP irp, UCHAR boost)
+{
+    UNREFERENCED_PARAMETER(irp);
+    UNREFERENCED_PARAMETER(boost);
+}
+
+NTSTATUS IoCsqInsertIrp(PIO_CSQ csq, PIRP irp, PIO_CSQ_IRP_CONTEXT context)
+{
+    UNREFERENCED_PARAMETER(context);
+
+    if (csq->irp != NULL)
+    {
+        return STATUS_UNSUCCESSFUL;
+    }
+
+    csq->irp = irp;
+    return STATUS_SUCCESS;
+}
+
+PIRP IoCsqRemoveNextIrp(PIO_CSQ csq, PVOID peek_context)
+{
+    PIRP irp = csq->irp;
+
+    UNREFERENCED_PARAMETER(peek_context);
+
+    csq->irp = NULL;
+    return irp;
+}
+
+LARGE_INTEGER USBPcapGetCurrentTimestamp(VOID)
+{
+    LARGE_INTEGER    timestamp;
+    struct timespec  now;
+
+    clock_gettime(CLOCK_REALTIME, &now);
+    timestamp.QuadPart = HOST_EPOCH_OFFSET + (LONGLONG)now.tv_sec * 10000000 +
+                         now.tv_nsec / 100;
+    return timestamp;
+}
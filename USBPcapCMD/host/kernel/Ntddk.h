@@ -0,0 +1,235 @@
+/*
+ * Copyright (c) 2026 Tomasz Moń <desowin@gmail.com>
+ *
+ * SPDX-License-Identifier: GPL-2.0
+ */
+
+#ifndef USBPCAP_HOST_NTDDK_H
+#define USBPCAP_HOST_NTDDK_H
+
+/* Subset of WDK used by driver buffer code that is built on POSIX hosts
+ * for benchmarking. Routines are implemented in kernel.c. There is single
+ * processor and IRQL is not tracked, so driver code must be called from
+ * one thread at a time.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define IN
+#define OUT
+#define __in
+#define __out
+#define __inline inline
+#define __FUNCTION__ __func__
+
+#define __drv_dispatchType(x)
+#define __drv_dispatchType_other
+#define __drv_raisesIRQL(x)
+#define __drv_maxIRQL(x)
+#define __drv_requiresIRQL(x)
+#define __drv_savesIRQL
+#define __drv_restoresIRQL
+#define __drv_out_deref(x)
+#define __drv_in(x)
+
+#define VOID void
+typedef int                BOOL;
+typedef unsigned char      BOOLEAN, *PBOOLEAN;
+typedef char               CHAR, *PCHAR;
+typedef unsigned char      UCHAR, *PUCHAR, UINT8;
+typedef short              SHORT;
+typedef unsigned short     USHORT, *PUSHORT, UINT16;
+typedef int                INT, LONG, *PLONG, INT32;
+typedef unsigned int       UINT, ULONG, *PULONG, UINT32, *PUINT32;
+typedef long long          LONGLONG, INT64;
+typedef unsigned long long ULONGLONG, UINT64, *PUINT64;
+typedef intptr_t           LONG_PTR;
+typedef uintptr_t          ULONG_PTR, UINT_PTR, SIZE_T;
+typedef wchar_t            WCHAR, *PWSTR;
+typedef void               *PVOID;
+typedef LONG               NTSTATUS;
+
+typedef union
+{
+    struct
+    {
+        ULONG LowPart;
+        LONG  HighPart;
+    } u;
+    LONGLONG QuadPart;
+} LARGE_INTEGER, *PLARGE_INTEGER;
+
+#define TRUE  1
+#define FALSE 0
+
+#ifndef min
+#define min(a, b) (((a) < (b)) ? (a) : (b))
+#endif
+#ifndef max
+#define max(a, b) (((a) > (b)) ? (a) : (b))
+#endif
+
+#define FIELD_OFFSET(type, field) ((LONG)offsetof(type, field))
+#define UNREFERENCED_PARAMETER(p) ((void)(p))
+
+#define NT_SUCCESS(status)            (((NTSTATUS)(status)) >= 0)
+#define STATUS_SUCCESS                ((NTSTATUS)0x00000000)
+#define STATUS_PENDING                ((NTSTATUS)0x00000103)
+#define STATUS_UNSUCCESSFUL           ((NTSTATUS)0xC0000001)
+#define STATUS_INVALID_PARAMETER      ((NTSTATUS)0xC000000D)
+#define STATUS_NOT_SUPPORTED          ((NTSTATUS)0xC00000BB)
+#define STATUS_INSUFFICIENT_RESOURCES ((NTSTATUS)0xC000009A)
+#define STATUS_BUFFER_TOO_SMALL       ((NTSTATUS)0xC0000023)
+#define STATUS_INVALID_BUFFER_SIZE    ((NTSTATUS)0xC0000206)
+
+#define NTDDI_WIN7     0x06010000
+#define NTDDI_VERSION  NTDDI_WIN7
+
+#define ASSERT(e)      ((void)0)
+#define KdPrint(x)     ((void)0)
+
+#define RtlCopyMemory(dst, src, length) memcpy((dst), (src), (length))
+#define RtlZeroMemory(dst, length)      memset((dst), 0, (length))
+
+/* Memory */
+typedef enum
+{
+    NonPagedPool
+} POOL_TYPE;
+
+PVOID ExAllocatePoolWithTag(POOL_TYPE type, SIZE_T size, ULONG tag);
+VOID ExFreePool(PVOID p);
+
+/* Processors and synchronization */
+typedef UCHAR KIRQL, *PKIRQL;
+#define PASSIVE_LEVEL   0
+#define DISPATCH_LEVEL  2
+
+typedef volatile LONG KSPIN_LOCK, *PKSPIN_LOCK;
+
+VOID KeInitializeSpinLock(PKSPIN_LOCK lock);
+VOID KeAcquireSpinLock(PKSPIN_LOCK lock, PKIRQL irql);
+VOID KeReleaseSpinLock(PKSPIN_LOCK lock, KIRQL irql);
+VOID KeAcquireSpinLockAtDpcLevel(PKSPIN_LOCK lock);
+VOID KeReleaseSpinLockFromDpcLevel(PKSPIN_LOCK lock);
+VOID KeRaiseIrql(KIRQL level, PKIRQL irql);
+VOID KeLowerIrql(KIRQL irql);
+KIRQL KeGetCurrentIrql(VOID);
+
+#define ALL_PROCESSOR_GROUPS  0xFFFF
+ULONG KeQueryMaximumProcessorCountEx(USHORT group);
+ULONG KeGetCurrentProcessorNumberEx(PVOID number);
+
+static inline PVOID
+InterlockedCompareExchangePointer(PVOID volatile *target, PVOID exchange,
+                                  PVOID comparand)
+{
+    __atomic_compare_exchange_n(target, &comparand, exchange, 0,
+                                __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+    return comparand;
+}
+
+typedef struct _LIST_ENTRY
+{
+    struct _LIST_ENTRY *Flink;
+    struct _LIST_ENTRY *Blink;
+} LIST_ENTRY, *PLIST_ENTRY;
+
+/* Objects referenced by driver structures, but not used by the code that
+ * is built on hosts.
+ */
+typedef struct { int unused; } KTIMER, KDPC, IO_REMOVE_LOCK, *PIO_REMOVE_LOCK;
+typedef struct _DRIVER_OBJECT *PDRIVER_OBJECT;
+typedef struct _FILE_OBJECT *PFILE_OBJECT;
+typedef struct _RTL_GENERIC_TABLE *PRTL_GENERIC_TABLE;
+
+/* I/O requests. Every IRP has single stack location and MDL describes
+ * buffer that is already mapped.
+ */
+typedef struct _MDL
+{
+    PVOID  address;
+    ULONG  byteCount;
+} MDL, *PMDL;
+
+#define NormalPagePriority  16
+
+#define MmGetSystemAddressForMdlSafe(mdl, priority) ((mdl)->address)
+#define MmGetMdlByteCount(mdl)                      ((mdl)->byteCount)
+
+typedef struct _IO_STATUS_BLOCK
+{
+    NTSTATUS   Status;
+    ULONG_PTR  Information;
+} IO_STATUS_BLOCK;
+
+typedef struct _IO_STACK_LOCATION
+{
+    UCHAR  MajorFunction;
+    UCHAR  MinorFunction;
+    union
+    {
+        struct
+        {
+            ULONG  Length;
+        } Read;
+        struct
+        {
+            ULONG  Length;
+        } Write;
+    } Parameters;
+} IO_STACK_LOCATION, *PIO_STACK_LOCATION;
+
+typedef struct _IRP
+{
+    PMDL               MdlAddress;
+    IO_STATUS_BLOCK    IoStatus;
+    IO_STACK_LOCATION  stack;
+} IRP, *PIRP;
+
+#define IO_NO_INCREMENT  0
+
+#define IoGetCurrentIrpStackLocation(irp) (&(irp)->stack)
+VOID IoCompleteRequest(PIRP irp, UCHAR boost);
+
+typedef struct _DEVICE_OBJECT
+{
+    PVOID  DeviceExtension;
+} DEVICE_OBJECT, *PDEVICE_OBJECT;
+
+/* Cancel-safe queue holds at most one IRP */
+typedef struct _IO_CSQ
+{
+    PIRP  irp;
+} IO_CSQ, *PIO_CSQ;
+
+typedef struct _IO_CSQ_IRP_CONTEXT *PIO_CSQ_IRP_CONTEXT;
+
+NTSTATUS IoCsqInsertIrp(PIO_CSQ csq, PIRP irp, PIO_CSQ_IRP_CONTEXT context);
+PIRP IoCsqRemoveNextIrp(PIO_CSQ csq, PVOID peek_context);
+
+typedef VOID IO_CSQ_INSERT_IRP(PIO_CSQ csq, PIRP irp);
+typedef VOID IO_CSQ_REMOVE_IRP(PIO_CSQ csq, PIRP irp);
+typedef PIRP IO_CSQ_PEEK_NEXT_IRP(PIO_CSQ csq, PIRP irp, PVOID context);
+typedef VOID IO_CSQ_COMPLETE_CANCELED_IRP(PIO_CSQ csq, PIRP irp);
+
+typedef NTSTATUS DRIVER_INITIALIZE(PDRIVER_OBJECT driver, PVOID path);
+typedef VOID DRIVER_UNLOAD(PDRIVER_OBJECT driver);
+typedef NTSTATUS DRIVER_ADD_DEVICE(PDRIVER_OBJECT driver, PDEVICE_OBJECT pdo);
+typedef NTSTATUS DRIVER_DISPATCH(PDEVICE_OBJECT device, PIRP irp);
+typedef NTSTATUS IO_COMPLETION_ROUTINE(PDEVICE_OBJECT device, PIRP irp,
+                                       PVOID context);
+
+/* devioctl.h */
+#define CTL_CODE(type, function, method, access) \
+    (((type) << 16) | ((access) << 14) | ((function) << 2) | (method))
+#define FILE_DEVICE_UNKNOWN  0x00000022
+#define METHOD_BUFFERED      0
+#define FILE_ANY_ACCESS      0
+#define FILE_READ_ACCESS     0x0001
+#define FILE_WRITE_ACCESS    0x0002
+
+#endif /* USBPCAP_HOST_NTDDK_H */
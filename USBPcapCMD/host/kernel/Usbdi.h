@@ -0,0 +1,12 @@
+/*
+ * Copyright (c) 2026 Tomasz Moń <desowin@gmail.com>
+ *
+ * SPDX-License-Identifier: GPL-2.0
+ */
+
+#ifndef USBPCAP_HOST_USBDI_H
+#define USBPCAP_HOST_USBDI_H
+
+#include <usb.h>
+
+#endif /* USBPCAP_HOST_USBDI_H */
@@ -0,0 +1,19 @@
+/*
+ * Copyright (c) 2026 Tomasz Moń <desowin@gmail.com>
+ *
+ * SPDX-License-Identifier: GPL-2.0
+ */
+
+#ifndef USBPCAP_HOST_KERNEL_USB_H
+#define USBPCAP_HOST_KERNEL_USB_H
+
+#include "Ntddk.h"
+
+typedef LONG USBD_STATUS;
+typedef PVOID USBD_PIPE_HANDLE;
+
+#define USBD_STATUS_SUCCESS  ((USBD_STATUS)0x00000000)
+
+typedef struct _USB_CONFIGURATION_DESCRIPTOR *PUSB_CONFIGURATION_DESCRIPTOR;
+
+#endif /* USBPCAP_HOST_KERNEL_USB_H */
@@ -0,0 +1,122 @@
+/*
+ * Copyright (c) 2026 Tomasz Moń <desowin@gmail.com>
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+/* Runs capture pipeline benchmark on POSIX hosts. Options have the same
+ * meaning as USBPcapCMD --benchmark ones.
+ */
+
+#include <getopt.h>
+#include <signal.h>
+#include <windows.h>
+#include "bench.h"
+#include "thread.h"
+
+#define DEFAULT_INTERNAL_KERNEL_BUFFER_SIZE (1024*1024)
+#define DEFAULT_SNAPSHOT_LENGTH             (65535)
+
+#define ARG_COMPRESS_PAYLOAD  900
+#define ARG_REORDER_WINDOW    901
+#define ARG_LIVE_STATS_JSON   902
+
+static void usage(const char *self)
+{
+    printf("Usage: %s -o <file> [options] <settings>\n"
+           "Runs USBPcapCMD capture pipeline on generated packets.\n"
+           "  -o <file>, --output <file>\n"
+           "    Output file, - for standard output, NUL to leave out disk writes.\n"
+           "  -b <len>, --bufferlen <len>\n"
+           "    Producer buffer size in bytes, default %d.\n"
+           "  -s <len>, --snaplen <len>\n"
+           "    Snapshot length written to pcap header, default %d.\n"
+           "  --compress-payload\n"
+           "    Passes data through inflate stage.\n"
+           "  --reorder-window <n>\n"
+           "    Passes data through reorder stage of <n> packets.\n"
+           "  --live-stats-json <file>\n"
+           "    Appends per-second statistics to <file>.\n"
+           "Settings are comma separated: size=<bytes> (default 64),\n"
+           "rate=<packets/s> (default 0, unlimited), burst=<packets> (default 1),\n"
+           "duration=<s> (default 10) and sweep, which doubles rate after every\n"
+           "run until packets are lost.\n",
+           self, DEFAULT_INTERNAL_KERNEL_BUFFER_SIZE, DEFAULT_SNAPSHOT_LENGTH);
+}
+
+int main(int argc, char **argv)
+{
+    static struct option long_options[] =
+    {
+        {"help", no_argument, 0, 'h'},
+        {"output", required_argument, 0, 'o'},
+        {"snaplen", required_argument, 0, 's'},
+        {"bufferlen", required_argument, 0, 'b'},
+        {"compress-payload", no_argument, 0, ARG_COMPRESS_PAYLOAD},
+        {"reorder-window", required_argument, 0, ARG_REORDER_WINDOW},
+        {"live-stats-json", required_argument, 0, ARG_LIVE_STATS_JSON},
+        {0, 0, 0, 0}
+    };
+    struct thread_data data;
+    int c;
+
+    memset(&data, 0, sizeof(data));
+    data.snaplen = DEFAULT_SNAPSHOT_LENGTH;
+    data.bufferlen = DEFAULT_INTERNAL_KERNEL_BUFFER_SIZE;
+    data.read_handle = INVALID_HANDLE_VALUE;
+    data.write_handle = INVALID_HANDLE_VALUE;
+    data.exit_event = INVALID_HANDLE_VALUE;
+
+    while ((c = getopt_long(argc, argv, "ho:s:b:", long_options, NULL)) != -1)
+    {
+        switch (c)
+        {
+            case 'o':
+                data.filename = optarg;
+                break;
+            case 's':
+                data.snaplen = atol(optarg);
+                if (data.snaplen == 0)
+                {
+                    fprintf(stderr, "Invalid snapshot length!\n");
+                    return -1;
+                }
+                break;
+            case 'b':
+                data.bufferlen = atol(optarg);
+                if (data.bufferlen < 4096 || data.bufferlen > 134217728)
+                {
+                    fprintf(stderr, "Invalid buffer length! "
+                                    "Valid range <4096,134217728>.\n");
+                    return -1;
+                }
+                break;
+            case ARG_COMPRESS_PAYLOAD:
+                data.compress_payload = TRUE;
+                break;
+            case ARG_REORDER_WINDOW:
+                data.reorder_window = atol(optarg);
+                break;
+            case ARG_LIVE_STATS_JSON:
+                data.live_stats_json = optarg;
+                break;
+            case 'h':
+                usage(argv[0]);
+                return 0;
+            default:
+                usage(argv[0]);
+                return -1;
+        }
+    }
+
+    if ((data.filename == NULL) || (optind != argc - 1))
+    {
+        usage(argv[0]);
+        return -1;
+    }
+
+    /* Closed reader makes write fail instead of killing the process */
+    signal(SIGPIPE, SIG_IGN);
+
+    return bench_run(&data, argv[optind]);
+}
@@ -0,0 +1,550 @@
+/*
+ * Copyright (c) 2026 Tomasz Moń <desowin@gmail.com>
+ *
+ * SPDX-License-Identifier: GPL-2.0
+ */
+
+/* Stores packets in the driver buffer on POSIX hosts and reports how many
+ * of them the buffer holds and how much CPU time storing and reading them
+ * takes with every buffer option.
+ *
+ * Packets come from USBPcap capture files. Any other file is split into
+ * bulk IN completions, like data read from a mass storage device.
+ */
+
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+#include "USBPcapMain.h"
+#include "USBPcapBuffer.h"
+#include "USBPcapLz.h"
+
+#define DEFAULT_BUFFER_SIZE    (1024*1024)
+#define DEFAULT_SNAPSHOT_LEN   USBPCAP_DEFAULT_SNAP_LEN
+#define DEFAULT_TRANSFER_SIZE  16384
+
+#define READ_BUFFER_SIZE       (1024*1024)
+
+/* Interval between generated bulk completions, in 100 ns units */
+#define TRANSFER_INTERVAL      1250
+
+#define URB_FUNCTION_BULK_OR_INTERRUPT_TRANSFER  0x0009
+
+typedef struct
+{
+    LARGE_INTEGER                  timestamp;
+    PUSBPCAP_BUFFER_PACKET_HEADER  header;
+    PUCHAR                         payload;
+} RING_RECORD;
+
+typedef struct
+{
+    RING_RECORD  *records;
+    size_t        count;
+    size_t        allocated;
+    ULONGLONG     bytes;   /* pcap record data, without record headers */
+} RING_INPUT;
+
+typedef struct
+{
+    const char  *name;
+    UINT32       options;
+} RING_MODE;
+
+static const RING_MODE modes[] =
+{
+    {"plain",    0},
+    {"compact",  USBPCAP_OPTION_COMPACT_RING},
+    {"compress", USBPCAP_OPTION_COMPRESS_PAYLOAD},
+    {"aligned",  USBPCAP_OPTION_ALIGNED_RING},
+    {"aligned+compress",
+                 USBPCAP_OPTION_ALIGNED_RING | USBPCAP_OPTION_COMPRESS_PAYLOAD},
+};
+
+/* Fake device stack the buffer code reaches through */
+typedef struct
+{
+    USBPCAP_ROOTHUB_DATA  root;
+    USBPCAP_DEVICE_DATA   device;
+    DEVICE_EXTENSION      rootExt;
+    DEVICE_OBJECT         rootObject;
+    DEVICE_EXTENSION      controlExt;
+    DEVICE_OBJECT         controlObject;
+} RING_STACK;
+
+/* Counts records in data read from buffer */
+typedef struct
+{
+    UCHAR      header[sizeof(pcaprec_hdr_t)];
+    UINT32     headerFill;
+    UINT32     skip;
+    ULONGLONG  records;
+} RING_PARSER;
+
+static LONGLONG now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (LONGLONG)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static RING_RECORD *input_add(RING_INPUT *input)
+{
+    if (input->count == input->allocated)
+    {
+        size_t allocated = input->allocated ? input->allocated * 2 : 1024;
+        RING_RECORD *records = realloc(input->records,
+                                       allocated * sizeof(RING_RECORD));
+
+        if (records == NULL)
+        {
+            return NULL;
+        }
+        input->records = records;
+        input->allocated = allocated;
+    }
+
+    return &input->records[input->count++];
+}
+
+static BOOLEAN load_pcap(RING_INPUT *input, PUCHAR data, size_t length)
+{
+    size_t offset = sizeof(pcap_hdr_t);
+
+    if (((pcap_hdr_t *)data)->network != DLT_USBPCAP)
+    {
+        fprintf(stderr, "Only DLT_USBPCAP captures are supported\n");
+        return FALSE;
+    }
+
+    while (length - offset >= sizeof(pcaprec_hdr_t))
+    {
+        pcaprec_hdr_t                  *rec = (pcaprec_hdr_t *)&data[offset];
+        PUSBPCAP_BUFFER_PACKET_HEADER  header;
+        RING_RECORD                    *record;
+
+        offset += sizeof(pcaprec_hdr_t);
+        if (rec->incl_len > length - offset)
+        {
+            break;
+        }
+
+        header = (PUSBPCAP_BUFFER_PACKET_HEADER)&data[offset];
+        offset += rec->incl_len;
+
+        /* Records that the driver would not store this way */
+        if ((rec->incl_len < sizeof(USBPCAP_BUFFER_PACKET_HEADER)) ||
+            (header->headerLen < sizeof(USBPCAP_BUFFER_PACKET_HEADER)) ||
+            (header->headerLen > rec->incl_len) ||
+            (header->info & (USBPCAP_INFO_SEQUENCE | USBPCAP_INFO_COMPRESSED)))
+        {
+            continue;
+        }
+
+        record = input_add(input);
+        if (record == NULL)
+        {
+            return FALSE;
+        }
+        /* Only captured part is stored again */
+        header->dataLength = rec->incl_len - header->headerLen;
+        record->header = header;
+        record->payload = (PUCHAR)header + header->headerLen;
+        record->timestamp.QuadPart = 116444736000000000LL +
+            (LONGLONG)rec->ts_sec * 10000000 + (LONGLONG)rec->ts_usec * 10;
+        input->bytes += rec->incl_len;
+    }
+
+    return TRUE;
+}
+
+static BOOLEAN load_raw(RING_INPUT *input, PUCHAR data, size_t length,
+                        UINT32 transfer)
+{
+    PUSBPCAP_BUFFER_PACKET_HEADER  headers;
+    size_t                         count = (length + transfer - 1) / transfer;
+    size_t                         i;
+    LARGE_INTEGER                  timestamp;
+
+    timestamp.QuadPart = 116444736000000000LL;
+    if (input->count > 0)
+    {
+        timestamp = input->records[input->count - 1].timestamp;
+    }
+
+    headers = calloc(count, sizeof(USBPCAP_BUFFER_PACKET_HEADER));
+    if (headers == NULL)
+    {
+        return FALSE;
+    }
+
+    for (i = 0; i < count; i++)
+    {
+        PUSBPCAP_BUFFER_PACKET_HEADER  header = &headers[i];
+        RING_RECORD                    *record = input_add(input);
+
+        if (record == NULL)
+        {
+            return FALSE;
+        }
+
+        header->headerLen  = sizeof(USBPCAP_BUFFER_PACKET_HEADER);
+        header->irpId      = 0x1000 + (i & 0xF) * 0x100;
+        header->status     = USBD_STATUS_SUCCESS;
+        header->function   = URB_FUNCTION_BULK_OR_INTERRUPT_TRANSFER;
+        header->info       = USBPCAP_INFO_PDO_TO_FDO;
+        header->bus        = 1;
+        header->device     = 2;
+        header->endpoint   = 0x81;
+        header->transfer   = USBPCAP_TRANSFER_BULK;
+        header->dataLength = (UINT32)min(transfer, length - i * transfer);
+
+        timestamp.QuadPart += TRANSFER_INTERVAL;
+        record->timestamp = timestamp;
+        record->header = header;
+        record->payload = &data[i * transfer];
+        input->bytes += header->headerLen + header->dataLength;
+    }
+
+    return TRUE;
+}
+
+static BOOLEAN load_file(RING_INPUT *input, const char *name, UINT32 transfer)
+{
+    FILE    *file;
+    PUCHAR  data;
+    long    length;
+    BOOLEAN result;
+
+    file = fopen(name, "rb");
+    if (file == NULL)
+    {
+        perror(name);
+        return FALSE;
+    }
+
+    fseek(file, 0, SEEK_END);
+    length = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    /* Data is referenced by records until the program ends */
+    data = malloc(length > 0 ? length : 1);
+    if ((data == NULL) || (fread(data, 1, length, file) != (size_t)length))
+    {
+        fprintf(stderr, "Cannot read %s\n", name);
+        fclose(file);
+        return FALSE;
+    }
+    fclose(file);
+
+    if ((length >= (long)sizeof(pcap_hdr_t)) &&
+        (((pcap_hdr_t *)data)->magic_number == 0xA1B2C3D4))
+    {
+        result = load_pcap(input, data, length);
+    }
+    else
+    {
+        result = load_raw(input, data, length, transfer);
+    }
+
+    if (result == FALSE)
+    {
+        fprintf(stderr, "Cannot load %s\n", name);
+    }
+    return result;
+}
+
+static void parser_feed(RING_PARSER *parser, PUCHAR data, UINT32 length)
+{
+    while (length > 0)
+    {
+        UINT32 tmp;
+
+        if (parser->skip > 0)
+        {
+            tmp = min(parser->skip, length);
+            parser->skip -= tmp;
+            data += tmp;
+            length -= tmp;
+            continue;
+        }
+
+        tmp = min(sizeof(pcaprec_hdr_t) - parser->headerFill, length);
+        memcpy(&parser->header[parser->headerFill], data, tmp);
+        parser->headerFill += tmp;
+        data += tmp;
+        length -= tmp;
+
+        if (parser->headerFill == sizeof(pcaprec_hdr_t))
+        {
+            parser->skip = ((pcaprec_hdr_t *)parser->header)->incl_len;
+            parser->headerFill = 0;
+            parser->records++;
+        }
+    }
+}
+
+static void stack_init(RING_STACK *stack, UINT32 snaplen)
+{
+    memset(stack, 0, sizeof(RING_STACK));
+
+    KeInitializeSpinLock(&stack->root.bufferLock);
+    stack->root.snaplen = snaplen;
+    stack->root.controlDevice = &stack->controlObject;
+
+    stack->device.pRootData = &stack->root;
+    stack->rootExt.deviceMagic = USBPCAP_MAGIC_ROOTHUB;
+    stack->rootExt.context.usb.pDeviceData = &stack->device;
+    stack->rootObject.DeviceExtension = &stack->rootExt;
+
+    stack->controlExt.deviceMagic = USBPCAP_MAGIC_CONTROL;
+    stack->controlExt.context.control.pRootHubObject = &stack->rootObject;
+    stack->controlObject.DeviceExtension = &stack->controlExt;
+}
+
+/* Reads everything from buffer, returns number of bytes read */
+static ULONGLONG drain(RING_STACK *stack, PUCHAR buffer, RING_PARSER *parser)
+{
+    ULONGLONG  total = 0;
+    MDL        mdl;
+    IRP        irp;
+    UINT32     bytes;
+
+    mdl.address = buffer;
+    mdl.byteCount = READ_BUFFER_SIZE;
+    memset(&irp, 0, sizeof(irp));
+    irp.MdlAddress = &mdl;
+    irp.stack.Parameters.Read.Length = READ_BUFFER_SIZE;
+
+    while (1)
+    {
+        NTSTATUS status = USBPcapBufferHandleReadIrp(&irp, &stack->controlExt,
+                                                     &bytes);
+
+        if (status == STATUS_PENDING)
+        {
+            /* Buffer is empty, take the IRP back */
+            IoCsqRemoveNextIrp(&stack->controlExt.context.control.ioCsq, NULL);
+            break;
+        }
+        if (parser != NULL)
+        {
+            parser_feed(parser, buffer, bytes);
+        }
+        total += bytes;
+    }
+
+    return total;
+}
+
+static int run_mode(const RING_MODE *mode, RING_INPUT *input, UINT32 size,
+                    UINT32 snaplen, int rounds)
+{
+    RING_STACK   stack;
+    RING_PARSER  parser;
+    PUCHAR       buffer;
+    LONGLONG     storeNs = 0;
+    LONGLONG     readNs = 0;
+    LONGLONG     start;
+    ULONGLONG    stored = 0;
+    ULONGLONG    ringBytes = 0;
+    ULONGLONG    fills = 0;
+    ULONGLONG    fillRecords = 0;
+    ULONGLONG    sinceDrain = 0;
+    ULONGLONG    readBytes = 0;
+    NTSTATUS     status;
+    int          round;
+    size_t       i;
+
+    buffer = malloc(READ_BUFFER_SIZE);
+    if (buffer == NULL)
+    {
+        return -1;
+    }
+
+    stack_init(&stack, snaplen);
+    memset(&parser, 0, sizeof(parser));
+
+    status = USBPcapSetOptions(&stack.root, mode->options);
+    if (NT_SUCCESS(status))
+    {
+        status = USBPcapSetUpBuffer(&stack.root, size);
+    }
+    if (!NT_SUCCESS(status))
+    {
+        fprintf(stderr, "%s: cannot set up buffer (0x%08X)\n", mode->name,
+                (unsigned)status);
+        free(buffer);
+        return -1;
+    }
+
+    /* pcap file header */
+    drain(&stack, buffer, NULL);
+
+    for (round = 0; round < rounds; round++)
+    {
+        for (i = 0; i < input->count; i++)
+        {
+            RING_RECORD *record = &input->records[i];
+            UINT32 writeOffset = stack.root.writeOffset;
+
+            start = now_ns();
+            status = USBPcapBufferWriteTimestampedPacket(&stack.root,
+                                                         record->timestamp,
+                                                         record->header,
+                                                         record->payload);
+            storeNs += now_ns() - start;
+
+            if (status == STATUS_INSUFFICIENT_RESOURCES)
+            {
+                fills++;
+                fillRecords += sinceDrain;
+                sinceDrain = 0;
+
+                start = now_ns();
+                readBytes += drain(&stack, buffer, &parser);
+                readNs += now_ns() - start;
+
+                writeOffset = stack.root.writeOffset;
+                start = now_ns();
+                status = USBPcapBufferWriteTimestampedPacket(&stack.root,
+                                                             record->timestamp,
+                                                             record->header,
+                                                             record->payload);
+                storeNs += now_ns() - start;
+            }
+
+            if (!NT_SUCCESS(status))
+            {
+                fprintf(stderr, "%s: record %lu not stored (0x%08X)\n",
+                        mode->name, (unsigned long)i, (unsigned)status);
+                continue;
+            }
+
+            stored++;
+            sinceDrain++;
+            ringBytes += (stack.root.writeOffset + stack.root.bufferSize -
+                          writeOffset) % stack.root.bufferSize;
+        }
+    }
+
+    start = now_ns();
+    readBytes += drain(&stack, buffer, &parser);
+    readNs += now_ns() - start;
+
+    printf("%-16s %10llu %10.1f %12.0f %9.2f %9.1f %9.1f",
+           mode->name, stored,
+           stored ? (double)ringBytes / stored : 0.0,
+           ringBytes ? (double)stored * stack.root.bufferSize / ringBytes : 0.0,
+           ringBytes ? (double)(input->bytes * rounds) / ringBytes : 0.0,
+           stored ? (double)storeNs / stored : 0.0,
+           stored ? (double)readNs / stored : 0.0);
+    if (fills > 0)
+    {
+        printf(" %10.0f", (double)fillRecords / fills);
+    }
+    printf("\n");
+
+    if (parser.records != stored)
+    {
+        fprintf(stderr, "%s: stored %llu records, read %llu\n", mode->name,
+                stored, parser.records);
+    }
+
+    free(stack.root.buffer);
+    free(stack.root.compact);
+    free(buffer);
+    return (parser.records == stored) ? 0 : -1;
+}
+
+static void usage(const char *self)
+{
+    printf("Usage: %s [options] <file>...\n"
+           "Stores packets in driver buffer with every buffer option.\n"
+           "Files are USBPcap captures or any data that is split into bulk\n"
+           "IN transfers.\n"
+           "  -b <len>  Driver buffer size in bytes, default %d.\n"
+           "  -s <len>  Snapshot length, default %d.\n"
+           "  -t <len>  Transfer size for files that are not captures,\n"
+           "            default %d.\n"
+           "  -r <n>    Number of passes over input, default 1.\n"
+           "Reported per mode: records stored, buffer bytes per record,\n"
+           "records buffer holds, capture bytes per buffer byte, store and\n"
+           "read CPU time per record in ns and records stored between reads\n"
+           "when buffer got full.\n",
+           self, DEFAULT_BUFFER_SIZE, DEFAULT_SNAPSHOT_LEN,
+           DEFAULT_TRANSFER_SIZE);
+}
+
+int main(int argc, char **argv)
+{
+    RING_INPUT  input;
+    UINT32      size = DEFAULT_BUFFER_SIZE;
+    UINT32      snaplen = DEFAULT_SNAPSHOT_LEN;
+    UINT32      transfer = DEFAULT_TRANSFER_SIZE;
+    int         rounds = 1;
+    int         result = 0;
+    int         c;
+    size_t      i;
+
+    while ((c = getopt(argc, argv, "hb:s:t:r:")) != -1)
+    {
+        switch (c)
+        {
+            case 'b':
+                size = atol(optarg);
+                break;
+            case 's':
+                snaplen = atol(optarg);
+                break;
+            case 't':
+                transfer = atol(optarg);
+                break;
+            case 'r':
+                rounds = atoi(optarg);
+                break;
+            case 'h':
+                usage(argv[0]);
+                return 0;
+            default:
+                usage(argv[0]);
+                return -1;
+        }
+    }
+
+    if ((optind == argc) || (snaplen == 0) || (transfer == 0) || (rounds < 1))
+    {
+        usage(argv[0]);
+        return -1;
+    }
+
+    memset(&input, 0, sizeof(input));
+    for (; optind < argc; optind++)
+    {
+        if (load_file(&input, argv[optind], transfer) == FALSE)
+        {
+            return -1;
+        }
+    }
+
+    if (USBPcapLzInitialize() != STATUS_SUCCESS)
+    {
+        return -1;
+    }
+
+    printf("%llu records, %llu bytes, %u bytes buffer\n",
+           (ULONGLONG)input.count, input.bytes, size);
+    printf("%-16s %10s %10s %12s %9s %9s %9s %10s\n", "mode", "stored",
+           "bytes/rec", "recs/buffer", "ratio", "store ns", "read ns",
+           "recs/fill");
+    for (i = 0; i < sizeof(modes) / sizeof(modes[0]); i++)
+    {
+        if (run_mode(&modes[i], &input, size, snaplen, rounds) != 0)
+        {
+            result = -1;
+        }
+    }
+
+    return result;
+}
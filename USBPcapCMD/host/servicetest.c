@@ -0,0 +1,537 @@
+/*
+ * Copyright (c) 2026 Tomasz Moń <desowin@gmail.com>
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+/* Tests of capture service core on fake capture devices.
+ * Run with make -C USBPcapCMD/host check.
+ */
+
+#include <windows.h>
+#include "servicecore.h"
+
+#define TEST_MAX_HUBS      4
+#define TEST_SINK_SIZE     (8 * 1024 * 1024)
+#define TEST_RECORDS       64
+#define TEST_SNAPLEN       (1024 * 1024)
+#define TEST_SHORT_SNAPLEN 40
+
+static int failures;
+
+#define CHECK(condition) \
+    do \
+    { \
+        if (!(condition)) \
+        { \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); \
+            failures++; \
+        } \
+    } while (0)
+
+/* Fake filter device. Remembers the filter service core set last. */
+typedef struct
+{
+    char device[SERVICE_DEVICE_LENGTH];
+    USBPCAP_ADDRESS_FILTER filter;
+    int filter_calls;
+    BOOL closed;
+} test_hub;
+
+typedef struct
+{
+    test_hub hubs[TEST_MAX_HUBS];
+    int opened;
+} test_backend;
+
+/* Client pipe, receives everything service core writes */
+typedef struct
+{
+    unsigned char *data;
+    DWORD used;
+    int writes;
+    BOOL broken;
+} test_sink;
+
+static void *test_open_hub(void *ctx, const char *device)
+{
+    test_backend *backend = (test_backend *)ctx;
+    test_hub *hub;
+
+    /* Hub that does not exist */
+    if ((backend->opened == TEST_MAX_HUBS) || (strcmp(device, "\\\\.\\USBPcap9") == 0))
+    {
+        return NULL;
+    }
+
+    hub = &backend->hubs[backend->opened++];
+    strcpy_s(hub->device, sizeof(hub->device), device);
+    return hub;
+}
+
+static BOOL test_set_filter(void *ctx, void *hub, const USBPCAP_ADDRESS_FILTER *filter)
+{
+    test_hub *fake = (test_hub *)hub;
+
+    UNREFERENCED_PARAMETER(ctx);
+
+    fake->filter = *filter;
+    fake->filter_calls++;
+    return TRUE;
+}
+
+static void test_close_hub(void *ctx, void *hub)
+{
+    UNREFERENCED_PARAMETER(ctx);
+
+    ((test_hub *)hub)->closed = TRUE;
+}
+
+static const service_backend test_ops =
+{
+    test_open_hub,
+    test_set_filter,
+    test_close_hub,
+};
+
+static BOOL test_write(void *ctx, const unsigned char *data, DWORD length)
+{
+    test_sink *sink = (test_sink *)ctx;
+
+    if (sink->broken || (sink->used + length > TEST_SINK_SIZE))
+    {
+        return FALSE;
+    }
+    memcpy(&sink->data[sink->used], data, length);
+    sink->used += length;
+    sink->writes++;
+    return TRUE;
+}
+
+static void test_sink_init(test_sink *sink)
+{
+    memset(sink, 0, sizeof(test_sink));
+    sink->data = (unsigned char *)malloc(TEST_SINK_SIZE);
+    CHECK(sink->data != NULL);
+}
+
+static void test_request(SERVICE_ATTACH_REQUEST *request, const char *device,
+                         UINT32 snaplen, const char *addresses, BOOL all)
+{
+    char list[64];
+
+    memset(request, 0, sizeof(SERVICE_ATTACH_REQUEST));
+    request->version = SERVICE_PROTOCOL_VERSION;
+    request->snaplen = snaplen;
+    strcpy_s(request->device, sizeof(request->device), device);
+    strcpy_s(list, sizeof(list), addresses);
+    /* Same bit layout as USBPcapInitAddressFilter() */
+    if (all)
+    {
+        request->filter.filterAll = TRUE;
+    }
+    else
+    {
+        char *context;
+        char *token;
+
+        for (token = strtok_s(list, ",", &context); token != NULL;
+             token = strtok_s(NULL, ",", &context))
+        {
+            int address = atoi(token);
+
+            request->filter.addresses[address / 32] |= 1 << (address % 32);
+        }
+    }
+}
+
+static BOOL test_filtered(const USBPCAP_ADDRESS_FILTER *filter, int address)
+{
+    return (filter->addresses[address / 32] & (1 << (address % 32))) ? TRUE : FALSE;
+}
+
+static DWORD test_header(unsigned char *out)
+{
+    pcap_hdr_t header;
+
+    memset(&header, 0, sizeof(header));
+    header.magic_number = 0xA1B2C3D4;
+    header.version_major = 2;
+    header.version_minor = 4;
+    header.snaplen = TEST_SNAPLEN;
+    header.network = DLT_USBPCAP;
+    memcpy(out, &header, sizeof(header));
+    return sizeof(header);
+}
+
+/* Appends record of given device with length bytes of packet data */
+static DWORD test_record(unsigned char *out, USHORT device, UINT32 length, UINT32 seq)
+{
+    pcaprec_hdr_t hdr;
+    USBPCAP_BUFFER_PACKET_HEADER packet;
+    UINT32 i;
+
+    memset(&packet, 0, sizeof(packet));
+    packet.headerLen = sizeof(packet);
+    packet.device = device;
+    packet.transfer = USBPCAP_TRANSFER_BULK;
+    packet.dataLength = length;
+
+    hdr.ts_sec = seq;
+    hdr.ts_usec = 0;
+    hdr.incl_len = sizeof(packet) + length;
+    hdr.orig_len = hdr.incl_len;
+
+    memcpy(out, &hdr, sizeof(hdr));
+    memcpy(out + sizeof(hdr), &packet, sizeof(packet));
+    for (i = 0; i < length; i++)
+    {
+        out[sizeof(hdr) + sizeof(packet) + i] = (unsigned char)(seq + i);
+    }
+    return sizeof(hdr) + sizeof(packet) + length;
+}
+
+/* Returns number of records in pcap stream of sink and checks its framing */
+static int test_count_records(const test_sink *sink, UINT32 snaplen, int device)
+{
+    DWORD offset = sizeof(pcap_hdr_t);
+    int count = 0;
+
+    CHECK(sink->used >= sizeof(pcap_hdr_t));
+    CHECK(((const pcap_hdr_t *)sink->data)->snaplen == snaplen);
+
+    while (offset + sizeof(pcaprec_hdr_t) <= sink->used)
+    {
+        const pcaprec_hdr_t *hdr = (const pcaprec_hdr_t *)&sink->data[offset];
+
+        CHECK(hdr->incl_len <= snaplen);
+        if ((device >= 0) && (hdr->incl_len >= sizeof(USBPCAP_BUFFER_PACKET_HEADER)))
+        {
+            const USBPCAP_BUFFER_PACKET_HEADER *packet =
+                (const USBPCAP_BUFFER_PACKET_HEADER *)(hdr + 1);
+
+            CHECK(packet->device == device);
+        }
+        offset += sizeof(pcaprec_hdr_t) + hdr->incl_len;
+        count++;
+    }
+    CHECK(offset == sink->used);
+    return count;
+}
+
+static void test_attach(void)
+{
+    test_backend backend;
+    service_core core;
+    SERVICE_ATTACH_REQUEST request;
+    service_client *first;
+    service_client *second;
+    service_client *all;
+    service_client *other;
+    test_sink sink;
+    test_hub *hub;
+    UINT32 error;
+
+    memset(&backend, 0, sizeof(backend));
+    test_sink_init(&sink);
+    service_core_init(&core, &test_ops, &backend);
+
+    test_request(&request, "\\\\.\\USBPcap1", TEST_SNAPLEN, "1,2", FALSE);
+    request.version = SERVICE_PROTOCOL_VERSION + 1;
+    CHECK(service_core_attach(&core, &request, test_write, &sink, &error) == NULL);
+    CHECK(error == SERVICE_ERROR_VERSION);
+
+    request.version = SERVICE_PROTOCOL_VERSION;
+    request.snaplen = 0;
+    CHECK(service_core_attach(&core, &request, test_write, &sink, &error) == NULL);
+    CHECK(error == SERVICE_ERROR_REQUEST);
+
+    request.snaplen = TEST_SNAPLEN;
+    memset(request.device, 'x', sizeof(request.device));
+    CHECK(service_core_attach(&core, &request, test_write, &sink, &error) == NULL);
+    CHECK(error == SERVICE_ERROR_REQUEST);
+
+    test_request(&request, "\\\\.\\USBPcap9", TEST_SNAPLEN, "1", FALSE);
+    CHECK(service_core_attach(&core, &request, test_write, &sink, &error) == NULL);
+    CHECK(error == SERVICE_ERROR_DEVICE);
+    CHECK(core.hub_count == 0);
+
+    /* Filters of clients on the same hub are merged */
+    test_request(&request, "\\\\.\\USBPcap1", TEST_SNAPLEN, "1,2", FALSE);
+    first = service_core_attach(&core, &request, test_write, &sink, &error);
+    CHECK(first != NULL);
+    CHECK(error == SERVICE_ERROR_NONE);
+    hub = &backend.hubs[0];
+    CHECK(backend.opened == 1);
+    CHECK(test_filtered(&hub->filter, 1) && test_filtered(&hub->filter, 2));
+    CHECK(!test_filtered(&hub->filter, 100));
+
+    test_request(&request, "\\\\.\\usbpcap1", TEST_SNAPLEN, "100", FALSE);
+    second = service_core_attach(&core, &request, test_write, &sink, &error);
+    CHECK(second != NULL);
+    CHECK(backend.opened == 1);
+    CHECK(test_filtered(&hub->filter, 1) && test_filtered(&hub->filter, 2));
+    CHECK(test_filtered(&hub->filter, 100));
+    CHECK(!hub->filter.filterAll);
+
+    test_request(&request, "\\\\.\\USBPcap1", TEST_SNAPLEN, "", TRUE);
+    all = service_core_attach(&core, &request, test_write, &sink, &error);
+    CHECK(all != NULL);
+    CHECK(hub->filter.filterAll);
+
+    /* Other hub has its own filter */
+    test_request(&request, "\\\\.\\USBPcap2", TEST_SNAPLEN, "5", FALSE);
+    other = service_core_attach(&core, &request, test_write, &sink, &error);
+    CHECK(other != NULL);
+    CHECK(backend.opened == 2);
+    CHECK(test_filtered(&backend.hubs[1].filter, 5));
+    CHECK(!test_filtered(&backend.hubs[1].filter, 1));
+    CHECK(!test_filtered(&hub->filter, 5));
+
+    /* Detach removes only addresses no other client wants */
+    service_core_detach(&core, all);
+    CHECK(!hub->filter.filterAll);
+    CHECK(test_filtered(&hub->filter, 1) && test_filtered(&hub->filter, 100));
+
+    service_core_detach(&core, first);
+    CHECK(!test_filtered(&hub->filter, 1) && !test_filtered(&hub->filter, 2));
+    CHECK(test_filtered(&hub->filter, 100));
+
+    /* Hub without clients stays open with empty filter */
+    service_core_detach(&core, second);
+    CHECK(!test_filtered(&hub->filter, 100));
+    CHECK(!hub->closed);
+    CHECK(core.hub_count == 2);
+
+    service_core_detach(&core, other);
+    CHECK(core.client_count == 0);
+    service_core_cleanup(&core);
+    CHECK(backend.hubs[0].closed && backend.hubs[1].closed);
+
+    free(sink.data);
+}
+
+static void test_snaplen(void)
+{
+    test_backend backend;
+    service_core core;
+    SERVICE_ATTACH_REQUEST request;
+    service_client *full;
+    service_client *cut;
+    test_sink full_sink;
+    test_sink cut_sink;
+    unsigned char *stream;
+    DWORD length;
+    DWORD offset;
+    UINT32 error;
+    int i;
+
+    memset(&backend, 0, sizeof(backend));
+    test_sink_init(&full_sink);
+    test_sink_init(&cut_sink);
+    stream = (unsigned char *)malloc(TEST_SINK_SIZE);
+    service_core_init(&core, &test_ops, &backend);
+
+    test_request(&request, "\\\\.\\USBPcap1", TEST_SNAPLEN, "", TRUE);
+    full = service_core_attach(&core, &request, test_write, &full_sink, &error);
+    test_request(&request, "\\\\.\\USBPcap1", TEST_SHORT_SNAPLEN, "", TRUE);
+    cut = service_core_attach(&core, &request, test_write, &cut_sink, &error);
+    CHECK((full != NULL) && (cut != NULL));
+    service_core_start(&core, full);
+    service_core_start(&core, cut);
+
+    length = test_header(stream);
+    for (i = 0; i < TEST_RECORDS; i++)
+    {
+        length += test_record(&stream[length], 1, i * 3, i);
+    }
+    service_core_data(&core, full->hub, stream, length);
+
+    /* Client with large snaplen gets the stream as it was read */
+    CHECK(full_sink.used == length);
+    CHECK(memcmp(full_sink.data, stream, length) == 0);
+
+    /* Short snaplen client gets header with its snaplen and cut records */
+    CHECK(test_count_records(&cut_sink, TEST_SHORT_SNAPLEN, 1) == TEST_RECORDS);
+    offset = sizeof(pcap_hdr_t);
+    for (i = 0; i < TEST_RECORDS; i++)
+    {
+        const pcaprec_hdr_t *hdr = (const pcaprec_hdr_t *)&cut_sink.data[offset];
+        UINT32 orig_len = sizeof(USBPCAP_BUFFER_PACKET_HEADER) + i * 3;
+
+        CHECK(hdr->ts_sec == (UINT32)i);
+        CHECK(hdr->orig_len == orig_len);
+        CHECK(hdr->incl_len == min(orig_len, TEST_SHORT_SNAPLEN));
+        if (hdr->incl_len > sizeof(USBPCAP_BUFFER_PACKET_HEADER))
+        {
+            const unsigned char *data = (const unsigned char *)(hdr + 1) +
+                                        sizeof(USBPCAP_BUFFER_PACKET_HEADER);
+
+            CHECK(data[0] == (unsigned char)i);
+        }
+        offset += sizeof(pcaprec_hdr_t) + hdr->incl_len;
+    }
+
+    service_core_detach(&core, full);
+    service_core_detach(&core, cut);
+    service_core_cleanup(&core);
+    free(stream);
+    free(full_sink.data);
+    free(cut_sink.data);
+}
+
+/* Feeds the same stream in chunks of every size up to max_chunk, output
+ * must not depend on how the stream was split.
+ */
+static void test_split(void)
+{
+    test_backend backend;
+    unsigned char *stream;
+    unsigned char *expected;
+    DWORD expected_length;
+    DWORD length;
+    DWORD chunk;
+    int i;
+
+    memset(&backend, 0, sizeof(backend));
+    stream = (unsigned char *)malloc(TEST_SINK_SIZE);
+    expected = (unsigned char *)malloc(TEST_SINK_SIZE);
+
+    length = test_header(stream);
+    for (i = 0; i < TEST_RECORDS; i++)
+    {
+        /* Zero length records, records of other devices and large records */
+        USHORT device = (i % 3 == 0) ? 7 : 1;
+        UINT32 data = (i % 5 == 0) ? 0 : (i % 7 == 0) ? 3 * SERVICE_CLIENT_BUFFER / 2 : i;
+
+        length += test_record(&stream[length], device, data, i);
+        if (i % 11 == 0)
+        {
+            pcaprec_hdr_t empty;
+
+            memset(&empty, 0, sizeof(empty));
+            memcpy(&stream[length], &empty, sizeof(empty));
+            length += sizeof(empty);
+        }
+    }
+    CHECK(length < TEST_SINK_SIZE);
+
+    expected_length = 0;
+    for (chunk = 1; chunk <= 4099; chunk = (chunk < 40) ? chunk + 1 : chunk * 3 + 1)
+    {
+        service_core core;
+        SERVICE_ATTACH_REQUEST request;
+        service_client *client;
+        test_sink sink;
+        DWORD offset;
+        UINT32 error;
+
+        test_sink_init(&sink);
+        service_core_init(&core, &test_ops, &backend);
+        backend.opened = 0;
+        test_request(&request, "\\\\.\\USBPcap1", TEST_SNAPLEN, "1", FALSE);
+        client = service_core_attach(&core, &request, test_write, &sink, &error);
+        CHECK(client != NULL);
+        service_core_start(&core, client);
+
+        for (offset = 0; offset < length; offset += chunk)
+        {
+            service_core_data(&core, client->hub, &stream[offset], min(chunk, length - offset));
+        }
+        CHECK(client->hub->received == 0);
+
+        if (expected_length == 0)
+        {
+            /* Device 7 records are filtered out, zero length ones kept */
+            CHECK(test_count_records(&sink, TEST_SNAPLEN, -1) ==
+                  TEST_RECORDS - (TEST_RECORDS + 2) / 3 + (TEST_RECORDS + 10) / 11);
+            memcpy(expected, sink.data, sink.used);
+            expected_length = sink.used;
+        }
+        else
+        {
+            CHECK(sink.used == expected_length);
+            CHECK(memcmp(sink.data, expected, expected_length) == 0);
+        }
+
+        service_core_detach(&core, client);
+        service_core_cleanup(&core);
+        free(sink.data);
+    }
+
+    free(stream);
+    free(expected);
+}
+
+/* Client attached after the header was read gets it on start */
+static void test_late_attach(void)
+{
+    test_backend backend;
+    service_core core;
+    SERVICE_ATTACH_REQUEST request;
+    service_client *early;
+    service_client *late;
+    test_sink early_sink;
+    test_sink late_sink;
+    unsigned char stream[256];
+    DWORD length;
+    UINT32 error;
+
+    memset(&backend, 0, sizeof(backend));
+    test_sink_init(&early_sink);
+    test_sink_init(&late_sink);
+    service_core_init(&core, &test_ops, &backend);
+
+    test_request(&request, "\\\\.\\USBPcap1", TEST_SNAPLEN, "0", FALSE);
+    early = service_core_attach(&core, &request, test_write, &early_sink, &error);
+    service_core_start(&core, early);
+    CHECK(early_sink.used == 0);
+
+    length = test_header(stream);
+    length += test_record(&stream[length], 3, 4, 1);
+    service_core_data(&core, early->hub, stream, length);
+    /* Device 3 was active before the client attached, so it is not new */
+    CHECK(test_count_records(&early_sink, TEST_SNAPLEN, 3) == 1);
+
+    test_request(&request, "\\\\.\\USBPcap1", TEST_SNAPLEN, "0", FALSE);
+    late = service_core_attach(&core, &request, test_write, &late_sink, &error);
+    service_core_start(&core, late);
+    CHECK(late_sink.used == sizeof(pcap_hdr_t));
+
+    length = test_record(stream, 3, 4, 2);
+    length += test_record(&stream[length], 4, 4, 3);
+    service_core_data(&core, early->hub, stream, length);
+    CHECK(test_count_records(&late_sink, TEST_SNAPLEN, 4) == 1);
+    CHECK(test_count_records(&early_sink, TEST_SNAPLEN, -1) == 3);
+
+    /* Failed client is not written to again */
+    late_sink.broken = TRUE;
+    service_core_data(&core, early->hub, stream, length);
+    CHECK(late->failed);
+    late_sink.broken = FALSE;
+    late_sink.writes = 0;
+    service_core_data(&core, early->hub, stream, length);
+    CHECK(late_sink.writes == 0);
+
+    service_core_detach(&core, early);
+    service_core_detach(&core, late);
+    service_core_cleanup(&core);
+    free(early_sink.data);
+    free(late_sink.data);
+}
+
+int main(int argc, char **argv)
+{
+    test_attach();
+    test_snaplen();
+    test_split();
+    test_late_attach();
+
+    if (failures > 0)
+    {
+        fprintf(stderr, "%d checks failed\n", failures);
+        return 1;
+    }
+    printf("All service core tests passed\n");
+    return 0;
+}
@@ -0,0 +1,126 @@
+/*
+ * Copyright (c) 2026 Tomasz Moń <desowin@gmail.com>
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+/* Symbols referenced by capture pipeline sources that the benchmark never
+ * reaches or that need Windows: filter device, shared memory, compressed
+ * output, annotations, console and capture file tools. They fail with
+ * ERROR_NOT_SUPPORTED.
+ */
+
+#include <windows.h>
+#include "annotate.h"
+#include "blockfile.h"
+#include "iocontrol.h"
+#include "pcapfile.h"
+#include "shmring.h"
+
+BOOLEAN USBPcapSetDeviceFiltered(PUSBPCAP_ADDRESS_FILTER filter, int address)
+{
+    return FALSE;
+}
+
+BOOL DeviceIoControl(HANDLE device, DWORD code, LPVOID in, DWORD in_length,
+                     LPVOID out, DWORD out_length, LPDWORD returned,
+                     LPOVERLAPPED overlapped)
+{
+    *returned = 0;
+    SetLastError(ERROR_NOT_SUPPORTED);
+    return FALSE;
+}
+
+BOOL GetConsoleScreenBufferInfo(HANDLE console, CONSOLE_SCREEN_BUFFER_INFO *info)
+{
+    /* Live statistics are only written to JSON file */
+    SetLastError(ERROR_NOT_SUPPORTED);
+    return FALSE;
+}
+
+BOOL SetConsoleCursorPosition(HANDLE console, COORD position)
+{
+    SetLastError(ERROR_NOT_SUPPORTED);
+    return FALSE;
+}
+
+DWORD GetTempPathA(DWORD length, LPSTR buffer)
+{
+    SetLastError(ERROR_NOT_SUPPORTED);
+    return 0;
+}
+
+UINT GetTempFileNameA(LPCSTR path, LPCSTR prefix, UINT unique, LPSTR name)
+{
+    SetLastError(ERROR_NOT_SUPPORTED);
+    return 0;
+}
+
+shm_ring *shm_ring_create(const char *name, UINT64 size, BOOL allow_users)
+{
+    fprintf(stderr, "Shared memory output is not available in host build\n");
+    return NULL;
+}
+
+BOOL shm_ring_write(shm_ring *ring, const unsigned char *data, DWORD length)
+{
+    return FALSE;
+}
+
+void shm_ring_close(shm_ring *ring)
+{
+}
+
+blockfile_writer *blockfile_writer_create(HANDLE handle, UINT32 block_size)
+{
+    fprintf(stderr, "Compressed output is not available in host build\n");
+    return NULL;
+}
+
+BOOL blockfile_write(blockfile_writer *writer, const void *data, UINT32 length)
+{
+    return FALSE;
+}
+
+BOOL blockfile_writer_close(blockfile_writer *writer)
+{
+    return FALSE;
+}
+
+BOOL annotate_pipe_open(annotate_pipe *pipe, const char *name)
+{
+    return FALSE;
+}
+
+HANDLE annotate_pipe_event(annotate_pipe *pipe)
+{
+    return NULL;
+}
+
+void annotate_pipe_process(annotate_pipe *pipe, HANDLE device)
+{
+}
+
+void annotate_pipe_close(annotate_pipe *pipe)
+{
+}
+
+size_t pcap_base_length(const char *filename)
+{
+    return strlen(filename);
+}
+
+BOOL pcap_reader_open(pcap_reader *reader, const char *filename)
+{
+    fprintf(stderr, "Capture files can't be read in host build\n");
+    return FALSE;
+}
+
+int pcap_reader_next(pcap_reader *reader, pcaprec_hdr_t *hdr, unsigned char **data)
+{
+    return PCAP_READ_ERROR;
+}
+
+void pcap_reader_close(pcap_reader *reader)
+{
+}
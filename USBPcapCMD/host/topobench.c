@@ -0,0 +1,526 @@
+/*
+ * Copyright (c) 2026 Tomasz Moń <desowin@gmail.com>
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+/* Enumerates simulated hub tree with topology_enumerate() and reports how
+ * long it takes and how many hub and Configuration Manager requests are
+ * made without cache, with cache but without generation value, with
+ * unchanged generation and after one device was reconnected.
+ *
+ * Every request sleeps to model kernel round trip. Reported tree is
+ * checked against walk without cache.
+ */
+
+#include <dirent.h>
+#include <time.h>
+#include <wchar.h>
+#include <windows.h>
+#include "topology.h"
+
+#define DEFAULT_ROOT_PORTS     8
+#define DEFAULT_HUB_PORTS      4
+#define DEFAULT_DEPTH          2
+#define DEFAULT_IOCTL_US       50
+#define DEFAULT_DESCRIBE_US    2000
+#define DEFAULT_ROUNDS         10
+
+#define SIM_MAX_HUBS           1024
+#define SIM_MAX_PORTS          16
+#define SIM_NAME_LENGTH        128
+
+#define SIM_ROOT_HUB           "\\\\?\\USB#ROOT_HUB30#SIM"
+
+typedef struct
+{
+    BOOL   connected;
+    BOOL   is_hub;
+    USHORT address;
+    USHORT product;
+    int    hub;        /* Index of hub on port, if is_hub */
+} sim_port;
+
+typedef struct
+{
+    char     name[SIM_NAME_LENGTH];
+    ULONG    port_count;
+    sim_port ports[SIM_MAX_PORTS];
+} sim_hub;
+
+/* Simulated tree and request counters */
+typedef struct
+{
+    sim_hub       hubs[SIM_MAX_HUBS];
+    int           hub_count;
+    USHORT        next_address;
+    UINT64        generation;
+    DWORD         ioctl_us;
+    DWORD         describe_us;
+    volatile LONG opens;
+    volatile LONG ioctls;      /* Port count, connection and hub name */
+    volatile LONG describes;
+} sim_tree;
+
+typedef struct
+{
+    topology_entry *entries;
+    UINT32 count;
+    UINT32 size;
+} sim_list;
+
+static void sim_delay(DWORD us)
+{
+    struct timespec duration;
+
+    duration.tv_sec = us / 1000000;
+    duration.tv_nsec = (long)(us % 1000000) * 1000L;
+    while (nanosleep(&duration, &duration) != 0)
+    {
+    }
+}
+
+static LONGLONG now_us(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (LONGLONG)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+static USHORT sim_new_address(sim_tree *tree)
+{
+    USHORT address = tree->next_address;
+
+    tree->next_address = (address == 127) ? 1 : address + 1;
+    return address;
+}
+
+/* Every third port has hub until depth is reached, every fourth is empty */
+static int sim_build_hub(sim_tree *tree, const char *name, ULONG port_count,
+                         ULONG hub_ports, int depth)
+{
+    int index;
+    ULONG i;
+
+    if (tree->hub_count == SIM_MAX_HUBS)
+    {
+        return -1;
+    }
+
+    index = tree->hub_count++;
+    strcpy_s(tree->hubs[index].name, SIM_NAME_LENGTH, name);
+    tree->hubs[index].port_count = port_count;
+
+    for (i = 0; i < port_count; i++)
+    {
+        sim_port *port = &tree->hubs[index].ports[i];
+
+        if (i % 4 == 3)
+        {
+            continue;
+        }
+
+        port->connected = TRUE;
+        port->address = sim_new_address(tree);
+        port->product = (USHORT)(0x1000 + port->address);
+        if ((depth > 0) && (i % 3 == 1))
+        {
+            char child[SIM_NAME_LENGTH];
+
+            sprintf_s(child, sizeof(child), "%s#%u", name, i + 1);
+            port->hub = sim_build_hub(tree, child, hub_ports, hub_ports, depth - 1);
+            port->is_hub = (port->hub >= 0);
+        }
+    }
+
+    return index;
+}
+
+static void *sim_open_hub(void *ctx, const char *hub)
+{
+    sim_tree *tree = (sim_tree *)ctx;
+    int i;
+
+    InterlockedIncrement(&tree->opens);
+    sim_delay(tree->ioctl_us);
+    for (i = 0; i < tree->hub_count; i++)
+    {
+        if (strcmp(tree->hubs[i].name, hub) == 0)
+        {
+            return &tree->hubs[i];
+        }
+    }
+    return NULL;
+}
+
+static void sim_close_hub(void *ctx, void *hub)
+{
+    UNREFERENCED_PARAMETER(ctx);
+    UNREFERENCED_PARAMETER(hub);
+}
+
+static UCHAR sim_get_port_count(void *ctx, void *hub)
+{
+    sim_tree *tree = (sim_tree *)ctx;
+
+    InterlockedIncrement(&tree->ioctls);
+    sim_delay(tree->ioctl_us);
+    return (UCHAR)((sim_hub *)hub)->port_count;
+}
+
+static BOOL sim_get_connection(void *ctx, void *hub, ULONG port,
+                               PUSB_NODE_CONNECTION_INFORMATION info)
+{
+    sim_tree *tree = (sim_tree *)ctx;
+    const sim_port *sim;
+
+    InterlockedIncrement(&tree->ioctls);
+    sim_delay(tree->ioctl_us);
+    if ((port == 0) || (port > ((sim_hub *)hub)->port_count))
+    {
+        return FALSE;
+    }
+
+    sim = &((sim_hub *)hub)->ports[port - 1];
+    info->ConnectionStatus = sim->connected ? DeviceConnected : NoDeviceConnected;
+    info->DeviceIsHub = (BOOLEAN)sim->is_hub;
+    info->DeviceAddress = sim->address;
+    info->DeviceDescriptor.bLength = sizeof(USB_DEVICE_DESCRIPTOR);
+    info->DeviceDescriptor.bDescriptorType = 1;
+    info->DeviceDescriptor.bDeviceClass = sim->is_hub ? 9 : 0;
+    info->DeviceDescriptor.idVendor = 0x1209;
+    info->DeviceDescriptor.idProduct = sim->product;
+    return TRUE;
+}
+
+static char *sim_get_external_hub_name(void *ctx, void *hub, ULONG port)
+{
+    sim_tree *tree = (sim_tree *)ctx;
+    const sim_port *sim = &((sim_hub *)hub)->ports[port - 1];
+
+    InterlockedIncrement(&tree->ioctls);
+    sim_delay(tree->ioctl_us);
+    return sim->is_hub ? _strdup(tree->hubs[sim->hub].name) : NULL;
+}
+
+/* Composite device with two interfaces, like the Configuration Manager tree */
+static void sim_describe_device(void *ctx, void *hub, ULONG port, BOOL children,
+                                topology_entry_callback callback, void *callback_ctx)
+{
+    sim_tree *tree = (sim_tree *)ctx;
+    const sim_port *sim = &((sim_hub *)hub)->ports[port - 1];
+    topology_entry entry;
+    int i;
+
+    InterlockedIncrement(&tree->describes);
+    sim_delay(tree->describe_us);
+
+    memset(&entry, 0, sizeof(entry));
+    swprintf(entry.display, TOPOLOGY_DISPLAY_LEN, L"%ls %04x",
+             sim->is_hub ? L"Simulated hub" : L"Simulated device", sim->product);
+    callback(&entry, callback_ctx);
+
+    if (children)
+    {
+        for (i = 1; i <= 2; i++)
+        {
+            entry.level = 1;
+            entry.node = i;
+            entry.parentNode = 0;
+            swprintf(entry.display, TOPOLOGY_DISPLAY_LEN, L"Interface %d of %04x",
+                     i - 1, sim->product);
+            callback(&entry, callback_ctx);
+        }
+    }
+}
+
+static UINT64 sim_generation(void *ctx)
+{
+    InterlockedIncrement(&((sim_tree *)ctx)->ioctls);
+    sim_delay(((sim_tree *)ctx)->ioctl_us);
+    return ((sim_tree *)ctx)->generation;
+}
+
+static const topology_ops sim_ops =
+{
+    sim_open_hub,
+    sim_close_hub,
+    sim_get_port_count,
+    sim_get_connection,
+    sim_get_external_hub_name,
+    sim_describe_device,
+    sim_generation,
+};
+
+static const topology_ops sim_ops_no_generation =
+{
+    sim_open_hub,
+    sim_close_hub,
+    sim_get_port_count,
+    sim_get_connection,
+    sim_get_external_hub_name,
+    sim_describe_device,
+    NULL,
+};
+
+static void sim_collect(const topology_entry *entry, void *ctx)
+{
+    sim_list *list = (sim_list *)ctx;
+
+    if (list->count == list->size)
+    {
+        list->size = list->size ? list->size * 2 : 64;
+        list->entries = realloc(list->entries, list->size * sizeof(topology_entry));
+        if (list->entries == NULL)
+        {
+            fprintf(stderr, "Out of memory\n");
+            exit(-1);
+        }
+    }
+    list->entries[list->count++] = *entry;
+}
+
+static void sim_reset_counters(sim_tree *tree)
+{
+    tree->opens = 0;
+    tree->ioctls = 0;
+    tree->describes = 0;
+}
+
+/* Reconnects device on next non-hub port. It gets new address. */
+static void sim_reconnect(sim_tree *tree, int *cursor)
+{
+    int total = tree->hub_count * SIM_MAX_PORTS;
+    int i;
+
+    for (i = 0; i < total; i++)
+    {
+        sim_hub *hub;
+        sim_port *port;
+
+        *cursor = (*cursor + 1) % total;
+        hub = &tree->hubs[*cursor / SIM_MAX_PORTS];
+        port = &hub->ports[*cursor % SIM_MAX_PORTS];
+        if (((ULONG)(*cursor % SIM_MAX_PORTS) < hub->port_count) &&
+            port->connected && !port->is_hub)
+        {
+            port->address = sim_new_address(tree);
+            port->product++;
+            tree->generation++;
+            return;
+        }
+    }
+}
+
+static BOOL sim_enumerate(sim_tree *tree, const topology_ops *ops,
+                          const char *cache_dir, sim_list *list)
+{
+    list->count = 0;
+    return topology_enumerate(ops, tree, SIM_ROOT_HUB, cache_dir, sim_collect, list);
+}
+
+static BOOL sim_same(const sim_list *a, const sim_list *b)
+{
+    return (a->count == b->count) &&
+           (memcmp(a->entries, b->entries, a->count * sizeof(topology_entry)) == 0);
+}
+
+typedef enum
+{
+    SCENARIO_NO_CACHE,
+    SCENARIO_NO_GENERATION,
+    SCENARIO_GENERATION,
+    SCENARIO_RECONNECT,
+} scenario;
+
+static const char *scenario_names[] =
+{
+    "no cache",
+    "no generation",
+    "generation",
+    "reconnect",
+};
+
+static int run_scenario(sim_tree *tree, scenario type, const char *cache_dir,
+                        int rounds)
+{
+    const topology_ops *ops = (type == SCENARIO_NO_GENERATION) ? &sim_ops_no_generation : &sim_ops;
+    sim_list result;
+    sim_list expected;
+    LONGLONG elapsed = 0;
+    LONG opens = 0;
+    LONG ioctls = 0;
+    LONG describes = 0;
+    int cursor = 0;
+    int failed = 0;
+    int r;
+
+    memset(&result, 0, sizeof(result));
+    memset(&expected, 0, sizeof(expected));
+
+    /* Cache left by other scenario does not match this one */
+    if (type != SCENARIO_NO_CACHE)
+    {
+        sim_enumerate(tree, ops, cache_dir, &result);
+    }
+
+    for (r = 0; r < rounds; r++)
+    {
+        LONGLONG start;
+
+        if (type == SCENARIO_RECONNECT)
+        {
+            sim_reconnect(tree, &cursor);
+        }
+
+        /* Reference tree, cache is neither used nor updated */
+        sim_enumerate(tree, &sim_ops, NULL, &expected);
+
+        sim_reset_counters(tree);
+        start = now_us();
+        if (!sim_enumerate(tree, ops, (type == SCENARIO_NO_CACHE) ? NULL : cache_dir,
+                           &result))
+        {
+            fprintf(stderr, "%s: enumeration failed\n", scenario_names[type]);
+            failed = 1;
+            break;
+        }
+        elapsed += now_us() - start;
+        opens += tree->opens;
+        ioctls += tree->ioctls;
+        describes += tree->describes;
+
+        if (!sim_same(&result, &expected))
+        {
+            fprintf(stderr, "%s: reported tree differs from tree without cache\n",
+                    scenario_names[type]);
+            failed = 1;
+            break;
+        }
+    }
+
+    if (!failed)
+    {
+        printf("%-14s %8u %10.2f %8.1f %8.1f %10.1f\n", scenario_names[type],
+               expected.count, (double)elapsed / rounds / 1000.0,
+               (double)opens / rounds, (double)ioctls / rounds,
+               (double)describes / rounds);
+    }
+
+    free(result.entries);
+    free(expected.entries);
+    return failed;
+}
+
+static void remove_cache_dir(const char *cache_dir)
+{
+    struct dirent *entry;
+    DIR *dir = opendir(cache_dir);
+    char path[MAX_PATH];
+
+    if (dir != NULL)
+    {
+        while ((entry = readdir(dir)) != NULL)
+        {
+            if (entry->d_name[0] != '.')
+            {
+                sprintf_s(path, sizeof(path), "%s/%s", cache_dir, entry->d_name);
+                DeleteFileA(path);
+            }
+        }
+        closedir(dir);
+    }
+    rmdir(cache_dir);
+}
+
+static void usage(const char *self)
+{
+    printf("Usage: %s [options]\n"
+           "Enumerates simulated USB tree with and without topology cache.\n"
+           "  -p <n>  Root hub ports, default %d.\n"
+           "  -f <n>  External hub ports, default %d.\n"
+           "  -d <n>  External hub nesting depth, default %d.\n"
+           "  -i <us> Hub request latency, default %d.\n"
+           "  -c <us> Device description latency, default %d.\n"
+           "  -r <n>  Rounds per scenario, default %d.\n",
+           self, DEFAULT_ROOT_PORTS, DEFAULT_HUB_PORTS, DEFAULT_DEPTH,
+           DEFAULT_IOCTL_US, DEFAULT_DESCRIBE_US, DEFAULT_ROUNDS);
+}
+
+int main(int argc, char **argv)
+{
+    static sim_tree tree;
+    char cache_dir[] = "/tmp/usbpcap-topobench-XXXXXX";
+    ULONG root_ports = DEFAULT_ROOT_PORTS;
+    ULONG hub_ports = DEFAULT_HUB_PORTS;
+    int depth = DEFAULT_DEPTH;
+    int rounds = DEFAULT_ROUNDS;
+    int result = 0;
+    int c;
+    int s;
+
+    tree.ioctl_us = DEFAULT_IOCTL_US;
+    tree.describe_us = DEFAULT_DESCRIBE_US;
+
+    while ((c = getopt(argc, argv, "hp:f:d:i:c:r:")) != -1)
+    {
+        switch (c)
+        {
+            case 'p':
+                root_ports = atol(optarg);
+                break;
+            case 'f':
+                hub_ports = atol(optarg);
+                break;
+            case 'd':
+                depth = atoi(optarg);
+                break;
+            case 'i':
+                tree.ioctl_us = atol(optarg);
+                break;
+            case 'c':
+                tree.describe_us = atol(optarg);
+                break;
+            case 'r':
+                rounds = atoi(optarg);
+                break;
+            case 'h':
+                usage(argv[0]);
+                return 0;
+            default:
+                usage(argv[0]);
+                return -1;
+        }
+    }
+
+    if ((root_ports == 0) || (root_ports > SIM_MAX_PORTS) ||
+        (hub_ports == 0) || (hub_ports > SIM_MAX_PORTS) ||
+        (depth < 0) || (rounds < 1))
+    {
+        usage(argv[0]);
+        return -1;
+    }
+
+    if (mkdtemp(cache_dir) == NULL)
+    {
+        fprintf(stderr, "Failed to create cache directory\n");
+        return -1;
+    }
+
+    tree.next_address = 1;
+    tree.generation = 1;
+    sim_build_hub(&tree, SIM_ROOT_HUB, root_ports, hub_ports, depth);
+
+    printf("%d hubs, %u us per hub request, %u us per description\n",
+           tree.hub_count, tree.ioctl_us, tree.describe_us);
+    printf("%-14s %8s %10s %8s %8s %10s\n", "scenario", "entries", "ms/enum",
+           "opens", "ioctls", "describes");
+    for (s = SCENARIO_NO_CACHE; s <= SCENARIO_RECONNECT; s++)
+    {
+        result |= run_scenario(&tree, (scenario)s, cache_dir, rounds);
+    }
+
+    remove_cache_dir(cache_dir);
+    return result;
+}
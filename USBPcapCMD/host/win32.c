@@ -0,0 +1,1239 @@
+/*
+ * Copyright (c) 2026 Tomasz Moń <desowin@gmail.com>
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+/* Win32 calls used by capture pipeline, implemented with POSIX threads.
+ *
+ * Every file handle is a file descriptor with synchronous I/O, overlapped
+ * operations finish before they return. Asynchronous I/O is done by epoll
+ * based ioengine_epoll.c on descriptors returned by host_file_descriptor().
+ * Named pipes are POSIX pipes that exist only within the process.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sched.h>
+#include <stdarg.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <windows.h>
+
+typedef enum
+{
+    HOST_EVENT = 1,
+    HOST_THREAD,
+    HOST_FILE,
+    HOST_PIPE_SERVER,
+    HOST_PIPE_CLIENT,
+    HOST_WAIT
+} host_type;
+
+/* Common header of all handles */
+typedef struct
+{
+    host_type type;
+    volatile LONG refs;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+} host_object;
+
+typedef struct
+{
+    host_object object;
+    BOOL manual_reset;
+    BOOL signalled;
+} host_event;
+
+typedef struct
+{
+    host_object object;
+    pthread_t thread;
+    LPTHREAD_START_ROUTINE start;
+    LPVOID param;
+    BOOL finished;
+} host_thread;
+
+/* Named pipe is POSIX pipe, server end writes to it and client end
+ * reads from it. Read end waits here until client opens it.
+ */
+typedef struct _host_pipe
+{
+    char name[MAX_PATH];
+    int read_fd;            /* -1 once client has it */
+    struct _host_pipe *next;
+} host_pipe;
+
+typedef struct _host_file
+{
+    host_object object;
+    int fd;
+    BOOL std_handle;        /* Standard handles are never closed */
+    host_pipe *pipe;        /* Server end only */
+} host_file;
+
+typedef struct
+{
+    host_object object;
+    pthread_t thread;
+    host_event *event;
+    WAITORTIMERCALLBACK callback;
+    PVOID param;
+    DWORD timeout;
+    DWORD flags;
+    BOOL cancelled;
+} host_wait;
+
+static __thread DWORD host_last_error;
+
+/* Named pipes that have server end open */
+static host_pipe *host_pipes;
+static pthread_mutex_t host_pipes_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+DWORD GetLastError(void)
+{
+    return host_last_error;
+}
+
+void SetLastError(DWORD error)
+{
+    host_last_error = error;
+}
+
+static DWORD host_error_from_errno(int error)
+{
+    switch (error)
+    {
+        case ENOENT:
+        case ENOTDIR:
+            return ERROR_FILE_NOT_FOUND;
+        case EACCES:
+        case EPERM:
+        case EROFS:
+            return ERROR_ACCESS_DENIED;
+        case EBADF:
+            return ERROR_INVALID_HANDLE;
+        case ENOMEM:
+            return ERROR_NOT_ENOUGH_MEMORY;
+        case EPIPE:
+            return ERROR_NO_DATA;
+        case EINVAL:
+            return ERROR_INVALID_PARAMETER;
+        default:
+            return ERROR_WRITE_FAULT;
+    }
+}
+
+static void *host_object_create(host_type type, size_t size)
+{
+    host_object *object;
+    pthread_condattr_t attr;
+
+    object = (host_object *)calloc(1, size);
+    if (object == NULL)
+    {
+        SetLastError(ERROR_NOT_ENOUGH_MEMORY);
+        return NULL;
+    }
+
+    object->type = type;
+    object->refs = 1;
+    pthread_mutex_init(&object->mutex, NULL);
+    /* Timeouts are measured with monotonic clock */
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&object->cond, &attr);
+    pthread_condattr_destroy(&attr);
+    return object;
+}
+
+static void host_object_release(host_object *object)
+{
+    if (InterlockedDecrement(&object->refs) == 0)
+    {
+        pthread_cond_destroy(&object->cond);
+        pthread_mutex_destroy(&object->mutex);
+        free(object);
+    }
+}
+
+static void host_deadline(struct timespec *deadline, DWORD timeout)
+{
+    clock_gettime(CLOCK_MONOTONIC, deadline);
+    deadline->tv_sec += timeout / 1000;
+    deadline->tv_nsec += (long)(timeout % 1000) * 1000000L;
+    if (deadline->tv_nsec >= 1000000000L)
+    {
+        deadline->tv_sec++;
+        deadline->tv_nsec -= 1000000000L;
+    }
+}
+
+/* Waits on object condition with object mutex held.
+ * Returns FALSE once deadline has passed.
+ */
+static BOOL host_object_wait(host_object *object, DWORD timeout,
+                             const struct timespec *deadline)
+{
+    if (timeout == INFINITE)
+    {
+        pthread_cond_wait(&object->cond, &object->mutex);
+        return TRUE;
+    }
+    return pthread_cond_timedwait(&object->cond, &object->mutex, deadline) != ETIMEDOUT;
+}
+
+static host_object *host_handle(HANDLE handle)
+{
+    if ((handle == NULL) || (handle == INVALID_HANDLE_VALUE))
+    {
+        SetLastError(ERROR_INVALID_HANDLE);
+        return NULL;
+    }
+    return (host_object *)handle;
+}
+
+/* Event handle in OVERLAPPED can have low order bit set */
+static host_event *host_overlapped_event(LPOVERLAPPED overlapped)
+{
+    return (host_event *)((ULONG_PTR)overlapped->hEvent & ~(ULONG_PTR)1);
+}
+
+static BOOL host_event_set(host_event *event, BOOL signalled)
+{
+    if ((event == NULL) || (event->object.type != HOST_EVENT))
+    {
+        SetLastError(ERROR_INVALID_HANDLE);
+        return FALSE;
+    }
+
+    pthread_mutex_lock(&event->object.mutex);
+    event->signalled = signalled;
+    if (signalled)
+    {
+        pthread_cond_broadcast(&event->object.cond);
+    }
+    pthread_mutex_unlock(&event->object.mutex);
+    return TRUE;
+}
+
+HANDLE CreateEventA(LPVOID attributes, BOOL manual_reset, BOOL initial_state,
+                    LPCSTR name)
+{
+    host_event *event;
+
+    if (name != NULL)
+    {
+        SetLastError(ERROR_NOT_SUPPORTED);
+        return NULL;
+    }
+
+    event = (host_event *)host_object_create(HOST_EVENT, sizeof(host_event));
+    if (event == NULL)
+    {
+        return NULL;
+    }
+    event->manual_reset = manual_reset;
+    event->signalled = initial_state;
+    return event;
+}
+
+BOOL SetEvent(HANDLE event)
+{
+    return host_event_set((host_event *)host_handle(event), TRUE);
+}
+
+BOOL ResetEvent(HANDLE event)
+{
+    return host_event_set((host_event *)host_handle(event), FALSE);
+}
+
+static void *host_thread_start(void *param)
+{
+    host_thread *thread = (host_thread *)param;
+
+    thread->start(thread->param);
+
+    pthread_mutex_lock(&thread->object.mutex);
+    thread->finished = TRUE;
+    pthread_cond_broadcast(&thread->object.cond);
+    pthread_mutex_unlock(&thread->object.mutex);
+    host_object_release(&thread->object);
+    return NULL;
+}
+
+HANDLE CreateThread(LPVOID attributes, SIZE_T stack_size,
+                    LPTHREAD_START_ROUTINE start, LPVOID param,
+                    DWORD flags, LPDWORD thread_id)
+{
+    host_thread *thread;
+
+    thread = (host_thread *)host_object_create(HOST_THREAD, sizeof(host_thread));
+    if (thread == NULL)
+    {
+        return NULL;
+    }
+    thread->start = start;
+    thread->param = param;
+
+    /* Running thread keeps its own reference */
+    thread->object.refs = 2;
+    if (pthread_create(&thread->thread, NULL, host_thread_start, thread) != 0)
+    {
+        free(thread);
+        SetLastError(ERROR_NOT_ENOUGH_MEMORY);
+        return NULL;
+    }
+    pthread_detach(thread->thread);
+
+    if (thread_id != NULL)
+    {
+        *thread_id = 0;
+    }
+    return thread;
+}
+
+DWORD WaitForSingleObject(HANDLE handle, DWORD timeout)
+{
+    host_object *object = host_handle(handle);
+    struct timespec deadline;
+    DWORD result = WAIT_OBJECT_0;
+
+    if (object == NULL)
+    {
+        return WAIT_FAILED;
+    }
+
+    host_deadline(&deadline, timeout);
+    pthread_mutex_lock(&object->mutex);
+    if (object->type == HOST_EVENT)
+    {
+        host_event *event = (host_event *)object;
+
+        while (!event->signalled && (result == WAIT_OBJECT_0))
+        {
+            if (!host_object_wait(object, timeout, &deadline))
+            {
+                result = WAIT_TIMEOUT;
+            }
+        }
+        if ((result == WAIT_OBJECT_0) && !event->manual_reset)
+        {
+            event->signalled = FALSE;
+        }
+    }
+    else if (object->type == HOST_THREAD)
+    {
+        host_thread *thread = (host_thread *)object;
+
+        while (!thread->finished && (result == WAIT_OBJECT_0))
+        {
+            if (!host_object_wait(object, timeout, &deadline))
+            {
+                result = WAIT_TIMEOUT;
+            }
+        }
+    }
+    else
+    {
+        SetLastError(ERROR_INVALID_HANDLE);
+        result = WAIT_FAILED;
+    }
+    pthread_mutex_unlock(&object->mutex);
+    return result;
+}
+
+void Sleep(DWORD milliseconds)
+{
+    struct timespec duration;
+
+    if (milliseconds == 0)
+    {
+        sched_yield();
+        return;
+    }
+
+    duration.tv_sec = milliseconds / 1000;
+    duration.tv_nsec = (long)(milliseconds % 1000) * 1000000L;
+    while ((nanosleep(&duration, &duration) != 0) && (errno == EINTR))
+    {
+    }
+}
+
+DWORD GetCurrentProcessId(void)
+{
+    return (DWORD)getpid();
+}
+
+/* Only waiting for all objects is needed */
+DWORD WaitForMultipleObjects(DWORD count, const HANDLE *handles, BOOL wait_all,
+                             DWORD timeout)
+{
+    DWORD i;
+
+    if (!wait_all || (timeout != INFINITE))
+    {
+        SetLastError(ERROR_NOT_SUPPORTED);
+        return WAIT_FAILED;
+    }
+
+    for (i = 0; i < count; i++)
+    {
+        if (WaitForSingleObject(handles[i], INFINITE) == WAIT_FAILED)
+        {
+            return WAIT_FAILED;
+        }
+    }
+    return WAIT_OBJECT_0;
+}
+
+void GetSystemInfo(SYSTEM_INFO *info)
+{
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+
+    memset(info, 0, sizeof(SYSTEM_INFO));
+    info->dwNumberOfProcessors = (count > 0) ? (DWORD)count : 1;
+}
+
+void InitializeCriticalSection(CRITICAL_SECTION *section)
+{
+    pthread_mutexattr_t attr;
+
+    /* Critical sections can be entered again by owner */
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_init(&section->mutex, &attr);
+    pthread_mutexattr_destroy(&attr);
+}
+
+void EnterCriticalSection(CRITICAL_SECTION *section)
+{
+    pthread_mutex_lock(&section->mutex);
+}
+
+void LeaveCriticalSection(CRITICAL_SECTION *section)
+{
+    pthread_mutex_unlock(&section->mutex);
+}
+
+void DeleteCriticalSection(CRITICAL_SECTION *section)
+{
+    pthread_mutex_destroy(&section->mutex);
+}
+
+BOOL QueryPerformanceCounter(LARGE_INTEGER *counter)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    counter->QuadPart = (LONGLONG)now.tv_sec * 1000000000LL + now.tv_nsec;
+    return TRUE;
+}
+
+BOOL QueryPerformanceFrequency(LARGE_INTEGER *frequency)
+{
+    frequency->QuadPart = 1000000000LL;
+    return TRUE;
+}
+
+DWORD GetTickCount(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (DWORD)((UINT64)now.tv_sec * 1000 + now.tv_nsec / 1000000);
+}
+
+static void *host_wait_thread(void *param)
+{
+    host_wait *wait = (host_wait *)param;
+    host_event *event = wait->event;
+    struct timespec deadline;
+
+    pthread_mutex_lock(&event->object.mutex);
+    while (!wait->cancelled)
+    {
+        BOOL timed_out = FALSE;
+
+        host_deadline(&deadline, wait->timeout);
+        while (!event->signalled && !wait->cancelled && !timed_out)
+        {
+            timed_out = !host_object_wait(&event->object, wait->timeout, &deadline);
+        }
+        if (wait->cancelled)
+        {
+            break;
+        }
+        if (!timed_out && !event->manual_reset)
+        {
+            event->signalled = FALSE;
+        }
+
+        pthread_mutex_unlock(&event->object.mutex);
+        wait->callback(wait->param, (BOOLEAN)timed_out);
+        pthread_mutex_lock(&event->object.mutex);
+
+        if (wait->flags & WT_EXECUTEONLYONCE)
+        {
+            break;
+        }
+    }
+    pthread_mutex_unlock(&event->object.mutex);
+    return NULL;
+}
+
+BOOL RegisterWaitForSingleObject(HANDLE *handle, HANDLE object,
+                                 WAITORTIMERCALLBACK callback, PVOID param,
+                                 DWORD timeout, DWORD flags)
+{
+    host_event *event = (host_event *)host_handle(object);
+    host_wait *wait;
+
+    if ((event == NULL) || (event->object.type != HOST_EVENT))
+    {
+        /* Only events can be waited for */
+        SetLastError(ERROR_INVALID_HANDLE);
+        return FALSE;
+    }
+
+    wait = (host_wait *)host_object_create(HOST_WAIT, sizeof(host_wait));
+    if (wait == NULL)
+    {
+        return FALSE;
+    }
+    wait->event = event;
+    wait->callback = callback;
+    wait->param = param;
+    wait->timeout = timeout;
+    wait->flags = flags;
+
+    if (pthread_create(&wait->thread, NULL, host_wait_thread, wait) != 0)
+    {
+        host_object_release(&wait->object);
+        SetLastError(ERROR_NOT_ENOUGH_MEMORY);
+        return FALSE;
+    }
+
+    *handle = wait;
+    return TRUE;
+}
+
+BOOL UnregisterWaitEx(HANDLE handle, HANDLE completion_event)
+{
+    host_wait *wait = (host_wait *)host_handle(handle);
+
+    if ((wait == NULL) || (wait->object.type != HOST_WAIT))
+    {
+        SetLastError(ERROR_INVALID_HANDLE);
+        return FALSE;
+    }
+
+    pthread_mutex_lock(&wait->event->object.mutex);
+    wait->cancelled = TRUE;
+    pthread_cond_broadcast(&wait->event->object.cond);
+    pthread_mutex_unlock(&wait->event->object.mutex);
+
+    /* Callback that might be running has finished after join */
+    pthread_join(wait->thread, NULL);
+    host_object_release(&wait->object);
+
+    if ((completion_event != NULL) && (completion_event != INVALID_HANDLE_VALUE))
+    {
+        SetEvent(completion_event);
+    }
+    return TRUE;
+}
+
+static host_file *host_file_create(host_type type, int fd)
+{
+    host_file *file;
+
+    file = (host_file *)host_object_create(type, sizeof(host_file));
+    if (file != NULL)
+    {
+        file->fd = fd;
+    }
+    return file;
+}
+
+/* Sets result of operation that finished before returning */
+static void host_finish(LPOVERLAPPED overlapped, DWORD error, DWORD bytes)
+{
+    host_event *event = host_overlapped_event(overlapped);
+
+    overlapped->Internal = error;
+    overlapped->InternalHigh = bytes;
+    if (event != NULL)
+    {
+        host_event_set(event, TRUE);
+    }
+}
+
+/* Waits until descriptor made non-blocking by I/O engine is ready */
+static void host_fd_wait(int fd, short events)
+{
+    struct pollfd pfd;
+
+    pfd.fd = fd;
+    pfd.events = events;
+    pfd.revents = 0;
+    while ((poll(&pfd, 1, -1) < 0) && (errno == EINTR))
+    {
+    }
+}
+
+HANDLE CreateNamedPipeA(LPCSTR name, DWORD open_mode, DWORD pipe_mode,
+                        DWORD max_instances, DWORD out_buffer_size,
+                        DWORD in_buffer_size, DWORD default_timeout,
+                        LPVOID attributes)
+{
+    host_file *server;
+    host_pipe *pipe;
+    host_pipe *existing;
+    int fds[2];
+
+    if (((open_mode & (PIPE_ACCESS_INBOUND | PIPE_ACCESS_OUTBOUND)) != PIPE_ACCESS_OUTBOUND) ||
+        (pipe_mode != (PIPE_TYPE_BYTE | PIPE_WAIT)) || (max_instances != 1) ||
+        (strlen(name) >= MAX_PATH))
+    {
+        /* Only outbound single instance byte pipes are implemented */
+        SetLastError(ERROR_NOT_SUPPORTED);
+        return INVALID_HANDLE_VALUE;
+    }
+
+    if (pipe2(fds, O_CLOEXEC) != 0)
+    {
+        SetLastError(host_error_from_errno(errno));
+        return INVALID_HANDLE_VALUE;
+    }
+    if ((int)out_buffer_size > fcntl(fds[1], F_GETPIPE_SZ))
+    {
+        /* Like Win32 quota, size only grows the buffer. Failure is harmless. */
+        fcntl(fds[1], F_SETPIPE_SZ, (int)out_buffer_size);
+    }
+
+    pipe = (host_pipe *)calloc(1, sizeof(host_pipe));
+    server = host_file_create(HOST_PIPE_SERVER, fds[1]);
+    if ((pipe == NULL) || (server == NULL))
+    {
+        if (server != NULL)
+        {
+            host_object_release(&server->object);
+        }
+        free(pipe);
+        close(fds[0]);
+        close(fds[1]);
+        SetLastError(ERROR_NOT_ENOUGH_MEMORY);
+        return INVALID_HANDLE_VALUE;
+    }
+    strcpy(pipe->name, name);
+    pipe->read_fd = fds[0];
+    server->pipe = pipe;
+
+    pthread_mutex_lock(&host_pipes_mutex);
+    for (existing = host_pipes; existing != NULL; existing = existing->next)
+    {
+        if (strcmp(existing->name, name) == 0)
+        {
+            pthread_mutex_unlock(&host_pipes_mutex);
+            host_object_release(&server->object);
+            free(pipe);
+            close(fds[0]);
+            close(fds[1]);
+            SetLastError(ERROR_ACCESS_DENIED);
+            return INVALID_HANDLE_VALUE;
+        }
+    }
+    pipe->next = host_pipes;
+    host_pipes = pipe;
+    pthread_mutex_unlock(&host_pipes_mutex);
+    return server;
+}
+
+BOOL ConnectNamedPipe(HANDLE handle, LPOVERLAPPED overlapped)
+{
+    host_file *server = (host_file *)host_handle(handle);
+    BOOL connected;
+
+    if ((server == NULL) || (server->object.type != HOST_PIPE_SERVER))
+    {
+        SetLastError(ERROR_INVALID_HANDLE);
+        return FALSE;
+    }
+
+    pthread_mutex_lock(&host_pipes_mutex);
+    connected = (server->pipe->read_fd == -1);
+    pthread_mutex_unlock(&host_pipes_mutex);
+
+    /* Waiting for clients is not implemented, they connect right away */
+    SetLastError(connected ? ERROR_PIPE_CONNECTED : ERROR_NOT_SUPPORTED);
+    return FALSE;
+}
+
+BOOL DisconnectNamedPipe(HANDLE handle)
+{
+    SetLastError(ERROR_NOT_SUPPORTED);
+    return FALSE;
+}
+
+static HANDLE host_pipe_open(LPCSTR name, DWORD access)
+{
+    host_pipe *pipe;
+    host_file *client;
+    int fd = -1;
+
+    if (access != GENERIC_READ)
+    {
+        /* Pipes are outbound only */
+        SetLastError(ERROR_ACCESS_DENIED);
+        return INVALID_HANDLE_VALUE;
+    }
+
+    pthread_mutex_lock(&host_pipes_mutex);
+    for (pipe = host_pipes; pipe != NULL; pipe = pipe->next)
+    {
+        if (strcmp(pipe->name, name) == 0)
+        {
+            fd = pipe->read_fd;
+            pipe->read_fd = -1;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&host_pipes_mutex);
+
+    if (fd == -1)
+    {
+        SetLastError((pipe == NULL) ? ERROR_FILE_NOT_FOUND : ERROR_PIPE_BUSY);
+        return INVALID_HANDLE_VALUE;
+    }
+
+    client = host_file_create(HOST_PIPE_CLIENT, fd);
+    if (client == NULL)
+    {
+        close(fd);
+        return INVALID_HANDLE_VALUE;
+    }
+    return client;
+}
+
+HANDLE CreateFileA(LPCSTR name, DWORD access, DWORD share, LPVOID attributes,
+                   DWORD disposition, DWORD flags, HANDLE template_file)
+{
+    host_file *file;
+    int open_flags;
+    int fd;
+
+    if (strncmp(name, "\\\\.\\pipe\\", 9) == 0)
+    {
+        return host_pipe_open(name, access);
+    }
+
+    switch (access & (GENERIC_READ | GENERIC_WRITE))
+    {
+        case GENERIC_READ | GENERIC_WRITE:
+            open_flags = O_RDWR;
+            break;
+        case GENERIC_WRITE:
+            open_flags = O_WRONLY;
+            break;
+        default:
+            open_flags = O_RDONLY;
+            break;
+    }
+
+    switch (disposition)
+    {
+        case CREATE_NEW:
+            open_flags |= O_CREAT | O_EXCL;
+            break;
+        case CREATE_ALWAYS:
+            open_flags |= O_CREAT | O_TRUNC;
+            break;
+        case OPEN_ALWAYS:
+            open_flags |= O_CREAT;
+            break;
+        default:
+            break;
+    }
+
+    fd = open((strcmp(name, "NUL") == 0) ? "/dev/null" : name, open_flags | O_CLOEXEC, 0644);
+    if (fd == -1)
+    {
+        SetLastError(host_error_from_errno(errno));
+        return INVALID_HANDLE_VALUE;
+    }
+
+    file = host_file_create(HOST_FILE, fd);
+    if (file == NULL)
+    {
+        close(fd);
+        return INVALID_HANDLE_VALUE;
+    }
+    return file;
+}
+
+HANDLE GetStdHandle(DWORD std_handle)
+{
+    static host_file *handles[3];
+    static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+    int fd;
+
+    switch (std_handle)
+    {
+        case STD_INPUT_HANDLE:
+            fd = 0;
+            break;
+        case STD_OUTPUT_HANDLE:
+            fd = 1;
+            break;
+        case STD_ERROR_HANDLE:
+            fd = 2;
+            break;
+        default:
+            SetLastError(ERROR_INVALID_PARAMETER);
+            return INVALID_HANDLE_VALUE;
+    }
+
+    pthread_mutex_lock(&mutex);
+    if (handles[fd] == NULL)
+    {
+        handles[fd] = host_file_create(HOST_FILE, fd);
+        if (handles[fd] != NULL)
+        {
+            handles[fd]->std_handle = TRUE;
+        }
+    }
+    pthread_mutex_unlock(&mutex);
+
+    return (handles[fd] != NULL) ? handles[fd] : INVALID_HANDLE_VALUE;
+}
+
+int host_file_descriptor(HANDLE handle)
+{
+    host_file *file = (host_file *)host_handle(handle);
+
+    if ((file == NULL) ||
+        ((file->object.type != HOST_FILE) &&
+         (file->object.type != HOST_PIPE_SERVER) &&
+         (file->object.type != HOST_PIPE_CLIENT)))
+    {
+        SetLastError(ERROR_INVALID_HANDLE);
+        return -1;
+    }
+    return file->fd;
+}
+
+DWORD GetFileType(HANDLE handle)
+{
+    host_file *file = (host_file *)host_handle(handle);
+    struct stat st;
+
+    if (file == NULL)
+    {
+        return FILE_TYPE_UNKNOWN;
+    }
+
+    switch (file->object.type)
+    {
+        case HOST_PIPE_SERVER:
+        case HOST_PIPE_CLIENT:
+            return FILE_TYPE_PIPE;
+        case HOST_FILE:
+            break;
+        default:
+            SetLastError(ERROR_INVALID_HANDLE);
+            return FILE_TYPE_UNKNOWN;
+    }
+
+    if (fstat(file->fd, &st) != 0)
+    {
+        SetLastError(host_error_from_errno(errno));
+        return FILE_TYPE_UNKNOWN;
+    }
+    if (S_ISREG(st.st_mode))
+    {
+        return FILE_TYPE_DISK;
+    }
+    /* POSIX pipes are reported as character devices. Reader quitting is
+     * noticed by failed write, they do not need dummy reads.
+     */
+    return FILE_TYPE_CHAR;
+}
+
+BOOL ReadFile(HANDLE handle, LPVOID buffer, DWORD length, LPDWORD bytes_read,
+              LPOVERLAPPED overlapped)
+{
+    host_file *file = (host_file *)host_handle(handle);
+    ssize_t copied;
+
+    if ((file == NULL) ||
+        ((file->object.type != HOST_FILE) && (file->object.type != HOST_PIPE_CLIENT)))
+    {
+        SetLastError((file == NULL) ? ERROR_INVALID_HANDLE : ERROR_ACCESS_DENIED);
+        return FALSE;
+    }
+
+    /* Overlapped reads finish synchronously too, engine does its own I/O */
+    for (;;)
+    {
+        copied = read(file->fd, buffer, length);
+        if (copied >= 0)
+        {
+            break;
+        }
+        if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
+        {
+            host_fd_wait(file->fd, POLLIN);
+        }
+        else if (errno != EINTR)
+        {
+            SetLastError(host_error_from_errno(errno));
+            return FALSE;
+        }
+    }
+
+    if ((copied == 0) && (length > 0) && (file->object.type == HOST_PIPE_CLIENT))
+    {
+        /* Server end was closed */
+        if (overlapped != NULL)
+        {
+            host_finish(overlapped, ERROR_BROKEN_PIPE, 0);
+        }
+        SetLastError(ERROR_BROKEN_PIPE);
+        return FALSE;
+    }
+
+    if (bytes_read != NULL)
+    {
+        *bytes_read = (DWORD)copied;
+    }
+    if (overlapped != NULL)
+    {
+        host_finish(overlapped, ERROR_SUCCESS, (DWORD)copied);
+    }
+    return TRUE;
+}
+
+static BOOL host_fd_write(int fd, const unsigned char *data, DWORD length)
+{
+    DWORD done = 0;
+
+    while (done < length)
+    {
+        ssize_t written = write(fd, &data[done], length - done);
+
+        if (written < 0)
+        {
+            if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
+            {
+                host_fd_wait(fd, POLLOUT);
+                continue;
+            }
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            SetLastError(host_error_from_errno(errno));
+            return FALSE;
+        }
+        done += (DWORD)written;
+    }
+    return TRUE;
+}
+
+BOOL WriteFile(HANDLE handle, LPCVOID buffer, DWORD length, LPDWORD written,
+               LPOVERLAPPED overlapped)
+{
+    host_file *file = (host_file *)host_handle(handle);
+
+    if (file == NULL)
+    {
+        return FALSE;
+    }
+
+    if ((file->object.type != HOST_FILE) && (file->object.type != HOST_PIPE_SERVER))
+    {
+        SetLastError(ERROR_ACCESS_DENIED);
+        return FALSE;
+    }
+
+    /* Overlapped writes always append, offset is ignored */
+    if (!host_fd_write(file->fd, (const unsigned char *)buffer, length))
+    {
+        return FALSE;
+    }
+    if (written != NULL)
+    {
+        *written = length;
+    }
+    if (overlapped != NULL)
+    {
+        /* Writes finish synchronously */
+        host_finish(overlapped, ERROR_SUCCESS, length);
+    }
+    return TRUE;
+}
+
+BOOL GetOverlappedResult(HANDLE handle, LPOVERLAPPED overlapped,
+                         LPDWORD bytes, BOOL wait)
+{
+    host_event *event = host_overlapped_event(overlapped);
+
+    if (overlapped->Internal == STATUS_PENDING)
+    {
+        if (!wait || (event == NULL))
+        {
+            SetLastError(ERROR_IO_INCOMPLETE);
+            return FALSE;
+        }
+        WaitForSingleObject(event, INFINITE);
+    }
+
+    *bytes = (DWORD)overlapped->InternalHigh;
+    if (overlapped->Internal != ERROR_SUCCESS)
+    {
+        SetLastError((DWORD)overlapped->Internal);
+        return FALSE;
+    }
+    return TRUE;
+}
+
+BOOL CancelIo(HANDLE handle)
+{
+    /* Only I/O engine has operations in flight, io_cancel() cancels them */
+    return (host_handle(handle) != NULL);
+}
+
+BOOL FlushFileBuffers(HANDLE handle)
+{
+    host_file *file = (host_file *)host_handle(handle);
+
+    if (file == NULL)
+    {
+        return FALSE;
+    }
+
+    /* Like on Windows, written file data goes to disk before return */
+    if ((file->object.type == HOST_FILE) && (GetFileType(handle) == FILE_TYPE_DISK) &&
+        (fdatasync(file->fd) != 0))
+    {
+        SetLastError(host_error_from_errno(errno));
+        return FALSE;
+    }
+    return TRUE;
+}
+
+BOOL DeleteFileA(LPCSTR name)
+{
+    if (unlink(name) != 0)
+    {
+        SetLastError(host_error_from_errno(errno));
+        return FALSE;
+    }
+    return TRUE;
+}
+
+/* rename() always replaces existing file */
+BOOL MoveFileExA(LPCSTR existing, LPCSTR name, DWORD flags)
+{
+    UNREFERENCED_PARAMETER(flags);
+
+    if (rename(existing, name) != 0)
+    {
+        SetLastError(host_error_from_errno(errno));
+        return FALSE;
+    }
+    return TRUE;
+}
+
+static void host_pipe_close_server(host_file *server)
+{
+    host_pipe *pipe = server->pipe;
+    host_pipe **link;
+
+    pthread_mutex_lock(&host_pipes_mutex);
+    for (link = &host_pipes; *link != NULL; link = &(*link)->next)
+    {
+        if (*link == pipe)
+        {
+            *link = pipe->next;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&host_pipes_mutex);
+
+    if (pipe->read_fd != -1)
+    {
+        /* Client never opened it */
+        close(pipe->read_fd);
+    }
+    free(pipe);
+    /* Client reads end of file once buffered data is gone */
+    close(server->fd);
+}
+
+BOOL CloseHandle(HANDLE handle)
+{
+    host_object *object = host_handle(handle);
+
+    if (object == NULL)
+    {
+        return FALSE;
+    }
+
+    switch (object->type)
+    {
+        case HOST_FILE:
+            if (((host_file *)object)->std_handle)
+            {
+                return TRUE;
+            }
+            close(((host_file *)object)->fd);
+            break;
+        case HOST_PIPE_SERVER:
+            host_pipe_close_server((host_file *)object);
+            break;
+        case HOST_PIPE_CLIENT:
+            /* Writer gets EPIPE, reported as ERROR_NO_DATA */
+            close(((host_file *)object)->fd);
+            break;
+        case HOST_EVENT:
+        case HOST_THREAD:
+            break;
+        default:
+            SetLastError(ERROR_INVALID_HANDLE);
+            return FALSE;
+    }
+
+    host_object_release(object);
+    return TRUE;
+}
+
+/* Replaces %I64 and %I32 length modifiers with C99 ones */
+static char *host_format(const char *format)
+{
+    char *result;
+    char *out;
+
+    result = (char *)malloc(strlen(format) + 1);
+    if (result == NULL)
+    {
+        return NULL;
+    }
+
+    out = result;
+    while (*format != '\0')
+    {
+        if (*format != '%')
+        {
+            *out++ = *format++;
+            continue;
+        }
+
+        *out++ = *format++;
+        while ((*format != '\0') && (strchr("-+ #0123456789.*", *format) != NULL))
+        {
+            *out++ = *format++;
+        }
+        if (strncmp(format, "I64", 3) == 0)
+        {
+            *out++ = 'l';
+            *out++ = 'l';
+            format += 3;
+        }
+        else if (strncmp(format, "I32", 3) == 0)
+        {
+            format += 3;
+        }
+        else if (*format == '%')
+        {
+            *out++ = *format++;
+        }
+    }
+    *out = '\0';
+    return result;
+}
+
+static int host_vfprintf(FILE *stream, const char *format, va_list args)
+{
+    char *converted = host_format(format);
+    int result;
+
+    if (converted == NULL)
+    {
+        return -1;
+    }
+    result = vfprintf(stream, converted, args);
+    free(converted);
+    return result;
+}
+
+int host_printf(const char *format, ...)
+{
+    va_list args;
+    int result;
+
+    va_start(args, format);
+    result = host_vfprintf(stdout, format, args);
+    va_end(args);
+    return result;
+}
+
+int host_fprintf(FILE *stream, const char *format, ...)
+{
+    va_list args;
+    int result;
+
+    va_start(args, format);
+    result = host_vfprintf(stream, format, args);
+    va_end(args);
+    return result;
+}
+
+int host_sprintf_s(char *buffer, size_t size, const char *format, ...)
+{
+    char *converted = host_format(format);
+    va_list args;
+    int result;
+
+    if (converted == NULL)
+    {
+        buffer[0] = '\0';
+        return -1;
+    }
+
+    va_start(args, format);
+    result = vsnprintf(buffer, size, converted, args);
+    va_end(args);
+    free(converted);
+
+    if ((result < 0) || ((size_t)result >= size))
+    {
+        /* Truncated output is an error */
+        buffer[0] = '\0';
+        return -1;
+    }
+    return result;
+}
+
+int strcpy_s(char *destination, size_t size, const char *source)
+{
+    size_t length = strlen(source);
+
+    if (length >= size)
+    {
+        destination[0] = '\0';
+        return ERANGE;
+    }
+    memcpy(destination, source, length + 1);
+    return 0;
+}
+
+int fopen_s(FILE **file, const char *name, const char *mode)
+{
+    *file = fopen(name, mode);
+    return (*file == NULL) ? errno : 0;
+}
@@ -0,0 +1,308 @@
+/*
+ * Copyright (c) 2026 Tomasz Moń <desowin@gmail.com>
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "inflate.h"
+#include "lzblock.h"
+
+/* Records are collected and handed to sink in chunks of this size */
+#define INFLATE_OUTPUT_SIZE  (256 * 1024)
+
+struct _inflate_stage
+{
+    inflate_sink sink;
+    void *ctx;
+
+    pcap_hdr_t header;
+    UINT32 header_received;
+
+    /* Record split across inflate_feed() calls */
+    unsigned char *record;
+    UINT32 record_size;
+    UINT32 received;
+
+    /* Decompressed record */
+    unsigned char *inflated;
+    UINT32 inflated_size;
+
+    unsigned char *output;
+    DWORD output_used;
+
+    UINT64 failed;
+};
+
+static BOOL inflate_reserve(unsigned char **buffer, UINT32 *size, UINT32 length)
+{
+    if (length > *size)
+    {
+        unsigned char *tmp = realloc(*buffer, length);
+        if (tmp == NULL)
+        {
+            fprintf(stderr, "Failed to allocate %u bytes inflate buffer\n", length);
+            return FALSE;
+        }
+        *buffer = tmp;
+        *size = length;
+    }
+    return TRUE;
+}
+
+static void inflate_output_flush(inflate_stage *stage)
+{
+    if (stage->output_used > 0)
+    {
+        stage->sink(stage->ctx, stage->output, stage->output_used);
+        stage->output_used = 0;
+    }
+}
+
+static void inflate_write(inflate_stage *stage, const unsigned char *data, DWORD length)
+{
+    if (stage->output_used + length > INFLATE_OUTPUT_SIZE)
+    {
+        inflate_output_flush(stage);
+    }
+
+    if (length > INFLATE_OUTPUT_SIZE)
+    {
+        stage->sink(stage->ctx, data, length);
+    }
+    else
+    {
+        memcpy(&stage->output[stage->output_used], data, length);
+        stage->output_used += length;
+    }
+}
+
+static BOOL inflate_is_compressed(const unsigned char *record, UINT32 length)
+{
+    USBPCAP_BUFFER_PACKET_HEADER packet;
+
+    if (length < sizeof(pcaprec_hdr_t) + sizeof(USBPCAP_BUFFER_PACKET_HEADER))
+    {
+        return FALSE;
+    }
+
+    memcpy(&packet, &record[sizeof(pcaprec_hdr_t)], sizeof(packet));
+    return (packet.info & USBPCAP_INFO_COMPRESSED) ? TRUE : FALSE;
+}
+
+/* Writes decompressed copy of complete compressed record */
+static BOOL inflate_record(inflate_stage *stage, const unsigned char *record, UINT32 length)
+{
+    pcaprec_hdr_t hdr;
+    USBPCAP_BUFFER_PACKET_HEADER packet;
+    const unsigned char *payload;
+    unsigned char *out;
+    UINT32 expected;
+    INT32 inflated;
+
+    memcpy(&hdr, record, sizeof(hdr));
+    memcpy(&packet, &record[sizeof(hdr)], sizeof(packet));
+
+    /* Driver compresses everything that fits into snaplen after headers */
+    expected = min(hdr.orig_len, stage->header.snaplen);
+    if ((packet.headerLen < sizeof(USBPCAP_BUFFER_PACKET_HEADER)) ||
+        (packet.headerLen > hdr.incl_len) || (packet.headerLen > expected))
+    {
+        stage->failed++;
+        return TRUE;
+    }
+    expected -= packet.headerLen;
+
+    if (!inflate_reserve(&stage->inflated, &stage->inflated_size,
+                         sizeof(hdr) + packet.headerLen + expected))
+    {
+        return FALSE;
+    }
+
+    out = stage->inflated;
+    payload = &record[sizeof(hdr) + packet.headerLen];
+    inflated = lz_decompress(payload, hdr.incl_len - packet.headerLen,
+                             &out[sizeof(hdr) + packet.headerLen], expected);
+    if ((inflated < 0) || ((UINT32)inflated != expected))
+    {
+        stage->failed++;
+        return TRUE;
+    }
+
+    hdr.incl_len = packet.headerLen + expected;
+    packet.info &= ~USBPCAP_INFO_COMPRESSED;
+    memcpy(out, &hdr, sizeof(hdr));
+    memcpy(&out[sizeof(hdr)], &packet, sizeof(packet));
+    /* Transfer specific header (and sequence number) is not compressed */
+    memcpy(&out[sizeof(hdr) + sizeof(packet)], &record[sizeof(hdr) + sizeof(packet)],
+           packet.headerLen - sizeof(packet));
+
+    inflate_write(stage, out, sizeof(hdr) + hdr.incl_len);
+    return TRUE;
+}
+
+inflate_stage *inflate_create(inflate_sink sink, void *ctx)
+{
+    inflate_stage *stage;
+
+    stage = (inflate_stage *)calloc(1, sizeof(inflate_stage));
+    if (stage == NULL)
+    {
+        return NULL;
+    }
+
+    stage->sink = sink;
+    stage->ctx = ctx;
+    stage->output = (unsigned char *)malloc(INFLATE_OUTPUT_SIZE);
+    if (stage->output == NULL)
+    {
+        fprintf(stderr, "Failed to allocate inflate output buffer\n");
+        inflate_destroy(stage);
+        return NULL;
+    }
+
+    return stage;
+}
+
+void inflate_destroy(inflate_stage *stage)
+{
+    free(stage->record);
+    free(stage->inflated);
+    free(stage->output);
+    free(stage);
+}
+
+BOOL inflate_feed(inflate_stage *stage, const unsigned char *data, DWORD length)
+{
+    BOOL result = TRUE;
+
+    while ((length > 0) && result)
+    {
+        UINT32 needed;
+        UINT32 to_copy;
+        DWORD run;
+
+        if (stage->header_received < sizeof(pcap_hdr_t))
+        {
+            to_copy = min(sizeof(pcap_hdr_t) - stage->header_received, length);
+            memcpy((unsigned char *)&stage->header + stage->header_received, data, to_copy);
+            stage->header_received += to_copy;
+            inflate_write(stage, data, to_copy);
+            data += to_copy;
+            length -= to_copy;
+            continue;
+        }
+
+        if (stage->received > 0)
+        {
+            /* Complete the record that was split */
+            if (stage->received < sizeof(pcaprec_hdr_t))
+            {
+                needed = sizeof(pcaprec_hdr_t);
+            }
+            else
+            {
+                needed = sizeof(pcaprec_hdr_t) + ((pcaprec_hdr_t *)stage->record)->incl_len;
+            }
+
+            if (!inflate_reserve(&stage->record, &stage->record_size, needed))
+            {
+                result = FALSE;
+                break;
+            }
+
+            to_copy = min(needed - stage->received, length);
+            memcpy(&stage->record[stage->received], data, to_copy);
+            stage->received += to_copy;
+            data += to_copy;
+            length -= to_copy;
+
+            if ((stage->received == sizeof(pcaprec_hdr_t)) &&
+                (((pcaprec_hdr_t *)stage->record)->incl_len > 0))
+            {
+                /* Header complete, record data follows */
+                continue;
+            }
+
+            if (stage->received == needed)
+            {
+                if (inflate_is_compressed(stage->record, needed))
+                {
+                    result = inflate_record(stage, stage->record, needed);
+                }
+                else
+                {
+                    inflate_write(stage, stage->record, needed);
+                }
+                stage->received = 0;
+            }
+            continue;
+        }
+
+        /* Complete records are handled in place, consecutive records that
+         * are not compressed are written together.
+         */
+        run = 0;
+        while (length - run >= sizeof(pcaprec_hdr_t))
+        {
+            pcaprec_hdr_t hdr;
+
+            memcpy(&hdr, &data[run], sizeof(hdr));
+            if (length - run - sizeof(hdr) < hdr.incl_len)
+            {
+                break;
+            }
+            needed = sizeof(hdr) + hdr.incl_len;
+
+            if (inflate_is_compressed(&data[run], needed))
+            {
+                inflate_write(stage, data, run);
+                result = inflate_record(stage, &data[run], needed);
+                data += run + needed;
+                length -= run + needed;
+                run = 0;
+                if (!result)
+                {
+                    break;
+                }
+            }
+            else
+            {
+                run += needed;
+            }
+        }
+
+        if (!result)
+        {
+            break;
+        }
+
+        inflate_write(stage, data, run);
+        data += run;
+        length -= run;
+
+        if (length > 0)
+        {
+            /* Beginning of record, rest comes with next call */
+            if (!inflate_reserve(&stage->record, &stage->record_size,
+                                 max(length, sizeof(pcaprec_hdr_t))))
+            {
+                result = FALSE;
+                break;
+            }
+            memcpy(stage->record, data, length);
+            stage->received = length;
+            length = 0;
+        }
+    }
+
+    inflate_output_flush(stage);
+    return result;
+}
+
+UINT64 inflate_failed(inflate_stage *stage)
+{
+    return stage->failed;
+}
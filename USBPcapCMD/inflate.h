@@ -0,0 +1,39 @@
+/*
+ * Copyright (c) 2026 Tomasz Moń <desowin@gmail.com>
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#ifndef USBPCAP_CMD_INFLATE_H
+#define USBPCAP_CMD_INFLATE_H
+
+#include <windows.h>
+#include "USBPcap.h"
+
+/* Driver started with USBPCAP_OPTION_COMPRESS_PAYLOAD stores larger
+ * payloads compressed (USBPCAP_INFO_COMPRESSED). Inflate stage restores
+ * them, so everything after it sees the same stream as without the
+ * option. Other records are passed as they are.
+ *
+ * Records that fail to decompress are dropped and counted.
+ */
+typedef struct _inflate_stage inflate_stage;
+
+/* Receives pcap stream. Called with as much data as possible at once. */
+typedef void (*inflate_sink)(void *ctx, const unsigned char *data, DWORD length);
+
+inflate_stage *inflate_create(inflate_sink sink, void *ctx);
+void inflate_destroy(inflate_stage *stage);
+
+/* Accepts pcap stream as read from the driver, starting with pcap file
+ * header. Records can be split across calls. All complete records are
+ * passed to sink before it returns.
+ *
+ * Returns FALSE if record could not be buffered.
+ */
+BOOL inflate_feed(inflate_stage *stage, const unsigned char *data, DWORD length);
+
+/* Returns number of records dropped because they were corrupted. */
+UINT64 inflate_failed(inflate_stage *stage);
+
+#endif /* USBPCAP_CMD_INFLATE_H */
@@ -0,0 +1,335 @@
+/*
+ * Copyright (c) 2026 Tomasz Moń <desowin@gmail.com>
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "ioengine.h"
+
+/* Completion keys */
+#define IO_KEY_HANDLE  0  /* Operation on attached handle */
+#define IO_KEY_POSTED  1  /* Operation that finished without completion packet */
+#define IO_KEY_WATCH   2  /* Watched event got signalled */
+#define IO_KEY_WAKE    3  /* io_engine_wake(), there is no request */
+
+#define IO_ENGINE_MAX_THREADS  8
+
+/* CancelIoEx() is missing on Windows XP */
+typedef BOOL (WINAPI *io_cancel_ex_fn)(HANDLE handle, LPOVERLAPPED overlapped);
+
+struct _io_engine
+{
+    HANDLE port;
+    volatile LONG pending;   /* Reads, writes and connects in flight */
+    volatile LONG draining;
+    io_cancel_ex_fn cancel_ex;
+    HANDLE threads[IO_ENGINE_MAX_THREADS];
+    DWORD thread_count;
+    volatile LONG stopping;
+};
+
+io_engine *io_engine_create(void)
+{
+    io_engine *engine;
+
+    engine = (io_engine *)calloc(1, sizeof(io_engine));
+    if (engine == NULL)
+    {
+        return NULL;
+    }
+
+    engine->port = CreateIoCompletionPort(INVALID_HANDLE_VALUE, NULL, 0, 0);
+    if (engine->port == NULL)
+    {
+        fprintf(stderr, "Failed to create completion port - %d\n", GetLastError());
+        free(engine);
+        return NULL;
+    }
+
+    engine->cancel_ex = (io_cancel_ex_fn)GetProcAddress(GetModuleHandleA("kernel32.dll"),
+                                                        "CancelIoEx");
+    return engine;
+}
+
+void io_engine_destroy(io_engine *engine)
+{
+    io_engine_stop(engine);
+    /* Packets still queued are discarded together with the port */
+    CloseHandle(engine->port);
+    free(engine);
+}
+
+BOOL io_engine_attach(io_engine *engine, HANDLE handle)
+{
+    if (CreateIoCompletionPort(handle, engine->port, IO_KEY_HANDLE, 0) == NULL)
+    {
+        fprintf(stderr, "Failed to attach handle to completion port - %d\n", GetLastError());
+        return FALSE;
+    }
+    return TRUE;
+}
+
+BOOL io_engine_poll(io_engine *engine, DWORD timeout)
+{
+    LPOVERLAPPED overlapped = NULL;
+    ULONG_PTR key = 0;
+    DWORD bytes = 0;
+    DWORD error = ERROR_SUCCESS;
+    io_request *request;
+
+    if (!GetQueuedCompletionStatus(engine->port, &bytes, &key, &overlapped, timeout))
+    {
+        if (overlapped == NULL)
+        {
+            /* Timeout or port failure, last error is already set */
+            return FALSE;
+        }
+        /* Dequeued operation that failed */
+        error = GetLastError();
+    }
+
+    if (key == IO_KEY_WAKE)
+    {
+        return TRUE;
+    }
+
+    request = CONTAINING_RECORD(overlapped, io_request, overlapped);
+    if (key == IO_KEY_WATCH)
+    {
+        if (engine->draining)
+        {
+            return TRUE;
+        }
+    }
+    else
+    {
+        if (key == IO_KEY_POSTED)
+        {
+            error = request->error;
+        }
+        InterlockedDecrement(&engine->pending);
+    }
+
+    request->callback(request, error, bytes);
+    return TRUE;
+}
+
+void io_engine_wake(io_engine *engine)
+{
+    if (!PostQueuedCompletionStatus(engine->port, 0, IO_KEY_WAKE, NULL))
+    {
+        fprintf(stderr, "PostQueuedCompletionStatus() failed - %d\n", GetLastError());
+    }
+}
+
+static DWORD WINAPI io_engine_thread(LPVOID param)
+{
+    io_engine *engine = (io_engine *)param;
+
+    while (!engine->stopping)
+    {
+        if (!io_engine_poll(engine, INFINITE))
+        {
+            fprintf(stderr, "Engine thread failed to poll - %d\n", GetLastError());
+            break;
+        }
+    }
+    return 0;
+}
+
+DWORD io_engine_start(io_engine *engine, DWORD threads)
+{
+    if (engine->cancel_ex == NULL)
+    {
+        /* CancelIo() cancels only operations started by calling thread,
+         * callbacks have to run on the thread that cancels them.
+         */
+        return 0;
+    }
+
+    InterlockedExchange(&engine->stopping, FALSE);
+    threads = min(threads, IO_ENGINE_MAX_THREADS);
+    while (engine->thread_count < threads)
+    {
+        HANDLE thread = CreateThread(NULL, 0, io_engine_thread, engine, 0, NULL);
+
+        if (thread == NULL)
+        {
+            fprintf(stderr, "Failed to create engine thread - %d\n", GetLastError());
+            break;
+        }
+        engine->threads[engine->thread_count++] = thread;
+    }
+    return engine->thread_count;
+}
+
+void io_engine_stop(io_engine *engine)
+{
+    DWORD i;
+
+    InterlockedExchange(&engine->stopping, TRUE);
+    for (i = 0; i < engine->thread_count; i++)
+    {
+        /* Wake ups left unused by threads are ignored by pollers */
+        io_engine_wake(engine);
+    }
+    for (i = 0; i < engine->thread_count; i++)
+    {
+        WaitForSingleObject(engine->threads[i], INFINITE);
+        CloseHandle(engine->threads[i]);
+    }
+    engine->thread_count = 0;
+}
+
+void io_engine_drain(io_engine *engine)
+{
+    InterlockedExchange(&engine->draining, TRUE);
+    while (engine->pending > 0)
+    {
+        if (!io_engine_poll(engine, INFINITE))
+        {
+            fprintf(stderr, "Failed to drain completion port - %d\n", GetLastError());
+            break;
+        }
+    }
+}
+
+void io_request_init(io_request *request, io_engine *engine,
+                     io_callback callback, void *ctx)
+{
+    memset(request, 0, sizeof(io_request));
+    request->engine = engine;
+    request->callback = callback;
+    request->ctx = ctx;
+}
+
+/* Queues result of operation that did not produce completion packet */
+static BOOL io_post(io_request *request, DWORD error)
+{
+    request->error = error;
+    if (!PostQueuedCompletionStatus(request->engine->port, 0, IO_KEY_POSTED,
+                                    &request->overlapped))
+    {
+        fprintf(stderr, "PostQueuedCompletionStatus() failed - %d\n", GetLastError());
+        InterlockedDecrement(&request->engine->pending);
+        return FALSE;
+    }
+    return TRUE;
+}
+
+BOOL io_read(io_request *request, HANDLE handle, void *buffer, DWORD length)
+{
+    DWORD err;
+
+    memset(&request->overlapped, 0, sizeof(OVERLAPPED));
+    InterlockedIncrement(&request->engine->pending);
+    if (ReadFile(handle, buffer, length, NULL, &request->overlapped))
+    {
+        /* Completion packet is queued even if data was available */
+        return TRUE;
+    }
+
+    err = GetLastError();
+    if (err == ERROR_IO_PENDING)
+    {
+        return TRUE;
+    }
+    return io_post(request, err);
+}
+
+BOOL io_write(io_request *request, HANDLE handle, const void *buffer, DWORD length)
+{
+    DWORD err;
+
+    memset(&request->overlapped, 0, sizeof(OVERLAPPED));
+    /* Write data to the end of the file. */
+    request->overlapped.Offset = 0xFFFFFFFF;
+    request->overlapped.OffsetHigh = 0xFFFFFFFF;
+    InterlockedIncrement(&request->engine->pending);
+    if (WriteFile(handle, buffer, length, NULL, &request->overlapped))
+    {
+        return TRUE;
+    }
+
+    err = GetLastError();
+    if (err == ERROR_IO_PENDING)
+    {
+        return TRUE;
+    }
+    return io_post(request, err);
+}
+
+void io_cancel(io_request *request, HANDLE handle)
+{
+    if (request->engine->cancel_ex != NULL)
+    {
+        /* Fails with ERROR_NOT_FOUND if operation has finished */
+        request->engine->cancel_ex(handle, &request->overlapped);
+    }
+    else
+    {
+        /* There are no engine threads, operation was started by caller */
+        CancelIo(handle);
+    }
+}
+
+BOOL io_connect(io_request *request, HANDLE pipe)
+{
+    DWORD err;
+
+    memset(&request->overlapped, 0, sizeof(OVERLAPPED));
+    InterlockedIncrement(&request->engine->pending);
+    if (ConnectNamedPipe(pipe, &request->overlapped))
+    {
+        return TRUE;
+    }
+
+    err = GetLastError();
+    if (err == ERROR_IO_PENDING)
+    {
+        return TRUE;
+    }
+    if (err == ERROR_PIPE_CONNECTED)
+    {
+        /* Client connected before the call, nothing gets queued */
+        err = ERROR_SUCCESS;
+    }
+    return io_post(request, err);
+}
+
+static VOID CALLBACK io_watch_signalled(PVOID param, BOOLEAN timed_out)
+{
+    io_request *request = (io_request *)param;
+
+    PostQueuedCompletionStatus(request->engine->port, 0, IO_KEY_WATCH,
+                               &request->overlapped);
+}
+
+BOOL io_watch(io_request *request, HANDLE event)
+{
+    /* One shot wait is still registered until unregistered */
+    io_unwatch(request);
+
+    if (!RegisterWaitForSingleObject(&request->wait, event, io_watch_signalled,
+                                     request, INFINITE,
+                                     WT_EXECUTEONLYONCE | WT_EXECUTEINWAITTHREAD))
+    {
+        fprintf(stderr, "RegisterWaitForSingleObject() failed - %d\n", GetLastError());
+        request->wait = NULL;
+        return FALSE;
+    }
+    return TRUE;
+}
+
+void io_unwatch(io_request *request)
+{
+    if (request->wait != NULL)
+    {
+        /* Returns after callback that might be running has finished */
+        UnregisterWaitEx(request->wait, INVALID_HANDLE_VALUE);
+        request->wait = NULL;
+    }
+}
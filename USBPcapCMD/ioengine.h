@@ -0,0 +1,125 @@
+/*
+ * Copyright (c) 2026 Tomasz Moń <desowin@gmail.com>
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#ifndef USBPCAP_CMD_IOENGINE_H
+#define USBPCAP_CMD_IOENGINE_H
+
+#include <windows.h>
+
+/* I/O completion port engine.
+ *
+ * Every asynchronous operation (read, write, pipe connect, watched event)
+ * is described by io_request. When the operation finishes, its callback
+ * is called from io_engine_poll(). Results of operations that fail right
+ * away are delivered the same way, so callbacks never run from inside
+ * io_read(), io_write() or io_connect().
+ *
+ * Request has at most one operation in flight. io_engine_poll() can be
+ * called from multiple threads, callback of one request never runs on
+ * two of them at once. io_engine_start() adds threads that do nothing
+ * else.
+ *
+ * ioengine.c implements the engine with Win32 completion port, POSIX
+ * host build uses epoll based host/ioengine_epoll.c instead.
+ */
+typedef struct _io_engine io_engine;
+typedef struct _io_request io_request;
+
+/* error is ERROR_SUCCESS or Win32 error code the operation failed with */
+typedef void (*io_callback)(io_request *request, DWORD error, DWORD bytes);
+
+struct _io_request
+{
+    OVERLAPPED overlapped;
+    io_engine *engine;
+    io_callback callback;
+    void *ctx;
+    DWORD error;      /* Result of operation that failed right away */
+    HANDLE wait;      /* Registered wait of io_watch() */
+    /* Completion queue of engine without completion port */
+    io_request *next;
+    ULONG_PTR key;
+};
+
+/* Event handle with low order bit set keeps completion of operation on
+ * handle attached to engine from being queued to completion port. Used
+ * for operations that are waited for right after they are started.
+ */
+#define IO_UNQUEUED_EVENT(event) ((HANDLE)((ULONG_PTR)(event) | 1))
+
+io_engine *io_engine_create(void);
+void io_engine_destroy(io_engine *engine);
+
+/* Operations on handle complete to engine from now on. Handle must be
+ * opened with FILE_FLAG_OVERLAPPED and can be attached only once.
+ */
+BOOL io_engine_attach(io_engine *engine, HANDLE handle);
+
+/* Dispatches one completion.
+ *
+ * Returns FALSE if nothing completed within timeout milliseconds
+ * (GetLastError() returns WAIT_TIMEOUT) or if the port failed. Returns
+ * TRUE without calling any callback after io_engine_wake().
+ */
+BOOL io_engine_poll(io_engine *engine, DWORD timeout);
+
+/* Makes one io_engine_poll() call return */
+void io_engine_wake(io_engine *engine);
+
+/* Starts up to threads threads that dispatch completions until
+ * io_engine_stop(). Returns number of threads started, which is 0 where
+ * operations started by them could not be cancelled by io_cancel().
+ */
+DWORD io_engine_start(io_engine *engine, DWORD threads);
+
+/* Waits for threads started by io_engine_start() to finish callbacks they
+ * are running and quit. Completions are left to io_engine_poll() callers.
+ */
+void io_engine_stop(io_engine *engine);
+
+/* Waits until all reads, writes and connects complete. Must be called
+ * after reads and connects were cancelled and engine threads stopped,
+ * before buffers and requests are freed. Watched events are ignored from
+ * now on.
+ */
+void io_engine_drain(io_engine *engine);
+
+void io_request_init(io_request *request, io_engine *engine,
+                     io_callback callback, void *ctx);
+
+/* Reads up to length bytes from attached handle.
+ * Returns FALSE if the result could not be queued.
+ */
+BOOL io_read(io_request *request, HANDLE handle, void *buffer, DWORD length);
+
+/* Appends length bytes to attached handle. Operation completes once all
+ * of them were written, buffer must stay untouched until then.
+ * Returns FALSE if the result could not be queued.
+ */
+BOOL io_write(io_request *request, HANDLE handle, const void *buffer, DWORD length);
+
+/* Cancels read, write or connect of request on handle. Can be called from
+ * any thread, callback is called with ERROR_OPERATION_ABORTED unless the
+ * operation has finished already.
+ */
+void io_cancel(io_request *request, HANDLE handle);
+
+/* Waits for client on attached named pipe server handle.
+ * Returns FALSE if the result could not be queued.
+ */
+BOOL io_connect(io_request *request, HANDLE pipe);
+
+/* Calls request callback once event gets signalled. Event that should be
+ * followed further has to be watched again from the callback.
+ */
+BOOL io_watch(io_request *request, HANDLE event);
+
+/* Stops watching event. Callback can still be called if the event was
+ * signalled before, unless io_engine_drain() is called afterwards.
+ */
+void io_unwatch(io_request *request);
+
+#endif /* USBPCAP_CMD_IOENGINE_H */
@@ -0,0 +1,350 @@
+/*
+ * Copyright (c) 2026 Tomasz Moń <desowin@gmail.com>
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "pcapfile.h"
+#include "isoch.h"
+
+/* Interim report interval (capture time) when reading from pipe */
+#define ISOCH_LIVE_REPORT_USEC  (10 * 1000000)
+
+/* Fixed point fraction bits used for frames per packet ratio */
+#define ISOCH_SPAN_SHIFT        8
+
+/* All state kept per isochronous endpoint. Everything is updated in place
+ * so memory use does not depend on capture length.
+ */
+typedef struct _isoch_endpoint
+{
+    USHORT bus;
+    USHORT device;
+    UCHAR endpoint;
+
+    /* Frame continuity, tracked on completions */
+    BOOL has_frame;
+    ULONG last_start;          /* startFrame of previous completion */
+    ULONG last_packets;        /* numberOfPackets of previous completion */
+    ULONG span;                /* Minimum frames per packet (fixed point) */
+    UINT64 gaps;
+    UINT64 missed_frames;
+    UINT64 overlaps;
+
+    /* Per-packet status */
+    UINT64 transfers;
+    UINT64 packets;
+    UINT64 error_packets;
+    UINT64 bursts;
+    ULONG burst;
+    ULONG longest_burst;
+    UINT64 underruns;          /* Successful zero-length IN packets */
+
+    /* Packet length mean and variance (Welford's method) */
+    UINT64 length_count;
+    double length_mean;
+    double length_m2;
+
+    /* Delivered bitrate */
+    UINT64 bytes;
+    UINT64 first_ts;
+    UINT64 last_ts;
+    UINT64 second;             /* Current one second window number */
+    UINT64 second_bytes;
+    UINT64 min_rate;           /* Bytes in slowest complete second */
+    UINT64 max_rate;           /* Bytes in fastest complete second */
+    BOOL has_rate;
+
+    struct _isoch_endpoint *next;
+} isoch_endpoint;
+
+static isoch_endpoint *isoch_get_endpoint(isoch_endpoint **head,
+                                          PUSBPCAP_BUFFER_PACKET_HEADER header)
+{
+    isoch_endpoint *ep;
+    isoch_endpoint *prev = NULL;
+
+    for (ep = *head; ep; prev = ep, ep = ep->next)
+    {
+        if ((ep->bus == header->bus) && (ep->device == header->device) &&
+            (ep->endpoint == header->endpoint))
+        {
+            if (prev != NULL)
+            {
+                /* Move to front, active streams are looked up first */
+                prev->next = ep->next;
+                ep->next = *head;
+                *head = ep;
+            }
+            return ep;
+        }
+    }
+
+    ep = (isoch_endpoint *)calloc(1, sizeof(isoch_endpoint));
+    if (ep != NULL)
+    {
+        ep->bus = header->bus;
+        ep->device = header->device;
+        ep->endpoint = header->endpoint;
+        ep->next = *head;
+        *head = ep;
+    }
+    return ep;
+}
+
+static void isoch_add_length(isoch_endpoint *ep, ULONG length)
+{
+    double delta;
+
+    ep->length_count++;
+    delta = (double)length - ep->length_mean;
+    ep->length_mean += delta / (double)ep->length_count;
+    ep->length_m2 += delta * ((double)length - ep->length_mean);
+}
+
+static void isoch_add_bytes(isoch_endpoint *ep, UINT64 ts, ULONG bytes)
+{
+    UINT64 second = ts / 1000000;
+
+    if (ep->first_ts == 0)
+    {
+        ep->first_ts = ts;
+        ep->second = second;
+    }
+
+    if (second != ep->second)
+    {
+        /* Only whole seconds between first and current one count */
+        if ((second == ep->second + 1) && (ep->second != ep->first_ts / 1000000))
+        {
+            if (!ep->has_rate || (ep->second_bytes < ep->min_rate))
+            {
+                ep->min_rate = ep->second_bytes;
+            }
+            if (!ep->has_rate || (ep->second_bytes > ep->max_rate))
+            {
+                ep->max_rate = ep->second_bytes;
+            }
+            ep->has_rate = TRUE;
+        }
+        ep->second = second;
+        ep->second_bytes = 0;
+    }
+
+    ep->second_bytes += bytes;
+    ep->bytes += bytes;
+    ep->last_ts = ts;
+}
+
+static void isoch_check_frames(isoch_endpoint *ep, PUSBPCAP_BUFFER_ISOCH_HEADER isoch)
+{
+    if (ep->has_frame && (ep->last_packets > 0))
+    {
+        LONG delta = (LONG)(isoch->startFrame - ep->last_start);
+
+        if (delta <= 0)
+        {
+            /* Transfer scheduled in frames already used by previous one */
+            ep->overlaps++;
+        }
+        else
+        {
+            ULONG span = ((ULONG)delta << ISOCH_SPAN_SHIFT) / ep->last_packets;
+            ULONG expected;
+
+            /* Back-to-back transfers give the smallest frame distance per
+             * packet. Anything above that is frame discontinuity.
+             */
+            if ((ep->span == 0) || (span < ep->span))
+            {
+                ep->span = span;
+            }
+
+            expected = (ep->last_packets * ep->span) >> ISOCH_SPAN_SHIFT;
+            if ((ULONG)delta > expected)
+            {
+                ep->gaps++;
+                ep->missed_frames += (ULONG)delta - expected;
+            }
+        }
+    }
+
+    ep->has_frame = TRUE;
+    ep->last_start = isoch->startFrame;
+    ep->last_packets = isoch->numberOfPackets;
+}
+
+static void isoch_process(isoch_endpoint **head, UINT64 ts,
+                          unsigned char *data, UINT32 length)
+{
+    PUSBPCAP_BUFFER_PACKET_HEADER header;
+    PUSBPCAP_BUFFER_ISOCH_HEADER isoch;
+    isoch_endpoint *ep;
+    BOOL in;
+    ULONG i;
+
+    header = pcap_usbpcap_header(data, length);
+    if ((header == NULL) || (header->transfer != USBPCAP_TRANSFER_ISOCHRONOUS) ||
+        (header->headerLen < FIELD_OFFSET(USBPCAP_BUFFER_ISOCH_HEADER, packet)))
+    {
+        return;
+    }
+
+    isoch = (PUSBPCAP_BUFFER_ISOCH_HEADER)data;
+    if (isoch->numberOfPackets >
+        (header->headerLen - FIELD_OFFSET(USBPCAP_BUFFER_ISOCH_HEADER, packet)) /
+        sizeof(USBPCAP_BUFFER_ISO_PACKET))
+    {
+        /* Header claims more packets than it contains */
+        return;
+    }
+
+    ep = isoch_get_endpoint(head, header);
+    if (ep == NULL)
+    {
+        return;
+    }
+
+    in = (header->endpoint & 0x80) ? TRUE : FALSE;
+
+    if (!(header->info & USBPCAP_INFO_PDO_TO_FDO))
+    {
+        /* Submission. Only OUT data lengths are known at this point. */
+        if (!in)
+        {
+            for (i = 0; i < isoch->numberOfPackets; i++)
+            {
+                ULONG end = (i + 1 < isoch->numberOfPackets) ?
+                            isoch->packet[i + 1].offset : header->dataLength;
+
+                if (end >= isoch->packet[i].offset)
+                {
+                    isoch_add_length(ep, end - isoch->packet[i].offset);
+                }
+            }
+            isoch_add_bytes(ep, ts, header->dataLength);
+        }
+        return;
+    }
+
+    ep->transfers++;
+    isoch_check_frames(ep, isoch);
+
+    for (i = 0; i < isoch->numberOfPackets; i++)
+    {
+        PUSBPCAP_BUFFER_ISO_PACKET packet = &isoch->packet[i];
+
+        ep->packets++;
+        if (packet->status != 0)
+        {
+            ep->error_packets++;
+            ep->burst++;
+            if (ep->burst == 1)
+            {
+                ep->bursts++;
+            }
+            if (ep->burst > ep->longest_burst)
+            {
+                ep->longest_burst = ep->burst;
+            }
+            continue;
+        }
+
+        ep->burst = 0;
+        if (in)
+        {
+            if (packet->length == 0)
+            {
+                ep->underruns++;
+            }
+            isoch_add_length(ep, packet->length);
+            isoch_add_bytes(ep, ts, packet->length);
+        }
+    }
+}
+
+static void isoch_print(isoch_endpoint *head)
+{
+    isoch_endpoint *ep;
+
+    for (ep = head; ep; ep = ep->next)
+    {
+        double duration = (ep->last_ts - ep->first_ts) / 1000000.0;
+        double stddev = (ep->length_count > 1) ?
+                        sqrt(ep->length_m2 / (double)(ep->length_count - 1)) : 0.0;
+
+        printf("Bus %u Device %u Endpoint 0x%02x (%s)\n",
+               ep->bus, ep->device, ep->endpoint,
+               (ep->endpoint & 0x80) ? "IN" : "OUT");
+        printf("  transfers %I64u, packets %I64u, duration %.3f s\n",
+               ep->transfers, ep->packets, duration);
+        printf("  frame gaps %I64u (%I64u frames missed), overlaps %I64u\n",
+               ep->gaps, ep->missed_frames, ep->overlaps);
+        printf("  packet errors %I64u in %I64u bursts (longest %u), underruns %I64u\n",
+               ep->error_packets, ep->bursts, ep->longest_burst, ep->underruns);
+        printf("  packet length mean %.1f, stddev %.1f\n",
+               ep->length_mean, stddev);
+        if (duration > 0.0)
+        {
+            printf("  bitrate avg %.1f kbit/s", (ep->bytes * 8) / duration / 1000.0);
+            if (ep->has_rate)
+            {
+                printf(", min %.1f, max %.1f",
+                       (ep->min_rate * 8) / 1000.0, (ep->max_rate * 8) / 1000.0);
+            }
+            printf("\n");
+        }
+    }
+}
+
+int isoch_analyze(const char *capture)
+{
+    pcap_reader reader;
+    pcaprec_hdr_t hdr;
+    unsigned char *data;
+    isoch_endpoint *head = NULL;
+    UINT64 next_report = 0;
+    int result;
+
+    if (!pcap_reader_open(&reader, capture))
+    {
+        return -1;
+    }
+
+    while ((result = pcap_reader_next(&reader, &hdr, &data)) == PCAP_READ_RECORD)
+    {
+        UINT64 ts = pcap_reader_timestamp(&reader, &hdr);
+
+        isoch_process(&head, ts, data, hdr.incl_len);
+
+        if (reader.is_pipe)
+        {
+            if (next_report == 0)
+            {
+                next_report = ts + ISOCH_LIVE_REPORT_USEC;
+            }
+            else if (ts >= next_report)
+            {
+                isoch_print(head);
+                fflush(stdout);
+                next_report = ts + ISOCH_LIVE_REPORT_USEC;
+            }
+        }
+    }
+
+    isoch_print(head);
+
+    while (head != NULL)
+    {
+        isoch_endpoint *ep = head;
+        head = ep->next;
+        free(ep);
+    }
+
+    pcap_reader_close(&reader);
+    return (result == PCAP_READ_ERROR) ? -1 : 0;
+}
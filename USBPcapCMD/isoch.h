@@ -0,0 +1,18 @@
+/*
+ * Copyright (c) 2026 Tomasz Moń <desowin@gmail.com>
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#ifndef USBPCAP_CMD_ISOCH_H
+#define USBPCAP_CMD_ISOCH_H
+
+/* Analyzes isochronous transfers in capture file (or standard input when
+ * capture is "-") and prints per-endpoint frame continuity, packet error,
+ * payload length and bitrate statistics to standard output.
+ *
+ * Returns 0 on success, -1 on failure.
+ */
+int isoch_analyze(const char *capture);
+
+#endif /* USBPCAP_CMD_ISOCH_H */
@@ -0,0 +1,364 @@
+/*
+ * Copyright (c) 2026 Tomasz Moń <desowin@gmail.com>
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "livestats.h"
+
+/* Endpoints shown in console table, busiest first */
+#define LIVE_STATS_ROWS        20
+
+#define LIVE_STATS_LINE_WIDTH  79
+
+static const char *live_stats_transfer_name(UCHAR transfer)
+{
+    switch (transfer)
+    {
+        case USBPCAP_TRANSFER_ISOCHRONOUS:
+            return "isochronous";
+        case USBPCAP_TRANSFER_INTERRUPT:
+            return "interrupt";
+        case USBPCAP_TRANSFER_CONTROL:
+            return "control";
+        case USBPCAP_TRANSFER_BULK:
+            return "bulk";
+        default:
+            return "other";
+    }
+}
+
+static USHORT live_stats_device(UINT32 index)
+{
+    return (USHORT)(index >> 5);
+}
+
+static UCHAR live_stats_endpoint(UINT32 index)
+{
+    return (UCHAR)((index & 0x0F) | ((index & 0x10) ? 0x80 : 0x00));
+}
+
+live_stats *live_stats_create(const char *json)
+{
+    live_stats *stats;
+    CONSOLE_SCREEN_BUFFER_INFO info;
+
+    stats = (live_stats *)calloc(1, sizeof(live_stats));
+    if (stats == NULL)
+    {
+        fprintf(stderr, "Failed to allocate live statistics\n");
+        return NULL;
+    }
+
+    /* Data read from driver starts with pcap file header */
+    stats->skip = sizeof(pcap_hdr_t);
+    stats->start = GetTickCount();
+    stats->last_refresh = stats->start;
+
+    stats->console = GetStdHandle(STD_ERROR_HANDLE);
+    if ((stats->console == INVALID_HANDLE_VALUE) ||
+        !GetConsoleScreenBufferInfo(stats->console, &info))
+    {
+        /* Redirected, table would only clutter the output */
+        stats->console = NULL;
+    }
+
+    if (json != NULL)
+    {
+        if (fopen_s(&stats->json, json, "a") != 0)
+        {
+            fprintf(stderr, "Failed to open %s\n", json);
+            free(stats);
+            return NULL;
+        }
+    }
+
+    return stats;
+}
+
+void live_stats_destroy(live_stats *stats)
+{
+    if (stats->json != NULL)
+    {
+        fclose(stats->json);
+    }
+    free(stats);
+}
+
+static void live_stats_count(live_stats *stats, const pcaprec_hdr_t *hdr,
+                             const USBPCAP_BUFFER_PACKET_HEADER *header)
+{
+    live_stats_entry *entry;
+
+    if ((header == NULL) || (header->transfer > USBPCAP_TRANSFER_BULK))
+    {
+        entry = &stats->other;
+    }
+    else
+    {
+        UINT32 index = ((header->device & 0x7F) << 5) |
+                       (header->endpoint & 0x0F) |
+                       ((header->endpoint & 0x80) ? 0x10 : 0x00);
+
+        entry = &stats->entries[index];
+        entry->transfer = header->transfer;
+        entry->bytes += header->dataLength;
+    }
+
+    entry->packets++;
+    entry->ring_bytes += sizeof(pcaprec_hdr_t) + hdr->incl_len;
+}
+
+void live_stats_feed(live_stats *stats, const unsigned char *data, DWORD length)
+{
+    while (length > 0)
+    {
+        const pcaprec_hdr_t *hdr;
+        UINT32 needed;
+
+        if (stats->skip > 0)
+        {
+            UINT32 to_skip = min(stats->skip, length);
+
+            data += to_skip;
+            length -= to_skip;
+            stats->skip -= to_skip;
+            continue;
+        }
+
+        if ((stats->partial_length == 0) &&
+            (length >= sizeof(stats->partial)))
+        {
+            /* Common case, whole header is available in place */
+            hdr = (const pcaprec_hdr_t *)data;
+            if (hdr->incl_len >= sizeof(USBPCAP_BUFFER_PACKET_HEADER))
+            {
+                live_stats_count(stats, hdr,
+                    (const USBPCAP_BUFFER_PACKET_HEADER *)(data + sizeof(pcaprec_hdr_t)));
+            }
+            else
+            {
+                live_stats_count(stats, hdr, NULL);
+            }
+            stats->skip = sizeof(pcaprec_hdr_t) + hdr->incl_len;
+            continue;
+        }
+
+        /* Collect record start split across reads */
+        if (stats->partial_length < sizeof(pcaprec_hdr_t))
+        {
+            needed = sizeof(pcaprec_hdr_t);
+        }
+        else
+        {
+            hdr = (const pcaprec_hdr_t *)stats->partial;
+            needed = sizeof(pcaprec_hdr_t) +
+                     min(hdr->incl_len, sizeof(USBPCAP_BUFFER_PACKET_HEADER));
+        }
+
+        if (stats->partial_length < needed)
+        {
+            UINT32 to_copy = min(needed - stats->partial_length, length);
+
+            memcpy(&stats->partial[stats->partial_length], data, to_copy);
+            stats->partial_length += to_copy;
+            data += to_copy;
+            length -= to_copy;
+        }
+
+        hdr = (const pcaprec_hdr_t *)stats->partial;
+        if ((stats->partial_length < sizeof(pcaprec_hdr_t)) ||
+            (stats->partial_length < sizeof(pcaprec_hdr_t) +
+                                     min(hdr->incl_len, sizeof(USBPCAP_BUFFER_PACKET_HEADER))))
+        {
+            continue;
+        }
+
+        if (hdr->incl_len >= sizeof(USBPCAP_BUFFER_PACKET_HEADER))
+        {
+            live_stats_count(stats, hdr,
+                (const USBPCAP_BUFFER_PACKET_HEADER *)&stats->partial[sizeof(pcaprec_hdr_t)]);
+        }
+        else
+        {
+            live_stats_count(stats, hdr, NULL);
+        }
+        stats->skip = sizeof(pcaprec_hdr_t) + hdr->incl_len - stats->partial_length;
+        stats->partial_length = 0;
+    }
+}
+
+static UINT64 live_stats_rate(UINT64 value, UINT64 last, DWORD elapsed)
+{
+    return (value - last) * 1000 / elapsed;
+}
+
+static live_stats *sort_stats;
+
+static int live_stats_compare(const void *a, const void *b)
+{
+    const live_stats_entry *ea = &sort_stats->entries[*(const USHORT *)a];
+    const live_stats_entry *eb = &sort_stats->entries[*(const USHORT *)b];
+    UINT64 da = ea->ring_bytes - ea->last_ring_bytes;
+    UINT64 db = eb->ring_bytes - eb->last_ring_bytes;
+
+    if (da != db)
+    {
+        return (da > db) ? -1 : 1;
+    }
+    if (ea->packets != eb->packets)
+    {
+        return (ea->packets > eb->packets) ? -1 : 1;
+    }
+    return (int)*(const USHORT *)a - (int)*(const USHORT *)b;
+}
+
+static void live_stats_line(live_stats *stats, const char *line)
+{
+    fprintf(stderr, "%-*.*s\n", LIVE_STATS_LINE_WIDTH, LIVE_STATS_LINE_WIDTH, line);
+    stats->lines++;
+}
+
+static void live_stats_render(live_stats *stats, USHORT *active, UINT32 count,
+                              DWORD elapsed)
+{
+    CONSOLE_SCREEN_BUFFER_INFO info;
+    char line[LIVE_STATS_LINE_WIDTH + 1];
+    UINT64 packets = stats->other.packets - stats->other.last_packets;
+    UINT64 ring = stats->other.ring_bytes - stats->other.last_ring_bytes;
+    UINT32 i;
+
+    /* Draw over previous table */
+    if ((stats->lines > 0) && GetConsoleScreenBufferInfo(stats->console, &info))
+    {
+        COORD origin;
+
+        origin.X = 0;
+        origin.Y = (info.dwCursorPosition.Y > stats->lines) ?
+                   (info.dwCursorPosition.Y - stats->lines) : 0;
+        SetConsoleCursorPosition(stats->console, origin);
+    }
+    stats->lines = 0;
+
+    for (i = 0; i < count; i++)
+    {
+        live_stats_entry *entry = &stats->entries[active[i]];
+
+        packets += entry->packets - entry->last_packets;
+        ring += entry->ring_bytes - entry->last_ring_bytes;
+    }
+
+    sprintf_s(line, sizeof(line), "%u s, %I64u packets/s, %I64u ring bytes/s",
+              (GetTickCount() - stats->start) / 1000,
+              packets * 1000 / elapsed, ring * 1000 / elapsed);
+    live_stats_line(stats, line);
+    live_stats_line(stats, "Device Endpoint Type          Packets/s     Bytes/s Ring bytes/s    Packets");
+
+    for (i = 0; i < LIVE_STATS_ROWS; i++)
+    {
+        if (i < count)
+        {
+            live_stats_entry *entry = &stats->entries[active[i]];
+
+            sprintf_s(line, sizeof(line), "%6u 0x%02X     %-11s %11I64u %11I64u %12I64u %10I64u",
+                      live_stats_device(active[i]), live_stats_endpoint(active[i]),
+                      live_stats_transfer_name(entry->transfer),
+                      live_stats_rate(entry->packets, entry->last_packets, elapsed),
+                      live_stats_rate(entry->bytes, entry->last_bytes, elapsed),
+                      live_stats_rate(entry->ring_bytes, entry->last_ring_bytes, elapsed),
+                      entry->packets);
+        }
+        else
+        {
+            line[0] = '\0';
+        }
+        live_stats_line(stats, line);
+    }
+}
+
+static void live_stats_write_json(live_stats *stats, USHORT *active, UINT32 count,
+                                  DWORD elapsed)
+{
+    BOOL first = TRUE;
+    UINT32 i;
+
+    fprintf(stats->json, "{\"time\":%I64u,\"interval_ms\":%u,\"other\":{\"packets\":%I64u,\"ring_bytes\":%I64u},\"endpoints\":[",
+            (UINT64)time(NULL), elapsed,
+            stats->other.packets - stats->other.last_packets,
+            stats->other.ring_bytes - stats->other.last_ring_bytes);
+
+    for (i = 0; i < count; i++)
+    {
+        live_stats_entry *entry = &stats->entries[active[i]];
+
+        if (entry->packets == entry->last_packets)
+        {
+            continue;
+        }
+
+        fprintf(stats->json, "%s{\"device\":%u,\"endpoint\":%u,\"transfer\":\"%s\",\"packets\":%I64u,\"bytes\":%I64u,\"ring_bytes\":%I64u}",
+                first ? "" : ",",
+                live_stats_device(active[i]), live_stats_endpoint(active[i]),
+                live_stats_transfer_name(entry->transfer),
+                entry->packets - entry->last_packets,
+                entry->bytes - entry->last_bytes,
+                entry->ring_bytes - entry->last_ring_bytes);
+        first = FALSE;
+    }
+
+    fprintf(stats->json, "]}\n");
+    fflush(stats->json);
+}
+
+void live_stats_tick(live_stats *stats)
+{
+    USHORT active[LIVE_STATS_ENTRIES];
+    UINT32 count = 0;
+    DWORD now = GetTickCount();
+    DWORD elapsed = now - stats->last_refresh;
+    UINT32 i;
+
+    if (elapsed < LIVE_STATS_REFRESH_MS)
+    {
+        return;
+    }
+    stats->last_refresh = now;
+
+    for (i = 0; i < LIVE_STATS_ENTRIES; i++)
+    {
+        if (stats->entries[i].packets > 0)
+        {
+            active[count++] = (USHORT)i;
+        }
+    }
+
+    /* Counters are not modified while this runs, read_thread() calls feed
+     * and tick under the same lock
+     */
+    sort_stats = stats;
+    qsort(active, count, sizeof(USHORT), live_stats_compare);
+
+    if (stats->console != NULL)
+    {
+        live_stats_render(stats, active, count, elapsed);
+    }
+    if (stats->json != NULL)
+    {
+        live_stats_write_json(stats, active, count, elapsed);
+    }
+
+    for (i = 0; i < count; i++)
+    {
+        live_stats_entry *entry = &stats->entries[active[i]];
+
+        entry->last_packets = entry->packets;
+        entry->last_bytes = entry->bytes;
+        entry->last_ring_bytes = entry->ring_bytes;
+    }
+    stats->other.last_packets = stats->other.packets;
+    stats->other.last_ring_bytes = stats->other.ring_bytes;
+}
@@ -0,0 +1,67 @@
+/*
+ * Copyright (c) 2026 Tomasz Moń <desowin@gmail.com>
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#ifndef USBPCAP_CMD_LIVESTATS_H
+#define USBPCAP_CMD_LIVESTATS_H
+
+#include <stdio.h>
+#include <windows.h>
+#include "USBPcap.h"
+
+#define LIVE_STATS_REFRESH_MS  1000
+
+/* One counter per device address and endpoint (number and direction) */
+#define LIVE_STATS_ENTRIES  (128 * 32)
+
+typedef struct
+{
+    UINT64  packets;
+    UINT64  bytes;          /* Transfer payload bytes */
+    UINT64  ring_bytes;     /* Bytes the records took in capture buffer */
+    UINT64  last_packets;   /* Counters at previous refresh */
+    UINT64  last_bytes;
+    UINT64  last_ring_bytes;
+    UCHAR   transfer;       /* Transfer type of last packet */
+} live_stats_entry;
+
+/* Per-endpoint throughput of running capture.
+ *
+ * live_stats_feed() is called with every chunk read from the driver and
+ * only updates counters. live_stats_tick() renders the table to console
+ * and writes JSON line once per second.
+ */
+typedef struct
+{
+    live_stats_entry entries[LIVE_STATS_ENTRIES];
+    live_stats_entry other;  /* Packets that do not belong to endpoint */
+
+    /* Records can be split across reads. Start of record is collected
+     * here when it is not available in one piece.
+     */
+    unsigned char partial[sizeof(pcaprec_hdr_t) + sizeof(USBPCAP_BUFFER_PACKET_HEADER)];
+    UINT32 partial_length;
+    UINT32 skip;             /* Bytes of current record not needed anymore */
+
+    DWORD start;
+    DWORD last_refresh;
+    FILE *json;
+    HANDLE console;          /* NULL if standard error is not console */
+    SHORT lines;             /* Lines printed by previous refresh */
+} live_stats;
+
+/* json is name of file to append per-second JSON lines to, NULL if none.
+ * Returns NULL on failure.
+ */
+live_stats *live_stats_create(const char *json);
+void live_stats_destroy(live_stats *stats);
+
+/* Accepts data as read from the driver, starting with pcap file header */
+void live_stats_feed(live_stats *stats, const unsigned char *data, DWORD length);
+
+/* Refreshes output if at least a second has passed since last refresh */
+void live_stats_tick(live_stats *stats);
+
+#endif /* USBPCAP_CMD_LIVESTATS_H */
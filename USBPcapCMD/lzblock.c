@@ -0,0 +1,270 @@
+/*
+ * Copyright (c) 2026 Tomasz Moń <desowin@gmail.com>
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#include <string.h>
+#include "lzblock.h"
+
+#define LZ_MIN_MATCH     4
+#define LZ_MAX_OFFSET    65535
+
+/* Literals are copied at end of block, matches never start there */
+#define LZ_LAST_LITERALS 8
+
+static UINT32 lz_read32(const unsigned char *p)
+{
+    UINT32 value;
+
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+static UINT32 lz_hash(UINT32 value)
+{
+    return (value * 2654435761U) >> (32 - LZ_HASH_BITS);
+}
+
+static unsigned char *lz_put_length(unsigned char *op, unsigned char *oend, UINT32 length)
+{
+    while (length >= 255)
+    {
+        if (op >= oend)
+        {
+            return NULL;
+        }
+        *op++ = 255;
+        length -= 255;
+    }
+
+    if (op >= oend)
+    {
+        return NULL;
+    }
+    *op++ = (unsigned char)length;
+    return op;
+}
+
+/* Writes token with literals and optional match (match_length 0) */
+static unsigned char *lz_put_sequence(unsigned char *op, unsigned char *oend,
+                                      const unsigned char *literals,
+                                      UINT32 literal_length, UINT32 offset,
+                                      UINT32 match_length)
+{
+    unsigned char *token;
+
+    if (op >= oend)
+    {
+        return NULL;
+    }
+
+    token = op++;
+    *token = (unsigned char)(min(literal_length, 15) << 4);
+    if (literal_length >= 15)
+    {
+        op = lz_put_length(op, oend, literal_length - 15);
+        if (op == NULL)
+        {
+            return NULL;
+        }
+    }
+
+    if ((UINT32)(oend - op) < literal_length)
+    {
+        return NULL;
+    }
+    memcpy(op, literals, literal_length);
+    op += literal_length;
+
+    if (match_length > 0)
+    {
+        match_length -= LZ_MIN_MATCH;
+
+        if (oend - op < 2)
+        {
+            return NULL;
+        }
+        *op++ = (unsigned char)(offset & 0xFF);
+        *op++ = (unsigned char)(offset >> 8);
+
+        *token |= (unsigned char)min(match_length, 15);
+        if (match_length >= 15)
+        {
+            op = lz_put_length(op, oend, match_length - 15);
+        }
+    }
+
+    return op;
+}
+
+UINT32 lz_compress(const unsigned char *src, UINT32 length,
+                   unsigned char *dst, UINT32 capacity, void *workmem)
+{
+    UINT32 *table = (UINT32 *)workmem;
+    unsigned char *op = dst;
+    unsigned char *oend = dst + capacity;
+    UINT32 anchor = 0;
+    UINT32 ip = 0;
+    UINT32 limit;
+
+    memset(table, 0, LZ_WORKMEM_SIZE);
+
+    limit = (length > LZ_LAST_LITERALS + LZ_MIN_MATCH) ?
+            length - LZ_LAST_LITERALS - LZ_MIN_MATCH : 0;
+
+    while (ip < limit)
+    {
+        UINT32 sequence = lz_read32(&src[ip]);
+        UINT32 hash = lz_hash(sequence);
+        UINT32 candidate = table[hash];
+
+        table[hash] = ip;
+
+        if ((candidate < ip) && (ip - candidate <= LZ_MAX_OFFSET) &&
+            (lz_read32(&src[candidate]) == sequence))
+        {
+            UINT32 match_length = LZ_MIN_MATCH;
+
+            while ((ip > anchor) && (candidate > 0) &&
+                   (src[ip - 1] == src[candidate - 1]))
+            {
+                ip--;
+                candidate--;
+                match_length++;
+            }
+
+            while ((ip + match_length < length - LZ_LAST_LITERALS) &&
+                   (src[candidate + match_length] == src[ip + match_length]))
+            {
+                match_length++;
+            }
+
+            op = lz_put_sequence(op, oend, &src[anchor], ip - anchor,
+                                 ip - candidate, match_length);
+            if (op == NULL)
+            {
+                return 0;
+            }
+
+            ip += match_length;
+            anchor = ip;
+
+            /* Make position just before match end findable, it often
+             * starts next repetition in structured data.
+             */
+            if (ip - 2 < limit)
+            {
+                table[lz_hash(lz_read32(&src[ip - 2]))] = ip - 2;
+            }
+        }
+        else
+        {
+            /* Step faster over data that does not compress */
+            ip += 1 + ((ip - anchor) >> 6);
+        }
+    }
+
+    op = lz_put_sequence(op, oend, &src[anchor], length - anchor, 0, 0);
+    if (op == NULL)
+    {
+        return 0;
+    }
+
+    return (UINT32)(op - dst);
+}
+
+INT32 lz_decompress(const unsigned char *src, UINT32 length,
+                    unsigned char *dst, UINT32 capacity)
+{
+    const unsigned char *ip = src;
+    const unsigned char *iend = src + length;
+    unsigned char *op = dst;
+    unsigned char *oend = dst + capacity;
+
+    while (ip < iend)
+    {
+        unsigned char token = *ip++;
+        UINT32 literal_length = token >> 4;
+        UINT32 match_length = token & 0x0F;
+        UINT32 offset;
+        const unsigned char *match;
+
+        if (literal_length == 15)
+        {
+            unsigned char b;
+            do
+            {
+                if (ip >= iend)
+                {
+                    return -1;
+                }
+                b = *ip++;
+                literal_length += b;
+            } while (b == 255);
+        }
+
+        if ((literal_length > (UINT32)(iend - ip)) ||
+            (literal_length > (UINT32)(oend - op)))
+        {
+            return -1;
+        }
+        memcpy(op, ip, literal_length);
+        ip += literal_length;
+        op += literal_length;
+
+        if (ip == iend)
+        {
+            /* Last token has no match */
+            break;
+        }
+
+        if (iend - ip < 2)
+        {
+            return -1;
+        }
+        offset = ip[0] | (ip[1] << 8);
+        ip += 2;
+        if ((offset == 0) || (offset > (UINT32)(op - dst)))
+        {
+            return -1;
+        }
+
+        if (match_length == 15)
+        {
+            unsigned char b;
+            do
+            {
+                if (ip >= iend)
+                {
+                    return -1;
+                }
+                b = *ip++;
+                match_length += b;
+            } while (b == 255);
+        }
+        match_length += LZ_MIN_MATCH;
+
+        if (match_length > (UINT32)(oend - op))
+        {
+            return -1;
+        }
+
+        match = op - offset;
+        if (offset >= match_length)
+        {
+            memcpy(op, match, match_length);
+            op += match_length;
+        }
+        else
+        {
+            /* Overlapping copy repeats the last offset bytes */
+            while (match_length-- > 0)
+            {
+                *op++ = *match++;
+            }
+        }
+    }
+
+    return (INT32)(op - dst);
+}
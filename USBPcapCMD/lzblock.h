@@ -0,0 +1,43 @@
+/*
+ * Copyright (c) 2026 Tomasz Moń <desowin@gmail.com>
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#ifndef USBPCAP_CMD_LZBLOCK_H
+#define USBPCAP_CMD_LZBLOCK_H
+
+#include <windows.h>
+
+/* Byte-oriented LZ77 block compressor.
+ *
+ * Compressed block is a sequence of tokens. Every token byte holds literal
+ * count in high nibble and match length minus 4 in low nibble, value 15
+ * in either nibble is extended by following bytes (255 means continue).
+ * Literals follow the literal count, 16-bit little endian match offset
+ * follows the literals. Last token contains only literals.
+ */
+
+#define LZ_HASH_BITS     14
+
+/* Size of work memory required by lz_compress() */
+#define LZ_WORKMEM_SIZE  (sizeof(UINT32) << LZ_HASH_BITS)
+
+/* Compresses length bytes from src into dst.
+ *
+ * Returns compressed length, or 0 if data does not fit into capacity
+ * bytes. Callers pass capacity smaller than length to detect blocks that
+ * are not worth compressing.
+ */
+UINT32 lz_compress(const unsigned char *src, UINT32 length,
+                   unsigned char *dst, UINT32 capacity, void *workmem);
+
+/* Decompresses length bytes from src into dst.
+ *
+ * Returns decompressed length, or -1 if input is corrupted or would
+ * overflow capacity bytes.
+ */
+INT32 lz_decompress(const unsigned char *src, UINT32 length,
+                    unsigned char *dst, UINT32 capacity);
+
+#endif /* USBPCAP_CMD_LZBLOCK_H */
@@ -0,0 +1,368 @@
+/*
+ * Copyright (c) 2026 Tomasz Moń <desowin@gmail.com>
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <share.h>
+#include <fcntl.h>
+#include <io.h>
+#include "pcapfile.h"
+#include "blockfile.h"
+
+/* Records larger than this are considered file corruption */
+#define PCAP_MAX_RECORD_LENGTH  (256 * 1024 * 1024)
+
+static BOOL pcap_check_header(const pcap_hdr_t *header, const char *filename,
+                              BOOL *nanoseconds)
+{
+    if (header->magic_number == PCAP_MAGIC_USEC)
+    {
+        *nanoseconds = FALSE;
+    }
+    else if (header->magic_number == PCAP_MAGIC_NSEC)
+    {
+        *nanoseconds = TRUE;
+    }
+    else
+    {
+        fprintf(stderr, "%s: not a little endian pcap file (magic 0x%08X)\n",
+                filename, header->magic_number);
+        return FALSE;
+    }
+
+    if (header->network != DLT_USBPCAP)
+    {
+        fprintf(stderr, "%s: unsupported link type %u (expected %u)\n",
+                filename, header->network, DLT_USBPCAP);
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+static UINT64 pcap_timestamp(BOOL nanoseconds, const pcaprec_hdr_t *hdr)
+{
+    UINT64 ts = ((UINT64)hdr->ts_sec) * 1000000;
+
+    if (nanoseconds)
+    {
+        ts += hdr->ts_usec / 1000;
+    }
+    else
+    {
+        ts += hdr->ts_usec;
+    }
+
+    return ts;
+}
+
+BOOL pcap_reader_open(pcap_reader *reader, const char *filename)
+{
+    memset(reader, 0, sizeof(pcap_reader));
+
+    if (strncmp("-", filename, 2) == 0)
+    {
+        _setmode(_fileno(stdin), _O_BINARY);
+        reader->file = stdin;
+        reader->is_pipe = TRUE;
+    }
+    else
+    {
+        /* Open with shared read/write access so the file can be analyzed
+         * while USBPcapCMD is still appending to it.
+         */
+        reader->file = _fsopen(filename, "rb", _SH_DENYNO);
+    }
+    if (reader->file == NULL)
+    {
+        fprintf(stderr, "Failed to open %s\n", filename);
+        return FALSE;
+    }
+
+    if (fread(&reader->header, sizeof(pcap_hdr_t), 1, reader->file) != 1)
+    {
+        fprintf(stderr, "%s: file too short to contain pcap header\n", filename);
+        goto error;
+    }
+
+    if (blockfile_check_magic(&reader->header, sizeof(pcap_hdr_t)))
+    {
+        if (reader->is_pipe)
+        {
+            fprintf(stderr, "Compressed capture cannot be read from pipe\n");
+            goto error;
+        }
+
+        /* Records are read from decompressed snapshot of the file */
+        fclose(reader->file);
+        reader->file = blockfile_open_stream(filename);
+        if ((reader->file == NULL) ||
+            (fread(&reader->header, sizeof(pcap_hdr_t), 1, reader->file) != 1))
+        {
+            fprintf(stderr, "%s: no pcap header in compressed capture\n", filename);
+            goto error;
+        }
+    }
+
+    if (!pcap_check_header(&reader->header, filename, &reader->nanoseconds))
+    {
+        goto error;
+    }
+
+    reader->offset = sizeof(pcap_hdr_t);
+    return TRUE;
+
+error:
+    if ((reader->file != NULL) && !reader->is_pipe)
+    {
+        fclose(reader->file);
+    }
+    reader->file = NULL;
+    return FALSE;
+}
+
+int pcap_reader_next(pcap_reader *reader, pcaprec_hdr_t *hdr, unsigned char **data)
+{
+    if (fread(hdr, sizeof(pcaprec_hdr_t), 1, reader->file) != 1)
+    {
+        /* Either end of file or the header is not fully written yet */
+        pcap_reader_seek(reader, reader->offset);
+        return PCAP_READ_EOF;
+    }
+
+    if (hdr->incl_len > PCAP_MAX_RECORD_LENGTH)
+    {
+        fprintf(stderr, "Invalid record length %u at offset %I64d\n",
+                hdr->incl_len, reader->offset);
+        return PCAP_READ_ERROR;
+    }
+
+    if (hdr->incl_len > reader->data_size)
+    {
+        unsigned char *tmp = realloc(reader->data, hdr->incl_len);
+        if (tmp == NULL)
+        {
+            fprintf(stderr, "Failed to allocate %u bytes record buffer\n",
+                    hdr->incl_len);
+            return PCAP_READ_ERROR;
+        }
+        reader->data = tmp;
+        reader->data_size = hdr->incl_len;
+    }
+
+    if ((hdr->incl_len > 0) &&
+        (fread(reader->data, hdr->incl_len, 1, reader->file) != 1))
+    {
+        pcap_reader_seek(reader, reader->offset);
+        return PCAP_READ_EOF;
+    }
+
+    reader->offset += sizeof(pcaprec_hdr_t) + hdr->incl_len;
+    *data = reader->data;
+    return PCAP_READ_RECORD;
+}
+
+BOOL pcap_reader_seek(pcap_reader *reader, __int64 offset)
+{
+    /* Clear EOF indicator so new data appended to file can be read */
+    clearerr(reader->file);
+
+    if (reader->is_pipe)
+    {
+        /* Pipe cannot be rewound. Writer has closed it if we are here. */
+        return (offset == reader->offset);
+    }
+
+    if (_fseeki64(reader->file, offset, SEEK_SET) != 0)
+    {
+        fprintf(stderr, "Failed to seek to offset %I64d\n", offset);
+        return FALSE;
+    }
+
+    reader->offset = offset;
+    return TRUE;
+}
+
+void pcap_reader_close(pcap_reader *reader)
+{
+    if ((reader->file != NULL) && !reader->is_pipe)
+    {
+        fclose(reader->file);
+    }
+    reader->file = NULL;
+
+    if (reader->data != NULL)
+    {
+        free(reader->data);
+        reader->data = NULL;
+    }
+    reader->data_size = 0;
+}
+
+UINT64 pcap_reader_timestamp(pcap_reader *reader, pcaprec_hdr_t *hdr)
+{
+    return pcap_timestamp(reader->nanoseconds, hdr);
+}
+
+BOOL pcap_map_open(pcap_map *map, const char *filename)
+{
+    LARGE_INTEGER size;
+
+    memset(map, 0, sizeof(pcap_map));
+
+    map->file = CreateFileA(filename,
+                            GENERIC_READ,
+                            FILE_SHARE_READ | FILE_SHARE_WRITE,
+                            NULL,
+                            OPEN_EXISTING,
+                            FILE_FLAG_SEQUENTIAL_SCAN,
+                            NULL);
+    if (map->file == INVALID_HANDLE_VALUE)
+    {
+        fprintf(stderr, "Failed to open %s - %d\n", filename, GetLastError());
+        map->file = NULL;
+        return FALSE;
+    }
+
+    if (!GetFileSizeEx(map->file, &size) || (size.QuadPart < sizeof(pcap_hdr_t)))
+    {
+        fprintf(stderr, "%s: file too short to contain pcap header\n", filename);
+        goto error;
+    }
+
+    if ((UINT64)size.QuadPart > (SIZE_T)-1)
+    {
+        fprintf(stderr, "%s: file too large to map in 32-bit process\n", filename);
+        goto error;
+    }
+    map->size = (UINT64)size.QuadPart;
+
+    map->mapping = CreateFileMappingA(map->file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (map->mapping == NULL)
+    {
+        fprintf(stderr, "CreateFileMapping failed - %d\n", GetLastError());
+        goto error;
+    }
+
+    map->base = MapViewOfFile(map->mapping, FILE_MAP_READ, 0, 0, 0);
+    if (map->base == NULL)
+    {
+        fprintf(stderr, "MapViewOfFile failed - %d\n", GetLastError());
+        goto error;
+    }
+
+    if (blockfile_check_magic(map->base, (size_t)map->size))
+    {
+        /* Replace the mapping with decompressed copy of whole capture */
+        pcap_map_close(map);
+        map->base = blockfile_load(filename, &map->size);
+        if (map->base == NULL)
+        {
+            return FALSE;
+        }
+        map->decompressed = TRUE;
+
+        if (map->size < sizeof(pcap_hdr_t))
+        {
+            fprintf(stderr, "%s: no pcap header in compressed capture\n", filename);
+            goto error;
+        }
+    }
+
+    memcpy(&map->header, map->base, sizeof(pcap_hdr_t));
+    if (!pcap_check_header(&map->header, filename, &map->nanoseconds))
+    {
+        goto error;
+    }
+
+    map->offset = sizeof(pcap_hdr_t);
+    return TRUE;
+
+error:
+    pcap_map_close(map);
+    return FALSE;
+}
+
+int pcap_map_next(pcap_map *map, const pcaprec_hdr_t **hdr, const unsigned char **data)
+{
+    const pcaprec_hdr_t *rec;
+
+    if (map->size - map->offset < sizeof(pcaprec_hdr_t))
+    {
+        return PCAP_READ_EOF;
+    }
+
+    rec = (const pcaprec_hdr_t *)(map->base + map->offset);
+    if (rec->incl_len > map->size - map->offset - sizeof(pcaprec_hdr_t))
+    {
+        /* Truncated last record */
+        return PCAP_READ_EOF;
+    }
+
+    *hdr = rec;
+    *data = map->base + map->offset + sizeof(pcaprec_hdr_t);
+    map->offset += sizeof(pcaprec_hdr_t) + rec->incl_len;
+    return PCAP_READ_RECORD;
+}
+
+void pcap_map_close(pcap_map *map)
+{
+    if (map->decompressed)
+    {
+        blockfile_unload((unsigned char *)map->base);
+    }
+    else if (map->base != NULL)
+    {
+        UnmapViewOfFile(map->base);
+    }
+    if (map->mapping != NULL)
+    {
+        CloseHandle(map->mapping);
+    }
+    if (map->file != NULL)
+    {
+        CloseHandle(map->file);
+    }
+    memset(map, 0, sizeof(pcap_map));
+}
+
+UINT64 pcap_map_timestamp(pcap_map *map, const pcaprec_hdr_t *hdr)
+{
+    return pcap_timestamp(map->nanoseconds, hdr);
+}
+
+PUSBPCAP_BUFFER_PACKET_HEADER pcap_usbpcap_header(const unsigned char *data, UINT32 incl_len)
+{
+    PUSBPCAP_BUFFER_PACKET_HEADER header;
+
+    if (incl_len < sizeof(USBPCAP_BUFFER_PACKET_HEADER))
+    {
+        return NULL;
+    }
+
+    header = (PUSBPCAP_BUFFER_PACKET_HEADER)data;
+    if ((header->headerLen < sizeof(USBPCAP_BUFFER_PACKET_HEADER)) ||
+        (header->headerLen > incl_len))
+    {
+        return NULL;
+    }
+
+    return header;
+}
+
+size_t pcap_base_length(const char *filename)
+{
+    const char *dot = strrchr(filename, '.');
+    const char *sep = strrchr(filename, '\\');
+
+    if ((dot != NULL) && ((sep == NULL) || (dot > sep)))
+    {
+        return dot - filename;
+    }
+
+    return strlen(filename);
+}
@@ -0,0 +1,86 @@
+/*
+ * Copyright (c) 2026 Tomasz Moń <desowin@gmail.com>
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#ifndef USBPCAP_CMD_PCAPFILE_H
+#define USBPCAP_CMD_PCAPFILE_H
+
+#include <stdio.h>
+#include <windows.h>
+#include "USBPcap.h"
+
+#define PCAP_MAGIC_USEC  0xa1b2c3d4
+#define PCAP_MAGIC_NSEC  0xa1b23c4d
+
+/* Sequential reader for classic .pcap files with DLT_USBPCAP link type.
+ *
+ * The reader tolerates a truncated last record so it can be used on files
+ * that are still being written by a running capture: pcap_reader_next()
+ * rewinds to the start of the incomplete record and reports end of file.
+ * Calling it again after the writer appended more data continues from
+ * that record.
+ *
+ * Filename "-" reads standard input, so the reader can be placed after
+ * USBPcapCMD -o - in a pipeline.
+ */
+typedef struct
+{
+    FILE *file;
+    BOOL is_pipe;         /* TRUE if reading from standard input */
+    pcap_hdr_t header;
+    BOOL nanoseconds;     /* TRUE if ts_usec field holds nanoseconds */
+    unsigned char *data;  /* Current record data */
+    UINT32 data_size;     /* Allocated size of data buffer */
+    __int64 offset;       /* File offset of the next record */
+} pcap_reader;
+
+/* Values returned by pcap_reader_next() */
+#define PCAP_READ_ERROR  -1
+#define PCAP_READ_EOF     0
+#define PCAP_READ_RECORD  1
+
+BOOL pcap_reader_open(pcap_reader *reader, const char *filename);
+int pcap_reader_next(pcap_reader *reader, pcaprec_hdr_t *hdr, unsigned char **data);
+BOOL pcap_reader_seek(pcap_reader *reader, __int64 offset);
+void pcap_reader_close(pcap_reader *reader);
+
+/* Returns record timestamp in microseconds since epoch. */
+UINT64 pcap_reader_timestamp(pcap_reader *reader, pcaprec_hdr_t *hdr);
+
+/* Memory-mapped read-only view of whole capture file. Records are
+ * returned as pointers into the mapping, so payloads can be handed over
+ * without copying. The pointers stay valid until pcap_map_close().
+ *
+ * Compressed captures are decompressed into memory on open. Reader does
+ * the same through temporary file.
+ */
+typedef struct
+{
+    HANDLE file;
+    HANDLE mapping;
+    const unsigned char *base;
+    UINT64 size;
+    UINT64 offset;        /* File offset of the next record */
+    pcap_hdr_t header;
+    BOOL nanoseconds;
+    BOOL decompressed;    /* TRUE if base is decompressed copy, not mapping */
+} pcap_map;
+
+BOOL pcap_map_open(pcap_map *map, const char *filename);
+int pcap_map_next(pcap_map *map, const pcaprec_hdr_t **hdr, const unsigned char **data);
+void pcap_map_close(pcap_map *map);
+UINT64 pcap_map_timestamp(pcap_map *map, const pcaprec_hdr_t *hdr);
+
+/* Returns pointer to USBPcap packet header if record is large enough to
+ * contain one, NULL otherwise.
+ */
+PUSBPCAP_BUFFER_PACKET_HEADER pcap_usbpcap_header(const unsigned char *data, UINT32 incl_len);
+
+/* Returns filename length without extension. Used to derive names of
+ * files generated from capture.
+ */
+size_t pcap_base_length(const char *filename);
+
+#endif /* USBPCAP_CMD_PCAPFILE_H */
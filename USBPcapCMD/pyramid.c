@@ -0,0 +1,781 @@
+/*
+ * Copyright (c) 2026 Tomasz Moń <desowin@gmail.com>
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "pcapfile.h"
+#include "pyramid.h"
+
+typedef struct
+{
+    UINT32 count;
+    UINT32 size;
+    PYRAMID_BUCKET *buckets;
+} bucket_array;
+
+typedef struct
+{
+    USHORT bus;
+    USHORT device;
+    UCHAR endpoint;
+    bucket_array levels[PYRAMID_LEVELS];
+} pyramid_stream;
+
+typedef struct
+{
+    BOOL has_base;
+    UINT64 base_time;
+    UINT64 source_offset;
+    UINT32 count;
+    UINT32 size;
+    pyramid_stream *streams;
+    int last_stream; /* Most recently used stream, speeds up lookup */
+} pyramid_builder;
+
+static UINT64 level_width(int level)
+{
+    UINT64 width = PYRAMID_LEVEL0_USEC;
+
+    while (level-- > 0)
+    {
+        width *= 10;
+    }
+
+    return width;
+}
+
+static void builder_free(pyramid_builder *builder)
+{
+    UINT32 i;
+    int level;
+
+    for (i = 0; i < builder->count; i++)
+    {
+        for (level = 0; level < PYRAMID_LEVELS; level++)
+        {
+            free(builder->streams[i].levels[level].buckets);
+        }
+    }
+    free(builder->streams);
+    memset(builder, 0, sizeof(pyramid_builder));
+}
+
+static pyramid_stream *builder_get_stream(pyramid_builder *builder,
+                                          USHORT bus, USHORT device, UCHAR endpoint)
+{
+    pyramid_stream *stream;
+    UINT32 i;
+
+    if (builder->last_stream >= 0)
+    {
+        stream = &builder->streams[builder->last_stream];
+        if ((stream->bus == bus) && (stream->device == device) &&
+            (stream->endpoint == endpoint))
+        {
+            return stream;
+        }
+    }
+
+    for (i = 0; i < builder->count; i++)
+    {
+        stream = &builder->streams[i];
+        if ((stream->bus == bus) && (stream->device == device) &&
+            (stream->endpoint == endpoint))
+        {
+            builder->last_stream = (int)i;
+            return stream;
+        }
+    }
+
+    if (builder->count == builder->size)
+    {
+        UINT32 size = (builder->size == 0) ? 16 : builder->size * 2;
+        pyramid_stream *tmp = realloc(builder->streams, size * sizeof(pyramid_stream));
+        if (tmp == NULL)
+        {
+            return NULL;
+        }
+        builder->streams = tmp;
+        builder->size = size;
+    }
+
+    stream = &builder->streams[builder->count];
+    memset(stream, 0, sizeof(pyramid_stream));
+    stream->bus = bus;
+    stream->device = device;
+    stream->endpoint = endpoint;
+    builder->last_stream = (int)builder->count;
+    builder->count++;
+    return stream;
+}
+
+/* Returns bucket with given index, inserting new one if needed. Records
+ * are almost always in timestamp order so the common case is to either
+ * update or append the last bucket.
+ */
+static PYRAMID_BUCKET *bucket_array_get(bucket_array *array, UINT32 index)
+{
+    UINT32 lo;
+    UINT32 hi;
+    PYRAMID_BUCKET *bucket;
+
+    if ((array->count > 0) && (array->buckets[array->count - 1].index == index))
+    {
+        return &array->buckets[array->count - 1];
+    }
+
+    if ((array->count > 0) && (array->buckets[array->count - 1].index > index))
+    {
+        /* Out of order record, find insert position */
+        lo = 0;
+        hi = array->count;
+        while (lo < hi)
+        {
+            UINT32 mid = lo + (hi - lo) / 2;
+            if (array->buckets[mid].index < index)
+            {
+                lo = mid + 1;
+            }
+            else
+            {
+                hi = mid;
+            }
+        }
+
+        if (array->buckets[lo].index == index)
+        {
+            return &array->buckets[lo];
+        }
+    }
+    else
+    {
+        lo = array->count;
+    }
+
+    if (array->count == array->size)
+    {
+        UINT32 size = (array->size == 0) ? 64 : array->size * 2;
+        PYRAMID_BUCKET *tmp = realloc(array->buckets, size * sizeof(PYRAMID_BUCKET));
+        if (tmp == NULL)
+        {
+            return NULL;
+        }
+        array->buckets = tmp;
+        array->size = size;
+    }
+
+    if (lo < array->count)
+    {
+        memmove(&array->buckets[lo + 1], &array->buckets[lo],
+                (array->count - lo) * sizeof(PYRAMID_BUCKET));
+    }
+
+    bucket = &array->buckets[lo];
+    memset(bucket, 0, sizeof(PYRAMID_BUCKET));
+    bucket->index = index;
+    array->count++;
+    return bucket;
+}
+
+static BOOL builder_add(pyramid_builder *builder, UINT64 timestamp,
+                        PUSBPCAP_BUFFER_PACKET_HEADER header)
+{
+    pyramid_stream *stream;
+    UINT64 delta;
+    int level;
+
+    if (builder->has_base == FALSE)
+    {
+        /* Align base to the coarsest bucket so that bucket boundaries
+         * match on all levels.
+         */
+        UINT64 width = level_width(PYRAMID_LEVELS - 1);
+        builder->base_time = (timestamp / width) * width;
+        builder->has_base = TRUE;
+    }
+
+    delta = (timestamp > builder->base_time) ? (timestamp - builder->base_time) : 0;
+    if (delta / PYRAMID_LEVEL0_USEC > MAXUINT32)
+    {
+        /* Bucket index would not fit into PYRAMID_BUCKET at 1 ms level */
+        fprintf(stderr, "Capture spans more than %u ms, pyramid cannot index it\n",
+                MAXUINT32);
+        return FALSE;
+    }
+
+    stream = builder_get_stream(builder, header->bus, header->device, header->endpoint);
+    if (stream == NULL)
+    {
+        fprintf(stderr, "Failed to allocate memory for pyramid\n");
+        return FALSE;
+    }
+
+    for (level = 0; level < PYRAMID_LEVELS; level++)
+    {
+        PYRAMID_BUCKET *bucket;
+
+        bucket = bucket_array_get(&stream->levels[level],
+                                  (UINT32)(delta / level_width(level)));
+        if (bucket == NULL)
+        {
+            fprintf(stderr, "Failed to allocate memory for pyramid\n");
+            return FALSE;
+        }
+
+        bucket->bytes += header->dataLength;
+        if (header->info & USBPCAP_INFO_PDO_TO_FDO)
+        {
+            bucket->transfers++;
+            if (header->status != 0)
+            {
+                bucket->errors++;
+            }
+        }
+    }
+
+    return TRUE;
+}
+
+/* Loads previously written sidecar into builder. Returns FALSE if the
+ * sidecar does not exist or is not usable, in which case the capture has
+ * to be processed from the beginning.
+ */
+static BOOL builder_load(pyramid_builder *builder, const char *sidecar)
+{
+    pyramid_view view;
+    UINT32 i;
+    int level;
+
+    if (GetFileAttributesA(sidecar) == INVALID_FILE_ATTRIBUTES)
+    {
+        return FALSE;
+    }
+
+    if (!pyramid_view_open(&view, sidecar))
+    {
+        return FALSE;
+    }
+
+    builder->has_base = TRUE;
+    builder->base_time = view.header->baseTime;
+    builder->source_offset = view.header->sourceOffset;
+
+    for (i = 0; i < view.header->streams; i++)
+    {
+        const PYRAMID_STREAM_ENTRY *entry = &view.streams[i];
+        pyramid_stream *stream;
+
+        stream = builder_get_stream(builder, entry->bus, entry->device, entry->endpoint);
+        if (stream == NULL)
+        {
+            goto error;
+        }
+
+        for (level = 0; level < PYRAMID_LEVELS; level++)
+        {
+            bucket_array *array = &stream->levels[level];
+            UINT32 count = entry->count[level];
+
+            if (count == 0)
+            {
+                continue;
+            }
+
+            array->buckets = malloc(count * sizeof(PYRAMID_BUCKET));
+            if (array->buckets == NULL)
+            {
+                goto error;
+            }
+            memcpy(array->buckets, view.base + entry->offset[level],
+                   count * sizeof(PYRAMID_BUCKET));
+            array->count = count;
+            array->size = count;
+        }
+    }
+
+    pyramid_view_close(&view);
+    return TRUE;
+
+error:
+    pyramid_view_close(&view);
+    builder_free(builder);
+    builder->last_stream = -1;
+    return FALSE;
+}
+
+static BOOL builder_save(pyramid_builder *builder, const char *sidecar)
+{
+    PYRAMID_FILE_HEADER header;
+    PYRAMID_STREAM_ENTRY entry;
+    UINT64 offset;
+    char *tmpname;
+    size_t namelen;
+    FILE *file;
+    UINT32 i;
+    int level;
+
+    namelen = strlen(sidecar) + sizeof(".tmp");
+    tmpname = malloc(namelen);
+    if (tmpname == NULL)
+    {
+        return FALSE;
+    }
+    sprintf_s(tmpname, namelen, "%s.tmp", sidecar);
+
+    if (fopen_s(&file, tmpname, "wb") != 0)
+    {
+        fprintf(stderr, "Failed to create %s\n", tmpname);
+        free(tmpname);
+        return FALSE;
+    }
+
+    memset(&header, 0, sizeof(header));
+    header.magic = PYRAMID_MAGIC;
+    header.version = PYRAMID_VERSION;
+    header.levels = PYRAMID_LEVELS;
+    header.streams = builder->count;
+    header.baseTime = builder->base_time;
+    header.sourceOffset = builder->source_offset;
+    fwrite(&header, sizeof(header), 1, file);
+
+    /* Buckets are stored after the stream table, stream by stream */
+    offset = sizeof(PYRAMID_FILE_HEADER) +
+             (UINT64)builder->count * sizeof(PYRAMID_STREAM_ENTRY);
+    for (i = 0; i < builder->count; i++)
+    {
+        memset(&entry, 0, sizeof(entry));
+        entry.bus = builder->streams[i].bus;
+        entry.device = builder->streams[i].device;
+        entry.endpoint = builder->streams[i].endpoint;
+        for (level = 0; level < PYRAMID_LEVELS; level++)
+        {
+            entry.count[level] = builder->streams[i].levels[level].count;
+            entry.offset[level] = offset;
+            offset += (UINT64)entry.count[level] * sizeof(PYRAMID_BUCKET);
+        }
+        fwrite(&entry, sizeof(entry), 1, file);
+    }
+
+    for (i = 0; i < builder->count; i++)
+    {
+        for (level = 0; level < PYRAMID_LEVELS; level++)
+        {
+            bucket_array *array = &builder->streams[i].levels[level];
+            if (array->count > 0)
+            {
+                fwrite(array->buckets, sizeof(PYRAMID_BUCKET), array->count, file);
+            }
+        }
+    }
+
+    if (ferror(file) || (fclose(file) != 0))
+    {
+        fprintf(stderr, "Failed to write %s\n", tmpname);
+        DeleteFileA(tmpname);
+        free(tmpname);
+        return FALSE;
+    }
+
+    if (!MoveFileExA(tmpname, sidecar, MOVEFILE_REPLACE_EXISTING))
+    {
+        fprintf(stderr, "Failed to replace %s - %d\n", sidecar, GetLastError());
+        DeleteFileA(tmpname);
+        free(tmpname);
+        return FALSE;
+    }
+
+    free(tmpname);
+    return TRUE;
+}
+
+int pyramid_build(const char *capture)
+{
+    pyramid_builder builder;
+    pcap_reader reader;
+    pcaprec_hdr_t hdr;
+    unsigned char *data;
+    char *sidecar;
+    size_t namelen;
+    UINT64 records = 0;
+    int result;
+    int ret = -1;
+
+    memset(&builder, 0, sizeof(builder));
+    builder.last_stream = -1;
+
+    namelen = strlen(capture) + sizeof(".pyr");
+    sidecar = malloc(namelen);
+    if (sidecar == NULL)
+    {
+        return -1;
+    }
+    sprintf_s(sidecar, namelen, "%s.pyr", capture);
+
+    if (!pcap_reader_open(&reader, capture))
+    {
+        free(sidecar);
+        return -1;
+    }
+
+    if (builder_load(&builder, sidecar))
+    {
+        /* Sidecar past end of capture means the capture was overwritten */
+        if ((_fseeki64(reader.file, 0, SEEK_END) != 0) ||
+            (_ftelli64(reader.file) < (__int64)builder.source_offset) ||
+            !pcap_reader_seek(&reader, (__int64)builder.source_offset))
+        {
+            builder_free(&builder);
+            builder.last_stream = -1;
+            pcap_reader_seek(&reader, sizeof(pcap_hdr_t));
+        }
+    }
+
+    while ((result = pcap_reader_next(&reader, &hdr, &data)) == PCAP_READ_RECORD)
+    {
+        PUSBPCAP_BUFFER_PACKET_HEADER header = pcap_usbpcap_header(data, hdr.incl_len);
+
+        if (header == NULL)
+        {
+            continue;
+        }
+
+        if (!builder_add(&builder, pcap_reader_timestamp(&reader, &hdr), header))
+        {
+            goto finish;
+        }
+        records++;
+    }
+
+    if (result == PCAP_READ_ERROR)
+    {
+        goto finish;
+    }
+
+    builder.source_offset = (UINT64)reader.offset;
+    if (builder_save(&builder, sidecar))
+    {
+        fprintf(stderr, "%s: %I64u new records, %u endpoints\n",
+                sidecar, records, builder.count);
+        ret = 0;
+    }
+
+finish:
+    pcap_reader_close(&reader);
+    builder_free(&builder);
+    free(sidecar);
+    return ret;
+}
+
+BOOL pyramid_view_open(pyramid_view *view, const char *sidecar)
+{
+    LARGE_INTEGER size;
+    UINT64 table_end;
+    UINT32 i;
+    int level;
+
+    memset(view, 0, sizeof(pyramid_view));
+    view->mapping = NULL;
+
+    view->file = CreateFileA(sidecar,
+                             GENERIC_READ,
+                             FILE_SHARE_READ | FILE_SHARE_DELETE,
+                             NULL,
+                             OPEN_EXISTING,
+                             FILE_ATTRIBUTE_NORMAL,
+                             NULL);
+    if (view->file == INVALID_HANDLE_VALUE)
+    {
+        fprintf(stderr, "Failed to open %s - %d\n", sidecar, GetLastError());
+        return FALSE;
+    }
+
+    if (!GetFileSizeEx(view->file, &size) ||
+        (size.QuadPart < sizeof(PYRAMID_FILE_HEADER)))
+    {
+        fprintf(stderr, "%s: invalid pyramid file\n", sidecar);
+        goto error;
+    }
+    view->size = (UINT64)size.QuadPart;
+
+    view->mapping = CreateFileMappingA(view->file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (view->mapping == NULL)
+    {
+        fprintf(stderr, "CreateFileMapping failed - %d\n", GetLastError());
+        goto error;
+    }
+
+    view->base = MapViewOfFile(view->mapping, FILE_MAP_READ, 0, 0, 0);
+    if (view->base == NULL)
+    {
+        fprintf(stderr, "MapViewOfFile failed - %d\n", GetLastError());
+        goto error;
+    }
+
+    view->header = (const PYRAMID_FILE_HEADER *)view->base;
+    view->streams = (const PYRAMID_STREAM_ENTRY *)(view->base + sizeof(PYRAMID_FILE_HEADER));
+
+    if ((view->header->magic != PYRAMID_MAGIC) ||
+        (view->header->version != PYRAMID_VERSION) ||
+        (view->header->levels != PYRAMID_LEVELS))
+    {
+        fprintf(stderr, "%s: unsupported pyramid file\n", sidecar);
+        goto error;
+    }
+
+    /* Validate all offsets once so queries do not have to */
+    table_end = sizeof(PYRAMID_FILE_HEADER) +
+                (UINT64)view->header->streams * sizeof(PYRAMID_STREAM_ENTRY);
+    if (table_end > view->size)
+    {
+        fprintf(stderr, "%s: truncated pyramid file\n", sidecar);
+        goto error;
+    }
+
+    for (i = 0; i < view->header->streams; i++)
+    {
+        for (level = 0; level < PYRAMID_LEVELS; level++)
+        {
+            UINT64 end = view->streams[i].offset[level] +
+                         (UINT64)view->streams[i].count[level] * sizeof(PYRAMID_BUCKET);
+
+            if ((view->streams[i].offset[level] < table_end) || (end > view->size))
+            {
+                fprintf(stderr, "%s: truncated pyramid file\n", sidecar);
+                goto error;
+            }
+        }
+    }
+
+    return TRUE;
+
+error:
+    pyramid_view_close(view);
+    return FALSE;
+}
+
+void pyramid_view_close(pyramid_view *view)
+{
+    if (view->base != NULL)
+    {
+        UnmapViewOfFile(view->base);
+    }
+    if (view->mapping != NULL)
+    {
+        CloseHandle(view->mapping);
+    }
+    if ((view->file != NULL) && (view->file != INVALID_HANDLE_VALUE))
+    {
+        CloseHandle(view->file);
+    }
+    memset(view, 0, sizeof(pyramid_view));
+}
+
+int pyramid_view_find_stream(pyramid_view *view, USHORT bus, USHORT device, UCHAR endpoint)
+{
+    UINT32 i;
+
+    for (i = 0; i < view->header->streams; i++)
+    {
+        if ((view->streams[i].bus == bus) &&
+            (view->streams[i].device == device) &&
+            (view->streams[i].endpoint == endpoint))
+        {
+            return (int)i;
+        }
+    }
+
+    return -1;
+}
+
+UINT64 pyramid_query(pyramid_view *view, int stream, UINT64 start, UINT64 end,
+                     UINT32 pixels, pyramid_sample *samples)
+{
+    const PYRAMID_STREAM_ENTRY *entry;
+    const PYRAMID_BUCKET *buckets;
+    UINT64 pixel_width;
+    UINT64 width;
+    UINT64 base;
+    UINT32 first;
+    UINT32 count;
+    UINT32 lo;
+    UINT32 hi;
+    UINT32 i;
+    int level;
+
+    if ((stream < 0) || ((UINT32)stream >= view->header->streams) ||
+        (end <= start) || (pixels == 0))
+    {
+        return 0;
+    }
+
+    memset(samples, 0, pixels * sizeof(pyramid_sample));
+
+    /* Pick the coarsest level with bucket no wider than single sample */
+    pixel_width = (end - start + pixels - 1) / pixels;
+    for (level = PYRAMID_LEVELS - 1; level > 0; level--)
+    {
+        if (level_width(level) <= pixel_width)
+        {
+            break;
+        }
+    }
+
+    entry = &view->streams[stream];
+    width = level_width(level);
+    base = view->header->baseTime;
+    buckets = (const PYRAMID_BUCKET *)(view->base + entry->offset[level]);
+    count = entry->count[level];
+
+    if ((start > base) && ((start - base) / width > MAXUINT32))
+    {
+        /* Range starts past the last bucket that can exist */
+        return width;
+    }
+
+    first = (start > base) ? (UINT32)((start - base) / width) : 0;
+    lo = 0;
+    hi = count;
+    while (lo < hi)
+    {
+        UINT32 mid = lo + (hi - lo) / 2;
+        if (buckets[mid].index < first)
+        {
+            lo = mid + 1;
+        }
+        else
+        {
+            hi = mid;
+        }
+    }
+
+    for (i = lo; i < count; i++)
+    {
+        UINT64 bucket_start = base + (UINT64)buckets[i].index * width;
+        UINT64 pixel;
+
+        if (bucket_start >= end)
+        {
+            break;
+        }
+
+        pixel = (bucket_start > start) ?
+                ((bucket_start - start) * pixels) / (end - start) : 0;
+
+        samples[pixel].bytes += buckets[i].bytes;
+        samples[pixel].transfers += buckets[i].transfers;
+        samples[pixel].errors += buckets[i].errors;
+    }
+
+    return width;
+}
+
+BOOL pyramid_view_range(pyramid_view *view, UINT64 *start, UINT64 *end)
+{
+    UINT64 last = 0;
+    BOOL found = FALSE;
+    UINT32 i;
+
+    /* Level 0 buckets are sorted, so the last one in each stream is the
+     * latest bucket of that stream.
+     */
+    for (i = 0; i < view->header->streams; i++)
+    {
+        UINT32 count = view->streams[i].count[0];
+        const PYRAMID_BUCKET *buckets;
+
+        if (count == 0)
+        {
+            continue;
+        }
+
+        buckets = (const PYRAMID_BUCKET *)(view->base + view->streams[i].offset[0]);
+        if ((found == FALSE) || (buckets[count - 1].index > last))
+        {
+            last = buckets[count - 1].index;
+        }
+        found = TRUE;
+    }
+
+    if (found == FALSE)
+    {
+        return FALSE;
+    }
+
+    *start = view->header->baseTime;
+    *end = view->header->baseTime + (last + 1) * PYRAMID_LEVEL0_USEC;
+    return TRUE;
+}
+
+int pyramid_print(const char *capture, UINT32 pixels)
+{
+    pyramid_view view;
+    pyramid_sample *samples;
+    char *sidecar;
+    size_t namelen;
+    UINT64 start;
+    UINT64 end;
+    UINT32 i;
+
+    if ((pixels == 0) || (pixels > PYRAMID_MAX_SAMPLES))
+    {
+        fprintf(stderr, "Number of samples must be between 1 and %u\n",
+                PYRAMID_MAX_SAMPLES);
+        return -1;
+    }
+
+    namelen = strlen(capture) + sizeof(".pyr");
+    sidecar = malloc(namelen);
+    if (sidecar == NULL)
+    {
+        return -1;
+    }
+    sprintf_s(sidecar, namelen, "%s.pyr", capture);
+
+    if (!pyramid_view_open(&view, sidecar))
+    {
+        free(sidecar);
+        return -1;
+    }
+
+    samples = malloc(pixels * sizeof(pyramid_sample));
+    if (samples == NULL)
+    {
+        pyramid_view_close(&view);
+        free(sidecar);
+        return -1;
+    }
+
+    if (pyramid_view_range(&view, &start, &end))
+    {
+        UINT64 width = 0;
+
+        for (i = 0; i < view.header->streams; i++)
+        {
+            const PYRAMID_STREAM_ENTRY *entry = &view.streams[i];
+            UINT32 pixel;
+
+            width = pyramid_query(&view, (int)i, start, end, pixels, samples);
+            for (pixel = 0; pixel < pixels; pixel++)
+            {
+                UINT64 time = start + ((end - start) * pixel) / pixels;
+
+                printf("sample,%u,%u,0x%02x,%I64u.%06I64u,%I64u,%u,%u\n",
+                       entry->bus, entry->device, entry->endpoint,
+                       time / 1000000, time % 1000000, samples[pixel].bytes,
+                       samples[pixel].transfers, samples[pixel].errors);
+            }
+        }
+
+        fprintf(stderr, "%s: %u endpoints, %u samples from %I64u us buckets\n",
+                sidecar, view.header->streams, pixels, width);
+    }
+
+    free(samples);
+    pyramid_view_close(&view);
+    free(sidecar);
+    return 0;
+}
@@ -0,0 +1,116 @@
+/*
+ * Copyright (c) 2026 Tomasz Moń <desowin@gmail.com>
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#ifndef USBPCAP_CMD_PYRAMID_H
+#define USBPCAP_CMD_PYRAMID_H
+
+#include <windows.h>
+
+/* Throughput pyramid is a sidecar file (<capture>.pyr) that contains
+ * per-(bus, device, endpoint) byte, transfer and error counts aggregated
+ * into 1 ms, 10 ms, 100 ms, 1 s, 10 s, 100 s and 1000 s buckets. Only
+ * non-empty buckets are stored, sorted by bucket index, so any time range
+ * can be answered by a binary search followed by a scan that touches at
+ * most 10 buckets per requested output sample. Bucket indices are 32-bit,
+ * so captures spanning more than 2^32 ms (about 49.7 days) are rejected.
+ *
+ * All multi-byte fields are little endian.
+ */
+#define PYRAMID_MAGIC        0x59505055 /* "UPPY" */
+#define PYRAMID_VERSION      1
+#define PYRAMID_LEVELS       7
+#define PYRAMID_LEVEL0_USEC  1000
+#define PYRAMID_MAX_SAMPLES  1000000
+
+#pragma pack(push, 1)
+typedef struct
+{
+    UINT32  magic;
+    UINT16  version;
+    UINT16  levels;        /* Number of levels (PYRAMID_LEVELS) */
+    UINT32  streams;       /* Number of PYRAMID_STREAM_ENTRY following header */
+    UINT32  reserved;
+    UINT64  baseTime;      /* Bucket 0 start, microseconds since epoch */
+    UINT64  sourceOffset;  /* Capture file bytes already accounted for */
+} PYRAMID_FILE_HEADER, *PPYRAMID_FILE_HEADER;
+
+typedef struct
+{
+    USHORT  bus;
+    USHORT  device;
+    UCHAR   endpoint;
+    UCHAR   reserved[3];
+    UINT32  count[PYRAMID_LEVELS];  /* Number of buckets in each level */
+    UINT64  offset[PYRAMID_LEVELS]; /* File offset of first bucket */
+} PYRAMID_STREAM_ENTRY, *PPYRAMID_STREAM_ENTRY;
+
+typedef struct
+{
+    UINT32  index;      /* Bucket number relative to baseTime */
+    UINT32  transfers;  /* Completed transfers (PDO -> FDO records) */
+    UINT32  errors;     /* Completed transfers with non-zero USBD_STATUS */
+    UINT32  reserved;
+    UINT64  bytes;      /* Payload bytes in both directions */
+} PYRAMID_BUCKET, *PPYRAMID_BUCKET;
+#pragma pack(pop)
+
+typedef struct
+{
+    UINT64  bytes;
+    UINT32  transfers;
+    UINT32  errors;
+} pyramid_sample;
+
+/* Read-only memory-mapped view of pyramid sidecar file */
+typedef struct
+{
+    HANDLE file;
+    HANDLE mapping;
+    const unsigned char *base;
+    UINT64 size;
+    const PYRAMID_FILE_HEADER *header;
+    const PYRAMID_STREAM_ENTRY *streams;
+} pyramid_view;
+
+/* Builds or incrementally updates <capture>.pyr for given capture file.
+ * If the sidecar already exists, only records appended to capture since
+ * the previous run are processed.
+ *
+ * Returns 0 on success, -1 on failure.
+ */
+int pyramid_build(const char *capture);
+
+BOOL pyramid_view_open(pyramid_view *view, const char *sidecar);
+void pyramid_view_close(pyramid_view *view);
+
+/* Returns stream index or -1 if there was no traffic on given endpoint. */
+int pyramid_view_find_stream(pyramid_view *view, USHORT bus, USHORT device, UCHAR endpoint);
+
+/* Fills pixels samples covering time range <start, end) (microseconds since
+ * epoch) for given stream. The coarsest level that still has at least one
+ * bucket per sample is used.
+ *
+ * Returns bucket width in microseconds of the level that was used, 0 on
+ * invalid arguments.
+ */
+UINT64 pyramid_query(pyramid_view *view, int stream, UINT64 start, UINT64 end,
+                     UINT32 pixels, pyramid_sample *samples);
+
+/* Returns FALSE if pyramid is empty. Otherwise sets <start, end) to the
+ * time range covered by level 0 buckets of all streams.
+ */
+BOOL pyramid_view_range(pyramid_view *view, UINT64 *start, UINT64 *end);
+
+/* Splits the whole time range stored in <capture>.pyr into given number
+ * of equally wide samples and prints them for every endpoint as comma
+ * separated values:
+ *   sample,bus,device,endpoint,time,bytes,transfers,errors
+ *
+ * Returns 0 on success, -1 on failure.
+ */
+int pyramid_print(const char *capture, UINT32 samples);
+
+#endif /* USBPCAP_CMD_PYRAMID_H */
@@ -0,0 +1,411 @@
+/*
+ * Copyright (c) 2026 Tomasz Moń <desowin@gmail.com>
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "pcapfile.h"
+#include "reassembly.h"
+
+/* Bulk OUT submissions waiting for completion. Payload is referenced in
+ * the mapped capture, only the pointer is stored.
+ */
+#define REASSEMBLY_PENDING_SLOTS  4096
+#define REASSEMBLY_PENDING_PROBES 16
+
+/* stdio buffer size for every output file */
+#define REASSEMBLY_FILE_BUFFER    (1024 * 1024)
+
+typedef struct
+{
+    BOOL valid;
+    UINT64 irpId;
+    USHORT bus;
+    USHORT device;
+    UCHAR endpoint;
+    UINT64 record_offset;
+    const unsigned char *data;
+    UINT32 length;
+} reassembly_pending;
+
+typedef struct _reassembly_stream
+{
+    USHORT bus;
+    USHORT device;
+    UCHAR endpoint;
+    UINT64 offset;
+    struct _reassembly_stream *next;
+} reassembly_stream;
+
+typedef struct
+{
+    reassembly_callback callback;
+    void *ctx;
+    reassembly_stream *streams;
+    reassembly_pending *pending;
+} reassembly_context;
+
+static reassembly_stream *reassembly_get_stream(reassembly_context *ctx,
+                                                USHORT bus, USHORT device,
+                                                UCHAR endpoint)
+{
+    reassembly_stream *stream;
+    reassembly_stream *prev = NULL;
+
+    for (stream = ctx->streams; stream; prev = stream, stream = stream->next)
+    {
+        if ((stream->bus == bus) && (stream->device == device) &&
+            (stream->endpoint == endpoint))
+        {
+            if (prev != NULL)
+            {
+                prev->next = stream->next;
+                stream->next = ctx->streams;
+                ctx->streams = stream;
+            }
+            return stream;
+        }
+    }
+
+    stream = (reassembly_stream *)calloc(1, sizeof(reassembly_stream));
+    if (stream != NULL)
+    {
+        stream->bus = bus;
+        stream->device = device;
+        stream->endpoint = endpoint;
+        stream->next = ctx->streams;
+        ctx->streams = stream;
+    }
+    return stream;
+}
+
+static BOOL reassembly_deliver(reassembly_context *ctx, USHORT bus, USHORT device,
+                               UCHAR endpoint, UINT64 timestamp, UINT64 record_offset,
+                               const unsigned char *data, UINT32 length)
+{
+    reassembly_stream *stream;
+
+    if (length == 0)
+    {
+        return TRUE;
+    }
+
+    stream = reassembly_get_stream(ctx, bus, device, endpoint);
+    if (stream == NULL)
+    {
+        return FALSE;
+    }
+
+    ctx->callback(ctx->ctx, bus, device, endpoint, stream->offset,
+                  timestamp, record_offset, data, length);
+    stream->offset += length;
+    return TRUE;
+}
+
+static reassembly_pending *reassembly_find_pending(reassembly_context *ctx,
+                                                   PUSBPCAP_BUFFER_PACKET_HEADER header)
+{
+    UINT32 slot = (UINT32)((header->irpId >> 4) % REASSEMBLY_PENDING_SLOTS);
+    int i;
+
+    for (i = 0; i < REASSEMBLY_PENDING_PROBES; i++)
+    {
+        reassembly_pending *p = &ctx->pending[(slot + i) % REASSEMBLY_PENDING_SLOTS];
+
+        if (p->valid && (p->irpId == header->irpId) && (p->bus == header->bus) &&
+            (p->device == header->device) && (p->endpoint == header->endpoint))
+        {
+            return p;
+        }
+    }
+
+    return NULL;
+}
+
+static BOOL reassembly_add_pending(reassembly_context *ctx, UINT64 timestamp,
+                                   UINT64 record_offset,
+                                   PUSBPCAP_BUFFER_PACKET_HEADER header,
+                                   const unsigned char *data, UINT32 length)
+{
+    /* IRP pointers are at least 16 byte aligned */
+    UINT32 slot = (UINT32)((header->irpId >> 4) % REASSEMBLY_PENDING_SLOTS);
+    reassembly_pending *p;
+    int i;
+
+    /* IRP cannot be resubmitted before it completes, so an existing entry
+     * lost its completion (driver dropped it when buffer was full). Its
+     * status is unknown and the payload is dropped, otherwise the next
+     * completion would deliver the stale payload.
+     */
+    p = reassembly_find_pending(ctx, header);
+    if (p != NULL)
+    {
+        p->valid = FALSE;
+    }
+    else
+    {
+        for (i = 0; i < REASSEMBLY_PENDING_PROBES; i++)
+        {
+            p = &ctx->pending[(slot + i) % REASSEMBLY_PENDING_SLOTS];
+            if (!p->valid)
+            {
+                break;
+            }
+        }
+    }
+
+    if (p->valid)
+    {
+        /* Table is full around this slot. Deliver the occupant now, in
+         * submission order, rather than growing the table.
+         */
+        if (!reassembly_deliver(ctx, p->bus, p->device, p->endpoint, timestamp,
+                                p->record_offset, p->data, p->length))
+        {
+            return FALSE;
+        }
+    }
+
+    p->valid = TRUE;
+    p->irpId = header->irpId;
+    p->bus = header->bus;
+    p->device = header->device;
+    p->endpoint = header->endpoint;
+    p->record_offset = record_offset;
+    p->data = data;
+    p->length = length;
+    return TRUE;
+}
+
+int reassemble_capture(const char *capture, reassembly_callback callback, void *user)
+{
+    reassembly_context ctx;
+    pcap_map map;
+    const pcaprec_hdr_t *hdr;
+    const unsigned char *data;
+    int ret = 0;
+
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.callback = callback;
+    ctx.ctx = user;
+    ctx.pending = (reassembly_pending *)calloc(REASSEMBLY_PENDING_SLOTS,
+                                               sizeof(reassembly_pending));
+    if (ctx.pending == NULL)
+    {
+        return -1;
+    }
+
+    if (!pcap_map_open(&map, capture))
+    {
+        free(ctx.pending);
+        return -1;
+    }
+
+    while (pcap_map_next(&map, &hdr, &data) == PCAP_READ_RECORD)
+    {
+        PUSBPCAP_BUFFER_PACKET_HEADER header = pcap_usbpcap_header(data, hdr->incl_len);
+        UINT64 record_offset = map.offset - hdr->incl_len - sizeof(pcaprec_hdr_t);
+        const unsigned char *payload;
+        UINT32 length;
+        BOOL completion;
+
+        if ((header == NULL) || (header->transfer != USBPCAP_TRANSFER_BULK))
+        {
+            continue;
+        }
+
+        /* Only captured bytes can be delivered if snaplen truncated data */
+        payload = data + header->headerLen;
+        length = min(header->dataLength, hdr->incl_len - header->headerLen);
+        completion = (header->info & USBPCAP_INFO_PDO_TO_FDO) ? TRUE : FALSE;
+
+        if (header->endpoint & 0x80)
+        {
+            if (completion && (header->status == 0) &&
+                !reassembly_deliver(&ctx, header->bus, header->device, header->endpoint,
+                                    pcap_map_timestamp(&map, hdr), record_offset,
+                                    payload, length))
+            {
+                ret = -1;
+                break;
+            }
+        }
+        else if (!completion)
+        {
+            if ((length > 0) &&
+                !reassembly_add_pending(&ctx, pcap_map_timestamp(&map, hdr),
+                                        record_offset, header, payload, length))
+            {
+                ret = -1;
+                break;
+            }
+        }
+        else
+        {
+            reassembly_pending *p = reassembly_find_pending(&ctx, header);
+
+            if (p != NULL)
+            {
+                p->valid = FALSE;
+                if ((header->status == 0) &&
+                    !reassembly_deliver(&ctx, p->bus, p->device, p->endpoint,
+                                        pcap_map_timestamp(&map, hdr),
+                                        p->record_offset, p->data, p->length))
+                {
+                    ret = -1;
+                    break;
+                }
+            }
+        }
+    }
+
+    while (ctx.streams != NULL)
+    {
+        reassembly_stream *stream = ctx.streams;
+        ctx.streams = stream->next;
+        free(stream);
+    }
+    free(ctx.pending);
+    pcap_map_close(&map);
+    return ret;
+}
+
+typedef struct _reassembly_file
+{
+    USHORT bus;
+    USHORT device;
+    UCHAR endpoint;
+    FILE *data;
+    FILE *index;
+    struct _reassembly_file *next;
+} reassembly_file;
+
+typedef struct
+{
+    const char *capture;
+    size_t base_length;
+    reassembly_file *files;
+    BOOL failed;
+} reassembly_file_context;
+
+static FILE *reassembly_open(reassembly_file_context *ctx, USHORT bus,
+                             USHORT device, UCHAR endpoint, const char *extension)
+{
+    char *filename;
+    size_t length;
+    FILE *file;
+
+    length = ctx->base_length + 40;
+    filename = malloc(length);
+    if (filename == NULL)
+    {
+        return NULL;
+    }
+
+    sprintf_s(filename, length, "%.*s_bus%u_dev%u_ep%02x.%s",
+              (int)ctx->base_length, ctx->capture, bus, device, endpoint, extension);
+    if (fopen_s(&file, filename, "wb") != 0)
+    {
+        fprintf(stderr, "Failed to create %s\n", filename);
+        file = NULL;
+    }
+    else
+    {
+        setvbuf(file, NULL, _IOFBF, REASSEMBLY_FILE_BUFFER);
+    }
+
+    free(filename);
+    return file;
+}
+
+static void reassembly_file_callback(void *param, USHORT bus, USHORT device,
+                                     UCHAR endpoint, UINT64 stream_offset,
+                                     UINT64 timestamp, UINT64 record_offset,
+                                     const unsigned char *data, UINT32 length)
+{
+    reassembly_file_context *ctx = (reassembly_file_context *)param;
+    reassembly_file *file;
+    REASSEMBLY_INDEX_ENTRY entry;
+
+    for (file = ctx->files; file; file = file->next)
+    {
+        if ((file->bus == bus) && (file->device == device) &&
+            (file->endpoint == endpoint))
+        {
+            break;
+        }
+    }
+
+    if (file == NULL)
+    {
+        file = (reassembly_file *)calloc(1, sizeof(reassembly_file));
+        if (file == NULL)
+        {
+            ctx->failed = TRUE;
+            return;
+        }
+        file->bus = bus;
+        file->device = device;
+        file->endpoint = endpoint;
+        file->next = ctx->files;
+        ctx->files = file;
+
+        file->data = reassembly_open(ctx, bus, device, endpoint, "bin");
+        file->index = reassembly_open(ctx, bus, device, endpoint, "idx");
+    }
+
+    if ((file->data == NULL) || (file->index == NULL))
+    {
+        ctx->failed = TRUE;
+        return;
+    }
+
+    entry.streamOffset = stream_offset;
+    entry.timestamp = timestamp;
+    entry.recordOffset = record_offset;
+
+    if ((fwrite(data, 1, length, file->data) != length) ||
+        (fwrite(&entry, sizeof(entry), 1, file->index) != 1))
+    {
+        ctx->failed = TRUE;
+    }
+}
+
+int reassemble_to_files(const char *capture)
+{
+    reassembly_file_context ctx;
+    int ret;
+
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.capture = capture;
+    ctx.base_length = pcap_base_length(capture);
+
+    ret = reassemble_capture(capture, reassembly_file_callback, &ctx);
+
+    while (ctx.files != NULL)
+    {
+        reassembly_file *file = ctx.files;
+        ctx.files = file->next;
+
+        if ((file->data != NULL) && (fclose(file->data) != 0))
+        {
+            ctx.failed = TRUE;
+        }
+        if ((file->index != NULL) && (fclose(file->index) != 0))
+        {
+            ctx.failed = TRUE;
+        }
+        free(file);
+    }
+
+    if (ctx.failed)
+    {
+        fprintf(stderr, "Failed to write reassembled streams\n");
+        ret = -1;
+    }
+
+    return ret;
+}
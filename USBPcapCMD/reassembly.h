@@ -0,0 +1,47 @@
+/*
+ * Copyright (c) 2026 Tomasz Moń <desowin@gmail.com>
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#ifndef USBPCAP_CMD_REASSEMBLY_H
+#define USBPCAP_CMD_REASSEMBLY_H
+
+#include <windows.h>
+
+/* Called for every chunk of bulk payload in completion order.
+ *
+ * stream_offset - offset of data within (bus, device, endpoint) stream
+ * timestamp - completion time in microseconds since epoch
+ * record_offset - capture file offset of the record that carries data
+ * data - pointer into memory-mapped capture, valid only during the call
+ */
+typedef void (*reassembly_callback)(void *ctx, USHORT bus, USHORT device,
+                                    UCHAR endpoint, UINT64 stream_offset,
+                                    UINT64 timestamp, UINT64 record_offset,
+                                    const unsigned char *data, UINT32 length);
+
+/* Reassembles bulk IN data (attached to completions) and bulk OUT data
+ * (attached to submissions, delivered once the matching irpId completes
+ * successfully) into per-endpoint byte streams.
+ *
+ * Returns 0 on success, -1 on failure.
+ */
+int reassemble_capture(const char *capture, reassembly_callback callback, void *ctx);
+
+/* Writes every stream to <capture>_bus<B>_dev<D>_ep<EP>.bin together with
+ * .idx side index. Index is array of REASSEMBLY_INDEX_ENTRY, one for every
+ * chunk, that maps stream offsets back to capture records.
+ */
+int reassemble_to_files(const char *capture);
+
+#pragma pack(push, 1)
+typedef struct
+{
+    UINT64  streamOffset;
+    UINT64  timestamp;     /* Microseconds since epoch */
+    UINT64  recordOffset;  /* Capture file offset of pcaprec_hdr_t */
+} REASSEMBLY_INDEX_ENTRY, *PREASSEMBLY_INDEX_ENTRY;
+#pragma pack(pop)
+
+#endif /* USBPCAP_CMD_REASSEMBLY_H */
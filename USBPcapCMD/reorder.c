@@ -0,0 +1,845 @@
+/*
+ * Copyright (c) 2026 Tomasz Moń <desowin@gmail.com>
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <io.h>
+#include "pcapfile.h"
+#include "reorder.h"
+
+/* Ordered records are collected and handed to sink in chunks of this size */
+#define REORDER_OUTPUT_SIZE  (256 * 1024)
+
+/* Output and run files are accessed through large stdio buffer */
+#define REORDER_FILE_BUFFER  (4 * 1024 * 1024)
+
+/* Maximum number of runs merged at once. More runs are merged in passes. */
+#define REORDER_MERGE_FANIN  64
+
+typedef struct
+{
+    UINT64 key;             /* Timestamp, seconds in upper 32 bits */
+    UINT64 order;           /* Arrival number, keeps equal timestamps in order */
+    UINT32 length;          /* pcaprec_hdr_t and record data */
+    UINT32 size;            /* Allocated size of data */
+    unsigned char *data;
+} reorder_slot;
+
+struct _reorder_stage
+{
+    UINT32 window;
+    reorder_slot *slots;    /* window + 1 slots, spare one receives record */
+    UINT32 *heap;           /* Min-heap of slot indices */
+    UINT32 count;
+    UINT32 *free;           /* Stack of slots not in heap */
+    UINT32 free_count;
+
+    UINT32 current;         /* Slot receiving record from reorder_feed() */
+    UINT32 received;        /* Bytes of current record received so far */
+    BOOL receiving;
+
+    UINT64 order;
+    UINT64 last_key;        /* Key of last written record */
+    BOOL written;
+    UINT64 late;
+
+    unsigned char *output;
+    DWORD output_used;
+    reorder_sink sink;
+    void *ctx;
+
+    /* Used only by reorder_capture(). Records older than last written one
+     * are collected in late slots, which are sorted and spilled to run file
+     * whenever all window slots are used.
+     */
+    BOOL spill;
+    reorder_slot *late_slots;
+    UINT32 late_count;
+    FILE **runs;
+    int run_count;
+    int run_size;
+    BOOL failed;
+};
+
+static UINT64 reorder_key(const pcaprec_hdr_t *hdr)
+{
+    return (((UINT64)hdr->ts_sec) << 32) | hdr->ts_usec;
+}
+
+static BOOL reorder_less(const reorder_slot *a, const reorder_slot *b)
+{
+    if (a->key != b->key)
+    {
+        return (a->key < b->key);
+    }
+    return (a->order < b->order);
+}
+
+static BOOL reorder_reserve(reorder_slot *slot, UINT32 length)
+{
+    if (length > slot->size)
+    {
+        unsigned char *tmp = realloc(slot->data, length);
+        if (tmp == NULL)
+        {
+            fprintf(stderr, "Failed to allocate %u bytes reorder slot\n", length);
+            return FALSE;
+        }
+        slot->data = tmp;
+        slot->size = length;
+    }
+    return TRUE;
+}
+
+static void reorder_output_flush(reorder_stage *stage)
+{
+    if (stage->output_used > 0)
+    {
+        stage->sink(stage->ctx, stage->output, stage->output_used);
+        stage->output_used = 0;
+    }
+}
+
+static void reorder_write(reorder_stage *stage, const reorder_slot *slot)
+{
+    if (stage->output_used + slot->length > REORDER_OUTPUT_SIZE)
+    {
+        reorder_output_flush(stage);
+    }
+
+    if (slot->length > REORDER_OUTPUT_SIZE)
+    {
+        stage->sink(stage->ctx, slot->data, slot->length);
+    }
+    else
+    {
+        memcpy(&stage->output[stage->output_used], slot->data, slot->length);
+        stage->output_used += slot->length;
+    }
+
+    stage->last_key = slot->key;
+    stage->written = TRUE;
+}
+
+static void reorder_sift_down(reorder_stage *stage, UINT32 i)
+{
+    UINT32 index = stage->heap[i];
+
+    for (;;)
+    {
+        UINT32 child = 2 * i + 1;
+
+        if (child >= stage->count)
+        {
+            break;
+        }
+        if ((child + 1 < stage->count) &&
+            reorder_less(&stage->slots[stage->heap[child + 1]],
+                         &stage->slots[stage->heap[child]]))
+        {
+            child++;
+        }
+        if (!reorder_less(&stage->slots[stage->heap[child]], &stage->slots[index]))
+        {
+            break;
+        }
+        stage->heap[i] = stage->heap[child];
+        i = child;
+    }
+    stage->heap[i] = index;
+}
+
+static void reorder_sift_up(reorder_stage *stage, UINT32 i)
+{
+    UINT32 index = stage->heap[i];
+
+    while (i > 0)
+    {
+        UINT32 parent = (i - 1) / 2;
+
+        if (!reorder_less(&stage->slots[index], &stage->slots[stage->heap[parent]]))
+        {
+            break;
+        }
+        stage->heap[i] = stage->heap[parent];
+        i = parent;
+    }
+    stage->heap[i] = index;
+}
+
+static FILE *reorder_temp_file(void)
+{
+    char dir[MAX_PATH];
+    char name[MAX_PATH];
+    FILE *file;
+    int fd;
+
+    if ((GetTempPathA(MAX_PATH, dir) == 0) || (GetTempFileNameA(dir, "upc", 0, name) == 0))
+    {
+        fprintf(stderr, "Failed to get temporary file name - %d\n", GetLastError());
+        return NULL;
+    }
+
+    /* File is deleted once closed */
+    fd = _open(name, _O_RDWR | _O_BINARY | _O_TRUNC | _O_TEMPORARY);
+    if (fd == -1)
+    {
+        fprintf(stderr, "Failed to open %s\n", name);
+        DeleteFileA(name);
+        return NULL;
+    }
+
+    file = _fdopen(fd, "w+b");
+    if (file == NULL)
+    {
+        _close(fd);
+        return NULL;
+    }
+
+    setvbuf(file, NULL, _IOFBF, REORDER_FILE_BUFFER);
+    return file;
+}
+
+static BOOL reorder_add_run(reorder_stage *stage, FILE *run)
+{
+    if (stage->run_count == stage->run_size)
+    {
+        int size = (stage->run_size == 0) ? 16 : stage->run_size * 2;
+        FILE **tmp = realloc(stage->runs, size * sizeof(FILE *));
+        if (tmp == NULL)
+        {
+            return FALSE;
+        }
+        stage->runs = tmp;
+        stage->run_size = size;
+    }
+
+    stage->runs[stage->run_count++] = run;
+    return TRUE;
+}
+
+static int reorder_compare_slots(const void *a, const void *b)
+{
+    if (reorder_less((const reorder_slot *)a, (const reorder_slot *)b))
+    {
+        return -1;
+    }
+    return reorder_less((const reorder_slot *)b, (const reorder_slot *)a) ? 1 : 0;
+}
+
+static void reorder_spill(reorder_stage *stage)
+{
+    FILE *run;
+    UINT32 i;
+
+    if (stage->late_count == 0)
+    {
+        return;
+    }
+
+    qsort(stage->late_slots, stage->late_count, sizeof(reorder_slot),
+          reorder_compare_slots);
+
+    run = reorder_temp_file();
+    if ((run == NULL) || !reorder_add_run(stage, run))
+    {
+        if (run != NULL)
+        {
+            fclose(run);
+        }
+        stage->failed = TRUE;
+        stage->late_count = 0;
+        return;
+    }
+
+    for (i = 0; i < stage->late_count; i++)
+    {
+        fwrite(stage->late_slots[i].data, 1, stage->late_slots[i].length, run);
+    }
+    if (ferror(run))
+    {
+        fprintf(stderr, "Failed to write reorder run\n");
+        stage->failed = TRUE;
+    }
+    stage->late_count = 0;
+}
+
+/* Places complete record from current slot in the window. Current slot
+ * must be already taken off the free stack.
+ */
+static void reorder_insert(reorder_stage *stage)
+{
+    UINT32 current = stage->current;
+    reorder_slot *slot = &stage->slots[current];
+
+    slot->key = reorder_key((const pcaprec_hdr_t *)slot->data);
+    slot->order = stage->order++;
+    stage->receiving = FALSE;
+
+    if (stage->written && (slot->key < stage->last_key))
+    {
+        if (stage->spill)
+        {
+            /* Swap buffers so the record does not have to be copied */
+            reorder_slot tmp = stage->late_slots[stage->late_count];
+            stage->late_slots[stage->late_count] = *slot;
+            *slot = tmp;
+            stage->late_count++;
+            if (stage->late_count == stage->window)
+            {
+                reorder_spill(stage);
+            }
+        }
+        else
+        {
+            reorder_write(stage, slot);
+        }
+        stage->late++;
+        stage->free[stage->free_count++] = current;
+    }
+    else if (stage->count < stage->window)
+    {
+        stage->heap[stage->count++] = current;
+        reorder_sift_up(stage, stage->count - 1);
+    }
+    else if (reorder_less(slot, &stage->slots[stage->heap[0]]))
+    {
+        /* Oldest record in window, no need to put it into heap */
+        reorder_write(stage, slot);
+        stage->free[stage->free_count++] = current;
+    }
+    else
+    {
+        UINT32 top = stage->heap[0];
+
+        reorder_write(stage, &stage->slots[top]);
+        stage->free[stage->free_count++] = top;
+        stage->heap[0] = current;
+        reorder_sift_down(stage, 0);
+    }
+}
+
+static reorder_stage *reorder_init(UINT32 window, BOOL spill,
+                                   reorder_sink sink, void *ctx)
+{
+    reorder_stage *stage;
+    UINT32 i;
+
+    if (window == 0)
+    {
+        window = 1;
+    }
+
+    stage = (reorder_stage *)calloc(1, sizeof(reorder_stage));
+    if (stage == NULL)
+    {
+        return NULL;
+    }
+
+    stage->window = window;
+    stage->sink = sink;
+    stage->ctx = ctx;
+    stage->spill = spill;
+    stage->slots = (reorder_slot *)calloc(window + 1, sizeof(reorder_slot));
+    stage->heap = (UINT32 *)malloc(window * sizeof(UINT32));
+    stage->free = (UINT32 *)malloc((window + 1) * sizeof(UINT32));
+    stage->output = (unsigned char *)malloc(REORDER_OUTPUT_SIZE);
+    if (spill)
+    {
+        stage->late_slots = (reorder_slot *)calloc(window, sizeof(reorder_slot));
+    }
+
+    if ((stage->slots == NULL) || (stage->heap == NULL) ||
+        (stage->free == NULL) || (stage->output == NULL) ||
+        (spill && (stage->late_slots == NULL)))
+    {
+        fprintf(stderr, "Failed to allocate reorder window of %u records\n", window);
+        reorder_destroy(stage);
+        return NULL;
+    }
+
+    for (i = 0; i <= window; i++)
+    {
+        stage->free[i] = window - i;
+    }
+    stage->free_count = window + 1;
+
+    return stage;
+}
+
+reorder_stage *reorder_create(UINT32 window, reorder_sink sink, void *ctx)
+{
+    return reorder_init(window, FALSE, sink, ctx);
+}
+
+void reorder_destroy(reorder_stage *stage)
+{
+    UINT32 i;
+    int run;
+
+    if (stage->slots != NULL)
+    {
+        for (i = 0; i <= stage->window; i++)
+        {
+            free(stage->slots[i].data);
+        }
+        free(stage->slots);
+    }
+    if (stage->late_slots != NULL)
+    {
+        for (i = 0; i < stage->window; i++)
+        {
+            free(stage->late_slots[i].data);
+        }
+        free(stage->late_slots);
+    }
+    for (run = 0; run < stage->run_count; run++)
+    {
+        fclose(stage->runs[run]);
+    }
+    free(stage->runs);
+    free(stage->heap);
+    free(stage->free);
+    free(stage->output);
+    free(stage);
+}
+
+BOOL reorder_feed(reorder_stage *stage, const unsigned char *data, DWORD length)
+{
+    while (length > 0)
+    {
+        reorder_slot *slot;
+        UINT32 needed;
+        UINT32 to_copy;
+
+        if (!stage->receiving)
+        {
+            stage->current = stage->free[--stage->free_count];
+            stage->received = 0;
+            stage->receiving = TRUE;
+        }
+        slot = &stage->slots[stage->current];
+
+        if (stage->received < sizeof(pcaprec_hdr_t))
+        {
+            needed = sizeof(pcaprec_hdr_t);
+        }
+        else
+        {
+            needed = sizeof(pcaprec_hdr_t) + ((pcaprec_hdr_t *)slot->data)->incl_len;
+        }
+
+        if (!reorder_reserve(slot, needed))
+        {
+            /* Put the slot back, stage is left in consistent state */
+            stage->free[stage->free_count++] = stage->current;
+            stage->receiving = FALSE;
+            return FALSE;
+        }
+
+        to_copy = min(needed - stage->received, length);
+        memcpy(&slot->data[stage->received], data, to_copy);
+        stage->received += to_copy;
+        data += to_copy;
+        length -= to_copy;
+
+        if ((stage->received == sizeof(pcaprec_hdr_t)) &&
+            (((pcaprec_hdr_t *)slot->data)->incl_len > 0))
+        {
+            /* Header complete, record data follows */
+            continue;
+        }
+
+        if (stage->received == needed)
+        {
+            slot->length = needed;
+            reorder_insert(stage);
+        }
+    }
+
+    reorder_output_flush(stage);
+    return TRUE;
+}
+
+void reorder_flush(reorder_stage *stage)
+{
+    while (stage->count > 0)
+    {
+        UINT32 top = stage->heap[0];
+
+        reorder_write(stage, &stage->slots[top]);
+        stage->free[stage->free_count++] = top;
+        stage->heap[0] = stage->heap[--stage->count];
+        if (stage->count > 0)
+        {
+            reorder_sift_down(stage, 0);
+        }
+    }
+    reorder_output_flush(stage);
+}
+
+UINT32 reorder_pending(reorder_stage *stage)
+{
+    return stage->count;
+}
+
+UINT64 reorder_late(reorder_stage *stage)
+{
+    return stage->late;
+}
+
+typedef struct
+{
+    FILE *file;
+    int index;              /* Run number, earlier run wins on equal keys */
+    UINT64 key;
+    pcaprec_hdr_t hdr;
+    unsigned char *data;
+    UINT32 size;
+} reorder_cursor;
+
+static BOOL reorder_cursor_less(const reorder_cursor *a, const reorder_cursor *b)
+{
+    if (a->key != b->key)
+    {
+        return (a->key < b->key);
+    }
+    return (a->index < b->index);
+}
+
+/* Returns 1 if record was read, 0 at the end of run, -1 on error */
+static int reorder_cursor_next(reorder_cursor *cursor)
+{
+    if (fread(&cursor->hdr, sizeof(pcaprec_hdr_t), 1, cursor->file) != 1)
+    {
+        return ferror(cursor->file) ? -1 : 0;
+    }
+
+    if (cursor->hdr.incl_len > cursor->size)
+    {
+        unsigned char *tmp = realloc(cursor->data, cursor->hdr.incl_len);
+        if (tmp == NULL)
+        {
+            return -1;
+        }
+        cursor->data = tmp;
+        cursor->size = cursor->hdr.incl_len;
+    }
+
+    if ((cursor->hdr.incl_len > 0) &&
+        (fread(cursor->data, cursor->hdr.incl_len, 1, cursor->file) != 1))
+    {
+        return -1;
+    }
+
+    cursor->key = reorder_key(&cursor->hdr);
+    return 1;
+}
+
+/* Merges sorted runs into output. Run files are read from the current
+ * position to the end.
+ */
+static BOOL reorder_merge(FILE **runs, int count, FILE *output)
+{
+    reorder_cursor cursors[REORDER_MERGE_FANIN];
+    reorder_cursor *heap[REORDER_MERGE_FANIN];
+    int heap_count = 0;
+    BOOL ok = TRUE;
+    int i;
+
+    memset(cursors, 0, sizeof(cursors));
+
+    for (i = 0; i < count; i++)
+    {
+        int result;
+
+        cursors[i].file = runs[i];
+        cursors[i].index = i;
+        result = reorder_cursor_next(&cursors[i]);
+        if (result < 0)
+        {
+            ok = FALSE;
+        }
+        else if (result > 0)
+        {
+            int j = heap_count++;
+
+            while ((j > 0) && reorder_cursor_less(&cursors[i], heap[(j - 1) / 2]))
+            {
+                heap[j] = heap[(j - 1) / 2];
+                j = (j - 1) / 2;
+            }
+            heap[j] = &cursors[i];
+        }
+    }
+
+    while (ok && (heap_count > 0))
+    {
+        reorder_cursor *top = heap[0];
+        int result;
+        int j;
+
+        fwrite(&top->hdr, sizeof(pcaprec_hdr_t), 1, output);
+        fwrite(top->data, 1, top->hdr.incl_len, output);
+
+        result = reorder_cursor_next(top);
+        if (result < 0)
+        {
+            ok = FALSE;
+            break;
+        }
+        else if (result == 0)
+        {
+            top = heap[--heap_count];
+        }
+
+        /* Sift top down from the root */
+        j = 0;
+        for (;;)
+        {
+            int child = 2 * j + 1;
+
+            if (child >= heap_count)
+            {
+                break;
+            }
+            if ((child + 1 < heap_count) &&
+                reorder_cursor_less(heap[child + 1], heap[child]))
+            {
+                child++;
+            }
+            if (!reorder_cursor_less(heap[child], top))
+            {
+                break;
+            }
+            heap[j] = heap[child];
+            j = child;
+        }
+        if (heap_count > 0)
+        {
+            heap[j] = top;
+        }
+    }
+
+    for (i = 0; i < count; i++)
+    {
+        free(cursors[i].data);
+    }
+
+    if (!ok)
+    {
+        fprintf(stderr, "Failed to read reorder run\n");
+    }
+    return ok && !ferror(output);
+}
+
+/* Merges spilled runs until they can be merged with output in one pass */
+static BOOL reorder_merge_runs(reorder_stage *stage)
+{
+    while (stage->run_count > REORDER_MERGE_FANIN - 1)
+    {
+        FILE *merged = reorder_temp_file();
+        int i;
+
+        if ((merged == NULL) || !reorder_add_run(stage, merged))
+        {
+            if (merged != NULL)
+            {
+                fclose(merged);
+            }
+            return FALSE;
+        }
+
+        for (i = 0; i < REORDER_MERGE_FANIN; i++)
+        {
+            rewind(stage->runs[i]);
+        }
+        if (!reorder_merge(stage->runs, REORDER_MERGE_FANIN, merged))
+        {
+            return FALSE;
+        }
+
+        for (i = 0; i < REORDER_MERGE_FANIN; i++)
+        {
+            fclose(stage->runs[i]);
+        }
+        stage->run_count -= REORDER_MERGE_FANIN;
+        memmove(stage->runs, &stage->runs[REORDER_MERGE_FANIN],
+                stage->run_count * sizeof(FILE *));
+    }
+
+    return TRUE;
+}
+
+static void reorder_file_sink(void *ctx, const unsigned char *data, DWORD length)
+{
+    fwrite(data, 1, length, (FILE *)ctx);
+}
+
+int reorder_capture(const char *capture, UINT32 window)
+{
+    pcap_reader reader;
+    pcaprec_hdr_t hdr;
+    unsigned char *data;
+    reorder_stage *stage = NULL;
+    size_t base_length = pcap_base_length(capture);
+    char *output_name = NULL;
+    char *merged_name = NULL;
+    FILE *output = NULL;
+    FILE *merged = NULL;
+    UINT64 records = 0;
+    int runs = 0;
+    int i;
+    int result = PCAP_READ_ERROR;
+    int ret = -1;
+    size_t length;
+
+    if (!pcap_reader_open(&reader, capture))
+    {
+        return -1;
+    }
+
+    length = base_length + sizeof("_reordered.pcap.tmp");
+    output_name = malloc(length);
+    merged_name = malloc(length);
+    if ((output_name == NULL) || (merged_name == NULL))
+    {
+        goto cleanup;
+    }
+    sprintf_s(output_name, length, "%.*s_reordered.pcap", (int)base_length, capture);
+    sprintf_s(merged_name, length, "%s.tmp", output_name);
+
+    /* Opened for update, so it can be read back as the first run */
+    if (fopen_s(&output, output_name, "w+b") != 0)
+    {
+        fprintf(stderr, "Failed to create %s\n", output_name);
+        output = NULL;
+        goto cleanup;
+    }
+    setvbuf(output, NULL, _IOFBF, REORDER_FILE_BUFFER);
+
+    stage = reorder_init(window, TRUE, reorder_file_sink, output);
+    if (stage == NULL)
+    {
+        goto cleanup;
+    }
+
+    fwrite(&reader.header, sizeof(pcap_hdr_t), 1, output);
+
+    while ((result = pcap_reader_next(&reader, &hdr, &data)) == PCAP_READ_RECORD)
+    {
+        reorder_slot *slot;
+
+        stage->current = stage->free[stage->free_count - 1];
+        slot = &stage->slots[stage->current];
+        if (!reorder_reserve(slot, sizeof(pcaprec_hdr_t) + hdr.incl_len))
+        {
+            result = PCAP_READ_ERROR;
+            break;
+        }
+        memcpy(slot->data, &hdr, sizeof(pcaprec_hdr_t));
+        memcpy(&slot->data[sizeof(pcaprec_hdr_t)], data, hdr.incl_len);
+        slot->length = sizeof(pcaprec_hdr_t) + hdr.incl_len;
+
+        stage->free_count--;
+        reorder_insert(stage);
+        reorder_output_flush(stage);
+        records++;
+
+        if (stage->failed)
+        {
+            result = PCAP_READ_ERROR;
+            break;
+        }
+    }
+
+    if (result != PCAP_READ_EOF)
+    {
+        goto cleanup;
+    }
+
+    reorder_flush(stage);
+    reorder_spill(stage);
+    if (stage->failed || !reorder_merge_runs(stage) || ferror(output))
+    {
+        goto cleanup;
+    }
+    runs = stage->run_count;
+
+    if (runs > 0)
+    {
+        FILE **inputs;
+
+        /* Merge records written so far with the spilled runs */
+        if (fopen_s(&merged, merged_name, "wb") != 0)
+        {
+            fprintf(stderr, "Failed to create %s\n", merged_name);
+            merged = NULL;
+            goto cleanup;
+        }
+        setvbuf(merged, NULL, _IOFBF, REORDER_FILE_BUFFER);
+        fwrite(&reader.header, sizeof(pcap_hdr_t), 1, merged);
+
+        inputs = malloc((runs + 1) * sizeof(FILE *));
+        if (inputs == NULL)
+        {
+            goto cleanup;
+        }
+        inputs[0] = output;
+        for (i = 0; i < runs; i++)
+        {
+            rewind(stage->runs[i]);
+            inputs[i + 1] = stage->runs[i];
+        }
+        if ((fseek(output, sizeof(pcap_hdr_t), SEEK_SET) != 0) ||
+            !reorder_merge(inputs, runs + 1, merged))
+        {
+            free(inputs);
+            goto cleanup;
+        }
+        free(inputs);
+
+        fclose(output);
+        output = NULL;
+        if (fclose(merged) != 0)
+        {
+            merged = NULL;
+            goto cleanup;
+        }
+        merged = NULL;
+
+        if (!MoveFileExA(merged_name, output_name, MOVEFILE_REPLACE_EXISTING))
+        {
+            fprintf(stderr, "Failed to replace %s - %d\n", output_name, GetLastError());
+            goto cleanup;
+        }
+    }
+
+    fprintf(stderr, "%s: %I64u records, %I64u outside %u record window, %d runs merged\n",
+            output_name, records, stage->late, stage->window, runs);
+    ret = 0;
+
+cleanup:
+    if (stage != NULL)
+    {
+        reorder_destroy(stage);
+    }
+    if ((output != NULL) && (fclose(output) != 0))
+    {
+        ret = -1;
+    }
+    if (merged != NULL)
+    {
+        fclose(merged);
+        DeleteFileA(merged_name);
+    }
+    free(output_name);
+    free(merged_name);
+    pcap_reader_close(&reader);
+    return ret;
+}
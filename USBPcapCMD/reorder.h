@@ -0,0 +1,62 @@
+/*
+ * Copyright (c) 2026 Tomasz Moń <desowin@gmail.com>
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#ifndef USBPCAP_CMD_REORDER_H
+#define USBPCAP_CMD_REORDER_H
+
+#include <windows.h>
+#include "USBPcap.h"
+
+/* Window used by --reorder when --reorder-window is not given */
+#define REORDER_DEFAULT_WINDOW  4096
+
+/* Driver takes packet timestamp before it acquires the buffer lock, so
+ * packets completed at the same time on different CPUs can be stored out
+ * of timestamp order. Reorder stage restores the order by holding up to
+ * window records in a min-heap and always writing out the oldest one.
+ *
+ * Records older than the last written record cannot be put back in order
+ * anymore. Stage created with reorder_create() writes them immediately and
+ * counts them. --reorder collects them into sorted runs on disk instead and
+ * merges the runs with the output, so it produces fully ordered capture
+ * regardless of the window size.
+ *
+ * Memory use is bounded by window records.
+ */
+typedef struct _reorder_stage reorder_stage;
+
+/* Receives ordered records. Called with as many records as possible at once. */
+typedef void (*reorder_sink)(void *ctx, const unsigned char *data, DWORD length);
+
+reorder_stage *reorder_create(UINT32 window, reorder_sink sink, void *ctx);
+void reorder_destroy(reorder_stage *stage);
+
+/* Accepts pcap records (without the pcap file header) as read from the
+ * driver. Records can be split across calls.
+ *
+ * Returns FALSE if record could not be buffered.
+ */
+BOOL reorder_feed(reorder_stage *stage, const unsigned char *data, DWORD length);
+
+/* Writes all buffered records. Used at the end of capture and when there
+ * was no new data for a while, i.e. nothing can be in flight anymore.
+ */
+void reorder_flush(reorder_stage *stage);
+
+/* Returns number of records waiting in the window. */
+UINT32 reorder_pending(reorder_stage *stage);
+
+/* Returns number of records written out of order. */
+UINT64 reorder_late(reorder_stage *stage);
+
+/* Writes <capture>_reordered.pcap with records sorted by timestamp.
+ * Records with equal timestamps keep their relative order.
+ *
+ * Returns 0 on success, -1 on failure.
+ */
+int reorder_capture(const char *capture, UINT32 window);
+
+#endif /* USBPCAP_CMD_REORDER_H */
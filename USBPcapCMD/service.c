@@ -0,0 +1,646 @@
+/*
+ * Copyright (c) 2026 Tomasz Moń <desowin@gmail.com>
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <windows.h>
+#include <sddl.h>
+#include "iocontrol.h"
+#include "service.h"
+#include "servicecore.h"
+
+/* Pipe output buffer. Writes to client normally complete immediately. */
+#define SERVICE_PIPE_BUFFER     (1024 * 1024)
+
+/* Client that does not accept data for this long is disconnected */
+#define SERVICE_IO_TIMEOUT_MS   1000
+
+/* Service captures whole packets, clients get them cut to their snaplen */
+#define SERVICE_SNAPLEN         65535
+
+/* Deny network logons, full access for administrators and SYSTEM.
+ * Members of group given to service_run() can read and write.
+ */
+#define SERVICE_PIPE_SDDL       "D:(D;;GA;;;NU)(A;;GA;;;BA)(A;;GA;;;SY)"
+#define SERVICE_PIPE_GROUP_ACE  "(A;;GRGW;;;%s)"
+#define SERVICE_SDDL_LENGTH     256
+
+/* Available since Windows Vista */
+typedef BOOL (WINAPI *GETNAMEDPIPECLIENTSESSIONID)(HANDLE, PULONG);
+
+#ifdef PIPE_REJECT_REMOTE_CLIENTS
+#define SERVICE_PIPE_MODE       (PIPE_TYPE_BYTE | PIPE_READMODE_BYTE | PIPE_WAIT | PIPE_REJECT_REMOTE_CLIENTS)
+#else
+#define SERVICE_PIPE_MODE       (PIPE_TYPE_BYTE | PIPE_READMODE_BYTE | PIPE_WAIT)
+#endif
+
+typedef struct
+{
+    HANDLE handle;
+    OVERLAPPED overlapped;
+    unsigned char *buffer;
+    UINT32 bufferlen;
+    BOOL failed;            /* Read failed, hub no longer delivers data */
+} service_port;
+
+typedef struct
+{
+    HANDLE pipe;
+    OVERLAPPED read_overlapped;   /* Dummy read to detect disconnect */
+    OVERLAPPED write_overlapped;
+    UCHAR dummy;
+    service_client *client;
+} service_connection;
+
+typedef struct
+{
+    UINT32 bufferlen;
+    service_core core;
+    service_connection *connections[SERVICE_MAX_CLIENTS];
+    int connection_count;
+    HANDLE listen;                /* Pipe instance waiting for next client */
+    OVERLAPPED connect_overlapped;
+    SECURITY_ATTRIBUTES sa;
+    GETNAMEDPIPECLIENTSESSIONID get_client_session;  /* NULL before Vista */
+    DWORD session;                /* Session the service runs in */
+} service_state;
+
+static HANDLE service_stop_event = NULL;
+
+static BOOL WINAPI service_ctrl_handler(DWORD type)
+{
+    SetEvent(service_stop_event);
+    return TRUE;
+}
+
+/* Transfers whole buffer over pipe or fails after SERVICE_IO_TIMEOUT_MS */
+static BOOL service_io(HANDLE pipe, BOOL write, void *buffer, DWORD length,
+                       LPOVERLAPPED overlapped)
+{
+    unsigned char *ptr = (unsigned char *)buffer;
+
+    while (length > 0)
+    {
+        DWORD transferred = 0;
+        BOOL ok;
+
+        ResetEvent(overlapped->hEvent);
+        if (write)
+        {
+            ok = WriteFile(pipe, ptr, length, NULL, overlapped);
+        }
+        else
+        {
+            ok = ReadFile(pipe, ptr, length, NULL, overlapped);
+        }
+        if (!ok && (GetLastError() != ERROR_IO_PENDING))
+        {
+            return FALSE;
+        }
+
+        if (WaitForSingleObject(overlapped->hEvent, SERVICE_IO_TIMEOUT_MS) != WAIT_OBJECT_0)
+        {
+            CancelIo(pipe);
+            GetOverlappedResult(pipe, overlapped, &transferred, TRUE);
+            return FALSE;
+        }
+        if (!GetOverlappedResult(pipe, overlapped, &transferred, FALSE) ||
+            (transferred == 0))
+        {
+            return FALSE;
+        }
+
+        ptr += transferred;
+        length -= transferred;
+    }
+
+    return TRUE;
+}
+
+static BOOL service_port_read(service_port *port)
+{
+    ResetEvent(port->overlapped.hEvent);
+    if (!ReadFile(port->handle, port->buffer, port->bufferlen, NULL, &port->overlapped) &&
+        (GetLastError() != ERROR_IO_PENDING))
+    {
+        fprintf(stderr, "Capture read failed - %d\n", GetLastError());
+        port->failed = TRUE;
+        return FALSE;
+    }
+    return TRUE;
+}
+
+static void service_close_port(void *ctx, void *hub)
+{
+    service_port *port = (service_port *)hub;
+
+    if (port->handle != INVALID_HANDLE_VALUE)
+    {
+        CancelIo(port->handle);
+        CloseHandle(port->handle);
+    }
+    if (port->overlapped.hEvent != NULL)
+    {
+        CloseHandle(port->overlapped.hEvent);
+    }
+    free(port->buffer);
+    free(port);
+}
+
+static void *service_open_port(void *ctx, const char *device)
+{
+    service_state *state = (service_state *)ctx;
+    struct thread_data data;
+    service_port *port;
+
+    port = (service_port *)calloc(1, sizeof(service_port));
+    if (port == NULL)
+    {
+        return NULL;
+    }
+
+    /* Filter device is opened with empty filter. Clients extend it. */
+    memset(&data, 0, sizeof(data));
+    data.device = (char *)device;
+    data.snaplen = SERVICE_SNAPLEN;
+    data.bufferlen = state->bufferlen;
+    port->handle = create_filter_read_handle(&data);
+    port->bufferlen = state->bufferlen;
+    port->buffer = (unsigned char *)malloc(state->bufferlen);
+    port->overlapped.hEvent = CreateEvent(NULL,
+                                          TRUE /* Manual Reset */,
+                                          FALSE /* Default non signaled */,
+                                          NULL /* No name */);
+
+    if ((port->handle == INVALID_HANDLE_VALUE) || (port->buffer == NULL) ||
+        (port->overlapped.hEvent == NULL) || !service_port_read(port))
+    {
+        fprintf(stderr, "Failed to open %s for capture service\n", device);
+        service_close_port(ctx, port);
+        return NULL;
+    }
+
+    fprintf(stderr, "Opened %s\n", device);
+    return port;
+}
+
+static BOOL service_set_filter(void *ctx, void *hub, const USBPCAP_ADDRESS_FILTER *filter)
+{
+    service_port *port = (service_port *)hub;
+    DWORD bytes_ret;
+
+    if (!DeviceIoControl(port->handle,
+                         IOCTL_USBPCAP_START_FILTERING,
+                         (LPVOID)filter,
+                         sizeof(USBPCAP_ADDRESS_FILTER),
+                         NULL,
+                         0,
+                         &bytes_ret,
+                         0))
+    {
+        fprintf(stderr, "Failed to update filter - %d\n", GetLastError());
+        return FALSE;
+    }
+    return TRUE;
+}
+
+static const service_backend service_windows_backend =
+{
+    service_open_port,
+    service_set_filter,
+    service_close_port,
+};
+
+static BOOL service_connection_write(void *ctx, const unsigned char *data, DWORD length)
+{
+    service_connection *connection = (service_connection *)ctx;
+
+    return service_io(connection->pipe, TRUE, (void *)data, length,
+                      &connection->write_overlapped);
+}
+
+static void service_connection_close(service_connection *connection)
+{
+    if (connection->pipe != INVALID_HANDLE_VALUE)
+    {
+        CancelIo(connection->pipe);
+        DisconnectNamedPipe(connection->pipe);
+        CloseHandle(connection->pipe);
+    }
+    if (connection->read_overlapped.hEvent != NULL)
+    {
+        CloseHandle(connection->read_overlapped.hEvent);
+    }
+    if (connection->write_overlapped.hEvent != NULL)
+    {
+        CloseHandle(connection->write_overlapped.hEvent);
+    }
+    free(connection);
+}
+
+static BOOL service_connection_read(service_connection *connection)
+{
+    ResetEvent(connection->read_overlapped.hEvent);
+    if (!ReadFile(connection->pipe, &connection->dummy, 1, NULL, &connection->read_overlapped) &&
+        (GetLastError() != ERROR_IO_PENDING))
+    {
+        return FALSE;
+    }
+    return TRUE;
+}
+
+static BOOL service_listen(service_state *state, BOOL first)
+{
+    state->listen = CreateNamedPipeA(SERVICE_PIPE_NAME,
+                                     PIPE_ACCESS_DUPLEX | FILE_FLAG_OVERLAPPED |
+                                     (first ? FILE_FLAG_FIRST_PIPE_INSTANCE : 0),
+                                     SERVICE_PIPE_MODE,
+                                     PIPE_UNLIMITED_INSTANCES,
+                                     SERVICE_PIPE_BUFFER,
+                                     sizeof(SERVICE_ATTACH_REQUEST),
+                                     0, &state->sa);
+    if (state->listen == INVALID_HANDLE_VALUE)
+    {
+        if (first && (GetLastError() == ERROR_ACCESS_DENIED))
+        {
+            fprintf(stderr, "Capture service is already running\n");
+        }
+        else
+        {
+            fprintf(stderr, "Failed to create %s - %d\n", SERVICE_PIPE_NAME, GetLastError());
+        }
+        return FALSE;
+    }
+
+    ResetEvent(state->connect_overlapped.hEvent);
+    if (!ConnectNamedPipe(state->listen, &state->connect_overlapped))
+    {
+        DWORD err = GetLastError();
+
+        if (err == ERROR_PIPE_CONNECTED)
+        {
+            SetEvent(state->connect_overlapped.hEvent);
+        }
+        else if (err != ERROR_IO_PENDING)
+        {
+            fprintf(stderr, "ConnectNamedPipe() failed with code %d\n", err);
+            CloseHandle(state->listen);
+            state->listen = INVALID_HANDLE_VALUE;
+            return FALSE;
+        }
+    }
+    return TRUE;
+}
+
+/* Clients from other sessions would capture devices of this session */
+static BOOL service_client_allowed(service_state *state, HANDLE pipe)
+{
+    ULONG session;
+
+    if (state->get_client_session == NULL)
+    {
+        return TRUE;
+    }
+
+    if (!state->get_client_session(pipe, &session))
+    {
+        fprintf(stderr, "Failed to get client session - %d\n", GetLastError());
+        return FALSE;
+    }
+    if (session != state->session)
+    {
+        fprintf(stderr, "Rejected client from session %u\n", session);
+        return FALSE;
+    }
+    return TRUE;
+}
+
+static void service_accept(service_state *state)
+{
+    SERVICE_ATTACH_REQUEST request;
+    SERVICE_ATTACH_REPLY reply;
+    service_connection *connection;
+    DWORD dummy;
+    UINT32 error = SERVICE_ERROR_BUSY;
+
+    connection = (service_connection *)calloc(1, sizeof(service_connection));
+    if (connection == NULL)
+    {
+        DisconnectNamedPipe(state->listen);
+        CloseHandle(state->listen);
+        service_listen(state, FALSE);
+        return;
+    }
+
+    GetOverlappedResult(state->listen, &state->connect_overlapped, &dummy, FALSE);
+    connection->pipe = state->listen;
+
+    /* Accept next client while this one is being served */
+    service_listen(state, FALSE);
+
+    connection->read_overlapped.hEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+    connection->write_overlapped.hEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+    if ((connection->read_overlapped.hEvent == NULL) ||
+        (connection->write_overlapped.hEvent == NULL) ||
+        !service_io(connection->pipe, FALSE, &request, sizeof(request),
+                    &connection->read_overlapped))
+    {
+        service_connection_close(connection);
+        return;
+    }
+
+    if (!service_client_allowed(state, connection->pipe))
+    {
+        error = SERVICE_ERROR_DENIED;
+    }
+    else if (state->connection_count < SERVICE_MAX_CLIENTS)
+    {
+        connection->client = service_core_attach(&state->core, &request,
+                                                 service_connection_write,
+                                                 connection, &error);
+    }
+
+    reply.version = SERVICE_PROTOCOL_VERSION;
+    reply.error = error;
+    if (!service_io(connection->pipe, TRUE, &reply, sizeof(reply),
+                    &connection->write_overlapped) ||
+        (connection->client == NULL))
+    {
+        if (connection->client != NULL)
+        {
+            service_core_detach(&state->core, connection->client);
+        }
+        service_connection_close(connection);
+        return;
+    }
+
+    service_core_start(&state->core, connection->client);
+    if (!service_connection_read(connection))
+    {
+        connection->client->failed = TRUE;
+    }
+    state->connections[state->connection_count++] = connection;
+}
+
+/* Disconnects clients that failed to accept data or closed the pipe */
+static void service_sweep(service_state *state)
+{
+    int i = 0;
+
+    while (i < state->connection_count)
+    {
+        service_connection *connection = state->connections[i];
+
+        if (connection->client->failed)
+        {
+            service_core_detach(&state->core, connection->client);
+            service_connection_close(connection);
+            state->connections[i] = state->connections[--state->connection_count];
+        }
+        else
+        {
+            i++;
+        }
+    }
+}
+
+int service_run(UINT32 bufferlen, const char *group)
+{
+    service_state state;
+    char sddl[SERVICE_SDDL_LENGTH];
+    int ret = -1;
+    int i;
+
+    memset(&state, 0, sizeof(state));
+    state.bufferlen = bufferlen;
+    state.listen = INVALID_HANDLE_VALUE;
+    service_core_init(&state.core, &service_windows_backend, &state);
+
+    strcpy_s(sddl, sizeof(sddl), SERVICE_PIPE_SDDL);
+    if (group != NULL)
+    {
+        PSID sid;
+
+        /* Accepts both S-1-... strings and SDDL aliases such as BU */
+        if ((strlen(sddl) + strlen(SERVICE_PIPE_GROUP_ACE) + strlen(group) >= sizeof(sddl)) ||
+            !ConvertStringSidToSidA(group, &sid))
+        {
+            fprintf(stderr, "Invalid service group SID '%s'\n", group);
+            return -1;
+        }
+        LocalFree(sid);
+        sprintf_s(&sddl[strlen(sddl)], sizeof(sddl) - strlen(sddl),
+                  SERVICE_PIPE_GROUP_ACE, group);
+    }
+
+    if (!ProcessIdToSessionId(GetCurrentProcessId(), &state.session))
+    {
+        fprintf(stderr, "Failed to get service session - %d\n", GetLastError());
+        return -1;
+    }
+    state.get_client_session = (GETNAMEDPIPECLIENTSESSIONID)
+        GetProcAddress(GetModuleHandleA("kernel32.dll"), "GetNamedPipeClientSessionId");
+
+    state.sa.nLength = sizeof(SECURITY_ATTRIBUTES);
+    state.sa.bInheritHandle = FALSE;
+    if (!ConvertStringSecurityDescriptorToSecurityDescriptorA(sddl,
+                                                              SDDL_REVISION_1,
+                                                              &state.sa.lpSecurityDescriptor,
+                                                              NULL))
+    {
+        fprintf(stderr, "Failed to create pipe security descriptor - %d\n", GetLastError());
+        return -1;
+    }
+
+    service_stop_event = CreateEvent(NULL, TRUE, FALSE, NULL);
+    state.connect_overlapped.hEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+    if ((service_stop_event == NULL) || (state.connect_overlapped.hEvent == NULL) ||
+        !service_listen(&state, TRUE))
+    {
+        goto cleanup;
+    }
+    SetConsoleCtrlHandler(service_ctrl_handler, TRUE);
+
+    fprintf(stderr, "Capture service listening on %s. Press Ctrl+C to stop.\n",
+            SERVICE_PIPE_NAME);
+    if (group != NULL)
+    {
+        fprintf(stderr, "Members of %s can capture from every root hub.\n", group);
+    }
+
+    for (;;)
+    {
+        HANDLE table[MAXIMUM_WAIT_OBJECTS];
+        int count = 0;
+        int hub_first;
+        int connection_first;
+        DWORD dw;
+
+        table[count++] = service_stop_event;
+        if (state.listen != INVALID_HANDLE_VALUE)
+        {
+            table[count++] = state.connect_overlapped.hEvent;
+        }
+
+        hub_first = count;
+        for (i = 0; i < state.core.hub_count; i++)
+        {
+            service_port *port = (service_port *)state.core.hubs[i].handle;
+
+            /* Failed hubs keep their slot, their event is never signaled */
+            table[count++] = port->overlapped.hEvent;
+        }
+
+        connection_first = count;
+        for (i = 0; i < state.connection_count; i++)
+        {
+            table[count++] = state.connections[i]->read_overlapped.hEvent;
+        }
+
+        dw = WaitForMultipleObjects(count, table, FALSE, INFINITE);
+        if ((dw < WAIT_OBJECT_0) || (dw >= WAIT_OBJECT_0 + count))
+        {
+            fprintf(stderr, "WaitForMultipleObjects failed in service_run(): %d\n", GetLastError());
+            break;
+        }
+
+        i = dw - WAIT_OBJECT_0;
+        if (table[i] == service_stop_event)
+        {
+            ret = 0;
+            break;
+        }
+        else if (table[i] == state.connect_overlapped.hEvent)
+        {
+            service_accept(&state);
+        }
+        else if (i < connection_first)
+        {
+            service_hub *hub = &state.core.hubs[i - hub_first];
+            service_port *port = (service_port *)hub->handle;
+            DWORD read;
+
+            if (GetOverlappedResult(port->handle, &port->overlapped, &read, FALSE))
+            {
+                service_core_data(&state.core, hub, port->buffer, read);
+                service_port_read(port);
+            }
+            else
+            {
+                fprintf(stderr, "%s: capture read failed - %d\n", hub->device, GetLastError());
+                port->failed = TRUE;
+                ResetEvent(port->overlapped.hEvent);
+            }
+        }
+        else
+        {
+            service_connection *connection = state.connections[i - connection_first];
+            DWORD read;
+
+            /* Clients never write after request, so this is disconnect */
+            if (!GetOverlappedResult(connection->pipe, &connection->read_overlapped, &read, FALSE) ||
+                !service_connection_read(connection))
+            {
+                connection->client->failed = TRUE;
+            }
+        }
+
+        service_sweep(&state);
+    }
+
+cleanup:
+    for (i = 0; i < state.connection_count; i++)
+    {
+        service_core_detach(&state.core, state.connections[i]->client);
+        service_connection_close(state.connections[i]);
+    }
+    service_core_cleanup(&state.core);
+    if (state.listen != INVALID_HANDLE_VALUE)
+    {
+        CancelIo(state.listen);
+        CloseHandle(state.listen);
+    }
+    if (state.connect_overlapped.hEvent != NULL)
+    {
+        CloseHandle(state.connect_overlapped.hEvent);
+    }
+    if (service_stop_event != NULL)
+    {
+        CloseHandle(service_stop_event);
+        service_stop_event = NULL;
+    }
+    LocalFree(state.sa.lpSecurityDescriptor);
+    return ret;
+}
+
+HANDLE service_attach(struct thread_data *data)
+{
+    SERVICE_ATTACH_REQUEST request;
+    SERVICE_ATTACH_REPLY reply;
+    OVERLAPPED overlapped;
+    HANDLE pipe;
+    BOOL ok;
+
+    if (strlen(data->device) >= SERVICE_DEVICE_LENGTH)
+    {
+        return INVALID_HANDLE_VALUE;
+    }
+
+    pipe = CreateFileA(SERVICE_PIPE_NAME,
+                       GENERIC_READ | GENERIC_WRITE,
+                       0,
+                       NULL,
+                       OPEN_EXISTING,
+                       FILE_FLAG_OVERLAPPED,
+                       NULL);
+    if ((pipe == INVALID_HANDLE_VALUE) && (GetLastError() == ERROR_PIPE_BUSY) &&
+        WaitNamedPipeA(SERVICE_PIPE_NAME, SERVICE_IO_TIMEOUT_MS))
+    {
+        pipe = CreateFileA(SERVICE_PIPE_NAME,
+                           GENERIC_READ | GENERIC_WRITE,
+                           0,
+                           NULL,
+                           OPEN_EXISTING,
+                           FILE_FLAG_OVERLAPPED,
+                           NULL);
+    }
+    if (pipe == INVALID_HANDLE_VALUE)
+    {
+        /* Service is not running */
+        return INVALID_HANDLE_VALUE;
+    }
+
+    memset(&request, 0, sizeof(request));
+    request.version = SERVICE_PROTOCOL_VERSION;
+    request.snaplen = data->snaplen;
+    request.filter = data->filter;
+    if (data->capture_new)
+    {
+        USBPcapSetDeviceFiltered(&request.filter, 0);
+    }
+    strcpy_s(request.device, sizeof(request.device), data->device);
+
+    memset(&overlapped, 0, sizeof(overlapped));
+    overlapped.hEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+    ok = (overlapped.hEvent != NULL) &&
+         service_io(pipe, TRUE, &request, sizeof(request), &overlapped) &&
+         service_io(pipe, FALSE, &reply, sizeof(reply), &overlapped);
+    if (overlapped.hEvent != NULL)
+    {
+        CloseHandle(overlapped.hEvent);
+    }
+
+    if (!ok || (reply.error != SERVICE_ERROR_NONE))
+    {
+        fprintf(stderr, "Capture service did not accept %s (error %u), capturing directly\n",
+                data->device, ok ? reply.error : SERVICE_ERROR_REQUEST);
+        CloseHandle(pipe);
+        return INVALID_HANDLE_VALUE;
+    }
+
+    return pipe;
+}
@@ -0,0 +1,34 @@
+/*
+ * Copyright (c) 2026 Tomasz Moń <desowin@gmail.com>
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#ifndef USBPCAP_CMD_SERVICE_H
+#define USBPCAP_CMD_SERVICE_H
+
+#include <windows.h>
+#include "thread.h"
+
+/* Runs capture service until Ctrl+C. Must be started elevated.
+ *
+ * Service keeps filter devices open with bufferlen bytes driver buffer
+ * and serves captures to USBPcapCMD instances over SERVICE_PIPE_NAME.
+ * Filter of every client is applied in the service.
+ *
+ * Only administrators can connect unless group (SID string) is given, in
+ * which case its members can capture any root hub without elevation.
+ * Clients from other logon sessions are rejected on Windows Vista and
+ * later.
+ *
+ * Returns 0 on clean exit, -1 on failure.
+ */
+int service_run(UINT32 bufferlen, const char *group);
+
+/* Attaches to running capture service. Returns connected pipe that
+ * carries pcap stream for data->device filtered with data->filter, or
+ * INVALID_HANDLE_VALUE if service is not running or refused the request.
+ */
+HANDLE service_attach(struct thread_data *data);
+
+#endif /* USBPCAP_CMD_SERVICE_H */
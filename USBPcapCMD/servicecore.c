@@ -0,0 +1,399 @@
+/*
+ * Copyright (c) 2026 Tomasz Moń <desowin@gmail.com>
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "servicecore.h"
+
+static BOOL service_address_set(const UINT32 *addresses, USHORT device)
+{
+    return (addresses[(device >> 5) & 0x03] & (1 << (device & 0x1F))) ? TRUE : FALSE;
+}
+
+/* Address 0 bit in filter requests devices connected after capture start */
+static BOOL service_client_accepts(const service_client *client, USHORT device)
+{
+    if ((device == 0) || client->filter.filterAll)
+    {
+        /* Packets not tied to device are sent to everyone */
+        return TRUE;
+    }
+    if (device > 127)
+    {
+        return FALSE;
+    }
+    if (service_address_set(client->filter.addresses, device))
+    {
+        return TRUE;
+    }
+
+    /* Device that was not active when client attached is treated as new */
+    return service_address_set(client->filter.addresses, 0) &&
+           !service_address_set(client->known, device);
+}
+
+static void service_update_filter(service_core *core, service_hub *hub)
+{
+    USBPCAP_ADDRESS_FILTER filter;
+    int i;
+    int j;
+
+    memset(&filter, 0, sizeof(filter));
+    for (i = 0; i < core->client_count; i++)
+    {
+        service_client *client = core->clients[i];
+
+        if (client->hub != hub)
+        {
+            continue;
+        }
+        for (j = 0; j < 4; j++)
+        {
+            filter.addresses[j] |= client->filter.addresses[j];
+        }
+        if (client->filter.filterAll)
+        {
+            filter.filterAll = TRUE;
+        }
+    }
+
+    core->backend->set_filter(core->ctx, hub->handle, &filter);
+}
+
+static void service_client_flush(service_client *client)
+{
+    if ((client->output_used > 0) && !client->failed)
+    {
+        if (!client->write(client->ctx, client->output, client->output_used))
+        {
+            client->failed = TRUE;
+        }
+    }
+    client->output_used = 0;
+}
+
+static void service_client_put(service_client *client, const void *data, DWORD length)
+{
+    if (client->failed)
+    {
+        return;
+    }
+
+    if (client->output_used + length > SERVICE_CLIENT_BUFFER)
+    {
+        service_client_flush(client);
+    }
+
+    if (length > SERVICE_CLIENT_BUFFER)
+    {
+        if (!client->write(client->ctx, (const unsigned char *)data, length))
+        {
+            client->failed = TRUE;
+        }
+    }
+    else
+    {
+        memcpy(&client->output[client->output_used], data, length);
+        client->output_used += length;
+    }
+}
+
+static void service_client_header(service_client *client, const pcap_hdr_t *header)
+{
+    pcap_hdr_t copy = *header;
+
+    if (copy.snaplen > client->snaplen)
+    {
+        copy.snaplen = client->snaplen;
+    }
+    service_client_put(client, &copy, sizeof(copy));
+    client->header_sent = TRUE;
+}
+
+void service_core_init(service_core *core, const service_backend *backend, void *ctx)
+{
+    memset(core, 0, sizeof(service_core));
+    core->backend = backend;
+    core->ctx = ctx;
+}
+
+void service_core_cleanup(service_core *core)
+{
+    int i;
+
+    for (i = 0; i < core->hub_count; i++)
+    {
+        core->backend->close_hub(core->ctx, core->hubs[i].handle);
+        free(core->hubs[i].record);
+    }
+    core->hub_count = 0;
+}
+
+service_client *service_core_attach(service_core *core,
+                                    const SERVICE_ATTACH_REQUEST *request,
+                                    service_write write, void *ctx,
+                                    UINT32 *error)
+{
+    service_client *client;
+    service_hub *hub = NULL;
+    int i;
+
+    if (request->version != SERVICE_PROTOCOL_VERSION)
+    {
+        *error = SERVICE_ERROR_VERSION;
+        return NULL;
+    }
+
+    if ((memchr(request->device, '\0', SERVICE_DEVICE_LENGTH) == NULL) ||
+        (request->snaplen == 0))
+    {
+        *error = SERVICE_ERROR_REQUEST;
+        return NULL;
+    }
+
+    if (core->client_count == SERVICE_MAX_CLIENTS)
+    {
+        *error = SERVICE_ERROR_BUSY;
+        return NULL;
+    }
+
+    for (i = 0; i < core->hub_count; i++)
+    {
+        if (_stricmp(core->hubs[i].device, request->device) == 0)
+        {
+            hub = &core->hubs[i];
+            break;
+        }
+    }
+
+    if (hub == NULL)
+    {
+        void *handle;
+
+        if (core->hub_count == SERVICE_MAX_HUBS)
+        {
+            *error = SERVICE_ERROR_BUSY;
+            return NULL;
+        }
+
+        handle = core->backend->open_hub(core->ctx, request->device);
+        if (handle == NULL)
+        {
+            *error = SERVICE_ERROR_DEVICE;
+            return NULL;
+        }
+
+        hub = &core->hubs[core->hub_count++];
+        memset(hub, 0, sizeof(service_hub));
+        strcpy_s(hub->device, sizeof(hub->device), request->device);
+        hub->handle = handle;
+    }
+
+    client = (service_client *)calloc(1, sizeof(service_client));
+    if (client != NULL)
+    {
+        client->output = (unsigned char *)malloc(SERVICE_CLIENT_BUFFER);
+    }
+    if ((client == NULL) || (client->output == NULL))
+    {
+        free(client);
+        *error = SERVICE_ERROR_BUSY;
+        return NULL;
+    }
+
+    client->hub = hub;
+    client->filter = request->filter;
+    memcpy(client->known, hub->seen, sizeof(client->known));
+    client->snaplen = request->snaplen;
+    client->write = write;
+    client->ctx = ctx;
+
+    core->clients[core->client_count++] = client;
+    hub->clients++;
+    service_update_filter(core, hub);
+
+    *error = SERVICE_ERROR_NONE;
+    return client;
+}
+
+void service_core_start(service_core *core, service_client *client)
+{
+    if (client->hub->header_received == sizeof(pcap_hdr_t))
+    {
+        service_client_header(client, &client->hub->header);
+        service_client_flush(client);
+    }
+}
+
+void service_core_detach(service_core *core, service_client *client)
+{
+    service_hub *hub = client->hub;
+    int i;
+
+    for (i = 0; i < core->client_count; i++)
+    {
+        if (core->clients[i] == client)
+        {
+            core->clients[i] = core->clients[--core->client_count];
+            break;
+        }
+    }
+
+    hub->clients--;
+    service_update_filter(core, hub);
+
+    free(client->output);
+    free(client);
+}
+
+static void service_dispatch(service_core *core, service_hub *hub,
+                             const unsigned char *record)
+{
+    const pcaprec_hdr_t *hdr = (const pcaprec_hdr_t *)record;
+    USHORT device = 0;
+    int i;
+
+    if (hdr->incl_len >= sizeof(USBPCAP_BUFFER_PACKET_HEADER))
+    {
+        device = ((const USBPCAP_BUFFER_PACKET_HEADER *)(record + sizeof(pcaprec_hdr_t)))->device;
+        if (device <= 127)
+        {
+            hub->seen[device >> 5] |= (1 << (device & 0x1F));
+        }
+    }
+
+    for (i = 0; i < core->client_count; i++)
+    {
+        service_client *client = core->clients[i];
+
+        if ((client->hub != hub) || !client->header_sent ||
+            !service_client_accepts(client, device))
+        {
+            continue;
+        }
+
+        if (hdr->incl_len > client->snaplen)
+        {
+            pcaprec_hdr_t cut = *hdr;
+
+            /* orig_len is kept, so the client still sees real size */
+            cut.incl_len = client->snaplen;
+            service_client_put(client, &cut, sizeof(cut));
+            service_client_put(client, record + sizeof(pcaprec_hdr_t), cut.incl_len);
+        }
+        else
+        {
+            service_client_put(client, record, sizeof(pcaprec_hdr_t) + hdr->incl_len);
+        }
+    }
+}
+
+static BOOL service_record_reserve(service_hub *hub, UINT32 length)
+{
+    if (length > hub->record_size)
+    {
+        unsigned char *tmp = realloc(hub->record, length);
+        if (tmp == NULL)
+        {
+            return FALSE;
+        }
+        hub->record = tmp;
+        hub->record_size = length;
+    }
+    return TRUE;
+}
+
+void service_core_data(service_core *core, service_hub *hub,
+                       const unsigned char *data, DWORD length)
+{
+    int i;
+
+    if (hub->header_received < sizeof(pcap_hdr_t))
+    {
+        UINT32 to_copy = min(sizeof(pcap_hdr_t) - hub->header_received, length);
+
+        memcpy(((unsigned char *)&hub->header) + hub->header_received, data, to_copy);
+        hub->header_received += to_copy;
+        data += to_copy;
+        length -= to_copy;
+
+        if (hub->header_received == sizeof(pcap_hdr_t))
+        {
+            /* Clients that attached before the header arrived */
+            for (i = 0; i < core->client_count; i++)
+            {
+                if ((core->clients[i]->hub == hub) && !core->clients[i]->header_sent)
+                {
+                    service_client_header(core->clients[i], &hub->header);
+                }
+            }
+        }
+    }
+
+    while (length > 0)
+    {
+        UINT32 needed;
+        UINT32 to_copy;
+
+        if ((hub->received == 0) && (length >= sizeof(pcaprec_hdr_t)))
+        {
+            const pcaprec_hdr_t *hdr = (const pcaprec_hdr_t *)data;
+
+            needed = sizeof(pcaprec_hdr_t) + hdr->incl_len;
+            if (length >= needed)
+            {
+                /* Whole record is available, no copy needed */
+                service_dispatch(core, hub, data);
+                data += needed;
+                length -= needed;
+                continue;
+            }
+        }
+
+        /* Record split across reads */
+        if (hub->received < sizeof(pcaprec_hdr_t))
+        {
+            needed = sizeof(pcaprec_hdr_t);
+        }
+        else
+        {
+            needed = sizeof(pcaprec_hdr_t) + ((pcaprec_hdr_t *)hub->record)->incl_len;
+        }
+
+        if (!service_record_reserve(hub, needed))
+        {
+            fprintf(stderr, "Failed to allocate %u bytes record buffer\n", needed);
+            break;
+        }
+
+        to_copy = min(needed - hub->received, length);
+        memcpy(&hub->record[hub->received], data, to_copy);
+        hub->received += to_copy;
+        data += to_copy;
+        length -= to_copy;
+
+        if ((hub->received == sizeof(pcaprec_hdr_t)) &&
+            (((pcaprec_hdr_t *)hub->record)->incl_len > 0))
+        {
+            continue;
+        }
+
+        if (hub->received == needed)
+        {
+            service_dispatch(core, hub, hub->record);
+            hub->received = 0;
+        }
+    }
+
+    for (i = 0; i < core->client_count; i++)
+    {
+        if (core->clients[i]->hub == hub)
+        {
+            service_client_flush(core->clients[i]);
+        }
+    }
+}
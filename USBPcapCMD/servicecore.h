@@ -0,0 +1,133 @@
+/*
+ * Copyright (c) 2026 Tomasz Moń <desowin@gmail.com>
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#ifndef USBPCAP_CMD_SERVICECORE_H
+#define USBPCAP_CMD_SERVICECORE_H
+
+#include <windows.h>
+#include "USBPcap.h"
+
+/* Capture service protocol.
+ *
+ * Client connects to SERVICE_PIPE_NAME, writes SERVICE_ATTACH_REQUEST and
+ * reads SERVICE_ATTACH_REPLY. On success the rest of the pipe is regular
+ * pcap stream, exactly as if it was read from the filter device.
+ */
+#define SERVICE_PIPE_NAME         "\\\\.\\pipe\\USBPcapService"
+#define SERVICE_PROTOCOL_VERSION  1
+#define SERVICE_DEVICE_LENGTH     64
+
+#define SERVICE_ERROR_NONE        0
+#define SERVICE_ERROR_VERSION     1  /* Unsupported protocol version */
+#define SERVICE_ERROR_REQUEST     2  /* Malformed request */
+#define SERVICE_ERROR_DEVICE      3  /* Filter device could not be opened */
+#define SERVICE_ERROR_BUSY        4  /* Too many clients or hubs */
+#define SERVICE_ERROR_DENIED      5  /* Client from other session */
+
+#pragma pack(push, 1)
+typedef struct
+{
+    UINT32 version;
+    UINT32 snaplen;
+    USBPCAP_ADDRESS_FILTER filter;
+    char device[SERVICE_DEVICE_LENGTH];  /* \\.\USBPcapX, NULL terminated */
+} SERVICE_ATTACH_REQUEST, *PSERVICE_ATTACH_REQUEST;
+
+typedef struct
+{
+    UINT32 version;
+    UINT32 error;                        /* SERVICE_ERROR_* */
+} SERVICE_ATTACH_REPLY, *PSERVICE_ATTACH_REPLY;
+#pragma pack(pop)
+
+#define SERVICE_MAX_HUBS     16
+#define SERVICE_MAX_CLIENTS  32
+
+/* Data is handed to client in chunks of up to this size */
+#define SERVICE_CLIENT_BUFFER  (256 * 1024)
+
+/* Capture device access used by service core. The Windows implementation
+ * in service.c opens filter device with pre-sized buffer, other
+ * implementations can feed arbitrary data.
+ */
+typedef struct
+{
+    /* Returns NULL if device cannot be opened */
+    void *(*open_hub)(void *ctx, const char *device);
+    BOOL (*set_filter)(void *ctx, void *hub, const USBPCAP_ADDRESS_FILTER *filter);
+    void (*close_hub)(void *ctx, void *hub);
+} service_backend;
+
+/* Returns FALSE if client is gone. Client is then marked failed. */
+typedef BOOL (*service_write)(void *ctx, const unsigned char *data, DWORD length);
+
+typedef struct _service_hub service_hub;
+
+typedef struct
+{
+    service_hub *hub;
+    USBPCAP_ADDRESS_FILTER filter;
+    UINT32 known[4];        /* Addresses with traffic before client attached */
+    UINT32 snaplen;
+    BOOL header_sent;
+    BOOL failed;
+    service_write write;
+    void *ctx;
+    unsigned char *output;
+    DWORD output_used;
+} service_client;
+
+/* Hub stays open once opened, so next client attaches without allocating
+ * driver buffer again. Without clients the driver filter is empty.
+ */
+struct _service_hub
+{
+    char device[SERVICE_DEVICE_LENGTH];
+    void *handle;
+    pcap_hdr_t header;       /* pcap header received from driver */
+    UINT32 header_received;
+    UINT32 seen[4];          /* Addresses with any captured traffic */
+    unsigned char *record;   /* Record split across reads */
+    UINT32 record_size;
+    UINT32 received;
+    int clients;
+};
+
+typedef struct
+{
+    const service_backend *backend;
+    void *ctx;
+    service_hub hubs[SERVICE_MAX_HUBS];
+    int hub_count;
+    service_client *clients[SERVICE_MAX_CLIENTS];
+    int client_count;
+} service_core;
+
+void service_core_init(service_core *core, const service_backend *backend, void *ctx);
+
+/* Closes all hubs. Clients must be detached before. */
+void service_core_cleanup(service_core *core);
+
+/* Validates request, opens hub if needed and extends driver filter.
+ * Returns NULL and sets error on failure.
+ */
+service_client *service_core_attach(service_core *core,
+                                    const SERVICE_ATTACH_REQUEST *request,
+                                    service_write write, void *ctx,
+                                    UINT32 *error);
+
+/* Sends pcap header to client once attach reply was written. */
+void service_core_start(service_core *core, service_client *client);
+
+void service_core_detach(service_core *core, service_client *client);
+
+/* Dispatches data read from hub to clients. Every client receives pcap
+ * header followed by records matching its filter, cut to its snaplen.
+ */
+void service_core_data(service_core *core, service_hub *hub,
+                       const unsigned char *data, DWORD length);
+
+#endif /* USBPCAP_CMD_SERVICECORE_H */
@@ -0,0 +1,458 @@
+/*
+ * Copyright (c) 2026 Tomasz Moń <desowin@gmail.com>
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <windows.h>
+#include <sddl.h>
+#include "shmring.h"
+
+/* Full access for administrators and SYSTEM, user running the capture
+ * can map the ring for reading. Optionally every authenticated user can.
+ */
+#define SHM_RING_SDDL         "D:(A;;GA;;;BA)(A;;GA;;;SY)(A;;GR;;;%s)"
+#define SHM_RING_SDDL_PUBLIC  "(A;;GR;;;AU)"
+#define SHM_RING_SDDL_LENGTH  256
+
+/* Single record can take at most this part of data area */
+#define SHM_RING_MAX_RECORD_SHIFT  2
+
+static UINT64 shm_ring_slot(UINT32 length)
+{
+    return (sizeof(SHM_RING_RECORD) + length + (SHM_RING_ALIGN - 1)) &
+           ~((UINT64)SHM_RING_ALIGN - 1);
+}
+
+/* Creates security descriptor that grants read access to token user */
+static BOOL shm_ring_security(BOOL allow_users, PSECURITY_DESCRIPTOR *sd)
+{
+    HANDLE token;
+    PTOKEN_USER user = NULL;
+    DWORD length = 0;
+    char *sid = NULL;
+    char sddl[SHM_RING_SDDL_LENGTH];
+    BOOL ok = FALSE;
+
+    if (!OpenProcessToken(GetCurrentProcess(), TOKEN_QUERY, &token))
+    {
+        return FALSE;
+    }
+
+    GetTokenInformation(token, TokenUser, NULL, 0, &length);
+    user = (PTOKEN_USER)malloc(length);
+    if ((user != NULL) &&
+        GetTokenInformation(token, TokenUser, user, length, &length) &&
+        ConvertSidToStringSidA(user->User.Sid, &sid))
+    {
+        sprintf_s(sddl, sizeof(sddl), SHM_RING_SDDL, sid);
+        if (allow_users)
+        {
+            strcat_s(sddl, sizeof(sddl), SHM_RING_SDDL_PUBLIC);
+        }
+        ok = ConvertStringSecurityDescriptorToSecurityDescriptorA(sddl,
+                                                                   SDDL_REVISION_1,
+                                                                   sd, NULL);
+        LocalFree(sid);
+    }
+
+    free(user);
+    CloseHandle(token);
+    return ok;
+}
+
+shm_ring *shm_ring_create(const char *name, UINT64 size, BOOL allow_users)
+{
+    shm_ring *ring;
+    SECURITY_ATTRIBUTES sa;
+    UINT64 capacity = SHM_RING_MIN_SIZE;
+    UINT64 total;
+
+    while (capacity < size)
+    {
+        capacity <<= 1;
+    }
+    total = SHM_RING_CONTROL_SIZE + capacity;
+
+    ring = (shm_ring *)calloc(1, sizeof(shm_ring));
+    if (ring == NULL)
+    {
+        fprintf(stderr, "Failed to allocate shared memory ring\n");
+        return NULL;
+    }
+
+    sa.nLength = sizeof(SECURITY_ATTRIBUTES);
+    sa.bInheritHandle = FALSE;
+    if (!shm_ring_security(allow_users, &sa.lpSecurityDescriptor))
+    {
+        fprintf(stderr, "Failed to create shared memory security descriptor - %d\n", GetLastError());
+        free(ring);
+        return NULL;
+    }
+
+    ring->mapping = CreateFileMappingA(INVALID_HANDLE_VALUE, &sa, PAGE_READWRITE,
+                                       (DWORD)(total >> 32), (DWORD)total, name);
+    LocalFree(sa.lpSecurityDescriptor);
+    if (ring->mapping == NULL)
+    {
+        fprintf(stderr, "Failed to create shared memory %s - %d\n", name, GetLastError());
+        free(ring);
+        return NULL;
+    }
+    if (GetLastError() == ERROR_ALREADY_EXISTS)
+    {
+        /* Two producers would corrupt each other's records */
+        fprintf(stderr, "Shared memory %s is already in use\n", name);
+        CloseHandle(ring->mapping);
+        free(ring);
+        return NULL;
+    }
+
+    ring->control = (PSHM_RING_CONTROL)MapViewOfFile(ring->mapping, FILE_MAP_WRITE, 0, 0, 0);
+    if (ring->control == NULL)
+    {
+        fprintf(stderr, "Failed to map shared memory %s - %d\n", name, GetLastError());
+        CloseHandle(ring->mapping);
+        free(ring);
+        return NULL;
+    }
+
+    ring->ring = ((unsigned char *)ring->control) + SHM_RING_CONTROL_SIZE;
+    ring->mask = capacity - 1;
+
+    /* Mapping is zero filled, readers check magic last */
+    ring->control->version = SHM_RING_VERSION;
+    ring->control->capacity = capacity;
+    MemoryBarrier();
+    ring->control->magic = SHM_RING_MAGIC;
+
+    return ring;
+}
+
+static void shm_ring_publish(shm_ring *ring, const unsigned char *record)
+{
+    PSHM_RING_CONTROL control = ring->control;
+    const pcaprec_hdr_t *hdr = (const pcaprec_hdr_t *)record;
+    UINT32 length = sizeof(pcaprec_hdr_t) + hdr->incl_len;
+    UINT64 slot = shm_ring_slot(length);
+    UINT64 position = (UINT64)control->commit;
+    UINT64 offset = position & ring->mask;
+    PSHM_RING_RECORD header;
+
+    if (slot > ((ring->mask + 1) >> SHM_RING_MAX_RECORD_SHIFT))
+    {
+        ring->oversized++;
+        return;
+    }
+
+    if (offset + slot > ring->mask + 1)
+    {
+        /* Record would wrap, readers skip rest of data area */
+        InterlockedExchange64(&control->reserve,
+                              (LONG64)(position + (ring->mask + 1 - offset) + slot));
+        header = (PSHM_RING_RECORD)&ring->ring[offset];
+        header->sequence = ring->sequence;
+        header->length = 0;
+        header->flags = SHM_RING_RECORD_PADDING;
+        position += ring->mask + 1 - offset;
+        offset = 0;
+    }
+    else
+    {
+        InterlockedExchange64(&control->reserve, (LONG64)(position + slot));
+    }
+
+    header = (PSHM_RING_RECORD)&ring->ring[offset];
+    header->sequence = ring->sequence;
+    header->length = length;
+    header->flags = 0;
+    memcpy(header + 1, record, length);
+
+    /* Full barrier, record is visible before the commit */
+    InterlockedExchange64(&control->commit, (LONG64)(position + slot));
+    ring->sequence++;
+    InterlockedExchange64(&control->published, (LONG64)ring->sequence);
+}
+
+static BOOL shm_ring_record_reserve(shm_ring *ring, UINT32 length)
+{
+    if (length > ring->record_size)
+    {
+        unsigned char *tmp = realloc(ring->record, length);
+        if (tmp == NULL)
+        {
+            return FALSE;
+        }
+        ring->record = tmp;
+        ring->record_size = length;
+    }
+    return TRUE;
+}
+
+BOOL shm_ring_write(shm_ring *ring, const unsigned char *data, DWORD length)
+{
+    if (ring->header_received < sizeof(pcap_hdr_t))
+    {
+        UINT32 to_copy = min(sizeof(pcap_hdr_t) - ring->header_received, length);
+
+        memcpy(((unsigned char *)&ring->control->pcap) + ring->header_received, data, to_copy);
+        ring->header_received += to_copy;
+        data += to_copy;
+        length -= to_copy;
+
+        if (ring->header_received == sizeof(pcap_hdr_t))
+        {
+            MemoryBarrier();
+            ring->control->header_valid = 1;
+        }
+    }
+
+    while (length > 0)
+    {
+        UINT32 needed;
+        UINT32 to_copy;
+
+        if ((ring->received == 0) && (length >= sizeof(pcaprec_hdr_t)))
+        {
+            const pcaprec_hdr_t *hdr = (const pcaprec_hdr_t *)data;
+
+            needed = sizeof(pcaprec_hdr_t) + hdr->incl_len;
+            if (length >= needed)
+            {
+                /* Whole record is available, copy it straight to the ring */
+                shm_ring_publish(ring, data);
+                data += needed;
+                length -= needed;
+                continue;
+            }
+        }
+
+        /* Record split across writes */
+        if (ring->received < sizeof(pcaprec_hdr_t))
+        {
+            needed = sizeof(pcaprec_hdr_t);
+        }
+        else
+        {
+            needed = sizeof(pcaprec_hdr_t) + ((pcaprec_hdr_t *)ring->record)->incl_len;
+        }
+
+        if (!shm_ring_record_reserve(ring, needed))
+        {
+            fprintf(stderr, "Failed to allocate %u bytes record buffer\n", needed);
+            return FALSE;
+        }
+
+        to_copy = min(needed - ring->received, length);
+        memcpy(&ring->record[ring->received], data, to_copy);
+        ring->received += to_copy;
+        data += to_copy;
+        length -= to_copy;
+
+        if ((ring->received == sizeof(pcaprec_hdr_t)) &&
+            (((pcaprec_hdr_t *)ring->record)->incl_len > 0))
+        {
+            continue;
+        }
+
+        if (ring->received == needed)
+        {
+            shm_ring_publish(ring, ring->record);
+            ring->received = 0;
+        }
+    }
+
+    return TRUE;
+}
+
+void shm_ring_close(shm_ring *ring)
+{
+    if (ring->oversized > 0)
+    {
+        fprintf(stderr, "%I64u records did not fit in shared memory ring\n",
+                ring->oversized);
+    }
+
+    MemoryBarrier();
+    ring->control->closed = 1;
+
+    UnmapViewOfFile(ring->control);
+    CloseHandle(ring->mapping);
+    free(ring->record);
+    free(ring);
+}
+
+shm_reader *shm_reader_open(const char *name)
+{
+    shm_reader *reader;
+    MEMORY_BASIC_INFORMATION info;
+
+    reader = (shm_reader *)calloc(1, sizeof(shm_reader));
+    if (reader == NULL)
+    {
+        return NULL;
+    }
+
+    reader->mapping = OpenFileMappingA(FILE_MAP_READ, FALSE, name);
+    if (reader->mapping == NULL)
+    {
+        free(reader);
+        return NULL;
+    }
+
+    reader->control = (const SHM_RING_CONTROL *)MapViewOfFile(reader->mapping, FILE_MAP_READ, 0, 0, 0);
+    if ((reader->control == NULL) ||
+        (VirtualQuery(reader->control, &info, sizeof(info)) != sizeof(info)) ||
+        (info.RegionSize < SHM_RING_CONTROL_SIZE) ||
+        (reader->control->magic != SHM_RING_MAGIC) ||
+        (reader->control->version != SHM_RING_VERSION) ||
+        (info.RegionSize - SHM_RING_CONTROL_SIZE < reader->control->capacity))
+    {
+        if (reader->control != NULL)
+        {
+            UnmapViewOfFile((LPCVOID)reader->control);
+        }
+        CloseHandle(reader->mapping);
+        free(reader);
+        return NULL;
+    }
+
+    MemoryBarrier();
+    reader->ring = ((const unsigned char *)reader->control) + SHM_RING_CONTROL_SIZE;
+    reader->mask = reader->control->capacity - 1;
+    reader->cursor = (UINT64)reader->control->commit;
+    reader->next = reader->cursor;
+    MemoryBarrier();
+    reader->expected = (UINT64)reader->control->published;
+
+    return reader;
+}
+
+void shm_reader_close(shm_reader *reader)
+{
+    UnmapViewOfFile((LPCVOID)reader->control);
+    CloseHandle(reader->mapping);
+    free(reader);
+}
+
+const pcap_hdr_t *shm_reader_header(shm_reader *reader)
+{
+    if (reader->control->header_valid == 0)
+    {
+        return NULL;
+    }
+    MemoryBarrier();
+    return &reader->control->pcap;
+}
+
+/* TRUE if data at position could have been overwritten by now */
+static BOOL shm_reader_overrun(const shm_reader *reader, UINT64 position)
+{
+    MemoryBarrier();
+    return ((UINT64)reader->control->reserve > position + reader->mask + 1) ? TRUE : FALSE;
+}
+
+static void shm_reader_resync(shm_reader *reader)
+{
+    /* Continue with the newest data. Number of skipped records is known
+     * once next record is read.
+     */
+    reader->cursor = (UINT64)reader->control->commit;
+    reader->next = reader->cursor;
+}
+
+BOOL shm_reader_next(shm_reader *reader, const pcaprec_hdr_t **record,
+                     UINT32 *length)
+{
+    for (;;)
+    {
+        SHM_RING_RECORD header;
+        UINT64 offset = reader->cursor & reader->mask;
+        UINT64 commit = (UINT64)reader->control->commit;
+
+        MemoryBarrier();
+        if (reader->cursor == commit)
+        {
+            return FALSE;
+        }
+        if (shm_reader_overrun(reader, reader->cursor))
+        {
+            shm_reader_resync(reader);
+            continue;
+        }
+
+        memcpy(&header, &reader->ring[offset], sizeof(header));
+        if (shm_reader_overrun(reader, reader->cursor))
+        {
+            shm_reader_resync(reader);
+            continue;
+        }
+
+        if (header.flags & SHM_RING_RECORD_PADDING)
+        {
+            reader->cursor += reader->mask + 1 - offset;
+            continue;
+        }
+
+        if ((header.length < sizeof(pcaprec_hdr_t)) ||
+            (offset + shm_ring_slot(header.length) > reader->mask + 1))
+        {
+            /* Cannot happen unless producer is broken */
+            shm_reader_resync(reader);
+            continue;
+        }
+
+        if (header.sequence > reader->expected)
+        {
+            reader->drops += header.sequence - reader->expected;
+        }
+        reader->expected = header.sequence + 1;
+        reader->next = reader->cursor + shm_ring_slot(header.length);
+
+        *record = (const pcaprec_hdr_t *)&reader->ring[offset + sizeof(SHM_RING_RECORD)];
+        *length = header.length;
+        return TRUE;
+    }
+}
+
+BOOL shm_reader_release(shm_reader *reader)
+{
+    if (shm_reader_overrun(reader, reader->cursor))
+    {
+        reader->drops++;
+        shm_reader_resync(reader);
+        return FALSE;
+    }
+
+    reader->cursor = reader->next;
+    return TRUE;
+}
+
+UINT64 shm_reader_drops(const shm_reader *reader)
+{
+    return reader->drops;
+}
+
+BOOL shm_reader_finished(shm_reader *reader)
+{
+    if (reader->control->closed == 0)
+    {
+        return FALSE;
+    }
+    MemoryBarrier();
+    if (reader->cursor != (UINT64)reader->control->commit)
+    {
+        return FALSE;
+    }
+
+    /* Records skipped on last resync have no successor to reveal them */
+    if ((UINT64)reader->control->published > reader->expected)
+    {
+        reader->drops += (UINT64)reader->control->published - reader->expected;
+        reader->expected = (UINT64)reader->control->published;
+    }
+    return TRUE;
+}
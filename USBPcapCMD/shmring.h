@@ -0,0 +1,142 @@
+/*
+ * Copyright (c) 2026 Tomasz Moń <desowin@gmail.com>
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#ifndef USBPCAP_CMD_SHMRING_H
+#define USBPCAP_CMD_SHMRING_H
+
+#include <windows.h>
+#include "USBPcap.h"
+
+/* Shared memory capture ring.
+ *
+ * One producer publishes captured records into named file mapping, any
+ * number of readers map it read-only and follow with their own cursor.
+ * Producer never waits for readers. Reader that falls behind by more than
+ * the ring size notices it and skips to the newest data, the records it
+ * missed are reported as drops.
+ *
+ * Mapping starts with SHM_RING_CONTROL page followed by capacity bytes of
+ * data. Every record in data area is SHM_RING_RECORD followed by
+ * pcaprec_hdr_t and packet data (USBPCAP_BUFFER_PACKET_HEADER first),
+ * exactly as it would be stored in pcap file. Records start at
+ * SHM_RING_ALIGN boundary and never wrap, unused space at the end of data
+ * area is covered by padding record.
+ *
+ * Positions are byte counts since ring creation, record at position p is
+ * at offset (p & (capacity - 1)). Producer first advances reserve, writes
+ * the record and then advances commit. Record at position p is intact as
+ * long as reserve <= p + capacity.
+ */
+#define SHM_RING_MAGIC          0x52425355  /* "USBR" */
+#define SHM_RING_VERSION        1
+#define SHM_RING_ALIGN          16
+#define SHM_RING_CONTROL_SIZE   4096
+
+#define SHM_RING_DEFAULT_SIZE   (64 * 1024 * 1024)
+#define SHM_RING_MIN_SIZE       (1024 * 1024)
+
+#define SHM_RING_RECORD_PADDING 0x0001  /* Skip to start of data area */
+
+#pragma pack(push, 1)
+typedef struct
+{
+    UINT32 magic;
+    UINT32 version;
+    UINT64 capacity;          /* Data area size, power of two */
+    UINT32 header_valid;      /* Nonzero once pcap header is set */
+    UINT32 closed;            /* Nonzero once producer finished */
+    pcap_hdr_t pcap;          /* pcap header of published stream */
+    UCHAR  reserved1[16];
+
+    /* Written only by producer, kept on separate cache lines */
+    volatile LONG64 reserve;  /* End of data being written */
+    UCHAR  reserved2[56];
+    volatile LONG64 commit;   /* End of published data */
+    volatile LONG64 published; /* Records published so far */
+    UCHAR  reserved3[48];
+} SHM_RING_CONTROL, *PSHM_RING_CONTROL;
+
+typedef struct
+{
+    UINT64 sequence;          /* Record number, padding has the next one */
+    UINT32 length;            /* pcaprec_hdr_t and data, without alignment */
+    UINT32 flags;             /* SHM_RING_RECORD_* */
+} SHM_RING_RECORD, *PSHM_RING_RECORD;
+#pragma pack(pop)
+
+typedef struct
+{
+    HANDLE mapping;
+    PSHM_RING_CONTROL control;
+    unsigned char *ring;
+    UINT64 mask;
+    UINT64 sequence;          /* Number of next published record */
+    UINT64 oversized;         /* Records too large for the ring */
+
+    /* Records can be split across writes, the rest is collected here */
+    unsigned char *record;
+    UINT32 record_size;
+    UINT32 received;
+    UINT32 header_received;
+} shm_ring;
+
+typedef struct
+{
+    HANDLE mapping;
+    const SHM_RING_CONTROL *control;
+    const unsigned char *ring;
+    UINT64 mask;
+    UINT64 cursor;
+    UINT64 next;              /* Position after record returned by next */
+    UINT64 expected;          /* Sequence of next record */
+    UINT64 drops;
+} shm_reader;
+
+/* Creates named mapping with size bytes of data, rounded up to power of
+ * two. Name can use Local\ or Global\ prefix. Only the user running the
+ * capture, administrators and SYSTEM can open it, unless allow_users is
+ * TRUE, then every authenticated user can read it. Returns NULL on failure.
+ */
+shm_ring *shm_ring_create(const char *name, UINT64 size, BOOL allow_users);
+
+/* Accepts pcap stream, starting with pcap file header, split at any
+ * point. Returns FALSE on allocation failure.
+ */
+BOOL shm_ring_write(shm_ring *ring, const unsigned char *data, DWORD length);
+
+/* Marks ring closed and releases it. Readers keep their mapping. */
+void shm_ring_close(shm_ring *ring);
+
+/* Opens ring created by shm_ring_create(). Reader starts at the newest
+ * data. Returns NULL if ring does not exist or is not compatible.
+ */
+shm_reader *shm_reader_open(const char *name);
+void shm_reader_close(shm_reader *reader);
+
+/* Returns pcap header of the stream, NULL until producer received it */
+const pcap_hdr_t *shm_reader_header(shm_reader *reader);
+
+/* Returns TRUE and points record at the next record in shared memory,
+ * or FALSE if there is no new data. length is sizeof(pcaprec_hdr_t) plus
+ * incl_len as written by producer. Record is not copied, so it has to be
+ * released with shm_reader_release() before it can be trusted.
+ */
+BOOL shm_reader_next(shm_reader *reader, const pcaprec_hdr_t **record,
+                     UINT32 *length);
+
+/* Moves past record returned by shm_reader_next(). Returns FALSE if the
+ * record was overwritten while it was accessed, it is then counted as
+ * dropped and the data read from it must be discarded.
+ */
+BOOL shm_reader_release(shm_reader *reader);
+
+/* Records lost because reader was too slow */
+UINT64 shm_reader_drops(const shm_reader *reader);
+
+/* TRUE once producer finished and reader consumed everything */
+BOOL shm_reader_finished(shm_reader *reader);
+
+#endif /* USBPCAP_CMD_SHMRING_H */
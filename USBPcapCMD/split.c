@@ -0,0 +1,556 @@
+/*
+ * Copyright (c) 2026 Tomasz Moń <desowin@gmail.com>
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "pcapfile.h"
+#include "split.h"
+#include "blockfile.h"
+
+/* Every output collects records in its own buffer. Full buffers are
+ * queued to writer thread so parsing continues while data is written.
+ * Single writer thread keeps the per-output write order intact.
+ */
+#define SPLIT_BUFFER_SIZE   (256 * 1024)
+#define SPLIT_BUFFER_COUNT  32
+#define SPLIT_HASH_SIZE     256
+
+/* Endpoint value used when splitting by device only */
+#define SPLIT_ANY_ENDPOINT  0xFFFF
+
+typedef struct _split_output split_output;
+
+typedef struct _split_buffer
+{
+    split_output *output;
+    DWORD length;
+    unsigned char *data;
+    struct _split_buffer *next;
+} split_buffer;
+
+struct _split_output
+{
+    USHORT bus;
+    USHORT device;
+    USHORT endpoint;
+    HANDLE handle;
+    blockfile_writer *compressed;  /* NULL if output is plain pcap */
+    split_buffer *current;
+    volatile LONG failed;
+    split_output *next;      /* Next output in hash bucket */
+    split_output *next_all;  /* Next output in creation order */
+};
+
+/* Records injected by --inject-descriptors for single device */
+typedef struct _split_injected
+{
+    USHORT bus;
+    USHORT device;
+    unsigned char *records;  /* pcaprec_hdr_t followed by data, repeated */
+    UINT32 length;
+    UINT32 size;
+    struct _split_injected *next;
+} split_injected;
+
+typedef struct
+{
+    const char *capture;
+    size_t base_length;      /* capture name length without extension */
+    BOOL by_endpoint;
+    BOOL compress;
+    pcap_hdr_t header;
+
+    split_output *hash[SPLIT_HASH_SIZE];
+    split_output *outputs;
+    split_output *last_output;
+    split_injected *injected;
+
+    split_buffer buffers[SPLIT_BUFFER_COUNT];
+    split_buffer *free_head;
+    split_buffer *queue_head;
+    split_buffer *queue_tail;
+    CRITICAL_SECTION lock;
+    HANDLE free_sem;         /* Counts buffers in free list */
+    HANDLE queue_sem;        /* Counts queued buffers (and done marker) */
+} split_context;
+
+static split_buffer *split_get_free_buffer(split_context *ctx)
+{
+    split_buffer *buffer;
+
+    WaitForSingleObject(ctx->free_sem, INFINITE);
+    EnterCriticalSection(&ctx->lock);
+    buffer = ctx->free_head;
+    ctx->free_head = buffer->next;
+    LeaveCriticalSection(&ctx->lock);
+
+    buffer->next = NULL;
+    buffer->length = 0;
+    return buffer;
+}
+
+static void split_queue_buffer(split_context *ctx, split_buffer *buffer)
+{
+    /* NULL buffer only signals the semaphore. Writer thread finds empty
+     * queue and exits.
+     */
+    EnterCriticalSection(&ctx->lock);
+    if (buffer != NULL)
+    {
+        buffer->next = NULL;
+        if (ctx->queue_tail)
+        {
+            ctx->queue_tail->next = buffer;
+        }
+        else
+        {
+            ctx->queue_head = buffer;
+        }
+        ctx->queue_tail = buffer;
+    }
+    LeaveCriticalSection(&ctx->lock);
+    ReleaseSemaphore(ctx->queue_sem, 1, NULL);
+}
+
+static DWORD WINAPI split_writer_thread(LPVOID param)
+{
+    split_context *ctx = (split_context *)param;
+
+    for (;;)
+    {
+        split_buffer *buffer;
+        DWORD written;
+
+        WaitForSingleObject(ctx->queue_sem, INFINITE);
+        EnterCriticalSection(&ctx->lock);
+        buffer = ctx->queue_head;
+        if (buffer != NULL)
+        {
+            ctx->queue_head = buffer->next;
+            if (ctx->queue_head == NULL)
+            {
+                ctx->queue_tail = NULL;
+            }
+        }
+        LeaveCriticalSection(&ctx->lock);
+
+        if (buffer == NULL)
+        {
+            /* Done marker is only queued after all buffers */
+            break;
+        }
+
+        if (buffer->output->failed != 0)
+        {
+            /* Drop data of failed output */
+        }
+        else if (buffer->output->compressed != NULL)
+        {
+            if (!blockfile_write(buffer->output->compressed, buffer->data, buffer->length))
+            {
+                InterlockedExchange(&buffer->output->failed, ERROR_WRITE_FAULT);
+            }
+        }
+        else if (!WriteFile(buffer->output->handle, buffer->data, buffer->length, &written, NULL) ||
+                 (written != buffer->length))
+        {
+            InterlockedExchange(&buffer->output->failed, GetLastError());
+        }
+
+        EnterCriticalSection(&ctx->lock);
+        buffer->next = ctx->free_head;
+        ctx->free_head = buffer;
+        LeaveCriticalSection(&ctx->lock);
+        ReleaseSemaphore(ctx->free_sem, 1, NULL);
+    }
+
+    return 0;
+}
+
+static void split_append(split_context *ctx, split_output *output,
+                         const void *data, DWORD length)
+{
+    const unsigned char *ptr = (const unsigned char *)data;
+
+    while (length > 0)
+    {
+        DWORD chunk;
+
+        if (output->current == NULL)
+        {
+            output->current = split_get_free_buffer(ctx);
+            output->current->output = output;
+        }
+
+        chunk = min(length, SPLIT_BUFFER_SIZE - output->current->length);
+        memcpy(&output->current->data[output->current->length], ptr, chunk);
+        output->current->length += chunk;
+        ptr += chunk;
+        length -= chunk;
+
+        if (output->current->length == SPLIT_BUFFER_SIZE)
+        {
+            split_queue_buffer(ctx, output->current);
+            output->current = NULL;
+        }
+    }
+}
+
+static split_injected *split_get_injected(split_context *ctx, USHORT bus,
+                                          USHORT device, BOOL create)
+{
+    split_injected *injected;
+
+    for (injected = ctx->injected; injected; injected = injected->next)
+    {
+        if ((injected->bus == bus) && (injected->device == device))
+        {
+            return injected;
+        }
+    }
+
+    if (!create)
+    {
+        return NULL;
+    }
+
+    injected = (split_injected *)calloc(1, sizeof(split_injected));
+    if (injected != NULL)
+    {
+        injected->bus = bus;
+        injected->device = device;
+        injected->next = ctx->injected;
+        ctx->injected = injected;
+    }
+    return injected;
+}
+
+static BOOL split_store_injected(split_context *ctx, pcaprec_hdr_t *hdr,
+                                 unsigned char *data,
+                                 PUSBPCAP_BUFFER_PACKET_HEADER header)
+{
+    split_injected *injected;
+    UINT32 needed;
+
+    injected = split_get_injected(ctx, header->bus, header->device, TRUE);
+    if (injected == NULL)
+    {
+        return FALSE;
+    }
+
+    needed = injected->length + sizeof(pcaprec_hdr_t) + hdr->incl_len;
+    if (needed > injected->size)
+    {
+        UINT32 size = max(needed, injected->size * 2);
+        unsigned char *tmp = realloc(injected->records, size);
+        if (tmp == NULL)
+        {
+            return FALSE;
+        }
+        injected->records = tmp;
+        injected->size = size;
+    }
+
+    memcpy(&injected->records[injected->length], hdr, sizeof(pcaprec_hdr_t));
+    memcpy(&injected->records[injected->length + sizeof(pcaprec_hdr_t)], data, hdr->incl_len);
+    injected->length = needed;
+    return TRUE;
+}
+
+static split_output *split_get_output(split_context *ctx, USHORT bus,
+                                      USHORT device, USHORT endpoint)
+{
+    split_output *output;
+    split_injected *injected;
+    unsigned int hash;
+    char *filename;
+    size_t length;
+
+    output = ctx->last_output;
+    if ((output != NULL) && (output->bus == bus) &&
+        (output->device == device) && (output->endpoint == endpoint))
+    {
+        return output;
+    }
+
+    hash = (bus * 31 + device * 17 + endpoint) % SPLIT_HASH_SIZE;
+    for (output = ctx->hash[hash]; output; output = output->next)
+    {
+        if ((output->bus == bus) && (output->device == device) &&
+            (output->endpoint == endpoint))
+        {
+            ctx->last_output = output;
+            return output;
+        }
+    }
+
+    output = (split_output *)calloc(1, sizeof(split_output));
+    if (output == NULL)
+    {
+        return NULL;
+    }
+
+    /* <base>_busXXXXX_devXXXXX_epXX.pcapz */
+    length = ctx->base_length + 40;
+    filename = malloc(length);
+    if (filename == NULL)
+    {
+        free(output);
+        return NULL;
+    }
+
+    if (endpoint == SPLIT_ANY_ENDPOINT)
+    {
+        sprintf_s(filename, length, "%.*s_bus%u_dev%u.%s",
+                  (int)ctx->base_length, ctx->capture, bus, device,
+                  ctx->compress ? "pcapz" : "pcap");
+    }
+    else
+    {
+        sprintf_s(filename, length, "%.*s_bus%u_dev%u_ep%02x.%s",
+                  (int)ctx->base_length, ctx->capture, bus, device, endpoint,
+                  ctx->compress ? "pcapz" : "pcap");
+    }
+
+    output->handle = CreateFileA(filename,
+                                 GENERIC_WRITE,
+                                 FILE_SHARE_READ,
+                                 NULL,
+                                 CREATE_ALWAYS,
+                                 FILE_ATTRIBUTE_NORMAL,
+                                 NULL);
+    if (output->handle == INVALID_HANDLE_VALUE)
+    {
+        fprintf(stderr, "Failed to create %s - %d\n", filename, GetLastError());
+        free(filename);
+        free(output);
+        return NULL;
+    }
+
+    if (ctx->compress)
+    {
+        output->compressed = blockfile_writer_create(output->handle, SPLIT_BUFFER_SIZE);
+        if (output->compressed == NULL)
+        {
+            CloseHandle(output->handle);
+            free(filename);
+            free(output);
+            return NULL;
+        }
+    }
+
+    fprintf(stderr, "Writing %s\n", filename);
+    free(filename);
+
+    output->bus = bus;
+    output->device = device;
+    output->endpoint = endpoint;
+    output->next = ctx->hash[hash];
+    ctx->hash[hash] = output;
+    output->next_all = ctx->outputs;
+    ctx->outputs = output;
+    ctx->last_output = output;
+
+    split_append(ctx, output, &ctx->header, sizeof(pcap_hdr_t));
+
+    /* Make every output self-describing for Wireshark */
+    injected = split_get_injected(ctx, bus, device, FALSE);
+    if (injected != NULL)
+    {
+        split_append(ctx, output, injected->records, injected->length);
+    }
+
+    return output;
+}
+
+static BOOL split_route(split_context *ctx, pcaprec_hdr_t *hdr, unsigned char *data)
+{
+    PUSBPCAP_BUFFER_PACKET_HEADER header;
+    split_output *output;
+    USHORT endpoint;
+
+    header = pcap_usbpcap_header(data, hdr->incl_len);
+    if (header == NULL)
+    {
+        /* Not a valid USBPcap record, nothing to route by */
+        return TRUE;
+    }
+
+    if (ctx->by_endpoint == FALSE)
+    {
+        endpoint = SPLIT_ANY_ENDPOINT;
+    }
+    else if (header->transfer == USBPCAP_TRANSFER_CONTROL)
+    {
+        /* Default control pipe is bidirectional */
+        endpoint = header->endpoint & 0x7F;
+    }
+    else
+    {
+        endpoint = header->endpoint;
+    }
+
+    output = split_get_output(ctx, header->bus, header->device, endpoint);
+    if (output == NULL)
+    {
+        return FALSE;
+    }
+
+    split_append(ctx, output, hdr, sizeof(pcaprec_hdr_t));
+    split_append(ctx, output, data, hdr->incl_len);
+
+    /* Injected descriptors are the only records without IRP. When
+     * splitting by endpoint, replicate them into all outputs of the
+     * device, including outputs that will be created later.
+     */
+    if (ctx->by_endpoint && (header->irpId == 0) &&
+        (header->transfer == USBPCAP_TRANSFER_CONTROL))
+    {
+        split_output *other;
+
+        for (other = ctx->outputs; other; other = other->next_all)
+        {
+            if ((other != output) && (other->bus == header->bus) &&
+                (other->device == header->device))
+            {
+                split_append(ctx, other, hdr, sizeof(pcaprec_hdr_t));
+                split_append(ctx, other, data, hdr->incl_len);
+            }
+        }
+
+        if (!split_store_injected(ctx, hdr, data, header))
+        {
+            return FALSE;
+        }
+    }
+
+    return TRUE;
+}
+
+int split_capture(const char *capture, BOOL by_endpoint, BOOL compress)
+{
+    split_context ctx;
+    pcap_reader reader;
+    pcaprec_hdr_t hdr;
+    unsigned char *data;
+    HANDLE writer = NULL;
+    split_output *output;
+    int result;
+    int ret = -1;
+    int i;
+
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.capture = capture;
+    ctx.by_endpoint = by_endpoint;
+    ctx.compress = compress;
+
+    ctx.base_length = pcap_base_length(capture);
+
+    if (!pcap_reader_open(&reader, capture))
+    {
+        return -1;
+    }
+    ctx.header = reader.header;
+
+    InitializeCriticalSection(&ctx.lock);
+    ctx.free_sem = CreateSemaphore(NULL, SPLIT_BUFFER_COUNT, SPLIT_BUFFER_COUNT, NULL);
+    ctx.queue_sem = CreateSemaphore(NULL, 0, SPLIT_BUFFER_COUNT + 1, NULL);
+    if ((ctx.free_sem == NULL) || (ctx.queue_sem == NULL))
+    {
+        fprintf(stderr, "Failed to create semaphores - %d\n", GetLastError());
+        goto cleanup;
+    }
+
+    for (i = 0; i < SPLIT_BUFFER_COUNT; i++)
+    {
+        ctx.buffers[i].data = malloc(SPLIT_BUFFER_SIZE);
+        if (ctx.buffers[i].data == NULL)
+        {
+            fprintf(stderr, "Failed to allocate split buffers\n");
+            goto cleanup;
+        }
+        ctx.buffers[i].next = ctx.free_head;
+        ctx.free_head = &ctx.buffers[i];
+    }
+
+    writer = CreateThread(NULL, 0, split_writer_thread, &ctx, 0, NULL);
+    if (writer == NULL)
+    {
+        fprintf(stderr, "Failed to create writer thread\n");
+        goto cleanup;
+    }
+
+    while ((result = pcap_reader_next(&reader, &hdr, &data)) == PCAP_READ_RECORD)
+    {
+        if (!split_route(&ctx, &hdr, data))
+        {
+            result = PCAP_READ_ERROR;
+            break;
+        }
+    }
+
+    /* Flush partially filled buffers and let writer thread finish */
+    for (output = ctx.outputs; output; output = output->next_all)
+    {
+        if (output->current != NULL)
+        {
+            split_queue_buffer(&ctx, output->current);
+            output->current = NULL;
+        }
+    }
+    split_queue_buffer(&ctx, NULL);
+    WaitForSingleObject(writer, INFINITE);
+    CloseHandle(writer);
+
+    ret = (result == PCAP_READ_EOF) ? 0 : -1;
+    for (output = ctx.outputs; output; output = output->next_all)
+    {
+        if (output->failed != 0)
+        {
+            fprintf(stderr, "Write failed for bus %u device %u - %d\n",
+                    output->bus, output->device, output->failed);
+            ret = -1;
+        }
+    }
+
+cleanup:
+    while (ctx.outputs != NULL)
+    {
+        output = ctx.outputs;
+        ctx.outputs = output->next_all;
+        if ((output->compressed != NULL) && !blockfile_writer_close(output->compressed))
+        {
+            fprintf(stderr, "Write failed for bus %u device %u\n",
+                    output->bus, output->device);
+            ret = -1;
+        }
+        CloseHandle(output->handle);
+        free(output);
+    }
+    while (ctx.injected != NULL)
+    {
+        split_injected *injected = ctx.injected;
+        ctx.injected = injected->next;
+        free(injected->records);
+        free(injected);
+    }
+    for (i = 0; i < SPLIT_BUFFER_COUNT; i++)
+    {
+        free(ctx.buffers[i].data);
+    }
+    if (ctx.free_sem != NULL)
+    {
+        CloseHandle(ctx.free_sem);
+    }
+    if (ctx.queue_sem != NULL)
+    {
+        CloseHandle(ctx.queue_sem);
+    }
+    DeleteCriticalSection(&ctx.lock);
+    pcap_reader_close(&reader);
+    return ret;
+}
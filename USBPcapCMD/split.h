@@ -0,0 +1,26 @@
+/*
+ * Copyright (c) 2026 Tomasz Moń <desowin@gmail.com>
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#ifndef USBPCAP_CMD_SPLIT_H
+#define USBPCAP_CMD_SPLIT_H
+
+#include <windows.h>
+
+/* Splits capture file into one file per (bus, device) or, if by_endpoint
+ * is TRUE, per (bus, device, endpoint). Output files are created next to
+ * capture and named <capture>_bus<B>_dev<D>[_ep<EP>].pcap.
+ *
+ * Descriptors injected by --inject-descriptors are copied into every
+ * output that belongs to the device they describe.
+ *
+ * If compress is TRUE, outputs are block compressed and use .pcapz
+ * extension instead.
+ *
+ * Returns 0 on success, -1 on failure.
+ */
+int split_capture(const char *capture, BOOL by_endpoint, BOOL compress);
+
+#endif /* USBPCAP_CMD_SPLIT_H */
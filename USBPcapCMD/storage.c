@@ -0,0 +1,469 @@
+/*
+ * Copyright (c) 2026 Tomasz Moń <desowin@gmail.com>
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "pcapfile.h"
+#include "storage.h"
+
+#define BOT_CBW_SIGNATURE     0x43425355 /* "USBC" */
+#define BOT_CSW_SIGNATURE     0x53425355 /* "USBS" */
+#define BOT_CBW_LENGTH        31
+#define BOT_CSW_LENGTH        13
+
+#define UAS_COMMAND_IU        0x01
+#define UAS_SENSE_IU          0x03
+#define UAS_RESPONSE_IU       0x04
+#define UAS_COMMAND_IU_LENGTH 32
+
+/* UAS devices can have many commands in flight. Slots are reused when
+ * the table is full, so state per device stays bounded no matter how
+ * many commands never complete in the capture.
+ */
+#define UAS_SLOTS             64
+
+/* Latency histogram bucket i counts commands with latency below
+ * 2^(i+1) microseconds. The last bucket counts everything above.
+ */
+#define STORAGE_HIST_BUCKETS  24
+
+typedef struct
+{
+    BOOL valid;
+    UINT64 ts;            /* Command submission time */
+    UINT32 tag;
+    UCHAR lun;
+    UCHAR opcode;
+    UINT64 lba;
+    UINT32 blocks;
+    UINT32 length;        /* BOT dCBWDataTransferLength */
+} storage_command;
+
+typedef struct _storage_device
+{
+    USHORT bus;
+    USHORT device;
+    BOOL bot;             /* Seen Bulk-Only Transport CBW */
+    BOOL uas;             /* Seen UAS Command IU */
+    storage_command bot_command;
+    storage_command uas_commands[UAS_SLOTS];
+    UINT64 evicted;       /* UAS commands dropped without status */
+    struct _storage_device *next;
+} storage_device;
+
+typedef struct
+{
+    UINT64 commands;
+    UINT64 total_us;
+    UINT64 min_us;
+    UINT64 max_us;
+    UINT64 buckets[STORAGE_HIST_BUCKETS];
+} storage_histogram;
+
+typedef struct
+{
+    storage_device *devices;
+    storage_histogram histogram[256];
+
+    /* Timeline, one line per second with any activity */
+    UINT64 second;
+    UINT64 second_commands;
+    UINT64 second_read;
+    UINT64 second_write;
+} storage_context;
+
+static UINT32 get_be32(const UCHAR *p)
+{
+    return ((UINT32)p[0] << 24) | ((UINT32)p[1] << 16) | ((UINT32)p[2] << 8) | p[3];
+}
+
+static UINT32 get_le32(const UCHAR *p)
+{
+    return ((UINT32)p[3] << 24) | ((UINT32)p[2] << 16) | ((UINT32)p[1] << 8) | p[0];
+}
+
+static storage_device *storage_get_device(storage_context *ctx, USHORT bus,
+                                          USHORT device, BOOL create)
+{
+    storage_device *dev;
+
+    for (dev = ctx->devices; dev; dev = dev->next)
+    {
+        if ((dev->bus == bus) && (dev->device == device))
+        {
+            return dev;
+        }
+    }
+
+    if (!create)
+    {
+        return NULL;
+    }
+
+    dev = (storage_device *)calloc(1, sizeof(storage_device));
+    if (dev != NULL)
+    {
+        dev->bus = bus;
+        dev->device = device;
+        dev->next = ctx->devices;
+        ctx->devices = dev;
+    }
+    return dev;
+}
+
+/* Extracts LBA and transfer length (in blocks) from SCSI CDB */
+static void storage_decode_cdb(storage_command *cmd, const UCHAR *cdb, int length)
+{
+    cmd->opcode = cdb[0];
+    cmd->lba = 0;
+    cmd->blocks = 0;
+
+    switch (cdb[0])
+    {
+        case 0x08: /* READ(6) */
+        case 0x0A: /* WRITE(6) */
+            if (length >= 6)
+            {
+                cmd->lba = ((UINT32)(cdb[1] & 0x1F) << 16) | ((UINT32)cdb[2] << 8) | cdb[3];
+                cmd->blocks = (cdb[4] == 0) ? 256 : cdb[4];
+            }
+            break;
+        case 0x28: /* READ(10) */
+        case 0x2A: /* WRITE(10) */
+        case 0x2F: /* VERIFY(10) */
+        case 0x35: /* SYNCHRONIZE CACHE(10) */
+            if (length >= 10)
+            {
+                cmd->lba = get_be32(&cdb[2]);
+                cmd->blocks = ((UINT32)cdb[7] << 8) | cdb[8];
+            }
+            break;
+        case 0xA8: /* READ(12) */
+        case 0xAA: /* WRITE(12) */
+            if (length >= 12)
+            {
+                cmd->lba = get_be32(&cdb[2]);
+                cmd->blocks = get_be32(&cdb[6]);
+            }
+            break;
+        case 0x88: /* READ(16) */
+        case 0x8A: /* WRITE(16) */
+        case 0x91: /* SYNCHRONIZE CACHE(16) */
+            if (length >= 16)
+            {
+                cmd->lba = ((UINT64)get_be32(&cdb[2]) << 32) | get_be32(&cdb[6]);
+                cmd->blocks = get_be32(&cdb[10]);
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+static void storage_flush_second(storage_context *ctx)
+{
+    if (ctx->second_commands || ctx->second_read || ctx->second_write)
+    {
+        printf("second,%I64u,%I64u,%I64u,%I64u\n", ctx->second,
+               ctx->second_commands, ctx->second_read, ctx->second_write);
+    }
+    ctx->second_commands = 0;
+    ctx->second_read = 0;
+    ctx->second_write = 0;
+}
+
+static void storage_advance_time(storage_context *ctx, UINT64 ts)
+{
+    UINT64 second = ts / 1000000;
+
+    if (second != ctx->second)
+    {
+        storage_flush_second(ctx);
+        ctx->second = second;
+    }
+}
+
+static void storage_complete(storage_context *ctx, storage_device *dev,
+                             storage_command *cmd, UINT64 ts,
+                             UINT32 bytes, UINT32 status)
+{
+    storage_histogram *hist = &ctx->histogram[cmd->opcode];
+    UINT64 latency = (ts > cmd->ts) ? (ts - cmd->ts) : 0;
+    int bucket = 0;
+
+    while ((bucket < STORAGE_HIST_BUCKETS - 1) && (latency >= ((UINT64)2 << bucket)))
+    {
+        bucket++;
+    }
+
+    if ((hist->commands == 0) || (latency < hist->min_us))
+    {
+        hist->min_us = latency;
+    }
+    if (latency > hist->max_us)
+    {
+        hist->max_us = latency;
+    }
+    hist->commands++;
+    hist->total_us += latency;
+    hist->buckets[bucket]++;
+
+    ctx->second_commands++;
+
+    printf("command,%I64u.%06I64u,%u,%u,%u,%u,0x%02x,%I64u,%u,%u,%u,%I64u\n",
+           cmd->ts / 1000000, cmd->ts % 1000000, dev->bus, dev->device,
+           cmd->lun, cmd->tag, cmd->opcode, cmd->lba, cmd->blocks,
+           bytes, status, latency);
+
+    cmd->valid = FALSE;
+}
+
+static BOOL storage_bot_cbw(storage_device *dev, UINT64 ts, const UCHAR *p, UINT32 length)
+{
+    storage_command *cmd = &dev->bot_command;
+    int cdb_length;
+
+    if ((length != BOT_CBW_LENGTH) || (get_le32(p) != BOT_CBW_SIGNATURE))
+    {
+        return FALSE;
+    }
+
+    cdb_length = p[14] & 0x1F;
+    if ((cdb_length < 1) || (cdb_length > 16))
+    {
+        return FALSE;
+    }
+
+    /* BOT allows only one command at a time. Previous command without
+     * CSW was aborted (reset recovery) and is dropped.
+     */
+    dev->bot = TRUE;
+    cmd->valid = TRUE;
+    cmd->ts = ts;
+    cmd->tag = get_le32(&p[4]);
+    cmd->length = get_le32(&p[8]);
+    cmd->lun = p[13] & 0x0F;
+    storage_decode_cdb(cmd, &p[15], cdb_length);
+    return TRUE;
+}
+
+static BOOL storage_bot_csw(storage_context *ctx, storage_device *dev, UINT64 ts,
+                            const UCHAR *p, UINT32 length)
+{
+    storage_command *cmd = &dev->bot_command;
+    UINT32 residue;
+
+    if ((length != BOT_CSW_LENGTH) || (get_le32(p) != BOT_CSW_SIGNATURE))
+    {
+        return FALSE;
+    }
+
+    if (cmd->valid && (get_le32(&p[4]) == cmd->tag))
+    {
+        residue = get_le32(&p[8]);
+        storage_complete(ctx, dev, cmd, ts,
+                         (residue < cmd->length) ? cmd->length - residue : 0,
+                         p[12]);
+    }
+    return TRUE;
+}
+
+static BOOL storage_uas_command(storage_device *dev, UINT64 ts, const UCHAR *p, UINT32 length)
+{
+    storage_command *cmd;
+    UINT32 tag;
+
+    /* Reserved bytes must be zero, which filters out most bulk data */
+    if ((length < UAS_COMMAND_IU_LENGTH) || (p[0] != UAS_COMMAND_IU) ||
+        (p[1] != 0) || (p[5] != 0) || (p[7] != 0) ||
+        (length != UAS_COMMAND_IU_LENGTH + (UINT32)(p[6] & 0xFC)))
+    {
+        return FALSE;
+    }
+
+    tag = ((UINT32)p[2] << 8) | p[3];
+    cmd = &dev->uas_commands[tag % UAS_SLOTS];
+    if (cmd->valid)
+    {
+        dev->evicted++;
+    }
+
+    dev->uas = TRUE;
+    cmd->valid = TRUE;
+    cmd->ts = ts;
+    cmd->tag = tag;
+    cmd->length = 0;
+    cmd->lun = p[9];
+    storage_decode_cdb(cmd, &p[16], 16);
+    return TRUE;
+}
+
+static BOOL storage_uas_status(storage_context *ctx, storage_device *dev, UINT64 ts,
+                               const UCHAR *p, UINT32 length)
+{
+    storage_command *cmd;
+    UINT32 tag;
+
+    if ((length < 8) || (p[1] != 0) ||
+        ((p[0] != UAS_SENSE_IU) && (p[0] != UAS_RESPONSE_IU)))
+    {
+        return FALSE;
+    }
+
+    tag = ((UINT32)p[2] << 8) | p[3];
+    cmd = &dev->uas_commands[tag % UAS_SLOTS];
+    if (!cmd->valid || (cmd->tag != tag))
+    {
+        return FALSE;
+    }
+
+    /* Sense IU carries SCSI status, Response IU the response code */
+    storage_complete(ctx, dev, cmd, ts, 0, (p[0] == UAS_SENSE_IU) ? p[6] : p[7]);
+    return TRUE;
+}
+
+static void storage_process(storage_context *ctx, UINT64 ts,
+                            unsigned char *data, UINT32 incl_len)
+{
+    PUSBPCAP_BUFFER_PACKET_HEADER header;
+    storage_device *dev;
+    const UCHAR *payload;
+    UINT32 length;
+    BOOL in;
+
+    header = pcap_usbpcap_header(data, incl_len);
+    if ((header == NULL) || (header->transfer != USBPCAP_TRANSFER_BULK))
+    {
+        return;
+    }
+
+    storage_advance_time(ctx, ts);
+
+    in = (header->endpoint & 0x80) ? TRUE : FALSE;
+    payload = data + header->headerLen;
+    length = min(header->dataLength, incl_len - header->headerLen);
+
+    /* OUT data is attached to submission, IN data to completion */
+    if ((in == FALSE) == ((header->info & USBPCAP_INFO_PDO_TO_FDO) != 0))
+    {
+        return;
+    }
+
+    if ((header->status != 0) || (length == 0))
+    {
+        return;
+    }
+
+    if (in)
+    {
+        dev = storage_get_device(ctx, header->bus, header->device, FALSE);
+        if (dev == NULL)
+        {
+            return;
+        }
+
+        if (dev->bot && storage_bot_csw(ctx, dev, ts, payload, length))
+        {
+            return;
+        }
+        if (dev->uas && storage_uas_status(ctx, dev, ts, payload, length))
+        {
+            return;
+        }
+        ctx->second_read += header->dataLength;
+    }
+    else
+    {
+        dev = storage_get_device(ctx, header->bus, header->device, FALSE);
+        if ((dev == NULL) &&
+            (((length == BOT_CBW_LENGTH) && (get_le32(payload) == BOT_CBW_SIGNATURE)) ||
+             ((length >= UAS_COMMAND_IU_LENGTH) && (payload[0] == UAS_COMMAND_IU))))
+        {
+            dev = storage_get_device(ctx, header->bus, header->device, TRUE);
+        }
+        if (dev == NULL)
+        {
+            return;
+        }
+
+        if (storage_bot_cbw(dev, ts, payload, length) ||
+            storage_uas_command(dev, ts, payload, length))
+        {
+            return;
+        }
+        ctx->second_write += header->dataLength;
+    }
+}
+
+static void storage_print_histograms(storage_context *ctx)
+{
+    int opcode;
+    int i;
+
+    for (opcode = 0; opcode < 256; opcode++)
+    {
+        storage_histogram *hist = &ctx->histogram[opcode];
+
+        if (hist->commands == 0)
+        {
+            continue;
+        }
+
+        printf("latency,0x%02x,%I64u,%I64u,%I64u,%I64u", opcode, hist->commands,
+               hist->min_us, hist->total_us / hist->commands, hist->max_us);
+        for (i = 0; i < STORAGE_HIST_BUCKETS; i++)
+        {
+            printf(",%I64u", hist->buckets[i]);
+        }
+        printf("\n");
+    }
+}
+
+int storage_analyze(const char *capture)
+{
+    storage_context *ctx;
+    pcap_reader reader;
+    pcaprec_hdr_t hdr;
+    unsigned char *data;
+    int result;
+
+    ctx = (storage_context *)calloc(1, sizeof(storage_context));
+    if (ctx == NULL)
+    {
+        return -1;
+    }
+
+    if (!pcap_reader_open(&reader, capture))
+    {
+        free(ctx);
+        return -1;
+    }
+
+    while ((result = pcap_reader_next(&reader, &hdr, &data)) == PCAP_READ_RECORD)
+    {
+        storage_process(ctx, pcap_reader_timestamp(&reader, &hdr), data, hdr.incl_len);
+    }
+
+    storage_flush_second(ctx);
+    storage_print_histograms(ctx);
+
+    while (ctx->devices != NULL)
+    {
+        storage_device *dev = ctx->devices;
+        ctx->devices = dev->next;
+        if (dev->evicted > 0)
+        {
+            fprintf(stderr, "Bus %u Device %u: %I64u UAS commands without status\n",
+                    dev->bus, dev->device, dev->evicted);
+        }
+        free(dev);
+    }
+
+    pcap_reader_close(&reader);
+    free(ctx);
+    return (result == PCAP_READ_ERROR) ? -1 : 0;
+}
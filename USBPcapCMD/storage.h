@@ -0,0 +1,22 @@
+/*
+ * Copyright (c) 2026 Tomasz Moń <desowin@gmail.com>
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#ifndef USBPCAP_CMD_STORAGE_H
+#define USBPCAP_CMD_STORAGE_H
+
+/* Decodes USB Mass Storage Bulk-Only Transport and USB Attached SCSI
+ * commands in capture file (or standard input when capture is "-").
+ *
+ * Output is written to standard output as comma separated lines:
+ *   command,<time>,<bus>,<device>,<lun>,<tag>,<opcode>,<lba>,<blocks>,<bytes>,<status>,<latency_us>
+ *   second,<time>,<commands>,<read_bytes>,<write_bytes>
+ *   latency,<opcode>,<commands>,<min_us>,<avg_us>,<max_us>,<bucket counts...>
+ *
+ * Returns 0 on success, -1 on failure.
+ */
+int storage_analyze(const char *capture);
+
+#endif /* USBPCAP_CMD_STORAGE_H */
@@ -12,6 +12,27 @@
 #include "thread.h"
 #include "iocontrol.h"
 #include "descriptors.h"
+#include "annotate.h"
+#include "ioengine.h"
+
+/* Packets held in reorder window are written out when there was no new
+ * data for this long. Any packet completed before that is already in the
+ * buffer, so nothing older can arrive anymore.
+ */
+#define REORDER_IDLE_FLUSH_MS  100
+
+/* Engine threads dispatching completions of capture I/O */
+#define CAPTURE_ENGINE_THREADS  2
+
+/* Reading pauses while output queue holds this many read buffers */
+#define OUTPUT_QUEUE_BUFFERS  4
+
+/* Context of reorder and inflate stage sinks */
+struct stage_output
+{
+    struct thread_data *data;
+    LPOVERLAPPED write_overlapped;
+};
 
 HANDLE create_filter_read_handle(struct thread_data *data)
 {
@@ -58,6 +79,43 @@ HANDLE create_filter_read_handle(struct thread_data *data)
         goto finish;
     }
 
+    if (data->sequence_numbers || data->compact_ring || data->compress_payload ||
+        data->aligned_ring)
+    {
+        USBPCAP_IOCTL_OPTIONS options;
+
+        options.options = 0;
+        if (data->sequence_numbers)
+        {
+            options.options |= USBPCAP_OPTION_SEQUENCE_NUMBERS;
+        }
+        if (data->compact_ring)
+        {
+            options.options |= USBPCAP_OPTION_COMPACT_RING;
+        }
+        if (data->aligned_ring)
+        {
+            options.options |= USBPCAP_OPTION_ALIGNED_RING;
+        }
+        if (data->compress_payload)
+        {
+            options.options |= USBPCAP_OPTION_COMPRESS_PAYLOAD;
+        }
+        if (!DeviceIoControl(filter_handle,
+                             IOCTL_USBPCAP_SET_OPTIONS,
+                             &options,
+                             sizeof(options),
+                             NULL,
+                             0,
+                             &bytes_ret,
+                             0))
+        {
+            fprintf(stderr, "Failed to set capture options - %d\n",
+                    GetLastError());
+            goto finish;
+        }
+    }
+
     ((PUSBPCAP_IOCTL_SIZE)inBuf)->size = data->bufferlen;
 
     if (!DeviceIoControl(filter_handle,
@@ -110,7 +168,43 @@ finish:
 static void write_data(struct thread_data* data, LPOVERLAPPED write_overlapped,
                        void *buffer, DWORD bytes)
 {
-    /* Write data to the end of the file. */
+    if (data->shm != NULL)
+    {
+        /* Readers follow on their own, producer never waits for them */
+        if (!shm_ring_write(data->shm, buffer, bytes))
+        {
+            fprintf(stderr, "Shared memory write failed. Stopping capture.\n");
+            data->process = FALSE;
+        }
+        return;
+    }
+
+    if (data->compressor != NULL)
+    {
+        /* Only copies data, blocks are compressed and written by workers */
+        if (!blockfile_write(data->compressor, buffer, bytes))
+        {
+            fprintf(stderr, "Compressed write failed. Stopping capture.\n");
+            data->process = FALSE;
+        }
+        return;
+    }
+
+    if (data->output != NULL)
+    {
+        /* Only copies data, engine writes it while capture goes on */
+        if (!write_queue_write(data->output, buffer, bytes) && data->process)
+        {
+            fprintf(stderr, "Write failed (%d). Stopping capture.\n",
+                    write_queue_error(data->output));
+            data->process = FALSE;
+        }
+        return;
+    }
+
+    /* Standard output is not opened for overlapped I/O, write it in place.
+     * Write data to the end of the file.
+     */
     write_overlapped->Offset = 0xFFFFFFFF;
     write_overlapped->OffsetHigh = 0xFFFFFFFF;
     if (!WriteFile(data->write_handle, buffer, bytes, NULL, write_overlapped))
@@ -140,9 +234,14 @@ static void write_data(struct thread_data* data, LPOVERLAPPED write_overlapped,
     ResetEvent(write_overlapped->hEvent);
 }
 
-static void process_data(struct thread_data* data, LPOVERLAPPED write_overlapped,
-                         unsigned char *buffer, DWORD bytes)
+static void process_stream(struct thread_data* data, LPOVERLAPPED write_overlapped,
+                           unsigned char *buffer, DWORD bytes)
 {
+    if (data->stats != NULL)
+    {
+        live_stats_feed(data->stats, buffer, bytes);
+    }
+
     if (data->descriptors.buf_written < sizeof(pcap_hdr_t))
     {
         DWORD to_write = sizeof(pcap_hdr_t) - data->descriptors.buf_written;
@@ -157,9 +256,9 @@ static void process_data(struct thread_data* data, LPOVERLAPPED write_overlapped
         {
             pcap_hdr_t *hdr = (pcap_hdr_t *)data->descriptors.buf;
             write_data(data, write_overlapped, data->descriptors.buf, sizeof(pcap_hdr_t));
-            if ((hdr->magic_number == 0xA1B2C3D4) && (hdr->network == DLT_USBPCAP) && (data->descriptors.descriptors_len > 0))
+            if ((hdr->magic_number == 0xA1B2C3D4) && (hdr->network == DLT_USBPCAP) && (data->descriptors.packets.length > 0))
             {
-                write_data(data, write_overlapped, data->descriptors.descriptors, data->descriptors.descriptors_len);
+                write_data(data, write_overlapped, data->descriptors.packets.data, data->descriptors.packets.length);
             }
         }
         buffer += to_write;
@@ -171,28 +270,298 @@ static void process_data(struct thread_data* data, LPOVERLAPPED write_overlapped
             return;
         }
     }
+    if (data->reorder != NULL)
+    {
+        if (!reorder_feed(data->reorder, buffer, bytes))
+        {
+            fprintf(stderr, "Reorder failed. Stopping capture.\n");
+            data->process = FALSE;
+        }
+        return;
+    }
     write_data(data, write_overlapped, buffer, bytes);
 }
 
+static void reorder_write_data(void *ctx, const unsigned char *buffer, DWORD bytes)
+{
+    struct stage_output *output = (struct stage_output *)ctx;
+
+    write_data(output->data, output->write_overlapped, (void *)buffer, bytes);
+}
+
+static void inflate_process_stream(void *ctx, const unsigned char *buffer, DWORD bytes)
+{
+    struct stage_output *output = (struct stage_output *)ctx;
+
+    process_stream(output->data, output->write_overlapped, (unsigned char *)buffer, bytes);
+}
+
+static void process_data(struct thread_data* data, LPOVERLAPPED write_overlapped,
+                         unsigned char *buffer, DWORD bytes)
+{
+    if (data->inflate != NULL)
+    {
+        /* Compressed payloads are restored before anything looks at them */
+        if (!inflate_feed(data->inflate, buffer, bytes))
+        {
+            fprintf(stderr, "Inflate failed. Stopping capture.\n");
+            data->process = FALSE;
+        }
+        return;
+    }
+    process_stream(data, write_overlapped, buffer, bytes);
+}
+
+/* Capture I/O completing to read_thread() engine.
+ *
+ * Callbacks run on engine threads, or on read_thread() where they could
+ * not be started. Pipeline stages are
+ * entered with pipeline lock held, which also serializes starting reads
+ * with the end of capture.
+ */
+struct capture_io
+{
+    struct thread_data *data;
+    io_engine *engine;
+    HANDLE stopped;         /* Set once process is cleared in a callback */
+    CRITICAL_SECTION pipeline;
+    LPOVERLAPPED write_overlapped;
+    unsigned char *buffer;
+    BOOL read_stalled;      /* Read waits for output queue to drain */
+    DWORD last_data;        /* GetTickCount() of last read data */
+    BOOL output_failed;     /* Output write failure was reported */
+    io_request read;
+    io_request connect;
+    io_request exit;
+    io_request annotate;
+    annotate_pipe annotations;
+    /* Dummy reads from write handle are used to detect broken pipe */
+    io_request write_handle_read;
+    OVERLAPPED write_handle_read_overlapped;
+    BOOL write_handle_read_pending;
+    unsigned char dummy_buf;
+};
+
+/* Lets read_thread() notice that capture has ended in a callback */
+static void capture_check(struct capture_io *io)
+{
+    if (io->data->process == FALSE)
+    {
+        SetEvent(io->stopped);
+        io_engine_wake(io->engine);
+    }
+}
+
+/* Called with pipeline lock held */
+static void capture_start_read(struct capture_io *io)
+{
+    if ((io->data->output != NULL) && write_queue_full(io->data->output))
+    {
+        /* capture_output_ready() starts the read later */
+        io->read_stalled = TRUE;
+        return;
+    }
+
+    if (!io_read(&io->read, io->data->read_handle, io->buffer, io->data->bufferlen))
+    {
+        io->data->process = FALSE;
+    }
+}
+
+static void capture_read_done(io_request *request, DWORD error, DWORD bytes)
+{
+    struct capture_io *io = (struct capture_io *)request->ctx;
+    struct thread_data *data = io->data;
+
+    EnterCriticalSection(&io->pipeline);
+    if (data->process == FALSE)
+    {
+        /* Read was cancelled on exit */
+        LeaveCriticalSection(&io->pipeline);
+        return;
+    }
+
+    if (error != ERROR_SUCCESS)
+    {
+        /* Broken pipe means worker or capture service has quit */
+        if (error != ERROR_BROKEN_PIPE)
+        {
+            fprintf(stderr, "Read failed (%d). Stopping capture.\n", error);
+        }
+        data->process = FALSE;
+    }
+    else
+    {
+        io->last_data = GetTickCount();
+        process_data(data, io->write_overlapped, io->buffer, bytes);
+        if (data->stats != NULL)
+        {
+            live_stats_tick(data->stats);
+        }
+        if (data->process)
+        {
+            /* Start new read. */
+            capture_start_read(io);
+        }
+    }
+    LeaveCriticalSection(&io->pipeline);
+    capture_check(io);
+}
+
+static void capture_output_ready(void *ctx)
+{
+    struct capture_io *io = (struct capture_io *)ctx;
+    DWORD error = write_queue_error(io->data->output);
+
+    EnterCriticalSection(&io->pipeline);
+    if (error != ERROR_SUCCESS)
+    {
+        if (!io->output_failed && io->data->process)
+        {
+            /* Failed to write to output. Quit. */
+            fprintf(stderr, "Write failed (%d). Stopping capture.\n", error);
+        }
+        io->output_failed = TRUE;
+        io->data->process = FALSE;
+    }
+    else if (io->read_stalled && io->data->process)
+    {
+        io->read_stalled = FALSE;
+        capture_start_read(io);
+    }
+    LeaveCriticalSection(&io->pipeline);
+    capture_check(io);
+}
+
+static void capture_connect_done(io_request *request, DWORD error, DWORD bytes)
+{
+    struct capture_io *io = (struct capture_io *)request->ctx;
+
+    EnterCriticalSection(&io->pipeline);
+    if (io->data->process == FALSE)
+    {
+        LeaveCriticalSection(&io->pipeline);
+        return;
+    }
+
+    if (error != ERROR_SUCCESS)
+    {
+        fprintf(stderr, "ConnectNamedPipe() failed with code %d\n", error);
+        io->data->process = FALSE;
+    }
+    else
+    {
+        /* Start reading data. */
+        capture_start_read(io);
+    }
+    LeaveCriticalSection(&io->pipeline);
+    capture_check(io);
+}
+
+static void capture_start_write_handle_read(struct capture_io *io)
+{
+    if (io->data->output != NULL)
+    {
+        /* Write handle is attached to engine, the read completes to it */
+        if (!io_read(&io->write_handle_read, io->data->write_handle,
+                     &io->dummy_buf, sizeof(io->dummy_buf)))
+        {
+            io->data->process = FALSE;
+        }
+        return;
+    }
+
+    ResetEvent(io->write_handle_read_overlapped.hEvent);
+    io->write_handle_read_pending = TRUE;
+    if (!ReadFile(io->data->write_handle, &io->dummy_buf, sizeof(io->dummy_buf),
+                  NULL, &io->write_handle_read_overlapped))
+    {
+        DWORD err = GetLastError();
+
+        if (err != ERROR_IO_PENDING)
+        {
+            io->write_handle_read_pending = FALSE;
+            if (err == ERROR_BROKEN_PIPE)
+            {
+                io->data->process = FALSE;
+            }
+            /* Event is never signalled, nothing to watch */
+            return;
+        }
+    }
+    io_watch(&io->write_handle_read, io->write_handle_read_overlapped.hEvent);
+}
+
+static void capture_write_handle_read_done(io_request *request, DWORD error, DWORD bytes)
+{
+    struct capture_io *io = (struct capture_io *)request->ctx;
+    DWORD dummy_read;
+
+    if ((io->data->output == NULL) &&
+        !GetOverlappedResult(io->data->write_handle, &io->write_handle_read_overlapped,
+                             &dummy_read, TRUE))
+    {
+        error = GetLastError();
+    }
+    io->write_handle_read_pending = FALSE;
+
+    if (error == ERROR_BROKEN_PIPE)
+    {
+        /* We should quit. */
+        io->data->process = FALSE;
+        capture_check(io);
+        return;
+    }
+
+    if ((error == ERROR_OPERATION_ABORTED) || (io->data->process == FALSE))
+    {
+        /* Cancelled on exit */
+        return;
+    }
+
+    /* Don't care about result. Start read again. */
+    capture_start_write_handle_read(io);
+}
+
+static void capture_exit_signalled(io_request *request, DWORD error, DWORD bytes)
+{
+    struct capture_io *io = (struct capture_io *)request->ctx;
+
+    /* We should quit as exit_event is set. */
+    io->data->process = FALSE;
+    capture_check(io);
+}
+
+static void capture_annotate_signalled(io_request *request, DWORD error, DWORD bytes)
+{
+    struct capture_io *io = (struct capture_io *)request->ctx;
+
+    annotate_pipe_process(&io->annotations, io->data->read_handle);
+    io_watch(&io->annotate, annotate_pipe_event(&io->annotations));
+}
+
 DWORD WINAPI read_thread(LPVOID param)
 {
     struct thread_data* data = (struct thread_data*)param;
-    unsigned char* buffer;
-    DWORD dummy_read;
-    unsigned char dummy_buf;
-    OVERLAPPED read_overlapped;
     OVERLAPPED write_overlapped;
-    OVERLAPPED connect_overlapped;
-    OVERLAPPED write_handle_read_overlapped; /* Used to detect broken pipe. */
-    DWORD read;
-    DWORD err;
-    HANDLE table[5];
-    int table_count = 0;
+    struct capture_io io;
+    io_engine *engine = NULL;
+    DWORD threads;
+    BOOL annotate = FALSE;
+    struct stage_output output;
 
-    memset(&table, 0, sizeof(table));
+    memset(&io, 0, sizeof(io));
+    memset(&write_overlapped, 0, sizeof(write_overlapped));
+    io.data = data;
+    io.write_overlapped = &write_overlapped;
+    InitializeCriticalSection(&io.pipeline);
+    io.stopped = CreateEvent(NULL,
+                             TRUE /* Manual Reset */,
+                             FALSE /* Default non signaled */,
+                             NULL /* No name */);
 
-    buffer = malloc(data->bufferlen);
-    if (buffer == NULL)
+    io.buffer = malloc(data->bufferlen);
+    if (io.buffer == NULL)
     {
         fprintf(stderr, "Failed to allocate user-mode buffer (length %d)\n",
                 data->bufferlen);
@@ -211,135 +580,285 @@ DWORD WINAPI read_thread(LPVOID param)
         goto finish;
     }
 
-    memset(&read_overlapped, 0, sizeof(read_overlapped));
-    memset(&connect_overlapped, 0, sizeof(connect_overlapped));
-    memset(&write_overlapped, 0, sizeof(write_overlapped));
-    memset(&write_handle_read_overlapped, 0, sizeof(write_handle_read_overlapped));
-    read_overlapped.hEvent = CreateEvent(NULL,
-                                         TRUE /* Manual Reset */,
-                                         FALSE /* Default non signaled */,
-                                         NULL /* No name */);
-    connect_overlapped.hEvent = CreateEvent(NULL,
-                                            TRUE /* Manual Reset */,
-                                            FALSE /* Default non signaled */,
-                                            NULL /* No name */);
+    if (data->compress)
+    {
+        data->compressor = blockfile_writer_create(data->write_handle,
+                                                   BLOCKFILE_DEFAULT_BLOCK_SIZE);
+        if (data->compressor == NULL)
+        {
+            fprintf(stderr, "Failed to start compressed output\n");
+            goto finish;
+        }
+    }
+
+    if (data->shm_name != NULL)
+    {
+        data->shm = shm_ring_create(data->shm_name, data->shm_size,
+                                    data->shm_allow_users);
+        if (data->shm == NULL)
+        {
+            goto finish;
+        }
+    }
+
+    output.data = data;
+    output.write_overlapped = &write_overlapped;
+
+    if (data->reorder_window > 0)
+    {
+        data->reorder = reorder_create(data->reorder_window,
+                                       reorder_write_data, &output);
+        if (data->reorder == NULL)
+        {
+            fprintf(stderr, "Failed to start reorder stage\n");
+            goto finish;
+        }
+    }
+
+    if (data->compress_payload)
+    {
+        data->inflate = inflate_create(inflate_process_stream, &output);
+        if (data->inflate == NULL)
+        {
+            fprintf(stderr, "Failed to start inflate stage\n");
+            goto finish;
+        }
+    }
+
+    if (data->live_stats || (data->live_stats_json != NULL))
+    {
+        data->stats = live_stats_create(data->live_stats_json);
+        if (data->stats == NULL)
+        {
+            goto finish;
+        }
+    }
+
+    engine = io_engine_create();
+    if ((engine == NULL) || !io_engine_attach(engine, data->read_handle))
+    {
+        goto finish;
+    }
+    io.engine = engine;
+
+    if ((data->shm == NULL) && (data->compressor == NULL) &&
+        (data->write_handle != GetStdHandle(STD_OUTPUT_HANDLE)))
+    {
+        if (!io_engine_attach(engine, data->write_handle))
+        {
+            goto finish;
+        }
+        data->output = write_queue_create(engine, data->write_handle,
+                                          OUTPUT_QUEUE_BUFFERS * data->bufferlen,
+                                          capture_output_ready, &io);
+        if (data->output == NULL)
+        {
+            fprintf(stderr, "Failed to start output queue\n");
+            goto finish;
+        }
+    }
+    io_request_init(&io.read, engine, capture_read_done, &io);
+    io_request_init(&io.connect, engine, capture_connect_done, &io);
+    io_request_init(&io.exit, engine, capture_exit_signalled, &io);
+    io_request_init(&io.annotate, engine, capture_annotate_signalled, &io);
+    io_request_init(&io.write_handle_read, engine, capture_write_handle_read_done, &io);
+
     write_overlapped.hEvent = CreateEvent(NULL,
                                           TRUE /* Manual Reset */,
                                           FALSE /* Default non signaled */,
                                           NULL /* No name */);
-    write_handle_read_overlapped.hEvent = CreateEvent(NULL,
-                                                      TRUE /* Manual Reset */,
-                                                      FALSE /* Default non signaled */,
-                                                      NULL /* No name */);
-    table[table_count] = read_overlapped.hEvent;
-    table_count++;
-    table[table_count] = write_overlapped.hEvent;
-    table_count++;
+    io.write_handle_read_overlapped.hEvent = CreateEvent(NULL,
+                                                         TRUE /* Manual Reset */,
+                                                         FALSE /* Default non signaled */,
+                                                         NULL /* No name */);
     if (GetFileType(data->write_handle) == FILE_TYPE_PIPE)
     {
         /* Setup dummy reads from write handle so we can detect broken pipe
-         * even ifthere isn't any data read from read handle.
+         * even if there isn't any data read from read handle.
          */
-        table[table_count] = write_handle_read_overlapped.hEvent;
-        table_count++;
-        ReadFile(data->write_handle, &dummy_buf, sizeof(dummy_buf), NULL, &write_handle_read_overlapped);
+        capture_start_write_handle_read(&io);
     }
     if (data->exit_event != INVALID_HANDLE_VALUE)
     {
-        table[table_count] = data->exit_event;
-        table_count++;
+        io_watch(&io.exit, data->exit_event);
     }
 
-    if (GetFileType(data->read_handle) == FILE_TYPE_PIPE)
+    if ((data->annotate_pipe != NULL) &&
+        (GetFileType(data->read_handle) != FILE_TYPE_PIPE))
     {
-        table[table_count] = connect_overlapped.hEvent;
-        table_count++;
-        if (!ConnectNamedPipe(data->read_handle, &connect_overlapped))
+        /* Only the process that has the capture handle serves annotations */
+        annotate = annotate_pipe_open(&io.annotations, data->annotate_pipe);
+        if (annotate)
         {
-            err = GetLastError();
-            if ((err != ERROR_IO_PENDING) && (err != ERROR_PIPE_CONNECTED))
-            {
-                fprintf(stderr, "ConnectNamedPipe() failed with code %d\n", err);
-                data->process = FALSE;
-            }
+            io_watch(&io.annotate, annotate_pipe_event(&io.annotations));
+        }
+    }
+
+    if ((GetFileType(data->read_handle) == FILE_TYPE_PIPE) && !data->read_connected)
+    {
+        if (!io_connect(&io.connect, data->read_handle))
+        {
+            data->process = FALSE;
         }
     }
     else
     {
-        ReadFile(data->read_handle, (PVOID)buffer, data->bufferlen, NULL, &read_overlapped);
+        EnterCriticalSection(&io.pipeline);
+        capture_start_read(&io);
+        LeaveCriticalSection(&io.pipeline);
     }
 
+    /* Completions are dispatched by engine threads, or by this thread if
+     * they could not be started
+     */
+    threads = io_engine_start(engine, CAPTURE_ENGINE_THREADS);
     for (; data->process == TRUE;)
     {
-        DWORD dw;
+        DWORD timeout = INFINITE;
 
-        dw = WaitForMultipleObjects(table_count,
-                                    table,
-                                    FALSE,
-                                    INFINITE);
-#pragma warning(default : 4296)
-        if ((dw >= WAIT_OBJECT_0) && dw < (WAIT_OBJECT_0 + table_count))
+        EnterCriticalSection(&io.pipeline);
+        if ((data->reorder != NULL) && (reorder_pending(data->reorder) > 0))
         {
-            int i = dw - WAIT_OBJECT_0;
-            if (table[i] == read_overlapped.hEvent)
-            {
-                GetOverlappedResult(data->read_handle, &read_overlapped, &read, TRUE);
-                ResetEvent(read_overlapped.hEvent);
-                process_data(data, &write_overlapped, buffer, read);
-                /* Start new read. */
-                ReadFile(data->read_handle, (PVOID)buffer, data->bufferlen, &read, &read_overlapped);
-            }
-            else if (table[i] == write_overlapped.hEvent)
-            {
-                ResetEvent(write_overlapped.hEvent);
-            }
-            else if (table[i] == write_handle_read_overlapped.hEvent)
-            {
-                /* Most likely broken pipe detected */
-                GetOverlappedResult(data->write_handle, &write_handle_read_overlapped, &dummy_read, TRUE);
-                err = GetLastError();
-                ResetEvent(write_handle_read_overlapped.hEvent);
-                if (err == ERROR_BROKEN_PIPE)
-                {
-                    /* We should quit. */
-                    data->process = FALSE;
-                }
-                else
-                {
-                    /* Don't care about result. Start read again. */
-                    ReadFile(data->write_handle, &dummy_buf, sizeof(dummy_buf), NULL, &write_handle_read_overlapped);
-                }
-            }
-            else if (table[i] == data->exit_event)
-            {
-                /* We should quit as exit_event is set. */
-                data->process = FALSE;
-            }
-            else if (table[i] == connect_overlapped.hEvent)
-            {
-                ResetEvent(connect_overlapped.hEvent);
-                /* Start reading data. */
-                ReadFile(data->read_handle, (PVOID)buffer, data->bufferlen, &read, &read_overlapped);
-            }
+            timeout = REORDER_IDLE_FLUSH_MS;
         }
-        else if (dw == WAIT_FAILED)
+        else if (data->stats != NULL)
         {
-            fprintf(stderr, "WaitForMultipleObjects failed in read_thread(): %d", GetLastError());
+            /* Keep refreshing statistics when there is no traffic */
+            timeout = LIVE_STATS_REFRESH_MS;
+        }
+        LeaveCriticalSection(&io.pipeline);
+
+        if (threads > 0)
+        {
+            WaitForSingleObject(io.stopped, timeout);
+        }
+        else if (!io_engine_poll(engine, timeout) && (GetLastError() != WAIT_TIMEOUT))
+        {
+            fprintf(stderr, "Engine poll failed in read_thread(): %d\n", GetLastError());
             break;
         }
+
+        EnterCriticalSection(&io.pipeline);
+        if ((data->reorder != NULL) && (reorder_pending(data->reorder) > 0) &&
+            (GetTickCount() - io.last_data >= REORDER_IDLE_FLUSH_MS))
+        {
+            /* Engine threads might have read data while this one waited */
+            reorder_flush(data->reorder);
+        }
+        if (data->stats != NULL)
+        {
+            live_stats_tick(data->stats);
+        }
+        LeaveCriticalSection(&io.pipeline);
+    }
+
+    /* Reads are not started anymore once process is cleared under lock.
+     * Completions that are still queued only finish the operations.
+     */
+    EnterCriticalSection(&io.pipeline);
+    data->process = FALSE;
+    LeaveCriticalSection(&io.pipeline);
+    io_unwatch(&io.exit);
+    io_unwatch(&io.annotate);
+    io_unwatch(&io.write_handle_read);
+    io_cancel(&io.read, data->read_handle);
+    io_cancel(&io.connect, data->read_handle);
+    if (data->output != NULL)
+    {
+        io_cancel(&io.write_handle_read, data->write_handle);
+    }
+    else
+    {
+        CancelIo(data->write_handle);
+    }
+    io_engine_stop(engine);
+
+    /* Records still held are queued before queued writes are waited for */
+    if (data->reorder != NULL)
+    {
+        reorder_flush(data->reorder);
+    }
+    io_engine_drain(engine);
+    if ((data->output != NULL) && (write_queue_error(data->output) != ERROR_SUCCESS) &&
+        !io.output_failed)
+    {
+        fprintf(stderr, "Failed to write captured data (%d)\n", write_queue_error(data->output));
+    }
+    if (io.write_handle_read_pending)
+    {
+        DWORD dummy_read;
+
+        GetOverlappedResult(data->write_handle, &io.write_handle_read_overlapped,
+                            &dummy_read, TRUE);
+    }
+
+    if (annotate)
+    {
+        annotate_pipe_close(&io.annotations);
     }
 
-    CancelIo(data->read_handle);
-    CancelIo(data->write_handle);
-    CloseHandle(read_overlapped.hEvent);
-    CloseHandle(connect_overlapped.hEvent);
+    if ((data->inflate != NULL) && (inflate_failed(data->inflate) > 0))
+    {
+        fprintf(stderr, "%I64u packets with corrupted compressed payload were dropped\n",
+                inflate_failed(data->inflate));
+    }
+    if (data->reorder != NULL)
+    {
+        if (reorder_late(data->reorder) > 0)
+        {
+            fprintf(stderr, "%I64u packets arrived outside reorder window and were written out of order\n",
+                    reorder_late(data->reorder));
+        }
+    }
+    if (data->compressor != NULL)
+    {
+        blockfile_writer_close(data->compressor);
+        data->compressor = NULL;
+    }
     CloseHandle(write_overlapped.hEvent);
-    CloseHandle(write_handle_read_overlapped.hEvent);
+    CloseHandle(io.write_handle_read_overlapped.hEvent);
 
 finish:
-    if (buffer != NULL)
+    if (engine != NULL)
+    {
+        io_engine_destroy(engine);
+    }
+
+    if (data->output != NULL)
+    {
+        write_queue_destroy(data->output);
+        data->output = NULL;
+    }
+    DeleteCriticalSection(&io.pipeline);
+    CloseHandle(io.stopped);
+
+    if (io.buffer != NULL)
+    {
+        free(io.buffer);
+    }
+
+    if (data->reorder != NULL)
+    {
+        reorder_destroy(data->reorder);
+        data->reorder = NULL;
+    }
+
+    if (data->inflate != NULL)
+    {
+        inflate_destroy(data->inflate);
+        data->inflate = NULL;
+    }
+
+    if (data->stats != NULL)
+    {
+        live_stats_destroy(data->stats);
+        data->stats = NULL;
+    }
+
+    if (data->shm != NULL)
     {
-        free(buffer);
+        shm_ring_close(data->shm);
+        data->shm = NULL;
     }
 
     /* Notify main thread that we are done.
@@ -9,11 +9,17 @@
 
 #include <windows.h>
 #include "USBPcap.h"
+#include "blockfile.h"
+#include "descriptors.h"
+#include "inflate.h"
+#include "livestats.h"
+#include "reorder.h"
+#include "shmring.h"
+#include "writequeue.h"
 
 struct inject_descriptors
 {
-    void *descriptors;   /* Packets to inject after pcap header on capture start */
-    int descriptors_len; /* inject_packets length in bytes */
+    descriptors_arena packets; /* Packets to inject after pcap header on capture start */
 
     /* Buffer to keep track of pcap data read from driver. Once it is filled, the magic
      * and DLT is checked and if it matches, the the inject_packets are written after
@@ -36,12 +42,39 @@ struct thread_data
     volatile BOOL process; /* FALSE if thread should stop */
     HANDLE read_handle; /* Handle to read data from. */
     HANDLE write_handle; /* Handle to write data to. */
+    write_queue *output; /* Overlapped writes to write_handle, used by read_thread. */
     HANDLE job_handle; /* Handle to job object of worker process. */
     HANDLE worker_process_thread; /* Handle to breakaway worker process main thread. */
     HANDLE exit_event; /* Handle to event that indicates that main thread should exit. */
 
     BOOLEAN inject_descriptors; /* TRUE if descriptors should be injected into capture. */
     struct inject_descriptors descriptors;
+
+    BOOLEAN compress; /* TRUE if output should be block compressed. */
+    blockfile_writer *compressor; /* Compressed output writer, used by read_thread. */
+
+    char *annotate_pipe; /* Name of pipe to read annotations from, NULL if disabled. */
+
+    BOOLEAN sequence_numbers; /* TRUE if driver should number captured packets. */
+    BOOLEAN compact_ring; /* TRUE if driver should keep packets in compact form. */
+    BOOLEAN aligned_ring; /* TRUE if driver should keep packets cache line aligned. */
+    BOOLEAN compress_payload; /* TRUE if driver should compress larger payloads. */
+    inflate_stage *inflate; /* Restores compressed payloads, used by read_thread. */
+
+    UINT32 reorder_window; /* Packets held to restore timestamp order, 0 if disabled. */
+    reorder_stage *reorder; /* Reorder stage, used by read_thread. */
+
+    BOOLEAN live_stats; /* TRUE if per-endpoint throughput should be shown. */
+    char *live_stats_json; /* File to append per-second statistics to, NULL if disabled. */
+    live_stats *stats; /* Live statistics, used by read_thread. */
+
+    BOOLEAN use_service; /* TRUE if capture service should be tried first. */
+    BOOLEAN read_connected; /* TRUE if read_handle is connected client end of pipe. */
+
+    char *shm_name; /* Shared memory to publish capture to instead of output, NULL if disabled. */
+    UINT64 shm_size; /* Shared memory ring data size in bytes. */
+    BOOLEAN shm_allow_users; /* TRUE if every authenticated user can read shared memory. */
+    shm_ring *shm; /* Shared memory ring, used by read_thread. */
 };
 
 HANDLE create_filter_read_handle(struct thread_data *data);
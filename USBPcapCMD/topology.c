@@ -0,0 +1,656 @@
+/*
+ * Copyright (c) 2026 Tomasz Moń <desowin@gmail.com>
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "topology.h"
+
+#define TOPOLOGY_CACHE_MAGIC    0x43545055 /* "UPTC" */
+#define TOPOLOGY_CACHE_VERSION  1
+
+/* Sanity limits for cache file contents */
+#define TOPOLOGY_MAX_ENTRIES    65536
+#define TOPOLOGY_MAX_HUB_NAME   4096
+
+#define TOPOLOGY_MAX_THREADS    8
+
+#pragma pack(push, 1)
+/* Connection information that identifies device on port */
+typedef struct
+{
+    UINT32                  connectionStatus;
+    USHORT                  deviceAddress;
+    UCHAR                   deviceIsHub;
+    UCHAR                   lowSpeed;
+    USB_DEVICE_DESCRIPTOR   descriptor;
+} TOPOLOGY_FINGERPRINT;
+
+typedef struct
+{
+    UINT32  magic;
+    UINT32  version;
+    UINT64  generation;
+    UINT32  entryCount;     /* topology_entry records of whole tree */
+    UINT32  portCount;      /* TOPOLOGY_CACHE_PORT records after tree */
+} TOPOLOGY_CACHE_HEADER;
+
+typedef struct
+{
+    UINT32  port;
+    UINT32  hubLength;      /* Hub name bytes following this header */
+    UINT32  entryCount;     /* topology_entry records following hub name */
+    TOPOLOGY_FINGERPRINT fingerprint;
+} TOPOLOGY_CACHE_PORT;
+#pragma pack(pop)
+
+typedef struct
+{
+    topology_entry *entries;
+    UINT32 count;
+    UINT32 size;
+} topology_list;
+
+/* Device on single hub port. Entries are relative: device itself has
+ * level 0 and addresses are filled in when the entries are reported.
+ */
+typedef struct _topology_port
+{
+    char *hub;
+    ULONG port;
+    TOPOLOGY_FINGERPRINT fingerprint;
+    topology_list entries;
+    struct _topology_port *next;
+} topology_port;
+
+typedef struct
+{
+    UINT64 generation;
+    topology_list tree;
+    topology_port *ports;
+} topology_cache;
+
+typedef struct
+{
+    const topology_ops *ops;
+    void *ctx;
+    const char *root_hub;
+    ULONG port_count;
+    const topology_cache *old;  /* Previous results, read-only */
+    topology_list *results;     /* Tree under every root hub port */
+    topology_port **records;    /* Port records under every root hub port */
+    volatile LONG next_port;
+    volatile LONG failed;
+} topology_walk;
+
+typedef struct
+{
+    topology_list *list;
+    BOOL failed;
+} topology_collect;
+
+static BOOL topology_list_append(topology_list *list, const topology_entry *entry)
+{
+    if (list->count == list->size)
+    {
+        UINT32 size = list->size ? list->size * 2 : 8;
+        topology_entry *tmp = realloc(list->entries, size * sizeof(topology_entry));
+        if (tmp == NULL)
+        {
+            return FALSE;
+        }
+        list->entries = tmp;
+        list->size = size;
+    }
+
+    list->entries[list->count++] = *entry;
+    return TRUE;
+}
+
+static void topology_free_ports(topology_port *port)
+{
+    while (port != NULL)
+    {
+        topology_port *next = port->next;
+        free(port->hub);
+        free(port->entries.entries);
+        free(port);
+        port = next;
+    }
+}
+
+static void topology_free_cache(topology_cache *cache)
+{
+    if (cache != NULL)
+    {
+        free(cache->tree.entries);
+        topology_free_ports(cache->ports);
+        free(cache);
+    }
+}
+
+static const topology_port *topology_find(const topology_cache *cache,
+                                          const char *hub, ULONG port)
+{
+    const topology_port *record;
+
+    if (cache == NULL)
+    {
+        return NULL;
+    }
+
+    for (record = cache->ports; record; record = record->next)
+    {
+        if ((record->port == port) && (strcmp(record->hub, hub) == 0))
+        {
+            return record;
+        }
+    }
+
+    return NULL;
+}
+
+static void topology_collect_entry(const topology_entry *entry, void *param)
+{
+    topology_collect *collect = (topology_collect *)param;
+    topology_entry copy = *entry;
+
+    copy.display[TOPOLOGY_DISPLAY_LEN - 1] = L'\0';
+    if (!topology_list_append(collect->list, &copy))
+    {
+        collect->failed = TRUE;
+    }
+}
+
+static void topology_walk_port(topology_walk *walk, void *hub, const char *hub_name,
+                               ULONG port, ULONG level, USHORT hub_address,
+                               topology_list *result, topology_port **records)
+{
+    USB_NODE_CONNECTION_INFORMATION info;
+    const topology_port *cached;
+    topology_port *record;
+    UINT32 i;
+
+    memset(&info, 0, sizeof(info));
+    info.ConnectionIndex = port;
+    if (!walk->ops->get_connection(walk->ctx, hub, port, &info) ||
+        (info.ConnectionStatus == NoDeviceConnected))
+    {
+        return;
+    }
+
+    record = (topology_port *)calloc(1, sizeof(topology_port));
+    if (record != NULL)
+    {
+        record->hub = _strdup(hub_name);
+    }
+    if ((record == NULL) || (record->hub == NULL))
+    {
+        free(record);
+        InterlockedExchange(&walk->failed, TRUE);
+        return;
+    }
+    record->port = port;
+    record->fingerprint.connectionStatus = info.ConnectionStatus;
+    record->fingerprint.deviceAddress = info.DeviceAddress;
+    record->fingerprint.deviceIsHub = info.DeviceIsHub;
+    record->fingerprint.lowSpeed = info.LowSpeed;
+    record->fingerprint.descriptor = info.DeviceDescriptor;
+    record->next = *records;
+    *records = record;
+
+    cached = topology_find(walk->old, hub_name, port);
+    if ((cached != NULL) &&
+        (memcmp(&cached->fingerprint, &record->fingerprint, sizeof(TOPOLOGY_FINGERPRINT)) == 0))
+    {
+        /* Same device as last time, skip the Configuration Manager lookup */
+        for (i = 0; i < cached->entries.count; i++)
+        {
+            if (!topology_list_append(&record->entries, &cached->entries.entries[i]))
+            {
+                InterlockedExchange(&walk->failed, TRUE);
+            }
+        }
+    }
+    else
+    {
+        topology_collect collect;
+
+        collect.list = &record->entries;
+        collect.failed = FALSE;
+        walk->ops->describe_device(walk->ctx, hub, port, !info.DeviceIsHub,
+                                   topology_collect_entry, &collect);
+        if (collect.failed)
+        {
+            InterlockedExchange(&walk->failed, TRUE);
+        }
+    }
+
+    for (i = 0; i < record->entries.count; i++)
+    {
+        topology_entry entry = record->entries.entries[i];
+
+        entry.level += level;
+        entry.deviceAddress = info.DeviceAddress;
+        if (entry.node == 0)
+        {
+            entry.port = port;
+            entry.parentAddress = hub_address;
+        }
+        else
+        {
+            entry.port = 0;
+            entry.parentAddress = info.DeviceAddress;
+        }
+
+        if (!topology_list_append(result, &entry))
+        {
+            InterlockedExchange(&walk->failed, TRUE);
+        }
+    }
+
+    if (info.DeviceIsHub)
+    {
+        char *name = walk->ops->get_external_hub_name(walk->ctx, hub, port);
+
+        if (name != NULL)
+        {
+            void *external = walk->ops->open_hub(walk->ctx, name);
+
+            if (external != NULL)
+            {
+                ULONG count = walk->ops->get_port_count(walk->ctx, external);
+                ULONG index;
+
+                /* Port indices are 1 based, not 0 based */
+                for (index = 1; index <= count; index++)
+                {
+                    topology_walk_port(walk, external, name, index, level + 1,
+                                       info.DeviceAddress, result, records);
+                }
+                walk->ops->close_hub(walk->ctx, external);
+            }
+            free(name);
+        }
+    }
+}
+
+static DWORD WINAPI topology_worker(LPVOID param)
+{
+    topology_walk *walk = (topology_walk *)param;
+    void *hub;
+
+    /* Own handle, requests on shared synchronous handle are serialized */
+    hub = walk->ops->open_hub(walk->ctx, walk->root_hub);
+    if (hub == NULL)
+    {
+        InterlockedExchange(&walk->failed, TRUE);
+        return 0;
+    }
+
+    for (;;)
+    {
+        LONG port = InterlockedIncrement(&walk->next_port);
+
+        if ((ULONG)port > walk->port_count)
+        {
+            break;
+        }
+
+        topology_walk_port(walk, hub, walk->root_hub, port, 0, 0,
+                           &walk->results[port - 1], &walk->records[port - 1]);
+    }
+
+    walk->ops->close_hub(walk->ctx, hub);
+    return 0;
+}
+
+static char *topology_cache_path(const char *cache_dir, const char *root_hub)
+{
+    UINT32 hash = 2166136261U;
+    const char *p;
+    size_t length;
+    char *path;
+
+    /* Hub symbolic links contain characters not allowed in file names */
+    for (p = root_hub; *p; p++)
+    {
+        hash = (hash ^ (unsigned char)*p) * 16777619U;
+    }
+
+    length = strlen(cache_dir) + 40;
+    path = malloc(length);
+    if (path != NULL)
+    {
+        size_t dir_length = strlen(cache_dir);
+        BOOL separator = (dir_length > 0) && (cache_dir[dir_length - 1] != '\\') &&
+                         (cache_dir[dir_length - 1] != '/');
+
+        sprintf_s(path, length, "%s%sUSBPcap-topology-%08x.cache",
+                  cache_dir, separator ? "\\" : "", hash);
+    }
+    return path;
+}
+
+static BOOL topology_read_entries(FILE *file, topology_list *list, UINT32 count)
+{
+    UINT32 i;
+
+    if (count > TOPOLOGY_MAX_ENTRIES)
+    {
+        return FALSE;
+    }
+
+    for (i = 0; i < count; i++)
+    {
+        topology_entry entry;
+
+        if (fread(&entry, sizeof(entry), 1, file) != 1)
+        {
+            return FALSE;
+        }
+        entry.display[TOPOLOGY_DISPLAY_LEN - 1] = L'\0';
+        if (!topology_list_append(list, &entry))
+        {
+            return FALSE;
+        }
+    }
+
+    return TRUE;
+}
+
+static topology_cache *topology_cache_load(const char *path)
+{
+    TOPOLOGY_CACHE_HEADER header;
+    topology_cache *cache;
+    topology_port *last = NULL;
+    FILE *file;
+    UINT32 i;
+
+    if (fopen_s(&file, path, "rb") != 0)
+    {
+        return NULL;
+    }
+
+    cache = (topology_cache *)calloc(1, sizeof(topology_cache));
+    if (cache == NULL)
+    {
+        fclose(file);
+        return NULL;
+    }
+
+    if ((fread(&header, sizeof(header), 1, file) != 1) ||
+        (header.magic != TOPOLOGY_CACHE_MAGIC) ||
+        (header.version != TOPOLOGY_CACHE_VERSION) ||
+        (header.portCount > TOPOLOGY_MAX_ENTRIES) ||
+        !topology_read_entries(file, &cache->tree, header.entryCount))
+    {
+        goto error;
+    }
+    cache->generation = header.generation;
+
+    for (i = 0; i < header.portCount; i++)
+    {
+        TOPOLOGY_CACHE_PORT port;
+        topology_port *record;
+
+        if ((fread(&port, sizeof(port), 1, file) != 1) ||
+            (port.hubLength == 0) || (port.hubLength > TOPOLOGY_MAX_HUB_NAME))
+        {
+            goto error;
+        }
+
+        record = (topology_port *)calloc(1, sizeof(topology_port));
+        if (record == NULL)
+        {
+            goto error;
+        }
+        if (last != NULL)
+        {
+            last->next = record;
+        }
+        else
+        {
+            cache->ports = record;
+        }
+        last = record;
+
+        record->port = port.port;
+        record->fingerprint = port.fingerprint;
+        record->hub = malloc(port.hubLength + 1);
+        if ((record->hub == NULL) ||
+            (fread(record->hub, port.hubLength, 1, file) != 1) ||
+            !topology_read_entries(file, &record->entries, port.entryCount))
+        {
+            goto error;
+        }
+        record->hub[port.hubLength] = '\0';
+    }
+
+    fclose(file);
+    return cache;
+
+error:
+    fclose(file);
+    topology_free_cache(cache);
+    return NULL;
+}
+
+static void topology_cache_save(const char *path, const topology_cache *cache)
+{
+    TOPOLOGY_CACHE_HEADER header;
+    const topology_port *record;
+    char *tmpname;
+    size_t length;
+    FILE *file;
+    BOOL ok;
+
+    /* Several USBPcapCMD instances can run at once, each writes own file */
+    length = strlen(path) + 16;
+    tmpname = malloc(length);
+    if (tmpname == NULL)
+    {
+        return;
+    }
+    sprintf_s(tmpname, length, "%s.%u.tmp", path, GetCurrentProcessId());
+
+    if (fopen_s(&file, tmpname, "wb") != 0)
+    {
+        free(tmpname);
+        return;
+    }
+
+    header.magic = TOPOLOGY_CACHE_MAGIC;
+    header.version = TOPOLOGY_CACHE_VERSION;
+    header.generation = cache->generation;
+    header.entryCount = cache->tree.count;
+    header.portCount = 0;
+    for (record = cache->ports; record; record = record->next)
+    {
+        header.portCount++;
+    }
+
+    ok = (fwrite(&header, sizeof(header), 1, file) == 1);
+    if (ok && (cache->tree.count > 0))
+    {
+        ok = (fwrite(cache->tree.entries, sizeof(topology_entry), cache->tree.count, file) ==
+              cache->tree.count);
+    }
+
+    for (record = cache->ports; ok && record; record = record->next)
+    {
+        TOPOLOGY_CACHE_PORT port;
+
+        port.port = record->port;
+        port.hubLength = (UINT32)strlen(record->hub);
+        port.entryCount = record->entries.count;
+        port.fingerprint = record->fingerprint;
+
+        ok = (fwrite(&port, sizeof(port), 1, file) == 1) &&
+             (fwrite(record->hub, port.hubLength, 1, file) == 1);
+        if (ok && (record->entries.count > 0))
+        {
+            ok = (fwrite(record->entries.entries, sizeof(topology_entry),
+                         record->entries.count, file) == record->entries.count);
+        }
+    }
+
+    if ((fclose(file) != 0) || !ok ||
+        !MoveFileExA(tmpname, path, MOVEFILE_REPLACE_EXISTING))
+    {
+        DeleteFileA(tmpname);
+    }
+    free(tmpname);
+}
+
+static void topology_report(const topology_list *list, topology_entry_callback callback,
+                            void *callback_ctx)
+{
+    UINT32 i;
+
+    for (i = 0; i < list->count; i++)
+    {
+        callback(&list->entries[i], callback_ctx);
+    }
+}
+
+BOOL topology_enumerate(const topology_ops *ops, void *ctx, const char *root_hub,
+                        const char *cache_dir, topology_entry_callback callback,
+                        void *callback_ctx)
+{
+    HANDLE threads[TOPOLOGY_MAX_THREADS];
+    topology_walk walk;
+    topology_cache *cache = NULL;
+    topology_port **tail = NULL;
+    char *cache_path = NULL;
+    SYSTEM_INFO info;
+    UINT64 generation;
+    void *hub;
+    ULONG i;
+    int count;
+    int t;
+
+    /* Sample generation before walking so changes made during the walk
+     * invalidate the cache next time.
+     */
+    generation = (ops->generation != NULL) ? ops->generation(ctx) : 0;
+
+    memset(&walk, 0, sizeof(walk));
+    if (cache_dir != NULL)
+    {
+        cache_path = topology_cache_path(cache_dir, root_hub);
+        walk.old = (cache_path != NULL) ? topology_cache_load(cache_path) : NULL;
+    }
+
+    if ((walk.old != NULL) && (generation != 0) && (walk.old->generation == generation))
+    {
+        topology_report(&walk.old->tree, callback, callback_ctx);
+        topology_free_cache((topology_cache *)walk.old);
+        free(cache_path);
+        return TRUE;
+    }
+
+    hub = ops->open_hub(ctx, root_hub);
+    if (hub == NULL)
+    {
+        topology_free_cache((topology_cache *)walk.old);
+        free(cache_path);
+        return FALSE;
+    }
+    walk.port_count = ops->get_port_count(ctx, hub);
+    ops->close_hub(ctx, hub);
+
+    walk.ops = ops;
+    walk.ctx = ctx;
+    walk.root_hub = root_hub;
+    walk.results = (topology_list *)calloc(max(walk.port_count, 1), sizeof(topology_list));
+    walk.records = (topology_port **)calloc(max(walk.port_count, 1), sizeof(topology_port *));
+    if ((walk.results == NULL) || (walk.records == NULL))
+    {
+        free(walk.results);
+        free(walk.records);
+        topology_free_cache((topology_cache *)walk.old);
+        free(cache_path);
+        return FALSE;
+    }
+
+    GetSystemInfo(&info);
+    count = (int)min(min(walk.port_count, max(info.dwNumberOfProcessors, 1)),
+                     TOPOLOGY_MAX_THREADS);
+    for (t = 0; t < count; t++)
+    {
+        threads[t] = CreateThread(NULL, 0, topology_worker, &walk, 0, NULL);
+        if (threads[t] == NULL)
+        {
+            break;
+        }
+    }
+    count = t;
+
+    if (count == 0)
+    {
+        topology_worker(&walk);
+    }
+    else
+    {
+        WaitForMultipleObjects(count, threads, TRUE, INFINITE);
+        for (t = 0; t < count; t++)
+        {
+            CloseHandle(threads[t]);
+        }
+    }
+
+    /* Join per-port results in port order */
+    cache = (topology_cache *)calloc(1, sizeof(topology_cache));
+    if (cache == NULL)
+    {
+        walk.failed = TRUE;
+    }
+    else
+    {
+        cache->generation = generation;
+        tail = &cache->ports;
+    }
+
+    for (i = 0; i < walk.port_count; i++)
+    {
+        topology_report(&walk.results[i], callback, callback_ctx);
+
+        if (cache != NULL)
+        {
+            UINT32 j;
+
+            for (j = 0; j < walk.results[i].count; j++)
+            {
+                if (!topology_list_append(&cache->tree, &walk.results[i].entries[j]))
+                {
+                    walk.failed = TRUE;
+                }
+            }
+
+            *tail = walk.records[i];
+            while (*tail != NULL)
+            {
+                tail = &(*tail)->next;
+            }
+            walk.records[i] = NULL;
+        }
+        free(walk.results[i].entries);
+        topology_free_ports(walk.records[i]);
+    }
+
+    if ((cache_path != NULL) && (cache != NULL) && !walk.failed)
+    {
+        topology_cache_save(cache_path, cache);
+    }
+
+    topology_free_cache(cache);
+    topology_free_cache((topology_cache *)walk.old);
+    free(walk.results);
+    free(walk.records);
+    free(cache_path);
+    return TRUE;
+}
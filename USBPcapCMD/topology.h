@@ -0,0 +1,87 @@
+/*
+ * Copyright (c) 2026 Tomasz Moń <desowin@gmail.com>
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#ifndef USBPCAP_CMD_TOPOLOGY_H
+#define USBPCAP_CMD_TOPOLOGY_H
+
+#include <windows.h>
+#include <usbioctl.h>
+
+#define TOPOLOGY_DISPLAY_LEN 200 /* MAX_DEVICE_ID_LEN */
+
+/*
+ * One line of device tree.
+ *
+ * level - Tree depth level
+ * port - Port the device is attached to on hub. 0 if does not apply (device node).
+ * display - Human-readable text describing device
+ * deviceAddress - USB address assigned to device
+ * parentAddress - USB address of parent hub, 0 if directly attached to Root Hub
+ * node - Running index of child device instance. When this is non-zero, device instance children
+ *        are being enumerated. They are enumerated to make it easy for user to determine what
+ *        the parent "USB Composite Device" is.
+ * parentNode - 0 if the node is directly under deviceAddress, otherwise a index of parent node
+ */
+typedef struct
+{
+    ULONG   level;
+    ULONG   port;
+    USHORT  deviceAddress;
+    USHORT  parentAddress;
+    ULONG   node;
+    ULONG   parentNode;
+    WCHAR   display[TOPOLOGY_DISPLAY_LEN];
+} topology_entry;
+
+typedef void (*topology_entry_callback)(const topology_entry *entry, void *ctx);
+
+/* Hub access used by topology_enumerate(). The Windows implementation in
+ * enum.c issues hub IOCTLs and Configuration Manager calls, other
+ * implementations can simulate arbitrary trees.
+ *
+ * Functions are called from several threads at once. Every thread opens
+ * its own hub handles.
+ */
+typedef struct
+{
+    /* Returns NULL if hub cannot be opened */
+    void *(*open_hub)(void *ctx, const char *hub);
+    void (*close_hub)(void *ctx, void *hub);
+    UCHAR (*get_port_count)(void *ctx, void *hub);
+    BOOL (*get_connection)(void *ctx, void *hub, ULONG port,
+                           PUSB_NODE_CONNECTION_INFORMATION info);
+    /* Returns name allocated with malloc(), NULL if not available */
+    char *(*get_external_hub_name)(void *ctx, void *hub, ULONG port);
+    /* Reports device on port with level 0 and, if children is TRUE, its
+     * device instance children with level 1 and deeper. Only level,
+     * display, node and parentNode are used.
+     */
+    void (*describe_device)(void *ctx, void *hub, ULONG port, BOOL children,
+                            topology_entry_callback callback, void *callback_ctx);
+    /* Returns value that changes whenever any device is added, removed
+     * or re-enumerated, 0 if it is not known at the moment. NULL if there
+     * is no such value.
+     */
+    UINT64 (*generation)(void *ctx);
+} topology_ops;
+
+/* Reports every device under root_hub in port order.
+ *
+ * If cache_dir is not NULL, results are cached in a file in that directory
+ * keyed by root hub name. When generation has not changed the cached tree
+ * is reported without opening any hub. Otherwise connection information
+ * is queried for every port and devices whose connection information did
+ * not change are not described again.
+ *
+ * Ports of the root hub are walked in parallel.
+ *
+ * Returns FALSE if root hub could not be enumerated.
+ */
+BOOL topology_enumerate(const topology_ops *ops, void *ctx, const char *root_hub,
+                        const char *cache_dir, topology_entry_callback callback,
+                        void *callback_ctx);
+
+#endif /* USBPCAP_CMD_TOPOLOGY_H */
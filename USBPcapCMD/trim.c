@@ -0,0 +1,808 @@
+/*
+ * Copyright (c) 2026 Tomasz Moń <desowin@gmail.com>
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <windows.h>
+#include <wincrypt.h>
+#include "blockfile.h"
+#include "lzblock.h"
+#include "pcapfile.h"
+#include "trim.h"
+
+/* Output is written through large stdio buffer */
+#define TRIM_FILE_BUFFER     (4 * 1024 * 1024)
+
+/* Stripped payloads are collected into batches. While worker threads hash,
+ * compress and store one batch, main thread keeps rewriting capture into
+ * the other.
+ */
+#define TRIM_BATCH_SIZE      (8 * 1024 * 1024)
+#define TRIM_BATCH_ENTRIES   4096
+#define TRIM_MAX_WORKERS     16
+
+typedef struct
+{
+    UINT32 offset;          /* Payload offset in batch data */
+    TRIM_INDEX_ENTRY entry;
+} trim_job;
+
+typedef struct
+{
+    unsigned char *data;
+    UINT32 size;
+    UINT32 used;
+    UINT32 count;
+    trim_job jobs[TRIM_BATCH_ENTRIES];
+} trim_batch;
+
+/* Trimmed capture, plain pcap or block compressed */
+typedef struct
+{
+    char *name;
+    FILE *file;
+    HANDLE handle;
+    blockfile_writer *compressed;
+    BOOL failed;
+} trim_output;
+
+typedef struct _trim_pool trim_pool;
+
+typedef struct
+{
+    trim_pool *pool;
+    int id;
+    HANDLE thread;
+    HANDLE start;
+    HCRYPTPROV provider;
+    void *workmem;          /* lz_compress() state, NULL if not compressing */
+    unsigned char *packed;
+    UINT32 packed_size;
+} trim_worker;
+
+struct _trim_pool
+{
+    const char *store;
+    trim_worker workers[TRIM_MAX_WORKERS];
+    int count;
+    trim_batch *batch;      /* Batch being processed */
+    volatile LONG remaining;
+    volatile LONG failed;
+    volatile BOOL quit;
+    HANDLE done;
+};
+
+static void trim_hex(const UCHAR *hash, char *hex)
+{
+    static const char digits[] = "0123456789abcdef";
+    int i;
+
+    for (i = 0; i < 32; i++)
+    {
+        hex[i * 2] = digits[hash[i] >> 4];
+        hex[i * 2 + 1] = digits[hash[i] & 0x0F];
+    }
+    hex[64] = '\0';
+}
+
+static BOOL trim_blob_path(const char *store, const UCHAR *hash,
+                           char *path, size_t length, BOOL create_dir)
+{
+    char hex[65];
+
+    trim_hex(hash, hex);
+
+    /* Fan out by first byte to keep directories small */
+    sprintf_s(path, length, "%s\\%.2s", store, hex);
+    if (create_dir && !CreateDirectoryA(path, NULL) &&
+        (GetLastError() != ERROR_ALREADY_EXISTS))
+    {
+        fprintf(stderr, "Failed to create %s - %d\n", path, GetLastError());
+        return FALSE;
+    }
+
+    sprintf_s(path, length, "%s\\%.2s\\%s", store, hex, hex);
+    return TRUE;
+}
+
+static BOOL trim_store_payload(trim_worker *worker, const unsigned char *data,
+                               PTRIM_INDEX_ENTRY entry)
+{
+    HCRYPTHASH hash;
+    DWORD hash_length = sizeof(entry->sha256);
+    char path[MAX_PATH];
+    char tmp[MAX_PATH];
+    HANDLE file;
+    const unsigned char *blob = data;
+    UINT32 blob_length = entry->payloadLength;
+    DWORD written;
+    BOOL ok;
+
+    if (!CryptCreateHash(worker->provider, CALG_SHA_256, 0, 0, &hash))
+    {
+        return FALSE;
+    }
+    ok = CryptHashData(hash, data, entry->payloadLength, 0) &&
+         CryptGetHashParam(hash, HP_HASHVAL, entry->sha256, &hash_length, 0);
+    CryptDestroyHash(hash);
+    if (!ok)
+    {
+        return FALSE;
+    }
+
+    if (!trim_blob_path(worker->pool->store, entry->sha256, path, sizeof(path), TRUE))
+    {
+        return FALSE;
+    }
+
+    if (GetFileAttributesA(path) != INVALID_FILE_ATTRIBUTES)
+    {
+        /* Same payload already stored */
+        return TRUE;
+    }
+
+    if (worker->workmem != NULL)
+    {
+        UINT32 packed_length;
+
+        if (entry->payloadLength > worker->packed_size)
+        {
+            unsigned char *tmp_packed = realloc(worker->packed, entry->payloadLength);
+            if (tmp_packed == NULL)
+            {
+                return FALSE;
+            }
+            worker->packed = tmp_packed;
+            worker->packed_size = entry->payloadLength;
+        }
+
+        /* Keep compressed data only if it saves at least 1/32. Compressed
+         * blob must be shorter than payload, that is how it is recognized.
+         */
+        packed_length = lz_compress(data, entry->payloadLength, worker->packed,
+                                    entry->payloadLength -
+                                    max(entry->payloadLength >> 5, 1),
+                                    worker->workmem);
+        if (packed_length > 0)
+        {
+            blob = worker->packed;
+            blob_length = packed_length;
+        }
+    }
+
+    /* Write under temporary name so store never has partial blobs */
+    sprintf_s(tmp, sizeof(tmp), "%s.%d.tmp", path, worker->id);
+    file = CreateFileA(tmp, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS,
+                       FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE)
+    {
+        fprintf(stderr, "Failed to create %s - %d\n", tmp, GetLastError());
+        return FALSE;
+    }
+
+    ok = WriteFile(file, blob, blob_length, &written, NULL) &&
+         (written == blob_length);
+    CloseHandle(file);
+
+    if (!ok || (!MoveFileExA(tmp, path, 0) && (GetFileAttributesA(path) == INVALID_FILE_ATTRIBUTES)))
+    {
+        fprintf(stderr, "Failed to store %s - %d\n", path, GetLastError());
+        DeleteFileA(tmp);
+        return FALSE;
+    }
+
+    /* Another worker could have stored identical payload meanwhile */
+    DeleteFileA(tmp);
+    return TRUE;
+}
+
+static DWORD WINAPI trim_worker_thread(LPVOID param)
+{
+    trim_worker *worker = (trim_worker *)param;
+    trim_pool *pool = worker->pool;
+
+    for (;;)
+    {
+        trim_batch *batch;
+        UINT32 i;
+
+        WaitForSingleObject(worker->start, INFINITE);
+        if (pool->quit)
+        {
+            break;
+        }
+
+        batch = pool->batch;
+        for (i = worker->id; i < batch->count; i += pool->count)
+        {
+            if (!trim_store_payload(worker, &batch->data[batch->jobs[i].offset],
+                                    &batch->jobs[i].entry))
+            {
+                InterlockedExchange(&pool->failed, 1);
+            }
+        }
+
+        if (InterlockedDecrement(&pool->remaining) == 0)
+        {
+            SetEvent(pool->done);
+        }
+    }
+
+    return 0;
+}
+
+static void trim_pool_stop(trim_pool *pool)
+{
+    int i;
+
+    pool->quit = TRUE;
+    for (i = 0; i < pool->count; i++)
+    {
+        SetEvent(pool->workers[i].start);
+        WaitForSingleObject(pool->workers[i].thread, INFINITE);
+        CloseHandle(pool->workers[i].thread);
+        CloseHandle(pool->workers[i].start);
+        CryptReleaseContext(pool->workers[i].provider, 0);
+        free(pool->workers[i].workmem);
+        free(pool->workers[i].packed);
+    }
+    pool->count = 0;
+
+    if (pool->done != NULL)
+    {
+        CloseHandle(pool->done);
+        pool->done = NULL;
+    }
+}
+
+static BOOL trim_pool_start(trim_pool *pool, const char *store, BOOL compress)
+{
+    SYSTEM_INFO info;
+    int workers;
+    int i;
+
+    memset(pool, 0, sizeof(trim_pool));
+    pool->store = store;
+
+    if (!CreateDirectoryA(store, NULL) && (GetLastError() != ERROR_ALREADY_EXISTS))
+    {
+        fprintf(stderr, "Failed to create %s - %d\n", store, GetLastError());
+        return FALSE;
+    }
+
+    GetSystemInfo(&info);
+    workers = min((int)info.dwNumberOfProcessors, TRIM_MAX_WORKERS);
+    if (workers < 1)
+    {
+        workers = 1;
+    }
+
+    pool->done = CreateEvent(NULL, FALSE, FALSE, NULL);
+    if (pool->done == NULL)
+    {
+        return FALSE;
+    }
+
+    for (i = 0; i < workers; i++)
+    {
+        trim_worker *worker = &pool->workers[i];
+
+        worker->pool = pool;
+        worker->id = i;
+        if (compress && ((worker->workmem = malloc(LZ_WORKMEM_SIZE)) == NULL))
+        {
+            break;
+        }
+        if (!CryptAcquireContext(&worker->provider, NULL, NULL,
+                                 PROV_RSA_AES, CRYPT_VERIFYCONTEXT))
+        {
+            fprintf(stderr, "CryptAcquireContext failed - %d\n", GetLastError());
+            free(worker->workmem);
+            break;
+        }
+
+        worker->start = CreateEvent(NULL, FALSE, FALSE, NULL);
+        if (worker->start == NULL)
+        {
+            CryptReleaseContext(worker->provider, 0);
+            free(worker->workmem);
+            break;
+        }
+
+        worker->thread = CreateThread(NULL, 0, trim_worker_thread, worker, 0, NULL);
+        if (worker->thread == NULL)
+        {
+            CloseHandle(worker->start);
+            CryptReleaseContext(worker->provider, 0);
+            free(worker->workmem);
+            break;
+        }
+        pool->count++;
+    }
+
+    if (pool->count == 0)
+    {
+        trim_pool_stop(pool);
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+static void trim_pool_submit(trim_pool *pool, trim_batch *batch)
+{
+    int i;
+
+    pool->batch = batch;
+    pool->remaining = pool->count;
+    for (i = 0; i < pool->count; i++)
+    {
+        SetEvent(pool->workers[i].start);
+    }
+}
+
+/* Waits for submitted batch and appends its entries to index */
+static BOOL trim_pool_finish(trim_pool *pool, FILE *index)
+{
+    trim_batch *batch = pool->batch;
+    UINT32 i;
+
+    if (batch == NULL)
+    {
+        return TRUE;
+    }
+
+    WaitForSingleObject(pool->done, INFINITE);
+    pool->batch = NULL;
+
+    for (i = 0; i < batch->count; i++)
+    {
+        if (fwrite(&batch->jobs[i].entry, sizeof(TRIM_INDEX_ENTRY), 1, index) != 1)
+        {
+            return FALSE;
+        }
+    }
+    batch->count = 0;
+    batch->used = 0;
+
+    return (pool->failed == 0);
+}
+
+static FILE *trim_open_output(const char *capture, size_t base_length,
+                              const char *suffix, char **name)
+{
+    size_t length = base_length + strlen(suffix) + 1;
+    FILE *file;
+
+    *name = malloc(length);
+    if (*name == NULL)
+    {
+        return NULL;
+    }
+
+    sprintf_s(*name, length, "%.*s%s", (int)base_length, capture, suffix);
+    if (fopen_s(&file, *name, "wb") != 0)
+    {
+        fprintf(stderr, "Failed to create %s\n", *name);
+        return NULL;
+    }
+
+    setvbuf(file, NULL, _IOFBF, TRIM_FILE_BUFFER);
+    return file;
+}
+
+static BOOL trim_output_open(trim_output *output, const char *capture, BOOL compress)
+{
+    size_t base_length = pcap_base_length(capture);
+    size_t length;
+
+    memset(output, 0, sizeof(trim_output));
+    output->handle = INVALID_HANDLE_VALUE;
+
+    if (!compress)
+    {
+        output->file = trim_open_output(capture, base_length, "_trimmed.pcap", &output->name);
+        return (output->file != NULL);
+    }
+
+    length = base_length + sizeof("_trimmed.pcapz");
+    output->name = malloc(length);
+    if (output->name == NULL)
+    {
+        return FALSE;
+    }
+    sprintf_s(output->name, length, "%.*s_trimmed.pcapz", (int)base_length, capture);
+
+    output->handle = CreateFileA(output->name, GENERIC_WRITE, FILE_SHARE_READ, NULL,
+                                 CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (output->handle == INVALID_HANDLE_VALUE)
+    {
+        fprintf(stderr, "Failed to create %s - %d\n", output->name, GetLastError());
+        return FALSE;
+    }
+
+    /* Only copies data, blocks are compressed and written by workers */
+    output->compressed = blockfile_writer_create(output->handle, BLOCKFILE_DEFAULT_BLOCK_SIZE);
+    return (output->compressed != NULL);
+}
+
+static void trim_output_write(trim_output *output, const void *data, UINT32 length)
+{
+    if (output->compressed != NULL)
+    {
+        if (!blockfile_write(output->compressed, data, length))
+        {
+            output->failed = TRUE;
+        }
+    }
+    else
+    {
+        fwrite(data, 1, length, output->file);
+    }
+}
+
+static BOOL trim_output_ok(const trim_output *output)
+{
+    return !output->failed && ((output->file == NULL) || !ferror(output->file));
+}
+
+/* Returns FALSE if any write failed */
+static BOOL trim_output_close(trim_output *output)
+{
+    BOOL ok = trim_output_ok(output);
+
+    if ((output->compressed != NULL) && !blockfile_writer_close(output->compressed))
+    {
+        ok = FALSE;
+    }
+    if (output->handle != INVALID_HANDLE_VALUE)
+    {
+        CloseHandle(output->handle);
+    }
+    if ((output->file != NULL) && (fclose(output->file) != 0))
+    {
+        ok = FALSE;
+    }
+    free(output->name);
+    memset(output, 0, sizeof(trim_output));
+    output->handle = INVALID_HANDLE_VALUE;
+    return ok;
+}
+
+int trim_capture(const char *capture, const trim_rules *rules)
+{
+    pcap_reader reader;
+    pcaprec_hdr_t hdr;
+    unsigned char *data;
+    trim_pool pool;
+    trim_batch *batches[2] = {NULL, NULL};
+    int current = 0;
+    trim_output output;
+    char *index_name = NULL;
+    FILE *index = NULL;
+    UINT64 record = 0;
+    UINT64 stripped = 0;
+    int result = PCAP_READ_ERROR;
+    int ret = -1;
+    int i;
+
+    memset(&pool, 0, sizeof(pool));
+
+    if (!pcap_reader_open(&reader, capture))
+    {
+        return -1;
+    }
+
+    if (!trim_output_open(&output, capture, rules->compress))
+    {
+        goto cleanup;
+    }
+
+    if (rules->store != NULL)
+    {
+        index = trim_open_output(output.name, strlen(output.name), ".cas", &index_name);
+        if ((index == NULL) || !trim_pool_start(&pool, rules->store, rules->compress))
+        {
+            goto cleanup;
+        }
+
+        for (i = 0; i < 2; i++)
+        {
+            batches[i] = (trim_batch *)calloc(1, sizeof(trim_batch));
+            if ((batches[i] == NULL) ||
+                ((batches[i]->data = malloc(TRIM_BATCH_SIZE)) == NULL))
+            {
+                fprintf(stderr, "Failed to allocate trim batches\n");
+                goto cleanup;
+            }
+            batches[i]->size = TRIM_BATCH_SIZE;
+        }
+    }
+
+    trim_output_write(&output, &reader.header, sizeof(pcap_hdr_t));
+
+    while ((result = pcap_reader_next(&reader, &hdr, &data)) == PCAP_READ_RECORD)
+    {
+        PUSBPCAP_BUFFER_PACKET_HEADER header = pcap_usbpcap_header(data, hdr.incl_len);
+        UINT32 payload = 0;
+        UINT32 keep = 0;
+
+        if (header != NULL)
+        {
+            payload = hdr.incl_len - header->headerLen;
+            if (header->transfer == USBPCAP_TRANSFER_BULK)
+            {
+                keep = min(payload, rules->bulk_keep);
+            }
+            else if (header->transfer == USBPCAP_TRANSFER_ISOCHRONOUS)
+            {
+                keep = min(payload, rules->isoch_keep);
+            }
+            else
+            {
+                keep = payload;
+            }
+        }
+
+        if (keep < payload)
+        {
+            if (rules->store != NULL)
+            {
+                trim_batch *batch = batches[current];
+                trim_job *job;
+
+                if ((batch->count == TRIM_BATCH_ENTRIES) ||
+                    (batch->used + payload > batch->size))
+                {
+                    /* Hand the full batch over and reuse the other one */
+                    if (!trim_pool_finish(&pool, index))
+                    {
+                        fprintf(stderr, "Failed to store stripped payloads\n");
+                        result = PCAP_READ_ERROR;
+                        break;
+                    }
+                    trim_pool_submit(&pool, batch);
+                    current ^= 1;
+                    batch = batches[current];
+                }
+
+                if (payload > batch->size)
+                {
+                    unsigned char *tmp = realloc(batch->data, payload);
+                    if (tmp == NULL)
+                    {
+                        result = PCAP_READ_ERROR;
+                        break;
+                    }
+                    batch->data = tmp;
+                    batch->size = payload;
+                }
+
+                job = &batch->jobs[batch->count++];
+                job->offset = batch->used;
+                job->entry.record = record;
+                job->entry.keptLength = keep;
+                job->entry.payloadLength = payload;
+                memcpy(&batch->data[batch->used], data + header->headerLen, payload);
+                batch->used += payload;
+            }
+
+            stripped += payload - keep;
+            hdr.incl_len -= payload - keep;
+        }
+
+        /* orig_len stays untouched, capture still reports real lengths */
+        trim_output_write(&output, &hdr, sizeof(pcaprec_hdr_t));
+        trim_output_write(&output, data, hdr.incl_len);
+        record++;
+    }
+
+    if (rules->store != NULL)
+    {
+        if (!trim_pool_finish(&pool, index))
+        {
+            result = PCAP_READ_ERROR;
+        }
+        else if (batches[current]->count > 0)
+        {
+            trim_pool_submit(&pool, batches[current]);
+            if (!trim_pool_finish(&pool, index))
+            {
+                result = PCAP_READ_ERROR;
+            }
+        }
+    }
+
+    if ((result == PCAP_READ_EOF) && trim_output_ok(&output) &&
+        ((index == NULL) || !ferror(index)))
+    {
+        fprintf(stderr, "%s: %I64u records, %I64u payload bytes stripped\n",
+                output.name, record, stripped);
+        ret = 0;
+    }
+
+cleanup:
+    if (pool.count > 0)
+    {
+        /* Make sure workers are idle before they are told to quit */
+        if (pool.batch != NULL)
+        {
+            WaitForSingleObject(pool.done, INFINITE);
+        }
+        trim_pool_stop(&pool);
+    }
+    for (i = 0; i < 2; i++)
+    {
+        if (batches[i] != NULL)
+        {
+            free(batches[i]->data);
+            free(batches[i]);
+        }
+    }
+    if (!trim_output_close(&output))
+    {
+        ret = -1;
+    }
+    if ((index != NULL) && (fclose(index) != 0))
+    {
+        ret = -1;
+    }
+    free(index_name);
+    pcap_reader_close(&reader);
+    return ret;
+}
+
+int trim_rehydrate(const char *trimmed, const char *store)
+{
+    pcap_reader reader;
+    pcaprec_hdr_t hdr;
+    unsigned char *data;
+    TRIM_INDEX_ENTRY entry;
+    BOOL has_entry;
+    char *output_name = NULL;
+    char *index_name;
+    size_t length;
+    FILE *output = NULL;
+    FILE *index = NULL;
+    unsigned char *payload = NULL;
+    unsigned char *blob = NULL;
+    UINT32 payload_size = 0;
+    UINT64 record = 0;
+    int result = PCAP_READ_ERROR;
+    int ret = -1;
+
+    if (!pcap_reader_open(&reader, trimmed))
+    {
+        return -1;
+    }
+
+    length = strlen(trimmed) + sizeof(".cas");
+    index_name = malloc(length);
+    if (index_name == NULL)
+    {
+        goto cleanup;
+    }
+    sprintf_s(index_name, length, "%s.cas", trimmed);
+    if (fopen_s(&index, index_name, "rb") != 0)
+    {
+        fprintf(stderr, "Failed to open %s\n", index_name);
+        index = NULL;
+        goto cleanup;
+    }
+
+    output = trim_open_output(trimmed, pcap_base_length(trimmed), "_rehydrated.pcap", &output_name);
+    if (output == NULL)
+    {
+        goto cleanup;
+    }
+
+    fwrite(&reader.header, sizeof(pcap_hdr_t), 1, output);
+    has_entry = (fread(&entry, sizeof(entry), 1, index) == 1);
+
+    while ((result = pcap_reader_next(&reader, &hdr, &data)) == PCAP_READ_RECORD)
+    {
+        PUSBPCAP_BUFFER_PACKET_HEADER header;
+        const unsigned char *restored;
+        char path[MAX_PATH];
+        HANDLE file;
+        DWORD read;
+        BOOL ok;
+
+        if (!has_entry || (entry.record != record))
+        {
+            fwrite(&hdr, sizeof(pcaprec_hdr_t), 1, output);
+            fwrite(data, 1, hdr.incl_len, output);
+            record++;
+            continue;
+        }
+
+        header = pcap_usbpcap_header(data, hdr.incl_len);
+        if ((header == NULL) ||
+            (hdr.incl_len - header->headerLen != entry.keptLength))
+        {
+            fprintf(stderr, "Record %I64u does not match index\n", record);
+            result = PCAP_READ_ERROR;
+            break;
+        }
+
+        if (entry.payloadLength > payload_size)
+        {
+            unsigned char *tmp = realloc(payload, entry.payloadLength);
+            if (tmp == NULL)
+            {
+                result = PCAP_READ_ERROR;
+                break;
+            }
+            payload = tmp;
+
+            tmp = realloc(blob, entry.payloadLength);
+            if (tmp == NULL)
+            {
+                result = PCAP_READ_ERROR;
+                break;
+            }
+            blob = tmp;
+            payload_size = entry.payloadLength;
+        }
+
+        trim_blob_path(store, entry.sha256, path, sizeof(path), FALSE);
+        file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+                           FILE_ATTRIBUTE_NORMAL, NULL);
+        if (file == INVALID_HANDLE_VALUE)
+        {
+            fprintf(stderr, "Failed to open %s - %d\n", path, GetLastError());
+            result = PCAP_READ_ERROR;
+            break;
+        }
+        ok = ReadFile(file, blob, entry.payloadLength, &read, NULL) && (read > 0);
+        CloseHandle(file);
+
+        /* Blob shorter than payload is compressed */
+        restored = blob;
+        if (ok && (read < entry.payloadLength))
+        {
+            ok = (lz_decompress(blob, read, payload, entry.payloadLength) ==
+                  (INT32)entry.payloadLength);
+            restored = payload;
+        }
+        if (!ok)
+        {
+            fprintf(stderr, "Failed to read %s\n", path);
+            result = PCAP_READ_ERROR;
+            break;
+        }
+
+        hdr.incl_len = header->headerLen + entry.payloadLength;
+        fwrite(&hdr, sizeof(pcaprec_hdr_t), 1, output);
+        fwrite(data, 1, header->headerLen, output);
+        fwrite(restored, 1, entry.payloadLength, output);
+
+        record++;
+        has_entry = (fread(&entry, sizeof(entry), 1, index) == 1);
+    }
+
+    if ((result == PCAP_READ_EOF) && !ferror(output))
+    {
+        ret = 0;
+    }
+
+cleanup:
+    if ((output != NULL) && (fclose(output) != 0))
+    {
+        ret = -1;
+    }
+    if (index != NULL)
+    {
+        fclose(index);
+    }
+    free(payload);
+    free(blob);
+    free(output_name);
+    free(index_name);
+    pcap_reader_close(&reader);
+    return ret;
+}
@@ -0,0 +1,52 @@
+/*
+ * Copyright (c) 2026 Tomasz Moń <desowin@gmail.com>
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#ifndef USBPCAP_CMD_TRIM_H
+#define USBPCAP_CMD_TRIM_H
+
+#include <windows.h>
+
+typedef struct
+{
+    UINT32 bulk_keep;   /* Bulk payload bytes to keep in every record */
+    UINT32 isoch_keep;  /* Isochronous payload bytes to keep in every record */
+    const char *store;  /* Directory for stripped payloads, NULL to discard */
+    BOOL compress;      /* Block compressed output, compressed payloads */
+} trim_rules;
+
+/* Every payload moved to store gets one entry in <output>.cas sidecar.
+ * Payload is stored in <store>\<hash[0]>\<hash> file named by lowercase
+ * hexadecimal SHA-256 of the payload. With compress the file holds single
+ * lzblock block if that is shorter than the payload. File shorter than
+ * payloadLength is always compressed, so one store can hold both forms.
+ */
+#pragma pack(push, 1)
+typedef struct
+{
+    UINT64  record;         /* 0-based record number in trimmed capture */
+    UINT32  keptLength;     /* Payload bytes left in trimmed record */
+    UINT32  payloadLength;  /* Payload bytes in store */
+    UCHAR   sha256[32];
+} TRIM_INDEX_ENTRY, *PTRIM_INDEX_ENTRY;
+#pragma pack(pop)
+
+/* Writes <capture>_trimmed.pcap (.pcapz if compressed) with bulk and
+ * isochronous payloads cut down according to rules. Headers, control,
+ * interrupt and all other records are copied unchanged. orig_len is
+ * preserved so the trimmed capture still shows the original transfer
+ * sizes.
+ *
+ * Returns 0 on success, -1 on failure.
+ */
+int trim_capture(const char *capture, const trim_rules *rules);
+
+/* Writes <trimmed>_rehydrated.pcap with payloads restored from store.
+ *
+ * Returns 0 on success, -1 on failure.
+ */
+int trim_rehydrate(const char *trimmed, const char *store);
+
+#endif /* USBPCAP_CMD_TRIM_H */
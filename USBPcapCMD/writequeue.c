@@ -0,0 +1,250 @@
+/*
+ * Copyright (c) 2026 Tomasz Moń <desowin@gmail.com>
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "writequeue.h"
+
+/* Queued data is collected in chunks of at least this size */
+#define WRITE_QUEUE_CHUNK  (256 * 1024)
+
+typedef struct _write_chunk
+{
+    struct _write_chunk *next;
+    DWORD length;
+    DWORD size;
+    unsigned char data[1];
+} write_chunk;
+
+struct _write_queue
+{
+    io_engine *engine;
+    HANDLE handle;
+    DWORD limit;
+    write_queue_ready ready;
+    void *ctx;
+
+    CRITICAL_SECTION lock;    /* Guards everything below */
+    io_request request;
+    write_chunk *head;        /* Chunk being written if writing is set */
+    write_chunk *tail;
+    write_chunk *spare;       /* Written chunk kept for reuse */
+    BOOL writing;
+    DWORD queued;             /* Bytes in chunks */
+    BOOL throttled;           /* write_queue_full() returned TRUE */
+    DWORD error;
+};
+
+static void write_queue_done(io_request *request, DWORD error, DWORD bytes);
+
+write_queue *write_queue_create(io_engine *engine, HANDLE handle, DWORD limit,
+                                write_queue_ready ready, void *ctx)
+{
+    write_queue *queue;
+
+    queue = (write_queue *)calloc(1, sizeof(write_queue));
+    if (queue == NULL)
+    {
+        return NULL;
+    }
+
+    queue->engine = engine;
+    queue->handle = handle;
+    queue->limit = limit;
+    queue->ready = ready;
+    queue->ctx = ctx;
+    queue->error = ERROR_SUCCESS;
+    InitializeCriticalSection(&queue->lock);
+    io_request_init(&queue->request, engine, write_queue_done, queue);
+    return queue;
+}
+
+static void write_queue_free_chunks(write_queue *queue)
+{
+    while (queue->head != NULL)
+    {
+        write_chunk *chunk = queue->head;
+
+        queue->head = chunk->next;
+        free(chunk);
+    }
+    queue->tail = NULL;
+    queue->queued = 0;
+}
+
+void write_queue_destroy(write_queue *queue)
+{
+    write_queue_free_chunks(queue);
+    free(queue->spare);
+    DeleteCriticalSection(&queue->lock);
+    free(queue);
+}
+
+/* Starts writing head chunk, called with lock held */
+static void write_queue_start(write_queue *queue)
+{
+    queue->writing = TRUE;
+    if (!io_write(&queue->request, queue->handle, queue->head->data, queue->head->length))
+    {
+        queue->writing = FALSE;
+        queue->error = ERROR_WRITE_FAULT;
+        write_queue_free_chunks(queue);
+    }
+}
+
+static void write_queue_done(io_request *request, DWORD error, DWORD bytes)
+{
+    write_queue *queue = (write_queue *)request->ctx;
+    write_chunk *chunk;
+    BOOL idle = FALSE;
+    BOOL ready = FALSE;
+
+    EnterCriticalSection(&queue->lock);
+    queue->writing = FALSE;
+    chunk = queue->head;
+    queue->head = chunk->next;
+    if (queue->head == NULL)
+    {
+        queue->tail = NULL;
+    }
+    queue->queued -= chunk->length;
+    if ((error == ERROR_SUCCESS) && (bytes != chunk->length))
+    {
+        error = ERROR_WRITE_FAULT;
+    }
+
+    if ((queue->spare == NULL) && (chunk->size == WRITE_QUEUE_CHUNK))
+    {
+        queue->spare = chunk;
+    }
+    else
+    {
+        free(chunk);
+    }
+
+    if (error != ERROR_SUCCESS)
+    {
+        /* Nothing more gets written, caller learns it from ready callback */
+        queue->error = error;
+        write_queue_free_chunks(queue);
+        ready = TRUE;
+    }
+    else if (queue->head != NULL)
+    {
+        write_queue_start(queue);
+    }
+    else
+    {
+        idle = TRUE;
+    }
+
+    if (queue->throttled && (queue->queued <= queue->limit / 2))
+    {
+        queue->throttled = FALSE;
+        ready = TRUE;
+    }
+    LeaveCriticalSection(&queue->lock);
+
+    if (idle)
+    {
+        /* Everything written so far is flushed once the queue empties */
+        FlushFileBuffers(queue->handle);
+    }
+    if (ready && (queue->ready != NULL))
+    {
+        queue->ready(queue->ctx);
+    }
+}
+
+BOOL write_queue_write(write_queue *queue, const void *data, DWORD length)
+{
+    write_chunk *tail;
+    BOOL result;
+
+    if (length == 0)
+    {
+        return TRUE;
+    }
+
+    EnterCriticalSection(&queue->lock);
+    if (queue->error != ERROR_SUCCESS)
+    {
+        LeaveCriticalSection(&queue->lock);
+        return FALSE;
+    }
+
+    tail = queue->tail;
+    if ((tail == NULL) || ((tail == queue->head) && queue->writing) ||
+        (tail->size - tail->length < length))
+    {
+        /* Chunk in flight cannot change, the rest are full */
+        if ((queue->spare != NULL) && (length <= WRITE_QUEUE_CHUNK))
+        {
+            tail = queue->spare;
+            queue->spare = NULL;
+        }
+        else
+        {
+            DWORD size = max(length, WRITE_QUEUE_CHUNK);
+
+            tail = (write_chunk *)malloc(FIELD_OFFSET(write_chunk, data) + size);
+            if (tail == NULL)
+            {
+                LeaveCriticalSection(&queue->lock);
+                fprintf(stderr, "Failed to allocate %d bytes for output queue\n", size);
+                return FALSE;
+            }
+            tail->size = size;
+        }
+        tail->next = NULL;
+        tail->length = 0;
+        if (queue->tail != NULL)
+        {
+            queue->tail->next = tail;
+        }
+        else
+        {
+            queue->head = tail;
+        }
+        queue->tail = tail;
+    }
+
+    memcpy(&tail->data[tail->length], data, length);
+    tail->length += length;
+    queue->queued += length;
+    if (!queue->writing)
+    {
+        write_queue_start(queue);
+    }
+    result = (queue->error == ERROR_SUCCESS);
+    LeaveCriticalSection(&queue->lock);
+    return result;
+}
+
+BOOL write_queue_full(write_queue *queue)
+{
+    BOOL full;
+
+    EnterCriticalSection(&queue->lock);
+    full = (queue->queued >= queue->limit) && (queue->error == ERROR_SUCCESS);
+    if (full)
+    {
+        queue->throttled = TRUE;
+    }
+    LeaveCriticalSection(&queue->lock);
+    return full;
+}
+
+DWORD write_queue_error(write_queue *queue)
+{
+    DWORD error;
+
+    EnterCriticalSection(&queue->lock);
+    error = queue->error;
+    LeaveCriticalSection(&queue->lock);
+    return error;
+}
@@ -0,0 +1,43 @@
+/*
+ * Copyright (c) 2026 Tomasz Moń <desowin@gmail.com>
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#ifndef USBPCAP_CMD_WRITEQUEUE_H
+#define USBPCAP_CMD_WRITEQUEUE_H
+
+#include <windows.h>
+#include "ioengine.h"
+
+/* Output written with io_write(). Data is copied to the queue, so callers
+ * never wait for the sink. One write is in flight at a time, which keeps
+ * appends in order, and data queued meanwhile goes out with the next one.
+ *
+ * Queue does not block when it holds more than limit bytes. Caller checks
+ * write_queue_full() and stops producing data until ready callback.
+ */
+typedef struct _write_queue write_queue;
+
+/* Called from engine callback when queue that was reported full has
+ * drained below half of the limit, or when a write has failed.
+ */
+typedef void (*write_queue_ready)(void *ctx);
+
+/* Handle has to be attached to engine already */
+write_queue *write_queue_create(io_engine *engine, HANDLE handle, DWORD limit,
+                                write_queue_ready ready, void *ctx);
+
+/* Frees the queue. Must be called after io_engine_drain(). */
+void write_queue_destroy(write_queue *queue);
+
+/* Returns FALSE if data could not be queued or a write has failed */
+BOOL write_queue_write(write_queue *queue, const void *data, DWORD length);
+
+/* Returns TRUE if the queue holds limit bytes or more */
+BOOL write_queue_full(write_queue *queue);
+
+/* Returns ERROR_SUCCESS or Win32 error code of failed write */
+DWORD write_queue_error(write_queue *queue);
+
+#endif /* USBPCAP_CMD_WRITEQUEUE_H */
@@ -6,10 +6,31 @@
 
 #include "USBPcapMain.h"
 #include "USBPcapBuffer.h"
+#include "USBPcapCompact.h"
+#include "USBPcapLz.h"
 #include "USBPcapHelperFunctions.h"
 
 #define USBPCAP_BUFFER_TAG  (ULONG)'ffuB'
 
+/* With USBPCAP_OPTION_ALIGNED_RING every record starts at multiple of
+ * USBPCAP_BUFFER_SLOT bytes. Record that does not fit before buffer end is
+ * stored at buffer start and pcap record header with USBPCAP_BUFFER_SKIP
+ * incl_len is left in place of it, so records are never split.
+ */
+#define USBPCAP_BUFFER_SLOT  64
+#define USBPCAP_BUFFER_SKIP  0xFFFFFFFF
+
+#define USBPcapBufferAlign(offset) \
+    (((offset) + USBPCAP_BUFFER_SLOT - 1) & ~(USBPCAP_BUFFER_SLOT - 1))
+
+/* Payload compressed before bufferLock was taken */
+typedef struct
+{
+    UINT32  length;         /* Stored payload length it was compressed from */
+    UINT32  compressedLen;  /* 0 if payload is stored as is */
+    PUCHAR  data;
+} USBPCAP_COMPRESSED_PAYLOAD, *PUSBPCAP_COMPRESSED_PAYLOAD;
+
 __inline static UINT32
 USBPcapGetBufferFree(PUSBPCAP_ROOTHUB_DATA pData)
 {
@@ -93,7 +114,10 @@ USBPcapBufferWriteUnsafe(PUSBPCAP_ROOTHUB_DATA pData,
                       data,
                       (SIZE_T)length);
         pData->writeOffset += length;
-        pData->writeOffset %= pData->bufferSize;
+        if (pData->writeOffset == pData->bufferSize)
+        {
+            pData->writeOffset = 0;
+        }
     }
     else
     {
@@ -181,7 +205,10 @@ static UINT32 USBPcapBufferRead(PUSBPCAP_ROOTHUB_DATA pData,
                       (SIZE_T)toRead);
 
         pData->readOffset += toRead;
-        pData->readOffset %= pData->bufferSize;
+        if (pData->readOffset == pData->bufferSize)
+        {
+            pData->readOffset = 0;
+        }
     }
     else
     {
@@ -197,7 +224,10 @@ static UINT32 USBPcapBufferRead(PUSBPCAP_ROOTHUB_DATA pData,
                           (SIZE_T)toRead);
 
             pData->readOffset += toRead;
-            pData->readOffset %= pData->bufferSize;
+            if (pData->readOffset == pData->bufferSize)
+            {
+                pData->readOffset = 0;
+            }
         }
         else
         {
@@ -221,6 +251,289 @@ static UINT32 USBPcapBufferRead(PUSBPCAP_ROOTHUB_DATA pData,
     return toRead;
 }
 
+/*
+ * Makes room for record with bytes following pcap record header.
+ * With USBPCAP_OPTION_ALIGNED_RING record that does not fit before buffer
+ * end is moved to buffer start.
+ *
+ * Caller must have acquired buffer spin lock.
+ * Returns FALSE if there is not enough free space.
+ */
+static BOOLEAN USBPcapBufferBeginRecord(PUSBPCAP_ROOTHUB_DATA pData,
+                                        UINT32 bytes)
+{
+    UINT32         bytesFree;
+    UINT32         length;
+    UINT32         tail;
+    pcaprec_hdr_t  *skip;
+
+    if ((pData->buffer == NULL) || (bytes >= pData->bufferSize))
+    {
+        return FALSE;
+    }
+
+    bytesFree = USBPcapGetBufferFree(pData);
+    length = sizeof(pcaprec_hdr_t) + bytes;
+
+    if (!(pData->options & USBPCAP_OPTION_ALIGNED_RING))
+    {
+        return (bytesFree >= length) ? TRUE : FALSE;
+    }
+
+    length = USBPcapBufferAlign(length);
+    tail = pData->bufferSize - pData->writeOffset;
+    if (tail >= length)
+    {
+        return (bytesFree >= length) ? TRUE : FALSE;
+    }
+
+    /* Skipped tail counts as used until reader gets past it */
+    if ((bytesFree < tail) || ((bytesFree - tail) < length))
+    {
+        return FALSE;
+    }
+
+    skip = (pcaprec_hdr_t *)((PUCHAR)pData->buffer + pData->writeOffset);
+    skip->incl_len = USBPCAP_BUFFER_SKIP;
+    pData->writeOffset = 0;
+    return TRUE;
+}
+
+/*
+ * Moves writeOffset to where next record starts.
+ * Caller must have acquired buffer spin lock.
+ */
+__inline static VOID
+USBPcapBufferEndRecord(PUSBPCAP_ROOTHUB_DATA pData)
+{
+    if (pData->options & USBPCAP_OPTION_ALIGNED_RING)
+    {
+        pData->writeOffset = USBPcapBufferAlign(pData->writeOffset) &
+                             (pData->bufferSize - 1);
+    }
+}
+
+/*
+ * Reads data from circular buffer with USBPCAP_OPTION_ALIGNED_RING.
+ *
+ * Record headers are parsed in place, every record is copied at once as
+ * it is never split at buffer end. Padding and skip markers are left out.
+ * Like with plain buffer, record can be split between reads.
+ *
+ * Returns number of bytes read.
+ */
+static UINT32 USBPcapBufferReadAligned(PUSBPCAP_ROOTHUB_DATA pData,
+                                       PVOID destBuffer,
+                                       UINT32 destBufferSize)
+{
+    PUCHAR  src = (PUCHAR)pData->buffer;
+    PUCHAR  dst = (PUCHAR)destBuffer;
+    UINT32  total = 0;
+    UINT32  tmp;
+
+    while (total < destBufferSize)
+    {
+        if (pData->recordRemaining > 0)
+        {
+            tmp = min(pData->recordRemaining, destBufferSize - total);
+            RtlCopyMemory(&dst[total], &src[pData->readOffset], tmp);
+            pData->readOffset += tmp;
+            pData->recordRemaining -= tmp;
+            total += tmp;
+
+            if (pData->recordRemaining == 0)
+            {
+                pData->readOffset = USBPcapBufferAlign(pData->readOffset) &
+                                    (pData->bufferSize - 1);
+            }
+            continue;
+        }
+
+        if (pData->readOffset == pData->writeOffset)
+        {
+            break;
+        }
+
+        tmp = ((pcaprec_hdr_t *)&src[pData->readOffset])->incl_len;
+        if (tmp == USBPCAP_BUFFER_SKIP)
+        {
+            pData->readOffset = 0;
+            continue;
+        }
+        pData->recordRemaining = sizeof(pcaprec_hdr_t) + tmp;
+    }
+
+    return total;
+}
+
+/*
+ * Copies unread records with USBPCAP_OPTION_ALIGNED_RING to start of
+ * newBuffer, keeping them aligned. Stores number of bytes used in
+ * newBuffer to pUsed.
+ *
+ * Caller must have acquired buffer spin lock.
+ * Returns FALSE if records do not fit into newSize bytes.
+ */
+static BOOLEAN USBPcapBufferMoveAligned(PUSBPCAP_ROOTHUB_DATA pData,
+                                        PUCHAR newBuffer,
+                                        UINT32 newSize,
+                                        PUINT32 pUsed)
+{
+    PUCHAR  src = (PUCHAR)pData->buffer;
+    UINT32  readOffset = pData->readOffset;
+    UINT32  length = pData->recordRemaining;
+    UINT32  used = 0;
+
+    while (1)
+    {
+        if (length > 0)
+        {
+            /* One byte has to stay free, like with plain buffer */
+            if (USBPcapBufferAlign(length) >= newSize - used)
+            {
+                return FALSE;
+            }
+            RtlCopyMemory(&newBuffer[used], &src[readOffset], length);
+            used += USBPcapBufferAlign(length);
+            readOffset = USBPcapBufferAlign(readOffset + length) &
+                         (pData->bufferSize - 1);
+        }
+
+        if (readOffset == pData->writeOffset)
+        {
+            break;
+        }
+
+        length = ((pcaprec_hdr_t *)&src[readOffset])->incl_len;
+        if (length == USBPCAP_BUFFER_SKIP)
+        {
+            readOffset = 0;
+            length = 0;
+            continue;
+        }
+        length += sizeof(pcaprec_hdr_t);
+    }
+
+    *pUsed = used;
+    return TRUE;
+}
+
+__inline static VOID
+USBPcapInitializePcapHeader(PUSBPCAP_ROOTHUB_DATA pData,
+                            LARGE_INTEGER timestamp,
+                            pcaprec_hdr_t *pcapHeader,
+                            UINT32 bytes)
+{
+    pcapHeader->ts_sec = (UINT32)(timestamp.QuadPart/10000000-11644473600);
+    pcapHeader->ts_usec = (UINT32)((timestamp.QuadPart%10000000)/10);
+
+    /* Obey the snaplen limit */
+    if (bytes > pData->snaplen)
+    {
+        pcapHeader->incl_len = pData->snaplen;
+    }
+    else
+    {
+        pcapHeader->incl_len = bytes;
+    }
+    pcapHeader->orig_len = bytes;
+}
+
+/*
+ * Reads data from circular buffer, expanding compact records.
+ *
+ * Records are returned in standard format even if buffer holds them in
+ * compact form (USBPCAP_OPTION_COMPACT_RING). Like with plain buffer,
+ * record can be split between reads.
+ *
+ * Returns number of bytes read.
+ */
+static UINT32 USBPcapBufferReadExpanded(PUSBPCAP_ROOTHUB_DATA pData,
+                                        PVOID destBuffer,
+                                        UINT32 destBufferSize)
+{
+    PUSBPCAP_COMPACT_RING  pRing = pData->compact;
+    PCHAR                  dst = (PCHAR)destBuffer;
+    UINT32                 total = 0;
+
+    if (pRing == NULL)
+    {
+        if (pData->options & USBPCAP_OPTION_ALIGNED_RING)
+        {
+            return USBPcapBufferReadAligned(pData, destBuffer, destBufferSize);
+        }
+        return USBPcapBufferRead(pData, destBuffer, destBufferSize);
+    }
+
+    while (total < destBufferSize)
+    {
+        UCHAR                         prefix[USBPCAP_COMPACT_MAX_PREFIX];
+        UINT32                        prefixLen;
+        UINT32                        readOffset;
+        UINT32                        tmp;
+        LARGE_INTEGER                 timestamp;
+        USBPCAP_BUFFER_PACKET_HEADER  header;
+        pcaprec_hdr_t                 pcapHeader;
+
+        if (pRing->pendingOffset < pRing->pendingLength)
+        {
+            tmp = min(pRing->pendingLength - pRing->pendingOffset,
+                      destBufferSize - total);
+            RtlCopyMemory(&dst[total], &pRing->pending[pRing->pendingOffset], tmp);
+            pRing->pendingOffset += tmp;
+            total += tmp;
+            continue;
+        }
+
+        if (pRing->rawRemaining > 0)
+        {
+            /* Transfer specific header and payload are stored as is */
+            tmp = USBPcapBufferRead(pData, &dst[total],
+                                    min(pRing->rawRemaining, destBufferSize - total));
+            pRing->rawRemaining -= tmp;
+            total += tmp;
+            continue;
+        }
+
+        if (USBPcapGetBufferAllocated(pData) == 0)
+        {
+            break;
+        }
+
+        /* Prefix can wrap, so copy it out. readOffset is rewound once it
+         * is known how long it was.
+         */
+        readOffset = pData->readOffset;
+        tmp = USBPcapBufferRead(pData, prefix, sizeof(prefix));
+        pData->readOffset = readOffset;
+
+        prefixLen = USBPcapCompactDecode(&pRing->decoder, prefix, tmp,
+                                         &timestamp, &header);
+        if (prefixLen == 0)
+        {
+            /* Cannot happen, records are only written by the driver */
+            DkDbgStr("Invalid compact record, discarding buffer.");
+            pData->readOffset = pData->writeOffset;
+            break;
+        }
+        pData->readOffset = (pData->readOffset + prefixLen) % pData->bufferSize;
+
+        USBPcapInitializePcapHeader(pData, timestamp, &pcapHeader,
+                                    header.headerLen + header.dataLength);
+        RtlCopyMemory(pRing->pending, &pcapHeader, sizeof(pcaprec_hdr_t));
+        RtlCopyMemory(&pRing->pending[sizeof(pcaprec_hdr_t)], &header,
+                      sizeof(USBPCAP_BUFFER_PACKET_HEADER));
+
+        /* Obey the snaplen limit, it applies to packet header too */
+        tmp = min(pcapHeader.incl_len, sizeof(USBPCAP_BUFFER_PACKET_HEADER));
+        pRing->pendingLength = sizeof(pcaprec_hdr_t) + tmp;
+        pRing->pendingOffset = 0;
+        pRing->rawRemaining = pcapHeader.incl_len - tmp;
+    }
+
+    return total;
+}
+
 
 /*
  * Writes global PCAP header to buffer.
@@ -239,17 +552,34 @@ USBPcapWriteGlobalHeader(PUSBPCAP_ROOTHUB_DATA pData)
     header.snaplen = pData->snaplen;
     header.network = DLT_USBPCAP;
 
+    if (pData->compact != NULL)
+    {
+        /* Returned to reader before the first record */
+        USBPcapCompactReset(pData->compact);
+        RtlCopyMemory(pData->compact->pending, &header, sizeof(header));
+        pData->compact->pendingLength = sizeof(header);
+        return;
+    }
+
     ASSERT (USBPcapGetBufferFree(pData) >= sizeof(header));
 
     USBPcapBufferWrite(pData, (PVOID)&header, sizeof(header));
+
+    if (pData->options & USBPCAP_OPTION_ALIGNED_RING)
+    {
+        /* Returned to reader like rest of partially read record */
+        pData->recordRemaining = sizeof(header);
+        USBPcapBufferEndRecord(pData);
+    }
 }
 
 NTSTATUS USBPcapSetUpBuffer(PUSBPCAP_ROOTHUB_DATA pData,
                             UINT32 bytes)
 {
-    NTSTATUS  status;
-    KIRQL     irql;
-    PVOID     buffer;
+    NTSTATUS               status;
+    KIRQL                  irql;
+    PVOID                  buffer;
+    PUSBPCAP_COMPACT_RING  compact = NULL;
 
     /* Minimum buffer size is 4 KiB, maximum 128 MiB */
     if (bytes < 4096 || bytes > 134217728)
@@ -257,6 +587,15 @@ NTSTATUS USBPcapSetUpBuffer(PUSBPCAP_ROOTHUB_DATA pData,
         return STATUS_INVALID_PARAMETER;
     }
 
+    if (pData->options & USBPCAP_OPTION_ALIGNED_RING)
+    {
+        /* Offsets are masked, round down to power of two */
+        while (bytes & (bytes - 1))
+        {
+            bytes &= bytes - 1;
+        }
+    }
+
     buffer = ExAllocatePoolWithTag(NonPagedPool,
                                    (SIZE_T) bytes,
                                    USBPCAP_BUFFER_TAG);
@@ -266,43 +605,96 @@ NTSTATUS USBPcapSetUpBuffer(PUSBPCAP_ROOTHUB_DATA pData,
         return STATUS_INSUFFICIENT_RESOURCES;
     }
 
+    if ((pData->options & USBPCAP_OPTION_COMPACT_RING) &&
+        (pData->compact == NULL))
+    {
+        compact = ExAllocatePoolWithTag(NonPagedPool,
+                                        sizeof(USBPCAP_COMPACT_RING),
+                                        USBPCAP_BUFFER_TAG);
+        if (compact == NULL)
+        {
+            ExFreePool(buffer);
+            return STATUS_INSUFFICIENT_RESOURCES;
+        }
+        USBPcapCompactReset(compact);
+    }
+
+    if (pData->options & USBPCAP_OPTION_COMPRESS_PAYLOAD)
+    {
+        status = USBPcapLzInitialize();
+        if (!NT_SUCCESS(status))
+        {
+            if (compact != NULL)
+            {
+                ExFreePool(compact);
+            }
+            ExFreePool(buffer);
+            return status;
+        }
+    }
+
     status = STATUS_SUCCESS;
     KeAcquireSpinLock(&pData->bufferLock, &irql);
     if (pData->buffer == NULL)
     {
+        if (compact != NULL)
+        {
+            pData->compact = compact;
+            compact = NULL;
+        }
         pData->buffer = buffer;
         pData->bufferSize = bytes;
         pData->readOffset = 0;
         pData->writeOffset = 0;
+        pData->recordRemaining = 0;
         USBPcapWriteGlobalHeader(pData);
         DkDbgVal("Created new buffer", bytes);
     }
     else
     {
-        UINT32 allocated = USBPcapGetBufferAllocated(pData);
+        UINT32   allocated = USBPcapGetBufferAllocated(pData);
+        BOOLEAN  fits;
 
-        if (allocated >= bytes)
+        if (pData->options & USBPCAP_OPTION_ALIGNED_RING)
         {
-            status = STATUS_BUFFER_TOO_SMALL;
-            ExFreePool(buffer);
+            /* Records are copied one by one, so they stay aligned */
+            fits = USBPcapBufferMoveAligned(pData, (PUCHAR)buffer, bytes,
+                                            &allocated);
         }
         else
         {
+            fits = (allocated < bytes) ? TRUE : FALSE;
+
             /* Copy (if any) unread data to new buffer */
-            if (allocated > 0)
+            if (fits && (allocated > 0))
             {
                 USBPcapBufferRead(pData, buffer, bytes);
             }
+        }
 
+        if (!fits)
+        {
+            status = STATUS_BUFFER_TOO_SMALL;
+            ExFreePool(buffer);
+        }
+        else
+        {
             /* Free the old buffer */
             ExFreePool(pData->buffer);
             pData->buffer = buffer;
+            pData->bufferSize = bytes;
             pData->readOffset = 0;
             pData->writeOffset = allocated;
         }
     }
 
     KeReleaseSpinLock(&pData->bufferLock, irql);
+
+    if (compact != NULL)
+    {
+        /* Buffer was already set up */
+        ExFreePool(compact);
+    }
     return status;
 }
 
@@ -332,6 +724,54 @@ NTSTATUS USBPcapSetSnaplenSize(PUSBPCAP_ROOTHUB_DATA pData,
     return status;
 }
 
+/*
+ * Sets capture options (USBPCAP_OPTION_XXX flags). Options can be changed
+ * only while there is no buffer allocated. Resets packet sequence number.
+ */
+NTSTATUS USBPcapSetOptions(PUSBPCAP_ROOTHUB_DATA pData,
+                           UINT32 options)
+{
+    NTSTATUS  status;
+    KIRQL     irql;
+
+    if (options & ~(USBPCAP_OPTION_SEQUENCE_NUMBERS |
+                    USBPCAP_OPTION_COMPACT_RING |
+                    USBPCAP_OPTION_COMPRESS_PAYLOAD |
+                    USBPCAP_OPTION_ALIGNED_RING))
+    {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    /* Compact records are not aligned */
+    if ((options & USBPCAP_OPTION_COMPACT_RING) &&
+        (options & USBPCAP_OPTION_ALIGNED_RING))
+    {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    /* Compact records have no room for compressed length */
+    if ((options & USBPCAP_OPTION_COMPACT_RING) &&
+        (options & USBPCAP_OPTION_COMPRESS_PAYLOAD))
+    {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    status = STATUS_SUCCESS;
+    KeAcquireSpinLock(&pData->bufferLock, &irql);
+    if (pData->buffer != NULL)
+    {
+        status = STATUS_UNSUCCESSFUL;
+    }
+    else
+    {
+        pData->options = options;
+        pData->sequence = 0;
+    }
+
+    KeReleaseSpinLock(&pData->bufferLock, irql);
+    return status;
+}
+
 /*
  * If there is buffer allocated for given control device, frees all
  * memory allocated to it, otherwise does nothing.
@@ -356,8 +796,15 @@ VOID USBPcapBufferRemoveBuffer(PDEVICE_EXTENSION pDevExt)
     KeAcquireSpinLock(&pData->bufferLock, &irql);
     pData->readOffset = 0;
     pData->writeOffset = 0;
+    pData->recordRemaining = 0;
     ExFreePool((PVOID)pData->buffer);
     pData->buffer = NULL;
+    if (pData->compact != NULL)
+    {
+        ExFreePool((PVOID)pData->compact);
+        pData->compact = NULL;
+    }
+    pData->options = 0;
     KeReleaseSpinLock(&pData->bufferLock, irql);
 }
 
@@ -385,6 +832,7 @@ VOID USBPcapBufferInitializeBuffer(PDEVICE_EXTENSION pDevExt)
     KeAcquireSpinLock(&pData->bufferLock, &irql);
     pData->readOffset = 0;
     pData->writeOffset = 0;
+    pData->recordRemaining = 0;
     USBPcapWriteGlobalHeader(pData);
     KeReleaseSpinLock(&pData->bufferLock, irql);
 }
@@ -440,8 +888,8 @@ NTSTATUS USBPcapBufferHandleReadIrp(PIRP pIrp,
      * otherwise complete this IRP then return SUCCESS
      */
     KeAcquireSpinLock(&pRootData->bufferLock, &irql);
-    bytesRead = USBPcapBufferRead(pRootData,
-                                  buffer, bufferLength);
+    bytesRead = USBPcapBufferReadExpanded(pRootData,
+                                          buffer, bufferLength);
     KeReleaseSpinLock(&pRootData->bufferLock, irql);
 
     *pBytesRead = bytesRead;
@@ -455,6 +903,70 @@ NTSTATUS USBPcapBufferHandleReadIrp(PIRP pIrp,
     return STATUS_SUCCESS;
 }
 
+NTSTATUS USBPcapBufferHandleWriteIrp(PIRP pIrp,
+                                     PDEVICE_EXTENSION pDevExt,
+                                     PUINT32 pBytesWritten)
+{
+    PDEVICE_EXTENSION             pRootExt;
+    PUSBPCAP_ROOTHUB_DATA         pRootData;
+    PVOID                         buffer;
+    UINT32                        bufferLength;
+    NTSTATUS                      status;
+    USBPCAP_BUFFER_PACKET_HEADER  header;
+
+    *pBytesWritten = 0;
+
+    pRootExt = (PDEVICE_EXTENSION)pDevExt->context.control.pRootHubObject->DeviceExtension;
+    pRootData = pRootExt->context.usb.pDeviceData->pRootData;
+
+    if (pRootData->buffer == NULL)
+    {
+        return STATUS_UNSUCCESSFUL;
+    }
+
+    if (pIrp->MdlAddress == NULL)
+    {
+        /* Zero length write, nothing to annotate */
+        return STATUS_SUCCESS;
+    }
+
+    /*
+     * Since control device has DO_DIRECT_IO bit set the MDL is already
+     * probed and locked
+     */
+    buffer = MmGetSystemAddressForMdlSafe(pIrp->MdlAddress,
+                                          NormalPagePriority);
+    if (buffer == NULL)
+    {
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    bufferLength = MmGetMdlByteCount(pIrp->MdlAddress);
+    if (bufferLength > USBPCAP_MAX_ANNOTATION_LENGTH)
+    {
+        return STATUS_INVALID_BUFFER_SIZE;
+    }
+
+    header.headerLen  = sizeof(USBPCAP_BUFFER_PACKET_HEADER);
+    header.irpId      = (UINT64) pIrp;
+    header.status     = USBD_STATUS_SUCCESS;
+    header.function   = USBPCAP_FUNCTION_EVENT;
+    header.info       = USBPCAP_INFO_ANNOTATION;
+    header.bus        = pRootData->busId;
+    header.device     = 0;
+    header.endpoint   = 0;
+    header.transfer   = USBPCAP_TRANSFER_IRP_INFO;
+    header.dataLength = bufferLength;
+
+    status = USBPcapBufferWritePacket(pRootData, &header, buffer);
+    if (NT_SUCCESS(status))
+    {
+        *pBytesWritten = bufferLength;
+    }
+
+    return status;
+}
+
 static void USBPcapBufferCompletePendedReadIrp(PUSBPCAP_ROOTHUB_DATA pRootData)
 {
     PDEVICE_EXTENSION  pControlExt;
@@ -494,8 +1006,8 @@ static void USBPcapBufferCompletePendedReadIrp(PUSBPCAP_ROOTHUB_DATA pRootData)
             {
                 KIRQL  irql;
                 KeAcquireSpinLock(&pRootData->bufferLock, &irql);
-                bytes = USBPcapBufferRead(pRootData,
-                                          buffer, bufferLength);
+                bytes = USBPcapBufferReadExpanded(pRootData,
+                                                  buffer, bufferLength);
                 KeReleaseSpinLock(&pRootData->bufferLock, irql);
             }
             else
@@ -511,44 +1023,154 @@ static void USBPcapBufferCompletePendedReadIrp(PUSBPCAP_ROOTHUB_DATA pRootData)
     }
 }
 
-__inline static VOID
-USBPcapInitializePcapHeader(PUSBPCAP_ROOTHUB_DATA pData,
-                            LARGE_INTEGER timestamp,
-                            pcaprec_hdr_t *pcapHeader,
-                            UINT32 bytes)
+/* Caller must hold bufferLock
+ *
+ * Writes entries (array of USBPCAP_PAYLOAD_ENTRY with the last element
+ * being {0, NULL}) but no more than bytes. Returns number of bytes left.
+ */
+static UINT32
+USBPcapBufferWriteEntries(PUSBPCAP_ROOTHUB_DATA pRootData,
+                          PUSBPCAP_PAYLOAD_ENTRY entries,
+                          UINT32 bytes)
 {
-    pcapHeader->ts_sec = (UINT32)(timestamp.QuadPart/10000000-11644473600);
-    pcapHeader->ts_usec = (UINT32)((timestamp.QuadPart%10000000)/10);
+    UINT32  tmp;
+    int     i;
 
-    /* Obey the snaplen limit */
-    if (bytes > pData->snaplen)
+    for (i = 0; (bytes > 0) && (entries[i].buffer); i++)
     {
-        pcapHeader->incl_len = pData->snaplen;
+        tmp = min(bytes, entries[i].size);
+        if (tmp > 0)
+        {
+            USBPcapBufferWriteUnsafe(pRootData,
+                                     entries[i].buffer,
+                                     tmp);
+        }
+        bytes -= tmp;
+    }
+
+    return bytes;
+}
+
+/*
+ * Returns number of payload bytes that will be stored for packet.
+ * Called without bufferLock, so the result has to be checked again once
+ * the lock is held.
+ */
+static UINT32
+USBPcapBufferPayloadLength(PUSBPCAP_ROOTHUB_DATA pRootData,
+                           PUSBPCAP_BUFFER_PACKET_HEADER header)
+{
+    UINT32  headerLen = header->headerLen;
+    UINT32  bytes;
+
+    if (pRootData->options & USBPCAP_OPTION_SEQUENCE_NUMBERS)
+    {
+        headerLen += sizeof(UINT64);
+    }
+
+    bytes = min(headerLen + header->dataLength, pRootData->snaplen);
+    return (bytes > headerLen) ? (bytes - headerLen) : 0;
+}
+
+/*
+ * Compresses first length bytes of entries into pContext->output.
+ * Returns compressed length or 0 if payload should be stored as is.
+ */
+static UINT32
+USBPcapBufferCompressPayload(PUSBPCAP_LZ_CONTEXT pContext,
+                             PUSBPCAP_PAYLOAD_ENTRY entries,
+                             UINT32 length)
+{
+    PUCHAR               src;
+    UINT32               copied;
+    UINT32               tmp;
+    int                  i;
+
+    if ((length < USBPCAP_LZ_MIN_PAYLOAD) || (length > USBPCAP_LZ_MAX_PAYLOAD))
+    {
+        return 0;
+    }
+
+    if ((entries[0].buffer != NULL) && (entries[0].size >= length))
+    {
+        /* Usual case, payload is in single buffer */
+        src = (PUCHAR)entries[0].buffer;
     }
     else
     {
-        pcapHeader->incl_len = bytes;
+        copied = 0;
+        for (i = 0; (copied < length) && (entries[i].buffer); i++)
+        {
+            tmp = min(length - copied, entries[i].size);
+            RtlCopyMemory(&pContext->input[copied], entries[i].buffer, tmp);
+            copied += tmp;
+        }
+        if (copied < length)
+        {
+            return 0;
+        }
+        src = pContext->input;
     }
-    pcapHeader->orig_len = bytes;
+
+    /* Not worth it unless it saves at least one eighth */
+    return USBPcapLzCompress(pContext, src, length, length - (length >> 3));
 }
 
 /* Caller must hold bufferLock
  *
  * payloadEntries is array of USBPCAP_PAYLOAD_ENTRY with the last element being {0, NULL}
+ * compressed is payload compressed before the lock was taken, it is stored
+ * instead of payloadEntries if it was made for the stored length.
  */
 static NTSTATUS
 USBPcapBufferStorePacket(PUSBPCAP_ROOTHUB_DATA pRootData,
                          LARGE_INTEGER timestamp,
                          PUSBPCAP_BUFFER_PACKET_HEADER header,
-                         PUSBPCAP_PAYLOAD_ENTRY payloadEntries)
+                         PUSBPCAP_PAYLOAD_ENTRY payloadEntries,
+                         PUSBPCAP_COMPRESSED_PAYLOAD compressed)
 {
-    UINT32             bytes;
-    UINT32             bytesFree;
-    UINT32             tmp;
-    pcaprec_hdr_t      pcapHeader;
-    int                i;
+    UINT32                        bytes;
+    UINT32                        bytesFree;
+    UINT32                        headerLen;
+    pcaprec_hdr_t                 pcapHeader;
+    USBPCAP_BUFFER_PACKET_HEADER  sequenceHeader;
+    UINT64                        sequence;
+    USBPCAP_PAYLOAD_ENTRY         headerEntries[4];
+    int                           i;
+
+    headerLen = header->headerLen;
+    if (pRootData->options & USBPCAP_OPTION_SEQUENCE_NUMBERS)
+    {
+        /* Number is consumed even if the packet is dropped below */
+        sequence = pRootData->sequence++;
 
-    bytes = header->headerLen + header->dataLength;
+        /* Copy of common header with sequence number appended after
+         * the transfer specific header.
+         */
+        RtlCopyMemory(&sequenceHeader, header,
+                      sizeof(USBPCAP_BUFFER_PACKET_HEADER));
+        headerLen += sizeof(UINT64);
+        sequenceHeader.headerLen = (USHORT)headerLen;
+        sequenceHeader.info |= USBPCAP_INFO_SEQUENCE;
+
+        headerEntries[0].size   = sizeof(USBPCAP_BUFFER_PACKET_HEADER);
+        headerEntries[0].buffer = &sequenceHeader;
+        headerEntries[1].size   = header->headerLen - sizeof(USBPCAP_BUFFER_PACKET_HEADER);
+        headerEntries[1].buffer = (PUCHAR)header + sizeof(USBPCAP_BUFFER_PACKET_HEADER);
+        headerEntries[2].size   = sizeof(UINT64);
+        headerEntries[2].buffer = &sequence;
+        headerEntries[3].size   = 0;
+        headerEntries[3].buffer = NULL;
+    }
+    else
+    {
+        headerEntries[0].size   = headerLen;
+        headerEntries[0].buffer = header;
+        headerEntries[1].size   = 0;
+        headerEntries[1].buffer = NULL;
+    }
+
+    bytes = headerLen + header->dataLength;
 
     USBPcapInitializePcapHeader(pRootData, timestamp, &pcapHeader, bytes);
 
@@ -556,9 +1178,9 @@ USBPcapBufferStorePacket(PUSBPCAP_ROOTHUB_DATA pRootData,
     bytes = pcapHeader.incl_len;
 
     /* Sanity check payload entries */
-    if (bytes > (sizeof(pcaprec_hdr_t) + header->headerLen))
+    if (bytes > (sizeof(pcaprec_hdr_t) + headerLen))
     {
-        UINT32 bytesMissing = bytes - (sizeof(pcaprec_hdr_t) + header->headerLen);
+        UINT32 bytesMissing = bytes - (sizeof(pcaprec_hdr_t) + headerLen);
 
         for (i = 0; (bytesMissing > 0) && (payloadEntries[i].buffer); i++)
         {
@@ -574,9 +1196,84 @@ USBPcapBufferStorePacket(PUSBPCAP_ROOTHUB_DATA pRootData,
 
     bytesFree = USBPcapGetBufferFree(pRootData);
 
-    if ((pRootData->buffer == NULL) ||
-        (bytesFree < sizeof(pcaprec_hdr_t)) ||
-        ((bytesFree - sizeof(pcaprec_hdr_t)) < bytes))
+    if ((pRootData->compact != NULL) && (pRootData->buffer != NULL))
+    {
+        UCHAR   prefix[USBPCAP_COMPACT_MAX_PREFIX];
+        UINT32  prefixLen;
+        PUSBPCAP_BUFFER_PACKET_HEADER  common;
+
+        /* Prefix replaces pcap record header and common packet header */
+        common = (PUSBPCAP_BUFFER_PACKET_HEADER)headerEntries[0].buffer;
+        prefixLen = USBPcapCompactEncode(&pRootData->compact->encoder,
+                                         timestamp, common, prefix);
+        bytes -= min(bytes, sizeof(USBPCAP_BUFFER_PACKET_HEADER));
+
+        if ((bytesFree < prefixLen) || ((bytesFree - prefixLen) < bytes))
+        {
+            DkDbgStr("No enough free space left.");
+            return STATUS_INSUFFICIENT_RESOURCES;
+        }
+
+        USBPcapCompactCommit(&pRootData->compact->encoder, timestamp, common);
+        USBPcapBufferWriteUnsafe(pRootData, prefix, prefixLen);
+
+        /* Transfer specific header follows common header in first entry */
+        headerEntries[0].buffer = (PUCHAR)common + sizeof(USBPCAP_BUFFER_PACKET_HEADER);
+        headerEntries[0].size  -= sizeof(USBPCAP_BUFFER_PACKET_HEADER);
+        bytes = USBPcapBufferWriteEntries(pRootData, headerEntries, bytes);
+        USBPcapBufferWriteEntries(pRootData, payloadEntries, bytes);
+
+        return STATUS_SUCCESS;
+    }
+
+    if ((compressed->compressedLen > 0) && (pRootData->buffer != NULL) &&
+        (pRootData->options & USBPCAP_OPTION_COMPRESS_PAYLOAD) &&
+        (bytes > headerLen) && (compressed->length == bytes - headerLen))
+    {
+        USBPCAP_BUFFER_PACKET_HEADER  compressedHeader;
+        USBPCAP_PAYLOAD_ENTRY         entries[6];
+        int                           count;
+
+        /* orig_len stays, reader decompresses payload to
+         * min(orig_len, snaplen) - headerLen bytes.
+         */
+        pcapHeader.incl_len = headerLen + compressed->compressedLen;
+
+        if (!USBPcapBufferBeginRecord(pRootData, pcapHeader.incl_len))
+        {
+            DkDbgStr("No enough free space left.");
+            return STATUS_INSUFFICIENT_RESOURCES;
+        }
+
+        RtlCopyMemory(&compressedHeader, headerEntries[0].buffer,
+                      sizeof(USBPCAP_BUFFER_PACKET_HEADER));
+        compressedHeader.info |= USBPCAP_INFO_COMPRESSED;
+
+        entries[0].size   = sizeof(USBPCAP_BUFFER_PACKET_HEADER);
+        entries[0].buffer = &compressedHeader;
+        entries[1].size   = headerEntries[0].size - sizeof(USBPCAP_BUFFER_PACKET_HEADER);
+        entries[1].buffer = (PUCHAR)headerEntries[0].buffer + sizeof(USBPCAP_BUFFER_PACKET_HEADER);
+        count = 2;
+        for (i = 1; headerEntries[i].buffer; i++)
+        {
+            entries[count++] = headerEntries[i];
+        }
+        entries[count].size   = compressed->compressedLen;
+        entries[count].buffer = compressed->data;
+        count++;
+        entries[count].size   = 0;
+        entries[count].buffer = NULL;
+
+        USBPcapBufferWriteUnsafe(pRootData,
+                                 (PVOID) &pcapHeader,
+                                 (UINT32) sizeof(pcaprec_hdr_t));
+        USBPcapBufferWriteEntries(pRootData, entries, pcapHeader.incl_len);
+        USBPcapBufferEndRecord(pRootData);
+
+        return STATUS_SUCCESS;
+    }
+
+    if (!USBPcapBufferBeginRecord(pRootData, bytes))
     {
         DkDbgStr("No enough free space left.");
         return STATUS_INSUFFICIENT_RESOURCES;
@@ -588,27 +1285,11 @@ USBPcapBufferStorePacket(PUSBPCAP_ROOTHUB_DATA pRootData,
                              (UINT32) sizeof(pcaprec_hdr_t));
 
     /* Write USBPCAP_BUFFER_PACKET_HEADER */
-    tmp = min(bytes, (UINT32)header->headerLen);
-    if (tmp > 0)
-    {
-        USBPcapBufferWriteUnsafe(pRootData,
-                                 (PVOID) header,
-                                 tmp);
-    }
-    bytes -= tmp;
+    bytes = USBPcapBufferWriteEntries(pRootData, headerEntries, bytes);
 
     /* Write payload entries */
-    for (i = 0; (bytes > 0) && (payloadEntries[i].buffer); i++)
-    {
-        tmp = min(bytes, payloadEntries[i].size);
-        if (tmp > 0)
-        {
-            USBPcapBufferWriteUnsafe(pRootData,
-                                     payloadEntries[i].buffer,
-                                     tmp);
-        }
-        bytes -= tmp;
-    }
+    USBPcapBufferWriteEntries(pRootData, payloadEntries, bytes);
+    USBPcapBufferEndRecord(pRootData);
 
     return STATUS_SUCCESS;
 }
@@ -618,12 +1299,37 @@ NTSTATUS USBPcapBufferWriteTimestampedPayload(PUSBPCAP_ROOTHUB_DATA pRootData,
                                               PUSBPCAP_BUFFER_PACKET_HEADER header,
                                               PUSBPCAP_PAYLOAD_ENTRY payload)
 {
-    KIRQL                  irql;
-    NTSTATUS               status;
+    KIRQL                       irql;
+    NTSTATUS                    status;
+    USBPCAP_COMPRESSED_PAYLOAD  compressed;
+    PUSBPCAP_LZ_CONTEXT         pContext;
 
-    KeAcquireSpinLock(&pRootData->bufferLock, &irql);
-    status = USBPcapBufferStorePacket(pRootData, timestamp, header, payload);
-    KeReleaseSpinLock(&pRootData->bufferLock, irql);
+    compressed.length = 0;
+    compressed.compressedLen = 0;
+    compressed.data = NULL;
+
+    KeRaiseIrql(DISPATCH_LEVEL, &irql);
+
+    if (pRootData->options & USBPCAP_OPTION_COMPRESS_PAYLOAD)
+    {
+        /* Compress before taking bufferLock, so other completions on the
+         * hub do not wait for it.
+         */
+        pContext = USBPcapLzGetProcessorContext();
+        if (pContext != NULL)
+        {
+            compressed.length = USBPcapBufferPayloadLength(pRootData, header);
+            compressed.compressedLen =
+                USBPcapBufferCompressPayload(pContext, payload, compressed.length);
+            compressed.data = pContext->output;
+        }
+    }
+
+    KeAcquireSpinLockAtDpcLevel(&pRootData->bufferLock);
+    status = USBPcapBufferStorePacket(pRootData, timestamp, header, payload,
+                                      &compressed);
+    KeReleaseSpinLockFromDpcLevel(&pRootData->bufferLock);
+    KeLowerIrql(irql);
 
     if (NT_SUCCESS(status))
     {
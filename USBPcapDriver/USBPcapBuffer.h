@@ -19,12 +19,17 @@ NTSTATUS USBPcapSetUpBuffer(PUSBPCAP_ROOTHUB_DATA pData,
                             UINT32 bytes);
 NTSTATUS USBPcapSetSnaplenSize(PUSBPCAP_ROOTHUB_DATA pData,
                                UINT32 bytes);
+NTSTATUS USBPcapSetOptions(PUSBPCAP_ROOTHUB_DATA pData,
+                           UINT32 options);
 
 VOID USBPcapBufferRemoveBuffer(PDEVICE_EXTENSION pDevExt);
 VOID USBPcapBufferInitializeBuffer(PDEVICE_EXTENSION pDevExt);
 NTSTATUS USBPcapBufferHandleReadIrp(PIRP pIrp,
                                     PDEVICE_EXTENSION pDevExt,
                                     PUINT32 pBytesRead);
+NTSTATUS USBPcapBufferHandleWriteIrp(PIRP pIrp,
+                                     PDEVICE_EXTENSION pDevExt,
+                                     PUINT32 pBytesWritten);
 
 /* Same as USBPcapBufferWriteTimestampedPacket but take {0, NULL} terminated
  * array of payload entries instead of single buffer pointer.
@@ -0,0 +1,308 @@
+/*
+ * Copyright (c) 2026 Tomasz Moń <desowin@gmail.com>
+ *
+ * SPDX-License-Identifier: GPL-2.0
+ */
+
+#include "USBPcapMain.h"
+#include "USBPcapCompact.h"
+
+__inline static UINT32
+USBPcapCompactEndpointSlot(USHORT device, UCHAR endpoint)
+{
+    return ((UINT32)device * 7 + (endpoint & 0x0F) * 2 + (endpoint >> 7)) &
+           (USBPCAP_COMPACT_ENDPOINTS - 1);
+}
+
+__inline static UINT32
+USBPcapCompactIrpSlot(UINT64 irpId)
+{
+    /* IRPs are pool allocations, low bits are always zero */
+    return (UINT32)((irpId >> 4) ^ (irpId >> 12)) & (USBPCAP_COMPACT_IRPS - 1);
+}
+
+__inline static UINT32
+USBPcapCompactPutVarint(PUCHAR pOut, UINT64 value)
+{
+    UINT32 length = 0;
+
+    while (value >= 0x80)
+    {
+        pOut[length++] = (UCHAR)(value | 0x80);
+        value >>= 7;
+    }
+    pOut[length++] = (UCHAR)value;
+    return length;
+}
+
+/* Returns number of bytes consumed or 0 if varint is not complete */
+__inline static UINT32
+USBPcapCompactGetVarint(PUCHAR pIn, UINT32 length, UINT64 *value)
+{
+    UINT32 i;
+
+    *value = 0;
+    for (i = 0; (i < length) && (i < 10); i++)
+    {
+        *value |= (UINT64)(pIn[i] & 0x7F) << (7 * i);
+        if ((pIn[i] & 0x80) == 0)
+        {
+            return i + 1;
+        }
+    }
+    return 0;
+}
+
+/* Context the header is compared with. Endpoint that is not in its slot
+ * starts from empty context.
+ */
+static VOID
+USBPcapCompactLookup(PUSBPCAP_COMPACT_STATE pState,
+                     PUSBPCAP_BUFFER_PACKET_HEADER header,
+                     PUSBPCAP_COMPACT_ENDPOINT pContext,
+                     PBOOLEAN pHit)
+{
+    PUSBPCAP_COMPACT_ENDPOINT pSlot;
+
+    pSlot = &pState->endpoints[USBPcapCompactEndpointSlot(header->device,
+                                                          header->endpoint)];
+    if (pSlot->valid &&
+        (pSlot->device == header->device) &&
+        (pSlot->endpoint == header->endpoint))
+    {
+        *pContext = *pSlot;
+        *pHit = TRUE;
+    }
+    else
+    {
+        RtlZeroMemory(pContext, sizeof(USBPCAP_COMPACT_ENDPOINT));
+        pContext->headerLen = sizeof(USBPCAP_BUFFER_PACKET_HEADER);
+        *pHit = FALSE;
+    }
+}
+
+VOID USBPcapCompactReset(PUSBPCAP_COMPACT_RING pRing)
+{
+    RtlZeroMemory(pRing, sizeof(USBPCAP_COMPACT_RING));
+}
+
+UINT32 USBPcapCompactEncode(PUSBPCAP_COMPACT_STATE pState,
+                            LARGE_INTEGER timestamp,
+                            PUSBPCAP_BUFFER_PACKET_HEADER header,
+                            PUCHAR pOut)
+{
+    USBPCAP_COMPACT_ENDPOINT  context;
+    BOOLEAN                   hit;
+    UCHAR                     flags = 0;
+    UINT32                    length = 1;
+    LONGLONG                  delta;
+
+    USBPcapCompactLookup(pState, header, &context, &hit);
+
+    if (hit)
+    {
+        pOut[length++] = (UCHAR)USBPcapCompactEndpointSlot(header->device,
+                                                           header->endpoint);
+    }
+    else
+    {
+        flags |= USBPCAP_COMPACT_FLAG_ENDPOINT;
+        length += USBPcapCompactPutVarint(&pOut[length], header->device);
+        pOut[length++] = header->endpoint;
+    }
+
+    if (header->transfer != context.transfer)
+    {
+        flags |= USBPCAP_COMPACT_FLAG_TRANSFER;
+        pOut[length++] = header->transfer;
+    }
+    if (header->function != context.function)
+    {
+        flags |= USBPCAP_COMPACT_FLAG_FUNCTION;
+        length += USBPcapCompactPutVarint(&pOut[length], header->function);
+    }
+    if ((UINT32)header->status != context.status)
+    {
+        flags |= USBPCAP_COMPACT_FLAG_STATUS;
+        length += USBPcapCompactPutVarint(&pOut[length], (UINT32)header->status);
+    }
+    if (header->info != context.info)
+    {
+        flags |= USBPCAP_COMPACT_FLAG_INFO;
+        pOut[length++] = header->info;
+    }
+    if (header->headerLen != context.headerLen)
+    {
+        flags |= USBPCAP_COMPACT_FLAG_HEADERLEN;
+        length += USBPcapCompactPutVarint(&pOut[length], header->headerLen);
+    }
+    if (header->bus != context.bus)
+    {
+        flags |= USBPCAP_COMPACT_FLAG_BUS;
+        length += USBPcapCompactPutVarint(&pOut[length], header->bus);
+    }
+
+    if (pState->irps[USBPcapCompactIrpSlot(header->irpId)] == header->irpId)
+    {
+        /* Completion of recently submitted IRP */
+        flags |= USBPCAP_COMPACT_FLAG_IRP;
+        pOut[length++] = (UCHAR)USBPcapCompactIrpSlot(header->irpId);
+    }
+    else
+    {
+        RtlCopyMemory(&pOut[length], &header->irpId, sizeof(UINT64));
+        length += sizeof(UINT64);
+    }
+
+    length += USBPcapCompactPutVarint(&pOut[length], header->dataLength);
+
+    delta = timestamp.QuadPart - pState->timestamp;
+    length += USBPcapCompactPutVarint(&pOut[length],
+                                      ((UINT64)delta << 1) ^ (UINT64)(delta >> 63));
+
+    pOut[0] = flags;
+
+    ASSERT(length <= USBPCAP_COMPACT_MAX_PREFIX);
+    return length;
+}
+
+VOID USBPcapCompactCommit(PUSBPCAP_COMPACT_STATE pState,
+                          LARGE_INTEGER timestamp,
+                          PUSBPCAP_BUFFER_PACKET_HEADER header)
+{
+    PUSBPCAP_COMPACT_ENDPOINT pSlot;
+
+    pSlot = &pState->endpoints[USBPcapCompactEndpointSlot(header->device,
+                                                          header->endpoint)];
+    pSlot->valid     = TRUE;
+    pSlot->device    = header->device;
+    pSlot->endpoint  = header->endpoint;
+    pSlot->transfer  = header->transfer;
+    pSlot->function  = header->function;
+    pSlot->status    = (UINT32)header->status;
+    pSlot->info      = header->info;
+    pSlot->headerLen = header->headerLen;
+    pSlot->bus       = header->bus;
+
+    pState->irps[USBPcapCompactIrpSlot(header->irpId)] = header->irpId;
+    pState->timestamp = timestamp.QuadPart;
+}
+
+UINT32 USBPcapCompactDecode(PUSBPCAP_COMPACT_STATE pState,
+                            PUCHAR pIn,
+                            UINT32 length,
+                            PLARGE_INTEGER timestamp,
+                            PUSBPCAP_BUFFER_PACKET_HEADER header)
+{
+    USBPCAP_COMPACT_ENDPOINT  context;
+    UCHAR                     flags;
+    UINT32                    used = 1;
+    UINT32                    tmp;
+    UINT64                    value;
+
+/* Reads varint into value or fails the decode */
+#define COMPACT_GET_VARINT()                                              \
+    tmp = USBPcapCompactGetVarint(&pIn[used], length - used, &value);     \
+    if (tmp == 0)                                                         \
+    {                                                                     \
+        return 0;                                                         \
+    }                                                                     \
+    used += tmp;
+
+/* Fails the decode if less than n bytes are left */
+#define COMPACT_NEED(n)                                                   \
+    if (length - used < (n))                                              \
+    {                                                                     \
+        return 0;                                                         \
+    }
+
+    if (length < 1)
+    {
+        return 0;
+    }
+    flags = pIn[0];
+
+    if (flags & USBPCAP_COMPACT_FLAG_ENDPOINT)
+    {
+        COMPACT_GET_VARINT();
+        header->device = (USHORT)value;
+        COMPACT_NEED(1);
+        header->endpoint = pIn[used++];
+        /* Encoder did not find it, so whatever is in the slot is replaced */
+        RtlZeroMemory(&context, sizeof(context));
+        context.headerLen = sizeof(USBPCAP_BUFFER_PACKET_HEADER);
+    }
+    else
+    {
+        COMPACT_NEED(1);
+        context = pState->endpoints[pIn[used++] & (USBPCAP_COMPACT_ENDPOINTS - 1)];
+        if (!context.valid)
+        {
+            return 0;
+        }
+        header->device = context.device;
+        header->endpoint = context.endpoint;
+    }
+
+    header->transfer = context.transfer;
+    if (flags & USBPCAP_COMPACT_FLAG_TRANSFER)
+    {
+        COMPACT_NEED(1);
+        header->transfer = pIn[used++];
+    }
+    header->function = context.function;
+    if (flags & USBPCAP_COMPACT_FLAG_FUNCTION)
+    {
+        COMPACT_GET_VARINT();
+        header->function = (USHORT)value;
+    }
+    header->status = (USBD_STATUS)context.status;
+    if (flags & USBPCAP_COMPACT_FLAG_STATUS)
+    {
+        COMPACT_GET_VARINT();
+        header->status = (USBD_STATUS)(UINT32)value;
+    }
+    header->info = context.info;
+    if (flags & USBPCAP_COMPACT_FLAG_INFO)
+    {
+        COMPACT_NEED(1);
+        header->info = pIn[used++];
+    }
+    header->headerLen = context.headerLen;
+    if (flags & USBPCAP_COMPACT_FLAG_HEADERLEN)
+    {
+        COMPACT_GET_VARINT();
+        header->headerLen = (USHORT)value;
+    }
+    header->bus = context.bus;
+    if (flags & USBPCAP_COMPACT_FLAG_BUS)
+    {
+        COMPACT_GET_VARINT();
+        header->bus = (USHORT)value;
+    }
+
+    if (flags & USBPCAP_COMPACT_FLAG_IRP)
+    {
+        COMPACT_NEED(1);
+        header->irpId = pState->irps[pIn[used++]];
+    }
+    else
+    {
+        COMPACT_NEED(sizeof(UINT64));
+        RtlCopyMemory(&header->irpId, &pIn[used], sizeof(UINT64));
+        used += sizeof(UINT64);
+    }
+
+    COMPACT_GET_VARINT();
+    header->dataLength = (UINT32)value;
+
+    COMPACT_GET_VARINT();
+    timestamp->QuadPart = pState->timestamp +
+                          (LONGLONG)((value >> 1) ^ (0 - (value & 1)));
+
+#undef COMPACT_GET_VARINT
+#undef COMPACT_NEED
+
+    USBPcapCompactCommit(pState, *timestamp, header);
+    return used;
+}
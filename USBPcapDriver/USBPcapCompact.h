@@ -0,0 +1,116 @@
+/*
+ * Copyright (c) 2026 Tomasz Moń <desowin@gmail.com>
+ *
+ * SPDX-License-Identifier: GPL-2.0
+ */
+
+#ifndef USBPCAP_COMPACT_H
+#define USBPCAP_COMPACT_H
+
+#include "USBPcapMain.h"
+
+/*
+ * Compact buffer record format (USBPCAP_OPTION_COMPACT_RING)
+ *
+ * Instead of pcaprec_hdr_t and USBPCAP_BUFFER_PACKET_HEADER every record
+ * starts with variable length prefix:
+ *
+ *   UCHAR   flags       USBPCAP_COMPACT_FLAG_XXX
+ *   UCHAR   slot        endpoint context, only without FLAG_ENDPOINT
+ *   varint  device      only with FLAG_ENDPOINT
+ *   UCHAR   endpoint    only with FLAG_ENDPOINT
+ *   UCHAR   transfer    only with FLAG_TRANSFER
+ *   varint  function    only with FLAG_FUNCTION
+ *   varint  status      only with FLAG_STATUS
+ *   UCHAR   info        only with FLAG_INFO
+ *   varint  headerLen   only with FLAG_HEADERLEN
+ *   varint  bus         only with FLAG_BUS
+ *   UCHAR   irp slot    with FLAG_IRP
+ *   UINT64  irpId       without FLAG_IRP
+ *   varint  dataLength
+ *   varint  timestamp   zigzag encoded difference to previous record
+ *
+ * Fields not present are the same as in the previous record for the same
+ * endpoint context. Transfer specific header and payload follow as is,
+ * record length is the same as in pcap record without the first
+ * sizeof(USBPCAP_BUFFER_PACKET_HEADER) bytes. Varints are little endian
+ * base 128.
+ *
+ * Encoder and decoder keep identical state, so records must be decoded in
+ * the order they were written and nothing can be skipped.
+ */
+
+#define USBPCAP_COMPACT_FLAG_ENDPOINT   0x01
+#define USBPCAP_COMPACT_FLAG_IRP        0x02
+#define USBPCAP_COMPACT_FLAG_TRANSFER   0x04
+#define USBPCAP_COMPACT_FLAG_FUNCTION   0x08
+#define USBPCAP_COMPACT_FLAG_STATUS     0x10
+#define USBPCAP_COMPACT_FLAG_INFO       0x20
+#define USBPCAP_COMPACT_FLAG_HEADERLEN  0x40
+#define USBPCAP_COMPACT_FLAG_BUS        0x80
+
+#define USBPCAP_COMPACT_ENDPOINTS   64
+#define USBPCAP_COMPACT_IRPS        256
+
+/* Longest possible prefix */
+#define USBPCAP_COMPACT_MAX_PREFIX  48
+
+typedef struct _USBPCAP_COMPACT_ENDPOINT
+{
+    BOOLEAN  valid;
+    UCHAR    endpoint;
+    USHORT   device;
+    UCHAR    transfer;
+    UCHAR    info;
+    USHORT   function;
+    USHORT   headerLen;
+    USHORT   bus;
+    UINT32   status;
+} USBPCAP_COMPACT_ENDPOINT, *PUSBPCAP_COMPACT_ENDPOINT;
+
+typedef struct _USBPCAP_COMPACT_STATE
+{
+    LONGLONG                  timestamp;  /* Timestamp of previous record */
+    USBPCAP_COMPACT_ENDPOINT  endpoints[USBPCAP_COMPACT_ENDPOINTS];
+    UINT64                    irps[USBPCAP_COMPACT_IRPS];
+} USBPCAP_COMPACT_STATE, *PUSBPCAP_COMPACT_STATE;
+
+typedef struct _USBPCAP_COMPACT_RING
+{
+    USBPCAP_COMPACT_STATE  encoder;
+    USBPCAP_COMPACT_STATE  decoder;
+
+    /* Expanded data not yet returned to reader: pcap file header or
+     * pcap record header followed by USBPCAP_BUFFER_PACKET_HEADER.
+     */
+    UCHAR   pending[sizeof(pcaprec_hdr_t) + sizeof(USBPCAP_BUFFER_PACKET_HEADER)];
+    UINT32  pendingLength;
+    UINT32  pendingOffset;
+    /* Bytes of current record that are copied from buffer as is */
+    UINT32  rawRemaining;
+} USBPCAP_COMPACT_RING, *PUSBPCAP_COMPACT_RING;
+
+VOID USBPcapCompactReset(PUSBPCAP_COMPACT_RING pRing);
+
+/* Writes prefix for header to pOut (USBPCAP_COMPACT_MAX_PREFIX bytes)
+ * and returns its length. State is not modified, call
+ * USBPcapCompactCommit() once the record is stored.
+ */
+UINT32 USBPcapCompactEncode(PUSBPCAP_COMPACT_STATE pState,
+                            LARGE_INTEGER timestamp,
+                            PUSBPCAP_BUFFER_PACKET_HEADER header,
+                            PUCHAR pOut);
+VOID USBPcapCompactCommit(PUSBPCAP_COMPACT_STATE pState,
+                          LARGE_INTEGER timestamp,
+                          PUSBPCAP_BUFFER_PACKET_HEADER header);
+
+/* Decodes prefix from pIn and updates state. Returns number of bytes
+ * consumed or 0 if prefix is not valid.
+ */
+UINT32 USBPcapCompactDecode(PUSBPCAP_COMPACT_STATE pState,
+                            PUCHAR pIn,
+                            UINT32 length,
+                            PLARGE_INTEGER timestamp,
+                            PUSBPCAP_BUFFER_PACKET_HEADER header);
+
+#endif /* USBPCAP_COMPACT_H */
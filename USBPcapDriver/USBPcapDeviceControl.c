@@ -5,11 +5,12 @@
  */
 
 #include "USBPcapMain.h"
-#include "include\USBPcap.h"
+#include "include/USBPcap.h"
 #include "USBPcapURB.h"
 #include "USBPcapRootHubControl.h"
 #include "USBPcapBuffer.h"
 #include "USBPcapHelperFunctions.h"
+#include "USBPcapPending.h"
 
 static NTSTATUS
 HandleUSBPcapControlIOCTL(PIRP pIrp, PIO_STACK_LOCATION pStack,
@@ -51,6 +52,21 @@ HandleUSBPcapControlIOCTL(PIRP pIrp, PIO_STACK_LOCATION pStack,
         return ntStat;
     }
 
+    if (pStack->Parameters.DeviceIoControl.IoControlCode == IOCTL_USBPCAP_GET_TOPOLOGY_GENERATION)
+    {
+        DkDbgStr("IOCTL_USBPCAP_GET_TOPOLOGY_GENERATION");
+
+        if (pStack->Parameters.DeviceIoControl.OutputBufferLength < sizeof(UINT64))
+        {
+            return STATUS_BUFFER_TOO_SMALL;
+        }
+
+        *(UINT64 *)pIrp->AssociatedIrp.SystemBuffer = pRootData->generationBase +
+            (ULONG)InterlockedCompareExchange(&pRootData->topologyChanges, 0, 0);
+        *outLength = sizeof(UINT64);
+        return STATUS_SUCCESS;
+    }
+
     /* Other IOCTLs are allowed only for the capture handle (exclusive) */
     if (!allowCapture)
     {
@@ -91,6 +107,7 @@ HandleUSBPcapControlIOCTL(PIRP pIrp, PIO_STACK_LOCATION pStack,
             pAddressFilter = (PUSBPCAP_ADDRESS_FILTER)pIrp->AssociatedIrp.SystemBuffer;
             memcpy(&pRootData->filter, pAddressFilter,
                    sizeof(USBPCAP_ADDRESS_FILTER));
+            USBPcapPendingResetStatistics(pRootData);
 
             DkDbgStr("IOCTL_USBPCAP_START_FILTERING");
             DkDbgVal("", pAddressFilter->addresses[0]);
@@ -125,6 +142,39 @@ HandleUSBPcapControlIOCTL(PIRP pIrp, PIO_STACK_LOCATION pStack,
             break;
         }
 
+        case IOCTL_USBPCAP_SET_OPTIONS:
+        {
+            PUSBPCAP_IOCTL_OPTIONS  pOptions;
+
+            if (pStack->Parameters.DeviceIoControl.InputBufferLength !=
+                sizeof(USBPCAP_IOCTL_OPTIONS))
+            {
+                ntStat = STATUS_INVALID_PARAMETER;
+                break;
+            }
+
+            pOptions = (PUSBPCAP_IOCTL_OPTIONS)pIrp->AssociatedIrp.SystemBuffer;
+            DkDbgVal("IOCTL_USBPCAP_SET_OPTIONS", pOptions->options);
+
+            ntStat = USBPcapSetOptions(pRootData, pOptions->options);
+            break;
+        }
+
+        case IOCTL_USBPCAP_GET_PENDING_INFO:
+            DkDbgStr("IOCTL_USBPCAP_GET_PENDING_INFO");
+
+            if (pStack->Parameters.DeviceIoControl.OutputBufferLength <
+                sizeof(USBPCAP_IOCTL_PENDING_INFO))
+            {
+                ntStat = STATUS_BUFFER_TOO_SMALL;
+                break;
+            }
+
+            USBPcapPendingGetInfo(pRootData,
+                (PUSBPCAP_IOCTL_PENDING_INFO)pIrp->AssociatedIrp.SystemBuffer);
+            *outLength = sizeof(USBPCAP_IOCTL_PENDING_INFO);
+            break;
+
         default:
         {
             ULONG ctlCode = IoGetFunctionCodeFromCtlCode(pStack->Parameters.DeviceIoControl.IoControlCode);
@@ -285,6 +335,8 @@ NTSTATUS DkTgtInDevCtl(PDEVICE_EXTENSION pDevExt, PIO_STACK_LOCATION pStack, PIR
         {
             USBPcapAnalyzeURB(pIrp, pUrb, FALSE,
                               pDevExt->context.usb.pDeviceData);
+            USBPcapPendingInsert(pDevExt->context.usb.pDeviceData,
+                                 pIrp, pUrb);
         }
 
         // Forward this request to bus driver or next lower object
@@ -296,6 +348,21 @@ NTSTATUS DkTgtInDevCtl(PDEVICE_EXTENSION pDevExt, PIO_STACK_LOCATION pStack, PIR
 
         ntStat = IoCallDriver(pDevExt->pNextDevObj, pIrp);
     }
+    else if (USBPcapWriteIrpEvent(pDevExt->context.usb.pDeviceData,
+                                  pIrp, pStack, FALSE))
+    {
+        DkDbgVal("IOCTL_INTERNAL_USB_XXXX", ctlCode);
+
+        /* Idle notification, port reset, port status and other requests
+         * are recorded on completion as well
+         */
+        IoCopyCurrentIrpStackLocationToNext(pIrp);
+        IoSetCompletionRoutine(pIrp,
+            (PIO_COMPLETION_ROUTINE) DkTgtInDevCtlCompletion,
+            NULL, TRUE, TRUE, TRUE);
+
+        ntStat = IoCallDriver(pDevExt->pNextDevObj, pIrp);
+    }
     else
     {
         DkDbgVal("IOCTL_INTERNAL_USB_XXXX", ctlCode);
@@ -323,11 +390,20 @@ NTSTATUS DkTgtInDevCtlCompletion(PDEVICE_OBJECT pDevObj, PIRP pIrp, PVOID pCtx)
 
     pDevExt = (PDEVICE_EXTENSION) pDevObj->DeviceExtension;
 
-    // URB is collected AFTER forward to bus driver or next lower object
     pStack = IoGetCurrentIrpStackLocation(pIrp);
+    if (pStack->Parameters.DeviceIoControl.IoControlCode != IOCTL_INTERNAL_USB_SUBMIT_URB)
+    {
+        USBPcapWriteIrpEvent(pDevExt->context.usb.pDeviceData,
+                             pIrp, pStack, TRUE);
+        IoReleaseRemoveLock(&pDevExt->removeLock, (PVOID) pIrp);
+        return status;
+    }
+
+    // URB is collected AFTER forward to bus driver or next lower object
     pUrb = (PURB) pStack->Parameters.Others.Argument1;
     if (pUrb != NULL)
     {
+        USBPcapPendingRemove(pDevExt->context.usb.pDeviceData, pIrp);
         USBPcapAnalyzeURB(pIrp, pUrb, TRUE,
                           pDevExt->context.usb.pDeviceData);
     }
@@ -8,6 +8,7 @@
 #include "USBPcapHelperFunctions.h"
 #include "USBPcapTables.h"
 #include "USBPcapRootHubControl.h"
+#include "USBPcapPending.h"
 
 /*
  * Frees pDevExt.context.usb.pDeviceData
@@ -32,6 +33,8 @@ static void USBPcapFreeDeviceData(IN PDEVICE_EXTENSION pDevExt)
         {
             LONG count;
 
+            USBPcapPendingRemoveDevice(pDeviceData);
+
             count = InterlockedDecrement(&pDeviceData->pRootData->refCount);
             if (count == 0)
             {
@@ -39,10 +42,15 @@ static void USBPcapFreeDeviceData(IN PDEVICE_EXTENSION pDevExt)
                  * RootHub is supposed to hold the last reference.
                  * So if we enter here, this data can be safely removed.
                  */
+                USBPcapPendingFreeRoot(pDeviceData->pRootData);
                 if (pDeviceData->pRootData->buffer != NULL)
                 {
                     ExFreePool((PVOID)pDeviceData->pRootData->buffer);
                 }
+                if (pDeviceData->pRootData->compact != NULL)
+                {
+                    ExFreePool((PVOID)pDeviceData->pRootData->compact);
+                }
                 ExFreePool((PVOID)pDeviceData->pRootData);
                 pDeviceData->pRootData = NULL;
             }
@@ -54,12 +62,6 @@ static void USBPcapFreeDeviceData(IN PDEVICE_EXTENSION pDevExt)
             pDeviceData->endpointTable = NULL;
         }
 
-        if (pDeviceData->URBIrpTable != NULL)
-        {
-            USBPcapFreeURBIRPInfoTable(pDeviceData->URBIrpTable);
-            pDeviceData->URBIrpTable = NULL;
-        }
-
         if (pDeviceData->previousChildren != NULL)
         {
             ExFreePool((PVOID)pDeviceData->previousChildren);
@@ -81,7 +83,8 @@ static void USBPcapFreeDeviceData(IN PDEVICE_EXTENSION pDevExt)
  * Allocates USBPCAP_DEVICE_DATA.
  */
 static NTSTATUS USBPcapAllocateDeviceData(IN PDEVICE_EXTENSION pDevExt,
-                                          IN PDEVICE_EXTENSION pParentDevExt)
+                                          IN PDEVICE_EXTENSION pParentDevExt,
+                                          IN PDEVICE_OBJECT pdo)
 {
     PUSBPCAP_DEVICE_DATA  pDeviceData;
     NTSTATUS              status = STATUS_SUCCESS;
@@ -113,6 +116,7 @@ static NTSTATUS USBPcapAllocateDeviceData(IN PDEVICE_EXTENSION pDevExt,
         pDeviceData->isHub = allocRoothubData;
 
         pDeviceData->previousChildren = NULL;
+        pDeviceData->pdo = pdo;
 
         if (allocRoothubData == FALSE)
         {
@@ -143,6 +147,11 @@ static NTSTATUS USBPcapAllocateDeviceData(IN PDEVICE_EXTENSION pDevExt,
                 /* Initialize default snaplen size */
                 pDeviceData->pRootData->snaplen = USBPCAP_DEFAULT_SNAP_LEN;
 
+                /* No options enabled by default */
+                pDeviceData->pRootData->options = 0;
+                pDeviceData->pRootData->sequence = 0;
+                pDeviceData->pRootData->compact = NULL;
+
                 /* Setup initial filtering state to FALSE */
                 memset(&pDeviceData->pRootData->filter, 0,
                        sizeof(USBPCAP_ADDRESS_FILTER));
@@ -154,6 +163,15 @@ static NTSTATUS USBPcapAllocateDeviceData(IN PDEVICE_EXTENSION pDevExt,
                  * roothub filter object gets destroyed.
                  */
                 pDeviceData->pRootData->refCount = 1L;
+
+                /* Generation of new Root Hub must differ from any value
+                 * reported before it was (re)created, even across reboots.
+                 */
+                pDeviceData->pRootData->generationBase =
+                    (UINT64)USBPcapGetCurrentTimestamp().QuadPart;
+                pDeviceData->pRootData->topologyChanges = 0;
+
+                USBPcapPendingInitializeRoot(pDeviceData->pRootData);
             }
             else
             {
@@ -163,7 +181,11 @@ static NTSTATUS USBPcapAllocateDeviceData(IN PDEVICE_EXTENSION pDevExt,
 
         KeInitializeSpinLock(&pDeviceData->tablesSpinLock);
         pDeviceData->endpointTable = USBPcapInitializeEndpointTable(NULL);
-        pDeviceData->URBIrpTable = USBPcapInitializeURBIRPInfoTable(NULL);
+
+        if (pDeviceData->pRootData != NULL)
+        {
+            USBPcapPendingAddDevice(pDeviceData);
+        }
 
         pDeviceData->descriptor = NULL;
     }
@@ -241,7 +263,7 @@ NTSTATUS AddDevice(IN PDRIVER_OBJECT pDrvObj,
 
     IoInitializeRemoveLock(&pDevExt->removeLock, 0, 0, 0);
 
-    ntStat = USBPcapAllocateDeviceData(pDevExt, NULL);
+    ntStat = USBPcapAllocateDeviceData(pDevExt, NULL, pTgtDevObj);
     if (!NT_SUCCESS(ntStat))
     {
         goto EndFunc;
@@ -346,7 +368,7 @@ NTSTATUS DkCreateAndAttachTgt(PDEVICE_EXTENSION pParentDevExt, PDEVICE_OBJECT pT
     pDevExt->parentRemoveLock = &pParentDevExt->removeLock;
     pDevExt->pDrvObj = pParentDevExt->pDrvObj;
 
-    ntStat = USBPcapAllocateDeviceData(pDevExt, pParentDevExt);
+    ntStat = USBPcapAllocateDeviceData(pDevExt, pParentDevExt, pTgtDevObj);
     if (!NT_SUCCESS(ntStat))
     {
         goto EndAttDev;
@@ -373,6 +395,9 @@ NTSTATUS DkCreateAndAttachTgt(PDEVICE_EXTENSION pParentDevExt, PDEVICE_OBJECT pT
 
     IoAcquireRemoveLock(pDevExt->parentRemoveLock, NULL);
 
+    USBPcapWritePnPEvent(pDevExt->context.usb.pDeviceData,
+                         USBPCAP_PNP_EVENT_ARRIVAL, STATUS_SUCCESS);
+
 EndAttDev:
     if (!NT_SUCCESS(ntStat))
     {
@@ -138,6 +138,7 @@ NTSTATUS DkReadWrite(PDEVICE_OBJECT pDevObj, PIRP pIrp)
     }
     else if (pDevExt->deviceMagic == USBPCAP_MAGIC_CONTROL)
     {
+        /* Bytes read or written */
         UINT32 bytesRead = 0;
         /* Handling Read/Write for control object */
         switch (pStack->MajorFunction)
@@ -157,9 +158,19 @@ NTSTATUS DkReadWrite(PDEVICE_OBJECT pDevObj, PIRP pIrp)
             }
 
             case IRP_MJ_WRITE:
-                /* Writing to the control device is not supported */
-                ntStat = STATUS_NOT_SUPPORTED;
+            {
+                /* Data written to capture handle is stored as annotation */
+                if (pStack->FileObject == InterlockedCompareExchangePointer(&pDevExt->context.control.pCaptureObject, NULL, NULL))
+                {
+                    ntStat = USBPcapBufferHandleWriteIrp(pIrp, pDevExt,
+                                                         &bytesRead);
+                }
+                else
+                {
+                    ntStat = STATUS_ACCESS_DENIED;
+                }
                 break;
+            }
 
 
             default:
@@ -0,0 +1,310 @@
+/*
+ * Copyright (c) 2026 Tomasz Moń <desowin@gmail.com>
+ *
+ * SPDX-License-Identifier: GPL-2.0
+ */
+
+#include "USBPcapMain.h"
+#include "USBPcapLz.h"
+
+#define USBPCAP_LZ_MIN_MATCH     4
+#define USBPCAP_LZ_MAX_OFFSET    65535
+
+/* Literals are copied at end of block, matches never start there */
+#define USBPCAP_LZ_LAST_LITERALS 8
+
+/* base is reset before positions can overflow */
+#define USBPCAP_LZ_MAX_BASE      0x7FFFFFFF
+
+#define USBPCAP_LZ_TAG           (ULONG)'zLpU'
+
+typedef struct _USBPCAP_LZ_PROCESSORS
+{
+    ULONG                count;
+    /* Entry is only accessed by its processor at DISPATCH_LEVEL */
+    PUSBPCAP_LZ_CONTEXT  contexts[1];
+} USBPCAP_LZ_PROCESSORS, *PUSBPCAP_LZ_PROCESSORS;
+
+static PUSBPCAP_LZ_PROCESSORS volatile g_lzProcessors;
+
+__inline static UINT32
+USBPcapLzRead32(PUCHAR p)
+{
+    UINT32 value;
+
+    RtlCopyMemory(&value, p, sizeof(value));
+    return value;
+}
+
+__inline static UINT32
+USBPcapLzHash(UINT32 value)
+{
+    return (value * 2654435761U) >> (32 - USBPCAP_LZ_HASH_BITS);
+}
+
+static PUCHAR
+USBPcapLzPutLength(PUCHAR op, PUCHAR oend, UINT32 length)
+{
+    while (length >= 255)
+    {
+        if (op >= oend)
+        {
+            return NULL;
+        }
+        *op++ = 255;
+        length -= 255;
+    }
+
+    if (op >= oend)
+    {
+        return NULL;
+    }
+    *op++ = (UCHAR)length;
+    return op;
+}
+
+/* Writes token with literals and optional match (matchLength 0) */
+static PUCHAR
+USBPcapLzPutSequence(PUCHAR op, PUCHAR oend, PUCHAR literals,
+                     UINT32 literalLength, UINT32 offset, UINT32 matchLength)
+{
+    PUCHAR token;
+
+    if (op >= oend)
+    {
+        return NULL;
+    }
+
+    token = op++;
+    *token = (UCHAR)(min(literalLength, 15) << 4);
+    if (literalLength >= 15)
+    {
+        op = USBPcapLzPutLength(op, oend, literalLength - 15);
+        if (op == NULL)
+        {
+            return NULL;
+        }
+    }
+
+    if ((UINT32)(oend - op) < literalLength)
+    {
+        return NULL;
+    }
+    RtlCopyMemory(op, literals, literalLength);
+    op += literalLength;
+
+    if (matchLength > 0)
+    {
+        matchLength -= USBPCAP_LZ_MIN_MATCH;
+
+        if (oend - op < 2)
+        {
+            return NULL;
+        }
+        *op++ = (UCHAR)(offset & 0xFF);
+        *op++ = (UCHAR)(offset >> 8);
+
+        *token |= (UCHAR)min(matchLength, 15);
+        if (matchLength >= 15)
+        {
+            op = USBPcapLzPutLength(op, oend, matchLength - 15);
+        }
+    }
+
+    return op;
+}
+
+VOID USBPcapLzReset(PUSBPCAP_LZ_CONTEXT pContext)
+{
+    pContext->base = 0;
+    RtlZeroMemory(pContext->table, sizeof(pContext->table));
+}
+
+UINT32 USBPcapLzCompress(PUSBPCAP_LZ_CONTEXT pContext,
+                         PUCHAR src,
+                         UINT32 length,
+                         UINT32 capacity)
+{
+    PUINT32  table = pContext->table;
+    UINT32   base;
+    PUCHAR   op = pContext->output;
+    PUCHAR   oend;
+    UINT32   anchor = 0;
+    UINT32   ip = 0;
+    UINT32   limit;
+
+    ASSERT(length <= USBPCAP_LZ_MAX_PAYLOAD);
+
+    if (pContext->base > USBPCAP_LZ_MAX_BASE)
+    {
+        USBPcapLzReset(pContext);
+    }
+    base = pContext->base;
+    /* Entries stored now are below base of the next payload */
+    pContext->base += length;
+
+    oend = op + min(capacity, USBPCAP_LZ_MAX_PAYLOAD);
+
+    limit = (length > USBPCAP_LZ_LAST_LITERALS + USBPCAP_LZ_MIN_MATCH) ?
+            length - USBPCAP_LZ_LAST_LITERALS - USBPCAP_LZ_MIN_MATCH : 0;
+
+    while (ip < limit)
+    {
+        UINT32 sequence = USBPcapLzRead32(&src[ip]);
+        UINT32 hash = USBPcapLzHash(sequence);
+        UINT32 candidate = table[hash];
+
+        table[hash] = base + ip;
+
+        if ((candidate >= base) &&
+            ((candidate -= base) < ip) &&
+            (ip - candidate <= USBPCAP_LZ_MAX_OFFSET) &&
+            (USBPcapLzRead32(&src[candidate]) == sequence))
+        {
+            UINT32 matchLength = USBPCAP_LZ_MIN_MATCH;
+
+            while ((ip > anchor) && (candidate > 0) &&
+                   (src[ip - 1] == src[candidate - 1]))
+            {
+                ip--;
+                candidate--;
+                matchLength++;
+            }
+
+            while ((ip + matchLength < length - USBPCAP_LZ_LAST_LITERALS) &&
+                   (src[candidate + matchLength] == src[ip + matchLength]))
+            {
+                matchLength++;
+            }
+
+            op = USBPcapLzPutSequence(op, oend, &src[anchor], ip - anchor,
+                                      ip - candidate, matchLength);
+            if (op == NULL)
+            {
+                return 0;
+            }
+
+            ip += matchLength;
+            anchor = ip;
+
+            /* Make position just before match end findable, it often
+             * starts next repetition in structured data.
+             */
+            if (ip - 2 < limit)
+            {
+                table[USBPcapLzHash(USBPcapLzRead32(&src[ip - 2]))] = base + ip - 2;
+            }
+        }
+        else
+        {
+            /* Step faster over data that does not compress */
+            ip += 1 + ((ip - anchor) >> 6);
+        }
+    }
+
+    op = USBPcapLzPutSequence(op, oend, &src[anchor], length - anchor, 0, 0);
+    if (op == NULL)
+    {
+        return 0;
+    }
+
+    return (UINT32)(op - pContext->output);
+}
+
+NTSTATUS USBPcapLzInitialize(VOID)
+{
+    PUSBPCAP_LZ_PROCESSORS  pProcessors;
+    ULONG                   count;
+    SIZE_T                  size;
+
+    if (g_lzProcessors != NULL)
+    {
+        return STATUS_SUCCESS;
+    }
+
+#if (NTDDI_VERSION >= NTDDI_WIN7)
+    count = KeQueryMaximumProcessorCountEx(ALL_PROCESSOR_GROUPS);
+#else
+    count = (ULONG)KeNumberProcessors;
+#endif
+
+    size = FIELD_OFFSET(USBPCAP_LZ_PROCESSORS, contexts) +
+           count * sizeof(PUSBPCAP_LZ_CONTEXT);
+    pProcessors = ExAllocatePoolWithTag(NonPagedPool, size, USBPCAP_LZ_TAG);
+    if (pProcessors == NULL)
+    {
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+    RtlZeroMemory(pProcessors, size);
+    pProcessors->count = count;
+
+    if (InterlockedCompareExchangePointer((PVOID volatile *)&g_lzProcessors,
+                                          pProcessors, NULL) != NULL)
+    {
+        /* Other hub set it up meanwhile */
+        ExFreePool(pProcessors);
+    }
+
+    return STATUS_SUCCESS;
+}
+
+VOID USBPcapLzCleanup(VOID)
+{
+    PUSBPCAP_LZ_PROCESSORS  pProcessors = g_lzProcessors;
+    ULONG                   i;
+
+    if (pProcessors == NULL)
+    {
+        return;
+    }
+
+    for (i = 0; i < pProcessors->count; i++)
+    {
+        if (pProcessors->contexts[i] != NULL)
+        {
+            ExFreePool(pProcessors->contexts[i]);
+        }
+    }
+    ExFreePool(pProcessors);
+    g_lzProcessors = NULL;
+}
+
+PUSBPCAP_LZ_CONTEXT USBPcapLzGetProcessorContext(VOID)
+{
+    PUSBPCAP_LZ_PROCESSORS  pProcessors = g_lzProcessors;
+    PUSBPCAP_LZ_CONTEXT     pContext;
+    ULONG                   index;
+
+    ASSERT(KeGetCurrentIrql() == DISPATCH_LEVEL);
+
+    if (pProcessors == NULL)
+    {
+        return NULL;
+    }
+
+#if (NTDDI_VERSION >= NTDDI_WIN7)
+    index = KeGetCurrentProcessorNumberEx(NULL);
+#else
+    index = KeGetCurrentProcessorNumber();
+#endif
+    if (index >= pProcessors->count)
+    {
+        /* Processor added after initialization */
+        return NULL;
+    }
+
+    pContext = pProcessors->contexts[index];
+    if (pContext == NULL)
+    {
+        pContext = ExAllocatePoolWithTag(NonPagedPool,
+                                         sizeof(USBPCAP_LZ_CONTEXT),
+                                         USBPCAP_LZ_TAG);
+        if (pContext != NULL)
+        {
+            USBPcapLzReset(pContext);
+            pProcessors->contexts[index] = pContext;
+        }
+    }
+
+    return pContext;
+}
@@ -0,0 +1,75 @@
+/*
+ * Copyright (c) 2026 Tomasz Moń <desowin@gmail.com>
+ *
+ * SPDX-License-Identifier: GPL-2.0
+ */
+
+#ifndef USBPCAP_LZ_H
+#define USBPCAP_LZ_H
+
+#include "USBPcapMain.h"
+
+/*
+ * Payload compressor for USBPCAP_OPTION_COMPRESS_PAYLOAD.
+ *
+ * Output uses the same block format as USBPcapCMD lzblock.c, so it is
+ * decompressed there with lz_decompress(). Every token byte holds literal
+ * count in high nibble and match length minus 4 in low nibble, value 15
+ * in either nibble is extended by following bytes (255 means continue).
+ * Literals follow the literal count, 16-bit little endian match offset
+ * follows the literals. Last token contains only literals.
+ */
+
+/* Payloads shorter than this are never compressed */
+#define USBPCAP_LZ_MIN_PAYLOAD  256
+/* Payloads longer than this are never compressed */
+#define USBPCAP_LZ_MAX_PAYLOAD  65536
+
+#define USBPCAP_LZ_HASH_BITS    12
+
+typedef struct _USBPCAP_LZ_CONTEXT
+{
+    /* Hash table holds positions relative to base. Entries below base
+     * belong to earlier payloads, so table does not have to be cleared
+     * for every payload.
+     */
+    UINT32  base;
+    UINT32  table[1 << USBPCAP_LZ_HASH_BITS];
+
+    /* Payload gathered from multiple entries */
+    UCHAR   input[USBPCAP_LZ_MAX_PAYLOAD];
+    UCHAR   output[USBPCAP_LZ_MAX_PAYLOAD];
+} USBPCAP_LZ_CONTEXT, *PUSBPCAP_LZ_CONTEXT;
+
+VOID USBPcapLzReset(PUSBPCAP_LZ_CONTEXT pContext);
+
+/* Payloads are compressed before bufferLock is taken, so compression on
+ * one processor does not hold up completions on others. Every processor
+ * has its own context that nothing else can use while it runs at
+ * DISPATCH_LEVEL.
+ *
+ * USBPcapLzInitialize() must be called at PASSIVE_LEVEL before contexts
+ * are used. Contexts are kept until USBPcapLzCleanup() is called from
+ * DkUnload, so they are never freed while in use.
+ */
+NTSTATUS USBPcapLzInitialize(VOID);
+VOID USBPcapLzCleanup(VOID);
+
+/* Returns context of current processor, allocating it on first use, or
+ * NULL if there is none. Caller must run at DISPATCH_LEVEL until it is
+ * done with the context.
+ */
+PUSBPCAP_LZ_CONTEXT USBPcapLzGetProcessorContext(VOID);
+
+/* Compresses length bytes from src into pContext->output.
+ *
+ * Returns compressed length, or 0 if it does not fit into capacity bytes.
+ * Callers pass capacity smaller than length to skip payloads that are not
+ * worth compressing.
+ */
+UINT32 USBPcapLzCompress(PUSBPCAP_LZ_CONTEXT pContext,
+                         PUCHAR src,
+                         UINT32 length,
+                         UINT32 capacity);
+
+#endif /* USBPCAP_LZ_H */
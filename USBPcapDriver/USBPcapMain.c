@@ -5,6 +5,7 @@
  */
 
 #include "USBPcapMain.h"
+#include "USBPcapLz.h"
 
 /* Control device ID, used when creating roothub control devices
  *
@@ -56,6 +57,7 @@ NTSTATUS DriverEntry(PDRIVER_OBJECT pDrvObj, PUNICODE_STRING pUsRegPath)
 VOID DkUnload(PDRIVER_OBJECT pDrvObj)
 {
     DkDbgStr("2");
+    USBPcapLzCleanup();
 }
 
 VOID DkCompleteRequest(PIRP pIrp, NTSTATUS resStat, UINT_PTR uiInfo)
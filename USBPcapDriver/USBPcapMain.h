@@ -31,10 +31,32 @@
 #define DKPORT_MTAG         (ULONG)'dk3A' // To tag memory allocation if any
 
 #include "USBPcapQueue.h"
-#include "include\USBPcap.h"
+#include "include/USBPcap.h"
 
 #define USBPCAP_DEFAULT_SNAP_LEN  65535
 
+/* Maximum number of outstanding URBs tracked per device */
+#define USBPCAP_PENDING_SLOTS  64
+
+typedef struct _USBPCAP_PENDING_URB
+{
+    PIRP              irp;         /* NULL if slot is free */
+    ULONGLONG         submitTime;  /* Interrupt time in 100 ns units */
+    ULONG             reportAge;   /* Age in ms when next marker is due */
+    USBD_PIPE_HANDLE  pipe;        /* NULL for requests to default pipe */
+    ULONG             flags;       /* Transfer flags */
+    USHORT            function;    /* URB function on submission */
+} USBPCAP_PENDING_URB, *PUSBPCAP_PENDING_URB;
+
+typedef struct _USBPCAP_PENDING_TABLE
+{
+    KSPIN_LOCK           lock;
+    LIST_ENTRY           entry;  /* Entry in roothub devices list */
+    volatile LONG        count;  /* Number of used slots */
+    ULONG                hint;   /* Slot to start free slot search at */
+    USBPCAP_PENDING_URB  slots[USBPCAP_PENDING_SLOTS];
+} USBPCAP_PENDING_TABLE, *PUSBPCAP_PENDING_TABLE;
+
 typedef struct _USBPCAP_ROOTHUB_DATA
 {
     /* Circular-Buffer related variables */
@@ -47,6 +69,19 @@ typedef struct _USBPCAP_ROOTHUB_DATA
     /* Snapshot length */
     UINT32                 snaplen;
 
+    /* USBPCAP_OPTION_XXX, protected by bufferLock */
+    UINT32                 options;
+    /* Next packet sequence number, protected by bufferLock */
+    UINT64                 sequence;
+    /* Codec state if USBPCAP_OPTION_COMPACT_RING is enabled, NULL otherwise.
+     * Allocated together with buffer, protected by bufferLock.
+     */
+    struct _USBPCAP_COMPACT_RING *compact;
+    /* Bytes of record at readOffset that were not read yet. Used only
+     * with USBPCAP_OPTION_ALIGNED_RING, protected by bufferLock.
+     */
+    UINT32                 recordRemaining;
+
     /* Address filter. See include\USBPcap.h for more information. */
     USBPCAP_ADDRESS_FILTER filter;
 
@@ -55,10 +90,30 @@ typedef struct _USBPCAP_ROOTHUB_DATA
 
     USHORT                 busId; /* bus number */
     PDEVICE_OBJECT         controlDevice;
+
+    /* Outstanding URB tracking. See USBPcapPending.h */
+    KSPIN_LOCK             devicesLock;
+    LIST_ENTRY             devices;     /* USBPCAP_PENDING_TABLE entries */
+    volatile LONG          outstanding;
+    volatile LONG          untracked;
+    volatile LONG          slowestCompletion;
+    KTIMER                 pendingTimer;
+    KDPC                   pendingDpc;
+
+    /* Topology generation, see IOCTL_USBPCAP_GET_TOPOLOGY_GENERATION.
+     * Changes is to be used only with InterlockedXXX calls.
+     */
+    UINT64                 generationBase;
+    volatile LONG          topologyChanges;
 } USBPCAP_ROOTHUB_DATA, *PUSBPCAP_ROOTHUB_DATA;
 
 typedef struct _DEVICE_DATA
 {
+    /* Physical device object the filter is attached to. Identifies the
+     * device in PnP event packets, from arrival until removal.
+     */
+    PDEVICE_OBJECT         pdo;
+
     /* pParentFlt and pNextParentFlt are NULL for RootHub */
     PDEVICE_OBJECT         pParentFlt;     /* Parent filter object */
     PDEVICE_OBJECT         pNextParentFlt; /* Lower object of Parent filter */
@@ -77,7 +132,8 @@ typedef struct _DEVICE_DATA
 
     KSPIN_LOCK             tablesSpinLock;
     PRTL_GENERIC_TABLE     endpointTable;
-    PRTL_GENERIC_TABLE     URBIrpTable;
+
+    USBPCAP_PENDING_TABLE  pending;
 
     PUSBPCAP_ROOTHUB_DATA  pRootData;
 
@@ -227,6 +283,25 @@ NTSTATUS DkCreateAndAttachTgt(PDEVICE_EXTENSION pDevExt, PDEVICE_OBJECT pTgtDevO
 VOID DkDetachAndDeleteTgt(PDEVICE_EXTENSION pDevExt);
 
 
+///////////////////////////////////////////////////////////////////////////
+// Write device PnP event packet (USBPCAP_INFO_PNP) to capture buffer
+//
+VOID USBPcapWritePnPEvent(PUSBPCAP_DEVICE_DATA pDeviceData,
+                          USHORT event,
+                          NTSTATUS status);
+
+
+///////////////////////////////////////////////////////////////////////////
+// Write power or internal IOCTL IRP packet (USBPCAP_INFO_IRP) to capture
+// buffer. pStack must be the filter stack location. Returns FALSE if the
+// device is not being captured.
+//
+BOOLEAN USBPcapWriteIrpEvent(PUSBPCAP_DEVICE_DATA pDeviceData,
+                             PIRP pIrp,
+                             PIO_STACK_LOCATION pStack,
+                             BOOLEAN post);
+
+
 ///////////////////////////////////////////////////////////////////////////
 // Get USB Hub device name
 //
@@ -0,0 +1,405 @@
+/*
+ * Copyright (c) 2026 Tomasz Moń <desowin@gmail.com>
+ *
+ * SPDX-License-Identifier: GPL-2.0
+ */
+
+#include "USBPcapMain.h"
+#include "USBPcapPending.h"
+#include "USBPcapTables.h"
+#include "USBPcapBuffer.h"
+#include "USBPcapHelperFunctions.h"
+
+/* Maximum number of markers written for single device in one scan.
+ * Remaining ones are written on next scan.
+ */
+#define USBPCAP_PENDING_MARKERS  8
+
+typedef struct _USBPCAP_PENDING_MARKER
+{
+    PIRP              irp;
+    ULONG             age;  /* milliseconds */
+    USBD_PIPE_HANDLE  pipe;
+    ULONG             flags;
+    USHORT            function;
+} USBPCAP_PENDING_MARKER, *PUSBPCAP_PENDING_MARKER;
+
+static ULONG USBPcapPendingAge(ULONGLONG now, ULONGLONG submitTime)
+{
+    ULONGLONG age;
+
+    if (now < submitTime)
+    {
+        /* URB was submitted after the scan has started */
+        return 0;
+    }
+
+    age = (now - submitTime) / 10000;
+
+    return (age > MAXLONG) ? MAXLONG : (ULONG)age;
+}
+
+static UCHAR USBPcapPendingEndpoint(PUSBPCAP_DEVICE_DATA pDeviceData,
+                                    USBD_PIPE_HANDLE pipe,
+                                    ULONG flags)
+{
+    USBPCAP_ENDPOINT_INFO  info;
+    UCHAR                  endpoint = 0;
+
+    if ((pipe != NULL) &&
+        (USBPcapRetrieveEndpointInfo(pDeviceData, pipe, &info) == TRUE))
+    {
+        endpoint = info.endpointAddress;
+    }
+
+    if (flags & USBD_TRANSFER_DIRECTION_IN)
+    {
+        endpoint |= 0x80;
+    }
+
+    return endpoint;
+}
+
+static VOID USBPcapPendingWriteMarker(PUSBPCAP_DEVICE_DATA pDeviceData,
+                                      PUSBPCAP_PENDING_MARKER marker)
+{
+    USBPCAP_BUFFER_PACKET_HEADER  header;
+    UINT32                        age;
+
+    DkDbgVal("URB still pending", marker->irp);
+
+    age = (UINT32)marker->age;
+
+    header.headerLen  = sizeof(USBPCAP_BUFFER_PACKET_HEADER);
+    header.irpId      = (UINT64) marker->irp;
+    header.status     = USBD_STATUS_PENDING;
+    header.function   = marker->function;
+    header.info       = USBPCAP_INFO_PENDING;
+    header.bus        = pDeviceData->pRootData->busId;
+    header.device     = pDeviceData->deviceAddress;
+    header.endpoint   = USBPcapPendingEndpoint(pDeviceData,
+                                               marker->pipe,
+                                               marker->flags);
+    header.transfer   = USBPCAP_TRANSFER_IRP_INFO;
+    header.dataLength = sizeof(age);
+
+    USBPcapBufferWritePacket(pDeviceData->pRootData, &header, &age);
+}
+
+/*
+ * Walks all tracked URBs on the roothub.
+ *
+ * If report is TRUE, writes markers for URBs that are due.
+ * If pInfo is not NULL, fills in outstanding URB information.
+ */
+static VOID USBPcapPendingScan(PUSBPCAP_ROOTHUB_DATA pRootData,
+                               BOOLEAN report,
+                               PUSBPCAP_IOCTL_PENDING_INFO pInfo)
+{
+    ULONGLONG               now;
+    KIRQL                   irql;
+    PLIST_ENTRY             entry;
+    ULONG                   outstanding = 0;
+    PUSBPCAP_DEVICE_DATA    oldestDevice = NULL;
+    USBPCAP_PENDING_URB     oldest;
+
+    now = KeQueryInterruptTime();
+
+    KeAcquireSpinLock(&pRootData->devicesLock, &irql);
+    for (entry = pRootData->devices.Flink;
+         entry != &pRootData->devices;
+         entry = entry->Flink)
+    {
+        PUSBPCAP_DEVICE_DATA    pDeviceData;
+        PUSBPCAP_PENDING_TABLE  table;
+        USBPCAP_PENDING_MARKER  markers[USBPCAP_PENDING_MARKERS];
+        ULONG                   count = 0;
+        ULONG                   i;
+
+        pDeviceData = CONTAINING_RECORD(entry, USBPCAP_DEVICE_DATA, pending.entry);
+        table = &pDeviceData->pending;
+
+        if (table->count == 0)
+        {
+            continue;
+        }
+
+        KeAcquireSpinLockAtDpcLevel(&table->lock);
+        for (i = 0; i < USBPCAP_PENDING_SLOTS; i++)
+        {
+            PUSBPCAP_PENDING_URB  slot = &table->slots[i];
+            ULONG                 age;
+
+            if (slot->irp == NULL)
+            {
+                continue;
+            }
+
+            outstanding++;
+            if ((oldestDevice == NULL) || (slot->submitTime < oldest.submitTime))
+            {
+                oldestDevice = pDeviceData;
+                oldest = *slot;
+            }
+
+            age = USBPcapPendingAge(now, slot->submitTime);
+            if ((report == TRUE) && (age >= slot->reportAge) &&
+                (count < USBPCAP_PENDING_MARKERS))
+            {
+                markers[count].irp = slot->irp;
+                markers[count].age = age;
+                markers[count].pipe = slot->pipe;
+                markers[count].flags = slot->flags;
+                markers[count].function = slot->function;
+                count++;
+
+                slot->reportAge = (age > MAXLONG / 2) ? MAXLONG : age * 2;
+            }
+        }
+        KeReleaseSpinLockFromDpcLevel(&table->lock);
+
+        if ((count > 0) &&
+            USBPcapIsDeviceFiltered(&pRootData->filter,
+                                    (int)pDeviceData->deviceAddress))
+        {
+            for (i = 0; i < count; i++)
+            {
+                USBPcapPendingWriteMarker(pDeviceData, &markers[i]);
+            }
+        }
+    }
+
+    if (pInfo != NULL)
+    {
+        RtlZeroMemory(pInfo, sizeof(USBPCAP_IOCTL_PENDING_INFO));
+        pInfo->outstanding = outstanding;
+        pInfo->untracked = (UINT32)pRootData->untracked;
+        pInfo->slowestCompletion = (UINT32)pRootData->slowestCompletion;
+        if (oldestDevice != NULL)
+        {
+            pInfo->oldestAge = USBPcapPendingAge(now, oldest.submitTime);
+            pInfo->oldestIrpId = (UINT64) oldest.irp;
+            pInfo->oldestFunction = oldest.function;
+            pInfo->oldestDevice = oldestDevice->deviceAddress;
+            /* Device cannot be removed while devicesLock is held */
+            pInfo->oldestEndpoint = USBPcapPendingEndpoint(oldestDevice,
+                                                           oldest.pipe,
+                                                           oldest.flags);
+        }
+    }
+    KeReleaseSpinLock(&pRootData->devicesLock, irql);
+}
+
+KDEFERRED_ROUTINE USBPcapPendingDpc;
+VOID USBPcapPendingDpc(PKDPC Dpc, PVOID DeferredContext,
+                       PVOID SystemArgument1, PVOID SystemArgument2)
+{
+    PUSBPCAP_ROOTHUB_DATA pRootData = (PUSBPCAP_ROOTHUB_DATA)DeferredContext;
+
+    UNREFERENCED_PARAMETER(Dpc);
+    UNREFERENCED_PARAMETER(SystemArgument1);
+    UNREFERENCED_PARAMETER(SystemArgument2);
+
+    /* Nothing to do unless there is something tracked */
+    if (pRootData->outstanding == 0)
+    {
+        return;
+    }
+
+    USBPcapPendingScan(pRootData, TRUE, NULL);
+}
+
+VOID USBPcapPendingInitializeRoot(PUSBPCAP_ROOTHUB_DATA pRootData)
+{
+    LARGE_INTEGER dueTime;
+
+    KeInitializeSpinLock(&pRootData->devicesLock);
+    InitializeListHead(&pRootData->devices);
+    pRootData->outstanding = 0;
+    pRootData->untracked = 0;
+    pRootData->slowestCompletion = 0;
+
+    KeInitializeTimer(&pRootData->pendingTimer);
+    KeInitializeDpc(&pRootData->pendingDpc, USBPcapPendingDpc, pRootData);
+
+    /* Relative time in 100 ns units */
+    dueTime.QuadPart = -10000LL * USBPCAP_PENDING_SCAN_MS;
+    KeSetTimerEx(&pRootData->pendingTimer, dueTime,
+                 USBPCAP_PENDING_SCAN_MS, &pRootData->pendingDpc);
+}
+
+VOID USBPcapPendingFreeRoot(PUSBPCAP_ROOTHUB_DATA pRootData)
+{
+    KeCancelTimer(&pRootData->pendingTimer);
+    /* Wait for DPC that might be already running */
+    KeFlushQueuedDpcs();
+}
+
+VOID USBPcapPendingAddDevice(PUSBPCAP_DEVICE_DATA pDeviceData)
+{
+    PUSBPCAP_PENDING_TABLE  table = &pDeviceData->pending;
+    KIRQL                   irql;
+
+    KeInitializeSpinLock(&table->lock);
+    table->count = 0;
+    table->hint = 0;
+    RtlZeroMemory(table->slots, sizeof(table->slots));
+
+    KeAcquireSpinLock(&pDeviceData->pRootData->devicesLock, &irql);
+    InsertTailList(&pDeviceData->pRootData->devices, &table->entry);
+    KeReleaseSpinLock(&pDeviceData->pRootData->devicesLock, irql);
+}
+
+VOID USBPcapPendingRemoveDevice(PUSBPCAP_DEVICE_DATA pDeviceData)
+{
+    KIRQL irql;
+
+    KeAcquireSpinLock(&pDeviceData->pRootData->devicesLock, &irql);
+    RemoveEntryList(&pDeviceData->pending.entry);
+    KeReleaseSpinLock(&pDeviceData->pRootData->devicesLock, irql);
+
+    if (pDeviceData->pending.count != 0)
+    {
+        /* Remove lock makes sure all IRPs completed */
+        DkDbgVal("Device removed with tracked URBs", pDeviceData->pending.count);
+        InterlockedExchangeAdd(&pDeviceData->pRootData->outstanding,
+                               -pDeviceData->pending.count);
+    }
+}
+
+VOID USBPcapPendingInsert(PUSBPCAP_DEVICE_DATA pDeviceData,
+                          PIRP pIrp,
+                          PURB pUrb)
+{
+    PUSBPCAP_PENDING_TABLE  table = &pDeviceData->pending;
+    USBD_PIPE_HANDLE        pipe = NULL;
+    ULONG                   flags = 0;
+    ULONGLONG               now;
+    KIRQL                   irql;
+    ULONG                   i;
+    BOOLEAN                 inserted = FALSE;
+
+    if (USBPcapIsDeviceFiltered(&pDeviceData->pRootData->filter,
+                                (int)pDeviceData->deviceAddress) == FALSE)
+    {
+        /* Track only URBs that are being captured */
+        return;
+    }
+
+    switch (pUrb->UrbHeader.Function)
+    {
+        case URB_FUNCTION_CONTROL_TRANSFER:
+        case URB_FUNCTION_BULK_OR_INTERRUPT_TRANSFER:
+        case URB_FUNCTION_ISOCH_TRANSFER:
+#if (_WIN32_WINNT >= 0x0600)
+        case URB_FUNCTION_CONTROL_TRANSFER_EX:
+#endif
+#if (_WIN32_WINNT >= 0x0602)
+        case URB_FUNCTION_BULK_OR_INTERRUPT_TRANSFER_USING_CHAINED_MDL:
+        case URB_FUNCTION_ISOCH_TRANSFER_USING_CHAINED_MDL:
+#endif
+            /* All transfer URBs start with pipe handle and transfer flags */
+            pipe = pUrb->UrbBulkOrInterruptTransfer.PipeHandle;
+            flags = pUrb->UrbBulkOrInterruptTransfer.TransferFlags;
+            break;
+
+        default:
+            break;
+    }
+
+    now = KeQueryInterruptTime();
+
+    KeAcquireSpinLock(&table->lock, &irql);
+    for (i = 0; i < USBPCAP_PENDING_SLOTS; i++)
+    {
+        ULONG                 index = (table->hint + i) % USBPCAP_PENDING_SLOTS;
+        PUSBPCAP_PENDING_URB  slot = &table->slots[index];
+
+        if (slot->irp == NULL)
+        {
+            slot->irp = pIrp;
+            slot->submitTime = now;
+            slot->reportAge = USBPCAP_PENDING_THRESHOLD_MS;
+            slot->pipe = pipe;
+            slot->flags = flags;
+            slot->function = pUrb->UrbHeader.Function;
+
+            table->hint = (index + 1) % USBPCAP_PENDING_SLOTS;
+            table->count++;
+            inserted = TRUE;
+            break;
+        }
+    }
+    KeReleaseSpinLock(&table->lock, irql);
+
+    if (inserted == TRUE)
+    {
+        InterlockedIncrement(&pDeviceData->pRootData->outstanding);
+    }
+    else
+    {
+        InterlockedIncrement(&pDeviceData->pRootData->untracked);
+    }
+}
+
+VOID USBPcapPendingRemove(PUSBPCAP_DEVICE_DATA pDeviceData,
+                          PIRP pIrp)
+{
+    PUSBPCAP_PENDING_TABLE  table = &pDeviceData->pending;
+    KIRQL                   irql;
+    ULONG                   i;
+    ULONG                   age = 0;
+    BOOLEAN                 found = FALSE;
+
+    if (table->count == 0)
+    {
+        /* Nothing tracked, avoid taking the lock */
+        return;
+    }
+
+    KeAcquireSpinLock(&table->lock, &irql);
+    for (i = 0; i < USBPCAP_PENDING_SLOTS; i++)
+    {
+        PUSBPCAP_PENDING_URB  slot = &table->slots[i];
+
+        if (slot->irp == pIrp)
+        {
+            age = USBPcapPendingAge(KeQueryInterruptTime(), slot->submitTime);
+            slot->irp = NULL;
+            table->count--;
+            table->hint = i;
+            found = TRUE;
+            break;
+        }
+    }
+    KeReleaseSpinLock(&table->lock, irql);
+
+    if (found == TRUE)
+    {
+        LONG slowest;
+
+        InterlockedDecrement(&pDeviceData->pRootData->outstanding);
+
+        do
+        {
+            slowest = pDeviceData->pRootData->slowestCompletion;
+            if ((LONG)age <= slowest)
+            {
+                break;
+            }
+        } while (InterlockedCompareExchange(&pDeviceData->pRootData->slowestCompletion,
+                                            (LONG)age, slowest) != slowest);
+    }
+}
+
+VOID USBPcapPendingGetInfo(PUSBPCAP_ROOTHUB_DATA pRootData,
+                           PUSBPCAP_IOCTL_PENDING_INFO pInfo)
+{
+    USBPcapPendingScan(pRootData, FALSE, pInfo);
+}
+
+VOID USBPcapPendingResetStatistics(PUSBPCAP_ROOTHUB_DATA pRootData)
+{
+    InterlockedExchange(&pRootData->untracked, 0);
+    InterlockedExchange(&pRootData->slowestCompletion, 0);
+}
@@ -0,0 +1,42 @@
+/*
+ * Copyright (c) 2026 Tomasz Moń <desowin@gmail.com>
+ *
+ * SPDX-License-Identifier: GPL-2.0
+ */
+
+#ifndef USBPCAP_PENDING_H
+#define USBPCAP_PENDING_H
+
+#include "USBPcapMain.h"
+
+/*
+ * Outstanding URB tracker
+ *
+ * URBs submitted by filtered devices are kept in per-device fixed size
+ * table until they complete. Roothub timer periodically scans the tables
+ * and writes USBPCAP_INFO_PENDING marker packet for every URB that is
+ * pending for longer than USBPCAP_PENDING_THRESHOLD_MS. Marker is written
+ * again every time the URB age doubles.
+ */
+
+#define USBPCAP_PENDING_THRESHOLD_MS  1000
+#define USBPCAP_PENDING_SCAN_MS       250
+
+VOID USBPcapPendingInitializeRoot(PUSBPCAP_ROOTHUB_DATA pRootData);
+/* Must be called at PASSIVE_LEVEL */
+VOID USBPcapPendingFreeRoot(PUSBPCAP_ROOTHUB_DATA pRootData);
+
+VOID USBPcapPendingAddDevice(PUSBPCAP_DEVICE_DATA pDeviceData);
+VOID USBPcapPendingRemoveDevice(PUSBPCAP_DEVICE_DATA pDeviceData);
+
+VOID USBPcapPendingInsert(PUSBPCAP_DEVICE_DATA pDeviceData,
+                          PIRP pIrp,
+                          PURB pUrb);
+VOID USBPcapPendingRemove(PUSBPCAP_DEVICE_DATA pDeviceData,
+                          PIRP pIrp);
+
+VOID USBPcapPendingGetInfo(PUSBPCAP_ROOTHUB_DATA pRootData,
+                           PUSBPCAP_IOCTL_PENDING_INFO pInfo);
+VOID USBPcapPendingResetStatistics(PUSBPCAP_ROOTHUB_DATA pRootData);
+
+#endif /* USBPCAP_PENDING_H */
@@ -7,6 +7,59 @@
 #include "USBPcapMain.h"
 #include "USBPcapHelperFunctions.h"
 #include "USBPcapRootHubControl.h"
+#include "USBPcapBuffer.h"
+
+VOID USBPcapWritePnPEvent(PUSBPCAP_DEVICE_DATA pDeviceData,
+                          USHORT event,
+                          NTSTATUS status)
+{
+    USBPCAP_BUFFER_PACKET_HEADER  header;
+    USBPCAP_PNP_EVENT             payload;
+    PDEVICE_EXTENSION             pParentExt;
+
+    if ((pDeviceData == NULL) || (pDeviceData->pRootData == NULL))
+    {
+        return;
+    }
+
+    /* Every PnP event changes topology, whether it is captured or not */
+    InterlockedIncrement(&pDeviceData->pRootData->topologyChanges);
+
+    if (!USBPcapIsDeviceFiltered(&pDeviceData->pRootData->filter,
+                                 (int)pDeviceData->deviceAddress))
+    {
+        return;
+    }
+
+    payload.event = event;
+    payload.status = (UINT32)status;
+    payload.port = (USHORT)pDeviceData->parentPort;
+    payload.parentDevice = 0;
+    payload.isHub = (pDeviceData->isHub == TRUE) ? 1 : 0;
+
+    if (pDeviceData->pParentFlt != NULL)
+    {
+        pParentExt = (PDEVICE_EXTENSION)pDeviceData->pParentFlt->DeviceExtension;
+        if ((pParentExt->deviceMagic == USBPCAP_MAGIC_DEVICE) &&
+            (pParentExt->context.usb.pDeviceData != NULL))
+        {
+            payload.parentDevice = pParentExt->context.usb.pDeviceData->deviceAddress;
+        }
+    }
+
+    header.headerLen  = sizeof(USBPCAP_BUFFER_PACKET_HEADER);
+    header.irpId      = (UINT64) pDeviceData->pdo;
+    header.status     = USBD_STATUS_SUCCESS;
+    header.function   = USBPCAP_FUNCTION_EVENT;
+    header.info       = USBPCAP_INFO_PNP;
+    header.bus        = pDeviceData->pRootData->busId;
+    header.device     = pDeviceData->deviceAddress;
+    header.endpoint   = 0;
+    header.transfer   = USBPCAP_TRANSFER_IRP_INFO;
+    header.dataLength = sizeof(USBPCAP_PNP_EVENT);
+
+    USBPcapBufferWritePacket(pDeviceData->pRootData, &header, &payload);
+}
 
 NTSTATUS DkPnP(PDEVICE_OBJECT pDevObj, PIRP pIrp)
 {
@@ -152,9 +205,13 @@ NTSTATUS DkTgtPnP(PDEVICE_EXTENSION pDevExt, PIO_STACK_LOCATION pStack, PIRP pIr
             ntStat = DkForwardAndWait(pDevExt->pNextDevObj, pIrp);
             IoCompleteRequest(pIrp, IO_NO_INCREMENT);
 
+            USBPcapWritePnPEvent(pDeviceData, USBPCAP_PNP_EVENT_START, ntStat);
+
             if (NT_SUCCESS(USBPcapGetDeviceUSBInfo(pDevExt)))
             {
                 DkDbgVal("Started device", pDeviceData->deviceAddress);
+                USBPcapWritePnPEvent(pDeviceData, USBPCAP_PNP_EVENT_ADDRESS,
+                                     STATUS_SUCCESS);
             }
             else
             {
@@ -180,9 +237,18 @@ NTSTATUS DkTgtPnP(PDEVICE_EXTENSION pDevExt, PIO_STACK_LOCATION pStack, PIRP pIr
                 break;
             }
 
+        case IRP_MN_SURPRISE_REMOVAL:
+            DkDbgStr("IRP_MN_SURPRISE_REMOVAL");
+            USBPcapWritePnPEvent(pDeviceData, USBPCAP_PNP_EVENT_SURPRISE_REMOVAL,
+                                 STATUS_SUCCESS);
+            break;
+
         case IRP_MN_REMOVE_DEVICE:
             DkDbgStr("IRP_MN_REMOVE_DEVICE");
 
+            USBPcapWritePnPEvent(pDeviceData, USBPCAP_PNP_EVENT_REMOVE,
+                                 STATUS_SUCCESS);
+
             IoSkipCurrentIrpStackLocation(pIrp);
             ntStat = IoCallDriver(pDevExt->pNextDevObj, pIrp);
 
@@ -238,6 +304,14 @@ NTSTATUS DkHubFltPnpHandleQryDevRels(PDEVICE_EXTENSION pDevExt, PIO_STACK_LOCATI
 
             ntStat = DkForwardAndWait(pDevExt->pNextDevObj, pIrp);
 
+            /* Hub reports relations after any port status change, including
+             * devices that failed enumeration and have no PnP events.
+             */
+            if ((pDeviceData != NULL) && (pDeviceData->pRootData != NULL))
+            {
+                InterlockedIncrement(&pDeviceData->pRootData->topologyChanges);
+            }
+
             // After we forward the request, the bus driver have created or deleted
             // a child device object. When bus driver created one (or more), this is the PDO
             // of our target device, we create and attach a filter object to it.
@@ -5,6 +5,115 @@
  */
 
 #include "USBPcapMain.h"
+#include "USBPcapBuffer.h"
+#include "USBPcapHelperFunctions.h"
+
+BOOLEAN USBPcapWriteIrpEvent(PUSBPCAP_DEVICE_DATA pDeviceData,
+                             PIRP pIrp,
+                             PIO_STACK_LOCATION pStack,
+                             BOOLEAN post)
+{
+    USBPCAP_BUFFER_PACKET_HEADER  header;
+    USBPCAP_IRP_EVENT             payload;
+
+    if ((pDeviceData == NULL) || (pDeviceData->pRootData == NULL))
+    {
+        return FALSE;
+    }
+
+    if (!USBPcapIsDeviceFiltered(&pDeviceData->pRootData->filter,
+                                 (int)pDeviceData->deviceAddress))
+    {
+        return FALSE;
+    }
+
+    RtlZeroMemory(&payload, sizeof(USBPCAP_IRP_EVENT));
+    payload.majorFunction = pStack->MajorFunction;
+    payload.minorFunction = pStack->MinorFunction;
+    if (post == TRUE)
+    {
+        payload.status = (UINT32)pIrp->IoStatus.Status;
+    }
+
+    header.headerLen  = sizeof(USBPCAP_BUFFER_PACKET_HEADER);
+    header.irpId      = (UINT64) pIrp;
+    header.status     = USBD_STATUS_SUCCESS;
+    header.function   = USBPCAP_FUNCTION_EVENT;
+    header.info       = USBPCAP_INFO_IRP;
+    if (post == TRUE)
+    {
+        header.info |= USBPCAP_INFO_PDO_TO_FDO;
+    }
+    header.bus        = pDeviceData->pRootData->busId;
+    header.device     = pDeviceData->deviceAddress;
+    header.endpoint   = 0;
+    header.transfer   = USBPCAP_TRANSFER_IRP_INFO;
+    header.dataLength = sizeof(USBPCAP_IRP_EVENT);
+
+    if (pStack->MajorFunction == IRP_MJ_POWER)
+    {
+        switch (pStack->MinorFunction)
+        {
+            case IRP_MN_QUERY_POWER:
+            case IRP_MN_SET_POWER:
+                payload.powerType = pStack->Parameters.Power.Type;
+                if (pStack->Parameters.Power.Type == SystemPowerState)
+                {
+                    payload.powerState = pStack->Parameters.Power.State.SystemState;
+                }
+                else
+                {
+                    payload.powerState = pStack->Parameters.Power.State.DeviceState;
+                }
+                break;
+
+            case IRP_MN_WAIT_WAKE:
+                payload.powerType = SystemPowerState;
+                payload.powerState = pStack->Parameters.WaitWake.PowerState;
+                break;
+
+            default:
+                break;
+        }
+    }
+    else
+    {
+        ULONG ctlCode = pStack->Parameters.DeviceIoControl.IoControlCode;
+
+        payload.ioControlCode = ctlCode;
+
+        if ((post == TRUE) &&
+            (ctlCode == IOCTL_INTERNAL_USB_GET_PORT_STATUS) &&
+            NT_SUCCESS(pIrp->IoStatus.Status) &&
+            (pStack->Parameters.Others.Argument1 != NULL))
+        {
+            payload.portStatus = *((PULONG)pStack->Parameters.Others.Argument1);
+        }
+    }
+
+    USBPcapBufferWritePacket(pDeviceData->pRootData, &header, &payload);
+    return TRUE;
+}
+
+static IO_COMPLETION_ROUTINE DkPowerCompletion;
+static NTSTATUS DkPowerCompletion(PDEVICE_OBJECT pDevObj, PIRP pIrp, PVOID pCtx)
+{
+    PDEVICE_EXTENSION   pDevExt;
+
+    UNREFERENCED_PARAMETER(pCtx);
+
+    if (pIrp->PendingReturned)
+        IoMarkIrpPending(pIrp);
+
+    pDevExt = (PDEVICE_EXTENSION) pDevObj->DeviceExtension;
+
+    USBPcapWriteIrpEvent(pDevExt->context.usb.pDeviceData, pIrp,
+                         IoGetCurrentIrpStackLocation(pIrp), TRUE);
+
+    IoReleaseRemoveLock(&pDevExt->removeLock, (PVOID) pIrp);
+
+    return STATUS_CONTINUE_COMPLETION;
+}
 
 NTSTATUS DkPower(PDEVICE_OBJECT pDevObj, PIRP pIrp)
 {
@@ -74,6 +183,23 @@ NTSTATUS DkPower(PDEVICE_OBJECT pDevObj, PIRP pIrp)
     PoStartNextPowerIrp(pIrp);
 #endif
 
+    if ((pDevExt->deviceMagic == USBPCAP_MAGIC_DEVICE) &&
+        USBPcapWriteIrpEvent(pDevExt->context.usb.pDeviceData,
+                             pIrp, pStack, FALSE))
+    {
+        /* Remove lock is released in completion routine */
+        IoCopyCurrentIrpStackLocationToNext(pIrp);
+        IoSetCompletionRoutine(pIrp,
+            (PIO_COMPLETION_ROUTINE) DkPowerCompletion,
+            NULL, TRUE, TRUE, TRUE);
+
+#if (NTDDI_VERSION < NTDDI_VISTA)
+        return PoCallDriver(pNextDevObj, pIrp);
+#else
+        return IoCallDriver(pNextDevObj, pIrp);
+#endif
+    }
+
     IoSkipCurrentIrpStackLocation(pIrp);
 
 #if (NTDDI_VERSION < NTDDI_VISTA)
@@ -74,6 +74,101 @@ static PVOID USBPcapURBGetBufferPointer(ULONG length,
     }
 }
 
+/*
+ * Transfer buffer of URB that can be described either by a single buffer
+ * or by a chain of MDLs (URB_FUNCTION_XXX_USING_CHAINED_MDL).
+ */
+typedef struct _USBPCAP_URB_BUFFER
+{
+    PUCHAR  address;  /* Buffer address if not chained */
+    PMDL    chain;    /* First MDL in chain, NULL if not chained */
+    ULONG   segments; /* Number of MDLs in chain, 1 if not chained */
+} USBPCAP_URB_BUFFER, *PUSBPCAP_URB_BUFFER;
+
+static BOOLEAN USBPcapURBGetBuffer(PUSBPCAP_URB_BUFFER pBuffer,
+                                   ULONG length,
+                                   PVOID buffer,
+                                   PMDL  bufferMDL,
+                                   BOOLEAN chained)
+{
+    if (chained == TRUE)
+    {
+        PMDL mdl;
+
+        pBuffer->address = NULL;
+        pBuffer->chain = bufferMDL;
+        pBuffer->segments = 0;
+        for (mdl = bufferMDL; mdl != NULL; mdl = mdl->Next)
+        {
+            pBuffer->segments++;
+        }
+        return (pBuffer->segments > 0) ? TRUE : FALSE;
+    }
+
+    pBuffer->address = USBPcapURBGetBufferPointer(length, buffer, bufferMDL);
+    pBuffer->chain = NULL;
+    pBuffer->segments = 1;
+    return (pBuffer->address != NULL) ? TRUE : FALSE;
+}
+
+/*
+ * Appends payload entries describing length bytes at offset in the
+ * transfer buffer. Range in chained buffer can span several MDLs.
+ *
+ * Returns FALSE if the range cannot be mapped or there is no room
+ * for the entries.
+ */
+static BOOLEAN USBPcapURBBufferRange(PUSBPCAP_URB_BUFFER pBuffer,
+                                     ULONG offset,
+                                     ULONG length,
+                                     PUSBPCAP_PAYLOAD_ENTRY entries,
+                                     ULONG maxEntries,
+                                     PULONG count)
+{
+    PMDL mdl;
+
+    if (pBuffer->chain == NULL)
+    {
+        if (*count >= maxEntries)
+        {
+            return FALSE;
+        }
+        entries[*count].size = length;
+        entries[*count].buffer = &pBuffer->address[offset];
+        (*count)++;
+        return TRUE;
+    }
+
+    for (mdl = pBuffer->chain; (mdl != NULL) && (length > 0); mdl = mdl->Next)
+    {
+        ULONG   mdlLength = MmGetMdlByteCount(mdl);
+        ULONG   chunk;
+        PUCHAR  address;
+
+        if (offset >= mdlLength)
+        {
+            offset -= mdlLength;
+            continue;
+        }
+
+        address = MmGetSystemAddressForMdlSafe(mdl, NormalPagePriority);
+        if ((address == NULL) || (*count >= maxEntries))
+        {
+            return FALSE;
+        }
+
+        chunk = min(length, mdlLength - offset);
+        entries[*count].size = chunk;
+        entries[*count].buffer = &address[offset];
+        (*count)++;
+
+        offset = 0;
+        length -= chunk;
+    }
+
+    return (length == 0) ? TRUE : FALSE;
+}
+
 static VOID
 USBPcapParseInterfaceInformation(PUSBPCAP_DEVICE_DATA pDeviceData,
                                  PUSBD_INTERFACE_INFORMATION pInterface,
@@ -297,992 +392,1280 @@ USBPcapAnalyzeControlTransfer(struct _URB_CONTROL_TRANSFER* transfer,
     }
 }
 
+static VOID
+USBPcapInitializePacketHeader(PUSBPCAP_BUFFER_PACKET_HEADER packetHeader,
+                              USHORT headerLen,
+                              PIRP pIrp,
+                              PURB pUrb,
+                              BOOLEAN post,
+                              PUSBPCAP_DEVICE_DATA pDeviceData,
+                              UCHAR transfer)
+{
+    packetHeader->headerLen  = headerLen;
+    packetHeader->irpId      = (UINT64) pIrp;
+    packetHeader->status     = pUrb->UrbHeader.Status;
+    packetHeader->function   = pUrb->UrbHeader.Function;
+    packetHeader->info       = 0;
+    if (post == TRUE)
+    {
+        packetHeader->info |= USBPCAP_INFO_PDO_TO_FDO;
+    }
+    packetHeader->bus        = pDeviceData->pRootData->busId;
+    packetHeader->device     = pDeviceData->deviceAddress;
+    packetHeader->endpoint   = 0;
+    packetHeader->transfer   = transfer;
+    packetHeader->dataLength = 0;
+}
+
 /*
- * Analyzes the URB
+ * Logs URB that is carried out by host controller driver as a control
+ * transfer on default pipe.
  *
- * post is FALSE when the request is being on its way to the bus driver
- * post is TRUE when the request returns from the bus driver
+ * D7 of requestType determines the data stage direction.
  */
-VOID USBPcapAnalyzeURB(PIRP pIrp, PURB pUrb, BOOLEAN post,
-                       PUSBPCAP_DEVICE_DATA pDeviceData)
+static VOID
+USBPcapEncodeDefaultPipeRequest(PIRP pIrp,
+                                PURB pUrb,
+                                BOOLEAN post,
+                                PUSBPCAP_DEVICE_DATA pDeviceData,
+                                UCHAR requestType,
+                                UCHAR request,
+                                USHORT value,
+                                USHORT index,
+                                ULONG length,
+                                PVOID buffer,
+                                PMDL bufferMDL)
 {
-    struct _URB_HEADER     *header;
-    USBPCAP_URB_IRP_INFO    unknownURBSubmitInfo;
-    BOOLEAN                 hasUnknownURBSubmitInfo;
-
-    ASSERT(pUrb != NULL);
-    ASSERT(pDeviceData != NULL);
-    ASSERT(pDeviceData->pRootData != NULL);
+    struct _URB_CONTROL_TRANSFER  wrapTransfer;
 
-    header = (struct _URB_HEADER*)pUrb;
+    wrapTransfer.PipeHandle = NULL; /* Default pipe handle */
+    if (requestType & 0x80)
+    {
+        wrapTransfer.TransferFlags = USBD_TRANSFER_DIRECTION_IN;
+    }
+    else
+    {
+        wrapTransfer.TransferFlags = USBD_TRANSFER_DIRECTION_OUT;
+    }
+    wrapTransfer.TransferBufferLength = length;
+    wrapTransfer.TransferBuffer = buffer;
+    wrapTransfer.TransferBufferMDL = bufferMDL;
+
+    wrapTransfer.SetupPacket[0] = requestType;
+    wrapTransfer.SetupPacket[1] = request;
+    wrapTransfer.SetupPacket[2] = (value & 0x00FF);
+    wrapTransfer.SetupPacket[3] = (value & 0xFF00) >> 8;
+    wrapTransfer.SetupPacket[4] = (index & 0x00FF);
+    wrapTransfer.SetupPacket[5] = (index & 0xFF00) >> 8;
+    wrapTransfer.SetupPacket[6] = (UCHAR)(length & 0x00FF);
+    wrapTransfer.SetupPacket[7] = (UCHAR)((length & 0xFF00) >> 8);
+
+    USBPcapAnalyzeControlTransfer(&wrapTransfer, &pUrb->UrbHeader,
+                                  pDeviceData, pIrp, post);
+}
 
-    /* Check if the IRP on its way from FDO to PDO had unknown URB function */
-    if (post)
+/*
+ * Logs URB that is not associated with any USB transfer as
+ * USBPCAP_TRANSFER_IRP_INFO packet for the endpoint pipe refers to.
+ */
+static VOID
+USBPcapWritePipeRequest(PIRP pIrp,
+                        PURB pUrb,
+                        BOOLEAN post,
+                        PUSBPCAP_DEVICE_DATA pDeviceData,
+                        USBD_PIPE_HANDLE pipe,
+                        PVOID payload,
+                        UINT32 payloadLength)
+{
+    USBPCAP_BUFFER_PACKET_HEADER   packetHeader;
+    USBPCAP_ENDPOINT_INFO          info;
+    BOOLEAN                        epFound;
+
+    USBPcapInitializePacketHeader(&packetHeader,
+                                  sizeof(USBPCAP_BUFFER_PACKET_HEADER),
+                                  pIrp, pUrb, post, pDeviceData,
+                                  USBPCAP_TRANSFER_IRP_INFO);
+
+    DkDbgVal("URB PIPE REQUEST", pipe);
+    epFound = USBPcapRetrieveEndpointInfo(pDeviceData, pipe, &info);
+    if (epFound == TRUE)
     {
-        hasUnknownURBSubmitInfo =
-            USBPcapObtainURBIRPInfo(pDeviceData, pIrp, &unknownURBSubmitInfo);
+        packetHeader.device = info.deviceAddress;
+        packetHeader.endpoint = info.endpointAddress;
     }
     else
     {
-        hasUnknownURBSubmitInfo = FALSE;
+        packetHeader.endpoint = 0xFF;
+        packetHeader.transfer = USBPCAP_TRANSFER_UNKNOWN;
     }
 
-    /* Following URBs are always analyzed */
-    switch (header->Function)
+    if (payload != NULL)
     {
-        case URB_FUNCTION_SELECT_CONFIGURATION:
-        {
-            struct _URB_SELECT_CONFIGURATION *pSelectConfiguration;
-            USHORT interfaces_len;
+        packetHeader.dataLength = payloadLength;
+    }
 
-            if (post == FALSE)
-            {
-                /* Pass the request to host controller,
-                 * we are interested only in select configuration
-                 * after the fields are set by host controller driver */
-                break;
-            }
+    USBPcapBufferWritePacket(pDeviceData->pRootData,
+                             &packetHeader,
+                             payload);
+}
 
-            DkDbgStr("URB_FUNCTION_SELECT_CONFIGURATION");
-            pSelectConfiguration = (struct _URB_SELECT_CONFIGURATION*)pUrb;
+/*
+ * URB function encoders
+ *
+ * Every encoder writes the packets for a single URB function. Encoders are
+ * called for URBs on their way to the bus driver (post is FALSE) and on
+ * their way back (post is TRUE). requestType is the bmRequestType for URBs
+ * that are logged as control transfers, unused otherwise.
+ *
+ * Host controller driver can change the URB function to
+ * URB_FUNCTION_CONTROL_TRANSFER while processing the request. Because
+ * the encoders are selected by the URB function read at the time of the
+ * call, such requests are completed by the control transfer encoder.
+ * All the information needed to log the Setup stage is logged when
+ * the URB is submitted, so no state has to be kept per IRP.
+ */
+typedef VOID (*USBPCAP_URB_ENCODER)(PIRP pIrp,
+                                    PURB pUrb,
+                                    BOOLEAN post,
+                                    PUSBPCAP_DEVICE_DATA pDeviceData,
+                                    UCHAR requestType);
 
-            /* Check if there is interface information in the URB */
-            if (pUrb->UrbHeader.Length > offsetof(struct _URB_SELECT_CONFIGURATION, Interface))
-            {
-                /* Calculate interfaces length */
-                interfaces_len = pUrb->UrbHeader.Length;
-                interfaces_len -= offsetof(struct _URB_SELECT_CONFIGURATION, Interface);
+/*
+ * Updates device data (endpoint table, active configuration) based
+ * on URB returning from the bus driver. Trackers are called regardless
+ * of device filtering.
+ */
+typedef VOID (*USBPCAP_URB_TRACKER)(PURB pUrb,
+                                    PUSBPCAP_DEVICE_DATA pDeviceData);
 
-                KdPrint(("Header Len: %d Interfaces_len: %d\n",
-                        pUrb->UrbHeader.Length, interfaces_len));
+typedef struct _USBPCAP_URB_DISPATCH_ENTRY
+{
+    USBPCAP_URB_TRACKER  track;
+    USBPCAP_URB_ENCODER  encode;
+    UCHAR                requestType;
+} USBPCAP_URB_DISPATCH_ENTRY;
 
-                USBPcapParseInterfaceInformation(pDeviceData,
-                                                 &pSelectConfiguration->Interface,
-                                                 interfaces_len);
-            }
+static VOID
+USBPcapTrackSelectConfiguration(PURB pUrb,
+                                PUSBPCAP_DEVICE_DATA pDeviceData)
+{
+    struct _URB_SELECT_CONFIGURATION *pSelectConfiguration;
+    USHORT interfaces_len;
 
-            /* Store the configuration information for later use */
-            if (pDeviceData->descriptor != NULL)
-            {
-                ExFreePool((PVOID)pDeviceData->descriptor);
-            }
+    DkDbgStr("URB_FUNCTION_SELECT_CONFIGURATION");
+    pSelectConfiguration = (struct _URB_SELECT_CONFIGURATION*)pUrb;
 
-            if (pSelectConfiguration->ConfigurationDescriptor != NULL)
-            {
-                SIZE_T descSize = pSelectConfiguration->ConfigurationDescriptor->wTotalLength;
+    /* Check if there is interface information in the URB */
+    if (pUrb->UrbHeader.Length > offsetof(struct _URB_SELECT_CONFIGURATION, Interface))
+    {
+        /* Calculate interfaces length */
+        interfaces_len = pUrb->UrbHeader.Length;
+        interfaces_len -= offsetof(struct _URB_SELECT_CONFIGURATION, Interface);
 
-                pDeviceData->descriptor =
-                    ExAllocatePoolWithTag(NonPagedPool,
-                                          descSize,
-                                          (ULONG)'CSED');
+        KdPrint(("Header Len: %d Interfaces_len: %d\n",
+                pUrb->UrbHeader.Length, interfaces_len));
 
-                RtlCopyMemory(pDeviceData->descriptor,
-                              pSelectConfiguration->ConfigurationDescriptor,
-                              (SIZE_T)descSize);
-            }
-            else
-            {
-                pDeviceData->descriptor = NULL;
-            }
+        USBPcapParseInterfaceInformation(pDeviceData,
+                                         &pSelectConfiguration->Interface,
+                                         interfaces_len);
+    }
 
-            break;
-        }
+    /* Store the configuration information for later use */
+    if (pDeviceData->descriptor != NULL)
+    {
+        ExFreePool((PVOID)pDeviceData->descriptor);
+    }
 
-        case URB_FUNCTION_SELECT_INTERFACE:
-        {
-            struct _URB_SELECT_INTERFACE *pSelectInterface;
-            USHORT interfaces_len;
+    if (pSelectConfiguration->ConfigurationDescriptor != NULL)
+    {
+        SIZE_T descSize = pSelectConfiguration->ConfigurationDescriptor->wTotalLength;
 
-            if (post == FALSE)
-            {
-                /* Pass the request to host controller,
-                 * we are interested only in select interface
-                 * after the fields are set by host controller driver */
-                break;
-            }
+        pDeviceData->descriptor =
+            ExAllocatePoolWithTag(NonPagedPool,
+                                  descSize,
+                                  (ULONG)'CSED');
 
-            DkDbgStr("URB_FUNCTION_SELECT_INTERFACE");
-            pSelectInterface = (struct _URB_SELECT_INTERFACE*)pUrb;
+        RtlCopyMemory(pDeviceData->descriptor,
+                      pSelectConfiguration->ConfigurationDescriptor,
+                      (SIZE_T)descSize);
+    }
+    else
+    {
+        pDeviceData->descriptor = NULL;
+    }
+}
 
-            /* Check if there is interface information in the URB */
-            if (pUrb->UrbHeader.Length > offsetof(struct _URB_SELECT_INTERFACE, Interface))
-            {
-                /* Calculate interfaces length */
-                interfaces_len = pUrb->UrbHeader.Length;
-                interfaces_len -= offsetof(struct _URB_SELECT_INTERFACE, Interface);
+static VOID
+USBPcapTrackSelectInterface(PURB pUrb,
+                            PUSBPCAP_DEVICE_DATA pDeviceData)
+{
+    struct _URB_SELECT_INTERFACE *pSelectInterface;
+    USHORT interfaces_len;
 
-                KdPrint(("Header Len: %d Interfaces_len: %d\n",
-                        pUrb->UrbHeader.Length, interfaces_len));
+    DkDbgStr("URB_FUNCTION_SELECT_INTERFACE");
+    pSelectInterface = (struct _URB_SELECT_INTERFACE*)pUrb;
 
-                USBPcapParseInterfaceInformation(pDeviceData,
-                                                 &pSelectInterface->Interface,
-                                                 interfaces_len);
-            }
-            break;
-        }
+    /* Check if there is interface information in the URB */
+    if (pUrb->UrbHeader.Length > offsetof(struct _URB_SELECT_INTERFACE, Interface))
+    {
+        /* Calculate interfaces length */
+        interfaces_len = pUrb->UrbHeader.Length;
+        interfaces_len -= offsetof(struct _URB_SELECT_INTERFACE, Interface);
 
-        default:
-            break;
-    }
+        KdPrint(("Header Len: %d Interfaces_len: %d\n",
+                pUrb->UrbHeader.Length, interfaces_len));
 
-    if (USBPcapIsDeviceFiltered(&pDeviceData->pRootData->filter,
-                                (int)pDeviceData->deviceAddress) == FALSE)
-    {
-        /* Do not log URBs from devices which are not being filtered */
-        return;
+        USBPcapParseInterfaceInformation(pDeviceData,
+                                         &pSelectInterface->Interface,
+                                         interfaces_len);
     }
+}
 
-    if (hasUnknownURBSubmitInfo)
-    {
-        /* Simply log the unknown URB.
-         *
-         * Originally this was used to detect if URB returns from PDO as URB_FUNCTION_CONTROL_TRANSFER
-         * When this was the case, the unknownURBSubmitInfo was used together with the pUrb to fake
-         * the Setup stage packet. Unfortunately it is unreliable as there are specific Windows and
-         * USB Root Hub combinations for which the URB can return with URB_FUNCTION_CONTROL_TRANSFER
-         * but the SetupPacket inside pUrb does not contain valid data!
-         */
-        USBPCAP_BUFFER_PACKET_HEADER  packetHeader;
-
-        DkDbgVal("Logging unknown URB from URB IRP table", unknownURBSubmitInfo.function);
-
-        packetHeader.headerLen  = sizeof(USBPCAP_BUFFER_PACKET_HEADER);
-        packetHeader.irpId      = (UINT64) pIrp;
-        packetHeader.status     = unknownURBSubmitInfo.status;
-        packetHeader.function   = unknownURBSubmitInfo.function;
-        packetHeader.info       = unknownURBSubmitInfo.info;
-        packetHeader.bus        = unknownURBSubmitInfo.bus;
-        packetHeader.device     = unknownURBSubmitInfo.device;
-        packetHeader.endpoint   = 0;
-        packetHeader.transfer   = USBPCAP_TRANSFER_UNKNOWN;
-        packetHeader.dataLength = 0;
-
-        USBPcapBufferWriteTimestampedPacket(pDeviceData->pRootData,
-                                            unknownURBSubmitInfo.timestamp,
-                                            &packetHeader, NULL);
-    }
+static VOID
+USBPcapEncodeUnknown(PIRP pIrp, PURB pUrb, BOOLEAN post,
+                     PUSBPCAP_DEVICE_DATA pDeviceData, UCHAR requestType)
+{
+    USBPCAP_BUFFER_PACKET_HEADER  packetHeader;
 
-    switch (header->Function)
-    {
-        case URB_FUNCTION_SELECT_CONFIGURATION:
-        {
-            struct _URB_SELECT_CONFIGURATION *pSelectConfiguration;
-            struct _URB_CONTROL_TRANSFER     wrapTransfer;
-
-            pSelectConfiguration = (struct _URB_SELECT_CONFIGURATION*)pUrb;
-
-            wrapTransfer.PipeHandle = NULL; /* Default pipe handle */
-            wrapTransfer.TransferFlags = USBD_TRANSFER_DIRECTION_OUT;
-            wrapTransfer.TransferBufferLength = 0;
-            wrapTransfer.TransferBuffer = NULL;
-            wrapTransfer.TransferBufferMDL = NULL;
-            wrapTransfer.SetupPacket[0] = 0x00; /* Host to Device, Standard */
-            wrapTransfer.SetupPacket[1] = 0x09; /* SET_CONFIGURATION */
-            if (pSelectConfiguration->ConfigurationDescriptor == NULL)
-            {
-                wrapTransfer.SetupPacket[2] = 0;
-            }
-            else
-            {
-                wrapTransfer.SetupPacket[2] = pSelectConfiguration->ConfigurationDescriptor->bConfigurationValue;
-            }
-            wrapTransfer.SetupPacket[3] = 0;
-            wrapTransfer.SetupPacket[4] = 0;
-            wrapTransfer.SetupPacket[5] = 0;
-            wrapTransfer.SetupPacket[6] = 0;
-            wrapTransfer.SetupPacket[7] = 0;
-
-            USBPcapAnalyzeControlTransfer(&wrapTransfer, header,
-                                          pDeviceData, pIrp, post);
-            break;
-        }
+    DkDbgVal("Unknown URB type", pUrb->UrbHeader.Function);
 
-        case URB_FUNCTION_SELECT_INTERFACE:
-        {
-            struct _URB_SELECT_INTERFACE *pSelectInterface;
-            struct _URB_CONTROL_TRANSFER wrapTransfer;
-            PUSBD_INTERFACE_INFORMATION  intInfo;
-            PUSB_INTERFACE_DESCRIPTOR    intDescriptor;
+    USBPcapInitializePacketHeader(&packetHeader,
+                                  sizeof(USBPCAP_BUFFER_PACKET_HEADER),
+                                  pIrp, pUrb, post, pDeviceData,
+                                  USBPCAP_TRANSFER_UNKNOWN);
 
-            pSelectInterface = (struct _URB_SELECT_INTERFACE*)pUrb;
+    USBPcapBufferWritePacket(pDeviceData->pRootData, &packetHeader, NULL);
+}
 
-            if (pDeviceData->descriptor == NULL)
-            {
-                /* Won't log this URB */
-                DkDbgStr("No configuration descriptor");
-                break;
-            }
+static VOID
+USBPcapEncodeSelectConfiguration(PIRP pIrp, PURB pUrb, BOOLEAN post,
+                                 PUSBPCAP_DEVICE_DATA pDeviceData,
+                                 UCHAR requestType)
+{
+    struct _URB_SELECT_CONFIGURATION *pSelectConfiguration;
+    UCHAR                             configurationValue;
 
-            /* Obtain the USB_INTERFACE_DESCRIPTOR */
-            intInfo = &pSelectInterface->Interface;
+    pSelectConfiguration = (struct _URB_SELECT_CONFIGURATION*)pUrb;
 
-            intDescriptor =
-                USBD_ParseConfigurationDescriptorEx(pDeviceData->descriptor,
-                                                    pDeviceData->descriptor,
-                                                    intInfo->InterfaceNumber,
-                                                    intInfo->AlternateSetting,
-                                                    -1,  /* Class */
-                                                    -1,  /* SubClass */
-                                                    -1); /* Protocol */
+    if (pSelectConfiguration->ConfigurationDescriptor == NULL)
+    {
+        configurationValue = 0;
+    }
+    else
+    {
+        configurationValue = pSelectConfiguration->ConfigurationDescriptor->bConfigurationValue;
+    }
 
-            if (intDescriptor == NULL)
-            {
-                /* Interface descriptor not found */
-                DkDbgStr("Failed to get interface descriptor");
-                break;
-            }
+    /* 0x09 - SET_CONFIGURATION */
+    USBPcapEncodeDefaultPipeRequest(pIrp, pUrb, post, pDeviceData,
+                                    requestType, 0x09,
+                                    configurationValue, 0,
+                                    0, NULL, NULL);
+}
 
-            wrapTransfer.PipeHandle = NULL; /* Default pipe handle */
-            wrapTransfer.TransferFlags = USBD_TRANSFER_DIRECTION_OUT;
-            wrapTransfer.TransferBufferLength = 0;
-            wrapTransfer.TransferBuffer = NULL;
-            wrapTransfer.TransferBufferMDL = NULL;
-            wrapTransfer.SetupPacket[0] = 0x00; /* Host to Device, Standard */
-            wrapTransfer.SetupPacket[1] = 0x0B; /* SET_INTERFACE */
-
-            wrapTransfer.SetupPacket[2] = intDescriptor->bAlternateSetting;
-            wrapTransfer.SetupPacket[3] = 0;
-            wrapTransfer.SetupPacket[4] = intDescriptor->bInterfaceNumber;
-            wrapTransfer.SetupPacket[5] = 0;
-            wrapTransfer.SetupPacket[6] = 0;
-            wrapTransfer.SetupPacket[7] = 0;
-
-            USBPcapAnalyzeControlTransfer(&wrapTransfer, header,
-                                          pDeviceData, pIrp, post);
-            break;
-        }
+static VOID
+USBPcapEncodeSelectInterface(PIRP pIrp, PURB pUrb, BOOLEAN post,
+                             PUSBPCAP_DEVICE_DATA pDeviceData,
+                             UCHAR requestType)
+{
+    struct _URB_SELECT_INTERFACE *pSelectInterface;
+    PUSBD_INTERFACE_INFORMATION  intInfo;
+    PUSB_INTERFACE_DESCRIPTOR    intDescriptor;
 
-        case URB_FUNCTION_CONTROL_TRANSFER:
-        {
-            struct _URB_CONTROL_TRANSFER* transfer;
+    pSelectInterface = (struct _URB_SELECT_INTERFACE*)pUrb;
 
-            transfer = (struct _URB_CONTROL_TRANSFER*)pUrb;
+    if (pDeviceData->descriptor == NULL)
+    {
+        /* Won't log this URB */
+        DkDbgStr("No configuration descriptor");
+        return;
+    }
 
-            DkDbgStr("URB_FUNCTION_CONTROL_TRANSFER");
-            USBPcapAnalyzeControlTransfer(transfer, header,
-                                          pDeviceData, pIrp, post);
+    /* Obtain the USB_INTERFACE_DESCRIPTOR */
+    intInfo = &pSelectInterface->Interface;
 
-            DkDbgVal("", transfer->PipeHandle);
-            USBPcapPrintChars("Setup Packet", &transfer->SetupPacket[0], 8);
-            if (transfer->TransferBuffer != NULL)
-            {
-                USBPcapPrintChars("Transfer Buffer",
-                                 transfer->TransferBuffer,
-                                 transfer->TransferBufferLength);
-            }
-            break;
-        }
+    intDescriptor =
+        USBD_ParseConfigurationDescriptorEx(pDeviceData->descriptor,
+                                            pDeviceData->descriptor,
+                                            intInfo->InterfaceNumber,
+                                            intInfo->AlternateSetting,
+                                            -1,  /* Class */
+                                            -1,  /* SubClass */
+                                            -1); /* Protocol */
 
-#if (_WIN32_WINNT >= 0x0600)
-        case URB_FUNCTION_CONTROL_TRANSFER_EX:
-        {
-            struct _URB_CONTROL_TRANSFER     wrapTransfer;
-            struct _URB_CONTROL_TRANSFER_EX* transfer;
+    if (intDescriptor == NULL)
+    {
+        /* Interface descriptor not found */
+        DkDbgStr("Failed to get interface descriptor");
+        return;
+    }
 
-            transfer = (struct _URB_CONTROL_TRANSFER_EX*)pUrb;
+    /* 0x0B - SET_INTERFACE */
+    USBPcapEncodeDefaultPipeRequest(pIrp, pUrb, post, pDeviceData,
+                                    requestType, 0x0B,
+                                    intDescriptor->bAlternateSetting,
+                                    intDescriptor->bInterfaceNumber,
+                                    0, NULL, NULL);
+}
 
-            DkDbgStr("URB_FUNCTION_CONTROL_TRANSFER_EX");
+static VOID
+USBPcapEncodePipeRequest(PIRP pIrp, PURB pUrb, BOOLEAN post,
+                         PUSBPCAP_DEVICE_DATA pDeviceData, UCHAR requestType)
+{
+    struct _URB_PIPE_REQUEST  *request;
 
-            /* Copy the required data to wrapTransfer */
-            wrapTransfer.PipeHandle = transfer->PipeHandle;
-            wrapTransfer.TransferFlags = transfer->TransferFlags;
-            wrapTransfer.TransferBufferLength = transfer->TransferBufferLength;
-            wrapTransfer.TransferBuffer = transfer->TransferBuffer;
-            wrapTransfer.TransferBufferMDL = transfer->TransferBufferMDL;
-            RtlCopyMemory(&wrapTransfer.SetupPacket[0],
-                          &transfer->SetupPacket[0],
-                          8 /* Setup packet is always 8 bytes */);
+    request = (struct _URB_PIPE_REQUEST*)pUrb;
 
-            USBPcapAnalyzeControlTransfer(&wrapTransfer, header,
-                                          pDeviceData, pIrp, post);
+    USBPcapWritePipeRequest(pIrp, pUrb, post, pDeviceData,
+                            request->PipeHandle, NULL, 0);
+}
 
-            DkDbgVal("", transfer->PipeHandle);
-            USBPcapPrintChars("Setup Packet", &transfer->SetupPacket[0], 8);
-            if (transfer->TransferBuffer != NULL)
-            {
-                USBPcapPrintChars("Transfer Buffer",
-                                  transfer->TransferBuffer,
-                                  transfer->TransferBufferLength);
-            }
-            break;
-        }
-#endif
+#if (_WIN32_WINNT >= 0x0602)
+static VOID
+USBPcapEncodeOpenStaticStreams(PIRP pIrp, PURB pUrb, BOOLEAN post,
+                               PUSBPCAP_DEVICE_DATA pDeviceData,
+                               UCHAR requestType)
+{
+    struct _URB_OPEN_STATIC_STREAMS  *request;
+    UINT32                            numberOfStreams;
 
-        case URB_FUNCTION_GET_DESCRIPTOR_FROM_DEVICE:
-        case URB_FUNCTION_GET_DESCRIPTOR_FROM_ENDPOINT:
-        case URB_FUNCTION_GET_DESCRIPTOR_FROM_INTERFACE:
-        case URB_FUNCTION_SET_DESCRIPTOR_TO_DEVICE:
-        case URB_FUNCTION_SET_DESCRIPTOR_TO_ENDPOINT:
-        case URB_FUNCTION_SET_DESCRIPTOR_TO_INTERFACE:
-        {
-            struct _URB_CONTROL_TRANSFER             wrapTransfer;
-            struct _URB_CONTROL_DESCRIPTOR_REQUEST*  request;
+    request = (struct _URB_OPEN_STATIC_STREAMS*)pUrb;
 
-            request = (struct _URB_CONTROL_DESCRIPTOR_REQUEST*)pUrb;
+    DkDbgVal("URB_FUNCTION_OPEN_STATIC_STREAMS", request->NumberOfStreams);
 
-            DkDbgVal("URB_FUNCTION_XXX_DESCRIPTOR", header->Function);
+    /* Requested number of streams is the only meaningful payload */
+    numberOfStreams = (UINT32)request->NumberOfStreams;
+    USBPcapWritePipeRequest(pIrp, pUrb, post, pDeviceData,
+                            request->PipeHandle,
+                            (post == FALSE) ? &numberOfStreams : NULL,
+                            sizeof(numberOfStreams));
+}
+#endif
 
-            /* Set up wrapTransfer */
-            wrapTransfer.PipeHandle = NULL; /* Default pipe handle */
-            if (header->Function == URB_FUNCTION_GET_DESCRIPTOR_FROM_DEVICE)
-            {
-                wrapTransfer.TransferFlags = USBD_TRANSFER_DIRECTION_IN;
-                /* D7: Data from Device to Host (1)
-                 * D6-D5: Standard (0)
-                 * D4-D0: Device (0)
-                 */
-                wrapTransfer.SetupPacket[0] = 0x80;
-                /* 0x06 - GET_DESCRIPTOR */
-                wrapTransfer.SetupPacket[1] = 0x06;
-            }
-            else if (header->Function == URB_FUNCTION_GET_DESCRIPTOR_FROM_ENDPOINT)
-            {
-                wrapTransfer.TransferFlags = USBD_TRANSFER_DIRECTION_IN;
-                /* D7: Data from Device to Host (1)
-                 * D6-D5: Standard (0)
-                 * D4-D0: Endpoint (2)
-                 */
-                wrapTransfer.SetupPacket[0] = 0x82;
-                /* 0x06 - GET_DESCRIPTOR */
-                wrapTransfer.SetupPacket[1] = 0x06;
-            }
-            else if (header->Function == URB_FUNCTION_GET_DESCRIPTOR_FROM_INTERFACE)
-            {
-                wrapTransfer.TransferFlags = USBD_TRANSFER_DIRECTION_IN;
-                /* D7: Data from Device to Host (1)
-                 * D6-D5: Standard (0)
-                 * D4-D0: Interface (1)
-                 */
-                wrapTransfer.SetupPacket[0] = 0x81;
-                /* 0x06 - GET_DESCRIPTOR */
-                wrapTransfer.SetupPacket[1] = 0x06;
-            }
-            else if (header->Function == URB_FUNCTION_SET_DESCRIPTOR_TO_DEVICE)
-            {
-                wrapTransfer.TransferFlags = USBD_TRANSFER_DIRECTION_OUT;
-                /* D7: Data from Host to Device (0)
-                 * D6-D5: Standard (0)
-                 * D4-D0: Device (0)
-                 */
-                wrapTransfer.SetupPacket[0] = 0x00;
-                /* 0x07 - SET_DESCRIPTOR */
-                wrapTransfer.SetupPacket[1] = 0x07;
-            }
-            else if (header->Function == URB_FUNCTION_SET_DESCRIPTOR_TO_ENDPOINT)
-            {
-                wrapTransfer.TransferFlags = USBD_TRANSFER_DIRECTION_OUT;
-                /* D7: Data from Host to Device (0)
-                 * D6-D5: Standard (0)
-                 * D4-D0: Endpoint (2)
-                 */
-                wrapTransfer.SetupPacket[0] = 0x02;
-                /* 0x07 - SET_DESCRIPTOR */
-                wrapTransfer.SetupPacket[1] = 0x07;
-            }
-            else if (header->Function == URB_FUNCTION_SET_DESCRIPTOR_TO_INTERFACE)
-            {
-                wrapTransfer.TransferFlags = USBD_TRANSFER_DIRECTION_OUT;
-                /* D7: Data from Host to Device (0)
-                 * D6-D5: Standard (0)
-                 * D4-D0: Interface (1)
-                 */
-                wrapTransfer.SetupPacket[0] = 0x01;
-                /* 0x07 - SET_DESCRIPTOR */
-                wrapTransfer.SetupPacket[1] = 0x07;
-            }
-            else
-            {
-                DkDbgVal("Invalid function", header->Function);
-                break;
-            }
-            wrapTransfer.SetupPacket[2] = request->Index;
-            wrapTransfer.SetupPacket[3] = request->DescriptorType;
-            wrapTransfer.SetupPacket[4] = (request->LanguageId & 0x00FF);
-            wrapTransfer.SetupPacket[5] = (request->LanguageId & 0xFF00) >> 8;
-            wrapTransfer.SetupPacket[6] = (request->TransferBufferLength & 0x00FF);
-            wrapTransfer.SetupPacket[7] = (request->TransferBufferLength & 0xFF00) >> 8;
-
-            wrapTransfer.TransferBufferLength = request->TransferBufferLength;
-            wrapTransfer.TransferBuffer = request->TransferBuffer;
-            wrapTransfer.TransferBufferMDL = request->TransferBufferMDL;
-
-            USBPcapAnalyzeControlTransfer(&wrapTransfer, header,
-                                          pDeviceData, pIrp, post);
-            break;
-        }
+static VOID
+USBPcapEncodeFrameLengthControl(PIRP pIrp, PURB pUrb, BOOLEAN post,
+                                PUSBPCAP_DEVICE_DATA pDeviceData,
+                                UCHAR requestType)
+{
+    USBPCAP_BUFFER_PACKET_HEADER  packetHeader;
 
-        case URB_FUNCTION_GET_STATUS_FROM_DEVICE:
-        case URB_FUNCTION_GET_STATUS_FROM_INTERFACE:
-        case URB_FUNCTION_GET_STATUS_FROM_ENDPOINT:
-        case URB_FUNCTION_GET_STATUS_FROM_OTHER:
-        {
-            struct _URB_CONTROL_TRANSFER             wrapTransfer;
-            struct _URB_CONTROL_GET_STATUS_REQUEST*  request;
+    DkDbgVal("URB_FUNCTION_XXX_FRAME_LENGTH_CONTROL", pUrb->UrbHeader.Function);
 
-            request = (struct _URB_CONTROL_GET_STATUS_REQUEST*)pUrb;
+    USBPcapInitializePacketHeader(&packetHeader,
+                                  sizeof(USBPCAP_BUFFER_PACKET_HEADER),
+                                  pIrp, pUrb, post, pDeviceData,
+                                  USBPCAP_TRANSFER_IRP_INFO);
 
-            DkDbgVal("URB_FUNCTION_GET_STATUS_FROM_XXX", header->Function);
+    USBPcapBufferWritePacket(pDeviceData->pRootData, &packetHeader, NULL);
+}
 
-            /* Set up wrapTransfer */
-            wrapTransfer.PipeHandle = NULL; /* Default pipe handle */
-            wrapTransfer.TransferFlags = USBD_TRANSFER_DIRECTION_IN;
+static VOID
+USBPcapEncodeGetFrameLength(PIRP pIrp, PURB pUrb, BOOLEAN post,
+                            PUSBPCAP_DEVICE_DATA pDeviceData,
+                            UCHAR requestType)
+{
+    struct _URB_GET_FRAME_LENGTH  *request;
+    USBPCAP_BUFFER_PACKET_HEADER   packetHeader;
+    UINT32                         frame[2];
 
-            if (header->Function == URB_FUNCTION_GET_STATUS_FROM_DEVICE)
-            {
-                /* D7: Data from Device to Host (1)
-                 * D6-D5: Standard (0)
-                 * D4-D0: Device (0)
-                 */
-                wrapTransfer.SetupPacket[0] = 0x80;
-            }
-            else if (header->Function == URB_FUNCTION_GET_STATUS_FROM_INTERFACE)
-            {
-                /* D7: Data from Device to Host (1)
-                 * D6-D5: Standard (0)
-                 * D4-D0: Interface (1)
-                 */
-                wrapTransfer.SetupPacket[0] = 0x81;
-            }
-            else if (header->Function == URB_FUNCTION_GET_STATUS_FROM_ENDPOINT)
-            {
-                /* D7: Data from Device to Host (1)
-                 * D6-D5: Standard (0)
-                 * D4-D0: Endpoint (2)
-                 */
-                wrapTransfer.SetupPacket[0] = 0x82;
-            }
-            else if (header->Function == URB_FUNCTION_GET_STATUS_FROM_OTHER)
-            {
-                /* D7: Data from Device to Host (1)
-                 * D6-D5: Standard (0)
-                 * D4-D0: Other (3)
-                 */
-                wrapTransfer.SetupPacket[0] = 0x83;
-            }
-            else
-            {
-                DkDbgVal("Invalid function", header->Function);
-                break;
-            }
+    request = (struct _URB_GET_FRAME_LENGTH*)pUrb;
 
-            /* 0x00 - GET_STATUS */
-            wrapTransfer.SetupPacket[1] = 0x00;
-            /* wValue is Zero */
-            wrapTransfer.SetupPacket[2] = 0;
-            wrapTransfer.SetupPacket[3] = 0;
-            /* wIndex */
-            wrapTransfer.SetupPacket[4] = (request->Index & 0x00FF);
-            wrapTransfer.SetupPacket[5] = (request->Index & 0xFF00) >> 8;
-            /* wLength must be 2 */
-            wrapTransfer.SetupPacket[6] = (request->TransferBufferLength & 0x00FF);
-            wrapTransfer.SetupPacket[7] = (request->TransferBufferLength & 0xFF00) >> 8;
-
-            wrapTransfer.TransferBufferLength = request->TransferBufferLength;
-            wrapTransfer.TransferBuffer = request->TransferBuffer;
-            wrapTransfer.TransferBufferMDL = request->TransferBufferMDL;
-
-            USBPcapAnalyzeControlTransfer(&wrapTransfer, header,
-                                          pDeviceData, pIrp, post);
-            break;
-        }
+    USBPcapInitializePacketHeader(&packetHeader,
+                                  sizeof(USBPCAP_BUFFER_PACKET_HEADER),
+                                  pIrp, pUrb, post, pDeviceData,
+                                  USBPCAP_TRANSFER_IRP_INFO);
+    packetHeader.endpoint = 0x80;
 
-        case URB_FUNCTION_VENDOR_DEVICE:
-        case URB_FUNCTION_VENDOR_INTERFACE:
-        case URB_FUNCTION_VENDOR_ENDPOINT:
-        case URB_FUNCTION_VENDOR_OTHER:
-        case URB_FUNCTION_CLASS_DEVICE:
-        case URB_FUNCTION_CLASS_INTERFACE:
-        case URB_FUNCTION_CLASS_ENDPOINT:
-        case URB_FUNCTION_CLASS_OTHER:
-        {
-            struct _URB_CONTROL_TRANSFER                  wrapTransfer;
-            struct _URB_CONTROL_VENDOR_OR_CLASS_REQUEST*  request;
+    if (post == TRUE)
+    {
+        frame[0] = request->FrameLength;
+        frame[1] = request->FrameNumber;
+        packetHeader.dataLength = sizeof(frame);
+    }
 
-            request = (struct _URB_CONTROL_VENDOR_OR_CLASS_REQUEST*)pUrb;
+    USBPcapBufferWritePacket(pDeviceData->pRootData, &packetHeader, frame);
+}
 
-            DkDbgVal("URB_FUNCTION_VENDOR_XXX/URB_FUNCTION_CLASS_XXX",
-                     header->Function);
+static VOID
+USBPcapEncodeSetFrameLength(PIRP pIrp, PURB pUrb, BOOLEAN post,
+                            PUSBPCAP_DEVICE_DATA pDeviceData,
+                            UCHAR requestType)
+{
+    struct _URB_SET_FRAME_LENGTH  *request;
+    USBPCAP_BUFFER_PACKET_HEADER   packetHeader;
+    INT32                          frameLengthDelta;
 
-            wrapTransfer.PipeHandle = NULL; /* Default pipe handle */
-            wrapTransfer.TransferFlags = request->TransferFlags;
-            wrapTransfer.TransferBufferLength = request->TransferBufferLength;
-            wrapTransfer.TransferBuffer = request->TransferBuffer;
-            wrapTransfer.TransferBufferMDL = request->TransferBufferMDL;
+    request = (struct _URB_SET_FRAME_LENGTH*)pUrb;
 
-            /* Set up D6-D0 of Request Type based on Function
-             * D7 (Data Stage direction) will be set later
-             */
-            switch (header->Function)
-            {
-                case URB_FUNCTION_VENDOR_DEVICE:
-                    /* D4-D0: Device (0)
-                     * D6-D5: Vendor (2)
-                     */
-                    wrapTransfer.SetupPacket[0] = 0x40;
-                    break;
-                case URB_FUNCTION_VENDOR_INTERFACE:
-                    /* D4-D0: Interface (1)
-                     * D6-D5: Vendor (2)
-                     */
-                    wrapTransfer.SetupPacket[0] = 0x41;
-                    break;
-                case URB_FUNCTION_VENDOR_ENDPOINT:
-                    /* D4-D0: Endpoint (2)
-                     * D6-D5: Vendor (2)
-                     */
-                    wrapTransfer.SetupPacket[0] = 0x42;
-                    break;
-                case URB_FUNCTION_VENDOR_OTHER:
-                    /* D4-D0: Other (3)
-                     * D6-D5: Vendor (2)
-                     */
-                    wrapTransfer.SetupPacket[0] = 0x43;
-                    break;
-                case URB_FUNCTION_CLASS_DEVICE:
-                    /* D4-D0: Device (0)
-                     * D6-D5: Class (1)
-                     */
-                    wrapTransfer.SetupPacket[0] = 0x20;
-                    break;
-                case URB_FUNCTION_CLASS_INTERFACE:
-                    /* D4-D0: Interface (1)
-                     * D6-D5: Class (1)
-                     */
-                    wrapTransfer.SetupPacket[0] = 0x21;
-                    break;
-                case URB_FUNCTION_CLASS_ENDPOINT:
-                    /* D4-D0: Endpoint (2)
-                     * D6-D5: Class (1)
-                     */
-                    wrapTransfer.SetupPacket[0] = 0x22;
-                    break;
-                case URB_FUNCTION_CLASS_OTHER:
-                    /* D4-D0: Other (3)
-                     * D6-D5: Class (1)
-                     */
-                    wrapTransfer.SetupPacket[0] = 0x23;
-                    break;
-                default:
-                    DkDbgVal("Invalid function", header->Function);
-                    break;
-            }
+    USBPcapInitializePacketHeader(&packetHeader,
+                                  sizeof(USBPCAP_BUFFER_PACKET_HEADER),
+                                  pIrp, pUrb, post, pDeviceData,
+                                  USBPCAP_TRANSFER_IRP_INFO);
 
-            if (request->TransferFlags & USBD_TRANSFER_DIRECTION_IN)
-            {
-                /* Set D7: Request data from device */
-                wrapTransfer.SetupPacket[0] |= 0x80;
-            }
+    if (post == FALSE)
+    {
+        frameLengthDelta = request->FrameLengthDelta;
+        packetHeader.dataLength = sizeof(frameLengthDelta);
+    }
 
-            wrapTransfer.SetupPacket[1] = request->Request;
-            wrapTransfer.SetupPacket[2] = (request->Value & 0x00FF);
-            wrapTransfer.SetupPacket[3] = (request->Value & 0xFF00) >> 8;
-            wrapTransfer.SetupPacket[4] = (request->Index & 0x00FF);
-            wrapTransfer.SetupPacket[5] = (request->Index & 0xFF00) >> 8;
-            wrapTransfer.SetupPacket[6] = (request->TransferBufferLength & 0x00FF);
-            wrapTransfer.SetupPacket[7] = (request->TransferBufferLength & 0xFF00) >> 8;
+    USBPcapBufferWritePacket(pDeviceData->pRootData, &packetHeader,
+                             &frameLengthDelta);
+}
 
-            USBPcapAnalyzeControlTransfer(&wrapTransfer, header,
-                                          pDeviceData, pIrp, post);
-            break;
-        }
+static VOID
+USBPcapEncodeGetCurrentFrameNumber(PIRP pIrp, PURB pUrb, BOOLEAN post,
+                                   PUSBPCAP_DEVICE_DATA pDeviceData,
+                                   UCHAR requestType)
+{
+    struct _URB_GET_CURRENT_FRAME_NUMBER  *request;
+    USBPCAP_BUFFER_PACKET_HEADER           packetHeader;
+    UINT32                                 frameNum;
 
-        case URB_FUNCTION_BULK_OR_INTERRUPT_TRANSFER:
-        {
-            struct _URB_BULK_OR_INTERRUPT_TRANSFER  *transfer;
-            USBPCAP_ENDPOINT_INFO                   info;
-            BOOLEAN                                 epFound;
-            USBPCAP_BUFFER_PACKET_HEADER            packetHeader;
-            PVOID                                   transferBuffer;
-
-            packetHeader.headerLen = sizeof(USBPCAP_BUFFER_PACKET_HEADER);
-            packetHeader.irpId     = (UINT64) pIrp;
-            packetHeader.status    = header->Status;
-            packetHeader.function  = header->Function;
-            packetHeader.info      = 0;
-            if (post == TRUE)
-            {
-                packetHeader.info |= USBPCAP_INFO_PDO_TO_FDO;
-            }
+    request = (struct _URB_GET_CURRENT_FRAME_NUMBER*)pUrb;
 
-            packetHeader.bus      = pDeviceData->pRootData->busId;
+    USBPcapInitializePacketHeader(&packetHeader,
+                                  sizeof(USBPCAP_BUFFER_PACKET_HEADER),
+                                  pIrp, pUrb, post, pDeviceData,
+                                  USBPCAP_TRANSFER_IRP_INFO);
+    packetHeader.endpoint = 0x80;
 
-            transfer = (struct _URB_BULK_OR_INTERRUPT_TRANSFER*)pUrb;
+    if (post == TRUE)
+    {
+        frameNum = request->FrameNumber;
+        packetHeader.dataLength = sizeof(frameNum);
+    }
 
-            DkDbgStr("URB_FUNCTION_BULK_OR_INTERRUPT_TRANSFER");
-            DkDbgVal("", transfer->PipeHandle);
-            epFound = USBPcapRetrieveEndpointInfo(pDeviceData,
-                                                  transfer->PipeHandle,
-                                                  &info);
-            if (epFound == TRUE)
-            {
-                packetHeader.device = info.deviceAddress;
-                packetHeader.endpoint = info.endpointAddress;
+    USBPcapBufferWritePacket(pDeviceData->pRootData,
+                             &packetHeader,
+                             &frameNum);
+}
 
-                switch (info.type)
-                {
-                    case UsbdPipeTypeInterrupt:
-                        packetHeader.transfer = USBPCAP_TRANSFER_INTERRUPT;
-                        break;
-                    default:
-                        DkDbgVal("Invalid pipe type. Assuming bulk.",
-                                 info.type);
-                        /* Fall through */
-                    case UsbdPipeTypeBulk:
-                        packetHeader.transfer = USBPCAP_TRANSFER_BULK;
-                        break;
-                }
-            }
-            else
-            {
-                packetHeader.device = pDeviceData->deviceAddress;
-                packetHeader.endpoint = 0xFF;
+static VOID
+USBPcapEncodeControlTransfer(PIRP pIrp, PURB pUrb, BOOLEAN post,
+                             PUSBPCAP_DEVICE_DATA pDeviceData,
+                             UCHAR requestType)
+{
+    struct _URB_CONTROL_TRANSFER* transfer;
+
+    transfer = (struct _URB_CONTROL_TRANSFER*)pUrb;
+
+    DkDbgStr("URB_FUNCTION_CONTROL_TRANSFER");
+    USBPcapAnalyzeControlTransfer(transfer, &pUrb->UrbHeader,
+                                  pDeviceData, pIrp, post);
+
+    DkDbgVal("", transfer->PipeHandle);
+    USBPcapPrintChars("Setup Packet", &transfer->SetupPacket[0], 8);
+    if (transfer->TransferBuffer != NULL)
+    {
+        USBPcapPrintChars("Transfer Buffer",
+                         transfer->TransferBuffer,
+                         transfer->TransferBufferLength);
+    }
+}
+
+#if (_WIN32_WINNT >= 0x0600)
+static VOID
+USBPcapEncodeControlTransferEx(PIRP pIrp, PURB pUrb, BOOLEAN post,
+                               PUSBPCAP_DEVICE_DATA pDeviceData,
+                               UCHAR requestType)
+{
+    struct _URB_CONTROL_TRANSFER     wrapTransfer;
+    struct _URB_CONTROL_TRANSFER_EX* transfer;
+
+    transfer = (struct _URB_CONTROL_TRANSFER_EX*)pUrb;
+
+    DkDbgStr("URB_FUNCTION_CONTROL_TRANSFER_EX");
+
+    /* Copy the required data to wrapTransfer */
+    wrapTransfer.PipeHandle = transfer->PipeHandle;
+    wrapTransfer.TransferFlags = transfer->TransferFlags;
+    wrapTransfer.TransferBufferLength = transfer->TransferBufferLength;
+    wrapTransfer.TransferBuffer = transfer->TransferBuffer;
+    wrapTransfer.TransferBufferMDL = transfer->TransferBufferMDL;
+    RtlCopyMemory(&wrapTransfer.SetupPacket[0],
+                  &transfer->SetupPacket[0],
+                  8 /* Setup packet is always 8 bytes */);
+
+    USBPcapAnalyzeControlTransfer(&wrapTransfer, &pUrb->UrbHeader,
+                                  pDeviceData, pIrp, post);
+
+    DkDbgVal("", transfer->PipeHandle);
+    USBPcapPrintChars("Setup Packet", &transfer->SetupPacket[0], 8);
+    if (transfer->TransferBuffer != NULL)
+    {
+        USBPcapPrintChars("Transfer Buffer",
+                          transfer->TransferBuffer,
+                          transfer->TransferBufferLength);
+    }
+}
+#endif
+
+/* URB_FUNCTION_GET_DESCRIPTOR_FROM_XXX and URB_FUNCTION_SET_DESCRIPTOR_TO_XXX */
+static VOID
+USBPcapEncodeDescriptorRequest(PIRP pIrp, PURB pUrb, BOOLEAN post,
+                               PUSBPCAP_DEVICE_DATA pDeviceData,
+                               UCHAR requestType)
+{
+    struct _URB_CONTROL_DESCRIPTOR_REQUEST*  request;
+
+    request = (struct _URB_CONTROL_DESCRIPTOR_REQUEST*)pUrb;
+
+    DkDbgVal("URB_FUNCTION_XXX_DESCRIPTOR", pUrb->UrbHeader.Function);
+
+    /* 0x06 - GET_DESCRIPTOR, 0x07 - SET_DESCRIPTOR */
+    USBPcapEncodeDefaultPipeRequest(pIrp, pUrb, post, pDeviceData,
+                                    requestType,
+                                    (requestType & 0x80) ? 0x06 : 0x07,
+                                    (USHORT)(request->Index |
+                                             (request->DescriptorType << 8)),
+                                    request->LanguageId,
+                                    request->TransferBufferLength,
+                                    request->TransferBuffer,
+                                    request->TransferBufferMDL);
+}
+
+/* URB_FUNCTION_GET_STATUS_FROM_XXX */
+static VOID
+USBPcapEncodeGetStatus(PIRP pIrp, PURB pUrb, BOOLEAN post,
+                       PUSBPCAP_DEVICE_DATA pDeviceData, UCHAR requestType)
+{
+    struct _URB_CONTROL_GET_STATUS_REQUEST*  request;
+
+    request = (struct _URB_CONTROL_GET_STATUS_REQUEST*)pUrb;
+
+    DkDbgVal("URB_FUNCTION_GET_STATUS_FROM_XXX", pUrb->UrbHeader.Function);
+
+    /* 0x00 - GET_STATUS, wValue is Zero, wLength must be 2 */
+    USBPcapEncodeDefaultPipeRequest(pIrp, pUrb, post, pDeviceData,
+                                    requestType, 0x00,
+                                    0, request->Index,
+                                    request->TransferBufferLength,
+                                    request->TransferBuffer,
+                                    request->TransferBufferMDL);
+}
+
+static VOID
+USBPcapEncodeFeatureRequest(PIRP pIrp, PURB pUrb, BOOLEAN post,
+                            PUSBPCAP_DEVICE_DATA pDeviceData,
+                            UCHAR requestType, UCHAR request)
+{
+    struct _URB_CONTROL_FEATURE_REQUEST*  featureRequest;
+
+    featureRequest = (struct _URB_CONTROL_FEATURE_REQUEST*)pUrb;
+
+    DkDbgVal("URB_FUNCTION_XXX_FEATURE_TO_XXX", pUrb->UrbHeader.Function);
+
+    USBPcapEncodeDefaultPipeRequest(pIrp, pUrb, post, pDeviceData,
+                                    requestType, request,
+                                    featureRequest->FeatureSelector,
+                                    featureRequest->Index,
+                                    0, NULL, NULL);
+}
+
+/* URB_FUNCTION_SET_FEATURE_TO_XXX */
+static VOID
+USBPcapEncodeSetFeature(PIRP pIrp, PURB pUrb, BOOLEAN post,
+                        PUSBPCAP_DEVICE_DATA pDeviceData, UCHAR requestType)
+{
+    /* 0x03 - SET_FEATURE */
+    USBPcapEncodeFeatureRequest(pIrp, pUrb, post, pDeviceData,
+                                requestType, 0x03);
+}
+
+/* URB_FUNCTION_CLEAR_FEATURE_TO_XXX */
+static VOID
+USBPcapEncodeClearFeature(PIRP pIrp, PURB pUrb, BOOLEAN post,
+                          PUSBPCAP_DEVICE_DATA pDeviceData, UCHAR requestType)
+{
+    /* 0x01 - CLEAR_FEATURE */
+    USBPcapEncodeFeatureRequest(pIrp, pUrb, post, pDeviceData,
+                                requestType, 0x01);
+}
+
+static VOID
+USBPcapEncodeGetConfiguration(PIRP pIrp, PURB pUrb, BOOLEAN post,
+                              PUSBPCAP_DEVICE_DATA pDeviceData,
+                              UCHAR requestType)
+{
+    struct _URB_CONTROL_GET_CONFIGURATION_REQUEST*  request;
+
+    request = (struct _URB_CONTROL_GET_CONFIGURATION_REQUEST*)pUrb;
+
+    DkDbgStr("URB_FUNCTION_GET_CONFIGURATION");
+
+    /* 0x08 - GET_CONFIGURATION, wValue and wIndex are Zero */
+    USBPcapEncodeDefaultPipeRequest(pIrp, pUrb, post, pDeviceData,
+                                    requestType, 0x08, 0, 0,
+                                    request->TransferBufferLength,
+                                    request->TransferBuffer,
+                                    request->TransferBufferMDL);
+}
+
+static VOID
+USBPcapEncodeGetInterface(PIRP pIrp, PURB pUrb, BOOLEAN post,
+                          PUSBPCAP_DEVICE_DATA pDeviceData, UCHAR requestType)
+{
+    struct _URB_CONTROL_GET_INTERFACE_REQUEST*  request;
+
+    request = (struct _URB_CONTROL_GET_INTERFACE_REQUEST*)pUrb;
+
+    DkDbgStr("URB_FUNCTION_GET_INTERFACE");
+
+    /* 0x0A - GET_INTERFACE, wValue is Zero */
+    USBPcapEncodeDefaultPipeRequest(pIrp, pUrb, post, pDeviceData,
+                                    requestType, 0x0A, 0,
+                                    request->Interface,
+                                    request->TransferBufferLength,
+                                    request->TransferBuffer,
+                                    request->TransferBufferMDL);
+}
+
+static VOID
+USBPcapEncodeGetMSFeatureDescriptor(PIRP pIrp, PURB pUrb, BOOLEAN post,
+                                    PUSBPCAP_DEVICE_DATA pDeviceData,
+                                    UCHAR requestType)
+{
+    struct _URB_OS_FEATURE_DESCRIPTOR_REQUEST*  request;
+
+    request = (struct _URB_OS_FEATURE_DESCRIPTOR_REQUEST*)pUrb;
+
+    DkDbgVal("URB_FUNCTION_GET_MS_FEATURE_DESCRIPTOR",
+             request->MS_FeatureDescriptorIndex);
+
+    /* Microsoft OS Descriptors are retrieved with vendor request.
+     * bRequest is the vendor code the hub driver obtained from the
+     * OS String Descriptor. The code is not available in the URB,
+     * so it is logged as zero.
+     *
+     * wValue: High byte - Interface number, Low byte - Page number
+     * wIndex: Feature descriptor index
+     */
+    USBPcapEncodeDefaultPipeRequest(pIrp, pUrb, post, pDeviceData,
+                                    (UCHAR)(requestType | request->Recipient),
+                                    0x00,
+                                    (USHORT)((request->InterfaceNumber << 8) |
+                                             request->MS_PageIndex),
+                                    request->MS_FeatureDescriptorIndex,
+                                    request->TransferBufferLength,
+                                    request->TransferBuffer,
+                                    request->TransferBufferMDL);
+}
+
+/* URB_FUNCTION_VENDOR_XXX and URB_FUNCTION_CLASS_XXX */
+static VOID
+USBPcapEncodeVendorOrClassRequest(PIRP pIrp, PURB pUrb, BOOLEAN post,
+                                  PUSBPCAP_DEVICE_DATA pDeviceData,
+                                  UCHAR requestType)
+{
+    struct _URB_CONTROL_VENDOR_OR_CLASS_REQUEST*  request;
+
+    request = (struct _URB_CONTROL_VENDOR_OR_CLASS_REQUEST*)pUrb;
+
+    DkDbgVal("URB_FUNCTION_VENDOR_XXX/URB_FUNCTION_CLASS_XXX",
+             pUrb->UrbHeader.Function);
+
+    /* requestType contains D6-D0 of Request Type.
+     * D7 (Data Stage direction) is taken from transfer flags.
+     */
+    if (request->TransferFlags & USBD_TRANSFER_DIRECTION_IN)
+    {
+        /* Set D7: Request data from device */
+        requestType |= 0x80;
+    }
+
+    USBPcapEncodeDefaultPipeRequest(pIrp, pUrb, post, pDeviceData,
+                                    requestType,
+                                    request->Request,
+                                    request->Value,
+                                    request->Index,
+                                    request->TransferBufferLength,
+                                    request->TransferBuffer,
+                                    request->TransferBufferMDL);
+}
+
+static VOID
+USBPcapEncodeBulkOrInterruptBuffer(PIRP pIrp, PURB pUrb, BOOLEAN post,
+                                   PUSBPCAP_DEVICE_DATA pDeviceData,
+                                   BOOLEAN chained)
+{
+    struct _URB_BULK_OR_INTERRUPT_TRANSFER  *transfer;
+    USBPCAP_ENDPOINT_INFO                   info;
+    BOOLEAN                                 epFound;
+    USBPCAP_BUFFER_PACKET_HEADER            packetHeader;
+    USBPCAP_PAYLOAD_ENTRY                   inlinePayload[2];
+    PUSBPCAP_PAYLOAD_ENTRY                  payload;
+    ULONG                                   count;
+
+    USBPcapInitializePacketHeader(&packetHeader,
+                                  sizeof(USBPCAP_BUFFER_PACKET_HEADER),
+                                  pIrp, pUrb, post, pDeviceData,
+                                  USBPCAP_TRANSFER_BULK);
+
+    transfer = (struct _URB_BULK_OR_INTERRUPT_TRANSFER*)pUrb;
+
+    DkDbgVal("URB_FUNCTION_BULK_OR_INTERRUPT_TRANSFER", pUrb->UrbHeader.Function);
+    DkDbgVal("", transfer->PipeHandle);
+    epFound = USBPcapRetrieveEndpointInfo(pDeviceData,
+                                          transfer->PipeHandle,
+                                          &info);
+    if (epFound == TRUE)
+    {
+        packetHeader.device = info.deviceAddress;
+        packetHeader.endpoint = info.endpointAddress;
+
+        switch (info.type)
+        {
+            case UsbdPipeTypeInterrupt:
+                packetHeader.transfer = USBPCAP_TRANSFER_INTERRUPT;
+                break;
+            default:
+                DkDbgVal("Invalid pipe type. Assuming bulk.",
+                         info.type);
+                /* Fall through */
+            case UsbdPipeTypeBulk:
                 packetHeader.transfer = USBPCAP_TRANSFER_BULK;
+                break;
+        }
+    }
+    else
+    {
+        packetHeader.endpoint = 0xFF;
+    }
+
+    payload = inlinePayload;
+    count = 0;
+
+    /* For IN endpoints, add data to log only when post = TRUE,
+     * For OUT endpoints, add data to log only when post = FALSE
+     */
+    if ((transfer->TransferBufferLength != 0) &&
+        (((packetHeader.endpoint & 0x80) && (post == TRUE)) ||
+         (!(packetHeader.endpoint & 0x80) && (post == FALSE))))
+    {
+        USBPCAP_URB_BUFFER  buffer;
+
+        if (USBPcapURBGetBuffer(&buffer,
+                                transfer->TransferBufferLength,
+                                transfer->TransferBuffer,
+                                transfer->TransferBufferMDL,
+                                chained) == TRUE)
+        {
+            if (buffer.segments + 1 > ARRAYSIZE(inlinePayload))
+            {
+                payload = ExAllocatePoolWithTag(NonPagedPool,
+                    (SIZE_T)(buffer.segments + 1) * sizeof(USBPCAP_PAYLOAD_ENTRY),
+                    'KLUB');
             }
 
-            /* For IN endpoints, add data to log only when post = TRUE,
-             * For OUT endpoints, add data to log only when post = FALSE
-             */
-            if (((packetHeader.endpoint & 0x80) && (post == TRUE)) ||
-                (!(packetHeader.endpoint & 0x80) && (post == FALSE)))
+            if ((payload != NULL) &&
+                (USBPcapURBBufferRange(&buffer, 0,
+                                       transfer->TransferBufferLength,
+                                       payload, buffer.segments,
+                                       &count) == TRUE))
             {
                 packetHeader.dataLength = (UINT32)transfer->TransferBufferLength;
-
-                transferBuffer =
-                    USBPcapURBGetBufferPointer(transfer->TransferBufferLength,
-                                               transfer->TransferBuffer,
-                                               transfer->TransferBufferMDL);
             }
             else
             {
-                packetHeader.dataLength = 0;
-                transferBuffer = NULL;
+                DkDbgStr("Failed to map transfer buffer");
+                count = 0;
             }
+        }
+    }
 
-            USBPcapBufferWritePacket(pDeviceData->pRootData,
-                                     &packetHeader,
-                                     transferBuffer);
+    if (payload != NULL)
+    {
+        payload[count].size = 0;
+        payload[count].buffer = NULL;
 
-            DkDbgVal("", transfer->TransferFlags);
-            DkDbgVal("", transfer->TransferBufferLength);
-            DkDbgVal("", transfer->TransferBuffer);
-            DkDbgVal("", transfer->TransferBufferMDL);
-            if (transfer->TransferBuffer != NULL)
-            {
-                USBPcapPrintChars("Transfer Buffer",
-                                  transfer->TransferBuffer,
-                                  transfer->TransferBufferLength);
-            }
-            break;
-        }
+        USBPcapBufferWritePayload(pDeviceData->pRootData,
+                                  &packetHeader,
+                                  payload);
 
-        case URB_FUNCTION_ISOCH_TRANSFER:
+        if (payload != inlinePayload)
         {
-            struct _URB_ISOCH_TRANSFER    *transfer;
-            USBPCAP_ENDPOINT_INFO         info;
-            BOOLEAN                       epFound;
-            PUSBPCAP_BUFFER_ISOCH_HEADER  packetHeader;
-            PUSBPCAP_PAYLOAD_ENTRY        compactedPayloadEntries;
-            PVOID                         captureBuffer;
-            USHORT                        headerLen;
-            ULONG                         i;
-
-            transfer = (struct _URB_ISOCH_TRANSFER*)pUrb;
-
-            DkDbgStr("URB_FUNCTION_ISOCH_TRANSFER");
-            DkDbgVal("", transfer->PipeHandle);
-            DkDbgVal("", transfer->TransferFlags);
-            DkDbgVal("", transfer->NumberOfPackets);
-
-            /* Handle transfers up to maximum of 1024 packets */
-            if (transfer->NumberOfPackets > 1024)
-            {
-                DkDbgVal("Too many packets for isochronous transfer",
-                         transfer->NumberOfPackets);
-                break;
-            }
+            ExFreePool((PVOID)payload);
+        }
+    }
+    else
+    {
+        USBPcapBufferWritePacket(pDeviceData->pRootData,
+                                 &packetHeader,
+                                 NULL);
+    }
 
-            /* headerLen will fit on 16 bits for every allowed value of
-             * NumberOfPackets */
-            headerLen = (USHORT)sizeof(USBPCAP_BUFFER_ISOCH_HEADER) +
-                        (USHORT)(sizeof(USBPCAP_BUFFER_ISO_PACKET) *
-                                 (transfer->NumberOfPackets - 1));
+    DkDbgVal("", transfer->TransferFlags);
+    DkDbgVal("", transfer->TransferBufferLength);
+    DkDbgVal("", transfer->TransferBuffer);
+    DkDbgVal("", transfer->TransferBufferMDL);
+    if (transfer->TransferBuffer != NULL)
+    {
+        USBPcapPrintChars("Transfer Buffer",
+                          transfer->TransferBuffer,
+                          transfer->TransferBufferLength);
+    }
+}
 
-            packetHeader = ExAllocatePoolWithTag(NonPagedPool,
-                                                 (SIZE_T)headerLen,
-                                                 ' RDH');
+static VOID
+USBPcapEncodeBulkOrInterruptTransfer(PIRP pIrp, PURB pUrb, BOOLEAN post,
+                                     PUSBPCAP_DEVICE_DATA pDeviceData,
+                                     UCHAR requestType)
+{
+    USBPcapEncodeBulkOrInterruptBuffer(pIrp, pUrb, post, pDeviceData, FALSE);
+}
 
-            if (packetHeader == NULL)
-            {
-                DkDbgStr("Insufficient resources for isochronous transfer");
-                break;
-            }
+static VOID
+USBPcapEncodeBulkOrInterruptTransferChained(PIRP pIrp, PURB pUrb, BOOLEAN post,
+                                            PUSBPCAP_DEVICE_DATA pDeviceData,
+                                            UCHAR requestType)
+{
+    USBPcapEncodeBulkOrInterruptBuffer(pIrp, pUrb, post, pDeviceData, TRUE);
+}
 
-            packetHeader->header.headerLen = headerLen;
-            packetHeader->header.irpId     = (UINT64) pIrp;
-            packetHeader->header.status    = header->Status;
-            packetHeader->header.function  = header->Function;
-            packetHeader->header.info      = 0;
-            if (post == TRUE)
-            {
-                packetHeader->header.info |= USBPCAP_INFO_PDO_TO_FDO;
-            }
+static VOID
+USBPcapEncodeIsochBuffer(PIRP pIrp, PURB pUrb, BOOLEAN post,
+                         PUSBPCAP_DEVICE_DATA pDeviceData, BOOLEAN chained)
+{
+    struct _URB_ISOCH_TRANSFER    *transfer;
+    USBPCAP_ENDPOINT_INFO         info;
+    BOOLEAN                       epFound;
+    PUSBPCAP_BUFFER_ISOCH_HEADER  packetHeader;
+    PUSBPCAP_PAYLOAD_ENTRY        payloadEntries;
+    ULONG                         payloadCount;
+    USHORT                        headerLen;
+    ULONG                         i;
+
+    transfer = (struct _URB_ISOCH_TRANSFER*)pUrb;
+
+    DkDbgVal("URB_FUNCTION_ISOCH_TRANSFER", pUrb->UrbHeader.Function);
+    DkDbgVal("", transfer->PipeHandle);
+    DkDbgVal("", transfer->TransferFlags);
+    DkDbgVal("", transfer->NumberOfPackets);
+
+    /* Handle transfers up to maximum of 1024 packets */
+    if (transfer->NumberOfPackets > 1024)
+    {
+        DkDbgVal("Too many packets for isochronous transfer",
+                 transfer->NumberOfPackets);
+        return;
+    }
+
+    /* headerLen will fit on 16 bits for every allowed value of
+     * NumberOfPackets */
+    headerLen = (USHORT)sizeof(USBPCAP_BUFFER_ISOCH_HEADER) +
+                (USHORT)(sizeof(USBPCAP_BUFFER_ISO_PACKET) *
+                         (transfer->NumberOfPackets - 1));
 
-            packetHeader->header.bus       = pDeviceData->pRootData->busId;
+    packetHeader = ExAllocatePoolWithTag(NonPagedPool,
+                                         (SIZE_T)headerLen,
+                                         ' RDH');
 
-            epFound = USBPcapRetrieveEndpointInfo(pDeviceData,
-                                                  transfer->PipeHandle,
-                                                  &info);
-            if (epFound == TRUE)
+    if (packetHeader == NULL)
+    {
+        DkDbgStr("Insufficient resources for isochronous transfer");
+        return;
+    }
+
+    USBPcapInitializePacketHeader(&packetHeader->header, headerLen,
+                                  pIrp, pUrb, post, pDeviceData,
+                                  USBPCAP_TRANSFER_ISOCHRONOUS);
+
+    epFound = USBPcapRetrieveEndpointInfo(pDeviceData,
+                                          transfer->PipeHandle,
+                                          &info);
+    if (epFound == TRUE)
+    {
+        packetHeader->header.device = info.deviceAddress;
+        packetHeader->header.endpoint = info.endpointAddress;
+    }
+    else
+    {
+        packetHeader->header.endpoint = 0xFF;
+    }
+
+    /* Default to no data, will be changed later if data is to be attached to packet */
+    payloadEntries = NULL;
+    payloadCount = 0;
+
+    /* Copy the packet headers untouched */
+    for (i = 0; i < transfer->NumberOfPackets; i++)
+    {
+        packetHeader->packet[i].offset = transfer->IsoPacket[i].Offset;
+        packetHeader->packet[i].length = transfer->IsoPacket[i].Length;
+        packetHeader->packet[i].status = transfer->IsoPacket[i].Status;
+    }
+
+    /* For inbound isoch transfers (post), transfer->TransferBufferLength reflects the actual
+     * number of bytes received. Rather than copying the entire transfer buffer (which may have
+     * empty gaps), we will compact the data, copying only the packets that contain data.
+     */
+    if (transfer->TransferBufferLength != 0)
+    {
+        USBPCAP_URB_BUFFER  buffer;
+        BOOLEAN             mapped;
+
+        mapped = USBPcapURBGetBuffer(&buffer,
+                                     transfer->TransferBufferLength,
+                                     transfer->TransferBuffer,
+                                     transfer->TransferBufferMDL,
+                                     chained);
+
+        if (mapped == FALSE)
+        {
+            DkDbgStr("Failed to map isochronous transfer buffer");
+        }
+        else if (((transfer->TransferFlags & USBD_TRANSFER_DIRECTION_IN) == USBD_TRANSFER_DIRECTION_IN) && (post == TRUE))
+        {
+            ULONG  compactedOffset;
+            ULONG  compactedLength;
+            ULONG  maxEntries;
+
+            compactedLength = 0;
+
+            /* Compute the compacted transfer length by summing up the individual packet lengths */
+            for (i = 0; i < transfer->NumberOfPackets; i++)
             {
-                packetHeader->header.device = info.deviceAddress;
-                packetHeader->header.endpoint = info.endpointAddress;
+                compactedLength += transfer->IsoPacket[i].Length;
             }
-            else
+
+            if (compactedLength > transfer->TransferBufferLength)
             {
-                packetHeader->header.device = pDeviceData->deviceAddress;
-                packetHeader->header.endpoint = 0xFF;
+                /* This is a safety check -- the numbers don't add up (this should never happen) */
+                DkDbgStr("Sum of Isochronous transfer packet lengths exceeds transfer buffer length");
+                ExFreePool((PVOID)packetHeader);
+                return;
             }
-            packetHeader->header.transfer = USBPCAP_TRANSFER_ISOCHRONOUS;
 
-            /* Default to no data, will be changed later if data is to be attached to packet */
-            packetHeader->header.dataLength = 0;
-            compactedPayloadEntries = NULL;
-            captureBuffer = NULL;
+            /* Every packet needs one payload entry and chained buffer
+             * needs additional entry for every MDL boundary crossed.
+             */
+            maxEntries = transfer->NumberOfPackets + buffer.segments - 1;
 
-            /* Copy the packet headers untouched */
-            for (i = 0; i < transfer->NumberOfPackets; i++)
+            /* Allocate array of payload entries that will point to original data */
+            payloadEntries = ExAllocatePoolWithTag(NonPagedPool,
+                (SIZE_T)(maxEntries + 1) * sizeof(USBPCAP_PAYLOAD_ENTRY),
+                'COSI');
+            if (payloadEntries == NULL)
             {
-                packetHeader->packet[i].offset = transfer->IsoPacket[i].Offset;
-                packetHeader->packet[i].length = transfer->IsoPacket[i].Length;
-                packetHeader->packet[i].status = transfer->IsoPacket[i].Status;
+                DkDbgStr("Insufficient resources for isochronous transfer");
+                ExFreePool((PVOID)packetHeader);
+                return;
             }
 
-            /* For inbound isoch transfers (post), transfer->TransferBufferLength reflects the actual
-             * number of bytes received. Rather than copying the entire transfer buffer (which may have
-             * empty gaps), we will compact the data, copying only the packets that contain data.
+            /* Loop through all the isoch packets in the transfer buffer
+             * Store offset and length in payload entries array in a way
+             * that there won't be gaps in the resulting packet.
              */
-            if (transfer->TransferBufferLength != 0)
+            compactedOffset = 0;
+            for (i = 0; i < transfer->NumberOfPackets; i++)
             {
-                PUCHAR transferBuffer =
-                        USBPcapURBGetBufferPointer(transfer->TransferBufferLength,
-                                                   transfer->TransferBuffer,
-                                                   transfer->TransferBufferMDL);
-
-                if (((transfer->TransferFlags & USBD_TRANSFER_DIRECTION_IN) == USBD_TRANSFER_DIRECTION_IN) && (post == TRUE))
-                {
-                    ULONG  compactedOffset;
-                    ULONG  compactedLength;
-
-                    compactedLength = 0;
-
-                    /* Compute the compacted transfer length by summing up the individual packet lengths */
-                    for (i = 0; i < transfer->NumberOfPackets; i++)
-                    {
-                        compactedLength += transfer->IsoPacket[i].Length;
-                    }
-
-                    if (compactedLength > transfer->TransferBufferLength)
-                    {
-                        /* This is a safety check -- the numbers don't add up (this should never happen) */
-                        DkDbgStr("Sum of Isochronous transfer packet lengths exceeds transfer buffer length");
-                        ExFreePool((PVOID)packetHeader);
-                        break;
-                    }
-
-                    /* Compact the data to minimize the capture size */
-                    packetHeader->header.dataLength = (UINT32)compactedLength;
-
-                    /* Allocate array of payload entries that will point to original data */
-                    compactedPayloadEntries = ExAllocatePoolWithTag(NonPagedPool,
-                        (SIZE_T)(transfer->NumberOfPackets + 1) * sizeof(USBPCAP_PAYLOAD_ENTRY),
-                        'COSI');
-                    if (compactedPayloadEntries == NULL)
-                    {
-                        DkDbgStr("Insufficient resources for isochronous transfer");
-                        ExFreePool((PVOID)packetHeader);
-                        break;
-                    }
-
-                    /* Loop through all the isoch packets in the transfer buffer
-                     * Store offset and length in payload entries array in a way
-                     * that there won't be gaps in the resulting packet.
-                     */
-                    compactedOffset = 0;
-                    for (i = 0; i < transfer->NumberOfPackets; i++)
-                    {
-                        /* Adjust the offsets */
-                        packetHeader->packet[i].offset = compactedOffset;
-                        packetHeader->packet[i].length = transfer->IsoPacket[i].Length;
-                        packetHeader->packet[i].status = transfer->IsoPacket[i].Status;
-
-                        compactedPayloadEntries[i].size = transfer->IsoPacket[i].Length;
-                        compactedPayloadEntries[i].buffer = &transferBuffer[transfer->IsoPacket[i].Offset];
-                        compactedOffset += transfer->IsoPacket[i].Length;
-                    }
-                    compactedPayloadEntries[i].size = 0;
-                    compactedPayloadEntries[i].buffer = NULL;
-                }
-                else if (((transfer->TransferFlags & USBD_TRANSFER_DIRECTION_IN) == USBD_TRANSFER_DIRECTION_OUT) && (post == FALSE))
+                if (USBPcapURBBufferRange(&buffer,
+                                          transfer->IsoPacket[i].Offset,
+                                          transfer->IsoPacket[i].Length,
+                                          payloadEntries, maxEntries,
+                                          &payloadCount) == FALSE)
                 {
-                    captureBuffer = transferBuffer;
-                    packetHeader->header.dataLength = transfer->TransferBufferLength;
-                }
-                else
-                {
-                    /* Do not capture transfer buffer now */
+                    DkDbgVal("Failed to map isochronous packet", i);
+                    break;
                 }
-            }
 
-            packetHeader->startFrame      = transfer->StartFrame;
-            packetHeader->numberOfPackets = transfer->NumberOfPackets;
-            packetHeader->errorCount      = transfer->ErrorCount;
+                /* Adjust the offsets */
+                packetHeader->packet[i].offset = compactedOffset;
+                compactedOffset += transfer->IsoPacket[i].Length;
+            }
 
-            if (compactedPayloadEntries)
+            if (i == transfer->NumberOfPackets)
             {
-                USBPcapBufferWritePayload(pDeviceData->pRootData,
-                                          (PUSBPCAP_BUFFER_PACKET_HEADER)packetHeader,
-                                          compactedPayloadEntries);
-                ExFreePool((PVOID)compactedPayloadEntries);
+                /* Compact the data to minimize the capture size */
+                packetHeader->header.dataLength = (UINT32)compactedLength;
             }
             else
             {
-                USBPcapBufferWritePacket(pDeviceData->pRootData,
-                                         (PUSBPCAP_BUFFER_PACKET_HEADER)packetHeader,
-                                         captureBuffer);
+                /* Log packet descriptors only */
+                for (i = 0; i < transfer->NumberOfPackets; i++)
+                {
+                    packetHeader->packet[i].offset = transfer->IsoPacket[i].Offset;
+                }
+                payloadCount = 0;
             }
-
-            ExFreePool((PVOID)packetHeader);
-            break;
         }
-
-        case URB_FUNCTION_SYNC_RESET_PIPE_AND_CLEAR_STALL:
-        case URB_FUNCTION_SYNC_RESET_PIPE:
-        case URB_FUNCTION_SYNC_CLEAR_STALL:
-        case URB_FUNCTION_ABORT_PIPE:
-#if (_WIN32_WINNT >= 0x0602)
-        case URB_FUNCTION_CLOSE_STATIC_STREAMS:
-#endif
+        else if (((transfer->TransferFlags & USBD_TRANSFER_DIRECTION_IN) == USBD_TRANSFER_DIRECTION_OUT) && (post == FALSE))
         {
-            struct _URB_PIPE_REQUEST      *request;
-            USBPCAP_BUFFER_PACKET_HEADER   packetHeader;
-            USBPCAP_ENDPOINT_INFO          info;
-            BOOLEAN                        epFound;
-
-            packetHeader.headerLen  = sizeof(USBPCAP_BUFFER_PACKET_HEADER);
-            packetHeader.irpId      = (UINT64) pIrp;
-            packetHeader.status     = header->Status;
-            packetHeader.function   = header->Function;
-            packetHeader.info       = 0;
-            if (post == TRUE)
+            payloadEntries = ExAllocatePoolWithTag(NonPagedPool,
+                (SIZE_T)(buffer.segments + 1) * sizeof(USBPCAP_PAYLOAD_ENTRY),
+                'COSI');
+            if ((payloadEntries != NULL) &&
+                (USBPcapURBBufferRange(&buffer, 0,
+                                       transfer->TransferBufferLength,
+                                       payloadEntries, buffer.segments,
+                                       &payloadCount) == TRUE))
             {
-                packetHeader.info |= USBPCAP_INFO_PDO_TO_FDO;
-            }
-            packetHeader.bus        = pDeviceData->pRootData->busId;
-            packetHeader.transfer   = USBPCAP_TRANSFER_IRP_INFO;
-            packetHeader.dataLength = 0;
-
-            request = (struct _URB_PIPE_REQUEST*)pUrb;
-
-            DkDbgVal("URB PIPE REQUEST", request->PipeHandle);
-            epFound = USBPcapRetrieveEndpointInfo(pDeviceData,
-                                                  request->PipeHandle,
-                                                  &info);
-            if (epFound == TRUE)
-            {
-                packetHeader.device = info.deviceAddress;
-                packetHeader.endpoint = info.endpointAddress;
+                packetHeader->header.dataLength = transfer->TransferBufferLength;
             }
             else
             {
-                packetHeader.device = pDeviceData->deviceAddress;
-                packetHeader.endpoint = 0xFF;
-                packetHeader.transfer = USBPCAP_TRANSFER_UNKNOWN;
+                DkDbgStr("Failed to capture isochronous transfer buffer");
+                payloadCount = 0;
             }
+        }
+        else
+        {
+            /* Do not capture transfer buffer now */
+        }
+    }
 
+    packetHeader->startFrame      = transfer->StartFrame;
+    packetHeader->numberOfPackets = transfer->NumberOfPackets;
+    packetHeader->errorCount      = transfer->ErrorCount;
 
-            USBPcapBufferWritePacket(pDeviceData->pRootData,
-                                     &packetHeader,
-                                     NULL);
-            break;
-        }
+    if (payloadEntries != NULL)
+    {
+        payloadEntries[payloadCount].size = 0;
+        payloadEntries[payloadCount].buffer = NULL;
 
-        case URB_FUNCTION_GET_CURRENT_FRAME_NUMBER:
-        {
-            struct _URB_GET_CURRENT_FRAME_NUMBER  *request;
-            USBPCAP_BUFFER_PACKET_HEADER           packetHeader;
-            UINT32                                 frameNum;
-
-            request = (struct _URB_GET_CURRENT_FRAME_NUMBER*)pUrb;
-
-            packetHeader.headerLen  = sizeof(USBPCAP_BUFFER_PACKET_HEADER);
-            packetHeader.irpId      = (UINT64) pIrp;
-            packetHeader.status     = header->Status;
-            packetHeader.function   = header->Function;
-            packetHeader.info       = 0;
-            packetHeader.bus        = pDeviceData->pRootData->busId;
-            packetHeader.device     = pDeviceData->deviceAddress;
-            packetHeader.endpoint   = 0x80;
-            packetHeader.transfer   = USBPCAP_TRANSFER_IRP_INFO;
-            packetHeader.dataLength = 0;
-
-            if (post == TRUE)
-            {
-                packetHeader.info |= USBPCAP_INFO_PDO_TO_FDO;
-                frameNum = request->FrameNumber;
-                packetHeader.dataLength = sizeof(frameNum);
-            }
+        USBPcapBufferWritePayload(pDeviceData->pRootData,
+                                  (PUSBPCAP_BUFFER_PACKET_HEADER)packetHeader,
+                                  payloadEntries);
+        ExFreePool((PVOID)payloadEntries);
+    }
+    else
+    {
+        USBPcapBufferWritePacket(pDeviceData->pRootData,
+                                 (PUSBPCAP_BUFFER_PACKET_HEADER)packetHeader,
+                                 NULL);
+    }
 
-            USBPcapBufferWritePacket(pDeviceData->pRootData,
-                                     &packetHeader,
-                                     &frameNum);
-            break;
-        }
+    ExFreePool((PVOID)packetHeader);
+}
 
-        default:
-        {
-            if (post == FALSE)
-            {
-                KIRQL irql;
-                USBPCAP_URB_IRP_INFO info;
-
-                /* Record unknown URB function to table.
-                 * Some of the unknown URB change to control transfer on its way back
-                 * from the PDO to FDO.
-                 */
-                DkDbgVal("Recording unknown URB type in URB IRP table", header->Function);
-
-                info.irp = pIrp;
-                info.timestamp = USBPcapGetCurrentTimestamp();
-                info.status = header->Status;
-                info.function = header->Function;
-                info.info = 0;
-                info.bus = pDeviceData->pRootData->busId;
-                info.device = pDeviceData->deviceAddress;
-
-                KeAcquireSpinLock(&pDeviceData->tablesSpinLock, &irql);
-                USBPcapAddURBIRPInfo(pDeviceData->URBIrpTable, &info);
-                KeReleaseSpinLock(&pDeviceData->tablesSpinLock, irql);
-            }
-            else /* if (post == TRUE) */
-            {
-                USBPCAP_BUFFER_PACKET_HEADER  packetHeader;
+static VOID
+USBPcapEncodeIsochTransfer(PIRP pIrp, PURB pUrb, BOOLEAN post,
+                           PUSBPCAP_DEVICE_DATA pDeviceData, UCHAR requestType)
+{
+    USBPcapEncodeIsochBuffer(pIrp, pUrb, post, pDeviceData, FALSE);
+}
 
-                DkDbgVal("Unknown URB type", header->Function);
+static VOID
+USBPcapEncodeIsochTransferChained(PIRP pIrp, PURB pUrb, BOOLEAN post,
+                                  PUSBPCAP_DEVICE_DATA pDeviceData,
+                                  UCHAR requestType)
+{
+    USBPcapEncodeIsochBuffer(pIrp, pUrb, post, pDeviceData, TRUE);
+}
 
-                packetHeader.headerLen  = sizeof(USBPCAP_BUFFER_PACKET_HEADER);
-                packetHeader.irpId      = (UINT64) pIrp;
-                packetHeader.status     = header->Status;
-                packetHeader.function   = header->Function;
-                packetHeader.info       = USBPCAP_INFO_PDO_TO_FDO;
+#if (_WIN32_WINNT >= 0x0600)
+#define USBPCAP_ENCODE_CONTROL_TRANSFER_EX    USBPcapEncodeControlTransferEx
+#else
+#define USBPCAP_ENCODE_CONTROL_TRANSFER_EX    USBPcapEncodeUnknown
+#endif
 
-                packetHeader.bus        = pDeviceData->pRootData->busId;
-                packetHeader.device     = pDeviceData->deviceAddress;
-                packetHeader.endpoint   = 0;
-                packetHeader.transfer   = USBPCAP_TRANSFER_UNKNOWN;
-                packetHeader.dataLength = 0;
+#if (_WIN32_WINNT >= 0x0602)
+#define USBPCAP_ENCODE_OPEN_STATIC_STREAMS    USBPcapEncodeOpenStaticStreams
+#else
+#define USBPCAP_ENCODE_OPEN_STATIC_STREAMS    USBPcapEncodePipeRequest
+#endif
 
-                USBPcapBufferWritePacket(pDeviceData->pRootData, &packetHeader, NULL);
-            }
-        }
+/* One past URB_FUNCTION_ISOCH_TRANSFER_USING_CHAINED_MDL */
+#define USBPCAP_URB_FUNCTION_COUNT  0x0039
+
+/*
+ * URB dispatch table indexed by URB function.
+ *
+ * Reserved and undocumented functions are logged as unknown URBs.
+ */
+static const USBPCAP_URB_DISPATCH_ENTRY
+USBPcapURBDispatchTable[USBPCAP_URB_FUNCTION_COUNT] =
+{
+    /* 0x0000 URB_FUNCTION_SELECT_CONFIGURATION
+     * Host to Device, Standard, Device */
+    {USBPcapTrackSelectConfiguration, USBPcapEncodeSelectConfiguration, 0x00},
+    /* 0x0001 URB_FUNCTION_SELECT_INTERFACE
+     * Host to Device, Standard, Device */
+    {USBPcapTrackSelectInterface, USBPcapEncodeSelectInterface, 0x00},
+    /* 0x0002 URB_FUNCTION_ABORT_PIPE */
+    {NULL, USBPcapEncodePipeRequest, 0},
+    /* 0x0003 URB_FUNCTION_TAKE_FRAME_LENGTH_CONTROL */
+    {NULL, USBPcapEncodeFrameLengthControl, 0},
+    /* 0x0004 URB_FUNCTION_RELEASE_FRAME_LENGTH_CONTROL */
+    {NULL, USBPcapEncodeFrameLengthControl, 0},
+    /* 0x0005 URB_FUNCTION_GET_FRAME_LENGTH */
+    {NULL, USBPcapEncodeGetFrameLength, 0},
+    /* 0x0006 URB_FUNCTION_SET_FRAME_LENGTH */
+    {NULL, USBPcapEncodeSetFrameLength, 0},
+    /* 0x0007 URB_FUNCTION_GET_CURRENT_FRAME_NUMBER */
+    {NULL, USBPcapEncodeGetCurrentFrameNumber, 0},
+    /* 0x0008 URB_FUNCTION_CONTROL_TRANSFER */
+    {NULL, USBPcapEncodeControlTransfer, 0},
+    /* 0x0009 URB_FUNCTION_BULK_OR_INTERRUPT_TRANSFER */
+    {NULL, USBPcapEncodeBulkOrInterruptTransfer, 0},
+    /* 0x000A URB_FUNCTION_ISOCH_TRANSFER */
+    {NULL, USBPcapEncodeIsochTransfer, 0},
+    /* 0x000B URB_FUNCTION_GET_DESCRIPTOR_FROM_DEVICE
+     * Device to Host, Standard, Device */
+    {NULL, USBPcapEncodeDescriptorRequest, 0x80},
+    /* 0x000C URB_FUNCTION_SET_DESCRIPTOR_TO_DEVICE
+     * Host to Device, Standard, Device */
+    {NULL, USBPcapEncodeDescriptorRequest, 0x00},
+    /* 0x000D URB_FUNCTION_SET_FEATURE_TO_DEVICE
+     * Host to Device, Standard, Device */
+    {NULL, USBPcapEncodeSetFeature, 0x00},
+    /* 0x000E URB_FUNCTION_SET_FEATURE_TO_INTERFACE
+     * Host to Device, Standard, Interface */
+    {NULL, USBPcapEncodeSetFeature, 0x01},
+    /* 0x000F URB_FUNCTION_SET_FEATURE_TO_ENDPOINT
+     * Host to Device, Standard, Endpoint */
+    {NULL, USBPcapEncodeSetFeature, 0x02},
+    /* 0x0010 URB_FUNCTION_CLEAR_FEATURE_TO_DEVICE
+     * Host to Device, Standard, Device */
+    {NULL, USBPcapEncodeClearFeature, 0x00},
+    /* 0x0011 URB_FUNCTION_CLEAR_FEATURE_TO_INTERFACE
+     * Host to Device, Standard, Interface */
+    {NULL, USBPcapEncodeClearFeature, 0x01},
+    /* 0x0012 URB_FUNCTION_CLEAR_FEATURE_TO_ENDPOINT
+     * Host to Device, Standard, Endpoint */
+    {NULL, USBPcapEncodeClearFeature, 0x02},
+    /* 0x0013 URB_FUNCTION_GET_STATUS_FROM_DEVICE
+     * Device to Host, Standard, Device */
+    {NULL, USBPcapEncodeGetStatus, 0x80},
+    /* 0x0014 URB_FUNCTION_GET_STATUS_FROM_INTERFACE
+     * Device to Host, Standard, Interface */
+    {NULL, USBPcapEncodeGetStatus, 0x81},
+    /* 0x0015 URB_FUNCTION_GET_STATUS_FROM_ENDPOINT
+     * Device to Host, Standard, Endpoint */
+    {NULL, USBPcapEncodeGetStatus, 0x82},
+    /* 0x0016 URB_FUNCTION_RESERVED_0X0016 */
+    {NULL, USBPcapEncodeUnknown, 0},
+    /* 0x0017 URB_FUNCTION_VENDOR_DEVICE
+     * Vendor, Device */
+    {NULL, USBPcapEncodeVendorOrClassRequest, 0x40},
+    /* 0x0018 URB_FUNCTION_VENDOR_INTERFACE
+     * Vendor, Interface */
+    {NULL, USBPcapEncodeVendorOrClassRequest, 0x41},
+    /* 0x0019 URB_FUNCTION_VENDOR_ENDPOINT
+     * Vendor, Endpoint */
+    {NULL, USBPcapEncodeVendorOrClassRequest, 0x42},
+    /* 0x001A URB_FUNCTION_CLASS_DEVICE
+     * Class, Device */
+    {NULL, USBPcapEncodeVendorOrClassRequest, 0x20},
+    /* 0x001B URB_FUNCTION_CLASS_INTERFACE
+     * Class, Interface */
+    {NULL, USBPcapEncodeVendorOrClassRequest, 0x21},
+    /* 0x001C URB_FUNCTION_CLASS_ENDPOINT
+     * Class, Endpoint */
+    {NULL, USBPcapEncodeVendorOrClassRequest, 0x22},
+    /* 0x001D URB_FUNCTION_RESERVE_0X001D */
+    {NULL, USBPcapEncodeUnknown, 0},
+    /* 0x001E URB_FUNCTION_SYNC_RESET_PIPE_AND_CLEAR_STALL */
+    {NULL, USBPcapEncodePipeRequest, 0},
+    /* 0x001F URB_FUNCTION_CLASS_OTHER
+     * Class, Other */
+    {NULL, USBPcapEncodeVendorOrClassRequest, 0x23},
+    /* 0x0020 URB_FUNCTION_VENDOR_OTHER
+     * Vendor, Other */
+    {NULL, USBPcapEncodeVendorOrClassRequest, 0x43},
+    /* 0x0021 URB_FUNCTION_GET_STATUS_FROM_OTHER
+     * Device to Host, Standard, Other */
+    {NULL, USBPcapEncodeGetStatus, 0x83},
+    /* 0x0022 URB_FUNCTION_CLEAR_FEATURE_TO_OTHER
+     * Host to Device, Standard, Other */
+    {NULL, USBPcapEncodeClearFeature, 0x03},
+    /* 0x0023 URB_FUNCTION_SET_FEATURE_TO_OTHER
+     * Host to Device, Standard, Other */
+    {NULL, USBPcapEncodeSetFeature, 0x03},
+    /* 0x0024 URB_FUNCTION_GET_DESCRIPTOR_FROM_ENDPOINT
+     * Device to Host, Standard, Endpoint */
+    {NULL, USBPcapEncodeDescriptorRequest, 0x82},
+    /* 0x0025 URB_FUNCTION_SET_DESCRIPTOR_TO_ENDPOINT
+     * Host to Device, Standard, Endpoint */
+    {NULL, USBPcapEncodeDescriptorRequest, 0x02},
+    /* 0x0026 URB_FUNCTION_GET_CONFIGURATION
+     * Device to Host, Standard, Device */
+    {NULL, USBPcapEncodeGetConfiguration, 0x80},
+    /* 0x0027 URB_FUNCTION_GET_INTERFACE
+     * Device to Host, Standard, Interface */
+    {NULL, USBPcapEncodeGetInterface, 0x81},
+    /* 0x0028 URB_FUNCTION_GET_DESCRIPTOR_FROM_INTERFACE
+     * Device to Host, Standard, Interface */
+    {NULL, USBPcapEncodeDescriptorRequest, 0x81},
+    /* 0x0029 URB_FUNCTION_SET_DESCRIPTOR_TO_INTERFACE
+     * Host to Device, Standard, Interface */
+    {NULL, USBPcapEncodeDescriptorRequest, 0x01},
+    /* 0x002A URB_FUNCTION_GET_MS_FEATURE_DESCRIPTOR
+     * Device to Host, Vendor, recipient taken from URB */
+    {NULL, USBPcapEncodeGetMSFeatureDescriptor, 0xC0},
+    /* 0x002B - 0x002F Reserved */
+    {NULL, USBPcapEncodeUnknown, 0},
+    {NULL, USBPcapEncodeUnknown, 0},
+    {NULL, USBPcapEncodeUnknown, 0},
+    {NULL, USBPcapEncodeUnknown, 0},
+    {NULL, USBPcapEncodeUnknown, 0},
+    /* 0x0030 URB_FUNCTION_SYNC_RESET_PIPE */
+    {NULL, USBPcapEncodePipeRequest, 0},
+    /* 0x0031 URB_FUNCTION_SYNC_CLEAR_STALL */
+    {NULL, USBPcapEncodePipeRequest, 0},
+    /* 0x0032 URB_FUNCTION_CONTROL_TRANSFER_EX */
+    {NULL, USBPCAP_ENCODE_CONTROL_TRANSFER_EX, 0},
+    /* 0x0033 URB_FUNCTION_SET_PIPE_IO_POLICY (Reserved) */
+    {NULL, USBPcapEncodeUnknown, 0},
+    /* 0x0034 URB_FUNCTION_GET_PIPE_IO_POLICY (Reserved) */
+    {NULL, USBPcapEncodeUnknown, 0},
+    /* 0x0035 URB_FUNCTION_OPEN_STATIC_STREAMS */
+    {NULL, USBPCAP_ENCODE_OPEN_STATIC_STREAMS, 0},
+    /* 0x0036 URB_FUNCTION_CLOSE_STATIC_STREAMS */
+    {NULL, USBPcapEncodePipeRequest, 0},
+    /* 0x0037 URB_FUNCTION_BULK_OR_INTERRUPT_TRANSFER_USING_CHAINED_MDL */
+    {NULL, USBPcapEncodeBulkOrInterruptTransferChained, 0},
+    /* 0x0038 URB_FUNCTION_ISOCH_TRANSFER_USING_CHAINED_MDL */
+    {NULL, USBPcapEncodeIsochTransferChained, 0},
+};
+
+#if (_WIN32_WINNT >= 0x0602)
+C_ASSERT(URB_FUNCTION_ISOCH_TRANSFER_USING_CHAINED_MDL + 1 == USBPCAP_URB_FUNCTION_COUNT);
+#endif
+
+static const USBPCAP_URB_DISPATCH_ENTRY USBPcapURBUnknownEntry =
+    {NULL, USBPcapEncodeUnknown, 0};
+
+/*
+ * Analyzes the URB
+ *
+ * post is FALSE when the request is being on its way to the bus driver
+ * post is TRUE when the request returns from the bus driver
+ */
+VOID USBPcapAnalyzeURB(PIRP pIrp, PURB pUrb, BOOLEAN post,
+                       PUSBPCAP_DEVICE_DATA pDeviceData)
+{
+    const USBPCAP_URB_DISPATCH_ENTRY *entry;
+    USHORT                            function;
+
+    ASSERT(pUrb != NULL);
+    ASSERT(pDeviceData != NULL);
+    ASSERT(pDeviceData->pRootData != NULL);
+
+    function = pUrb->UrbHeader.Function;
+    if (function < USBPCAP_URB_FUNCTION_COUNT)
+    {
+        entry = &USBPcapURBDispatchTable[function];
+    }
+    else
+    {
+        entry = &USBPcapURBUnknownEntry;
+    }
+
+    /* Device state is always tracked. We are interested only in URBs
+     * after the fields are set by host controller driver.
+     */
+    if ((post == TRUE) && (entry->track != NULL))
+    {
+        entry->track(pUrb, pDeviceData);
     }
+
+    if (USBPcapIsDeviceFiltered(&pDeviceData->pRootData->filter,
+                                (int)pDeviceData->deviceAddress) == FALSE)
+    {
+        /* Do not log URBs from devices which are not being filtered */
+        return;
+    }
+
+    entry->encode(pIrp, pUrb, post, pDeviceData, entry->requestType);
 }
@@ -56,6 +56,80 @@ typedef struct _USBPCAP_ADDRESS_FILTER
 #define IOCTL_USBPCAP_SET_SNAPLEN_SIZE \
     CTL_CODE(FILE_DEVICE_UNKNOWN, 0x804, METHOD_BUFFERED, FILE_READ_ACCESS)
 
+/* USBPCAP_IOCTL_OPTIONS is input of IOCTL_USBPCAP_SET_OPTIONS.
+ * Options can be changed only before IOCTL_USBPCAP_SETUP_BUFFER.
+ *
+ * USBPCAP_OPTION_SEQUENCE_NUMBERS - every packet gets per-Root Hub
+ *     sequence number, see USBPCAP_INFO_SEQUENCE. Numbers are assigned in
+ *     the order packets are stored in the driver buffer. Packets dropped
+ *     due to lack of buffer space consume their number too, so gaps in
+ *     the numbers reveal dropped packets.
+ * USBPCAP_OPTION_COMPACT_RING - packets are kept in the driver buffer in
+ *     compact form, with most of the pcap record and packet headers delta
+ *     encoded. Data read from the device is expanded back and is the same
+ *     as without this option. Buffer holds several times more small packets.
+ * USBPCAP_OPTION_COMPRESS_PAYLOAD - payloads of at least 256 bytes are
+ *     LZ compressed when stored in the driver buffer, if it makes them
+ *     shorter. Such packets are returned compressed, see
+ *     USBPCAP_INFO_COMPRESSED. Cannot be combined with
+ *     USBPCAP_OPTION_COMPACT_RING.
+ * USBPCAP_OPTION_ALIGNED_RING - every packet starts on cache line boundary
+ *     in the driver buffer and is never split at buffer end, so it is
+ *     stored and read with single copy. Buffer size is rounded down to
+ *     power of two. Data read from the device is the same as without this
+ *     option. Cannot be combined with USBPCAP_OPTION_COMPACT_RING.
+ */
+#define USBPCAP_OPTION_SEQUENCE_NUMBERS  (1 << 0)
+#define USBPCAP_OPTION_COMPACT_RING      (1 << 1)
+#define USBPCAP_OPTION_COMPRESS_PAYLOAD  (1 << 2)
+#define USBPCAP_OPTION_ALIGNED_RING      (1 << 3)
+
+typedef struct
+{
+    UINT32  options;
+} USBPCAP_IOCTL_OPTIONS, *PUSBPCAP_IOCTL_OPTIONS;
+
+#define IOCTL_USBPCAP_SET_OPTIONS \
+    CTL_CODE(FILE_DEVICE_UNKNOWN, 0x806, METHOD_BUFFERED, FILE_READ_ACCESS)
+
+#pragma pack(push, 1)
+/* USBPCAP_IOCTL_PENDING_INFO is output of IOCTL_USBPCAP_GET_PENDING_INFO.
+ *
+ * URBs are tracked only for devices that are being filtered.
+ */
+typedef struct _USBPCAP_IOCTL_PENDING_INFO
+{
+    /* Number of tracked URBs that were not completed yet */
+    UINT32  outstanding;
+    /* Number of URBs not tracked because device tracker was full */
+    UINT32  untracked;
+    /* Longest time it took to complete tracked URB in milliseconds */
+    UINT32  slowestCompletion;
+    /* Age of the oldest outstanding URB in milliseconds */
+    UINT32  oldestAge;
+    /* Oldest outstanding URB. Valid only if outstanding is not zero.
+     * oldestIrpId matches irpId of the URB records in the capture.
+     */
+    UINT64  oldestIrpId;
+    USHORT  oldestFunction;
+    USHORT  oldestDevice;
+    UCHAR   oldestEndpoint;
+} USBPCAP_IOCTL_PENDING_INFO, *PUSBPCAP_IOCTL_PENDING_INFO;
+#pragma pack(pop)
+
+/* Allowed only for the capture handle, like the other capture IOCTLs. */
+#define IOCTL_USBPCAP_GET_PENDING_INFO \
+    CTL_CODE(FILE_DEVICE_UNKNOWN, 0x805, METHOD_BUFFERED, FILE_READ_ACCESS)
+
+/* Output is UINT64 value that changes whenever any device under the Root
+ * Hub arrives, starts, is removed or hub port status changes. The value is
+ * never reused, also after Root Hub or driver restart, so it can be stored
+ * to find out whether cached topology is still valid.
+ * Allowed for any handle, like IOCTL_USBPCAP_GET_HUB_SYMLINK.
+ */
+#define IOCTL_USBPCAP_GET_TOPOLOGY_GENERATION \
+    CTL_CODE(FILE_DEVICE_UNKNOWN, 0x807, METHOD_BUFFERED, FILE_ANY_ACCESS)
+
 /* USB packets, beginning with a USBPcap header */
 #define DLT_USBPCAP         249
 
@@ -91,9 +165,45 @@ typedef struct pcaprec_hdr_s {
 
 /* info byte fields:
  * bit 0 (LSB) - when 1: PDO -> FDO
- * bits 1-7: Reserved
+ * bit 1 - when 1: URB is still pending. Packet is USBPCAP_TRANSFER_IRP_INFO
+ *         with 4 bytes payload: time since submission in milliseconds.
+ * bit 2 - when 1: Packet is USBPCAP_TRANSFER_IRP_INFO device PnP event.
+ *         See USBPCAP_PNP_EVENT below.
+ * bit 3 - when 1: Packet is USBPCAP_TRANSFER_IRP_INFO record of power IRP
+ *         or internal IOCTL other than URB submission. Bit 0 tells if it
+ *         is the submission or completion. See USBPCAP_IRP_EVENT below.
+ * bit 4 - when 1: Packet is USBPCAP_TRANSFER_IRP_INFO annotation written
+ *         to the capture handle. function is USBPCAP_FUNCTION_EVENT and
+ *         payload is the data that was written.
+ * bit 5 - when 1: Packet header ends with UINT64 sequence number, i.e. it
+ *         is stored at headerLen - 8 offset. Header specific to transfer
+ *         type (if any) precedes it. See USBPCAP_OPTION_SEQUENCE_NUMBERS.
+ * bit 6 - when 1: Packet data following headerLen bytes is compressed.
+ *         Data is single USBPcapCMD lzblock.h block, that decompresses to
+ *         min(orig_len, snaplen) - headerLen bytes. pcap record incl_len
+ *         is headerLen plus compressed length, dataLength is not changed.
+ *         See USBPCAP_OPTION_COMPRESS_PAYLOAD.
+ * bit 7: Reserved
  */
 #define USBPCAP_INFO_PDO_TO_FDO  (1 << 0)
+#define USBPCAP_INFO_PENDING     (1 << 1)
+#define USBPCAP_INFO_PNP         (1 << 2)
+#define USBPCAP_INFO_IRP         (1 << 3)
+#define USBPCAP_INFO_ANNOTATION  (1 << 4)
+#define USBPCAP_INFO_SEQUENCE    (1 << 5)
+#define USBPCAP_INFO_COMPRESSED  (1 << 6)
+
+/* function value of USBPCAP_TRANSFER_IRP_INFO packets that do not describe
+ * URB (PnP, IRP and annotation packets). It is not a valid URB function,
+ * event specific code is stored in the payload.
+ */
+#define USBPCAP_FUNCTION_EVENT   0xFFFF
+
+/* Maximum number of bytes in single write to the capture handle.
+ * Every write is stored as one USBPCAP_INFO_ANNOTATION packet, timestamped
+ * and ordered together with captured URBs.
+ */
+#define USBPCAP_MAX_ANNOTATION_LENGTH  4096
 
 #pragma pack(push, 1)
 typedef struct
@@ -113,6 +223,50 @@ typedef struct
 } USBPCAP_BUFFER_PACKET_HEADER, *PUSBPCAP_BUFFER_PACKET_HEADER;
 #pragma pack(pop)
 
+/* PnP event packets have USBPCAP_INFO_PNP set in info field.
+ * irpId is the device PDO address and stays the same for all events of
+ * given device, function is USBPCAP_FUNCTION_EVENT and USBPCAP_PNP_EVENT
+ * is the packet payload.
+ *
+ * device is 255 until device address is known.
+ */
+#define USBPCAP_PNP_EVENT_ARRIVAL          0 /* Hub reported new child */
+#define USBPCAP_PNP_EVENT_START            1 /* IRP_MN_START_DEVICE completed */
+#define USBPCAP_PNP_EVENT_ADDRESS          2 /* Device address retrieved */
+#define USBPCAP_PNP_EVENT_SURPRISE_REMOVAL 3 /* IRP_MN_SURPRISE_REMOVAL */
+#define USBPCAP_PNP_EVENT_REMOVE           4 /* IRP_MN_REMOVE_DEVICE */
+
+#pragma pack(push, 1)
+typedef struct
+{
+    USHORT  event;         /* One of USBPCAP_PNP_EVENT_* values */
+    UINT32  status;        /* NTSTATUS of the operation */
+    USHORT  port;          /* port on parent hub, 0 if not known */
+    USHORT  parentDevice;  /* parent hub address, 0 for Root Hub */
+    UCHAR   isHub;         /* 1 if device is a hub */
+} USBPCAP_PNP_EVENT, *PUSBPCAP_PNP_EVENT;
+#pragma pack(pop)
+
+/* Power and internal IOCTL packets have USBPCAP_INFO_IRP set in info
+ * field. irpId identifies the IRP, function is USBPCAP_FUNCTION_EVENT.
+ * USBPCAP_IRP_EVENT is the packet payload, its minorFunction is the power
+ * IRP minor function and ioControlCode the internal IOCTL code.
+ */
+#pragma pack(push, 1)
+typedef struct
+{
+    UINT32  status;         /* NTSTATUS, 0 on submission */
+    UCHAR   majorFunction;  /* IRP_MJ_POWER or IRP_MJ_INTERNAL_DEVICE_CONTROL */
+    UCHAR   minorFunction;  /* Power IRP minor function */
+    UINT32  ioControlCode;  /* Internal IOCTL code, 0 for power IRPs */
+    UINT32  powerType;      /* POWER_STATE_TYPE, SystemPowerState or
+                             * DevicePowerState */
+    UINT32  powerState;     /* Requested SYSTEM_POWER_STATE or
+                             * DEVICE_POWER_STATE */
+    UINT32  portStatus;     /* IOCTL_INTERNAL_USB_GET_PORT_STATUS result */
+} USBPCAP_IRP_EVENT, *PUSBPCAP_IRP_EVENT;
+#pragma pack(pop)
+
 /* USBPcap versions before 1.5.0.0 recorded control transactions as two
  * or three pcap packets:
  *   * USBPCAP_CONTROL_STAGE_SETUP with 8 bytes USB SETUP data